@@ -31,8 +31,9 @@ except:
 with open(input_path, "r") as input_file:
     with open(output_path, "w") as output_file:
 
-        # Work out what our define will be
-        define = os.path.basename(input_path)[:-3].replace(os.sep, "_").upper()
+        # Work out what our define will be, OpenCL files end in _CL and CUDA files end in _CU
+        name, extension = os.path.splitext(os.path.basename(input_path))
+        define = "{}_{}".format(name.replace(os.sep, "_").upper(), extension[1:].upper())
 
-        output_file.write('constexpr const char* {}_CL = R"({})";'.format(define, input_file.read()))
+        output_file.write('constexpr const char* {} = R"({})";'.format(define, input_file.read()))
         output_file.write("\n")
@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef VISUALMESH_ADAPTIVE_VISUALMESH_HPP
+#define VISUALMESH_ADAPTIVE_VISUALMESH_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "visualmesh/lens.hpp"
+#include "visualmesh/mesh.hpp"
+#include "visualmesh/model/ring6.hpp"
+#include "visualmesh/utility/math.hpp"
+#include "visualmesh/visualmesh.hpp"
+
+namespace visualmesh {
+
+/**
+ * @brief Several VisualMeshes of different densities where each frame uses the densest one that fits a latency budget
+ *
+ * @details
+ *  The number of points that are on screen, and so the time the engine takes, depends on where the camera is looking.
+ *  Looking toward the horizon puts far more of the mesh on screen than looking at the ground. A VisualMesh is built for
+ *  each of a list of k values, and for each frame the on screen point count of each level is found from the sizes of
+ *  its lookup ranges, starting from the densest. The first level whose predicted latency is within the budget is used.
+ *
+ *  The latency is predicted with a linear model of the engine's time per frame against the number of points. The model
+ *  is fitted by least squares to the times passed to report, with older frames weighted down exponentially so it
+ *  follows changes such as thermal throttling. Until any times have been reported the densest level is always chosen.
+ *
+ *  select and report are thread safe.
+ *
+ * @tparam Scalar the type that will hold the vectors <float, double>
+ * @tparam Model  the model used to generate the mesh in each of the individual heights
+ */
+template <typename Scalar = float, template <typename> class Model = model::Ring6>
+class AdaptiveVisualMesh {
+public:
+    /// The level chosen for a frame
+    struct Selection {
+        /// The mesh to use for this frame
+        const Mesh<Scalar, Model>* mesh;
+        /// The index of the level the mesh is from, 0 is the densest
+        std::size_t level;
+        /// The number of points the lookup found on screen for the mesh
+        std::size_t points;
+        /// The predicted time for the engine to process the frame in seconds
+        double seconds;
+    };
+
+    /**
+     * @brief Generate a VisualMesh for each number of intersections
+     *
+     * @tparam Shape the shape type that this mesh will generate using
+     *
+     * @param shape        the shape we are generating a visual mesh for
+     * @param min_height   the minimum height that our camera will be at
+     * @param max_height   the maximum height our camera will be at
+     * @param ks           the numbers of intersections with the object for each level, in any order
+     * @param max_error    the maximum amount of error in terms of k that a mesh can have
+     * @param max_distance the maximum distance that this mesh will project for
+     * @param budget       the time in seconds that the engine should take for each frame
+     * @param forgetting   how much the weight of each reported frame decays with every new report, between 0 and 1
+     * @param concurrency  how many threads to use to build the meshes for each level
+     */
+    template <typename Shape>
+    AdaptiveVisualMesh(const Shape& shape,
+                       const Scalar& min_height,
+                       const Scalar& max_height,
+                       std::vector<Scalar> ks,
+                       const Scalar& max_error,
+                       const Scalar& max_distance,
+                       const double& budget,
+                       const double& forgetting        = 0.95,
+                       const unsigned int& concurrency = std::thread::hardware_concurrency())
+      : frame_budget(budget), forgetting(forgetting) {
+        if (ks.empty()) { throw std::invalid_argument("An adaptive visual mesh needs at least one level"); }
+
+        // Densest first so the first level that fits the budget is the best one
+        std::sort(ks.begin(), ks.end(), std::greater<Scalar>());
+        for (const auto& k : ks) {
+            levels.emplace_back(shape, min_height, max_height, k, max_error, max_distance, concurrency);
+        }
+    }
+
+    /**
+     * @brief Choose the densest level whose predicted latency for this frame fits in the budget
+     *
+     * @details
+     *  If no level fits the sparsest level is chosen.
+     *
+     * @param Hoc  the homogenous transformation matrix that transforms from camera space to observation plane space
+     * @param lens the lens object describing the type and geometry of the lens that is used
+     *
+     * @return the mesh to use for this frame along with its predicted point count and latency
+     */
+    Selection select(const mat4<Scalar>& Hoc, const Lens<Scalar>& lens) const {
+        std::vector<std::pair<int, int>> ranges;
+        Selection selection{};
+        for (std::size_t i = 0; i < levels.size(); ++i) {
+            const Mesh<Scalar, Model>& mesh = levels[i].height(Hoc[2][3]);
+            mesh.lookup(Hoc, lens, ranges);
+
+            std::size_t points = 0;
+            for (const auto& r : ranges) {
+                points += r.second - r.first;
+            }
+
+            selection = Selection{&mesh, i, points, predict(points)};
+            if (selection.seconds <= frame_budget) { break; }
+        }
+        return selection;
+    }
+
+    /**
+     * @brief Report how long the engine took for a frame so the latency model can be updated
+     *
+     * @param points  the number of points in the frame, the points of the Selection or the size of the engine's output
+     * @param seconds the time the engine took for the frame
+     */
+    void report(const std::size_t& points, const double& seconds) {
+        const double n = double(points);
+        std::lock_guard<std::mutex> lock(mutex);
+        weight = forgetting * weight + 1.0;
+        sum_n  = forgetting * sum_n + n;
+        sum_t  = forgetting * sum_t + seconds;
+        sum_nn = forgetting * sum_nn + n * n;
+        sum_nt = forgetting * sum_nt + n * seconds;
+    }
+
+    /**
+     * @brief Predict how long the engine will take for a frame with a number of points
+     *
+     * @param points the number of points in the frame
+     *
+     * @return the predicted time in seconds, or 0 if no frames have been reported yet
+     */
+    double predict(const std::size_t& points) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (weight == 0.0 || sum_n <= 0.0) { return 0.0; }
+
+        // Least squares fit of seconds = a + b * points, if the points haven't varied enough to fit a slope or the fit
+        // has a negative slope use the average time per point instead
+        const double variance = weight * sum_nn - sum_n * sum_n;
+        if (variance > 1e-9 * weight * sum_nn) {
+            const double b = (weight * sum_nt - sum_n * sum_t) / variance;
+            if (b > 0.0) {
+                const double a = (sum_t - b * sum_n) / weight;
+                return a + b * double(points);
+            }
+        }
+        return sum_t / sum_n * double(points);
+    }
+
+    /// @return the time in seconds that the engine should take for each frame
+    double budget() const {
+        return frame_budget;
+    }
+
+    /// Change the time in seconds that the engine should take for each frame
+    void budget(const double& seconds) {
+        frame_budget = seconds;
+    }
+
+    /// @return the number of levels
+    std::size_t size() const {
+        return levels.size();
+    }
+
+    /// @return the VisualMesh for a level, 0 is the densest
+    const VisualMesh<Scalar, Model>& level(const std::size_t& i) const {
+        return levels[i];
+    }
+
+private:
+    /// The meshes for each level, densest first
+    std::vector<VisualMesh<Scalar, Model>> levels;
+    /// The time in seconds that the engine should take for each frame
+    std::atomic<double> frame_budget;
+    /// How much the weight of each reported frame decays with every new report
+    double forgetting;
+
+    /// The decayed number of reported frames
+    double weight = 0.0;
+    /// The decayed sum of the point counts
+    double sum_n = 0.0;
+    /// The decayed sum of the times
+    double sum_t = 0.0;
+    /// The decayed sum of the squared point counts
+    double sum_nn = 0.0;
+    /// The decayed sum of the point counts multiplied by the times
+    double sum_nt = 0.0;
+    /// Guards the latency model
+    mutable std::mutex mutex;
+};
+
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_ADAPTIVE_VISUALMESH_HPP
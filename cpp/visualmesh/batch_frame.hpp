@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef VISUALMESH_BATCH_FRAME_HPP
+#define VISUALMESH_BATCH_FRAME_HPP
+
+#include <cstdint>
+
+#include "lens.hpp"
+#include "mesh.hpp"
+#include "utility/math.hpp"
+
+namespace visualmesh {
+
+/**
+ * @brief Describes one frame of a batch that is classified in a single call to an engine
+ *
+ * @details
+ *  The engines concatenate the projected points of every frame in a batch so that each layer of the network only needs
+ *  to be run once for the whole batch. Each frame can come from a different camera with its own mesh, lens and image.
+ *
+ * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+ * @tparam Model  the mesh model that we are projecting
+ */
+template <typename Scalar, template <typename> class Model>
+struct BatchFrame {
+    /// The mesh to project, for a VisualMesh this is mesh.height(Hoc[2][3])
+    const Mesh<Scalar, Model>* mesh;
+    /// The homogenous transformation matrix from the camera to the observation plane
+    mat4<Scalar> Hoc;
+    /// The lens parameters that describe the optics of the camera
+    Lens<Scalar> lens;
+    /// The data that represents the image the network will run from
+    const void* image;
+    /// The pixel format of this image as a fourcc code
+    uint32_t format;
+};
+
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_BATCH_FRAME_HPP
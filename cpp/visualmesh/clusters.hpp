@@ -0,0 +1,265 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_CLUSTERS_HPP
+#define VISUALMESH_CLUSTERS_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "classified_mesh.hpp"
+#include "mesh.hpp"
+#include "utility/cone.hpp"
+#include "utility/math.hpp"
+#include "utility/thread_pool.hpp"
+
+namespace visualmesh {
+
+/**
+ * @brief A group of points whose score for a class passed a threshold and that are connected through the mesh graph
+ *
+ * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+ */
+template <typename Scalar>
+struct Cluster {
+    /// The global indices in the mesh of the points in the cluster, in the order they were on the screen
+    std::vector<int> points;
+    /// The smallest pixel coordinates (x,y) of the points in the cluster
+    vec2<Scalar> min_pixel;
+    /// The largest pixel coordinates (x,y) of the points in the cluster
+    vec2<Scalar> max_pixel;
+    /// The mean pixel coordinates (x,y) of the points in the cluster
+    vec2<Scalar> centroid;
+    /// The axis in observation space of the smallest cone that holds the rays of every point in the cluster
+    vec3<Scalar> axis;
+    /// The cosine and sine of the half angle of that cone
+    vec2<Scalar> cone;
+};
+
+namespace cluster_detail {
+
+    /**
+     * @brief Find the root of the set a point is in, halving the path to it as it goes
+     *
+     * @details
+     *  Roots are only ever linked below smaller roots, so the parent of a point is never larger than the point and a
+     *  stale parent is still in the same set. That makes it safe to run alongside unite from other threads.
+     */
+    inline int find(std::vector<std::atomic<int>>& parent, int x) {
+        int p = parent[x].load(std::memory_order_relaxed);
+        while (p != x) {
+            const int g = parent[p].load(std::memory_order_relaxed);
+            if (g != p) { parent[x].compare_exchange_weak(p, g, std::memory_order_relaxed); }
+            x = p;
+            p = parent[x].load(std::memory_order_relaxed);
+        }
+        return x;
+    }
+
+    /**
+     * @brief Join the sets that two points are in, linking the larger root below the smaller one
+     */
+    inline void unite(std::vector<std::atomic<int>>& parent, int a, int b) {
+        while (true) {
+            a = find(parent, a);
+            b = find(parent, b);
+            if (a == b) { return; }
+            if (a < b) { std::swap(a, b); }
+            int expected = a;
+            if (parent[a].compare_exchange_strong(expected, b, std::memory_order_relaxed)) { return; }
+        }
+    }
+
+}  // namespace cluster_detail
+
+/**
+ * @brief Group labelled points into clusters, measuring their extent on the screen and in observation space
+ *
+ * @details
+ *  Points with the same label are in the same cluster and points with a negative label are in none. Clusters are
+ *  ordered by their smallest label, so labels that are the smallest index in each cluster give clusters in the order
+ *  their first point is on the screen.
+ *
+ * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+ * @tparam Model  the mesh model of the mesh
+ *
+ * @param mesh           the mesh the points came from, whose rays make the cones
+ * @param pixels         the pixel coordinates of each point
+ * @param global_indices the global index in the mesh of each point
+ * @param labels         the label of each point
+ * @param min_points     clusters with fewer points than this are dropped
+ * @param pool           a thread pool to find the cones of the clusters with, or nullptr to use this thread
+ *
+ * @return the clusters
+ */
+template <typename Scalar, template <typename> class Model>
+std::vector<Cluster<Scalar>> gather_clusters(const Mesh<Scalar, Model>& mesh,
+                                             const std::vector<std::array<Scalar, 2>>& pixels,
+                                             const std::vector<int>& global_indices,
+                                             const std::vector<int>& labels,
+                                             const std::size_t& min_points = 1,
+                                             ThreadPool* pool                = nullptr) {
+    // Give each label a cluster in order of label
+    int max_label = -1;
+    for (const auto& label : labels) {
+        max_label = std::max(max_label, label);
+    }
+    std::vector<int> counts(max_label + 1, 0);
+    for (const auto& label : labels) {
+        if (label >= 0) { ++counts[label]; }
+    }
+    std::vector<int> cluster_of(max_label + 1, -1);
+    std::vector<Cluster<Scalar>> clusters;
+    for (int label = 0; label <= max_label; ++label) {
+        if (counts[label] > 0 && std::size_t(counts[label]) >= std::max(min_points, std::size_t(1))) {
+            cluster_of[label] = int(clusters.size());
+            clusters.emplace_back();
+            clusters.back().points.reserve(counts[label]);
+            clusters.back().min_pixel = {std::numeric_limits<Scalar>::max(), std::numeric_limits<Scalar>::max()};
+            clusters.back().max_pixel = {std::numeric_limits<Scalar>::lowest(), std::numeric_limits<Scalar>::lowest()};
+            clusters.back().centroid  = {Scalar(0), Scalar(0)};
+        }
+    }
+
+    // Accumulate the points of each cluster on the screen
+    for (std::size_t i = 0; i < labels.size(); ++i) {
+        if (labels[i] < 0 || cluster_of[labels[i]] < 0) { continue; }
+        auto& cluster = clusters[cluster_of[labels[i]]];
+        const auto& p = pixels[i];
+        cluster.points.push_back(global_indices[i]);
+        cluster.min_pixel = {std::min(cluster.min_pixel[0], p[0]), std::min(cluster.min_pixel[1], p[1])};
+        cluster.max_pixel = {std::max(cluster.max_pixel[0], p[0]), std::max(cluster.max_pixel[1], p[1])};
+        cluster.centroid  = add(cluster.centroid, p);
+    }
+
+    // The cones are the expensive part so the clusters are shared between threads
+    auto cones = [&](const std::size_t& begin, const std::size_t& end) {
+        for (std::size_t c = begin; c < end; ++c) {
+            auto& cluster    = clusters[c];
+            cluster.centroid = multiply(cluster.centroid, Scalar(1) / Scalar(cluster.points.size()));
+
+            // The cone search runs in expected linear time when the rays are in a random order, a fixed seed
+            // keeps the results the same between runs
+            std::vector<vec3<Scalar>> rays;
+            rays.reserve(cluster.points.size());
+            for (const auto& point : cluster.points) {
+                const auto& ray = mesh.nodes[point].ray;
+                rays.push_back(vec3<Scalar>{Scalar(ray[0]), Scalar(ray[1]), Scalar(ray[2])});
+            }
+            std::shuffle(rays.begin(), rays.end(), std::minstd_rand(static_cast<unsigned>(c + 1)));
+            const auto cone = smallest_cone(rays);
+            cluster.axis    = cone.first;
+            cluster.cone    = {cone.second, std::sqrt(std::max(Scalar(0), Scalar(1) - cone.second * cone.second))};
+        }
+    };
+    if (pool != nullptr) { pool->parallel_for(clusters.size(), cones); }
+    else {
+        cones(0, clusters.size());
+    }
+
+    return clusters;
+}
+
+/**
+ * @brief Find the clusters of points in a classified mesh whose score for a class passes a threshold
+ *
+ * @details
+ *  Points that pass are joined with each of their neighbours that also pass using a lock free union find, which is
+ *  shared between the threads of the pool if one is given.
+ *
+ * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+ * @tparam Model  the mesh model of the mesh
+ *
+ * @param mesh       the mesh that was classified, whose rays make the cones
+ * @param classified the classified mesh to find the clusters in
+ * @param cls        the index of the class in the output of the network to threshold on
+ * @param min_score  the lowest score for the class that a point can have and be in a cluster
+ * @param min_points clusters with fewer points than this are dropped
+ * @param pool       a thread pool to share the work between, or nullptr to use this thread
+ *
+ * @return the clusters, in the order their first point is on the screen
+ */
+template <typename Scalar, template <typename> class Model>
+std::vector<Cluster<Scalar>> find_clusters(const Mesh<Scalar, Model>& mesh,
+                                           const ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS>& classified,
+                                           const int& cls,
+                                           const Scalar& min_score,
+                                           const std::size_t& min_points = 1,
+                                           ThreadPool* pool                = nullptr) {
+    static constexpr int N_NEIGHBOURS = Model<Scalar>::N_NEIGHBOURS;
+
+    // The neighbourhood and classifications end with the offscreen point
+    const int n_points = int(classified.pixel_coordinates.size());
+    if (n_points == 0) { return {}; }
+    const int n_classes = int(classified.classifications.size() / classified.neighbourhood.size());
+    if (cls < 0 || cls >= n_classes) {
+        throw std::invalid_argument("The class to cluster on is not an output of the network");
+    }
+
+    auto parallel_for = [&](const std::size_t& n, auto&& fn) {
+        if (pool != nullptr) { pool->parallel_for(n, fn, 1024); }
+        else {
+            fn(std::size_t(0), n);
+        }
+    };
+
+    // Every point starts in its own set, flagging the ones that fail with -1
+    const Scalar* scores = classified.classifications.data() + cls;
+    std::vector<int> labels(n_points);
+    std::vector<std::atomic<int>> parent(n_points);
+    parallel_for(n_points, [&](const std::size_t& begin, const std::size_t& end) {
+        for (std::size_t i = begin; i < end; ++i) {
+            labels[i] = scores[i * n_classes] >= min_score ? int(i) : -1;
+        }
+        for (std::size_t i = begin; i < end; ++i) {
+            parent[i].store(int(i), std::memory_order_relaxed);
+        }
+    });
+
+    // Join each point with the neighbours that also passed, the offscreen point has the index n_points
+    parallel_for(n_points, [&](const std::size_t& begin, const std::size_t& end) {
+        for (std::size_t i = begin; i < end; ++i) {
+            if (labels[i] < 0) { continue; }
+            const auto& neighbours = classified.neighbourhood[i];
+            for (int j = 0; j < N_NEIGHBOURS; ++j) {
+                const int n = neighbours[j];
+                if (n < n_points && labels[n] >= 0) { cluster_detail::unite(parent, int(i), n); }
+            }
+        }
+    });
+
+    // Label each point with the root of its set, which is the smallest index in it
+    parallel_for(n_points, [&](const std::size_t& begin, const std::size_t& end) {
+        for (std::size_t i = begin; i < end; ++i) {
+            if (labels[i] >= 0) { labels[i] = cluster_detail::find(parent, int(i)); }
+        }
+    });
+
+    return gather_clusters(
+      mesh, classified.pixel_coordinates, classified.global_indices, labels, min_points, pool);
+}
+
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_CLUSTERS_HPP
@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef VISUALMESH_COMPACT_NODES_HPP
+#define VISUALMESH_COMPACT_NODES_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "node.hpp"
+#include "utility/math.hpp"
+
+namespace visualmesh {
+
+/**
+ * @brief Encode a unit vector into 32 bits using an octahedral mapping
+ *
+ * @details
+ *  The vector is projected onto the octahedron |x| + |y| + |z| = 1 and the lower half is folded over the upper half
+ *  so that the whole sphere covers the square [-1, 1]². Each of the two coordinates of the square is then stored in
+ *  16 bits. The angular error of the decoded vector is below 7e-5 radians everywhere on the sphere.
+ *
+ * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+ *
+ * @param v the unit vector to encode
+ *
+ * @return the x coordinate of the square in the low 16 bits and the y coordinate in the high 16 bits
+ */
+template <typename Scalar>
+inline uint32_t encode_octahedral(const vec3<Scalar>& v) {
+    const Scalar l1 = std::abs(v[0]) + std::abs(v[1]) + std::abs(v[2]);
+    Scalar x        = v[0] / l1;
+    Scalar y        = v[1] / l1;
+
+    // Fold the lower half of the octahedron over the upper half
+    if (v[2] < 0) {
+        const Scalar fx = (Scalar(1.0) - std::abs(y)) * (x >= 0 ? Scalar(1.0) : Scalar(-1.0));
+        const Scalar fy = (Scalar(1.0) - std::abs(x)) * (y >= 0 ? Scalar(1.0) : Scalar(-1.0));
+        x               = fx;
+        y               = fy;
+    }
+
+    auto quantise = [](const Scalar& a) {
+        const Scalar c = std::min(Scalar(1.0), std::max(Scalar(-1.0), a));
+        return uint32_t(std::lround((c * Scalar(0.5) + Scalar(0.5)) * Scalar(65535.0)));
+    };
+    return quantise(x) | (quantise(y) << 16);
+}
+
+/**
+ * @brief Decode a unit vector that was encoded with encode_octahedral
+ *
+ * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+ *
+ * @param bits the encoded vector
+ *
+ * @return the unit vector
+ */
+template <typename Scalar>
+inline vec3<Scalar> decode_octahedral(const uint32_t& bits) {
+    Scalar x       = Scalar(bits & 0xFFFF) * Scalar(2.0 / 65535.0) - Scalar(1.0);
+    Scalar y       = Scalar(bits >> 16) * Scalar(2.0 / 65535.0) - Scalar(1.0);
+    const Scalar z = Scalar(1.0) - std::abs(x) - std::abs(y);
+
+    // Unfold the lower half of the octahedron
+    if (z < 0) {
+        const Scalar ux = (Scalar(1.0) - std::abs(y)) * (x >= 0 ? Scalar(1.0) : Scalar(-1.0));
+        const Scalar uy = (Scalar(1.0) - std::abs(x)) * (y >= 0 ? Scalar(1.0) : Scalar(-1.0));
+        x               = ux;
+        y               = uy;
+    }
+    return normalise(vec3<Scalar>{{x, y, z}});
+}
+
+/**
+ * @brief The nodes of a visual mesh stored in as few bytes as possible
+ *
+ * @details
+ *  Each ray is stored in 32 bits using an octahedral encoding and each neighbour as a 16 bit offset from the index of
+ *  its node. After the BSP sort most neighbours are close to their node in the list, so the few that are further away
+ *  than 16 bits can reach are kept in a separate sorted list. This takes 4 + 2N bytes for each node rather than the
+ *  12 + 4N bytes of a float Node, so many more heights of a mesh can be held in the same memory. The rays and
+ *  neighbours are decoded as they are read, which costs a few more operations than reading a Node.
+ *
+ * @tparam Scalar       the scalar type used for calculations and storage (normally one of float or double)
+ * @tparam N_NEIGHBOURS the number of neighbours that each point has
+ */
+template <typename Scalar, int N_NEIGHBOURS>
+struct CompactNodes {
+    CompactNodes() = default;
+
+    /**
+     * @brief Encode a list of nodes
+     *
+     * @param nodes the nodes to encode, neighbours that are one past the end are kept as the off screen point
+     */
+    explicit CompactNodes(const std::vector<Node<Scalar, N_NEIGHBOURS>>& nodes)
+      : rays(nodes.size()), offsets(nodes.size()) {
+        const int n = int(nodes.size());
+        for (int i = 0; i < n; ++i) {
+            rays[i] = encode_octahedral(nodes[i].ray);
+            for (int j = 0; j < N_NEIGHBOURS; ++j) {
+                const int target = nodes[i].neighbours[j];
+                const int delta  = target - i;
+                if (target == n) { offsets[i][j] = OFF_SCREEN; }
+                else if (delta > std::numeric_limits<int16_t>::max() || delta <= FAR) {
+                    offsets[i][j] = FAR;
+                    far.emplace_back(uint64_t(i) * N_NEIGHBOURS + j, target);
+                }
+                else {
+                    offsets[i][j] = int16_t(delta);
+                }
+            }
+        }
+    }
+
+    /// @return the number of nodes in the store
+    std::size_t size() const {
+        return rays.size();
+    }
+
+    /**
+     * @brief Decode the ray of a single node
+     *
+     * @param i the index of the node
+     *
+     * @return the unit vector in the direction of the node
+     */
+    vec3<Scalar> ray(const std::size_t& i) const {
+        return decode_octahedral<Scalar>(rays[i]);
+    }
+
+    /**
+     * @brief Decode a single neighbour of a node
+     *
+     * @param i the index of the node
+     * @param j which of the neighbours of the node to decode
+     *
+     * @return the absolute index of the neighbour, or size() for the off screen point
+     */
+    int neighbour(const std::size_t& i, const int& j) const {
+        const int16_t& offset = offsets[i][j];
+        if (offset == OFF_SCREEN) { return int(size()); }
+        if (offset == FAR) {
+            const uint64_t slot = uint64_t(i) * N_NEIGHBOURS + j;
+            return std::lower_bound(far.begin(),
+                                    far.end(),
+                                    slot,
+                                    [](const std::pair<uint64_t, int>& a, const uint64_t& b) { return a.first < b; })
+              ->second;
+        }
+        return int(i) + offset;
+    }
+
+    /**
+     * @brief Decode a node back into its full representation
+     *
+     * @param i the index of the node
+     *
+     * @return the node with its decoded ray and absolute neighbour indices
+     */
+    Node<Scalar, N_NEIGHBOURS> node(const std::size_t& i) const {
+        Node<Scalar, N_NEIGHBOURS> n{ray(i), {}};
+        for (int j = 0; j < N_NEIGHBOURS; ++j) {
+            n.neighbours[j] = neighbour(i, j);
+        }
+        return n;
+    }
+
+    /// @return the number of bytes held by the store
+    std::size_t bytes() const {
+        return sizeof(*this) + rays.capacity() * sizeof(uint32_t)
+               + offsets.capacity() * sizeof(typename decltype(offsets)::value_type)
+               + far.capacity() * sizeof(typename decltype(far)::value_type);
+    }
+
+    /// The offset used for a neighbour that is the off screen point
+    static constexpr int16_t OFF_SCREEN = std::numeric_limits<int16_t>::lowest();
+    /// The offset used for a neighbour that is too far away to store as an offset and so is in the far list
+    static constexpr int16_t FAR = std::numeric_limits<int16_t>::lowest() + 1;
+
+    /// The octahedral encoded ray of each node
+    std::vector<uint32_t> rays;
+    /// The offset from the index of each node to each of its neighbours
+    std::vector<std::array<int16_t, N_NEIGHBOURS>> offsets;
+    /// The neighbours that are too far away to be an offset as (node * N_NEIGHBOURS + neighbour, index) sorted by slot
+    std::vector<std::pair<uint64_t, int>> far;
+};
+
+template <typename Scalar, int N_NEIGHBOURS>
+constexpr int16_t CompactNodes<Scalar, N_NEIGHBOURS>::OFF_SCREEN;
+template <typename Scalar, int N_NEIGHBOURS>
+constexpr int16_t CompactNodes<Scalar, N_NEIGHBOURS>::FAR;
+
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_COMPACT_NODES_HPP
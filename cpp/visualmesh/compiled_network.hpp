@@ -0,0 +1,377 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef VISUALMESH_COMPILED_NETWORK_HPP
+#define VISUALMESH_COMPILED_NETWORK_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "network_structure.hpp"
+#include "utility/aligned_allocator.hpp"
+#include "utility/serialisation.hpp"
+
+namespace visualmesh {
+
+/**
+ * @brief A view of a single layer of a compiled network
+ *
+ * @details
+ *  The weights of the layer are split by output into blocks of `block` values, each block is zero padded to a full
+ *  block and stored input major. That is for each block, for each input, `block` consecutive weights. A block size of 1
+ *  is an output major (transposed) matrix, and a block size of a vector register or cache line allows a group of
+ *  outputs to be calculated together using only contiguous aligned loads.
+ *
+ * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+ */
+template <typename Scalar>
+struct LayerView {
+    /**
+     * @brief Get the weight that connects an input to an output
+     *
+     * @param i the index of the input
+     * @param j the index of the output
+     *
+     * @return the weight for the connection, equivalent to Layer::weights[i][j]
+     */
+    const Scalar& weight(const int& i, const int& j) const {
+        return weights[((j / block) * input_dimensions + i) * block + j % block];
+    }
+
+    /**
+     * @brief Get the bias for an output
+     *
+     * @param j the index of the output
+     *
+     * @return the bias for the output
+     */
+    const Scalar& bias(const int& j) const {
+        return biases[j];
+    }
+
+    /// The packed weights for this layer, [n_blocks][input_dimensions][block]
+    const Scalar* weights;
+    /// The biases for this layer, zero padded to n_blocks * block
+    const Scalar* biases;
+    /// The number of values in each input point
+    int input_dimensions;
+    /// The number of values in each output point
+    int output_dimensions;
+    /// The number of outputs in each block
+    int block;
+    /// The number of blocks of outputs
+    int n_blocks;
+    /// The activation function to apply after this layer
+    ActivationFunction activation;
+};
+
+/**
+ * @brief A network that has been compiled into a single contiguous aligned allocation
+ *
+ * @details
+ *  All the weights and biases of every layer are stored in a single arena where each layer's weights and biases start
+ *  on a cache line boundary. The shapes, offsets and activation functions for each layer are stored separately. This is
+ *  the representation that the engines build their networks from, so layout transforms only need to happen in a single
+ *  place.
+ *
+ * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+ */
+template <typename Scalar>
+class CompiledNetwork {
+public:
+    /// The metadata for a single layer in the network
+    struct LayerInfo {
+        /// The offset of the weights in the arena
+        std::size_t weights;
+        /// The offset of the biases in the arena
+        std::size_t biases;
+        /// The number of values in each input point
+        int input_dimensions;
+        /// The number of values in each output point
+        int output_dimensions;
+        /// The activation function to apply after this layer
+        ActivationFunction activation;
+    };
+
+    CompiledNetwork() = default;
+
+    /**
+     * @brief Compile a network structure
+     *
+     * @param structure the network structure to compile, weights are indexed as weights[input][output]
+     * @param block     the number of outputs to group together in the weight layout
+     */
+    // Implicit so that anything that takes a compiled network can also be given a network structure
+    // NOLINTNEXTLINE(google-explicit-constructor,hicpp-explicit-conversions)
+    CompiledNetwork(const NetworkStructure<Scalar>& structure, const int& block = 1) : block_size(block) {
+        build(structure.size(),
+              [&](const std::size_t& c) { return structure[c].size(); },
+              [&](const std::size_t& c, const std::size_t& l, LayerInfo& info) {
+                  const auto& layer      = structure[c][l];
+                  info.input_dimensions  = layer.weights.size();
+                  info.output_dimensions = layer.biases.size();
+                  info.activation        = layer.activation;
+              },
+              [&](const std::size_t& c, const std::size_t& l, const int& i, const int& j) {
+                  return structure[c][l].weights[i][j];
+              },
+              [&](const std::size_t& c, const std::size_t& l, const int& j) { return structure[c][l].biases[j]; });
+    }
+
+    /**
+     * @brief Recompile an existing network using a different block size
+     *
+     * @param other the network to recompile
+     * @param block the number of outputs to group together in the weight layout
+     */
+    CompiledNetwork(const CompiledNetwork& other, const int& block) : block_size(block) {
+        build(other.size(),
+              [&](const std::size_t& c) { return other.size(c); },
+              [&](const std::size_t& c, const std::size_t& l, LayerInfo& info) {
+                  const auto& o          = other.info(c, l);
+                  info.input_dimensions  = o.input_dimensions;
+                  info.output_dimensions = o.output_dimensions;
+                  info.activation        = o.activation;
+              },
+              [&](const std::size_t& c, const std::size_t& l, const int& i, const int& j) {
+                  return other.layer(c, l).weight(i, j);
+              },
+              [&](const std::size_t& c, const std::size_t& l, const int& j) { return other.layer(c, l).bias(j); });
+    }
+
+    /**
+     * @brief Load a compiled network that was previously written using save
+     *
+     * @details
+     *  The weights and biases are stored in the compiled layout, so when the file was written with the same Scalar type
+     *  each layer is copied straight into the arena without any conversion. A file written with the other floating
+     *  point type is converted as it is read.
+     *
+     * @param reader the reader positioned at the start of the network data
+     */
+    explicit CompiledNetwork(BinaryReader& reader) : block_size(int(reader.read<uint32_t>())) {
+        const uint32_t width = reader.read<uint32_t>();
+        if (width != sizeof(float) && width != sizeof(double)) {
+            throw std::runtime_error("Unsupported floating point width in binary network data");
+        }
+
+        // Every count is checked against the data that is left so a corrupt file can't make a huge allocation
+        auto count = [&reader](const std::size_t& bytes_each) {
+            const uint64_t n = reader.read<uint64_t>();
+            if (n > reader.remaining() / bytes_each) { throw std::runtime_error("Unexpected end of binary data"); }
+            return std::size_t(n);
+        };
+
+        // The shapes of every layer come first, so they are read in the order the layout asks for them
+        layout(
+          count(sizeof(uint64_t)),
+          [&](const std::size_t& /*c*/) { return count(3 * sizeof(uint32_t)); },
+          [&](const std::size_t& /*c*/, const std::size_t& /*l*/, LayerInfo& info) {
+              info.input_dimensions  = int(reader.read<uint32_t>());
+              info.output_dimensions = int(reader.read<uint32_t>());
+              info.activation        = ActivationFunction(reader.read<uint32_t>());
+              if (info.input_dimensions < 1 || info.output_dimensions < 1 || info.activation < SELU
+                  || info.activation > TANH) {
+                  throw std::runtime_error("Invalid layer in binary network data");
+              }
+          },
+          [&](const std::size_t& values) {
+              if (values > reader.remaining() / width) { throw std::runtime_error("Unexpected end of binary data"); }
+          });
+
+        for (const auto& conv : convs) {
+            for (const auto& info : conv) {
+                const std::size_t padded = n_blocks(info.output_dimensions) * block_size;
+                reader.read_floats(arena.data() + info.weights, padded * info.input_dimensions, width);
+                reader.read_floats(arena.data() + info.biases, padded, width);
+            }
+        }
+    }
+
+    /**
+     * @brief Write this network in its compiled layout so it can be loaded without compiling it again
+     *
+     * @details
+     *  The format is the block size and the size of the Scalar type, followed by the number of convolutional groups, the
+     *  number of layers in each group and the dimensions and activation of each layer. After that are the padded weights
+     *  and biases of each layer exactly as they are stored in the arena. Every value is written in little endian order.
+     *
+     * @param writer the writer to output the network to
+     */
+    void save(BinaryWriter& writer) const {
+        writer.write(uint32_t(block_size));
+        writer.write(uint32_t(sizeof(Scalar)));
+        writer.write(uint64_t(convs.size()));
+        for (const auto& conv : convs) {
+            writer.write(uint64_t(conv.size()));
+            for (const auto& info : conv) {
+                writer.write(uint32_t(info.input_dimensions));
+                writer.write(uint32_t(info.output_dimensions));
+                writer.write(uint32_t(info.activation));
+            }
+        }
+        for (const auto& conv : convs) {
+            for (const auto& info : conv) {
+                const std::size_t padded = n_blocks(info.output_dimensions) * block_size;
+                writer.write_array(arena.data() + info.weights, padded * info.input_dimensions);
+                writer.write_array(arena.data() + info.biases, padded);
+            }
+        }
+    }
+
+    /// @return the number of convolutional groups in the network
+    std::size_t size() const {
+        return convs.size();
+    }
+
+    /// @return the number of layers in a convolutional group
+    std::size_t size(const std::size_t& conv) const {
+        return convs[conv].size();
+    }
+
+    /// @return true if the network has no layers to execute
+    bool empty() const {
+        return convs.empty() || convs.front().empty();
+    }
+
+    /// @return the block size used for the weight layout
+    int block() const {
+        return block_size;
+    }
+
+    /// @return the metadata for a layer in the network
+    const LayerInfo& info(const std::size_t& conv, const std::size_t& layer) const {
+        return convs[conv][layer];
+    }
+
+    /// @return a view of the weights and biases for a layer in the network
+    LayerView<Scalar> layer(const std::size_t& conv, const std::size_t& layer) const {
+        const LayerInfo& i = convs[conv][layer];
+        return LayerView<Scalar>{arena.data() + i.weights,
+                                 arena.data() + i.biases,
+                                 i.input_dimensions,
+                                 i.output_dimensions,
+                                 block_size,
+                                 n_blocks(i.output_dimensions),
+                                 i.activation};
+    }
+
+    /// @return a view of the last layer in a convolutional group, which gives the output of the group
+    LayerView<Scalar> back(const std::size_t& conv) const {
+        return layer(conv, convs[conv].size() - 1);
+    }
+
+    /// @return the width of the widest layer output in the network
+    int max_width() const {
+        int width = 4;
+        for (const auto& conv : convs) {
+            for (const auto& l : conv) {
+                width = std::max(width, l.output_dimensions);
+            }
+        }
+        return width;
+    }
+
+    /// @return the contiguous storage holding all the weights and biases
+    const aligned_vector<Scalar>& data() const {
+        return arena;
+    }
+
+private:
+    /// The number of elements that make up a cache line, each layer's data starts on one of these
+    static constexpr std::size_t ALIGN = 64 / sizeof(Scalar) > 0 ? 64 / sizeof(Scalar) : 1;
+
+    int n_blocks(const int& outputs) const {
+        return (outputs + block_size - 1) / block_size;
+    }
+
+    static std::size_t align(const std::size_t& offset) {
+        return ((offset + ALIGN - 1) / ALIGN) * ALIGN;
+    }
+
+    /**
+     * @brief Work out the shapes of the layers and where everything goes in the arena, then allocate the arena
+     *
+     * @param n_convs the number of convolutional groups
+     * @param sizes   gives the number of layers in a convolutional group
+     * @param shape   fills in the dimensions and activation of a layer
+     * @param check   is given the number of unpadded weights and biases before the arena is allocated
+     */
+    template <typename Sizes, typename Shape, typename Check>
+    void layout(const std::size_t& n_convs, Sizes&& sizes, Shape&& shape, Check&& check) {
+        if (block_size < 1) { throw std::invalid_argument("The block size of a compiled network must be at least 1"); }
+
+        std::size_t offset = 0;
+        std::size_t values = 0;
+        convs.resize(n_convs);
+        for (std::size_t c = 0; c < n_convs; ++c) {
+            convs[c].resize(sizes(c));
+            for (std::size_t l = 0; l < convs[c].size(); ++l) {
+                LayerInfo& info = convs[c][l];
+                shape(c, l, info);
+
+                const std::size_t padded = n_blocks(info.output_dimensions) * block_size;
+                info.weights             = offset;
+                offset                   = align(offset + padded * info.input_dimensions);
+                info.biases              = offset;
+                offset                   = align(offset + padded);
+                values += padded * (info.input_dimensions + 1);
+            }
+        }
+        check(values);
+
+        // Single allocation for everything, padding is zero
+        arena.assign(offset, Scalar(0));
+    }
+
+    template <typename Sizes, typename Shape, typename Weight, typename Bias>
+    void build(const std::size_t& n_convs, Sizes&& sizes, Shape&& shape, Weight&& weight, Bias&& bias) {
+        layout(n_convs, sizes, shape, [](const std::size_t& /*values*/) {});
+        for (std::size_t c = 0; c < n_convs; ++c) {
+            for (std::size_t l = 0; l < convs[c].size(); ++l) {
+                const LayerInfo& info = convs[c][l];
+                Scalar* w             = arena.data() + info.weights;
+                Scalar* b             = arena.data() + info.biases;
+                for (int j = 0; j < info.output_dimensions; ++j) {
+                    for (int i = 0; i < info.input_dimensions; ++i) {
+                        w[((j / block_size) * info.input_dimensions + i) * block_size + j % block_size] =
+                          weight(c, l, i, j);
+                    }
+                    b[j] = bias(c, l, j);
+                }
+            }
+        }
+    }
+
+    /// The number of outputs grouped together in the weight layout
+    int block_size = 1;
+    /// The metadata for each layer grouped by convolution
+    std::vector<std::vector<LayerInfo>> convs;
+    /// The storage for all of the weights and biases
+    aligned_vector<Scalar> arena;
+};
+
+template <typename Scalar>
+constexpr std::size_t CompiledNetwork<Scalar>::ALIGN;
+
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_COMPILED_NETWORK_HPP
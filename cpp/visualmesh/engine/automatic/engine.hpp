@@ -0,0 +1,540 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_ENGINE_AUTOMATIC_ENGINE_HPP
+#define VISUALMESH_ENGINE_AUTOMATIC_ENGINE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "visualmesh/classified_mesh.hpp"
+#include "visualmesh/compiled_network.hpp"
+#include "visualmesh/engine/cpu/engine.hpp"
+#include "visualmesh/engine/cuda/engine.hpp"
+#include "visualmesh/engine/opencl/engine.hpp"
+#include "visualmesh/engine/vulkan/engine.hpp"
+#include "visualmesh/mesh.hpp"
+#include "visualmesh/projected_mesh.hpp"
+#include "visualmesh/utility/atomic_file.hpp"
+#include "visualmesh/utility/serialisation.hpp"
+#include "visualmesh/visualmesh.hpp"
+
+namespace visualmesh {
+namespace engine {
+    namespace automatic {
+
+        /// How the engine uses the backends once they have been timed
+        enum class Selection {
+            /// Only keep the fastest backend and run every frame on it
+            FASTEST,
+            /// Keep every backend and give each frame to the one that would finish it first, so frames from several
+            /// threads are split between them
+            SPLIT
+        };
+
+        /**
+         * @brief Options for how the backends are chosen
+         */
+        struct Options {
+            /// How the engine uses the backends once they have been timed
+            Selection selection = Selection::FASTEST;
+            /// The number of frames run on each backend before timing it, so its caches and buffers are warm
+            int warmup = 3;
+            /// The number of frames that are timed on each backend, the median is used
+            int frames = 10;
+            /// Time the backends again even if a decision is stored for this machine
+            bool recalibrate = false;
+        };
+
+        /**
+         * @brief An engine that picks between the CPU, OpenCL, Vulkan and CUDA engines at runtime
+         *
+         * @details
+         *  Which engine is fastest depends on the device, the width of the network and the size of the mesh. When it
+         *  is constructed this makes every engine that was compiled in and that has a device to run on, skipping any
+         *  that fail to start. It then times classifying a representative frame with each of them and keeps the
+         *  fastest, or keeps all of them to split frames between them.
+         *
+         *  The timings are stored in `$VISUALMESH_ENGINE_CACHE` if it is set, otherwise `visualmesh/engines` in
+         *  `$XDG_CACHE_HOME` or `$HOME/.cache`, keyed by the host name, the network, the mesh and the frame. Later
+         *  engines for the same setup on the same machine use them rather than timing again. Setting
+         *  `VISUALMESH_ENGINE_CACHE` to an empty string disables this.
+         *
+         *  The backends are behind a virtual interface, so the mesh model is a parameter of the class rather than of
+         *  each call. Like the engines it wraps this can be used from several threads.
+         *
+         * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+         * @tparam Model  the mesh model that is projected and classified
+         */
+        template <typename Scalar, template <typename> class Model>
+        class Engine {
+        private:
+            static constexpr int N_NEIGHBOURS = Model<Scalar>::N_NEIGHBOURS;
+
+        public:
+            /**
+             * @brief Make every available engine and choose between them by classifying a representative frame
+             *
+             * @param network the network to use for classification
+             * @param mesh    a mesh the size of the ones that will be classified
+             * @param Hoc     a typical orientation of the camera
+             * @param lens    the lens of the camera
+             * @param image   a typical image, with the dimensions of the lens
+             * @param format  the pixel format of the image as a fourcc code
+             * @param options how the backends are timed and used
+             */
+            Engine(const CompiledNetwork<Scalar>& network,
+                   const Mesh<Scalar, Model>& mesh,
+                   const mat4<Scalar>& Hoc,
+                   const Lens<Scalar>& lens,
+                   const void* image,
+                   const uint32_t& format,
+                   const Options& options = {})
+              : selection(options.selection) {
+
+                // Make each engine that was compiled in, one that can't start on this machine is left out
+                add<cpu::Engine<Scalar>>("cpu", network);
+#if !defined(VISUALMESH_DISABLE_OPENCL)
+                add<opencl::Engine<Scalar>>("opencl", network);
+#endif  // !defined(VISUALMESH_DISABLE_OPENCL)
+#if !defined(VISUALMESH_DISABLE_VULKAN)
+                add<vulkan::Engine<Scalar>>("vulkan", network);
+#endif  // !defined(VISUALMESH_DISABLE_VULKAN)
+#if !defined(VISUALMESH_DISABLE_CUDA)
+                add<cuda::Engine<Scalar>>("cuda", network);
+#endif  // !defined(VISUALMESH_DISABLE_CUDA)
+
+                // Use the stored timings if every backend has one, otherwise time them all
+                const std::string directory = cache_directory();
+                const std::string path =
+                  directory.empty() ? "" : directory + "/" + key(network, mesh, lens, format) + ".txt";
+                if (options.recalibrate || path.empty() || !load(path)) {
+                    calibrate(mesh, Hoc, lens, image, format, options);
+                    if (!path.empty()) { store(directory, path); }
+                }
+
+                // Order the backends from fastest to slowest, and only keep the fastest if we aren't splitting
+                std::stable_sort(backends.begin(), backends.end(), [](const auto& a, const auto& b) {
+                    return a->seconds < b->seconds;
+                });
+                if (selection == Selection::FASTEST) { backends.resize(1); }
+            }
+
+            /**
+             * @brief Projects a provided mesh to pixel coordinates
+             *
+             * @param mesh the mesh table that we are projecting to pixel coordinates
+             * @param Hoc  the homogenous transformation matrix from the camera to the observation plane
+             * @param lens the lens parameters that describe the optics of the camera
+             *
+             * @return a projected mesh for the provided arguments
+             */
+            ProjectedMesh<Scalar, N_NEIGHBOURS> operator()(const Mesh<Scalar, Model>& mesh,
+                                                           const mat4<Scalar>& Hoc,
+                                                           const Lens<Scalar>& lens) const {
+                Dispatch dispatch(choose());
+                return dispatch.backend.project(mesh, Hoc, lens);
+            }
+
+            /**
+             * @brief Projects a provided mesh to pixel coordinates from an aggregate VisualMesh object
+             *
+             * @param mesh the mesh table that we are projecting to pixel coordinates
+             * @param Hoc  the homogenous transformation matrix from the camera to the observation plane
+             * @param lens the lens parameters that describe the optics of the camera
+             *
+             * @return a projected mesh for the provided arguments
+             */
+            ProjectedMesh<Scalar, N_NEIGHBOURS> operator()(const VisualMesh<Scalar, Model>& mesh,
+                                                           const mat4<Scalar>& Hoc,
+                                                           const Lens<Scalar>& lens) const {
+                return operator()(mesh.height(Hoc[2][3]), Hoc, lens);
+            }
+
+            /**
+             * @brief Project and classify a mesh using the neural network that is loaded into this engine
+             *
+             * @param mesh    the mesh table that we are projecting to pixel coordinates
+             * @param Hoc     the homogenous transformation matrix from the camera to the observation plane
+             * @param lens    the lens parameters that describe the optics of the camera
+             * @param image   the data that represents the image the network will run from
+             * @param format  the pixel format of this image as a fourcc code
+             *
+             * @return a classified mesh for the provided arguments
+             */
+            ClassifiedMesh<Scalar, N_NEIGHBOURS> operator()(const Mesh<Scalar, Model>& mesh,
+                                                            const mat4<Scalar>& Hoc,
+                                                            const Lens<Scalar>& lens,
+                                                            const void* image,
+                                                            const uint32_t& format) const {
+                ClassifiedMesh<Scalar, N_NEIGHBOURS> output;
+                operator()(mesh, Hoc, lens, image, format, output);
+                return output;
+            }
+
+            /**
+             * @brief Project and classify a mesh into a classified mesh owned by the caller, reusing its memory
+             *
+             * @param mesh    the mesh table that we are projecting to pixel coordinates
+             * @param Hoc     the homogenous transformation matrix from the camera to the observation plane
+             * @param lens    the lens parameters that describe the optics of the camera
+             * @param image   the data that represents the image the network will run from
+             * @param format  the pixel format of this image as a fourcc code
+             * @param output  the classified mesh to write the result into
+             */
+            void operator()(const Mesh<Scalar, Model>& mesh,
+                            const mat4<Scalar>& Hoc,
+                            const Lens<Scalar>& lens,
+                            const void* image,
+                            const uint32_t& format,
+                            ClassifiedMesh<Scalar, N_NEIGHBOURS>& output) const {
+                Dispatch dispatch(choose());
+                dispatch.backend.classify(mesh, Hoc, lens, image, format, output);
+            }
+
+            /**
+             * @brief Project and classify a mesh using the neural network that is loaded into this engine.
+             * This version takes an aggregate VisualMesh object
+             *
+             * @param mesh    the mesh table that we are projecting to pixel coordinates
+             * @param Hoc     the homogenous transformation matrix from the camera to the observation plane
+             * @param lens    the lens parameters that describe the optics of the camera
+             * @param image   the data that represents the image the network will run from
+             * @param format  the pixel format of this image as a fourcc code
+             *
+             * @return a classified mesh for the provided arguments
+             */
+            ClassifiedMesh<Scalar, N_NEIGHBOURS> operator()(const VisualMesh<Scalar, Model>& mesh,
+                                                            const mat4<Scalar>& Hoc,
+                                                            const Lens<Scalar>& lens,
+                                                            const void* image,
+                                                            const uint32_t& format) const {
+                return operator()(mesh.height(Hoc[2][3]), Hoc, lens, image, format);
+            }
+
+            /**
+             * @brief Get the backends that are in use and how long each took to classify the representative frame
+             *
+             * @return the name of each backend and its time per frame in seconds, fastest first
+             */
+            std::vector<std::pair<std::string, double>> timings() const {
+                std::vector<std::pair<std::string, double>> result;
+                for (const auto& b : backends) {
+                    result.emplace_back(b->name, b->seconds);
+                }
+                return result;
+            }
+
+            /// @return the name of the fastest backend, which every frame runs on unless they are being split
+            const std::string& name() const {
+                return backends.front()->name;
+            }
+
+        private:
+            /// An engine behind a virtual interface so engines of different types can be chosen between at runtime
+            struct Backend {
+                explicit Backend(std::string name) : name(std::move(name)) {}
+                Backend(const Backend&) = delete;
+                Backend(Backend&&)      = delete;
+                Backend& operator=(const Backend&) = delete;
+                Backend& operator=(Backend&&) = delete;
+                virtual ~Backend()            = default;
+
+                virtual ProjectedMesh<Scalar, N_NEIGHBOURS> project(const Mesh<Scalar, Model>& mesh,
+                                                                    const mat4<Scalar>& Hoc,
+                                                                    const Lens<Scalar>& lens) const = 0;
+
+                virtual void classify(const Mesh<Scalar, Model>& mesh,
+                                      const mat4<Scalar>& Hoc,
+                                      const Lens<Scalar>& lens,
+                                      const void* image,
+                                      const uint32_t& format,
+                                      ClassifiedMesh<Scalar, N_NEIGHBOURS>& output) const = 0;
+
+                /// The name of the engine, as stored with its timing
+                std::string name;
+                /// The median time to classify the representative frame in seconds
+                double seconds = std::numeric_limits<double>::infinity();
+                /// The number of frames running on the engine
+                mutable std::atomic<int> in_flight{0};
+            };
+
+            /// A backend for an engine type
+            template <typename EngineType>
+            struct BackendOf : public Backend {
+                BackendOf(const std::string& name, const CompiledNetwork<Scalar>& network)
+                  : Backend(name), engine(network) {}
+
+                ProjectedMesh<Scalar, N_NEIGHBOURS> project(const Mesh<Scalar, Model>& mesh,
+                                                            const mat4<Scalar>& Hoc,
+                                                            const Lens<Scalar>& lens) const override {
+                    return engine(mesh, Hoc, lens);
+                }
+
+                void classify(const Mesh<Scalar, Model>& mesh,
+                              const mat4<Scalar>& Hoc,
+                              const Lens<Scalar>& lens,
+                              const void* image,
+                              const uint32_t& format,
+                              ClassifiedMesh<Scalar, N_NEIGHBOURS>& output) const override {
+                    engine(mesh, Hoc, lens, image, format, output);
+                }
+
+                /// The engine that runs the frames
+                EngineType engine;
+            };
+
+            /// Counts a frame as running on a backend for as long as it exists
+            struct Dispatch {
+                explicit Dispatch(const Backend& backend) : backend(backend) {
+                    ++backend.in_flight;
+                }
+                Dispatch(const Dispatch&) = delete;
+                Dispatch(Dispatch&&)      = delete;
+                Dispatch& operator=(const Dispatch&) = delete;
+                Dispatch& operator=(Dispatch&&) = delete;
+                ~Dispatch() {
+                    --backend.in_flight;
+                }
+
+                /// The backend the frame runs on
+                const Backend& backend;
+            };
+
+            /**
+             * @brief Make an engine and add it as a backend, leaving it out if it can't start on this machine
+             *
+             * @tparam EngineType the type of the engine
+             *
+             * @param name    the name of the engine, as stored with its timing
+             * @param network the network to use for classification
+             */
+            template <typename EngineType>
+            void add(const std::string& name, const CompiledNetwork<Scalar>& network) {
+                try {
+                    backends.push_back(std::make_unique<BackendOf<EngineType>>(name, network));
+                }
+                catch (const std::exception& /*error*/) {
+                    // No device or driver for this engine, so it can't be chosen
+                }
+            }
+
+            /**
+             * @brief Choose the backend for a frame
+             *
+             * @details
+             *  Each frame goes to the backend that would finish it first given the frames that are already running on
+             *  it. With frames from a single thread this is always the fastest backend, the slower ones only take
+             *  frames once the fastest has enough of them running.
+             *
+             * @return the backend to run the frame on
+             */
+            const Backend& choose() const {
+                const Backend* best = backends.front().get();
+                double finish       = (best->in_flight + 1) * best->seconds;
+                for (std::size_t i = 1; i < backends.size(); ++i) {
+                    const double f = (backends[i]->in_flight + 1) * backends[i]->seconds;
+                    if (f < finish) {
+                        best   = backends[i].get();
+                        finish = f;
+                    }
+                }
+                return *best;
+            }
+
+            /**
+             * @brief Time classifying the representative frame with each backend, dropping any that fail
+             *
+             * @param mesh    a mesh the size of the ones that will be classified
+             * @param Hoc     a typical orientation of the camera
+             * @param lens    the lens of the camera
+             * @param image   a typical image, with the dimensions of the lens
+             * @param format  the pixel format of the image as a fourcc code
+             * @param options how many frames are run
+             */
+            void calibrate(const Mesh<Scalar, Model>& mesh,
+                           const mat4<Scalar>& Hoc,
+                           const Lens<Scalar>& lens,
+                           const void* image,
+                           const uint32_t& format,
+                           const Options& options) {
+                ClassifiedMesh<Scalar, N_NEIGHBOURS> output;
+                for (auto it = backends.begin(); it != backends.end();) {
+                    try {
+                        for (int i = 0; i < options.warmup; ++i) {
+                            (*it)->classify(mesh, Hoc, lens, image, format, output);
+                        }
+                        std::vector<double> times;
+                        for (int i = 0; i < std::max(options.frames, 1); ++i) {
+                            const auto start = std::chrono::steady_clock::now();
+                            (*it)->classify(mesh, Hoc, lens, image, format, output);
+                            times.push_back(
+                              std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+                        }
+                        std::nth_element(times.begin(), std::next(times.begin(), times.size() / 2), times.end());
+                        (*it)->seconds = times[times.size() / 2];
+                        ++it;
+                    }
+                    catch (const std::exception& /*error*/) {
+                        // The engine started but can't run this frame, so it can't be chosen
+                        it = backends.erase(it);
+                    }
+                }
+                if (backends.empty()) { throw std::runtime_error("None of the engines could classify the frame"); }
+            }
+
+            /**
+             * @brief Read the stored timings of the backends
+             *
+             * @param path the file the timings are stored in
+             *
+             * @return true if there was a timing for every backend, otherwise the backends need to be timed
+             */
+            bool load(const std::string& path) {
+                std::ifstream file(path);
+                std::string name;
+                double seconds = 0;
+                std::vector<std::pair<std::string, double>> stored;
+                while (file >> name >> seconds) {
+                    stored.emplace_back(name, seconds);
+                }
+                for (auto& b : backends) {
+                    auto it = std::find_if(
+                      stored.begin(), stored.end(), [&b](const auto& s) { return s.first == b->name; });
+                    if (it == stored.end()) { return false; }
+                    b->seconds = it->second;
+                }
+                return !backends.empty();
+            }
+
+            /**
+             * @brief Store the timings of the backends so later engines on this machine don't time them again
+             *
+             * @details
+             *  The timings are written to a temporary file that is then renamed into place, so another process never
+             *  reads a partially written file. Failing to write them is not an error.
+             *
+             * @param directory the directory the timings are stored in
+             * @param path      the file to store the timings in
+             */
+            void store(const std::string& directory, const std::string& path) const {
+                if (!make_directories(directory)) { return; }
+
+                std::stringstream file;
+                file << std::setprecision(std::numeric_limits<double>::max_digits10);
+                for (const auto& b : backends) {
+                    file << b->name << " " << b->seconds << std::endl;
+                }
+                write_atomically(path, file.str());
+            }
+
+            /**
+             * @brief Work out the name the timings for this machine and setup are stored under
+             *
+             * @details
+             *  The name is a 64 bit FNV-1a hash of the host name and everything that affects how fast the engines are:
+             *  the scalar type, the network, the size of the mesh, the lens and the image format.
+             *
+             * @param network the network to use for classification
+             * @param mesh    the representative mesh
+             * @param lens    the lens of the camera
+             * @param format  the pixel format of the image as a fourcc code
+             *
+             * @return the name of the file for the timings
+             */
+            static std::string key(const CompiledNetwork<Scalar>& network,
+                                   const Mesh<Scalar, Model>& mesh,
+                                   const Lens<Scalar>& lens,
+                                   const uint32_t& format) {
+                uint64_t hash = 0xcbf29ce484222325;
+                auto add      = [&hash](const void* data, const std::size_t& size) {
+                    const auto* bytes = static_cast<const unsigned char*>(data);
+                    for (std::size_t i = 0; i < size; ++i) {
+                        hash ^= bytes[i];
+                        hash *= 0x100000001b3;
+                    }
+                };
+
+                const std::string version = "engines-v1";
+                add(version.data(), version.size());
+#ifdef VISUALMESH_HAVE_MMAP
+                char host[256] = {};
+                ::gethostname(host, sizeof(host) - 1);
+                add(host, std::strlen(host));
+#endif
+                const int scalar = sizeof(Scalar);
+                add(&scalar, sizeof(scalar));
+                for (std::size_t c = 0; c < network.size(); ++c) {
+                    for (std::size_t l = 0; l < network.size(c); ++l) {
+                        const auto& info = network.info(c, l);
+                        add(&info.input_dimensions, sizeof(info.input_dimensions));
+                        add(&info.output_dimensions, sizeof(info.output_dimensions));
+                        add(&info.activation, sizeof(info.activation));
+                    }
+                }
+                add(network.data().data(), network.data().size() * sizeof(Scalar));
+                const uint64_t nodes = mesh.nodes.size();
+                add(&nodes, sizeof(nodes));
+                const int neighbours = N_NEIGHBOURS;
+                add(&neighbours, sizeof(neighbours));
+                add(&lens.projection, sizeof(lens.projection));
+                add(lens.dimensions.data(), sizeof(lens.dimensions));
+                add(&format, sizeof(format));
+
+                std::stringstream name;
+                name << std::hex << std::setw(16) << std::setfill('0') << hash;
+                return name.str();
+            }
+
+            /// Get the directory the timings are stored in, or an empty string if they aren't stored
+            static std::string cache_directory() {
+#ifdef VISUALMESH_HAVE_MMAP
+                if (const char* dir = std::getenv("VISUALMESH_ENGINE_CACHE")) { return dir; }
+                if (const char* dir = std::getenv("XDG_CACHE_HOME")) {
+                    return *dir ? std::string(dir) + "/visualmesh/engines" : "";
+                }
+                if (const char* dir = std::getenv("HOME")) {
+                    return *dir ? std::string(dir) + "/.cache/visualmesh/engines" : "";
+                }
+#endif
+                return "";
+            }
+
+            /// How the backends are used once they have been timed
+            Selection selection;
+            /// The engines that frames can run on, fastest first once they have been timed
+            std::vector<std::unique_ptr<Backend>> backends;
+        };
+
+    }  // namespace automatic
+}  // namespace engine
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_ENGINE_AUTOMATIC_ENGINE_HPP
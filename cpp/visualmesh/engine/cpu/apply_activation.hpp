@@ -20,8 +20,13 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <limits>
 #include <vector>
 
+#include "target.hpp"
 #include "visualmesh/network_structure.hpp"
 #include "visualmesh/utility/math.hpp"
 
@@ -31,56 +36,224 @@ namespace engine {
 
         namespace activation {
 
+            /// The integer type with the same size as the floating point type, used to build powers of two
             template <typename Scalar>
-            void selu(std::vector<Scalar>& data, const int& /*dimensions*/) {
-                std::transform(data.begin(), data.end(), data.begin(), [](const Scalar& s) {
+            struct FloatBits;
+            template <>
+            struct FloatBits<float> {
+                using type                          = int32_t;
+                static constexpr int mantissa       = 23;
+                static constexpr int bias           = 127;
+                static constexpr float min_exponent = -87.0f;
+                static constexpr float max_exponent = 88.0f;
+            };
+            template <>
+            struct FloatBits<double> {
+                using type                           = int64_t;
+                static constexpr int mantissa        = 52;
+                static constexpr int bias            = 1023;
+                static constexpr double min_exponent = -708.0;
+                static constexpr double max_exponent = 708.0;
+            };
+
+            /**
+             * @brief A branch free approximation of exp that can be vectorised by the compiler
+             *
+             * @details
+             *  The input is split into x = n ln(2) + r with |r| <= ln(2)/2 so exp(x) = 2^n exp(r). The power of two is
+             *  built directly in the exponent bits and exp(r) is evaluated with a degree 6 polynomial. The relative
+             *  error is below 3e-7 over the range where the result is a normal number, which is within a couple of ulp
+             *  for float. For double the same bound holds which is much less accurate than std::exp. Inputs are clamped
+             *  to the range where 2^n is still a normal number, so very negative values return about e^-87 for float
+             *  and e^-708 for double rather than zero, and very positive values don't overflow.
+             *
+             * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+             *
+             * @param x the value to take the exponential of
+             *
+             * @return an approximation of e^x
+             */
+            template <typename Scalar>
+            VISUALMESH_ALWAYS_INLINE Scalar exp_approx(Scalar x) {
+                using Bits              = FloatBits<Scalar>;
+                constexpr Scalar log2e  = 1.44269504088896340736;
+                constexpr Scalar ln2_hi = 0.693145751953125;
+                constexpr Scalar ln2_lo = 1.42860682030941723212e-6;
+
+                x = std::min(std::max(x, Scalar(Bits::min_exponent)), Scalar(Bits::max_exponent));
+
+                // Round to the nearest power of two without calling out to a library function
+                const Scalar fn = std::floor(x * log2e + Scalar(0.5));
+                const Scalar r  = (x - fn * ln2_hi) - fn * ln2_lo;
+
+                // Horner form of the taylor series for exp(r) which is accurate enough over |r| <= ln(2)/2
+                Scalar p = Scalar(1.0 / 720.0);
+                p        = p * r + Scalar(1.0 / 120.0);
+                p        = p * r + Scalar(1.0 / 24.0);
+                p        = p * r + Scalar(1.0 / 6.0);
+                p        = p * r + Scalar(0.5);
+                p        = p * r + Scalar(1.0);
+                p        = p * r + Scalar(1.0);
+
+                // Multiply by 2^n by building it in the exponent bits
+                const typename Bits::type bits = (typename Bits::type(fn) + Bits::bias) << Bits::mantissa;
+                Scalar scale;
+                std::memcpy(&scale, &bits, sizeof(Scalar));
+                return p * scale;
+            }
+
+            /**
+             * @brief Calculates e^x, either exactly or using exp_approx
+             */
+            template <typename Scalar, bool Approximate>
+            VISUALMESH_ALWAYS_INLINE Scalar exp(const Scalar& x) {
+                return Approximate ? exp_approx(x) : std::exp(x);
+            }
+
+            /// No activation, used when the activation is applied separately
+            template <typename Scalar, bool Approximate>
+            struct Identity {
+                VISUALMESH_ALWAYS_INLINE Scalar operator()(const Scalar& s) const {
+                    return s;
+                }
+            };
+
+            /// The scaled exponential linear unit
+            template <typename Scalar, bool Approximate>
+            struct Selu {
+                VISUALMESH_ALWAYS_INLINE Scalar operator()(const Scalar& s) const {
                     constexpr const Scalar lambda = 1.0507009873554804934193349852946;
                     constexpr const Scalar alpha  = 1.6732632423543772848170429916717;
-                    return lambda * (s >= 0 ? s : alpha * std::exp(s) - alpha);
-                });
+                    return lambda * (s >= 0 ? s : alpha * activation::exp<Scalar, Approximate>(s) - alpha);
+                }
+            };
+
+            /// The rectified linear unit
+            template <typename Scalar, bool Approximate>
+            struct Relu {
+                VISUALMESH_ALWAYS_INLINE Scalar operator()(const Scalar& s) const {
+                    return std::max(s, Scalar(0.0));
+                }
+            };
+
+            /// The hyperbolic tangent, when approximated the absolute error is below 3e-7
+            template <typename Scalar, bool Approximate>
+            struct Tanh {
+                VISUALMESH_ALWAYS_INLINE Scalar operator()(const Scalar& s) const {
+                    if (!Approximate) { return std::tanh(s); }
+                    // tanh(x) = 1 - 2 / (e^2x + 1), beyond |x| = 9 tanh is 1 to within float precision
+                    const Scalar x = std::min(std::abs(s), Scalar(9.0));
+                    const Scalar t = Scalar(1.0) - Scalar(2.0) / (exp_approx(Scalar(2.0) * x) + Scalar(1.0));
+                    return s < 0 ? -t : t;
+                }
+            };
+
+            /// The exponential part of the softmax, the normalisation is done by normalise_rows
+            template <typename Scalar, bool Approximate>
+            struct Exp {
+                VISUALMESH_ALWAYS_INLINE Scalar operator()(const Scalar& s) const {
+                    return activation::exp<Scalar, Approximate>(s);
+                }
+            };
+
+            /**
+             * @brief Divide each row by its total, the second half of the softmax done while the row is still in cache
+             *
+             * @tparam Iterator a random access iterator to the scalar values
+             *
+             * @param begin      the start of the data, must be the start of a row
+             * @param end        the end of the data, must be the end of a row
+             * @param dimensions the number of values in each row
+             */
+            template <typename Iterator>
+            void normalise_rows(Iterator begin, Iterator end, const int& dimensions) {
+                using Scalar = typename std::iterator_traits<Iterator>::value_type;
+                for (auto it = begin; it < end; std::advance(it, dimensions)) {
+                    const auto row_end = std::next(it, dimensions);
+                    Scalar total(0.0);
+                    for (auto v = it; v < row_end; ++v) {
+                        total += *v;
+                    }
+                    const Scalar inv = Scalar(1.0) / total;
+                    for (auto v = it; v < row_end; ++v) {
+                        *v *= inv;
+                    }
+                }
             }
 
-            template <typename Scalar>
-            void relu(std::vector<Scalar>& data, const int& /*dimensions*/) {
-                std::transform(
-                  data.begin(), data.end(), data.begin(), [](const Scalar& s) { return std::max(s, Scalar(0.0)); });
+            /**
+             * @brief Apply an elementwise activation function to a range of values
+             */
+            template <template <typename, bool> class Fn, bool Approximate, typename Iterator>
+            void elementwise(Iterator begin, Iterator end) {
+                using Scalar = typename std::iterator_traits<Iterator>::value_type;
+                std::transform(begin, end, begin, Fn<Scalar, Approximate>());
             }
 
-            template <typename Scalar>
-            void tanh(std::vector<Scalar>& data, const int& /*dimensions*/) {
-                std::transform(data.begin(), data.end(), data.begin(), [](const Scalar& s) {  //
-                    return std::tanh(s);
-                });
+            template <bool Approximate = false, typename Iterator>
+            void selu(Iterator begin, Iterator end, const int& /*dimensions*/) {
+                elementwise<Selu, Approximate>(begin, end);
             }
 
-            template <typename Scalar>
-            void softmax(std::vector<Scalar>& data, const int& dimensions) {
-                std::transform(data.begin(), data.end(), data.begin(), [](const Scalar& s) { return std::exp(s); });
-                for (auto it = data.begin(); it < data.end(); std::advance(it, dimensions)) {
-                    const auto end = std::next(it, dimensions);
-                    Scalar total   = std::accumulate(it, end, Scalar(0.0));
-                    std::transform(it, end, it, [total](const Scalar& s) { return s / total; });
+            template <bool Approximate = false, typename Iterator>
+            void relu(Iterator begin, Iterator end, const int& /*dimensions*/) {
+                elementwise<Relu, Approximate>(begin, end);
+            }
+
+            template <bool Approximate = false, typename Iterator>
+            void tanh(Iterator begin, Iterator end, const int& /*dimensions*/) {
+                elementwise<Tanh, Approximate>(begin, end);
+            }
+
+            template <bool Approximate = false, typename Iterator>
+            void softmax(Iterator begin, Iterator end, const int& dimensions) {
+                // Do the exponential and the normalisation for each row at a time so each row is only loaded once
+                for (auto it = begin; it < end; std::advance(it, dimensions)) {
+                    const auto row_end = std::next(it, dimensions);
+                    elementwise<Exp, Approximate>(it, row_end);
+                    normalise_rows(it, row_end, dimensions);
                 }
             }
         }  // namespace activation
 
+        /**
+         * @brief Applys an activation function based on the selected activation function to a range of values
+         *
+         * @details
+         *  The range must contain whole rows of the layer so that activation functions like softmax see every
+         *  dimension of a point. This allows the activation to be applied to subsets of points in parallel.
+         *
+         * @tparam Approximate if the fast approximations of exp and tanh should be used
+         * @tparam Iterator    a random access iterator to the scalar values
+         *
+         * @param fn            the enum representing which activation function to use
+         * @param begin         the start of the range that we will be applying the activation function to
+         * @param end           the end of the range that we will be applying the activation function to
+         * @param dimensions    the dimensions of the layer for activation functions like softmax
+         */
+        template <bool Approximate = false, typename Iterator>
+        void apply_activation(const ActivationFunction& fn, Iterator begin, Iterator end, const int& dimensions) {
+            switch (fn) {
+                case ActivationFunction::SELU: activation::selu<Approximate>(begin, end, dimensions); break;
+                case ActivationFunction::RELU: activation::relu<Approximate>(begin, end, dimensions); break;
+                case ActivationFunction::TANH: activation::tanh<Approximate>(begin, end, dimensions); break;
+                case ActivationFunction::SOFTMAX: activation::softmax<Approximate>(begin, end, dimensions); break;
+            }
+        }
+
         /**
          * @brief Applys an activation function based on the selected activation function
          *
-         * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+         * @tparam Approximate if the fast approximations of exp and tanh should be used
+         * @tparam Scalar      the scalar type used for calculations and storage (normally one of float or double)
          *
          * @param fn            the enum representing which activation function to use
          * @param data          the data that we will be applying the activation function to
          * @param dimensions    the dimensions of the layer for activation functions like softmax
          */
-        template <typename Scalar>
+        template <bool Approximate = false, typename Scalar>
         void apply_activation(const ActivationFunction& fn, std::vector<Scalar>& data, const int& dimensions) {
-            switch (fn) {
-                case ActivationFunction::SELU: activation::selu(data, dimensions); break;
-                case ActivationFunction::RELU: activation::relu(data, dimensions); break;
-                case ActivationFunction::TANH: activation::tanh(data, dimensions); break;
-                case ActivationFunction::SOFTMAX: activation::softmax(data, dimensions); break;
-            }
+            apply_activation<Approximate>(fn, data.begin(), data.end(), dimensions);
         }
 
     }  // namespace cpu
@@ -18,9 +18,13 @@
 #ifndef VISUALMESH_ENGINE_CPU_BAYER_HPP
 #define VISUALMESH_ENGINE_CPU_BAYER_HPP
 
+#include <algorithm>
 #include <array>
+#include <cmath>
 #include <cstdint>
+#include <stdexcept>
 
+#include "target.hpp"
 #include "visualmesh/utility/fourcc.hpp"
 #include "visualmesh/utility/math.hpp"
 
@@ -157,6 +161,155 @@ namespace engine {
                 }
             }
 
+#if defined(__GNUC__) || defined(__clang__)
+            namespace lanes {
+
+                /// The number of points that are sampled together
+                constexpr int LANES = 8;
+
+                /// LANES 32 bit integers operated on as a single vector
+                typedef int32_t Int __attribute__((vector_size(LANES * sizeof(int32_t))));
+
+                /// Set out to a where the mask is set and b where it isn't, the mask lanes must be all ones or zeros
+                VISUALMESH_ALWAYS_INLINE void select(Int& out, const Int& mask, const Int& a, const Int& b) {
+                    out = (mask & a) | (~mask & b);
+                }
+
+                /// Divide by the scale factor in place, truncating towards zero like integer division
+                VISUALMESH_ALWAYS_INLINE void unscale(Int& v) {
+                    static_assert(scale == 64, "unscale assumes the kernels are scaled by 64");
+                    v = (v + ((v >> 31) & (scale - 1))) >> 6;
+                }
+
+                /**
+                 * @brief The demosaiced red, green and blue of one of the four bilinear taps for every lane
+                 *
+                 * @details
+                 *  Only the non zero coefficients of the Malvar-He-Cutler kernels are evaluated, and each of the four
+                 *  kernels is calculated once and then assigned to the channels it is used for depending on where each
+                 *  lane's tap falls in the pattern. The results are truncated the same way as demosaic.
+                 *
+                 * @param w        the 6x6 window of pixels around the taps for each lane
+                 * @param dx       the column of the tap in the 2x2 bilinear quad
+                 * @param dy       the row of the tap in the 2x2 bilinear quad
+                 * @param red_row  set for the lanes where this tap is on a row that contains red pixels
+                 * @param red_col  set for the lanes where this tap is on a column that contains red pixels
+                 * @param rgb      the demosaiced red, green and blue for each lane
+                 */
+                VISUALMESH_ALWAYS_INLINE void tap(const std::array<Int, 36>& w,
+                                                  const int& dx,
+                                                  const int& dy,
+                                                  const Int& red_row,
+                                                  const Int& red_col,
+                                                  std::array<Int, 3>& rgb) {
+                    // The 5x5 patch around this tap within the window
+                    auto p = [&](const int& y, const int& x) -> const Int& { return w[(y + dy) * 6 + x + dx]; };
+
+                    const Int centre = p(2, 2);
+                    const Int axis   = p(0, 2) + p(2, 0) + p(2, 4) + p(4, 2);
+                    const Int inner  = p(1, 2) + p(2, 1) + p(2, 3) + p(3, 2);
+                    const Int diag   = p(1, 1) + p(1, 3) + p(3, 1) + p(3, 3);
+                    const Int far_v  = p(0, 2) + p(4, 2);
+                    const Int far_h  = p(2, 0) + p(2, 4);
+                    const Int near_v = p(1, 2) + p(3, 2);
+                    const Int near_h = p(2, 1) + p(2, 3);
+
+                    // G_R, R_B, R_GR and R_GB
+                    Int cross = -8 * axis + 16 * inner + 32 * centre;
+                    Int x     = -12 * axis + 16 * diag + 48 * centre;
+                    Int h     = 4 * far_v - 8 * diag - 8 * far_h + 32 * near_h + 40 * centre;
+                    Int v     = -8 * far_v - 8 * diag + 32 * near_v + 4 * far_h + 40 * centre;
+                    unscale(cross);
+                    unscale(x);
+                    unscale(h);
+                    unscale(v);
+
+                    // R: (centre, cross, x)  GR: (h, centre, v)  GB: (v, centre, h)  B: (x, cross, centre)
+                    const Int is_r  = red_row & red_col;
+                    const Int is_gr = red_row & ~red_col;
+                    const Int is_gb = ~red_row & red_col;
+                    select(rgb[0], is_gb, v, x);
+                    select(rgb[0], is_gr, h, rgb[0]);
+                    select(rgb[0], is_r, centre, rgb[0]);
+                    select(rgb[1], red_row ^ red_col, centre, cross);
+                    select(rgb[2], is_gb, h, centre);
+                    select(rgb[2], is_gr, v, rgb[2]);
+                    select(rgb[2], is_r, x, rgb[2]);
+                }
+
+                /**
+                 * @brief Bilinearly sample LANES points from a bayer image
+                 *
+                 * @param P          the pixel coordinates of the points
+                 * @param image      the image bytes
+                 * @param dimensions the dimensions of the input image
+                 * @param red        the column and row of the red pixel in each 2x2 tile of the pattern
+                 * @param out        the four channels of each point
+                 *
+                 * @return false without writing anything if one of the points is on the last row or column of the
+                 *         image, where the bilinear quad collapses
+                 */
+                template <typename Scalar>
+                VISUALMESH_ALWAYS_INLINE bool sample(const vec2<Scalar>* P,
+                                                     const uint8_t* const image,
+                                                     const vec2<int>& dimensions,
+                                                     const vec2<int>& red,
+                                                     Scalar* out) {
+                    std::array<int, LANES> x1{};
+                    std::array<int, LANES> y1{};
+                    for (int l = 0; l < LANES; ++l) {
+                        x1[l] = std::max(int(std::floor(P[l][0])), 0);
+                        y1[l] = std::max(int(std::floor(P[l][1])), 0);
+                        if (x1[l] + 1 > dimensions[0] - 1 || y1[l] + 1 > dimensions[1] - 1) { return false; }
+                    }
+
+                    // Gather the 6x6 window that covers the 5x5 patches of all four taps, clamped to the image
+                    std::array<Int, 36> w;
+                    Int red_row;
+                    Int red_col;
+                    for (int l = 0; l < LANES; ++l) {
+                        for (int y = 0; y < 6; ++y) {
+                            const uint8_t* row =
+                              image + std::min(std::max(y1[l] - 2 + y, 0), dimensions[1] - 1) * dimensions[0];
+                            for (int x = 0; x < 6; ++x) {
+                                w[y * 6 + x][l] = row[std::min(std::max(x1[l] - 2 + x, 0), dimensions[0] - 1)];
+                            }
+                        }
+                        red_row[l] = (y1[l] & 1) == red[1] ? -1 : 0;
+                        red_col[l] = (x1[l] & 1) == red[0] ? -1 : 0;
+                    }
+
+                    // The taps to the right and below are on the other parity
+                    std::array<std::array<Int, 3>, 4> q;
+                    tap(w, 0, 0, red_row, red_col, q[0]);
+                    tap(w, 1, 0, red_row, ~red_col, q[1]);
+                    tap(w, 0, 1, ~red_row, red_col, q[2]);
+                    tap(w, 1, 1, ~red_row, ~red_col, q[3]);
+
+                    // Blend the taps the same way as interpolate so the results match it exactly
+                    const Scalar norm  = Scalar(1.0 / 255.0);
+                    const Scalar alpha = Scalar(255) * norm;
+                    for (int l = 0; l < LANES; ++l) {
+                        const Scalar x  = P[l][0];
+                        const Scalar y  = P[l][1];
+                        const Scalar wa = Scalar(x1[l] + 1) - x;
+                        const Scalar wb = x - Scalar(x1[l]);
+                        const Scalar wc = Scalar(y1[l] + 1) - y;
+                        const Scalar wd = y - Scalar(y1[l]);
+                        for (int c = 0; c < 3; ++c) {
+                            const Scalar r1 = Scalar(q[0][c][l]) * norm * wa + Scalar(q[1][c][l]) * norm * wb;
+                            const Scalar r2 = Scalar(q[2][c][l]) * norm * wa + Scalar(q[3][c][l]) * norm * wb;
+                            out[l * 4 + c]  = r1 * wc + r2 * wd;
+                        }
+                        out[l * 4 + 3] = (alpha * wa + alpha * wb) * wc + (alpha * wa + alpha * wb) * wd;
+                    }
+                    return true;
+                }
+
+
+            }  // namespace lanes
+#endif  // defined(__GNUC__) || defined(__clang__)
+
         }  // namespace bayer
     }      // namespace cpu
 }  // namespace engine
@@ -0,0 +1,384 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef VISUALMESH_ENGINE_CPU_DENSE_HPP
+#define VISUALMESH_ENGINE_CPU_DENSE_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#include "apply_activation.hpp"
+#include "target.hpp"
+#include "visualmesh/compiled_network.hpp"
+
+namespace visualmesh {
+namespace engine {
+    namespace cpu {
+
+        /**
+         * @brief The number of outputs that the dense kernels calculate together, one 64 byte cache line worth
+         *
+         * @details
+         *  The network used by the CPU engine is compiled with this block size. For each block the weights are stored
+         *  input major so that for a single input value the weights it is multiplied against are contiguous and aligned.
+         *  This lets a group of points be multiplied against a block using only aligned vector loads and fused multiply
+         *  adds.
+         *
+         * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+         *
+         * @return the number of outputs in a block
+         */
+        template <typename Scalar>
+        constexpr int dense_block() {
+            return 64 / sizeof(Scalar);
+        }
+
+        namespace dense_detail {
+
+            /// The number of points that are multiplied against a block of weights at the same time
+            constexpr int POINTS = 4;
+
+            /**
+             * @brief A source of input rows where each point's input is a single contiguous row
+             *
+             * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+             */
+            template <typename Scalar>
+            struct Contiguous {
+                static constexpr int N_SEGMENTS = 1;
+
+                /// Get the start of a segment of the input row for a point
+                VISUALMESH_ALWAYS_INLINE const Scalar* segment(const std::size_t& point, const int& /*s*/) const {
+                    return data + point * dimensions;
+                }
+
+                /// The input data
+                const Scalar* data;
+                /// The number of values in each segment
+                int dimensions;
+            };
+
+            /**
+             * @brief A source of input rows that gathers each point's row from itself and its neighbours
+             *
+             * @details
+             *  This is the input to the first layer of a convolution. Rather than building the row for each point by
+             *  copying its own values followed by each of its neighbours values, the segments are read in place from the
+             *  previous layer's output.
+             *
+             * @tparam Scalar       the scalar type used for calculations and storage (normally one of float or double)
+             * @tparam N_NEIGHBOURS the number of neighbours that each point has
+             */
+            template <typename Scalar, std::size_t N_NEIGHBOURS>
+            struct Gathered {
+                static constexpr int N_SEGMENTS = N_NEIGHBOURS + 1;
+
+                /// Get the start of a segment of the input row for a point, segment 0 is the point itself
+                VISUALMESH_ALWAYS_INLINE const Scalar* segment(const std::size_t& point, const int& s) const {
+                    return data + (s == 0 ? point : neighbourhood[point][s - 1]) * dimensions;
+                }
+
+                /// The output of the previous layer
+                const Scalar* data;
+                /// The number of values in each segment, the dimensions of the previous layer
+                int dimensions;
+                /// The neighbourhood graph for the points
+                const std::array<int, N_NEIGHBOURS>* neighbourhood;
+            };
+
+            /**
+             * @brief A BLOCK wide group of values that is operated on as a single vector
+             *
+             * @details
+             *  With GCC compatible compilers this is a generic vector extension type, which is lowered to the widest
+             *  vector registers available for the target the kernel is compiled for (one zmm, two ymm, four xmm or four
+             *  NEON registers). This is used rather than relying on the auto vectoriser, which at higher optimisation
+             *  levels may decide to vectorise the wrong loop and use gather instructions.
+             *
+             * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+             */
+            template <typename Scalar>
+            struct Lanes {
+                static constexpr int BLOCK = dense_block<Scalar>();
+#if defined(__GNUC__) || defined(__clang__)
+                typedef Scalar type __attribute__((vector_size(BLOCK * sizeof(Scalar))));
+
+                static VISUALMESH_ALWAYS_INLINE void load(type& v, const Scalar* ptr) {
+                    std::memcpy(&v, ptr, sizeof(type));
+                }
+                static VISUALMESH_ALWAYS_INLINE void store(const type& v, Scalar* ptr) {
+                    std::memcpy(ptr, &v, sizeof(type));
+                }
+                static VISUALMESH_ALWAYS_INLINE void madd(type& acc, const Scalar& x, const Scalar* w) {
+                    type v;
+                    load(v, w);
+                    acc += x * v;
+                }
+#else
+                using type = std::array<Scalar, BLOCK>;
+
+                static VISUALMESH_ALWAYS_INLINE void load(type& v, const Scalar* ptr) {
+                    std::copy(ptr, ptr + BLOCK, v.begin());
+                }
+                static VISUALMESH_ALWAYS_INLINE void store(const type& v, Scalar* ptr) {
+                    std::copy(v.begin(), v.end(), ptr);
+                }
+                static VISUALMESH_ALWAYS_INLINE void madd(type& acc, const Scalar& x, const Scalar* w) {
+                    for (int v = 0; v < BLOCK; ++v) {
+                        acc[v] += x * w[v];
+                    }
+                }
+#endif
+            };
+
+            /**
+             * @brief Multiply a group of points against a layer
+             *
+             * @details
+             *  This is the portable kernel that all the instruction set specific versions are compiled from. The
+             *  accumulators for P points by BLOCK outputs are kept in vector registers, and each input value is
+             *  broadcast and multiplied against the BLOCK contiguous weights that it contributes to.
+             */
+            template <int P, typename Scalar, typename Source, typename Activation>
+            VISUALMESH_ALWAYS_INLINE void block(const LayerView<Scalar>& layer,
+                                                const Source& source,
+                                                const Activation& fn,
+                                                const std::size_t& first,
+                                                Scalar* out) {
+                using L             = Lanes<Scalar>;
+                constexpr int BLOCK = dense_block<Scalar>();
+                const int& n_in     = layer.input_dimensions;
+                const int& n_out    = layer.output_dimensions;
+                const int& n_seg    = source.dimensions;
+
+                for (int b = 0; b < layer.n_blocks; ++b) {
+                    const Scalar* w = layer.weights + b * n_in * BLOCK;
+
+                    // Start from the biases
+                    std::array<typename L::type, P> acc;
+                    for (int p = 0; p < P; ++p) {
+                        L::load(acc[p], layer.biases + b * BLOCK);
+                    }
+
+                    // Accumulate each input against the BLOCK weights it contributes to
+                    for (int s = 0; s < Source::N_SEGMENTS; ++s) {
+                        std::array<const Scalar*, P> in;
+                        for (int p = 0; p < P; ++p) {
+                            in[p] = source.segment(first + p, s);
+                        }
+                        const Scalar* ws = w + s * n_seg * BLOCK;
+                        for (int i = 0; i < n_seg; ++i) {
+                            for (int p = 0; p < P; ++p) {
+                                L::madd(acc[p], in[p][i], ws + i * BLOCK);
+                            }
+                        }
+                    }
+
+                    // Apply the activation and store the outputs that exist (the last block may be padded)
+                    const int n_valid = std::min(BLOCK, n_out - b * BLOCK);
+                    for (int p = 0; p < P; ++p) {
+                        alignas(64) std::array<Scalar, BLOCK> result;
+                        L::store(acc[p], result.data());
+                        for (int v = 0; v < BLOCK; ++v) {
+                            result[v] = fn(result[v]);
+                        }
+                        std::copy(result.begin(), std::next(result.begin(), n_valid), out + p * n_out + b * BLOCK);
+                    }
+                }
+            }
+
+            template <typename Scalar, typename Source, typename Activation>
+            VISUALMESH_ALWAYS_INLINE void multiply(const LayerView<Scalar>& layer,
+                                                   const Source& source,
+                                                   const Activation& fn,
+                                                   Scalar* out,
+                                                   const std::size_t& begin,
+                                                   const std::size_t& end) {
+                std::size_t i = begin;
+                for (; i + POINTS <= end; i += POINTS) {
+                    block<POINTS>(layer, source, fn, i, out + (i - begin) * layer.output_dimensions);
+                }
+                for (; i < end; ++i) {
+                    block<1>(layer, source, fn, i, out + (i - begin) * layer.output_dimensions);
+                }
+            }
+
+            template <typename Scalar, typename Source, typename Activation>
+            void multiply_generic(const LayerView<Scalar>& layer,
+                                  const Source& source,
+                                  const Activation& fn,
+                                  Scalar* out,
+                                  const std::size_t& begin,
+                                  const std::size_t& end) {
+                multiply(layer, source, fn, out, begin, end);
+            }
+
+#if defined(VISUALMESH_CPU_RUNTIME_DISPATCH)
+            template <typename Scalar, typename Source, typename Activation>
+            __attribute__((target("avx2,fma"))) void multiply_avx2(const LayerView<Scalar>& layer,
+                                                                   const Source& source,
+                                                                   const Activation& fn,
+                                                                   Scalar* out,
+                                                                   const std::size_t& begin,
+                                                                   const std::size_t& end) {
+                multiply(layer, source, fn, out, begin, end);
+            }
+
+            template <typename Scalar, typename Source, typename Activation>
+            __attribute__((target("avx512f,avx2,fma"))) void multiply_avx512(const LayerView<Scalar>& layer,
+                                                                             const Source& source,
+                                                                             const Activation& fn,
+                                                                             Scalar* out,
+                                                                             const std::size_t& begin,
+                                                                             const std::size_t& end) {
+                multiply(layer, source, fn, out, begin, end);
+            }
+#endif  // defined(VISUALMESH_CPU_RUNTIME_DISPATCH)
+
+            /// The instruction sets that we have specialised kernels for
+            enum class ISA { GENERIC, AVX2, AVX512 };
+
+            /**
+             * @brief Work out which instruction set the dense layers should use on the machine we are running on
+             *
+             * @return the best instruction set that is available
+             */
+            inline ISA detect_isa() {
+#if defined(VISUALMESH_CPU_RUNTIME_DISPATCH)
+                __builtin_cpu_init();
+                if (__builtin_cpu_supports("avx512f")) { return ISA::AVX512; }
+                if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) { return ISA::AVX2; }
+#endif  // defined(VISUALMESH_CPU_RUNTIME_DISPATCH)
+                return ISA::GENERIC;
+            }
+
+            /**
+             * @brief Run the best available kernel for this processor, selected once at runtime
+             */
+            template <typename Scalar, typename Source, typename Activation>
+            void run_isa(const LayerView<Scalar>& layer,
+                         const Source& source,
+                         const Activation& fn,
+                         Scalar* out,
+                         const std::size_t& begin,
+                         const std::size_t& end) {
+                static const ISA isa = detect_isa();
+                switch (isa) {
+#if defined(VISUALMESH_CPU_RUNTIME_DISPATCH)
+                    case ISA::AVX512: multiply_avx512(layer, source, fn, out, begin, end); break;
+                    case ISA::AVX2: multiply_avx2(layer, source, fn, out, begin, end); break;
+#endif  // defined(VISUALMESH_CPU_RUNTIME_DISPATCH)
+                    default: multiply_generic(layer, source, fn, out, begin, end); break;
+                }
+            }
+
+            /**
+             * @brief Run the kernel with the layer's activation function fused into the store of the outputs
+             *
+             * @details
+             *  Softmax can't be done on a single block as it needs the whole row, so the exponential is fused into the
+             *  kernel and each row is normalised afterwards while it is still in cache.
+             */
+            template <bool Approximate, typename Scalar, typename Source>
+            void run(const LayerView<Scalar>& layer,
+                     const Source& source,
+                     Scalar* out,
+                     const std::size_t& begin,
+                     const std::size_t& end) {
+                using namespace activation;  // NOLINT(google-build-using-namespace) function scope is fine
+                switch (layer.activation) {
+                    case ActivationFunction::SELU:
+                        run_isa(layer, source, Selu<Scalar, Approximate>(), out, begin, end);
+                        break;
+                    case ActivationFunction::RELU:
+                        run_isa(layer, source, Relu<Scalar, Approximate>(), out, begin, end);
+                        break;
+                    case ActivationFunction::TANH:
+                        run_isa(layer, source, Tanh<Scalar, Approximate>(), out, begin, end);
+                        break;
+                    case ActivationFunction::SOFTMAX:
+                        run_isa(layer, source, Exp<Scalar, Approximate>(), out, begin, end);
+                        normalise_rows(out, out + (end - begin) * layer.output_dimensions, layer.output_dimensions);
+                        break;
+                }
+            }
+
+        }  // namespace dense_detail
+
+        /**
+         * @brief Apply a layer, including its activation function, to a set of points
+         *
+         * @details
+         *  The kernel that is used is selected once at runtime based on the instruction sets the processor supports.
+         *  The activation function is applied to the outputs before they are stored.
+         *
+         * @tparam Approximate if the fast approximations of exp and tanh should be used for the activation
+         * @tparam Scalar      the scalar type used for calculations and storage (normally one of float or double)
+         *
+         * @param layer    the layer to apply, compiled with a block size of dense_block<Scalar>()
+         * @param in       the input points, n_points rows of layer.input_dimensions values
+         * @param out      the output points, n_points rows of layer.output_dimensions values
+         * @param n_points the number of points to process
+         */
+        template <bool Approximate = false, typename Scalar>
+        void dense(const LayerView<Scalar>& layer, const Scalar* in, Scalar* out, const std::size_t& n_points) {
+            dense_detail::run<Approximate>(
+              layer, dense_detail::Contiguous<Scalar>{in, layer.input_dimensions}, out, 0, n_points);
+        }
+
+        /**
+         * @brief Apply the first layer of a convolution, gathering each point's neighbours as they are multiplied
+         *
+         * @details
+         *  This is equivalent to building the (N_NEIGHBOURS + 1) times larger gathered input for each point and then
+         *  calling dense on it, however the gathered input is never stored. Each neighbour's values are read directly
+         *  from the previous layer's output as they are accumulated.
+         *
+         * @tparam Approximate  if the fast approximations of exp and tanh should be used for the activation
+         * @tparam Scalar       the scalar type used for calculations and storage (normally one of float or double)
+         * @tparam N_NEIGHBOURS the number of neighbours that each point has
+         *
+         * @param layer         the layer to apply, compiled with a block size of dense_block<Scalar>(). Its input
+         *                      dimensions must be (N_NEIGHBOURS + 1) times the dimensions of the input
+         * @param in            the output of the previous layer for every point
+         * @param dimensions    the number of values for each point in the input
+         * @param neighbourhood the neighbourhood graph for every point
+         * @param out           where to write the output for the point begin onward
+         * @param begin         the first point to process
+         * @param end           one past the last point to process
+         */
+        template <bool Approximate = false, typename Scalar, std::size_t N_NEIGHBOURS>
+        void dense_gather(const LayerView<Scalar>& layer,
+                          const Scalar* in,
+                          const int& dimensions,
+                          const std::vector<std::array<int, N_NEIGHBOURS>>& neighbourhood,
+                          Scalar* out,
+                          const std::size_t& begin,
+                          const std::size_t& end) {
+            dense_detail::run<Approximate>(
+              layer, dense_detail::Gathered<Scalar, N_NEIGHBOURS>{in, dimensions, neighbourhood.data()}, out, begin, end);
+        }
+
+    }  // namespace cpu
+}  // namespace engine
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_ENGINE_CPU_DENSE_HPP
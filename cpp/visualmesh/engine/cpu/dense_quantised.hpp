@@ -0,0 +1,404 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef VISUALMESH_ENGINE_CPU_DENSE_QUANTISED_HPP
+#define VISUALMESH_ENGINE_CPU_DENSE_QUANTISED_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "apply_activation.hpp"
+#include "target.hpp"
+#include "visualmesh/quantisation.hpp"
+
+#if defined(VISUALMESH_CPU_RUNTIME_DISPATCH)
+#include <immintrin.h>
+#endif  // defined(VISUALMESH_CPU_RUNTIME_DISPATCH)
+
+namespace visualmesh {
+namespace engine {
+    namespace cpu {
+
+        namespace quantised_detail {
+
+            /// The number of points that are multiplied against a block of weights at the same time
+            constexpr int POINTS = 4;
+
+            /**
+             * @brief Copy values into a row and zero the padding on the end of it
+             */
+            VISUALMESH_ALWAYS_INLINE uint8_t* pad_row(uint8_t* row, const int& length, const int& padded) {
+                std::fill(row + length, row + padded, uint8_t(0));
+                return row;
+            }
+
+            /**
+             * @brief A source of quantised input rows where each point's input is a single contiguous row
+             */
+            struct ContiguousRows {
+                /// Get the input row for a point, scratch is used if the row needs padding
+                VISUALMESH_ALWAYS_INLINE const uint8_t* row(const std::size_t& point,
+                                                            uint8_t* scratch,
+                                                            const int& padded) const {
+                    const uint8_t* start = data + point * dimensions;
+                    if (padded == dimensions) { return start; }
+                    std::copy(start, start + dimensions, scratch);
+                    return pad_row(scratch, dimensions, padded);
+                }
+
+                /// The quantised input data
+                const uint8_t* data;
+                /// The number of values in each row
+                int dimensions;
+            };
+
+            /**
+             * @brief A source of quantised input rows that gathers each point's row from itself and its neighbours
+             *
+             * @tparam N_NEIGHBOURS the number of neighbours that each point has
+             */
+            template <std::size_t N_NEIGHBOURS>
+            struct GatheredRows {
+                /// Get the input row for a point, it is always built in scratch
+                VISUALMESH_ALWAYS_INLINE const uint8_t* row(const std::size_t& point,
+                                                            uint8_t* scratch,
+                                                            const int& padded) const {
+                    uint8_t* out = std::copy(data + point * dimensions, data + (point + 1) * dimensions, scratch);
+                    for (const auto& n : neighbourhood[point]) {
+                        out = std::copy(data + n * dimensions, data + (n + 1) * dimensions, out);
+                    }
+                    return pad_row(scratch, int(N_NEIGHBOURS + 1) * dimensions, padded);
+                }
+
+                /// The quantised output of the previous layer
+                const uint8_t* data;
+                /// The number of values for each point in the previous layer
+                int dimensions;
+                /// The neighbourhood graph for the points
+                const std::array<int, N_NEIGHBOURS>* neighbourhood;
+            };
+
+            /**
+             * @brief Dequantise the accumulated dot products for a block, apply the activation and store the outputs
+             */
+            template <typename Scalar, typename Activation>
+            VISUALMESH_ALWAYS_INLINE void finish(const QuantisedLayer<Scalar>& layer,
+                                                 const int& b,
+                                                 const int32_t* acc,
+                                                 const Activation& fn,
+                                                 Scalar* out) {
+                constexpr int BLOCK = QuantisedLayer<Scalar>::BLOCK;
+                const int first     = b * BLOCK;
+                const int n_valid   = std::min(BLOCK, layer.output_dimensions - first);
+                for (int v = 0; v < n_valid; ++v) {
+                    const int j = first + v;
+                    out[j]      = fn(layer.biases[j] + layer.scales[j] * Scalar(acc[v] - layer.offsets[j]));
+                }
+            }
+
+            /**
+             * @brief The portable kernel, the four way byte dot products are written as plain integer arithmetic
+             */
+            struct GenericBlock {
+                template <int P, typename Scalar, typename Activation>
+                VISUALMESH_ALWAYS_INLINE void operator()(const QuantisedLayer<Scalar>& layer,
+                                                         const std::array<const uint8_t*, P>& rows,
+                                                         const Activation& fn,
+                                                         Scalar* out) const {
+                    constexpr int BLOCK = QuantisedLayer<Scalar>::BLOCK;
+                    constexpr int GROUP = QuantisedLayer<Scalar>::GROUP;
+                    const int n_groups  = layer.padded_inputs / GROUP;
+
+                    for (int b = 0; b < layer.n_blocks; ++b) {
+                        const int8_t* w = layer.weights.data() + b * n_groups * BLOCK * GROUP;
+
+                        std::array<std::array<int32_t, BLOCK>, P> acc{};
+                        for (int g = 0; g < n_groups; ++g) {
+                            const int8_t* wg = w + g * BLOCK * GROUP;
+                            for (int p = 0; p < P; ++p) {
+                                const uint8_t* x = rows[p] + g * GROUP;
+                                for (int o = 0; o < BLOCK; ++o) {
+                                    int32_t sum = 0;
+                                    for (int k = 0; k < GROUP; ++k) {
+                                        sum += int32_t(x[k]) * int32_t(wg[o * GROUP + k]);
+                                    }
+                                    acc[p][o] += sum;
+                                }
+                            }
+                        }
+
+                        for (int p = 0; p < P; ++p) {
+                            finish(layer, b, acc[p].data(), fn, out + p * layer.output_dimensions);
+                        }
+                    }
+                }
+            };
+
+#if defined(VISUALMESH_CPU_RUNTIME_DISPATCH)
+            /**
+             * @brief The AVX512 VNNI kernel, one vpdpbusd multiplies four inputs against a whole block of weights
+             *
+             * @details
+             *  This can't be always inline as the generic driver loop it is called from is compiled without AVX512.
+             */
+            struct VnniBlock {
+                template <int P, typename Scalar, typename Activation>
+                __attribute__((target("avx512vnni,avx512bw,avx512f,avx2,fma"))) void operator()(
+                  const QuantisedLayer<Scalar>& layer,
+                  const std::array<const uint8_t*, P>& rows,
+                  const Activation& fn,
+                  Scalar* out) const {
+                    constexpr int BLOCK = QuantisedLayer<Scalar>::BLOCK;
+                    constexpr int GROUP = QuantisedLayer<Scalar>::GROUP;
+                    const int n_groups  = layer.padded_inputs / GROUP;
+
+                    for (int b = 0; b < layer.n_blocks; ++b) {
+                        const int8_t* w = layer.weights.data() + b * n_groups * BLOCK * GROUP;
+
+                        __m512i acc[P];  // NOLINT(modernize-avoid-c-arrays) std::array drops the vector attributes
+                        for (int p = 0; p < P; ++p) {
+                            acc[p] = _mm512_setzero_si512();
+                        }
+                        for (int g = 0; g < n_groups; ++g) {
+                            const __m512i wg = _mm512_load_si512(w + g * BLOCK * GROUP);
+                            for (int p = 0; p < P; ++p) {
+                                int32_t x;
+                                std::memcpy(&x, rows[p] + g * GROUP, sizeof(x));
+                                acc[p] = _mm512_dpbusd_epi32(acc[p], _mm512_set1_epi32(x), wg);
+                            }
+                        }
+
+                        for (int p = 0; p < P; ++p) {
+                            alignas(64) std::array<int32_t, BLOCK> result;
+                            _mm512_store_si512(result.data(), acc[p]);
+                            finish(layer, b, result.data(), fn, out + p * layer.output_dimensions);
+                        }
+                    }
+                }
+            };
+#endif  // defined(VISUALMESH_CPU_RUNTIME_DISPATCH)
+
+            template <typename Block, typename Scalar, typename Rows, typename Activation>
+            VISUALMESH_ALWAYS_INLINE void multiply(const QuantisedLayer<Scalar>& layer,
+                                                   const Rows& source,
+                                                   const Activation& fn,
+                                                   Scalar* out,
+                                                   const std::size_t& begin,
+                                                   const std::size_t& end) {
+                const Block kernel{};
+                const int& padded = layer.padded_inputs;
+                std::vector<uint8_t> scratch(POINTS * padded);
+
+                std::size_t i = begin;
+                for (; i + POINTS <= end; i += POINTS) {
+                    std::array<const uint8_t*, POINTS> rows;
+                    for (int p = 0; p < POINTS; ++p) {
+                        rows[p] = source.row(i + p, scratch.data() + p * padded, padded);
+                    }
+                    kernel.template operator()<POINTS>(layer, rows, fn, out + (i - begin) * layer.output_dimensions);
+                }
+                for (; i < end; ++i) {
+                    const std::array<const uint8_t*, 1> rows = {{source.row(i, scratch.data(), padded)}};
+                    kernel.template operator()<1>(layer, rows, fn, out + (i - begin) * layer.output_dimensions);
+                }
+            }
+
+            template <typename Scalar, typename Rows, typename Activation>
+            void multiply_generic(const QuantisedLayer<Scalar>& layer,
+                                  const Rows& source,
+                                  const Activation& fn,
+                                  Scalar* out,
+                                  const std::size_t& begin,
+                                  const std::size_t& end) {
+                multiply<GenericBlock>(layer, source, fn, out, begin, end);
+            }
+
+#if defined(VISUALMESH_CPU_RUNTIME_DISPATCH)
+            template <typename Scalar, typename Rows, typename Activation>
+            __attribute__((target("avx2,fma"))) void multiply_avx2(const QuantisedLayer<Scalar>& layer,
+                                                                   const Rows& source,
+                                                                   const Activation& fn,
+                                                                   Scalar* out,
+                                                                   const std::size_t& begin,
+                                                                   const std::size_t& end) {
+                multiply<GenericBlock>(layer, source, fn, out, begin, end);
+            }
+
+            template <typename Scalar, typename Rows, typename Activation>
+            __attribute__((target("avx512vnni,avx512bw,avx512f,avx2,fma"))) void multiply_vnni(
+              const QuantisedLayer<Scalar>& layer,
+              const Rows& source,
+              const Activation& fn,
+              Scalar* out,
+              const std::size_t& begin,
+              const std::size_t& end) {
+                multiply<VnniBlock>(layer, source, fn, out, begin, end);
+            }
+#endif  // defined(VISUALMESH_CPU_RUNTIME_DISPATCH)
+
+            /// The instruction sets that we have specialised quantised kernels for
+            enum class ISA { GENERIC, AVX2, VNNI };
+
+            /**
+             * @brief Work out which instruction set the quantised layers should use on the machine we are running on
+             *
+             * @return the best instruction set that is available
+             */
+            inline ISA detect_isa() {
+#if defined(VISUALMESH_CPU_RUNTIME_DISPATCH)
+                __builtin_cpu_init();
+                if (__builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512bw")) { return ISA::VNNI; }
+                if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) { return ISA::AVX2; }
+#endif  // defined(VISUALMESH_CPU_RUNTIME_DISPATCH)
+                return ISA::GENERIC;
+            }
+
+            /**
+             * @brief Run the best available kernel for this processor, selected once at runtime
+             */
+            template <typename Scalar, typename Rows, typename Activation>
+            void run_isa(const QuantisedLayer<Scalar>& layer,
+                         const Rows& source,
+                         const Activation& fn,
+                         Scalar* out,
+                         const std::size_t& begin,
+                         const std::size_t& end) {
+                static const ISA isa = detect_isa();
+                switch (isa) {
+#if defined(VISUALMESH_CPU_RUNTIME_DISPATCH)
+                    case ISA::VNNI: multiply_vnni(layer, source, fn, out, begin, end); break;
+                    case ISA::AVX2: multiply_avx2(layer, source, fn, out, begin, end); break;
+#endif  // defined(VISUALMESH_CPU_RUNTIME_DISPATCH)
+                    default: multiply_generic(layer, source, fn, out, begin, end); break;
+                }
+            }
+
+            /**
+             * @brief Run the kernel with the layer's activation function fused into the store of the outputs
+             */
+            template <bool Approximate, typename Scalar, typename Rows>
+            void run(const QuantisedLayer<Scalar>& layer,
+                     const Rows& source,
+                     Scalar* out,
+                     const std::size_t& begin,
+                     const std::size_t& end) {
+                using namespace activation;  // NOLINT(google-build-using-namespace) function scope is fine
+                switch (layer.activation) {
+                    case ActivationFunction::SELU:
+                        run_isa(layer, source, Selu<Scalar, Approximate>(), out, begin, end);
+                        break;
+                    case ActivationFunction::RELU:
+                        run_isa(layer, source, Relu<Scalar, Approximate>(), out, begin, end);
+                        break;
+                    case ActivationFunction::TANH:
+                        run_isa(layer, source, Tanh<Scalar, Approximate>(), out, begin, end);
+                        break;
+                    case ActivationFunction::SOFTMAX:
+                        run_isa(layer, source, Exp<Scalar, Approximate>(), out, begin, end);
+                        normalise_rows(out, out + (end - begin) * layer.output_dimensions, layer.output_dimensions);
+                        break;
+                }
+            }
+
+        }  // namespace quantised_detail
+
+        /**
+         * @brief Quantise values to 8 bits so they can be used as the input to a quantised layer
+         *
+         * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+         *
+         * @param parameters the quantisation of the layer's input
+         * @param in         the values to quantise
+         * @param out        where to write the quantised values
+         * @param n          the number of values to quantise
+         */
+        template <typename Scalar>
+        void quantise(const QuantisationParameters<Scalar>& parameters,
+                      const Scalar* in,
+                      uint8_t* out,
+                      const std::size_t& n) {
+            const Scalar inv    = Scalar(1) / parameters.scale;
+            const Scalar offset = Scalar(parameters.zero_point) + Scalar(0.5);
+            const Scalar max    = Scalar(QuantisationParameters<Scalar>::MAX_VALUE);
+            for (std::size_t i = 0; i < n; ++i) {
+                // Everything is positive after the clamp so truncation is the same as the floor in quantise
+                out[i] = uint8_t(std::min(max, std::max(Scalar(0), in[i] * inv + offset)));
+            }
+        }
+
+        /**
+         * @brief Apply a quantised layer, including its activation function, to a set of quantised points
+         *
+         * @tparam Approximate if the fast approximations of exp and tanh should be used for the activation
+         * @tparam Scalar      the scalar type used for calculations and storage (normally one of float or double)
+         *
+         * @param layer    the quantised layer to apply
+         * @param in       the quantised input points, n_points rows of layer.input_dimensions values
+         * @param out      the output points, n_points rows of layer.output_dimensions values
+         * @param n_points the number of points to process
+         */
+        template <bool Approximate = false, typename Scalar>
+        void dense_quantised(const QuantisedLayer<Scalar>& layer,
+                             const uint8_t* in,
+                             Scalar* out,
+                             const std::size_t& n_points) {
+            quantised_detail::run<Approximate>(
+              layer, quantised_detail::ContiguousRows{in, layer.input_dimensions}, out, 0, n_points);
+        }
+
+        /**
+         * @brief Apply the quantised first layer of a convolution, gathering each point's neighbours as it goes
+         *
+         * @tparam Approximate  if the fast approximations of exp and tanh should be used for the activation
+         * @tparam Scalar       the scalar type used for calculations and storage (normally one of float or double)
+         * @tparam N_NEIGHBOURS the number of neighbours that each point has
+         *
+         * @param layer         the quantised layer to apply, its input dimensions must be (N_NEIGHBOURS + 1) times
+         *                      the dimensions of the input
+         * @param in            the quantised output of the previous layer for every point
+         * @param dimensions    the number of values for each point in the input
+         * @param neighbourhood the neighbourhood graph for every point
+         * @param out           where to write the output for the point begin onward
+         * @param begin         the first point to process
+         * @param end           one past the last point to process
+         */
+        template <bool Approximate = false, typename Scalar, std::size_t N_NEIGHBOURS>
+        void dense_quantised_gather(const QuantisedLayer<Scalar>& layer,
+                                    const uint8_t* in,
+                                    const int& dimensions,
+                                    const std::vector<std::array<int, N_NEIGHBOURS>>& neighbourhood,
+                                    Scalar* out,
+                                    const std::size_t& begin,
+                                    const std::size_t& end) {
+            quantised_detail::run<Approximate>(
+              layer,
+              quantised_detail::GatheredRows<N_NEIGHBOURS>{in, dimensions, neighbourhood.data()},
+              out,
+              begin,
+              end);
+        }
+
+    }  // namespace cpu
+}  // namespace engine
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_ENGINE_CPU_DENSE_QUANTISED_HPP
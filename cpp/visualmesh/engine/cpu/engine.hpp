@@ -18,17 +18,36 @@
 #ifndef VISUALMESH_ENGINE_CPU_ENGINE_HPP
 #define VISUALMESH_ENGINE_CPU_ENGINE_HPP
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
 #include <cstdint>
-#include <numeric>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
 
 #include "apply_activation.hpp"
+#include "dense.hpp"
+#include "dense_quantised.hpp"
 #include "pixel.hpp"
+#include "visualmesh/batch_frame.hpp"
 #include "visualmesh/classified_mesh.hpp"
+#include "visualmesh/compiled_network.hpp"
+#include "visualmesh/instrumentation.hpp"
+#include "visualmesh/lookup_cache.hpp"
 #include "visualmesh/mesh.hpp"
 #include "visualmesh/network_structure.hpp"
 #include "visualmesh/projected_mesh.hpp"
+#include "visualmesh/quantisation.hpp"
+#include "visualmesh/region.hpp"
 #include "visualmesh/utility/fourcc.hpp"
 #include "visualmesh/utility/math.hpp"
+#include "visualmesh/utility/object_pool.hpp"
+#include "visualmesh/utility/projection.hpp"
+#include "visualmesh/utility/thread_pool.hpp"
 #include "visualmesh/visualmesh.hpp"
 
 namespace visualmesh {
@@ -40,9 +59,12 @@ namespace engine {
          *
          * @details
          *  The CPU implementation is designed to be a simple implementation of the visual mesh projection and
-         *  classification code. It is only single threaded and is not designed to be used in high performance contexts.
-         *  For those use another implementation that is able to take advantage of other system features such as GPUs or
-         *  multithreading.
+         *  classification code. By default it is single threaded, however it can be given a number of threads in which
+         *  case the projection, the neighbourhood gather and each of the network layers are split by point ranges
+         *  across a persistent pool of threads. The results are identical regardless of how many threads are used.
+         *  Classification can be called from several threads at once, each call leases its buffers from a pool of
+         *  scratch buffers so only the network is shared. Calls that use the thread pool take turns using it.
+         *  Changing the precision with quantise is not thread safe.
          *
          * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
          */
@@ -52,27 +74,218 @@ namespace engine {
             /**
              * @brief Construct a new CPU Engine object
              *
-             * @param structure the network structure to use classification
-             */
-            Engine(const NetworkStructure<Scalar>& structure = {}) : structure(structure) {
-                // Transpose all the weights matrices to make it easier for us to multiply against
-                for (auto& conv : this->structure) {
-                    for (auto& layer : conv) {
-                        auto& w = layer.weights;
-                        Weights<Scalar> new_weights(w.front().size(), std::vector<Scalar>(w.size()));
-                        for (unsigned int i = 0; i < w.size(); ++i) {
-                            for (unsigned int j = 0; j < w[i].size(); ++j) {
-                                new_weights[j][i] = w[i][j];
-                            }
-                        }
-                        w = std::move(new_weights);
+             * @param network     the network to use for classification, a NetworkStructure is compiled implicitly
+             * @param concurrency the number of threads to use when projecting and classifying, 1 runs everything on
+             *                    the calling thread
+             * @param approximate use fast polynomial approximations of exp and tanh in the activation functions, these
+             *                    have a relative error below 3e-7 which is within a couple of ulp for float
+             * @param cpus        the processors to pin the threads of the pool to, such as performance_cpus() to keep
+             *                    them off the little cores. When these span NUMA nodes each node works on its own part
+             *                    of every loop. Empty leaves the threads unpinned.
+             */
+            Engine(const CompiledNetwork<Scalar>& network = {},
+                   const unsigned int& concurrency        = 1,
+                   const bool& approximate                = false,
+                   const std::vector<int>& cpus           = {})
+              // Relayout the weights into cache line sized blocks so the dense kernels can use aligned vector loads
+              : network(network, dense_block<Scalar>())
+              , approximate(approximate)
+              , pool(concurrency > 1 ? std::make_shared<ThreadPool>(concurrency, cpus) : nullptr)
+              , scratch(std::make_shared<ObjectPool<Scratch>>())
+              , arenas(std::make_shared<ObjectPool<ProjectionArena>>())
+              , lookup(std::make_shared<IncrementalLookup<Scalar>>()) {}
+
+            /**
+             * @brief Reuse the mesh lookup of previous frames while the camera has only rotated a little
+             *
+             * @details
+             *  Each mesh keeps the lookup of a reference frame, and while the camera stays within the tolerance of it
+             *  only the parts of the mesh near the edge of the screen are checked again. This works best when a single
+             *  camera uses the engine, several cameras sharing a mesh will mostly fall back to full lookups. Changing
+             *  the tolerance is not thread safe.
+             *
+             * @param tolerance the largest rotation in radians that a lookup is reused for, 0 disables reuse
+             */
+            void incremental_lookup(const Scalar& tolerance) {
+                lookup = std::make_shared<IncrementalLookup<Scalar>>(tolerance);
+            }
+
+            /// @return the largest rotation in radians that a lookup is reused for, 0 if reuse is disabled
+            Scalar incremental_lookup() const {
+                return lookup->tolerance;
+            }
+
+            /**
+             * @brief Report the time spent in each stage of every frame
+             *
+             * @details
+             *  The lookup, projection, image load, each convolutional group and the cascade are timed on the calling
+             *  thread. Each projection or classification call is reported as one frame, and a batch as a single frame
+             *  holding the stages of all of its frames. Changing the instrumentation is not thread safe.
+             *
+             * @param instrumentation where to report every frame, or nullptr to stop timing
+             */
+            void instrument(std::shared_ptr<Instrumentation> instrumentation) {
+                this->instrumentation = std::move(instrumentation);
+            }
+
+            /// @return where every frame is reported, or nullptr if the engine isn't being timed
+            const std::shared_ptr<Instrumentation>& instrument() const {
+                return instrumentation;
+            }
+
+            /**
+             * @brief Switch the engine to 8 bit quantised inference, or back to full precision
+             *
+             * @param calibration the observed input ranges of every layer (see calibrate), or an empty calibration to
+             *                    go back to full precision
+             *
+             * @throws std::invalid_argument if the calibration does not cover every layer of the network
+             */
+            void quantise(const Calibration<Scalar>& calibration) {
+                quantised = calibration.empty() ? QuantisedNetwork<Scalar>()
+                                                : QuantisedNetwork<Scalar>(network, calibration);
+            }
+
+            /**
+             * @brief Switch the engine to 8 bit quantised inference using a network that was already quantised
+             *
+             * @param network the quantised version of this engine's network, such as one loaded from a NetworkFile, or
+             *                an empty network to go back to full precision
+             *
+             * @throws std::invalid_argument if the quantised network has a different shape to the engine's network
+             */
+            void quantise(const QuantisedNetwork<Scalar>& network) {
+                bool same = network.empty() || network.size() == this->network.size();
+                for (std::size_t c = 0; same && !network.empty() && c < network.size(); ++c) {
+                    same = network.size(c) == this->network.size(c);
+                    for (std::size_t l = 0; same && l < network.size(c); ++l) {
+                        same = network.layer(c, l).input_dimensions == this->network.info(c, l).input_dimensions
+                               && network.layer(c, l).output_dimensions == this->network.info(c, l).output_dimensions;
                     }
                 }
+                if (!same) { throw std::invalid_argument("The quantised network does not match the engine's network"); }
+                quantised = network;
+            }
+
+            /// @return the precision that classification is executed with
+            Precision precision() const {
+                return quantised.empty() ? Precision::FULL : Precision::INT8;
             }
 
+            /**
+             * @brief Classify the points that the network is confident about early using an intermediate head
+             *
+             * @details
+             *  After the first cascade.groups convolutional groups the head is run over every point. The points whose
+             *  largest head output reaches the threshold take the output of the head, and the rest of the network is
+             *  only run for the other points and the neighbours within its receptive field. Every point that doesn't
+             *  exit early gets the same result as the full network. Calibration always runs the full network. Changing
+             *  the cascade is not thread safe.
+             *
+             * @param cascade the head and where to run it, or a cascade with no head to always run the full network
+             *
+             * @throws std::invalid_argument if the head doesn't fit between the groups of the network
+             */
+            void cascade(const Cascade<Scalar>& cascade) {
+                if (cascade.head.empty()) {
+                    cascade_head = CompiledNetwork<Scalar>();
+                    return;
+                }
+
+                const std::size_t groups = cascade.groups;
+                if (groups == 0 || groups >= network.size() || network.size(groups - 1) == 0) {
+                    throw std::invalid_argument("The cascade must follow a group with layers and leave one to run");
+                }
+                unsigned int dimensions = network.back(groups - 1).output_dimensions;
+                for (const auto& layer : cascade.head) {
+                    if (layer.weights.size() != dimensions) {
+                        throw std::invalid_argument("The cascade head does not fit the output of its group");
+                    }
+                    dimensions = layer.biases.size();
+                }
+                if (network.size(network.size() - 1) == 0
+                    || int(dimensions) != network.back(network.size() - 1).output_dimensions) {
+                    throw std::invalid_argument("The cascade head does not have the same outputs as the network");
+                }
+
+                const NetworkStructure<Scalar> head{cascade.head};
+                cascade_head      = CompiledNetwork<Scalar>(head, dense_block<Scalar>());
+                cascade_groups    = cascade.groups;
+                cascade_threshold = cascade.threshold;
+            }
+
+            /**
+             * @brief The temporary buffers used while projecting a mesh, kept by the caller so they can be reused
+             *
+             * @details
+             *  Every buffer is cleared rather than freed between frames, so once they have grown to fit the largest
+             *  frame projecting doesn't allocate. An arena must only be used by one projection at a time.
+             */
+            struct ProjectionArena {
+                /// The on screen ranges found by the mesh lookup
+                std::vector<std::pair<int, int>> ranges;
+                /// The flattened indices of every point in the ranges
+                std::vector<int> candidates;
+                /// The projected pixel coordinates of every candidate
+                std::vector<vec2<Scalar>> candidate_pixels;
+                /// If each candidate landed on the screen
+                std::vector<uint8_t> on_screen;
+                /// Maps global indices to local indices, -1 for anything that is not on screen
+                std::vector<int> r_lookup;
+            };
+
+            /**
+             * @brief The activations of the previous frames of a camera, kept by the caller so that the points whose
+             * input hasn't changed can reuse them
+             *
+             * @details
+             *  For every node of the mesh this holds the input the network last saw for it and the output of each
+             *  convolutional group, so it takes as much memory as every node's activations. A cache must only be used
+             *  by one camera, and by one call at a time. It starts again by itself when it is used with a different
+             *  mesh, call clear if the network or precision of the engine changes.
+             */
+            struct TemporalCache {
+                /**
+                 * @brief Make an empty cache
+                 *
+                 * @param threshold a point is recomputed when a channel of its input changes by more than this, the
+                 *                  input channels range from 0 to 1
+                 */
+                explicit TemporalCache(const Scalar& threshold = Scalar(0.02)) : threshold(threshold) {}
+
+                /// Forget every activation so the next frame is run in full
+                void clear() {
+                    seen.clear();
+                }
+
+                /// A point is recomputed when a channel of its input changes by more than this
+                Scalar threshold;
+                /// The number of points whose input changed in the last frame, before spreading to their neighbours
+                std::size_t changed = 0;
+
+                /// The identifier of the mesh the activations are for
+                uint64_t mesh = 0;
+                /// The number of frames run with this cache
+                uint32_t frame = 0;
+                /// The last frame each node was on the screen for, the offscreen point is after the nodes
+                std::vector<uint32_t> seen;
+                /// The input of each node that its cached activations were computed from
+                std::vector<Scalar> input;
+                /// The output of each convolutional group for each node
+                std::vector<std::vector<Scalar>> groups;
+                /// If the values of each point on screen have changed for the group that is being run and the next one
+                std::vector<uint8_t> dirty;
+                std::vector<uint8_t> next;
+            };
+
             /**
              * @brief Projects a provided mesh to pixel coordinates
              *
+             * @details
+             *  The temporary buffers are leased from a pool held by the engine, so the reverse lookup is only reset
+             *  where the previous frame wrote to it rather than being remade for the whole mesh.
+             *
              * @tparam Model the mesh model that we are projecting
              *
              * @param mesh the mesh table that we are projecting to pixel coordinates
@@ -85,10 +298,532 @@ namespace engine {
             ProjectedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> operator()(const Mesh<Scalar, Model>& mesh,
                                                                           const mat4<Scalar>& Hoc,
                                                                           const Lens<Scalar>& lens) const {
+                auto arena = arenas->acquire();
+                ProjectedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> output;
+                operator()(mesh, Hoc, lens, output, *arena);
+                return output;
+            }
+
+            /**
+             * @brief Projects a provided mesh to pixel coordinates, reusing the memory of a previous projection
+             *
+             * @details
+             *  The output and the arena are overwritten, but keep their memory between calls. The reverse lookup in the
+             *  arena is only reset where it was written, so after the first few frames projecting a mesh does no heap
+             *  allocations and doesn't touch memory proportional to the size of the whole mesh.
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh   the mesh table that we are projecting to pixel coordinates
+             * @param Hoc    the homogenous transformation matrix from the camera to the observation plane
+             * @param lens   the lens parameters that describe the optics of the camera
+             * @param output the projected mesh to write the result into
+             * @param arena  the temporary buffers to use while projecting
+             */
+            template <template <typename> class Model>
+            void operator()(const Mesh<Scalar, Model>& mesh,
+                            const mat4<Scalar>& Hoc,
+                            const Lens<Scalar>& lens,
+                            ProjectedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS>& output,
+                            ProjectionArena& arena) const {
+                FrameRecorder recorder(instrumentation.get());
+                project_frame(mesh, Hoc, lens, output, arena, recorder);
+                recorder.report();
+            }
+
+            /**
+             * @brief Projects the part of a provided mesh that is inside a region of the image to pixel coordinates
+             *
+             * @details
+             *  Only the points in the region are projected, and the neighbours of a point that are outside of the
+             *  region are the null point the same as the neighbours that are off the screen.
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh   the mesh table that we are projecting to pixel coordinates
+             * @param Hoc    the homogenous transformation matrix from the camera to the observation plane
+             * @param lens   the lens parameters that describe the optics of the camera
+             * @param region the part of the image to project the mesh into
+             *
+             * @return a projected mesh of the points in the region
+             */
+            template <template <typename> class Model>
+            ProjectedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> operator()(const Mesh<Scalar, Model>& mesh,
+                                                                          const mat4<Scalar>& Hoc,
+                                                                          const Lens<Scalar>& lens,
+                                                                          const Region<Scalar>& region) const {
+                auto arena = arenas->acquire();
+                ProjectedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> output;
+                operator()(mesh, Hoc, lens, region, output, *arena);
+                return output;
+            }
+
+            /**
+             * @brief Projects the part of a provided mesh that is inside a region of the image to pixel coordinates,
+             * reusing the memory of a previous projection
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh   the mesh table that we are projecting to pixel coordinates
+             * @param Hoc    the homogenous transformation matrix from the camera to the observation plane
+             * @param lens   the lens parameters that describe the optics of the camera
+             * @param region the part of the image to project the mesh into
+             * @param output the projected mesh to write the result into
+             * @param arena  the temporary buffers to use while projecting
+             */
+            template <template <typename> class Model>
+            void operator()(const Mesh<Scalar, Model>& mesh,
+                            const mat4<Scalar>& Hoc,
+                            const Lens<Scalar>& lens,
+                            const Region<Scalar>& region,
+                            ProjectedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS>& output,
+                            ProjectionArena& arena) const {
+                FrameRecorder recorder(instrumentation.get());
+                project_frame(mesh, Hoc, lens, region, output, arena, recorder);
+                recorder.report();
+            }
+
+            /**
+             * @brief Projects a provided mesh to pixel coordinates from an aggregate VisualMesh object
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh the mesh table that we are projecting to pixel coordinates
+             * @param Hoc  the homogenous transformation matrix from the camera to the observation plane
+             * @param lens the lens parameters that describe the optics of the camera
+             *
+             * @return a projected mesh for the provided arguments
+             */
+            template <template <typename> class Model>
+            inline ProjectedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> operator()(const VisualMesh<Scalar, Model>& mesh,
+                                                                                 const mat4<Scalar>& Hoc,
+                                                                                 const Lens<Scalar>& lens) const {
+                return operator()(mesh.height(Hoc[2][3]), Hoc, lens);
+            }
+
+            /**
+             * @brief Project and classify a mesh using the neural network that is loaded into this engine
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh    the mesh table that we are projecting to pixel coordinates
+             * @param Hoc     the homogenous transformation matrix from the camera to the observation plane
+             * @param lens    the lens parameters that describe the optics of the camera
+             * @param image   the data that represents the image the network will run from
+             * @param format  the pixel format of this image as a fourcc code
+             *
+             * @return a classified mesh for the provided arguments
+             */
+            template <template <typename> class Model>
+            ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> operator()(const Mesh<Scalar, Model>& mesh,
+                                                                           const mat4<Scalar>& Hoc,
+                                                                           const Lens<Scalar>& lens,
+                                                                           const void* image,
+                                                                           const uint32_t& format) const {
+                FrameRecorder recorder(instrumentation.get());
+                auto classified =
+                  classify(project_frame(mesh, Hoc, lens, recorder), lens, image, format, nullptr, recorder);
+                recorder.report();
+                return classified;
+            }
+
+            /**
+             * @brief Project and classify a mesh into a classified mesh owned by the caller, reusing its memory
+             *
+             * @details
+             *  Every vector in the output is overwritten but keeps its capacity, and the classifications are swapped
+             *  with the engine's buffer rather than copied out of it. Passing the same output (or recycling a few of
+             *  them) every frame means classification does no heap allocations once the sizes have settled.
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh    the mesh table that we are projecting to pixel coordinates
+             * @param Hoc     the homogenous transformation matrix from the camera to the observation plane
+             * @param lens    the lens parameters that describe the optics of the camera
+             * @param image   the data that represents the image the network will run from
+             * @param format  the pixel format of this image as a fourcc code
+             * @param output  the classified mesh to write the result into
+             */
+            template <template <typename> class Model>
+            void operator()(const Mesh<Scalar, Model>& mesh,
+                            const mat4<Scalar>& Hoc,
+                            const Lens<Scalar>& lens,
+                            const void* image,
+                            const uint32_t& format,
+                            ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS>& output) const {
+                FrameRecorder recorder(instrumentation.get());
+
+                // Project into the output's own vectors so their memory is reused
+                ProjectedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> projected{std::move(output.pixel_coordinates),
+                                                                             std::move(output.neighbourhood),
+                                                                             std::move(output.global_indices)};
+                /* arena scope */ {
+                    auto arena = arenas->acquire();
+                    project_frame(mesh, Hoc, lens, projected, *arena, recorder);
+                }
+                classify(std::move(projected), lens, image, format, nullptr, recorder, output);
+                recorder.report();
+            }
+
+            /**
+             * @brief Project and classify a mesh, only recomputing the points whose input changed since the last frame
+             *
+             * @details
+             *  For fixed and slowly moving cameras most points read nearly the same colour from one frame to the next.
+             *  The points whose input changed by more than the cache's threshold, or that weren't on the screen for the
+             *  previous frame, are recomputed along with every point whose receptive field reaches them through the
+             *  neighbourhood graph. The rest take their activations from the cache. Points next to the edge of the
+             *  screen are always recomputed as a neighbour may have just left it. The result is the same as running the
+             *  full network on an image where only the changed points were updated, and the cascade is not used.
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh    the mesh table that we are projecting to pixel coordinates
+             * @param Hoc     the homogenous transformation matrix from the camera to the observation plane
+             * @param lens    the lens parameters that describe the optics of the camera
+             * @param image   the data that represents the image the network will run from
+             * @param format  the pixel format of this image as a fourcc code
+             * @param cache   the activations of this camera's previous frames, updated for this frame
+             * @param output  the classified mesh to write the result into
+             */
+            template <template <typename> class Model>
+            void operator()(const Mesh<Scalar, Model>& mesh,
+                            const mat4<Scalar>& Hoc,
+                            const Lens<Scalar>& lens,
+                            const void* image,
+                            const uint32_t& format,
+                            TemporalCache& cache,
+                            ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS>& output) const {
+                FrameRecorder recorder(instrumentation.get());
+
+                ProjectedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> projected{std::move(output.pixel_coordinates),
+                                                                             std::move(output.neighbourhood),
+                                                                             std::move(output.global_indices)};
+                /* arena scope */ {
+                    auto arena = arenas->acquire();
+                    project_frame(mesh, Hoc, lens, projected, *arena, recorder);
+                }
+                classify_changed(
+                  std::move(projected), mesh.id(), mesh.nodes.size(), lens, image, format, cache, recorder, output);
+                recorder.report();
+            }
+
+            /**
+             * @brief Project and classify only the part of a mesh that is inside a region of the image
+             *
+             * @details
+             *  This is for tracking where only the area around a predicted object needs to be classified. The
+             *  neighbours of a point that are outside the region are treated the same as those off the screen.
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh    the mesh table that we are projecting to pixel coordinates
+             * @param Hoc     the homogenous transformation matrix from the camera to the observation plane
+             * @param lens    the lens parameters that describe the optics of the camera
+             * @param region  the part of the image to classify
+             * @param image   the data that represents the image the network will run from
+             * @param format  the pixel format of this image as a fourcc code
+             *
+             * @return a classified mesh of the points in the region
+             */
+            template <template <typename> class Model>
+            ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> operator()(const Mesh<Scalar, Model>& mesh,
+                                                                           const mat4<Scalar>& Hoc,
+                                                                           const Lens<Scalar>& lens,
+                                                                           const Region<Scalar>& region,
+                                                                           const void* image,
+                                                                           const uint32_t& format) const {
+                FrameRecorder recorder(instrumentation.get());
+                auto classified =
+                  classify(project_frame(mesh, Hoc, lens, region, recorder), lens, image, format, nullptr, recorder);
+                recorder.report();
+                return classified;
+            }
+
+            /**
+             * @brief Classify a mesh at full precision and observe the input of every layer of the network
+             *
+             * @details
+             *  Run this over a sample dataset to build the calibration that is used to quantise the network. The
+             *  classification is always done at full precision even if the engine has been quantised, so the result
+             *  can also be used as the reference when measuring the drift of a quantised network.
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param calibration the calibration to extend with the observed layer inputs
+             * @param mesh        the mesh table that we are projecting to pixel coordinates
+             * @param Hoc         the homogenous transformation matrix from the camera to the observation plane
+             * @param lens        the lens parameters that describe the optics of the camera
+             * @param image       the data that represents the image the network will run from
+             * @param format      the pixel format of this image as a fourcc code
+             *
+             * @return a full precision classified mesh for the provided arguments
+             */
+            template <template <typename> class Model>
+            ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> calibrate(Calibration<Scalar>& calibration,
+                                                                          const Mesh<Scalar, Model>& mesh,
+                                                                          const mat4<Scalar>& Hoc,
+                                                                          const Lens<Scalar>& lens,
+                                                                          const void* image,
+                                                                          const uint32_t& format) const {
+                FrameRecorder recorder(instrumentation.get());
+                auto classified =
+                  classify(project_frame(mesh, Hoc, lens, recorder), lens, image, format, &calibration, recorder);
+                recorder.report();
+                return classified;
+            }
+
+            /**
+             * @brief Classify a VisualMesh at full precision and observe the input of every layer of the network
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param calibration the calibration to extend with the observed layer inputs
+             * @param mesh        the mesh table that we are projecting to pixel coordinates
+             * @param Hoc         the homogenous transformation matrix from the camera to the observation plane
+             * @param lens        the lens parameters that describe the optics of the camera
+             * @param image       the data that represents the image the network will run from
+             * @param format      the pixel format of this image as a fourcc code
+             *
+             * @return a full precision classified mesh for the provided arguments
+             */
+            template <template <typename> class Model>
+            ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> calibrate(Calibration<Scalar>& calibration,
+                                                                          const VisualMesh<Scalar, Model>& mesh,
+                                                                          const mat4<Scalar>& Hoc,
+                                                                          const Lens<Scalar>& lens,
+                                                                          const void* image,
+                                                                          const uint32_t& format) const {
+                return calibrate(calibration, mesh.height(Hoc[2][3]), Hoc, lens, image, format);
+            }
+
+            /**
+             * @brief Project and classify a mesh using the neural network that is loaded into this engine.
+             * This version takes an aggregate VisualMesh object
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh    the mesh table that we are projecting to pixel coordinates
+             * @param Hoc     the homogenous transformation matrix from the camera to the observation plane
+             * @param lens    the lens parameters that describe the optics of the camera
+             * @param image   the data that represents the image the network will run from
+             * @param format  the pixel format of this image as a fourcc code
+             *
+             * @return a classified mesh for the provided arguments
+             */
+            template <template <typename> class Model>
+            ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> operator()(const VisualMesh<Scalar, Model>& mesh,
+                                                                           const mat4<Scalar>& Hoc,
+                                                                           const Lens<Scalar>& lens,
+                                                                           const void* image,
+                                                                           const uint32_t& format) const {
+                return operator()(mesh.height(Hoc[2][3]), Hoc, lens, image, format);
+            }
+
+            /**
+             * @brief Project and classify a batch of frames, running each layer of the network once for every frame
+             *
+             * @details
+             *  The projected points of all the frames are concatenated, with each frame keeping its own offscreen
+             *  point, so each layer is split between the threads once for the whole batch rather than once per frame.
+             *  The results are identical to classifying each frame on its own.
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param batch the frames to classify
+             *
+             * @return a classified mesh for each frame in the batch, in the same order
+             */
+            template <template <typename> class Model>
+            std::vector<ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS>> operator()(
+              const std::vector<BatchFrame<Scalar, Model>>& batch) const {
                 static constexpr int N_NEIGHBOURS = Model<Scalar>::N_NEIGHBOURS;
+                FrameRecorder recorder(instrumentation.get());
 
-                // Lookup the on screen ranges
-                auto ranges = mesh.lookup(Hoc, lens);
+                // Project every frame and work out where each one starts in the concatenated points
+                std::vector<ProjectedMesh<Scalar, N_NEIGHBOURS>> projected;
+                projected.reserve(batch.size());
+                std::vector<std::size_t> offsets;
+                offsets.reserve(batch.size());
+                std::size_t n_points = 0;
+                for (const auto& frame : batch) {
+                    projected.push_back(project_frame(*frame.mesh, frame.Hoc, frame.lens, recorder));
+                    offsets.push_back(n_points);
+                    // Frames with nothing on screen are left out entirely, including their offscreen point
+                    if (!projected.back().global_indices.empty()) { n_points += projected.back().neighbourhood.size(); }
+                }
+
+                std::vector<ClassifiedMesh<Scalar, N_NEIGHBOURS>> results(batch.size());
+                if (n_points == 0) {
+                    recorder.report();
+                    return results;
+                }
+
+                // Concatenate the neighbourhoods, moving each one to where its frame starts
+                std::vector<std::array<int, N_NEIGHBOURS>> neighbourhood;
+                neighbourhood.reserve(n_points);
+                for (unsigned int i = 0; i < batch.size(); ++i) {
+                    if (projected[i].global_indices.empty()) { continue; }
+                    for (auto n : projected[i].neighbourhood) {
+                        for (auto& v : n) {
+                            v += int(offsets[i]);
+                        }
+                        neighbourhood.push_back(n);
+                    }
+                }
+
+                // Load every image into its part of the input and run the network over all of them at once
+                auto buffers = scratch->acquire();
+                buffers->input.resize(n_points * 4);
+                /* load image scope */ {
+                    FrameRecorder::Scope scope(recorder, Stage::LOAD_IMAGE);
+                    for (unsigned int i = 0; i < batch.size(); ++i) {
+                        if (projected[i].global_indices.empty()) { continue; }
+                        load_image(projected[i], batch[i].lens, batch[i].image, batch[i].format, offsets[i], *buffers);
+                    }
+                }
+                run_network(neighbourhood, nullptr, *buffers, recorder);
+
+                // Split the classifications back up between the frames
+                const std::size_t width = buffers->input.size() / n_points;
+                for (unsigned int i = 0; i < batch.size(); ++i) {
+                    if (projected[i].global_indices.empty()) { continue; }
+                    auto begin = std::next(buffers->input.begin(), offsets[i] * width);
+                    auto end   = std::next(begin, projected[i].neighbourhood.size() * width);
+                    results[i] = ClassifiedMesh<Scalar, N_NEIGHBOURS>{std::move(projected[i].pixel_coordinates),
+                                                                      std::move(projected[i].neighbourhood),
+                                                                      std::move(projected[i].global_indices),
+                                                                      std::vector<Scalar>(begin, end)};
+                }
+                recorder.report();
+                return results;
+            }
+
+        private:
+            /**
+             * @brief Looks up and projects a mesh into the provided buffers, timing each stage
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh     the mesh table that we are projecting to pixel coordinates
+             * @param Hoc      the homogenous transformation matrix from the camera to the observation plane
+             * @param lens     the lens parameters that describe the optics of the camera
+             * @param output   the projected mesh to write the result into
+             * @param arena    the temporary buffers to use while projecting
+             * @param recorder the frame that the stages are timed in
+             */
+            template <template <typename> class Model>
+            void project_frame(const Mesh<Scalar, Model>& mesh,
+                               const mat4<Scalar>& Hoc,
+                               const Lens<Scalar>& lens,
+                               ProjectedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS>& output,
+                               ProjectionArena& arena,
+                               FrameRecorder& recorder) const {
+                /* lookup scope */ {
+                    FrameRecorder::Scope scope(recorder, Stage::LOOKUP);
+                    (*lookup)(mesh, Hoc, lens, arena.ranges);
+                }
+                FrameRecorder::Scope scope(recorder, Stage::PROJECT);
+                project_ranges(mesh, Hoc, lens, output, arena);
+            }
+
+            /**
+             * @brief Looks up and projects the part of a mesh inside a region into the provided buffers, timing each
+             * stage
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh     the mesh table that we are projecting to pixel coordinates
+             * @param Hoc      the homogenous transformation matrix from the camera to the observation plane
+             * @param lens     the lens parameters that describe the optics of the camera
+             * @param region   the part of the image to project the mesh into
+             * @param output   the projected mesh to write the result into
+             * @param arena    the temporary buffers to use while projecting
+             * @param recorder the frame that the stages are timed in
+             */
+            template <template <typename> class Model>
+            void project_frame(const Mesh<Scalar, Model>& mesh,
+                               const mat4<Scalar>& Hoc,
+                               const Lens<Scalar>& lens,
+                               const Region<Scalar>& region,
+                               ProjectedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS>& output,
+                               ProjectionArena& arena,
+                               FrameRecorder& recorder) const {
+                /* lookup scope */ {
+                    FrameRecorder::Scope scope(recorder, Stage::LOOKUP);
+                    mesh.lookup(Hoc, lens, region, arena.ranges);
+                }
+                FrameRecorder::Scope scope(recorder, Stage::PROJECT);
+                project_ranges(mesh, Hoc, lens, output, arena);
+            }
+
+            /**
+             * @brief Projects a mesh using pooled buffers as part of a frame that is being timed
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh     the mesh table that we are projecting to pixel coordinates
+             * @param Hoc      the homogenous transformation matrix from the camera to the observation plane
+             * @param lens     the lens parameters that describe the optics of the camera
+             * @param recorder the frame that the stages are timed in
+             *
+             * @return a projected mesh for the provided arguments
+             */
+            template <template <typename> class Model>
+            ProjectedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> project_frame(const Mesh<Scalar, Model>& mesh,
+                                                                             const mat4<Scalar>& Hoc,
+                                                                             const Lens<Scalar>& lens,
+                                                                             FrameRecorder& recorder) const {
+                auto arena = arenas->acquire();
+                ProjectedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> output;
+                project_frame(mesh, Hoc, lens, output, *arena, recorder);
+                return output;
+            }
+
+            /**
+             * @brief Projects the part of a mesh inside a region using pooled buffers as part of a frame that is being
+             * timed
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh     the mesh table that we are projecting to pixel coordinates
+             * @param Hoc      the homogenous transformation matrix from the camera to the observation plane
+             * @param lens     the lens parameters that describe the optics of the camera
+             * @param region   the part of the image to project the mesh into
+             * @param recorder the frame that the stages are timed in
+             *
+             * @return a projected mesh of the points in the region
+             */
+            template <template <typename> class Model>
+            ProjectedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> project_frame(const Mesh<Scalar, Model>& mesh,
+                                                                             const mat4<Scalar>& Hoc,
+                                                                             const Lens<Scalar>& lens,
+                                                                             const Region<Scalar>& region,
+                                                                             FrameRecorder& recorder) const {
+                auto arena = arenas->acquire();
+                ProjectedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> output;
+                project_frame(mesh, Hoc, lens, region, output, *arena, recorder);
+                return output;
+            }
+
+            /**
+             * @brief Projects the points in the ranges of a lookup to pixel coordinates
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh   the mesh table that we are projecting to pixel coordinates
+             * @param Hoc    the homogenous transformation matrix from the camera to the observation plane
+             * @param lens   the lens parameters that describe the optics of the camera
+             * @param output the projected mesh to write the result into
+             * @param arena  the temporary buffers to use while projecting, holding the ranges to project
+             */
+            template <template <typename> class Model>
+            void project_ranges(const Mesh<Scalar, Model>& mesh,
+                                const mat4<Scalar>& Hoc,
+                                const Lens<Scalar>& lens,
+                                ProjectedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS>& output,
+                                ProjectionArena& arena) const {
+                const auto& ranges = arena.ranges;
 
                 // Convenience variables
                 const auto& nodes = mesh.nodes;
@@ -100,211 +835,745 @@ namespace engine {
                     n_points += r.second - r.first;
                 }
 
-                // Output variables
-                std::vector<int> global_indices;
-                global_indices.reserve(n_points);
-                std::vector<vec2<Scalar>> pixels;
-                pixels.reserve(n_points);
-
-                // Loop through adding global indices and pixel coordinates
+                // Flatten the ranges so they can be split evenly between the threads
+                auto& candidates = arena.candidates;
+                candidates.clear();
                 for (const auto& range : ranges) {
                     for (int i = range.first; i < range.second; ++i) {
+                        candidates.push_back(i);
+                    }
+                }
+
+                // Project all the candidate points
+                auto& candidate_pixels = arena.candidate_pixels;
+                auto& on_screen        = arena.on_screen;
+                candidate_pixels.resize(n_points);
+                on_screen.resize(n_points);
+                parallel_for(n_points, [&](const std::size_t& begin, const std::size_t& end) {
+                    // Rotate a block of rays into camera space at a time so they can be projected together
+                    constexpr std::size_t BLOCK = 64;
+                    std::array<std::array<Scalar, BLOCK>, 3> rays;
+                    for (std::size_t b = begin; b < end; b += BLOCK) {
+                        const std::size_t n = std::min(BLOCK, end - b);
+                        for (std::size_t i = 0; i < n; ++i) {
+                            const auto& ray = nodes[candidates[b + i]].ray;
+                            for (int j = 0; j < 3; ++j) {
+                                rays[j][i] = Rco[j][0] * ray[0] + Rco[j][1] * ray[1] + Rco[j][2] * ray[2];
+                            }
+                        }
+                        project(rays[0].data(), rays[1].data(), rays[2].data(), n, lens, &candidate_pixels[b]);
+
                         // Even though we have already gone through a bsp to remove out of range points, sometimes it's
                         // not perfect and misses by a few pixels. So as we are projecting the points here we also need
                         // to check that they are on screen
-                        auto px = project(multiply(Rco, nodes[i].ray), lens);
-                        if (0 <= px[0] && px[0] + 1 < lens.dimensions[0] && 0 <= px[1]
-                            && px[1] + 1 < lens.dimensions[1]) {
-                            global_indices.emplace_back(i);
-                            pixels.emplace_back(px);
+                        for (std::size_t i = b; i < b + n; ++i) {
+                            const auto& px = candidate_pixels[i];
+                            on_screen[i]   = 0 <= px[0] && px[0] + 1 < lens.dimensions[0] && 0 <= px[1]
+                                           && px[1] + 1 < lens.dimensions[1];
                         }
                     }
+                });
+
+                // Output variables, keeping only the points that actually landed on the screen
+                auto& global_indices = output.global_indices;
+                auto& pixels         = output.pixel_coordinates;
+                global_indices.clear();
+                pixels.clear();
+                for (unsigned int i = 0; i < n_points; ++i) {
+                    if (on_screen[i] != 0) {
+                        global_indices.emplace_back(candidates[i]);
+                        pixels.emplace_back(candidate_pixels[i]);
+                    }
                 }
 
                 // Update the number of points to account for how many pixels we removed
                 n_points = pixels.size();
 
-                // Build our reverse lookup, the default point goes to the null point
-                std::vector<int> r_lookup(nodes.size() + 1, n_points);
+                // Build our reverse lookup, anything that isn't written is left as -1 from previous frames
+                auto& r_lookup = arena.r_lookup;
+                r_lookup.resize(nodes.size() + 1, -1);
                 for (unsigned int i = 0; i < n_points; ++i) {
                     r_lookup[global_indices[i]] = i;
                 }
 
-                // Build our local neighbourhood map
-                std::vector<std::array<int, N_NEIGHBOURS>> neighbourhood(n_points + 1);  // +1 for the null point
-                for (unsigned int i = 0; i < n_points; ++i) {
-                    const Node<Scalar, N_NEIGHBOURS>& node = nodes[global_indices[i]];
-                    for (unsigned int j = 0; j < node.neighbours.size(); ++j) {
-                        const auto& n       = node.neighbours[j];
-                        neighbourhood[i][j] = r_lookup[n];
+                // Build our local neighbourhood map, points that aren't on screen go to the null point
+                auto& neighbourhood = output.neighbourhood;
+                neighbourhood.resize(n_points + 1);  // +1 for the null point
+                parallel_for(n_points, [&](const std::size_t& begin, const std::size_t& end) {
+                    for (std::size_t i = begin; i < end; ++i) {
+                        const auto& neighbours = nodes[global_indices[i]].neighbours;
+                        for (unsigned int j = 0; j < neighbours.size(); ++j) {
+                            const auto& n       = neighbours[j];
+                            neighbourhood[i][j] = r_lookup[n] < 0 ? int(n_points) : r_lookup[n];
+                        }
                     }
-                }
+                });
                 // Last point is the null point
                 neighbourhood[n_points].fill(n_points);
 
-                return ProjectedMesh<Scalar, N_NEIGHBOURS>{
-                  std::move(pixels), std::move(neighbourhood), std::move(global_indices)};
+                // Reset only the entries we wrote so the reverse lookup is ready for the next frame
+                for (const auto& i : global_indices) {
+                    r_lookup[i] = -1;
+                }
             }
 
+            /// The buffers used by a single classification, pooled so we don't have to remake them between calls
+            struct Scratch {
+                /// An input buffer used to ping/pong when doing classification
+                std::vector<Scalar> input;
+                /// An output buffer used to ping/pong when doing classification
+                std::vector<Scalar> output;
+                /// A buffer to hold the quantised input of a layer when running quantised
+                std::vector<uint8_t> quantised_input;
+                /// The output of the cascade head for every point
+                std::vector<Scalar> head;
+                /// The points the rest of the network is run for when using a cascade, uncertain points first
+                std::vector<int> active;
+                /// The index of each point in active, or -1 if it is not active
+                std::vector<int> local;
+            };
+
             /**
-             * @brief Projects a provided mesh to pixel coordinates from an aggregate VisualMesh object
+             * @brief Classify a projected mesh using the neural network that is loaded into this engine
              *
-             * @tparam Model the mesh model that we are projecting
+             * @tparam N_NEIGHBOURS the number of neighbours that each point has
              *
-             * @param mesh the mesh table that we are projecting to pixel coordinates
-             * @param Hoc  the homogenous transformation matrix from the camera to the observation plane
-             * @param lens the lens parameters that describe the optics of the camera
+             * @param projected   the projected mesh to classify
+             * @param lens        the lens parameters that describe the optics of the camera
+             * @param image       the data that represents the image the network will run from
+             * @param format      the pixel format of this image as a fourcc code
+             * @param calibration if not null the input of every layer is observed and full precision is always used
+             * @param recorder    the frame that the stages are timed in
              *
-             * @return a projected mesh for the provided arguments
+             * @return a classified mesh for the provided arguments
              */
-            template <template <typename> class Model>
-            inline ProjectedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> operator()(const VisualMesh<Scalar, Model>& mesh,
-                                                                                 const mat4<Scalar>& Hoc,
-                                                                                 const Lens<Scalar>& lens) const {
-                return operator()(mesh.height(Hoc[2][3]), Hoc, lens);
+            template <int N_NEIGHBOURS>
+            ClassifiedMesh<Scalar, N_NEIGHBOURS> classify(ProjectedMesh<Scalar, N_NEIGHBOURS>&& projected,
+                                                          const Lens<Scalar>& lens,
+                                                          const void* image,
+                                                          const uint32_t& format,
+                                                          Calibration<Scalar>* calibration,
+                                                          FrameRecorder& recorder) const {
+                ClassifiedMesh<Scalar, N_NEIGHBOURS> output;
+                classify(std::move(projected), lens, image, format, calibration, recorder, output);
+                return output;
             }
 
             /**
-             * @brief Project and classify a mesh using the neural network that is loaded into this engine
+             * @brief Classify a projected mesh into a classified mesh, reusing the memory of its classifications
              *
-             * @tparam Model the mesh model that we are projecting
+             * @details
+             *  The network leaves its result in the input buffer of the scratch buffers. Rather than copying it out,
+             *  it is swapped with the output's classifications, so the scratch buffers take over the memory of the
+             *  previous result and the copy of n_points x n_classes values is avoided.
              *
-             * @param mesh    the mesh table that we are projecting to pixel coordinates
-             * @param Hoc     the homogenous transformation matrix from the camera to the observation plane
-             * @param lens    the lens parameters that describe the optics of the camera
-             * @param image   the data that represents the image the network will run from
-             * @param format  the pixel format of this image as a fourcc code
+             * @tparam N_NEIGHBOURS the number of neighbours that each point has
              *
-             * @return a classified mesh for the provided arguments
+             * @param projected   the projected mesh to classify, its vectors are moved into the output
+             * @param lens        the lens parameters that describe the optics of the camera
+             * @param image       the data that represents the image the network will run from
+             * @param format      the pixel format of this image as a fourcc code
+             * @param calibration if not null the input of every layer is observed and full precision is always used
+             * @param recorder    the frame that the stages are timed in
+             * @param output      the classified mesh to write the result into
              */
-            template <template <typename> class Model>
-            ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> operator()(const Mesh<Scalar, Model>& mesh,
-                                                                           const mat4<Scalar>& Hoc,
-                                                                           const Lens<Scalar>& lens,
-                                                                           const void* image,
-                                                                           const uint32_t& format) const {
-                static constexpr int N_NEIGHBOURS = Model<Scalar>::N_NEIGHBOURS;
+            template <int N_NEIGHBOURS>
+            void classify(ProjectedMesh<Scalar, N_NEIGHBOURS>&& projected,
+                          const Lens<Scalar>& lens,
+                          const void* image,
+                          const uint32_t& format,
+                          Calibration<Scalar>* calibration,
+                          FrameRecorder& recorder,
+                          ClassifiedMesh<Scalar, N_NEIGHBOURS>& output) const {
+                if (projected.global_indices.empty()) {
+                    projected.pixel_coordinates.clear();
+                    projected.neighbourhood.clear();
+                    output.classifications.clear();
+                }
+                else {
+                    // Lease a set of buffers for this call so other threads can classify at the same time
+                    auto buffers = scratch->acquire();
+                    buffers->input.resize(projected.neighbourhood.size() * 4);
+                    /* load image scope */ {
+                        FrameRecorder::Scope scope(recorder, Stage::LOAD_IMAGE);
+                        load_image(projected, lens, image, format, 0, *buffers);
+                    }
+                    run_network(projected.neighbourhood, calibration, *buffers, recorder);
 
-                // Project the pixels to the display
-                ProjectedMesh<Scalar, N_NEIGHBOURS> projected = operator()(mesh, Hoc, lens);
-                auto& neighbourhood                           = projected.neighbourhood;
-                unsigned int n_points                         = neighbourhood.size();
+                    // The result is in the input buffer, hand it over and keep the output's old memory for next time
+                    std::swap(output.classifications, buffers->input);
+                }
 
-                if (projected.global_indices.empty()) { return ClassifiedMesh<Scalar, N_NEIGHBOURS>(); }
+                output.pixel_coordinates = std::move(projected.pixel_coordinates);
+                output.neighbourhood     = std::move(projected.neighbourhood);
+                output.global_indices    = std::move(projected.global_indices);
+            }
 
-                // Based on the fourcc code, load the data from the image into input
-                input.reserve(n_points * 4);
+            /**
+             * @brief Classify a projected mesh, only recomputing the points whose input changed since the last frame
+             *
+             * @details
+             *  Each group is run on a smaller graph like the cascade: the points whose output changes, then the
+             *  neighbours they read that don't change, then one extra point for the neighbours of those. The rows of
+             *  the graph are gathered from the cache and the changed outputs are written back to it.
+             *
+             * @tparam N_NEIGHBOURS the number of neighbours that each point has
+             *
+             * @param projected the projected mesh to classify, its vectors are moved into the output
+             * @param mesh_id   the identifier of the mesh that was projected
+             * @param n_nodes   the number of nodes in the mesh
+             * @param lens      the lens parameters that describe the optics of the camera
+             * @param image     the data that represents the image the network will run from
+             * @param format    the pixel format of this image as a fourcc code
+             * @param cache     the activations of this camera's previous frames, updated for this frame
+             * @param recorder  the frame that the stages are timed in
+             * @param output    the classified mesh to write the result into
+             */
+            template <int N_NEIGHBOURS>
+            void classify_changed(ProjectedMesh<Scalar, N_NEIGHBOURS>&& projected,
+                                  const uint64_t& mesh_id,
+                                  const std::size_t& n_nodes,
+                                  const Lens<Scalar>& lens,
+                                  const void* image,
+                                  const uint32_t& format,
+                                  TemporalCache& cache,
+                                  FrameRecorder& recorder,
+                                  ClassifiedMesh<Scalar, N_NEIGHBOURS>& output) const {
+                if (projected.global_indices.empty() || network.empty()) {
+                    classify(std::move(projected), lens, image, format, nullptr, recorder, output);
+                    return;
+                }
 
-                for (const auto& px : projected.pixel_coordinates) {
-                    const auto* const im = reinterpret_cast<const uint8_t*>(image);
+                const auto& neighbourhood = projected.neighbourhood;
+                const auto& global        = projected.global_indices;
+                const int n_points        = global.size();
+                const int n               = n_points + 1;
 
-                    const vec4<Scalar> p = interpolate(px, im, lens.dimensions, format);
-                    input.insert(input.end(), p.begin(), p.end());
+                // The offscreen point is kept in the slot after the nodes of the mesh
+                auto slot = [&](const int& i) { return i < n_points ? std::size_t(global[i]) : n_nodes; };
+
+                // Start again if the cache is for another mesh, with nothing seen on the screen
+                if (cache.mesh != mesh_id || cache.seen.size() != n_nodes + 1) {
+                    cache.mesh  = mesh_id;
+                    cache.frame = 1;
+                    cache.seen.assign(n_nodes + 1, 0);
+                    cache.input.resize((n_nodes + 1) * 4);
+                    cache.groups.resize(network.size());
+                    unsigned int dimensions = 4;
+                    for (unsigned int conv_no = 0; conv_no < network.size(); ++conv_no) {
+                        dimensions = network.size(conv_no) == 0 ? dimensions * (N_NEIGHBOURS + 1)
+                                                                : network.back(conv_no).output_dimensions;
+                        cache.groups[conv_no].resize((n_nodes + 1) * dimensions);
+                    }
+                }
+                ++cache.frame;
+
+                auto buffers = scratch->acquire();
+                auto& input  = buffers->input;
+                input.resize(n * 4);
+                /* load image scope */ {
+                    FrameRecorder::Scope scope(recorder, Stage::LOAD_IMAGE);
+                    load_image(projected, lens, image, format, 0, *buffers);
                 }
 
+                // Find the points whose input changed or that have nothing to reuse as they weren't on the last frame
+                auto& dirty   = cache.dirty;
+                cache.changed = 0;
+                dirty.assign(n, 0);
+                for (int i = 0; i < n; ++i) {
+                    const std::size_t s = slot(i);
+                    const Scalar* in    = input.data() + i * 4;
+                    Scalar* cached      = cache.input.data() + s * 4;
+
+                    bool changed = cache.seen[s] + 1 != cache.frame;
+                    for (int j = 0; !changed && j < 4; ++j) {
+                        changed = std::abs(in[j] - cached[j]) > cache.threshold;
+                    }
+                    for (int j = 0; !changed && i < n_points && j < N_NEIGHBOURS; ++j) {
+                        changed = neighbourhood[i][j] == n_points;
+                    }
+                    if (changed) {
+                        std::copy(in, in + 4, cached);
+                        dirty[i] = 1;
+                        ++cache.changed;
+                    }
+                    cache.seen[s] = cache.frame;
+                }
+
+                auto& next                      = cache.next;
+                auto& active                    = buffers->active;
+                auto& local                     = buffers->local;
+                const std::vector<Scalar>* from = &cache.input;
+                unsigned int dimensions         = 4;
+                std::vector<std::array<int, N_NEIGHBOURS>> graph;
+                for (unsigned int conv_no = 0; conv_no < network.size(); ++conv_no) {
+                    auto& to                             = cache.groups[conv_no];
+                    const unsigned int output_dimensions = to.size() / (n_nodes + 1);
+
+                    // A point's output changes when its input or the input of one of its neighbours did
+                    next.assign(n, 0);
+                    active.clear();
+                    for (int i = 0; i < n; ++i) {
+                        bool changed = dirty[i] != 0;
+                        for (const auto& j : neighbourhood[i]) {
+                            changed = changed || dirty[j] != 0;
+                        }
+                        if (changed) {
+                            next[i] = 1;
+                            active.push_back(i);
+                        }
+                    }
+                    std::swap(dirty, next);
+
+                    if (!active.empty()) {
+                        // Add the neighbours the changed points read, these don't change so their neighbours aren't
+                        // needed and go to the extra point
+                        const int n_active = active.size();
+                        local.assign(n, -1);
+                        for (int k = 0; k < n_active; ++k) {
+                            local[active[k]] = k;
+                        }
+                        for (int k = 0; k < n_active; ++k) {
+                            for (const auto& j : neighbourhood[active[k]]) {
+                                if (local[j] < 0) {
+                                    local[j] = active.size();
+                                    active.push_back(j);
+                                }
+                            }
+                        }
+                        const int n_rows = active.size();
+                        graph.resize(n_rows + 1);
+                        for (int k = 0; k < n_rows; ++k) {
+                            for (std::size_t j = 0; j < N_NEIGHBOURS; ++j) {
+                                graph[k][j] = k < n_active ? local[neighbourhood[active[k]][j]] : n_rows;
+                            }
+                        }
+                        graph[n_rows].fill(n_rows);
+
+                        // Gather the input of the rows from the cache, the extra point's value never reaches the result
+                        input.resize((n_rows + 1) * dimensions);
+                        parallel_for(n_rows, [&](const std::size_t& begin, const std::size_t& end) {
+                            for (std::size_t k = begin; k < end; ++k) {
+                                const auto row = std::next(from->begin(), slot(active[k]) * dimensions);
+                                std::copy(row, std::next(row, dimensions), std::next(input.begin(), k * dimensions));
+                            }
+                        });
+                        std::fill(std::next(input.begin(), n_rows * dimensions), input.end(), Scalar(0));
+
+                        // Run the group and write the changed outputs back to the cache
+                        unsigned int group_dimensions = dimensions;
+                        run_groups(conv_no, conv_no + 1, graph, nullptr, *buffers, group_dimensions, recorder);
+                        parallel_for(n_active, [&](const std::size_t& begin, const std::size_t& end) {
+                            for (std::size_t k = begin; k < end; ++k) {
+                                const auto row = std::next(input.begin(), k * output_dimensions);
+                                std::copy(row,
+                                          std::next(row, output_dimensions),
+                                          std::next(to.begin(), slot(active[k]) * output_dimensions));
+                            }
+                        });
+                    }
+                    from       = &to;
+                    dimensions = output_dimensions;
+                }
+
+                // Read the output of every point out of the cache
+                output.classifications.resize(n * dimensions);
+                parallel_for(n, [&](const std::size_t& begin, const std::size_t& end) {
+                    for (std::size_t i = begin; i < end; ++i) {
+                        const auto row = std::next(from->begin(), slot(i) * dimensions);
+                        std::copy(
+                          row, std::next(row, dimensions), std::next(output.classifications.begin(), i * dimensions));
+                    }
+                });
+
+                output.pixel_coordinates = std::move(projected.pixel_coordinates);
+                output.neighbourhood     = std::move(projected.neighbourhood);
+                output.global_indices    = std::move(projected.global_indices);
+            }
+
+            /**
+             * @brief Read the pixels of a projected mesh from an image into the input buffer
+             *
+             * @tparam N_NEIGHBOURS the number of neighbours that each point has
+             *
+             * @param projected the projected mesh whose pixel coordinates are read
+             * @param lens      the lens parameters that describe the optics of the camera
+             * @param image     the data that represents the image the network will run from
+             * @param format    the pixel format of this image as a fourcc code
+             * @param offset    the point in the input buffer that the first point of this mesh is written to
+             * @param buffers   the scratch buffers for this call, the input must already be large enough
+             */
+            template <int N_NEIGHBOURS>
+            void load_image(const ProjectedMesh<Scalar, N_NEIGHBOURS>& projected,
+                            const Lens<Scalar>& lens,
+                            const void* image,
+                            const uint32_t& format,
+                            const std::size_t& offset,
+                            Scratch& buffers) const {
+                // Based on the fourcc code, load the data from the image into input
+                // The format is resolved once here so the sampling loop is specialised for it
+                Scalar* const input  = buffers.input.data() + offset * 4;
+                const auto* const im = reinterpret_cast<const uint8_t*>(image);
+                const auto& pixels   = projected.pixel_coordinates;
+                dispatch_format(format, [&](auto sampler) {
+                    parallel_for(pixels.size(), [&](const std::size_t& begin, const std::size_t& end) {
+                        interpolate(sampler, pixels.data(), int(begin), int(end), im, lens.dimensions, input);
+                    });
+                });
+
                 // Four -1 values for the offscreen point
-                input.insert(input.end(), {Scalar(-1.0), Scalar(-1.0), Scalar(-1.0), Scalar(-1.0)});
+                std::fill(input + pixels.size() * 4, input + projected.neighbourhood.size() * 4, Scalar(-1.0));
+            }
 
+            /**
+             * @brief Run the network over every point, the result is left in the input buffer
+             *
+             * @tparam N_NEIGHBOURS the number of neighbours that each point has
+             *
+             * @param neighbourhood the neighbourhood graph for every point
+             * @param calibration   if not null the input of every layer is observed and full precision is always used
+             * @param buffers       the scratch buffers for this call, holding the 4 dimensional input of every point
+             * @param recorder      the frame that the stages are timed in
+             */
+            template <std::size_t N_NEIGHBOURS>
+            void run_network(const std::vector<std::array<int, N_NEIGHBOURS>>& neighbourhood,
+                             Calibration<Scalar>* calibration,
+                             Scratch& buffers,
+                             FrameRecorder& recorder) const {
                 // We start out with 4d input (RGBAesque)
-                unsigned int input_dimensions  = 4;
+                unsigned int input_dimensions = 4;
+
+                // Calibration always observes the full network
+                if (calibration != nullptr || cascade_head.empty()) {
+                    run_groups(0, network.size(), neighbourhood, calibration, buffers, input_dimensions, recorder);
+                }
+                else {
+                    run_groups(0, cascade_groups, neighbourhood, nullptr, buffers, input_dimensions, recorder);
+                    run_cascade(neighbourhood, buffers, input_dimensions, recorder);
+                }
+            }
+
+            /**
+             * @brief Run a range of the convolutional groups of the network over every point
+             *
+             * @tparam N_NEIGHBOURS the number of neighbours that each point has
+             *
+             * @param first            the first convolutional group to run
+             * @param last             one past the last convolutional group to run
+             * @param neighbourhood    the neighbourhood graph for every point
+             * @param calibration      if not null the input of every layer is observed and full precision is used
+             * @param buffers          the scratch buffers for this call, the input is replaced by the output
+             * @param input_dimensions the number of values for each point in input, updated to those of the output
+             * @param recorder         the frame that each group is timed in
+             */
+            template <std::size_t N_NEIGHBOURS>
+            void run_groups(const unsigned int& first,
+                            const unsigned int& last,
+                            const std::vector<std::array<int, N_NEIGHBOURS>>& neighbourhood,
+                            Calibration<Scalar>* calibration,
+                            Scratch& buffers,
+                            unsigned int& input_dimensions,
+                            FrameRecorder& recorder) const {
+                const unsigned int n_points = neighbourhood.size();
+                auto& input                 = buffers.input;
+                auto& output                = buffers.output;
+
+                // Calibration always observes the full precision network
+                const bool quantise_layers = calibration == nullptr && !quantised.empty();
+
                 unsigned int output_dimensions = 0;
 
                 // For each convolutional layer
-                for (unsigned int conv_no = 0; conv_no < structure.size(); ++conv_no) {
-                    const auto& conv = structure[conv_no];
-
-                    // Ensure enough space for the convolutional gather
-                    output.resize(0);
-                    output.reserve(input.size() * (N_NEIGHBOURS + 1));
-                    output_dimensions = input_dimensions * (N_NEIGHBOURS + 1);
-
-                    // Gather over each of the neighbours
-                    for (unsigned int i = 0; i < neighbourhood.size(); ++i) {
-                        output.insert(output.end(),
-                                      std::next(input.begin(), i * input_dimensions),
-                                      std::next(input.begin(), (i + 1) * input_dimensions));
-                        for (const auto& n : neighbourhood[i]) {
-                            output.insert(output.end(),
-                                          std::next(input.begin(), n * input_dimensions),
-                                          std::next(input.begin(), (n + 1) * input_dimensions));
-                        }
-                    }
+                for (unsigned int conv_no = first; conv_no < last; ++conv_no) {
+                    FrameRecorder::Scope scope(recorder, Stage::CONVOLUTION, conv_no);
 
-                    // Output becomes input
-                    std::swap(input, output);
-                    input_dimensions = output_dimensions;
+                    // A convolution with no layers is just the gather
+                    if (network.size(conv_no) == 0) {
+                        output_dimensions = input_dimensions * (N_NEIGHBOURS + 1);
+                        output.resize(n_points * output_dimensions);
+                        parallel_for(n_points, [&](const std::size_t& begin, const std::size_t& end) {
+                            for (std::size_t i = begin; i < end; ++i) {
+                                auto out = std::next(output.begin(), i * output_dimensions);
+                                out      = std::copy(std::next(input.begin(), i * input_dimensions),
+                                                std::next(input.begin(), (i + 1) * input_dimensions),
+                                                out);
+                                for (const auto& n : neighbourhood[i]) {
+                                    out = std::copy(std::next(input.begin(), n * input_dimensions),
+                                                    std::next(input.begin(), (n + 1) * input_dimensions),
+                                                    out);
+                                }
+                            }
+                        });
+                        std::swap(input, output);
+                        input_dimensions = output_dimensions;
+                    }
 
                     // For each network layer
-                    for (unsigned int layer_no = 0; layer_no < conv.size(); ++layer_no) {
-                        const auto& weights    = conv[layer_no].weights;
-                        const auto& biases     = conv[layer_no].biases;
-                        const auto& activation = conv[layer_no].activation;
+                    for (unsigned int layer_no = 0; layer_no < network.size(conv_no); ++layer_no) {
+                        const auto layer = network.layer(conv_no, layer_no);
 
                         // Setup the shapes
-                        output_dimensions = biases.size();
-                        output.resize(0);
-                        output.reserve(n_points * output_dimensions);
-
-                        // Apply the weights and bias
-                        auto in_point = input.begin();
-                        for (unsigned int i = 0; i < n_points; ++i) {
-                            for (unsigned int j = 0; j < output_dimensions; ++j) {
-                                output.emplace_back(std::inner_product(
-                                  in_point, in_point + input_dimensions, weights[j].begin(), biases[j]));
-                            }
-                            in_point += input_dimensions;
+                        output_dimensions = layer.output_dimensions;
+                        output.resize(n_points * output_dimensions);
+
+                        if (calibration != nullptr) {
+                            calibration->observe(conv_no, layer_no, input.begin(), input.end());
                         }
 
-                        // Apply the activation function
-                        apply_activation(activation, output, output_dimensions);
+                        if (quantise_layers) {
+                            apply_quantised(quantised.layer(conv_no, layer_no),
+                                            layer_no == 0,
+                                            input_dimensions,
+                                            neighbourhood,
+                                            buffers);
+                        }
+                        else {
+                            // Apply the weights, bias and activation function to each block of points
+                            parallel_for(n_points, [&](const std::size_t& begin, const std::size_t& end) {
+                                // The first layer gathers the neighbourhood as it multiplies so it is never stored
+                                Scalar* out = output.data() + begin * output_dimensions;
+                                if (layer_no == 0 && approximate) {
+                                    dense_gather<true>(
+                                      layer, input.data(), input_dimensions, neighbourhood, out, begin, end);
+                                }
+                                else if (layer_no == 0) {
+                                    dense_gather<false>(
+                                      layer, input.data(), input_dimensions, neighbourhood, out, begin, end);
+                                }
+                                else if (approximate) {
+                                    dense<true>(layer, input.data() + begin * input_dimensions, out, end - begin);
+                                }
+                                else {
+                                    dense<false>(layer, input.data() + begin * input_dimensions, out, end - begin);
+                                }
+                            });
+                        }
 
                         // Swap our values over
                         std::swap(input, output);
                         input_dimensions = output_dimensions;
                     }
                 }
+            }
+
+            /**
+             * @brief Run the cascade head over every point and the rest of the network for the uncertain points
+             *
+             * @details
+             *  The rest of the network is run on a smaller graph made of the uncertain points and every point within
+             *  one hop per remaining group of them, with the neighbours outside of it going to an extra point. Values
+             *  that are wrong because of the missing neighbours move in by one hop for each group so they never reach
+             *  the uncertain points.
+             *
+             * @tparam N_NEIGHBOURS the number of neighbours that each point has
+             *
+             * @param neighbourhood    the neighbourhood graph for every point
+             * @param buffers          the scratch buffers for this call, holding the output of the groups before the
+             *                         head and left holding the final output
+             * @param input_dimensions the number of values for each point in input
+             * @param recorder         the frame that the head and the groups after it are timed in
+             */
+            template <std::size_t N_NEIGHBOURS>
+            void run_cascade(const std::vector<std::array<int, N_NEIGHBOURS>>& neighbourhood,
+                             Scratch& buffers,
+                             unsigned int input_dimensions,
+                             FrameRecorder& recorder) const {
+                const unsigned int n_points = neighbourhood.size();
+                auto& input                 = buffers.input;
+                auto& output                = buffers.output;
+                auto& head                  = buffers.head;
+
+                // The head and building the graph of the uncertain points are timed as the cascade, the groups after
+                // it are timed on their own
+                FrameRecorder::Scope cascade(recorder, Stage::CASCADE);
+
+                // Run the head over every point, the first layer reads the input so it is still there afterwards
+                unsigned int dimensions = input_dimensions;
+                for (unsigned int layer_no = 0; layer_no < cascade_head.size(0); ++layer_no) {
+                    const auto layer  = cascade_head.layer(0, layer_no);
+                    const Scalar* in  = layer_no == 0 ? input.data() : head.data();
+                    auto& out         = layer_no == 0 ? head : output;
+                    out.resize(n_points * layer.output_dimensions);
+                    parallel_for(n_points, [&](const std::size_t& begin, const std::size_t& end) {
+                        Scalar* o = out.data() + begin * layer.output_dimensions;
+                        if (approximate) { dense<true>(layer, in + begin * dimensions, o, end - begin); }
+                        else {
+                            dense<false>(layer, in + begin * dimensions, o, end - begin);
+                        }
+                    });
+                    if (layer_no != 0) { std::swap(head, output); }
+                    dimensions = layer.output_dimensions;
+                }
+                const unsigned int output_dimensions = dimensions;
+
+                // Find the points that are not confident enough to exit early
+                auto& active = buffers.active;
+                auto& local  = buffers.local;
+                active.clear();
+                local.assign(n_points, -1);
+                for (unsigned int i = 0; i < n_points; ++i) {
+                    const auto p = std::next(head.begin(), i * output_dimensions);
+                    if (*std::max_element(p, std::next(p, output_dimensions)) < cascade_threshold) {
+                        local[i] = active.size();
+                        active.push_back(i);
+                    }
+                }
+                const unsigned int n_uncertain = active.size();
+
+                // If everything was confident the head is the result
+                if (n_uncertain == 0) {
+                    std::swap(input, head);
+                    return;
+                }
 
-                // Move all the things we made into the classified mesh except the input
-                // We copy the input instead of moving it as we reuse the input buffer
-                return ClassifiedMesh<Scalar, N_NEIGHBOURS>{std::move(projected.pixel_coordinates),
-                                                            std::move(projected.neighbourhood),
-                                                            std::move(projected.global_indices),
-                                                            input};
+                // Grow the uncertain points by one hop for each group that gathers its neighbours
+                std::size_t begin = 0;
+                for (unsigned int hop = cascade_groups; hop < network.size(); ++hop) {
+                    const std::size_t end = active.size();
+                    for (std::size_t i = begin; i < end; ++i) {
+                        for (const auto& n : neighbourhood[active[i]]) {
+                            if (local[n] < 0) {
+                                local[n] = active.size();
+                                active.push_back(n);
+                            }
+                        }
+                    }
+                    begin = end;
+                }
+
+                // Build the graph of the active points, with one extra point for any neighbours outside of it
+                const int n_active = active.size();
+                std::vector<std::array<int, N_NEIGHBOURS>> graph(n_active + 1);
+                for (int i = 0; i < n_active; ++i) {
+                    const auto& neighbours = neighbourhood[active[i]];
+                    for (std::size_t j = 0; j < N_NEIGHBOURS; ++j) {
+                        graph[i][j] = local[neighbours[j]] < 0 ? n_active : local[neighbours[j]];
+                    }
+                }
+                graph[n_active].fill(n_active);
+
+                // Gather the input of the active points, the extra point is zero as its value never reaches the result
+                output.resize((n_active + 1) * input_dimensions);
+                parallel_for(n_active, [&](const std::size_t& begin, const std::size_t& end) {
+                    for (std::size_t i = begin; i < end; ++i) {
+                        std::copy(std::next(input.begin(), active[i] * input_dimensions),
+                                  std::next(input.begin(), (active[i] + 1) * input_dimensions),
+                                  std::next(output.begin(), i * input_dimensions));
+                    }
+                });
+                std::fill(std::next(output.begin(), n_active * input_dimensions), output.end(), Scalar(0));
+                std::swap(input, output);
+                cascade.stop();
+
+                // Run the rest of the network and replace the head output of the uncertain points
+                run_groups(cascade_groups, network.size(), graph, nullptr, buffers, input_dimensions, recorder);
+                parallel_for(n_uncertain, [&](const std::size_t& begin, const std::size_t& end) {
+                    for (std::size_t i = begin; i < end; ++i) {
+                        std::copy(std::next(input.begin(), i * output_dimensions),
+                                  std::next(input.begin(), (i + 1) * output_dimensions),
+                                  std::next(head.begin(), active[i] * output_dimensions));
+                    }
+                });
+                std::swap(input, head);
             }
 
             /**
-             * @brief Project and classify a mesh using the neural network that is loaded into this engine.
-             * This version takes an aggregate VisualMesh object
+             * @brief Apply a quantised layer to every point, the input is quantised first
              *
-             * @tparam Model the mesh model that we are projecting
+             * @tparam N_NEIGHBOURS the number of neighbours that each point has
              *
-             * @param mesh    the mesh table that we are projecting to pixel coordinates
-             * @param Hoc     the homogenous transformation matrix from the camera to the observation plane
-             * @param lens    the lens parameters that describe the optics of the camera
-             * @param image   the data that represents the image the network will run from
-             * @param format  the pixel format of this image as a fourcc code
+             * @param layer            the quantised layer to apply
+             * @param gather           if this is the first layer of a convolution and the neighbourhood is gathered
+             * @param input_dimensions the number of values for each point in input
+             * @param neighbourhood    the neighbourhood graph for every point
+             * @param buffers          the scratch buffers for this call, read from input and written to output
+             */
+            template <std::size_t N_NEIGHBOURS>
+            void apply_quantised(const QuantisedLayer<Scalar>& layer,
+                                 const bool& gather,
+                                 const unsigned int& input_dimensions,
+                                 const std::vector<std::array<int, N_NEIGHBOURS>>& neighbourhood,
+                                 Scratch& buffers) const {
+                const std::size_t n_points          = neighbourhood.size();
+                const unsigned int output_dimensions = layer.output_dimensions;
+                const auto& input                    = buffers.input;
+                auto& output                         = buffers.output;
+                auto& quantised_input                = buffers.quantised_input;
+
+                // Every point must be quantised before any are gathered
+                quantised_input.resize(n_points * input_dimensions);
+                parallel_for(n_points, [&](const std::size_t& begin, const std::size_t& end) {
+                    cpu::quantise(layer.input,
+                                  input.data() + begin * input_dimensions,
+                                  quantised_input.data() + begin * input_dimensions,
+                                  (end - begin) * input_dimensions);
+                });
+
+                parallel_for(n_points, [&](const std::size_t& begin, const std::size_t& end) {
+                    const uint8_t* in = quantised_input.data();
+                    Scalar* out       = output.data() + begin * output_dimensions;
+                    if (gather && approximate) {
+                        dense_quantised_gather<true>(layer, in, input_dimensions, neighbourhood, out, begin, end);
+                    }
+                    else if (gather) {
+                        dense_quantised_gather<false>(layer, in, input_dimensions, neighbourhood, out, begin, end);
+                    }
+                    else if (approximate) {
+                        dense_quantised<true>(layer, in + begin * input_dimensions, out, end - begin);
+                    }
+                    else {
+                        dense_quantised<false>(layer, in + begin * input_dimensions, out, end - begin);
+                    }
+                });
+            }
+
+            /**
+             * @brief Execute a function over the range [0, n) using the thread pool if we have one
              *
-             * @return a classified mesh for the provided arguments
+             * @tparam Func the type of the function to execute, called as fn(begin, end)
+             *
+             * @param n  the number of elements in the range
+             * @param fn the function to execute over each chunk of the range
              */
-            template <template <typename> class Model>
-            ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> operator()(const VisualMesh<Scalar, Model>& mesh,
-                                                                           const mat4<Scalar>& Hoc,
-                                                                           const Lens<Scalar>& lens,
-                                                                           const void* image,
-                                                                           const uint32_t& format) const {
-                return operator()(mesh.height(Hoc[2][3]), Hoc, lens, image, format);
+            template <typename Func>
+            void parallel_for(const std::size_t& n, Func&& fn) const {
+                if (pool) { pool->parallel_for(n, std::forward<Func>(fn), GRAIN); }
+                else {
+                    fn(std::size_t(0), n);
+                }
             }
 
-        private:
-            /// The network structure used to perform the operations
-            NetworkStructure<Scalar> structure;
+            /// The minimum number of points that will be given to a thread at a time
+            static constexpr std::size_t GRAIN = 64;
 
-            /// An input buffer used to ping/pong when doing classification so we don't have to remake them
-            mutable std::vector<Scalar> input;
-            /// An output buffer used to ping/pong when doing classification so we don't have to remake them
-            mutable std::vector<Scalar> output;
+            /// The network used to perform the operations, compiled with a block size of dense_block<Scalar>()
+            CompiledNetwork<Scalar> network;
+            /// The quantised version of the network, empty unless the engine has been quantised
+            QuantisedNetwork<Scalar> quantised;
+            /// The early exit head as a single group, empty unless a cascade has been set
+            CompiledNetwork<Scalar> cascade_head;
+            /// The number of convolutional groups that are run before the cascade head
+            unsigned int cascade_groups = 0;
+            /// A point exits early when the largest output of the cascade head is at least this
+            Scalar cascade_threshold = 1;
+            /// If the activation functions should use the fast approximations of exp and tanh
+            bool approximate;
+            /// The threads used to split the work, or nullptr if we are running single threaded
+            std::shared_ptr<ThreadPool> pool;
+
+            /// The scratch buffers that are not being used by a call, shared with any copies of this engine
+            std::shared_ptr<ObjectPool<Scratch>> scratch;
+            /// The projection buffers used when the caller doesn't provide their own, shared with any copies
+            std::shared_ptr<ObjectPool<ProjectionArena>> arenas;
+            /// Runs the mesh lookups, keeping the state of previous lookups when incremental lookup is enabled
+            std::shared_ptr<IncrementalLookup<Scalar>> lookup;
+            /// Where the stats of every frame are reported, or nullptr if the engine isn't being timed
+            std::shared_ptr<Instrumentation> instrumentation;
         };
 
+        template <typename Scalar>
+        constexpr std::size_t Engine<Scalar>::GRAIN;
+
     }  // namespace cpu
 }  // namespace engine
 }  // namespace visualmesh
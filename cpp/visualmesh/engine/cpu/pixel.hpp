@@ -18,9 +18,14 @@
 #ifndef VISUALMESH_ENGINE_CPU_PIXEL_HPP
 #define VISUALMESH_ENGINE_CPU_PIXEL_HPP
 
+#include <algorithm>
+#include <cmath>
 #include <cstdint>
+#include <cstring>
+#include <stdexcept>
 
 #include "bayer.hpp"
+#include "target.hpp"
 #include "visualmesh/utility/fourcc.hpp"
 #include "visualmesh/utility/math.hpp"
 
@@ -29,72 +34,157 @@ namespace engine {
     namespace cpu {
 
         /**
-         * @brief Read the pixel value at a specific pixel coordinate
-         *
-         * @tparam Scalar the scalar type to use when calculating the pixel coordinates
-         *
-         * @param px            the pixel coordinates to sample
-         * @param image         the image object we are sampling
-         * @param dimensions    the dimensions of the image
-         * @param format        the format of the image to sample
+         * @brief Samplers that read a single pixel from an image of a specific format
          *
-         * @return a floating point image output with a value between 0.0 -> 1.0
+         * @details
+         *  The format is a template parameter so the channel order and the size of each pixel are known at compile
+         *  time. The format of an image is resolved to one of these once per frame with dispatch_format, so the loop
+         *  that samples every point doesn't need to branch on the format.
          */
-        template <typename Scalar>
-        inline vec4<Scalar> get_pixel(const vec2<int>& px,
-                                      const uint8_t* const image,
-                                      const vec2<int>& dimensions,
-                                      const uint32_t& format) {
+        namespace sampler {
 
-            switch (format) {
-                // Bayer
-                case fourcc("GRBG"):
-                case fourcc("RGGB"):
-                case fourcc("GBRG"):
-                case fourcc("BGGR"): {
-                    return bayer::get_pixel<Scalar>(px, image, dimensions, format);
-                }
-                case fourcc("BGR3"):
-                case fourcc("BGR8"): {
-                    int c = (px[1] * dimensions[0] + px[0]) * 3;
-                    return vec4<Scalar>{image[c + 2] * Scalar(1.0 / 255.0),
-                                        image[c + 1] * Scalar(1.0 / 255.0),
-                                        image[c + 0] * Scalar(1.0 / 255.0),
-                                        1.0};
+            /**
+             * @brief An image whose pixels are made of 8 bit channels stored together
+             *
+             * @tparam R      the byte offset of the red channel within a pixel
+             * @tparam G      the byte offset of the green channel within a pixel
+             * @tparam B      the byte offset of the blue channel within a pixel
+             * @tparam A      the byte offset of the alpha channel within a pixel, or -1 if the image is opaque
+             * @tparam STRIDE the number of bytes in each pixel
+             */
+            template <int R, int G, int B, int A, int STRIDE>
+            struct Packed {
+                template <typename Scalar>
+                static VISUALMESH_ALWAYS_INLINE vec4<Scalar> get(const vec2<int>& px,
+                                                                 const uint8_t* const image,
+                                                                 const vec2<int>& dimensions) {
+                    const uint8_t* p = image + (px[1] * dimensions[0] + px[0]) * STRIDE;
+                    return vec4<Scalar>{{p[R] * Scalar(1.0 / 255.0),
+                                         p[G] * Scalar(1.0 / 255.0),
+                                         p[B] * Scalar(1.0 / 255.0),
+                                         A < 0 ? Scalar(1.0) : p[A < 0 ? 0 : A] * Scalar(1.0 / 255.0)}};
                 }
-                case fourcc("BGRA"): {
-                    int c = (px[1] * dimensions[0] + px[0]) * 4;
-                    return vec4<Scalar>{image[c + 2] * Scalar(1.0 / 255.0),
-                                        image[c + 1] * Scalar(1.0 / 255.0),
-                                        image[c + 0] * Scalar(1.0 / 255.0),
-                                        image[c + 3] * Scalar(1.0 / 255.0)};
+            };
+
+            using RGB  = Packed<0, 1, 2, -1, 3>;
+            using BGR  = Packed<2, 1, 0, -1, 3>;
+            using RGBA = Packed<0, 1, 2, 3, 4>;
+            using BGRA = Packed<2, 1, 0, 3, 4>;
+            using Grey = Packed<0, 0, 0, -1, 1>;
+
+            /**
+             * @brief A raw image with a bayer pattern, demosaiced at each pixel that is read
+             *
+             * @tparam PATTERN the fourcc code of the bayer pattern
+             */
+            template <uint32_t PATTERN>
+            struct Bayer {
+                template <typename Scalar>
+                static VISUALMESH_ALWAYS_INLINE vec4<Scalar> get(const vec2<int>& px,
+                                                                 const uint8_t* const image,
+                                                                 const vec2<int>& dimensions) {
+                    return bayer::get_pixel<Scalar>(px, image, dimensions, PATTERN);
                 }
+            };
 
-                case fourcc("RGB3"):
-                case fourcc("RGB8"): {
-                    int c = (px[1] * dimensions[0] + px[0]) * 3;
-                    return vec4<Scalar>{image[c + 0] * Scalar(1.0 / 255.0),
-                                        image[c + 1] * Scalar(1.0 / 255.0),
-                                        image[c + 2] * Scalar(1.0 / 255.0),
-                                        1.0};
+            /**
+             * @brief Convert an 8 bit YUV pixel to RGB
+             *
+             * @details
+             *  Uses the BT.601 limited range coefficients, the same as the YUV conversions in OpenCV, so images that
+             *  were converted before being passed in give the same network input.
+             *
+             * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+             *
+             * @param y the luma of the pixel
+             * @param u the blue difference chroma of the pixel
+             * @param v the red difference chroma of the pixel
+             *
+             * @return the pixel as RGBA with values between 0.0 and 1.0
+             */
+            template <typename Scalar>
+            VISUALMESH_ALWAYS_INLINE vec4<Scalar> yuv_to_rgb(const uint8_t& y, const uint8_t& u, const uint8_t& v) {
+                const Scalar Y = (Scalar(y) - Scalar(16.0)) * Scalar(1.164 / 255.0);
+                const Scalar U = (Scalar(u) - Scalar(128.0)) * Scalar(1.0 / 255.0);
+                const Scalar V = (Scalar(v) - Scalar(128.0)) * Scalar(1.0 / 255.0);
+                return vec4<Scalar>{{std::min(std::max(Y + Scalar(1.596) * V, Scalar(0.0)), Scalar(1.0)),
+                                     std::min(std::max(Y - Scalar(0.813) * V - Scalar(0.391) * U, Scalar(0.0)),
+                                              Scalar(1.0)),
+                                     std::min(std::max(Y + Scalar(2.018) * U, Scalar(0.0)), Scalar(1.0)),
+                                     Scalar(1.0)}};
+            }
+
+            /**
+             * @brief A planar YUV 4:2:0 image, a full resolution luma plane followed by a half resolution plane of
+             * interleaved U and V
+             */
+            struct NV12 {
+                template <typename Scalar>
+                static VISUALMESH_ALWAYS_INLINE vec4<Scalar> get(const vec2<int>& px,
+                                                                 const uint8_t* const image,
+                                                                 const vec2<int>& dimensions) {
+                    const uint8_t* uv = image + dimensions[0] * (dimensions[1] + (px[1] >> 1)) + (px[0] & ~1);
+                    return yuv_to_rgb<Scalar>(image[px[1] * dimensions[0] + px[0]], uv[0], uv[1]);
                 }
-                case fourcc("RGBA"): {
-                    int c = (px[1] * dimensions[0] + px[0]) * 4;
-                    return vec4<Scalar>{image[c + 0] * Scalar(1.0 / 255.0),
-                                        image[c + 1] * Scalar(1.0 / 255.0),
-                                        image[c + 2] * Scalar(1.0 / 255.0),
-                                        image[c + 3] * Scalar(1.0 / 255.0)};
+            };
+
+            /**
+             * @brief A packed YUV 4:2:2 image where each pair of pixels is stored as four bytes that share chroma
+             *
+             * @tparam Y0 the byte offset of the luma of the first pixel of a pair
+             * @tparam U  the byte offset of the blue difference chroma of a pair
+             * @tparam V  the byte offset of the red difference chroma of a pair
+             */
+            template <int Y0, int U, int V>
+            struct Packed422 {
+                template <typename Scalar>
+                static VISUALMESH_ALWAYS_INLINE vec4<Scalar> get(const vec2<int>& px,
+                                                                 const uint8_t* const image,
+                                                                 const vec2<int>& dimensions) {
+                    const uint8_t* p = image + (px[1] * dimensions[0] + (px[0] & ~1)) * 2;
+                    return yuv_to_rgb<Scalar>(p[Y0 + (px[0] & 1) * 2], p[U], p[V]);
                 }
+            };
+
+            using YUYV = Packed422<0, 1, 3>;
+            using UYVY = Packed422<1, 0, 2>;
+
+        }  // namespace sampler
 
+        /**
+         * @brief Call a function with the sampler for an image format
+         *
+         * @details
+         *  This is the only place the format of an image is switched on, the function is instantiated once for each
+         *  supported format and called with a default constructed sampler for the one that matches.
+         *
+         * @tparam Func the type of the function, normally a generic lambda taking the sampler by value
+         *
+         * @param format the pixel format of the image as a fourcc code
+         * @param fn     the function to call with the sampler
+         *
+         * @return the value returned by the function
+         */
+        template <typename Func>
+        auto dispatch_format(const uint32_t& format, Func&& fn) -> decltype(fn(sampler::RGBA())) {
+            switch (format) {
+                case fourcc("GRBG"): return fn(sampler::Bayer<fourcc("GRBG")>());
+                case fourcc("RGGB"): return fn(sampler::Bayer<fourcc("RGGB")>());
+                case fourcc("GBRG"): return fn(sampler::Bayer<fourcc("GBRG")>());
+                case fourcc("BGGR"): return fn(sampler::Bayer<fourcc("BGGR")>());
+                case fourcc("BGR3"):
+                case fourcc("BGR8"): return fn(sampler::BGR());
+                case fourcc("BGRA"): return fn(sampler::BGRA());
+                case fourcc("RGB3"):
+                case fourcc("RGB8"): return fn(sampler::RGB());
+                case fourcc("RGBA"): return fn(sampler::RGBA());
                 case fourcc("GRAY"):
                 case fourcc("GREY"):
-                case fourcc("Y8  "): {
-                    int c = (px[1] * dimensions[0] + px[0]);
-                    return vec4<Scalar>{image[c] * Scalar(1.0 / 255.0),
-                                        image[c] * Scalar(1.0 / 255.0),
-                                        image[c] * Scalar(1.0 / 255.0),
-                                        1.0};
-                }
+                case fourcc("Y8  "): return fn(sampler::Grey());
+                case fourcc("NV12"): return fn(sampler::NV12());
+                case fourcc("YUYV"):
+                case fourcc("YUY2"): return fn(sampler::YUYV());
+                case fourcc("UYVY"): return fn(sampler::UYVY());
 
                 // Oh no...
                 default: throw std::runtime_error("Unsupported image format " + fourcc_text(format));
@@ -102,21 +192,21 @@ namespace engine {
         }
 
         /**
-         * @brief A version of the get_pixel function that allows for floating point pixel locations. It will perform a
-         * linear interpolation on the surrounding pixels.
+         * @brief Bilinearly interpolate the pixels around a floating point pixel location
          *
-         * @tparam Scalar
-         * @param P
-         * @param image
-         * @param dimensions
-         * @param format
-         * @return vec4<Scalar>
+         * @tparam Sampler the sampler for the format of the image
+         * @tparam Scalar  the scalar type used for calculations and storage (normally one of float or double)
+         *
+         * @param P          the pixel coordinates to sample
+         * @param image      the image bytes
+         * @param dimensions the dimensions of the image
+         *
+         * @return the four channels of the image at P with values between 0.0 and 1.0
          */
-        template <typename Scalar>
-        inline vec4<Scalar> interpolate(const vec2<Scalar>& P,
-                                        const uint8_t* const image,
-                                        const vec2<int>& dimensions,
-                                        const uint32_t& format) {
+        template <typename Sampler, typename Scalar>
+        VISUALMESH_ALWAYS_INLINE vec4<Scalar> interpolate(const vec2<Scalar>& P,
+                                                          const uint8_t* const image,
+                                                          const vec2<int>& dimensions) {
 
             // (x1, y1) -------------- (x2, y1)
             //    |                       |
@@ -132,10 +222,10 @@ namespace engine {
             const int y1          = std::max(int(std::floor(P[1])), 0);
             const int x2          = std::min(x1 + 1, dimensions[0] - 1);
             const int y2          = std::min(y1 + 1, dimensions[1] - 1);
-            const vec4<Scalar> Q1 = get_pixel<Scalar>(vec2<int>{x1, y1}, image, dimensions, format);
-            const vec4<Scalar> Q2 = get_pixel<Scalar>(vec2<int>{x2, y1}, image, dimensions, format);
-            const vec4<Scalar> Q3 = get_pixel<Scalar>(vec2<int>{x1, y2}, image, dimensions, format);
-            const vec4<Scalar> Q4 = get_pixel<Scalar>(vec2<int>{x2, y2}, image, dimensions, format);
+            const vec4<Scalar> Q1 = Sampler::template get<Scalar>(vec2<int>{{x1, y1}}, image, dimensions);
+            const vec4<Scalar> Q2 = Sampler::template get<Scalar>(vec2<int>{{x2, y1}}, image, dimensions);
+            const vec4<Scalar> Q3 = Sampler::template get<Scalar>(vec2<int>{{x1, y2}}, image, dimensions);
+            const vec4<Scalar> Q4 = Sampler::template get<Scalar>(vec2<int>{{x2, y2}}, image, dimensions);
 
             const vec4<Scalar> R1 = add(multiply(Q1, ((x2 - x) / (x2 - x1))), multiply(Q2, ((x - x1) / (x2 - x1))));
             const vec4<Scalar> R2 = add(multiply(Q3, ((x2 - x) / (x2 - x1))), multiply(Q4, ((x - x1) / (x2 - x1))));
@@ -143,6 +233,179 @@ namespace engine {
             return add(multiply(R1, ((y2 - y) / (y2 - y1))), multiply(R2, ((y - y1) / (y2 - y1))));
         }
 
+        namespace bayer {
+
+#if defined(__GNUC__) || defined(__clang__)
+            template <uint32_t PATTERN, typename Scalar>
+            VISUALMESH_ALWAYS_INLINE void interpolate_lanes(const vec2<Scalar>* P,
+                                                            const int& begin,
+                                                            const int& end,
+                                                            const uint8_t* const image,
+                                                            const vec2<int>& dimensions,
+                                                            Scalar* out) {
+                using Sampler       = sampler::Bayer<PATTERN>;
+                const vec2<int> red = bayer_first_red(PATTERN);
+                int i               = begin;
+                for (; i + lanes::LANES <= end; i += lanes::LANES) {
+                    if (!lanes::sample(P + i, image, dimensions, red, out + i * 4)) {
+                        for (int l = i; l < i + lanes::LANES; ++l) {
+                            const vec4<Scalar> v = cpu::interpolate<Sampler>(P[l], image, dimensions);
+                            std::memcpy(out + l * 4, v.data(), sizeof(v));
+                        }
+                    }
+                }
+                for (; i < end; ++i) {
+                    const vec4<Scalar> v = cpu::interpolate<Sampler>(P[i], image, dimensions);
+                    std::memcpy(out + i * 4, v.data(), sizeof(v));
+                }
+            }
+#endif  // defined(__GNUC__) || defined(__clang__)
+
+#ifdef VISUALMESH_CPU_RUNTIME_DISPATCH
+            template <uint32_t PATTERN, typename Scalar>
+            __attribute__((target("avx2"))) void interpolate_avx2(const vec2<Scalar>* P,
+                                                                  const int begin,
+                                                                  const int end,
+                                                                  const uint8_t* const image,
+                                                                  const vec2<int>& dimensions,
+                                                                  Scalar* out) {
+                interpolate_lanes<PATTERN>(P, begin, end, image, dimensions, out);
+            }
+#endif  // VISUALMESH_CPU_RUNTIME_DISPATCH
+
+            /**
+             * @brief Bilinearly sample many points from a bayer image, demosaicing only the pixels that are used
+             *
+             * @details
+             *  Points are processed in groups of eight. The 6x6 window of raw pixels that covers the four taps of each
+             *  point is gathered and the demosaic kernels for the taps are evaluated together as integer vectors, with
+             *  the pixel type of each lane selected with masks rather than branches. Groups that touch the last row or
+             *  column of the image and any remaining points use the scalar interpolate so the results are identical.
+             *  On x86 an AVX2 version is selected at runtime when the processor supports it.
+             *
+             * @tparam PATTERN the fourcc code of the bayer pattern
+             * @tparam Scalar  the scalar type used for calculations and storage (normally one of float or double)
+             *
+             * @param P          the pixel coordinates of the points
+             * @param begin      the first point to sample
+             * @param end        one past the last point to sample
+             * @param image      the image bytes
+             * @param dimensions the dimensions of the input image
+             * @param out        the four channels of each point, indexed the same way as P
+             */
+            template <uint32_t PATTERN, typename Scalar>
+            void interpolate(const vec2<Scalar>* P,
+                             const int& begin,
+                             const int& end,
+                             const uint8_t* const image,
+                             const vec2<int>& dimensions,
+                             Scalar* out) {
+#ifdef VISUALMESH_CPU_RUNTIME_DISPATCH
+                static const bool avx2 = __builtin_cpu_supports("avx2");
+                if (avx2) {
+                    interpolate_avx2<PATTERN>(P, begin, end, image, dimensions, out);
+                    return;
+                }
+#endif  // VISUALMESH_CPU_RUNTIME_DISPATCH
+#if defined(__GNUC__) || defined(__clang__)
+                interpolate_lanes<PATTERN>(P, begin, end, image, dimensions, out);
+#else
+                for (int i = begin; i < end; ++i) {
+                    const vec4<Scalar> v = cpu::interpolate<sampler::Bayer<PATTERN>>(P[i], image, dimensions);
+                    std::memcpy(out + i * 4, v.data(), sizeof(v));
+                }
+#endif  // defined(__GNUC__) || defined(__clang__)
+            }
+
+        }  // namespace bayer
+
+        /**
+         * @brief Bilinearly sample the image at many points, writing the four channels of each to the output
+         *
+         * @tparam Sampler the sampler for the format of the image
+         * @tparam Scalar  the scalar type used for calculations and storage (normally one of float or double)
+         *
+         * @param P          the pixel coordinates of the points
+         * @param begin      the first point to sample
+         * @param end        one past the last point to sample
+         * @param image      the image bytes
+         * @param dimensions the dimensions of the image
+         * @param out        the four channels of each point, indexed the same way as P
+         */
+        template <typename Sampler, typename Scalar>
+        void interpolate(const Sampler& /*sampler*/,
+                         const vec2<Scalar>* P,
+                         const int& begin,
+                         const int& end,
+                         const uint8_t* const image,
+                         const vec2<int>& dimensions,
+                         Scalar* out) {
+            for (int i = begin; i < end; ++i) {
+                const vec4<Scalar> v = interpolate<Sampler>(P[i], image, dimensions);
+                std::memcpy(out + i * 4, v.data(), sizeof(v));
+            }
+        }
+
+        /// Bayer images are sampled several points at a time so the demosaic can be vectorised
+        template <uint32_t PATTERN, typename Scalar>
+        void interpolate(const sampler::Bayer<PATTERN>& /*sampler*/,
+                         const vec2<Scalar>* P,
+                         const int& begin,
+                         const int& end,
+                         const uint8_t* const image,
+                         const vec2<int>& dimensions,
+                         Scalar* out) {
+            bayer::interpolate<PATTERN>(P, begin, end, image, dimensions, out);
+        }
+
+        /**
+         * @brief Read the pixel value at a specific pixel coordinate
+         *
+         * @details
+         *  This resolves the format on every call, when sampling many points use dispatch_format once instead.
+         *
+         * @tparam Scalar the scalar type to use when calculating the pixel coordinates
+         *
+         * @param px            the pixel coordinates to sample
+         * @param image         the image object we are sampling
+         * @param dimensions    the dimensions of the image
+         * @param format        the format of the image to sample
+         *
+         * @return a floating point image output with a value between 0.0 -> 1.0
+         */
+        template <typename Scalar>
+        inline vec4<Scalar> get_pixel(const vec2<int>& px,
+                                      const uint8_t* const image,
+                                      const vec2<int>& dimensions,
+                                      const uint32_t& format) {
+            return dispatch_format(format, [&](auto s) {
+                using Sampler = decltype(s);
+                return Sampler::template get<Scalar>(px, image, dimensions);
+            });
+        }
+
+        /**
+         * @brief A version of the get_pixel function that allows for floating point pixel locations. It will perform a
+         * linear interpolation on the surrounding pixels.
+         *
+         * @details
+         *  This resolves the format on every call, when sampling many points use dispatch_format once instead.
+         *
+         * @tparam Scalar
+         * @param P
+         * @param image
+         * @param dimensions
+         * @param format
+         * @return vec4<Scalar>
+         */
+        template <typename Scalar>
+        inline vec4<Scalar> interpolate(const vec2<Scalar>& P,
+                                        const uint8_t* const image,
+                                        const vec2<int>& dimensions,
+                                        const uint32_t& format) {
+            return dispatch_format(format, [&](auto s) { return interpolate<decltype(s)>(P, image, dimensions); });
+        }
+
     }  // namespace cpu
 }  // namespace engine
 }  // namespace visualmesh
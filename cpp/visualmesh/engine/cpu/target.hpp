@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef VISUALMESH_ENGINE_CPU_TARGET_HPP
+#define VISUALMESH_ENGINE_CPU_TARGET_HPP
+
+// Runtime instruction set selection is on by default on x86 with GCC compatible compilers, where the kernels are also
+// compiled for AVX2 and AVX-512 and the best one for the processor is picked the first time it runs. It can be turned
+// off by defining VISUALMESH_DISABLE_CPU_RUNTIME_DISPATCH (-DENABLE_CPU_RUNTIME_DISPATCH=OFF in CMake).
+// There are no instruction set specific kernels for other platforms. On aarch64 only the generic kernels run, their
+// vector extension types are lowered to NEON by the compiler as NEON is always available there. SVE is not used.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__)) \
+  && !defined(VISUALMESH_DISABLE_CPU_RUNTIME_DISPATCH)
+#define VISUALMESH_CPU_RUNTIME_DISPATCH
+#endif
+
+// Used on the small functions that make up the kernels so that they are compiled into each instruction set specific
+// version of the kernel rather than being called out of line
+#if defined(__GNUC__) || defined(__clang__)
+#define VISUALMESH_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define VISUALMESH_ALWAYS_INLINE inline
+#endif
+
+#endif  // VISUALMESH_ENGINE_CPU_TARGET_HPP
@@ -0,0 +1,1153 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_ENGINE_CUDA_ENGINE_HPP
+#define VISUALMESH_ENGINE_CUDA_ENGINE_HPP
+
+// If CUDA is disabled then don't provide this file
+#if !defined(VISUALMESH_DISABLE_CUDA)
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "visualmesh/classified_mesh.hpp"
+#include "visualmesh/compiled_network.hpp"
+#include "visualmesh/engine/cuda/kernels/dense_tensor.cu.hpp"
+#include "visualmesh/engine/cuda/kernels/load_image.cu.hpp"
+#include "visualmesh/engine/cuda/kernels/project.cu.hpp"
+#include "visualmesh/engine/cuda/operation/create_buffer.hpp"
+#include "visualmesh/engine/cuda/operation/cuda_error_category.hpp"
+#include "visualmesh/engine/cuda/operation/graph.hpp"
+#include "visualmesh/engine/cuda/operation/make_context.hpp"
+#include "visualmesh/engine/cuda/operation/make_module.hpp"
+#include "visualmesh/engine/cuda/operation/make_network.hpp"
+#include "visualmesh/engine/cuda/operation/scalar_defines.hpp"
+#include "visualmesh/engine/cuda/operation/wrapper.hpp"
+#include "visualmesh/instrumentation.hpp"
+#include "visualmesh/mesh.hpp"
+#include "visualmesh/projected_mesh.hpp"
+#include "visualmesh/quantisation.hpp"
+#include "visualmesh/utility/buffer_capacity.hpp"
+#include "visualmesh/utility/fourcc.hpp"
+#include "visualmesh/utility/math.hpp"
+#include "visualmesh/utility/projection.hpp"
+#include "visualmesh/utility/range_lookup.hpp"
+#include "visualmesh/utility/residency_cache.hpp"
+#include "visualmesh/visualmesh.hpp"
+
+namespace visualmesh {
+namespace engine {
+    namespace cuda {
+
+        /**
+         * @brief A CUDA implementation of the visual mesh inference engine
+         *
+         * @details
+         *  The CUDA implementation is for NVIDIA devices, from Jetsons to datacentre GPUs, where it avoids the poorly
+         *  supported OpenCL drivers. The kernels for the network are generated from the network and compiled at runtime
+         *  with NVRTC. In half precision the convs that are wide enough are multiplied on the tensor cores of devices
+         *  that have them.
+         *  The work of a classification, from uploading the image to reading back the results, is built into a CUDA
+         *  graph by the first frame. Later frames only update the parameters of the graph and launch it, which saves
+         *  launching each of the kernels and copies separately.
+         *  The engine can be shared between threads, however the device buffers and graphs are reused between calls so
+         *  calls from several threads take turns.
+         *
+         * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+         */
+        template <typename Scalar>
+        class Engine {
+        public:
+            /**
+             * @brief Construct a new CUDA Engine object
+             *
+             * @param network         the network to use for classification, a NetworkStructure is compiled implicitly
+             * @param precision       the precision to execute the network with, either FULL or HALF. HALF runs the
+             *                        convs that gather at least 64 values on the tensor cores of devices with compute
+             *                        capability 7.0 or later, the other convs run at full precision
+             * @param cache_directory an existing directory to cache the compiled program in so later engines for the
+             *                        same network and device skip compiling it, or empty to always compile it
+             * @param device          the device to run on from operation::list_devices, or -1 for the device with the
+             *                        most multiprocessors
+             */
+            Engine(const CompiledNetwork<Scalar>& network = {},
+                   const Precision& precision             = Precision::FULL,
+                   const std::string& cache_directory     = "",
+                   CUdevice device                        = -1)
+              : Engine(network, operation::make_network(network), floating(precision), cache_directory, device) {}
+
+            /**
+             * @brief Construct a new CUDA Engine object that executes an 8 bit quantised network
+             *
+             * @param network         the quantised network to use for classification
+             * @param cache_directory an existing directory to cache the compiled program in so later engines for the
+             *                        same network and device skip compiling it, or empty to always compile it
+             * @param device          the device to run on from operation::list_devices, or -1 for the device with the
+             *                        most multiprocessors
+             */
+            explicit Engine(const QuantisedNetwork<Scalar>& network,
+                            const std::string& cache_directory = "",
+                            CUdevice device                    = -1)
+              : Engine(network, operation::make_network(network), Precision::INT8, cache_directory, device) {}
+
+        private:
+            /**
+             * @brief Construct a new CUDA Engine object from the generated source for a network
+             *
+             * @tparam Network the type of network, either a CompiledNetwork or a QuantisedNetwork
+             *
+             * @param network         the network to use for classification
+             * @param network_source  the CUDA source code for the network's kernels
+             * @param precision       the precision to execute the network with
+             * @param cache_directory the directory to cache the compiled program in, or empty to not cache it
+             * @param device          the device to run on, or -1 for the device with the most multiprocessors
+             */
+            template <typename Network>
+            Engine(const Network& network,
+                   const std::string& network_source,
+                   const Precision& precision,
+                   const std::string& cache_directory,
+                   CUdevice device)
+              : max_width(4) {
+                std::tie(context, this->device) = operation::make_context(device);
+                ScopedContext scope(context);
+                stream = operation::make_stream(context);
+
+                // The tensor cores multiply half precision from compute capability 7.0
+                const int capability = operation::compute_capability(this->device);
+                const bool tensors   = precision == Precision::HALF && capability >= 70;
+
+                // Work out how each conv runs and how wide the buffers between them must be
+                n_neighbours                   = network.empty() ? 0 : network.layer(0, 0).input_dimensions / 4 - 1;
+                unsigned int input_dimensions  = 4;
+                for (unsigned int conv_no = 0; conv_no < network.size(); ++conv_no) {
+                    Conv conv;
+                    conv.input_dimensions = input_dimensions;
+                    conv.outputs          = network.layer(conv_no, network.size(conv_no) - 1).output_dimensions;
+
+                    const int gathered = int(input_dimensions * (n_neighbours + 1));
+                    conv.stride        = padded(gathered);
+                    conv.tensor        = tensors && gathered >= MIN_TENSOR_WIDTH;
+                    for (unsigned int layer_no = 0; layer_no < network.size(conv_no); ++layer_no) {
+                        conv.tensor = conv.tensor
+                                      && padded(network.layer(conv_no, layer_no).output_dimensions)
+                                           <= MAX_TENSOR_WIDTH;
+                    }
+
+                    // Upload the weights of the convs that run on the tensor cores
+                    if (conv.tensor) {
+                        int k = conv.stride;
+                        for (unsigned int layer_no = 0; layer_no < network.size(conv_no); ++layer_no) {
+                            conv.layers.push_back(make_tensor_layer(network.layer(conv_no, layer_no), k));
+                            k = conv.layers.back().n;
+                        }
+                        max_tensor_width = std::max({max_tensor_width, conv.stride, conv.layers.front().n});
+                        for (const auto& layer : conv.layers) {
+                            max_tensor_width = std::max(max_tensor_width, layer.n);
+                        }
+                    }
+
+                    max_width        = std::max(max_width, conv.outputs);
+                    input_dimensions = conv.outputs;
+                    convs.push_back(std::move(conv));
+                }
+
+                // Compile the kernels, fast maths is left off so the results match the other engines
+                std::string source =
+                  std::string(operation::get_scalar_defines(Scalar(0.0))) + PROJECT_CU + LOAD_IMAGE_CU;
+                std::vector<std::string> options = {"--gpu-architecture=compute_" + std::to_string(capability),
+                                                    "--std=c++14",
+                                                    "-default-device"};
+                if (max_tensor_width > 0) {
+                    source += DENSE_TENSOR_CU;
+#if defined(VISUALMESH_CUDA_INCLUDE_DIR)
+                    options.push_back(std::string("-I") + VISUALMESH_CUDA_INCLUDE_DIR);
+#endif
+                }
+                source += network_source;
+                module = operation::make_module(context, this->device, source, options, cache_directory);
+
+                // Get the kernels for each projection, both alone and with each kind of image load
+                const std::array<std::string, 3> projections = {{"rectilinear", "equisolid", "equidistant"}};
+                const std::array<std::string, 3> loads       = {
+                  {"_load_bayer_image", "_load_yuv_image", "_load_interpolated_image"}};
+                for (std::size_t p = 0; p < projections.size(); ++p) {
+                    project_kernels[p] = function("project_" + projections[p]);
+                    for (std::size_t l = 0; l < loads.size(); ++l) {
+                        project_load_kernels[p][l] = function("project_" + projections[p] + loads[l]);
+                    }
+                }
+                for (std::size_t conv_no = 0; conv_no < convs.size(); ++conv_no) {
+                    convs[conv_no].kernel = function("conv" + std::to_string(conv_no));
+                }
+                if (max_tensor_width > 0) {
+                    gather_half_kernel  = function("gather_half");
+                    dense_tensor_kernel = function("dense_tensor");
+                    throw_cuda_error(::cuFuncSetAttribute(dense_tensor_kernel,
+                                                          CU_FUNC_ATTRIBUTE_MAX_DYNAMIC_SHARED_SIZE_BYTES,
+                                                          int(tensor_shared_bytes(max_tensor_width))),
+                                     "Error setting the shared memory of the tensor core kernel");
+                }
+            }
+
+        public:
+            /**
+             * @brief Projects a provided mesh to pixel coordinates
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh the mesh table that we are projecting to pixel coordinates
+             * @param Hoc  the homogenous transformation matrix from the camera to the observation plane
+             * @param lens the lens parameters that describe the optics of the camera
+             *
+             * @return a projected mesh for the provided arguments
+             */
+            template <template <typename> class Model>
+            ProjectedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> operator()(const Mesh<Scalar, Model>& mesh,
+                                                                          const mat4<Scalar>& Hoc,
+                                                                          const Lens<Scalar>& lens) const {
+                std::lock_guard<std::mutex> lock(mutex);
+                ScopedContext scope(context);
+                FrameRecorder recorder(instrumentation.get());
+
+                ProjectedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> output;
+                const int n_points = do_project(mesh, Hoc, lens, output.global_indices, output.neighbourhood, recorder);
+                if (n_points == 0) { return output; }
+
+                // Project the points with plain launches, there is too little work to be worth a graph
+                FrameRecorder::Scope upload(recorder, Stage::UPLOAD);
+                const CUdeviceptr points = get_device_points(mesh);
+                throw_cuda_error(
+                  ::cuMemcpyHtoDAsync(buffers.indices, buffers.host_indices, n_points * sizeof(int), stream),
+                  "Error uploading the indices");
+                upload.stop();
+
+                const Projection projection = make_projection(Hoc, lens);
+                CUdeviceptr indices         = buffers.indices;
+                CUdeviceptr pixels          = buffers.pixels;
+                void* args[]                = {const_cast<CUdeviceptr*>(&points),
+                                &indices,
+                                const_cast<Projection*>(&projection),
+                                &pixels,
+                                const_cast<int*>(&n_points)};
+                throw_cuda_error(::cuLaunchKernel(project_kernels[projection_index(lens.projection)],
+                                                  blocks(n_points),
+                                                  1,
+                                                  1,
+                                                  BLOCK_SIZE,
+                                                  1,
+                                                  1,
+                                                  0,
+                                                  stream,
+                                                  args,
+                                                  nullptr),
+                                 "Error launching the projection kernel");
+
+                FrameRecorder::Scope readback(recorder, Stage::READBACK);
+                output.pixel_coordinates.resize(n_points);
+                throw_cuda_error(::cuMemcpyDtoHAsync(
+                                   output.pixel_coordinates.data(), pixels, n_points * sizeof(vec2<Scalar>), stream),
+                                 "Error reading the projected pixels");
+                throw_cuda_error(::cuStreamSynchronize(stream), "Error waiting for the projection to complete");
+                readback.stop();
+                recorder.report();
+
+                return output;
+            }
+
+            /**
+             * @brief Projects a provided mesh to pixel coordinates from an aggregate VisualMesh object
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh the mesh table that we are projecting to pixel coordinates
+             * @param Hoc  the homogenous transformation matrix from the camera to the observation plane
+             * @param lens the lens parameters that describe the optics of the camera
+             *
+             * @return a projected mesh for the provided arguments
+             */
+            template <template <typename> class Model>
+            ProjectedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> operator()(const VisualMesh<Scalar, Model>& mesh,
+                                                                          const mat4<Scalar>& Hoc,
+                                                                          const Lens<Scalar>& lens) const {
+                return operator()(mesh.height(Hoc[2][3]), Hoc, lens);
+            }
+
+            /**
+             * @brief Project and classify a mesh using the neural network that is loaded into this engine
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh    the mesh table that we are projecting to pixel coordinates
+             * @param Hoc     the homogenous transformation matrix from the camera to the observation plane
+             * @param lens    the lens parameters that describe the optics of the camera
+             * @param image   the data that represents the image the network will run from
+             * @param format  the pixel format of this image as a fourcc code
+             *
+             * @return a classified mesh for the provided arguments
+             */
+            template <template <typename> class Model>
+            ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> operator()(const Mesh<Scalar, Model>& mesh,
+                                                                           const mat4<Scalar>& Hoc,
+                                                                           const Lens<Scalar>& lens,
+                                                                           const void* image,
+                                                                           const uint32_t& format) const {
+                ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> output;
+                operator()(mesh, Hoc, lens, image, format, output);
+                return output;
+            }
+
+            /**
+             * @brief Project and classify a mesh into a classified mesh owned by the caller, reusing its memory
+             *
+             * @details
+             *  The first frame for each lens projection and kind of image builds a CUDA graph of the whole frame, and
+             *  later frames update its parameters and launch it again. The output's vectors keep their capacity, so
+             *  passing the same output every frame avoids allocating them again.
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh    the mesh table that we are projecting to pixel coordinates
+             * @param Hoc     the homogenous transformation matrix from the camera to the observation plane
+             * @param lens    the lens parameters that describe the optics of the camera
+             * @param image   the data that represents the image the network will run from
+             * @param format  the pixel format of this image as a fourcc code
+             * @param output  the classified mesh to write the result into
+             */
+            template <template <typename> class Model>
+            void operator()(const Mesh<Scalar, Model>& mesh,
+                            const mat4<Scalar>& Hoc,
+                            const Lens<Scalar>& lens,
+                            const void* image,
+                            const uint32_t& format,
+                            ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS>& output) const {
+                static constexpr int N_NEIGHBOURS = Model<Scalar>::N_NEIGHBOURS;
+
+                std::lock_guard<std::mutex> lock(mutex);
+                ScopedContext scope(context);
+                FrameRecorder recorder(instrumentation.get());
+
+                const int n_points = do_project(mesh, Hoc, lens, output.global_indices, output.neighbourhood, recorder);
+                if (n_points == 0) {
+                    output.pixel_coordinates.clear();
+                    output.classifications.clear();
+                    return;
+                }
+                const int n_rows = n_points + 1;
+
+                // Copy the image into the staging memory that the graph uploads from
+                FrameRecorder::Scope upload(recorder, Stage::UPLOAD);
+                const ImageKind kind    = image_kind(format);
+                const vec2<int> extent  = image_extent(lens.dimensions, format);
+                const int channels      = format == fourcc("RGBA") || format == fourcc("BGRA") ? 4 : 1;
+                const std::size_t width = std::size_t(extent[0]) * channels;
+                get_image_memory(extent, channels, kind == ImageKind::INTERPOLATED);
+                std::memcpy(image_memory.host, image, width * extent[1]);
+                upload.stop();
+
+                // Get the graph for this projection and kind of image, a new image buffer invalidates the old graphs
+                const int p         = projection_index(lens.projection);
+                const int k         = static_cast<int>(kind);
+                auto& graph         = graphs[p * 3 + k];
+                if (!graph) { graph = std::make_unique<operation::Graph>(context); }
+                graph->begin();
+
+                // Arguments for the kernels, the graph copies their values when the nodes are added or updated
+                const CUdeviceptr points    = get_device_points(mesh);
+                CUdeviceptr indices         = buffers.indices;
+                CUdeviceptr neighbourhood   = buffers.neighbourhood;
+                CUdeviceptr pixels          = buffers.pixels;
+                CUdeviceptr texture         = image_memory.texture;
+                const Projection projection = make_projection(Hoc, lens);
+                int points_arg              = n_points;
+                int rows_arg                = n_rows;
+
+                // Upload the indices, the graph and the image
+                const std::size_t c_indices =
+                  graph->copy(copy_to_device(buffers.indices, buffers.host_indices, n_points * sizeof(int)), {});
+                const std::size_t c_neighbourhood = graph->copy(copy_to_device(buffers.neighbourhood,
+                                                                               buffers.host_neighbourhood,
+                                                                               n_rows * N_NEIGHBOURS * sizeof(int)),
+                                                                {});
+                CUDA_MEMCPY3D image_copy{};
+                image_copy.srcMemoryType = CU_MEMORYTYPE_HOST;
+                image_copy.srcHost       = image_memory.host;
+                image_copy.srcPitch      = width;
+                image_copy.dstMemoryType = CU_MEMORYTYPE_DEVICE;
+                image_copy.dstDevice     = image_memory.device;
+                image_copy.dstPitch      = image_memory.pitch;
+                image_copy.WidthInBytes  = width;
+                image_copy.Height        = extent[1];
+                image_copy.Depth         = 1;
+                const std::size_t c_image = graph->copy(image_copy, {});
+
+                // Project the points and read the image into the first buffer of the network
+                CUdeviceptr network[2] = {buffers.network[0], buffers.network[1]};
+                std::array<float, 2> first_red{};
+                std::array<int, 8> layout{};
+                int order = 0;
+                std::vector<void*> args = {const_cast<CUdeviceptr*>(&points),
+                                           &indices,
+                                           const_cast<Projection*>(&projection),
+                                           &pixels,
+                                           &texture};
+                switch (kind) {
+                    case ImageKind::BAYER:
+                        first_red = bayer_first_red<float>(format);
+                        args.push_back(first_red.data());
+                        break;
+                    case ImageKind::YUV:
+                        layout = yuv_layout(format, lens.dimensions);
+                        args.push_back(layout.data());
+                        break;
+                    case ImageKind::INTERPOLATED:
+                        order = format == fourcc("RGBA") ? 0 : format == fourcc("BGRA") ? 1 : 2;
+                        args.push_back(&order);
+                        break;
+                }
+                args.push_back(&network[0]);
+                args.push_back(&points_arg);
+                std::size_t last =
+                  graph->kernel(kernel_params(project_load_kernels[p][k], blocks(n_rows), BLOCK_SIZE, 0, args.data()),
+                                {c_indices, c_image});
+
+                // Run each conv, on the tensor cores or as one thread for each point
+                CUdeviceptr halves[2] = {buffers.half[0], buffers.half[1]};
+                int padded_rows       = padded(n_rows);
+                int neighbours        = int(n_neighbours);
+                for (std::size_t conv_no = 0; conv_no < convs.size(); ++conv_no) {
+                    const Conv& conv = convs[conv_no];
+                    CUdeviceptr& in  = network[conv_no % 2];
+                    CUdeviceptr& out = network[(conv_no + 1) % 2];
+
+                    if (conv.tensor) {
+                        int input_dimensions = conv.input_dimensions;
+                        int stride           = conv.stride;
+                        void* gather[]       = {&neighbourhood,
+                                          &in,
+                                          &halves[0],
+                                          &rows_arg,
+                                          &padded_rows,
+                                          &neighbours,
+                                          &input_dimensions,
+                                          &stride};
+                        last = graph->kernel(
+                          kernel_params(gather_half_kernel, blocks(padded_rows * stride), BLOCK_SIZE, 0, gather),
+                          {last, c_neighbourhood});
+
+                        for (std::size_t layer_no = 0; layer_no < conv.layers.size(); ++layer_no) {
+                            const TensorLayer& layer = conv.layers[layer_no];
+                            const bool final         = layer_no + 1 == conv.layers.size();
+                            CUdeviceptr weights      = layer.weights;
+                            CUdeviceptr biases       = layer.biases;
+                            CUdeviceptr next         = final ? 0 : halves[(layer_no + 1) % 2];
+                            int k_arg                = layer.k;
+                            int n_arg                = layer.n;
+                            int outputs              = layer.outputs;
+                            int activation           = layer.activation;
+                            void* dense[]            = {&halves[layer_no % 2],
+                                             &weights,
+                                             &biases,
+                                             &rows_arg,
+                                             &padded_rows,
+                                             &k_arg,
+                                             &n_arg,
+                                             &outputs,
+                                             &activation,
+                                             &next,
+                                             &out};
+                            last = graph->kernel(kernel_params(dense_tensor_kernel,
+                                                               (padded_rows / TENSOR_TILE + TENSOR_WARPS - 1)
+                                                                 / TENSOR_WARPS,
+                                                               TENSOR_WARPS * 32,
+                                                               tensor_shared_bytes(layer.n),
+                                                               dense),
+                                                 {last});
+                        }
+                    }
+                    else {
+                        void* conv_args[]                    = {&neighbourhood, &in, &out, &rows_arg};
+                        const CUDA_KERNEL_NODE_PARAMS params =
+                          kernel_params(conv.kernel, blocks(n_rows), BLOCK_SIZE, 0, conv_args);
+                        last = graph->kernel(params, {last, c_neighbourhood});
+                    }
+                }
+
+                // Read back the pixels and the classifications
+                const int n_outputs = convs.empty() ? 4 : convs.back().outputs;
+                graph->copy(copy_to_host(buffers.host_pixels, pixels, n_points * sizeof(vec2<Scalar>)), {last});
+                graph->copy(copy_to_host(buffers.host_classifications,
+                                         network[convs.size() % 2],
+                                         n_rows * n_outputs * sizeof(Scalar)),
+                            {last});
+
+                // Launch the frame and wait for it to finish
+                graph->launch(stream);
+                throw_cuda_error(::cuStreamSynchronize(stream), "Error waiting for the network to complete");
+
+                FrameRecorder::Scope readback(recorder, Stage::READBACK);
+                output.pixel_coordinates.resize(n_points);
+                std::memcpy(output.pixel_coordinates.data(), buffers.host_pixels, n_points * sizeof(vec2<Scalar>));
+                output.classifications.resize(n_rows * n_outputs);
+                std::memcpy(
+                  output.classifications.data(), buffers.host_classifications, n_rows * n_outputs * sizeof(Scalar));
+                readback.stop();
+                recorder.report();
+            }
+
+            /**
+             * @brief Project and classify a mesh using the neural network that is loaded into this engine.
+             * This version takes an aggregate VisualMesh object
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh    the mesh table that we are projecting to pixel coordinates
+             * @param Hoc     the homogenous transformation matrix from the camera to the observation plane
+             * @param lens    the lens parameters that describe the optics of the camera
+             * @param image   the data that represents the image the network will run from
+             * @param format  the pixel format of this image as a fourcc code
+             *
+             * @return a classified mesh for the provided arguments
+             */
+            template <template <typename> class Model>
+            ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> operator()(const VisualMesh<Scalar, Model>& mesh,
+                                                                           const mat4<Scalar>& Hoc,
+                                                                           const Lens<Scalar>& lens,
+                                                                           const void* image,
+                                                                           const uint32_t& format) const {
+                return operator()(mesh.height(Hoc[2][3]), Hoc, lens, image, format);
+            }
+
+            /**
+             * @brief Time every frame, reporting it to the given instrumentation
+             *
+             * @details
+             *  The stages on the host are timed, the work on the device is a single graph so it is timed as part of
+             *  the readback.
+             *
+             * @param instrumentation where to report every frame, or nullptr to stop timing
+             */
+            void instrument(std::shared_ptr<Instrumentation> instrumentation) {
+                std::lock_guard<std::mutex> lock(mutex);
+                this->instrumentation = std::move(instrumentation);
+            }
+
+            /// @return where every frame is reported, or nullptr if the engine isn't being timed
+            std::shared_ptr<Instrumentation> instrument() const {
+                std::lock_guard<std::mutex> lock(mutex);
+                return instrumentation;
+            }
+
+            /**
+             * @brief Set how much device memory the meshes kept on the device may use
+             *
+             * @details
+             *  Once the meshes use more than this the least recently used ones are dropped, and are uploaded again if
+             *  they are used later. The mesh used most recently is always kept. By default there is no limit.
+             *
+             * @param bytes the memory budget for the meshes in bytes
+             */
+            void device_budget(const std::size_t& bytes) {
+                std::lock_guard<std::mutex> lock(mutex);
+                device_points_cache.budget(bytes);
+            }
+
+            /// @return how much device memory the meshes kept on the device are using
+            std::size_t device_bytes() const {
+                std::lock_guard<std::mutex> lock(mutex);
+                return device_points_cache.bytes();
+            }
+
+            /**
+             * @brief Upload a mesh to the device ahead of the frame that will use it
+             *
+             * @tparam Model the mesh model of the mesh
+             *
+             * @param mesh the mesh to upload
+             */
+            template <template <typename> class Model>
+            void preload(const Mesh<Scalar, Model>& mesh) const {
+                std::lock_guard<std::mutex> lock(mutex);
+                ScopedContext scope(context);
+                get_device_points(mesh);
+            }
+
+            /**
+             * @brief Drop the device copy of a mesh, such as when a LazyVisualMesh evicts it
+             *
+             * @tparam Model the mesh model of the mesh
+             *
+             * @param mesh the mesh to drop
+             */
+            template <template <typename> class Model>
+            void evict(const Mesh<Scalar, Model>& mesh) const {
+                std::lock_guard<std::mutex> lock(mutex);
+                device_points_cache.erase(mesh.id());
+            }
+
+            void clear_cache() {
+                std::lock_guard<std::mutex> lock(mutex);
+                device_points_cache.clear();
+                graphs.clear();
+                image_memory = ImageMemory{};
+                buffers      = Buffers{};
+            }
+
+        private:
+            /// The number of threads in each block of the kernels that run a thread for each point
+            static constexpr unsigned int BLOCK_SIZE = 128;
+            /// The size of the square tiles the tensor cores multiply, the same as in dense_tensor.cu
+            static constexpr int TENSOR_TILE = 16;
+            /// The number of warps in each block of the tensor core kernel, the same as in dense_tensor.cu
+            static constexpr int TENSOR_WARPS = 4;
+            /// The fewest values a conv must gather for it to be worth running on the tensor cores
+            static constexpr int MIN_TENSOR_WIDTH = 64;
+            /// The widest layer that can run on the tensor cores, limited by the shared memory of a block
+            static constexpr int MAX_TENSOR_WIDTH = 192;
+
+            /// The lens and orientation of the camera as the projection kernels take them
+            struct Projection {
+                /// Rotation from the observation space to camera space, as three rows of three
+                Scalar Rco[9];
+                /// The focal length of the lens measured in pixels
+                Scalar f;
+                /// The offset from the centre of the lens axis to the centre of the image in pixels
+                Scalar centre[2];
+                /// The inverse distortion coefficients to apply the distortion to the image
+                Scalar k[4];
+                /// The dimensions of the input image
+                int dimensions[2];
+            };
+
+            /// The kinds of image load kernels, in the order they are held in project_load_kernels
+            enum class ImageKind { BAYER = 0, YUV = 1, INTERPOLATED = 2 };
+
+            /// A layer of a conv that runs on the tensor cores
+            struct TensorLayer {
+                /// The half precision weights, k by n with zeros in the padding
+                cu::device_memory weights;
+                /// The biases in Scalar precision
+                cu::device_memory biases;
+                /// The number of inputs, padded to whole tiles
+                int k;
+                /// The number of outputs, padded to whole tiles
+                int n;
+                /// The number of outputs
+                int outputs;
+                /// The activation function as the value of the ActivationFunction enum
+                int activation;
+            };
+
+            /// How a conv of the network is run
+            struct Conv {
+                /// The kernel that runs the conv with a thread for each point
+                CUfunction kernel = nullptr;
+                /// If the conv runs on the tensor cores rather than with kernel
+                bool tensor = false;
+                /// The number of values each point has in the input of the conv
+                int input_dimensions = 0;
+                /// The number of values each point has in the output of the conv
+                int outputs = 0;
+                /// The number of values gathered for each point, padded to whole tiles
+                int stride = 0;
+                /// The layers of the conv if it runs on the tensor cores
+                std::vector<TensorLayer> layers;
+            };
+
+            /// The device buffers of a frame, and the page locked host buffers that are copied to and from them
+            struct Buffers {
+                /// The number of points the buffers can hold, the network buffers hold one more for the offscreen point
+                int capacity = 0;
+                /// The number of neighbours of each point the neighbourhood buffers can hold
+                int neighbours = 0;
+                /// The number of rows the half precision buffers can hold
+                int half_capacity = 0;
+                cu::host_memory host_indices_memory;
+                cu::host_memory host_neighbourhood_memory;
+                cu::host_memory host_pixels_memory;
+                cu::host_memory host_classifications_memory;
+                void* host_indices           = nullptr;
+                void* host_neighbourhood     = nullptr;
+                void* host_pixels            = nullptr;
+                void* host_classifications   = nullptr;
+                cu::device_memory indices;
+                cu::device_memory neighbourhood;
+                cu::device_memory pixels;
+                std::array<cu::device_memory, 2> network;
+                std::array<cu::device_memory, 2> half;
+            };
+
+            /// The device image, the page locked host memory it is uploaded from and the texture that reads it
+            struct ImageMemory {
+                cu::host_memory host_memory;
+                void* host = nullptr;
+                cu::device_memory device;
+                std::size_t pitch = 0;
+                cu::texture texture;
+                vec2<int> extent = {{0, 0}};
+                int channels     = 0;
+                bool linear      = false;
+            };
+
+            /**
+             * @brief Get a kernel from the compiled program
+             *
+             * @param name the name of the kernel
+             *
+             * @return the kernel
+             */
+            CUfunction function(const std::string& name) const {
+                CUfunction f = nullptr;
+                throw_cuda_error(::cuModuleGetFunction(&f, module, name.c_str()), "Error getting the kernel " + name);
+                return f;
+            }
+
+            /// @return the precision of a network of floating point weights, which can't run at INT8
+            static Precision floating(const Precision& precision) {
+                if (precision == Precision::INT8) {
+                    throw std::invalid_argument("An INT8 CUDA engine must be made from a QuantisedNetwork");
+                }
+                return precision;
+            }
+
+            /// @return the value rounded up to whole tensor core tiles
+            static int padded(const int& value) {
+                return (value + TENSOR_TILE - 1) / TENSOR_TILE * TENSOR_TILE;
+            }
+
+            /// @return the number of blocks that cover the given number of threads
+            static unsigned int blocks(const int& threads) {
+                return (unsigned int) ((threads + BLOCK_SIZE - 1) / BLOCK_SIZE);
+            }
+
+            /// @return the dynamic shared memory the tensor core kernel needs for a layer with n padded outputs
+            static unsigned int tensor_shared_bytes(const int& n) {
+                return (unsigned int) (TENSOR_WARPS * TENSOR_TILE * n * sizeof(float));
+            }
+
+            /**
+             * @brief Convert a float to the bits of the nearest IEEE half precision value, rounding ties to even
+             *
+             * @param value the value to convert
+             *
+             * @return the bits of the half precision value
+             */
+            static uint16_t to_half(const float& value) {
+                uint32_t bits = 0;
+                std::memcpy(&bits, &value, sizeof(bits));
+                const uint32_t sign     = (bits >> 16) & 0x8000;
+                const int32_t exponent  = int32_t((bits >> 23) & 0xFF) - 127 + 15;
+                uint32_t mantissa       = bits & 0x7FFFFF;
+
+                // Infinities and NaNs, keeping NaNs quiet
+                if (((bits >> 23) & 0xFF) == 0xFF) { return uint16_t(sign | 0x7C00 | (mantissa != 0 ? 0x200 : 0)); }
+                // Too large for a half so it becomes infinite
+                if (exponent >= 31) { return uint16_t(sign | 0x7C00); }
+                // Too small for a normal half, so it becomes subnormal or zero
+                if (exponent <= 0) {
+                    if (exponent < -10) { return uint16_t(sign); }
+                    mantissa |= 0x800000;
+                    const uint32_t shift   = uint32_t(14 - exponent);
+                    const uint32_t half    = mantissa >> shift;
+                    const uint32_t rest    = mantissa & ((1u << shift) - 1);
+                    const uint32_t halfway = 1u << (shift - 1);
+                    return uint16_t(sign | (half + (rest > halfway || (rest == halfway && (half & 1)) ? 1 : 0)));
+                }
+                // A carry out of the mantissa when rounding correctly moves on to the next exponent
+                const uint32_t half = (uint32_t(exponent) << 10) | (mantissa >> 13);
+                const uint32_t rest = mantissa & 0x1FFF;
+                return uint16_t(sign | (half + (rest > 0x1000 || (rest == 0x1000 && (half & 1)) ? 1 : 0)));
+            }
+
+            /**
+             * @brief Upload the weights and biases of a layer for the tensor core kernel
+             *
+             * @tparam Layer the type of the layer of the network
+             *
+             * @param layer the layer to upload
+             * @param k     the number of inputs the layer is given, padded to whole tiles
+             *
+             * @return the uploaded layer
+             */
+            template <typename Layer>
+            TensorLayer make_tensor_layer(const Layer& layer, const int& k) const {
+                TensorLayer t;
+                t.k          = k;
+                t.n          = padded(layer.output_dimensions);
+                t.outputs    = layer.output_dimensions;
+                t.activation = static_cast<int>(layer.activation);
+
+                std::vector<uint16_t> weights(std::size_t(t.k) * t.n, 0);
+                for (int i = 0; i < layer.input_dimensions; ++i) {
+                    for (int j = 0; j < layer.output_dimensions; ++j) {
+                        weights[i * t.n + j] = to_half(float(layer.weight(i, j)));
+                    }
+                }
+                std::vector<Scalar> biases(layer.output_dimensions);
+                for (int j = 0; j < layer.output_dimensions; ++j) {
+                    biases[j] = layer.bias(j);
+                }
+
+                t.weights = operation::create_buffer(context, weights.size() * sizeof(uint16_t));
+                throw_cuda_error(::cuMemcpyHtoD(t.weights, weights.data(), weights.size() * sizeof(uint16_t)),
+                                 "Error uploading the weights of a tensor core layer");
+                t.biases = operation::create_buffer(context, biases.size() * sizeof(Scalar));
+                throw_cuda_error(::cuMemcpyHtoD(t.biases, biases.data(), biases.size() * sizeof(Scalar)),
+                                 "Error uploading the biases of a tensor core layer");
+                return t;
+            }
+
+            /// Quantised networks run at INT8 so they never run on the tensor cores
+            TensorLayer make_tensor_layer(const QuantisedLayer<Scalar>& /*layer*/, const int& /*k*/) const {
+                throw std::logic_error("A quantised network can't run on the tensor cores");
+            }
+
+            /// @return the parameters for a kernel node of the graph
+            static CUDA_KERNEL_NODE_PARAMS kernel_params(CUfunction kernel,
+                                                         const unsigned int& grid,
+                                                         const unsigned int& block,
+                                                         const unsigned int& shared,
+                                                         void** args) {
+                CUDA_KERNEL_NODE_PARAMS params{};
+                params.func           = kernel;
+                params.gridDimX       = grid;
+                params.gridDimY       = 1;
+                params.gridDimZ       = 1;
+                params.blockDimX      = block;
+                params.blockDimY      = 1;
+                params.blockDimZ      = 1;
+                params.sharedMemBytes = shared;
+                params.kernelParams   = args;
+                return params;
+            }
+
+            /// @return the parameters for a graph node copying bytes from page locked host memory to the device
+            static CUDA_MEMCPY3D copy_to_device(const CUdeviceptr& device, const void* host, const std::size_t& bytes) {
+                CUDA_MEMCPY3D params{};
+                params.srcMemoryType = CU_MEMORYTYPE_HOST;
+                params.srcHost       = host;
+                params.dstMemoryType = CU_MEMORYTYPE_DEVICE;
+                params.dstDevice     = device;
+                params.WidthInBytes  = bytes;
+                params.Height        = 1;
+                params.Depth         = 1;
+                return params;
+            }
+
+            /// @return the parameters for a graph node copying bytes from the device to page locked host memory
+            static CUDA_MEMCPY3D copy_to_host(void* host, const CUdeviceptr& device, const std::size_t& bytes) {
+                CUDA_MEMCPY3D params{};
+                params.srcMemoryType = CU_MEMORYTYPE_DEVICE;
+                params.srcDevice     = device;
+                params.dstMemoryType = CU_MEMORYTYPE_HOST;
+                params.dstHost       = host;
+                params.WidthInBytes  = bytes;
+                params.Height        = 1;
+                params.Depth         = 1;
+                return params;
+            }
+
+            /// @return the lens and orientation of the camera as the projection kernels take them
+            static Projection make_projection(const mat4<Scalar>& Hoc, const Lens<Scalar>& lens) {
+                Projection p{};
+                for (int i = 0; i < 3; ++i) {
+                    for (int j = 0; j < 3; ++j) {
+                        p.Rco[i * 3 + j] = Hoc[j][i];
+                    }
+                }
+                p.f                   = lens.focal_length;
+                p.centre[0]           = lens.centre[0];
+                p.centre[1]           = lens.centre[1];
+                const vec4<Scalar> ik = inverse_coefficients(lens.k);
+                std::copy(ik.begin(), ik.end(), p.k);
+                p.dimensions[0] = lens.dimensions[0];
+                p.dimensions[1] = lens.dimensions[1];
+                return p;
+            }
+
+            /// @return the index of the kernels for a lens projection
+            static int projection_index(const LensProjection& projection) {
+                switch (projection) {
+                    case RECTILINEAR: return 0;
+                    case EQUISOLID: return 1;
+                    case EQUIDISTANT: return 2;
+                    default: throw std::runtime_error("Requested lens projection is not currently supported.");
+                }
+            }
+
+            /**
+             * @brief Find the points of the mesh that are on the screen and build their neighbourhood graph, leaving
+             * the indices and graph in the page locked buffers to be uploaded. Must be called with the mutex held.
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh          the mesh table that we are projecting to pixel coordinates
+             * @param Hoc           the homogenous transformation matrix from the camera to the observation plane
+             * @param lens          the lens parameters that describe the optics of the camera
+             * @param indices       filled with the global indices of the points on the screen
+             * @param neighbourhood filled with the neighbourhood graph with the offscreen point at the end
+             * @param recorder      the recorder of the frame
+             *
+             * @return the number of points on the screen
+             */
+            template <template <typename> class Model>
+            int do_project(const Mesh<Scalar, Model>& mesh,
+                           const mat4<Scalar>& Hoc,
+                           const Lens<Scalar>& lens,
+                           std::vector<int>& indices,
+                           std::vector<std::array<int, Model<Scalar>::N_NEIGHBOURS>>& neighbourhood,
+                           FrameRecorder& recorder) const {
+                static constexpr int N_NEIGHBOURS = Model<Scalar>::N_NEIGHBOURS;
+
+                // Lookup the on screen ranges
+                FrameRecorder::Scope lookup(recorder, Stage::LOOKUP);
+                mesh.lookup(Hoc, lens, ranges);
+                lookup.stop();
+
+                int points = 0;
+                for (const auto& range : ranges) {
+                    points += range.second - range.first;
+                }
+                if (points == 0) {
+                    indices.clear();
+                    neighbourhood.clear();
+                    return 0;
+                }
+
+                // Build the list of indices and the packed neighbourhood map with the offscreen point at the end
+                FrameRecorder::Scope graph(recorder, Stage::PROJECT);
+                indices.resize(points);
+                auto it = indices.begin();
+                for (const auto& range : ranges) {
+                    auto n = std::next(it, range.second - range.first);
+                    std::iota(it, n, range.first);
+                    it = n;
+                }
+
+                const RangeLookup remap(ranges);
+                neighbourhood.resize(points + 1);
+                for (int i = 0; i < points; ++i) {
+                    const auto& node = mesh.nodes[indices[i]];
+                    for (int j = 0; j < N_NEIGHBOURS; ++j) {
+                        neighbourhood[i][j] = remap(node.neighbours[j]);
+                    }
+                }
+                neighbourhood[points].fill(points);
+                graph.stop();
+
+                // Stage them to be uploaded
+                get_buffers(points, N_NEIGHBOURS);
+                std::memcpy(buffers.host_indices, indices.data(), points * sizeof(int));
+                std::memcpy(
+                  buffers.host_neighbourhood, neighbourhood.data(), (points + 1) * N_NEIGHBOURS * sizeof(int));
+
+                return points;
+            }
+
+            /**
+             * @brief Make sure the buffers of a frame can hold the given number of points, growing them if they can't.
+             * Must be called with the mutex held.
+             *
+             * @param n_points     the number of points on the screen
+             * @param n_neighbours the number of neighbours of each point in the mesh
+             */
+            void get_buffers(const int& n_points, const int& n_neighbours) const {
+                if (n_points > buffers.capacity || n_neighbours > buffers.neighbours) {
+                    const int capacity = grow_capacity(buffers.capacity, n_points);
+                    const int rows     = capacity + 1;
+                    const int pixels   = capacity * sizeof(vec2<Scalar>);
+
+                    // The neighbourhood is sized for the mesh with the most neighbours so meshes can share the buffer
+                    const int neighbours                  = std::max(n_neighbours, buffers.neighbours);
+                    const std::size_t neighbourhood_bytes = std::size_t(rows) * neighbours * sizeof(int);
+                    const std::size_t network_bytes       = std::size_t(rows) * max_width * sizeof(Scalar);
+
+                    Buffers b;
+                    b.capacity                    = capacity;
+                    b.neighbours                  = neighbours;
+                    b.half_capacity               = buffers.half_capacity;
+                    b.half                        = buffers.half;
+                    b.host_indices_memory         = operation::create_host_buffer(context, capacity * sizeof(int));
+                    b.host_neighbourhood_memory   = operation::create_host_buffer(context, neighbourhood_bytes);
+                    b.host_pixels_memory          = operation::create_host_buffer(context, pixels);
+                    b.host_classifications_memory = operation::create_host_buffer(context, network_bytes);
+                    b.host_indices                = b.host_indices_memory;
+                    b.host_neighbourhood          = b.host_neighbourhood_memory;
+                    b.host_pixels                 = b.host_pixels_memory;
+                    b.host_classifications        = b.host_classifications_memory;
+                    b.indices                     = operation::create_buffer(context, capacity * sizeof(int));
+                    b.neighbourhood               = operation::create_buffer(context, neighbourhood_bytes);
+                    b.pixels                      = operation::create_buffer(context, pixels);
+                    for (auto& n : b.network) {
+                        n = operation::create_buffer(context, network_bytes);
+                    }
+                    buffers = std::move(b);
+                }
+
+                // The half precision buffers hold whole tiles of rows
+                if (max_tensor_width > 0 && padded(n_points + 1) > buffers.half_capacity) {
+                    buffers.half_capacity = padded(grow_capacity(buffers.half_capacity, n_points + 1));
+                    for (auto& h : buffers.half) {
+                        h = operation::create_buffer(context,
+                                                     std::size_t(buffers.half_capacity) * max_tensor_width * 2);
+                    }
+                }
+            }
+
+            /**
+             * @brief Make sure the device image and its texture match the image of this frame, making new ones if they
+             * don't. Must be called with the mutex held.
+             *
+             * @details
+             *  The graphs copy the image with a copy of several rows, which the driver can't update, so they are made
+             *  again when the image memory changes.
+             *
+             * @param extent   the width and height of the image in texels
+             * @param channels the number of 8 bit channels in each texel
+             * @param linear   if the texture interpolates between texels
+             */
+            void get_image_memory(const vec2<int>& extent, const int& channels, const bool& linear) const {
+                if (image_memory.host != nullptr && image_memory.extent == extent && image_memory.channels == channels
+                    && image_memory.linear == linear) {
+                    return;
+                }
+
+                const std::size_t width = std::size_t(extent[0]) * channels;
+                ImageMemory m;
+                m.host_memory = operation::create_host_buffer(context, width * extent[1]);
+                m.host        = m.host_memory;
+                std::tie(m.device, m.pitch) = operation::create_image_buffer(context, width, extent[1]);
+                m.texture =
+                  operation::create_texture(context, m.device, m.pitch, extent[0], extent[1], channels, linear);
+                m.extent   = extent;
+                m.channels = channels;
+                m.linear   = linear;
+
+                image_memory = std::move(m);
+                graphs.clear();
+            }
+
+            /**
+             * @brief Get the unit vectors of a mesh on the device, uploading them if they aren't there. Must be called
+             * with the mutex held.
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh the mesh whose unit vectors we need
+             *
+             * @return the device memory holding the unit vectors of the mesh
+             */
+            template <template <typename> class Model>
+            CUdeviceptr get_device_points(const Mesh<Scalar, Model>& mesh) const {
+                if (const auto* cached = device_points_cache.find(mesh.id())) { return *cached; }
+
+                std::vector<vec4<Scalar>> rays;
+                rays.reserve(mesh.nodes.size());
+                for (const auto& n : mesh.nodes) {
+                    rays.push_back(vec4<Scalar>{Scalar(n.ray[0]), Scalar(n.ray[1]), Scalar(n.ray[2]), Scalar(0)});
+                }
+
+                const std::size_t bytes        = sizeof(vec4<Scalar>) * rays.size();
+                cu::device_memory device_points = operation::create_buffer(context, bytes);
+                throw_cuda_error(::cuMemcpyHtoD(device_points, rays.data(), bytes),
+                                 "Error uploading the visual mesh points");
+
+                // Cache for future runs
+                device_points_cache[mesh.id()] = device_points;
+                device_points_cache.allocated(mesh.id(), bytes);
+                return device_points;
+            }
+
+            /// @return the kind of image load kernel that reads a format
+            static ImageKind image_kind(const uint32_t& format) {
+                switch (format) {
+                    case fourcc("GRBG"):
+                    case fourcc("RGGB"):
+                    case fourcc("GBRG"):
+                    case fourcc("BGGR"): return ImageKind::BAYER;
+                    case fourcc("NV12"):
+                    case fourcc("YUYV"):
+                    case fourcc("YUY2"):
+                    case fourcc("UYVY"): return ImageKind::YUV;
+                    case fourcc("GRAY"):
+                    case fourcc("GREY"):
+                    case fourcc("Y8  "):
+                    case fourcc("BGRA"):
+                    case fourcc("RGBA"): return ImageKind::INTERPOLATED;
+                    // Oh no...
+                    default: throw std::runtime_error("Unsupported image format " + fourcc_text(format));
+                }
+            }
+
+            /// The CUDA context the engine runs in
+            cu::context context;
+            /// The device the engine runs on
+            CUdevice device = 0;
+            /// The stream the frames are launched on
+            cu::stream stream;
+            /// The compiled kernels
+            cu::module module;
+
+            /// The kernels that only project, for each lens projection
+            std::array<CUfunction, 3> project_kernels{};
+            /// The kernels that project and load the image, for each lens projection and kind of image
+            std::array<std::array<CUfunction, 3>, 3> project_load_kernels{};
+            /// The kernel that gathers the neighbourhood for the tensor cores
+            CUfunction gather_half_kernel = nullptr;
+            /// The kernel that multiplies a layer on the tensor cores
+            CUfunction dense_tensor_kernel = nullptr;
+
+            /// How each conv of the network is run
+            std::vector<Conv> convs;
+            /// The number of neighbours each point has in the network
+            unsigned int n_neighbours = 0;
+            /// The most values any point has between two convs
+            int max_width;
+            /// The most columns of any half precision matrix, or 0 if no conv runs on the tensor cores
+            int max_tensor_width = 0;
+
+            /// A mutex to protect the device state from multiple threads
+            mutable std::mutex mutex;
+            /// The device copies of the meshes, keyed by the identifier of each mesh
+            mutable ResidencyCache<cu::device_memory> device_points_cache;
+            /// The buffers of a frame, grown as needed
+            mutable Buffers buffers;
+            /// The image of a frame, made again when the image changes size or format
+            mutable ImageMemory image_memory;
+            /// The graph for each lens projection and kind of image
+            mutable std::map<int, std::unique_ptr<operation::Graph>> graphs;
+            /// The on screen ranges of the mesh, kept to reuse their memory
+            mutable std::vector<std::pair<int, int>> ranges;
+            /// Where the time spent in each stage of a frame is reported, or nullptr if the engine isn't being timed
+            std::shared_ptr<Instrumentation> instrumentation;
+        };
+
+    }  // namespace cuda
+}  // namespace engine
+}  // namespace visualmesh
+
+#endif  // !defined(VISUALMESH_DISABLE_CUDA)
+#endif  // VISUALMESH_ENGINE_CUDA_ENGINE_HPP
@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <cuda_fp16.h>
+#include <mma.h>
+
+/// The size of the square tiles the tensor cores multiply
+#define TENSOR_TILE 16
+/// The number of warps in a block, each of which computes a tile of rows
+#define TENSOR_WARPS 4
+/// The selu constants
+#define SELU_LAMBDA 1.0507009873554804934193349852946f
+#define SELU_ALPHA 1.6732632423543772848170429916717f
+
+/**
+ * @brief Gathers the neighbourhood of each point into a row of a half precision matrix for the tensor cores
+ *
+ * @details
+ *  Each thread writes one element of the matrix. The matrix has a whole number of tiles of rows and columns, the
+ *  padding is filled with zeros so it doesn't add anything to the multiplication.
+ *
+ * @param neighbourhood    the neighbourhood graph of the points
+ * @param input            the output of the previous conv, or the image for the first conv
+ * @param out              the gathered matrix
+ * @param n_rows           the number of points including the offscreen point
+ * @param n_padded_rows    the number of rows in the gathered matrix
+ * @param n_neighbours     the number of neighbours each point has
+ * @param input_dimensions the number of values each point has in the input
+ * @param stride           the number of columns in the gathered matrix
+ */
+extern "C" __global__ void gather_half(const int* neighbourhood,
+                                       const Scalar* input,
+                                       __half* out,
+                                       const int n_rows,
+                                       const int n_padded_rows,
+                                       const int n_neighbours,
+                                       const int input_dimensions,
+                                       const int stride) {
+    const int index = blockIdx.x * blockDim.x + threadIdx.x;
+    if (index >= n_padded_rows * stride) { return; }
+
+    const int row = index / stride;
+    const int col = index % stride;
+
+    float value = 0.0f;
+    if (row < n_rows && col < input_dimensions * (n_neighbours + 1)) {
+        const int n      = col / input_dimensions;
+        const int source = n == 0 ? row : neighbourhood[row * n_neighbours + n - 1];
+        value            = float(input[source * input_dimensions + col % input_dimensions]);
+    }
+    out[index] = __float2half(value);
+}
+
+/**
+ * @brief Multiplies a half precision matrix by the weights of a layer on the tensor cores and applies the bias and
+ * activation function
+ *
+ * @details
+ *  Each warp multiplies a tile of rows against every column of the weights and accumulates in single precision into
+ *  shared memory, which needs TENSOR_WARPS * TENSOR_TILE * n floats of dynamic shared memory. Each row is then finished
+ *  by its own thread as softmax needs the whole row. A layer that feeds another layer in the same conv writes half
+ *  precision values into next for it to multiply, the last layer of a conv writes its outputs in Scalar to output.
+ *
+ * @param input         the input matrix, n_padded_rows by k
+ * @param weights       the weights of the layer, k by n with zeros in the padding
+ * @param biases        the biases of the layer
+ * @param n_rows        the number of points including the offscreen point
+ * @param n_padded_rows the number of rows in the input matrix
+ * @param k             the number of columns in the input, a multiple of TENSOR_TILE
+ * @param n             the number of columns in the weights, a multiple of TENSOR_TILE
+ * @param outputs       the number of outputs of the layer
+ * @param activation    the activation function as the value of the ActivationFunction enum
+ * @param next          the input matrix of the next layer, or null if this is the last layer of the conv
+ * @param output        the output of the conv if this is its last layer
+ */
+extern "C" __global__ void dense_tensor(const __half* input,
+                                        const __half* weights,
+                                        const Scalar* biases,
+                                        const int n_rows,
+                                        const int n_padded_rows,
+                                        const int k,
+                                        const int n,
+                                        const int outputs,
+                                        const int activation,
+                                        __half* next,
+                                        Scalar* output) {
+    using namespace nvcuda;
+
+    extern __shared__ float accumulated[];
+
+    const int warp = threadIdx.x / 32;
+    const int lane = threadIdx.x % 32;
+    const int row0 = (blockIdx.x * TENSOR_WARPS + warp) * TENSOR_TILE;
+    if (row0 >= n_padded_rows) { return; }
+
+    float* tile = accumulated + warp * TENSOR_TILE * n;
+    for (int c = 0; c < n; c += TENSOR_TILE) {
+        wmma::fragment<wmma::accumulator, TENSOR_TILE, TENSOR_TILE, TENSOR_TILE, float> sum;
+        wmma::fill_fragment(sum, 0.0f);
+        for (int i = 0; i < k; i += TENSOR_TILE) {
+            wmma::fragment<wmma::matrix_a, TENSOR_TILE, TENSOR_TILE, TENSOR_TILE, __half, wmma::row_major> a;
+            wmma::fragment<wmma::matrix_b, TENSOR_TILE, TENSOR_TILE, TENSOR_TILE, __half, wmma::row_major> b;
+            wmma::load_matrix_sync(a, input + row0 * k + i, k);
+            wmma::load_matrix_sync(b, weights + i * n + c, n);
+            wmma::mma_sync(sum, a, b, sum);
+        }
+        wmma::store_matrix_sync(tile + c, sum, n, wmma::mem_row_major);
+    }
+    __syncwarp();
+
+    if (lane < TENSOR_TILE) {
+        const int row = row0 + lane;
+        float* v      = tile + lane * n;
+
+        // Bias and activation, matching the values of the ActivationFunction enum
+        float exp_sum = 0.0f;
+        for (int j = 0; j < outputs; ++j) {
+            float e = v[j] + float(biases[j]);
+            switch (activation) {
+                case 0: e = SELU_LAMBDA * (e > 0.0f ? e : SELU_ALPHA * expf(e) - SELU_ALPHA); break;
+                case 1: e = e > 0.0f ? e : 0.0f; break;
+                case 2: e = expf(e); exp_sum += e; break;
+                case 3: e = tanhf(e); break;
+            }
+            v[j] = e;
+        }
+        if (activation == 2) {
+            for (int j = 0; j < outputs; ++j) { v[j] /= exp_sum; }
+        }
+
+        if (next != nullptr) {
+            for (int j = 0; j < n; ++j) { next[row * n + j] = __float2half(j < outputs ? v[j] : 0.0f); }
+        }
+        else if (row < n_rows) {
+            for (int j = 0; j < outputs; ++j) { output[row * outputs + j] = Scalar(v[j]); }
+        }
+    }
+}
+
+#undef SELU_ALPHA
+#undef SELU_LAMBDA
+#undef TENSOR_WARPS
+#undef TENSOR_TILE
@@ -0,0 +1,282 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * The layout of a YUV image, held as a single channel texture of its bytes
+ */
+struct YuvLayout {
+    /// The number of luma bytes for each pixel
+    int luma_step;
+    /// The offset of the first luma byte in a row
+    int luma_offset;
+    /// The number of chroma bytes for each pair of pixels
+    int chroma_step;
+    /// The offset of the U byte in each chroma pair
+    int u_offset;
+    /// The offset of the V byte in each chroma pair
+    int v_offset;
+    /// The number of rows that share chroma as a shift
+    int chroma_shift;
+    /// The width of the image in pixels
+    int width;
+    /// The height of the image in pixels
+    int height;
+};
+
+/**
+ * @brief Given an image, fetches the nearest value for use with debayering
+ *
+ * @param image the raw bayer image as a single channel texture that reads the nearest pixel
+ * @param x     the x coordinate to read from
+ * @param y     the y coordinate to read from
+ *
+ * @return the value of the pixel at the given coordinates, or zero outside the image
+ */
+__device__ inline float fetch(const cudaTextureObject_t image, const float x, const float y) {
+    return tex2D<float>(image, x, y);
+}
+
+/**
+ * @brief Converts a single pixel from a bayer pattern to RGB and returns it
+ *
+ * @details
+ *  Code adapted from http://graphics.cs.williams.edu/papers/BayerJGT09/ in the same way as the OpenCL engine, with the
+ *  vector swizzles written out for each channel.
+ *
+ * @param image     the raw bayer image as a single channel texture that reads the nearest pixel
+ * @param coord     the coordinate to read from
+ * @param first_red the coordinate for the first red pixel in the bayer pattern
+ *
+ * @return the RGB pixel at the given location in the bayer image
+ */
+__device__ float4 bayer_pixel(const cudaTextureObject_t image, const float2 coord, const float2 first_red) {
+    const float x = coord.x;
+    const float y = coord.y;
+
+    const float C = fetch(image, x, y);  // ( 0, 0)
+
+    // Determine which of four types of pixels we are on
+    const float alternate_x = fmodf(floorf(x + first_red.x), 2.0f);
+    const float alternate_y = fmodf(floorf(y + first_red.y), 2.0f);
+
+    // The sum of the four diagonal neighbours
+    const float D = fetch(image, x - 1.0f, y - 1.0f)    // (-1,-1)
+                    + fetch(image, x - 1.0f, y + 1.0f)  // (-1, 1)
+                    + fetch(image, x + 1.0f, y - 1.0f)  // ( 1,-1)
+                    + fetch(image, x + 1.0f, y + 1.0f); // ( 1, 1)
+
+    // The sums of the pairs of neighbours either side of the pixel
+    const float A = fetch(image, x, y - 2.0f) + fetch(image, x, y + 2.0f);  // ( 0,-2) + ( 0, 2)
+    const float B = fetch(image, x, y - 1.0f) + fetch(image, x, y + 1.0f);  // ( 0,-1) + ( 0, 1)
+    const float E = fetch(image, x - 2.0f, y) + fetch(image, x + 2.0f, y);  // (-2, 0) + ( 2, 0)
+    const float F = fetch(image, x - 1.0f, y) + fetch(image, x + 1.0f, y);  // (-1, 0) + ( 1, 0)
+
+    // There are five filter patterns (identity, cross, checker, theta, phi), the terms for all of them are computed
+    // and then assigned to colour channels
+    //   x       cross   (e.g., EE G)
+    //   y       checker (e.g., EE B)
+    //   z       theta   (e.g., EO R)
+    //   w       phi     (e.g., EO R)
+    const float px = 0.5f * C - 0.125f * A - 0.125f * E + 0.25f * B + 0.25f * F;
+    const float py = 0.75f * C + 0.25f * D - 0.1875f * A - 0.1875f * E;
+    const float pz = 0.625f * C - 0.125f * D + 0.0625f * A - 0.125f * E + 0.5f * F;
+    const float pw = 0.625f * C - 0.125f * D - 0.125f * A + 0.0625f * E + 0.5f * B;
+
+    if (alternate_y == 0.0f) {
+        if (alternate_x == 0.0f) { return float4{C, px, py, 1.0f}; }
+        return float4{pz, C, pw, 1.0f};
+    }
+    if (alternate_x == 0.0f) { return float4{pw, C, pz, 1.0f}; }
+    return float4{py, px, C, 1.0f};
+}
+
+/**
+ * @brief Reads a single pixel from a YUV image and converts it to RGB
+ *
+ * @details
+ *  The conversion uses the BT.601 limited range coefficients, the same as the other engines.
+ *
+ * @param image  the bytes of the YUV image as a single channel texture that reads the nearest pixel
+ * @param layout the layout of the YUV image
+ * @param px     the column of the pixel to read, which must be inside the image
+ * @param py     the row of the pixel to read, which must be inside the image
+ *
+ * @return the RGB pixel at the given location in the YUV image
+ */
+__device__ float4 yuv_pixel(const cudaTextureObject_t image, const YuvLayout layout, const int px, const int py) {
+    // With chroma on every other row (NV12) the chroma plane starts after the luma plane
+    const int cx = layout.chroma_step * (px >> 1);
+    const int cy = (py >> layout.chroma_shift) + layout.chroma_shift * layout.height;
+
+    const float y = fetch(image, float(layout.luma_step * px + layout.luma_offset) + 0.5f, float(py) + 0.5f);
+    const float u = fetch(image, float(cx + layout.u_offset) + 0.5f, float(cy) + 0.5f) - 0.5019608f;
+    const float v = fetch(image, float(cx + layout.v_offset) + 0.5f, float(cy) + 0.5f) - 0.5019608f;
+    const float l = 1.164f * (y - 0.0627451f);
+
+    return float4{
+      __saturatef(l + 1.596f * v), __saturatef(l - 0.813f * v - 0.391f * u), __saturatef(l + 2.018f * u), 1.0f};
+}
+
+/**
+ * @brief Bilinearly interpolates the four YUV pixels around a coordinate, converting each of them to RGB
+ *
+ * @details
+ *  A texture can't filter an image whose pixels aren't stored together, so the four taps are read and mixed here.
+ *  Pixel centres are on whole coordinates to match the CPU engine.
+ *
+ * @param image  the bytes of the YUV image as a single channel texture that reads the nearest pixel
+ * @param layout the layout of the YUV image
+ * @param coord  the coordinate to read from
+ *
+ * @return the RGB pixel at the given location in the YUV image
+ */
+__device__ float4 yuv_interpolate(const cudaTextureObject_t image, const YuvLayout layout, const float2 coord) {
+    const float fx = floorf(coord.x);
+    const float fy = floorf(coord.y);
+    const int x1   = min(max(int(fx), 0), layout.width - 1);
+    const int y1   = min(max(int(fy), 0), layout.height - 1);
+    const int x2   = min(x1 + 1, layout.width - 1);
+    const int y2   = min(y1 + 1, layout.height - 1);
+    const float tx = __saturatef(coord.x - fx);
+    const float ty = __saturatef(coord.y - fy);
+
+    const float4 a = yuv_pixel(image, layout, x1, y1);
+    const float4 b = yuv_pixel(image, layout, x2, y1);
+    const float4 c = yuv_pixel(image, layout, x1, y2);
+    const float4 d = yuv_pixel(image, layout, x2, y2);
+
+    const float top_x    = a.x + (b.x - a.x) * tx;
+    const float top_y    = a.y + (b.y - a.y) * tx;
+    const float top_z    = a.z + (b.z - a.z) * tx;
+    const float bottom_x = c.x + (d.x - c.x) * tx;
+    const float bottom_y = c.y + (d.y - c.y) * tx;
+    const float bottom_z = c.z + (d.z - c.z) * tx;
+    return float4{
+      top_x + (bottom_x - top_x) * ty, top_y + (bottom_y - top_y) * ty, top_z + (bottom_z - top_z) * ty, 1.0f};
+}
+
+/**
+ * @brief Reads a pixel from an image that the texture interpolates itself
+ *
+ * @param image the image, as a four channel texture for colour images and a single channel texture for grey ones
+ * @param coord the coordinate to read from
+ * @param order 0 if the image is RGBA, 1 if it is BGRA and 2 if it is grey
+ *
+ * @return the RGB pixel at the given location in the image
+ */
+__device__ float4 interpolated_pixel(const cudaTextureObject_t image, const float2 coord, const int order) {
+    if (order == 2) {
+        const float l = tex2D<float>(image, coord.x, coord.y);
+        return float4{l, l, l, 1.0f};
+    }
+    const float4 p = tex2D<float4>(image, coord.x, coord.y);
+    return order == 1 ? float4{p.z, p.y, p.x, p.w} : p;
+}
+
+/**
+ * @brief Writes a pixel into the input of the network
+ *
+ * @param network the memory storage for the first layer of the network
+ * @param index   the index of the point
+ * @param pixel   the value of the pixel
+ */
+__device__ inline void store_input(Scalar4* network, const int index, const float4 pixel) {
+    network[index] = Scalar4{Scalar(pixel.x), Scalar(pixel.y), Scalar(pixel.z), Scalar(pixel.w)};
+}
+
+/**
+ * Makes the kernels that project visual mesh points and read the image at them into the network input in one pass,
+ * one each for bayer images, YUV images and images the texture can interpolate itself. This saves launching the image
+ * load separately and reading the pixel coordinates back out of global memory.
+ *
+ * The grid covers one more point than is on the screen, that point is the offscreen point that every neighbour off the
+ * screen refers to and it gets a value of -1 to make it easy to distinguish.
+ *
+ * @param points     VisualMesh unit vectors as 4d vectors [x, y, z, 0]
+ * @param indices    map from local indices to global indices
+ * @param p          the lens and orientation of the camera
+ * @param out        the output image coordinates, which are still needed for the results
+ * @param image      the texture to read the image from
+ * @param first_red  the coordinate of the first red pixel in the bayer pattern
+ * @param layout     the layout of a YUV image
+ * @param order      the channel order of an image the texture interpolates
+ * @param network    the memory storage for the first layer of the network
+ * @param n_points   the number of points on the screen
+ */
+#define PROJECT_LOAD_IMAGE(projection)                                                                                 \
+    extern "C" __global__ void project_##projection##_load_bayer_image(const Scalar4* points,                          \
+                                                                       const int* indices,                             \
+                                                                       const Projection p,                             \
+                                                                       Scalar2* out,                                   \
+                                                                       const cudaTextureObject_t image,                \
+                                                                       const float2 first_red,                         \
+                                                                       Scalar4* network,                               \
+                                                                       const int n_points) {                           \
+        const int index = blockIdx.x * blockDim.x + threadIdx.x;                                                       \
+        if (index < n_points) {                                                                                        \
+            const Scalar2 pixel = projection##_pixel(points[indices[index]], p);                                       \
+            out[index]          = pixel;                                                                               \
+            store_input(network, index, bayer_pixel(image, float2{float(pixel.x), float(pixel.y)}, first_red));        \
+        }                                                                                                              \
+        else if (index == n_points) {                                                                                  \
+            store_input(network, index, float4{-1.0f, -1.0f, -1.0f, -1.0f});                                           \
+        }                                                                                                              \
+    }                                                                                                                  \
+                                                                                                                       \
+    extern "C" __global__ void project_##projection##_load_yuv_image(const Scalar4* points,                            \
+                                                                     const int* indices,                               \
+                                                                     const Projection p,                               \
+                                                                     Scalar2* out,                                     \
+                                                                     const cudaTextureObject_t image,                  \
+                                                                     const YuvLayout layout,                           \
+                                                                     Scalar4* network,                                 \
+                                                                     const int n_points) {                             \
+        const int index = blockIdx.x * blockDim.x + threadIdx.x;                                                       \
+        if (index < n_points) {                                                                                        \
+            const Scalar2 pixel = projection##_pixel(points[indices[index]], p);                                       \
+            out[index]          = pixel;                                                                               \
+            store_input(network, index, yuv_interpolate(image, layout, float2{float(pixel.x), float(pixel.y)}));       \
+        }                                                                                                              \
+        else if (index == n_points) {                                                                                  \
+            store_input(network, index, float4{-1.0f, -1.0f, -1.0f, -1.0f});                                           \
+        }                                                                                                              \
+    }                                                                                                                  \
+                                                                                                                       \
+    extern "C" __global__ void project_##projection##_load_interpolated_image(const Scalar4* points,                   \
+                                                                              const int* indices,                      \
+                                                                              const Projection p,                      \
+                                                                              Scalar2* out,                            \
+                                                                              const cudaTextureObject_t image,         \
+                                                                              const int order,                         \
+                                                                              Scalar4* network,                        \
+                                                                              const int n_points) {                    \
+        const int index = blockIdx.x * blockDim.x + threadIdx.x;                                                       \
+        if (index < n_points) {                                                                                        \
+            const Scalar2 pixel = projection##_pixel(points[indices[index]], p);                                       \
+            out[index]          = pixel;                                                                               \
+            store_input(network, index, interpolated_pixel(image, float2{float(pixel.x), float(pixel.y)}, order));     \
+        }                                                                                                              \
+        else if (index == n_points) {                                                                                  \
+            store_input(network, index, float4{-1.0f, -1.0f, -1.0f, -1.0f});                                           \
+        }                                                                                                              \
+    }
+
+PROJECT_LOAD_IMAGE(rectilinear)
+PROJECT_LOAD_IMAGE(equidistant)
+PROJECT_LOAD_IMAGE(equisolid)
+
+#undef PROJECT_LOAD_IMAGE
@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef M_PI_2
+#define M_PI_2 1.57079632679489661923132169163975144
+#endif
+
+/**
+ * The lens and orientation of the camera that the mesh is projected with. The host fills in the same layout, it is
+ * made only of Scalars and ints so it is the same on both.
+ */
+struct Projection {
+    /// Rotation from the observation space to camera space, as three rows of three
+    Scalar Rco[9];
+    /// The focal length of the lens measured in pixels
+    Scalar f;
+    /// The offset from the centre of the lens axis to the centre of the image in pixels
+    Scalar centre[2];
+    /// The inverse distortion coefficients to apply the distortion to the image
+    Scalar k[4];
+    /// The dimensions of the input image
+    int dimensions[2];
+};
+
+/**
+ * Rotates a visual mesh point into camera space
+ *
+ * @param ray the VisualMesh unit vector as a 4d vector [x, y, z, 0]
+ * @param p   the lens and orientation of the camera
+ *
+ * @return the unit vector in camera space
+ */
+__device__ inline Scalar3 camera_ray(const Scalar4 ray, const Projection& p) {
+    return Scalar3{p.Rco[0] * ray.x + p.Rco[1] * ray.y + p.Rco[2] * ray.z,
+                   p.Rco[3] * ray.x + p.Rco[4] * ray.y + p.Rco[5] * ray.z,
+                   p.Rco[6] * ray.x + p.Rco[7] * ray.y + p.Rco[8] * ray.z};
+}
+
+/**
+ * Distorts the undistorted radius of a ray in camera space and moves it into image space
+ *
+ * @param ray the unit vector in camera space
+ * @param r_u the undistorted radius of the ray on the image, which depends on the projection of the lens
+ * @param p   the lens and orientation of the camera
+ *
+ * @return the image coordinates of the point
+ */
+__device__ inline Scalar2 image_coordinates(const Scalar3 ray, const Scalar r_u, const Projection& p) {
+    const Scalar r2  = r_u * r_u;
+    const Scalar r_d = r_u
+                       * (Scalar(1.0)                            //
+                          + p.k[0] * r2                          //
+                          + p.k[1] * (r2 * r2)                   //
+                          + p.k[2] * ((r2 * r2) * r2)            //
+                          + p.k[3] * ((r2 * r2) * (r2 * r2))     //
+                       );
+
+    // Work out our pixel coordinates as a 0 centred image with x to the left and y up (screen space)
+    // When the pixel is at (1,0,0) lots of NaNs show up
+    const Scalar rsin_theta = rsqrt(Scalar(1.0) - ray.x * ray.x);
+    const Scalar sx         = ray.x >= 1 ? Scalar(0.0) : r_d * ray.y * rsin_theta;
+    const Scalar sy         = ray.x >= 1 ? Scalar(0.0) : r_d * ray.z * rsin_theta;
+
+    // Apply our offset to move into image space (0 at top left, x to the right, y down)
+    // Then apply the offset to the centre of our lens
+    return Scalar2{Scalar(p.dimensions[0] - 1) * Scalar(0.5) - sx - p.centre[0],
+                   Scalar(p.dimensions[1] - 1) * Scalar(0.5) - sy - p.centre[1]};
+}
+
+/**
+ * Projects a single visual mesh point to a rectilinear camera
+ *
+ * @param ray the VisualMesh unit vector as a 4d vector [x, y, z, 0]
+ * @param p   the lens and orientation of the camera
+ *
+ * @return the image coordinates of the point
+ */
+__device__ inline Scalar2 rectilinear_pixel(const Scalar4 ray, const Projection& p) {
+    const Scalar3 r     = camera_ray(ray, p);
+    const Scalar theta  = acos(r.x);
+    const Scalar capped = min(max(theta, Scalar(0.0)), Scalar(M_PI_2));
+    return image_coordinates(r, p.f * tan(capped), p);
+}
+
+/**
+ * Projects a single visual mesh point to a Fisheye camera with equidistant projection
+ *
+ * @param ray the VisualMesh unit vector as a 4d vector [x, y, z, 0]
+ * @param p   the lens and orientation of the camera
+ *
+ * @return the image coordinates of the point
+ */
+__device__ inline Scalar2 equidistant_pixel(const Scalar4 ray, const Projection& p) {
+    const Scalar3 r = camera_ray(ray, p);
+    return image_coordinates(r, p.f * acos(r.x), p);
+}
+
+/**
+ * Projects a single visual mesh point to a Fisheye camera with equisolid projection
+ *
+ * @param ray the VisualMesh unit vector as a 4d vector [x, y, z, 0]
+ * @param p   the lens and orientation of the camera
+ *
+ * @return the image coordinates of the point
+ */
+__device__ inline Scalar2 equisolid_pixel(const Scalar4 ray, const Projection& p) {
+    const Scalar3 r = camera_ray(ray, p);
+    return image_coordinates(r, Scalar(2.0) * p.f * sin(acos(r.x) * Scalar(0.5)), p);
+}
+
+/**
+ * Makes the kernels that project visual mesh points, one for each projection
+ *
+ * @param points   VisualMesh unit vectors as 4d vectors [x, y, z, 0]
+ * @param indices  map from local indices to global indices
+ * @param p        the lens and orientation of the camera
+ * @param out      the output image coordinates
+ * @param n_points the number of points on the screen, the grid is rounded up past it
+ */
+#define PROJECT(projection)                                                                                            \
+    extern "C" __global__ void project_##projection(                                                                   \
+      const Scalar4* points, const int* indices, const Projection p, Scalar2* out, const int n_points) {               \
+        const int index = blockIdx.x * blockDim.x + threadIdx.x;                                                       \
+        if (index < n_points) { out[index] = projection##_pixel(points[indices[index]], p); }                          \
+    }
+
+PROJECT(rectilinear)
+PROJECT(equidistant)
+PROJECT(equisolid)
+
+#undef PROJECT
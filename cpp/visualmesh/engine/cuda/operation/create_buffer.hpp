@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_ENGINE_CUDA_OPERATION_CREATE_BUFFER_HPP
+#define VISUALMESH_ENGINE_CUDA_OPERATION_CREATE_BUFFER_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+
+#include "wrapper.hpp"
+
+namespace visualmesh {
+namespace engine {
+    namespace cuda {
+        namespace operation {
+
+            /**
+             * @brief Allocate device memory
+             *
+             * @param context the context to allocate in, which must be current
+             * @param bytes   the size of the buffer in bytes
+             *
+             * @return the device memory, which is freed with the context made current
+             */
+            inline cu::device_memory create_buffer(const cu::context& context, const std::size_t& bytes) {
+                CUdeviceptr memory = 0;
+                throw_cuda_error(::cuMemAlloc(&memory, std::max(bytes, std::size_t(1))),
+                                 "Error allocating a buffer on the device");
+                return cu::device_memory(memory, [context](CUdeviceptr m) {
+                    ScopedContext scope(context);
+                    if (scope.ok()) { ::cuMemFree(m); }
+                });
+            }
+
+            /**
+             * @brief Allocate page locked host memory, which the device copies to and from asynchronously
+             *
+             * @param context the context to allocate in, which must be current
+             * @param bytes   the size of the buffer in bytes
+             *
+             * @return the host memory, which is freed with the context made current
+             */
+            inline cu::host_memory create_host_buffer(const cu::context& context, const std::size_t& bytes) {
+                void* memory = nullptr;
+                throw_cuda_error(::cuMemAllocHost(&memory, std::max(bytes, std::size_t(1))),
+                                 "Error allocating a page locked buffer on the host");
+                return cu::host_memory(memory, [context](void* m) {
+                    ScopedContext scope(context);
+                    if (scope.ok()) { ::cuMemFreeHost(m); }
+                });
+            }
+
+            /**
+             * @brief Allocate device memory for an image, padding each row so it can be read through a texture
+             *
+             * @param context the context to allocate in, which must be current
+             * @param width   the number of bytes in each row of the image
+             * @param height  the number of rows in the image
+             *
+             * @return the device memory and the number of bytes between the start of each row
+             */
+            inline std::pair<cu::device_memory, std::size_t> create_image_buffer(const cu::context& context,
+                                                                                 const std::size_t& width,
+                                                                                 const std::size_t& height) {
+                CUdeviceptr memory = 0;
+                std::size_t pitch  = 0;
+                throw_cuda_error(::cuMemAllocPitch(&memory, &pitch, width, height, 4),
+                                 "Error allocating an image on the device");
+                return std::make_pair(cu::device_memory(memory,
+                                                        [context](CUdeviceptr m) {
+                                                            ScopedContext scope(context);
+                                                            if (scope.ok()) { ::cuMemFree(m); }
+                                                        }),
+                                      pitch);
+            }
+
+            /**
+             * @brief Make a texture that reads the 8 bit channels of an image in device memory as normalised floats
+             *
+             * @details
+             *  Reads outside of the image give zero, the same as the OpenCL engine's clamp to border sampler.
+             *
+             * @param context  the context the image was allocated in, which must be current
+             * @param image    the device memory of the image
+             * @param pitch    the number of bytes between the start of each row
+             * @param width    the number of pixels in each row
+             * @param height   the number of rows
+             * @param channels the number of channels of each pixel, 1 or 4
+             * @param linear   if the texture interpolates between pixels, otherwise it reads the nearest pixel
+             *
+             * @return the texture object, which is destroyed with the context made current
+             */
+            inline cu::texture create_texture(const cu::context& context,
+                                              const CUdeviceptr& image,
+                                              const std::size_t& pitch,
+                                              const std::size_t& width,
+                                              const std::size_t& height,
+                                              const unsigned int& channels,
+                                              const bool& linear) {
+                CUDA_RESOURCE_DESC resource{};
+                resource.resType                  = CU_RESOURCE_TYPE_PITCH2D;
+                resource.res.pitch2D.devPtr       = image;
+                resource.res.pitch2D.format       = CU_AD_FORMAT_UNSIGNED_INT8;
+                resource.res.pitch2D.numChannels  = channels;
+                resource.res.pitch2D.width        = width;
+                resource.res.pitch2D.height       = height;
+                resource.res.pitch2D.pitchInBytes = pitch;
+
+                // Without CU_TRSF_READ_AS_INTEGER the 8 bit values are read as floats from 0 to 1
+                CUDA_TEXTURE_DESC description{};
+                description.addressMode[0] = CU_TR_ADDRESS_MODE_BORDER;
+                description.addressMode[1] = CU_TR_ADDRESS_MODE_BORDER;
+                description.filterMode     = linear ? CU_TR_FILTER_MODE_LINEAR : CU_TR_FILTER_MODE_POINT;
+
+                CUtexObject texture = 0;
+                throw_cuda_error(::cuTexObjectCreate(&texture, &resource, &description, nullptr),
+                                 "Error creating a texture for the image");
+                return cu::texture(texture, [context](CUtexObject t) {
+                    ScopedContext scope(context);
+                    if (scope.ok()) { ::cuTexObjectDestroy(t); }
+                });
+            }
+
+        }  // namespace operation
+    }      // namespace cuda
+}  // namespace engine
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_ENGINE_CUDA_OPERATION_CREATE_BUFFER_HPP
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_ENGINE_CUDA_OPERATION_CUDA_ERROR_CATEGORY_HPP
+#define VISUALMESH_ENGINE_CUDA_OPERATION_CUDA_ERROR_CATEGORY_HPP
+
+#include <cuda.h>
+#include <nvrtc.h>
+
+#include <string>
+#include <system_error>
+
+namespace visualmesh {
+namespace engine {
+    namespace cuda {
+        namespace operation {
+
+            /// The error category for the results of the CUDA driver API, the driver describes each of its own errors
+            class cuda_error_category_t : public std::error_category {
+            public:
+                inline const char* name() const noexcept override {
+                    return "cuda_error_category";
+                }
+
+                inline std::string message(int code) const override {
+                    const char* description = nullptr;
+                    if (::cuGetErrorString(static_cast<CUresult>(code), &description) == CUDA_SUCCESS
+                        && description != nullptr) {
+                        return description;
+                    }
+                    return "Unknown error " + std::to_string(code);
+                }
+            };
+
+            /// The error category for the results of NVRTC, which compiles the kernels at runtime
+            class nvrtc_error_category_t : public std::error_category {
+            public:
+                inline const char* name() const noexcept override {
+                    return "nvrtc_error_category";
+                }
+
+                inline std::string message(int code) const override {
+                    return ::nvrtcGetErrorString(static_cast<nvrtcResult>(code));
+                }
+            };
+
+            inline const std::error_category& cuda_error_category() {
+                static cuda_error_category_t instance;
+                return instance;
+            }
+
+            inline const std::error_category& nvrtc_error_category() {
+                static nvrtc_error_category_t instance;
+                return instance;
+            }
+
+        }  // namespace operation
+    }      // namespace cuda
+}  // namespace engine
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_ENGINE_CUDA_OPERATION_CUDA_ERROR_CATEGORY_HPP
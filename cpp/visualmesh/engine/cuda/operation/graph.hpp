@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_ENGINE_CUDA_OPERATION_GRAPH_HPP
+#define VISUALMESH_ENGINE_CUDA_OPERATION_GRAPH_HPP
+
+#include <cstddef>
+#include <initializer_list>
+#include <stdexcept>
+#include <vector>
+
+#include "wrapper.hpp"
+
+namespace visualmesh {
+namespace engine {
+    namespace cuda {
+        namespace operation {
+
+            /**
+             * @brief A CUDA graph of the work for a frame that is built once and then replayed with new parameters
+             *
+             * @details
+             *  Every frame adds the same kernels and copies in the same order. The first frame builds the graph from
+             *  them, and later frames replace the parameters of the matching nodes of the executable graph instead, so
+             *  the pointers, sizes and lens of each frame are updated without rebuilding it. The whole frame is then
+             *  started with a single launch however many kernels and copies it has. The kinds of copies and the kernels
+             *  must be the same every frame, only their parameters can change.
+             */
+            class Graph {
+            public:
+                /**
+                 * @brief Make an empty graph
+                 *
+                 * @param context the context the graph runs in, which must be current
+                 */
+                explicit Graph(const cu::context& context) : context(context) {
+                    CUgraph created = nullptr;
+                    throw_cuda_error(::cuGraphCreate(&created, 0), "Error creating a CUDA graph");
+                    graph = cu::graph(created, [context](CUgraph g) {
+                        ScopedContext scope(context);
+                        if (scope.ok()) { ::cuGraphDestroy(g); }
+                    });
+                }
+
+                /// Start adding the work of a frame from the first node
+                void begin() {
+                    next = 0;
+                }
+
+                /**
+                 * @brief Add a kernel to the frame
+                 *
+                 * @param params       the kernel, its launch dimensions and its arguments
+                 * @param dependencies the nodes that must finish before this kernel starts
+                 *
+                 * @return the node of the kernel, for use as a dependency of later nodes
+                 */
+                std::size_t kernel(const CUDA_KERNEL_NODE_PARAMS& params,
+                                   const std::initializer_list<std::size_t>& dependencies) {
+                    if (exec) {
+                        throw_cuda_error(::cuGraphExecKernelNodeSetParams(exec, node(), &params),
+                                         "Error updating a kernel of the CUDA graph");
+                        return next++;
+                    }
+                    const std::vector<CUgraphNode> deps = resolve(dependencies);
+                    CUgraphNode n                       = nullptr;
+                    throw_cuda_error(::cuGraphAddKernelNode(&n, graph, deps.data(), deps.size(), &params),
+                                     "Error adding a kernel to the CUDA graph");
+                    nodes.push_back(n);
+                    return next++;
+                }
+
+                /**
+                 * @brief Add a copy to the frame
+                 *
+                 * @details
+                 *  The driver can only update copies of a single row, so a copy of several rows keeps the parameters
+                 *  of the first frame. The caller must make a new graph if the memory of such a copy changes.
+                 *
+                 * @param params       the source and destination of the copy and its size
+                 * @param dependencies the nodes that must finish before this copy starts
+                 *
+                 * @return the node of the copy, for use as a dependency of later nodes
+                 */
+                std::size_t copy(const CUDA_MEMCPY3D& params, const std::initializer_list<std::size_t>& dependencies) {
+                    if (exec) {
+                        const CUgraphNode n = node();
+                        if (params.Height <= 1 && params.Depth <= 1) {
+                            throw_cuda_error(::cuGraphExecMemcpyNodeSetParams(exec, n, &params, context),
+                                             "Error updating a copy of the CUDA graph");
+                        }
+                        return next++;
+                    }
+                    const std::vector<CUgraphNode> deps = resolve(dependencies);
+                    CUgraphNode n                       = nullptr;
+                    throw_cuda_error(::cuGraphAddMemcpyNode(&n, graph, deps.data(), deps.size(), &params, context),
+                                     "Error adding a copy to the CUDA graph");
+                    nodes.push_back(n);
+                    return next++;
+                }
+
+                /**
+                 * @brief Launch the work of the frame, making the graph executable after the first frame built it
+                 *
+                 * @param stream the stream to launch the graph on
+                 */
+                void launch(CUstream stream) {
+                    if (next != nodes.size()) {
+                        throw std::logic_error("A frame added different work to the CUDA graph than the first frame");
+                    }
+                    if (!exec) {
+                        CUgraphExec created = nullptr;
+                        throw_cuda_error(::cuGraphInstantiateWithFlags(&created, graph, 0),
+                                         "Error making the CUDA graph executable");
+                        exec = cu::graph_exec(created, [ctx = context](CUgraphExec e) {
+                            ScopedContext scope(ctx);
+                            if (scope.ok()) { ::cuGraphExecDestroy(e); }
+                        });
+                    }
+                    throw_cuda_error(::cuGraphLaunch(exec, stream), "Error launching the CUDA graph");
+                }
+
+            private:
+                /// @return the node that the next update replaces the parameters of
+                CUgraphNode node() const {
+                    if (next >= nodes.size()) {
+                        throw std::logic_error("A frame added more work to the CUDA graph than the first frame");
+                    }
+                    return nodes[next];
+                }
+
+                /// @return the graph nodes for the indices of earlier nodes
+                std::vector<CUgraphNode> resolve(const std::initializer_list<std::size_t>& dependencies) const {
+                    std::vector<CUgraphNode> deps;
+                    deps.reserve(dependencies.size());
+                    for (const auto& d : dependencies) {
+                        deps.push_back(nodes[d]);
+                    }
+                    return deps;
+                }
+
+                /// The context the graph runs in
+                cu::context context;
+                /// The graph that the first frame built
+                cu::graph graph;
+                /// The executable graph that later frames update and launch
+                cu::graph_exec exec;
+                /// The nodes of the graph in the order they were added
+                std::vector<CUgraphNode> nodes;
+                /// The index of the next node of the current frame
+                std::size_t next = 0;
+            };
+
+        }  // namespace operation
+    }      // namespace cuda
+}  // namespace engine
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_ENGINE_CUDA_OPERATION_GRAPH_HPP
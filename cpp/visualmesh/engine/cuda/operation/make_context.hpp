@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_ENGINE_CUDA_OPERATION_MAKE_CONTEXT_HPP
+#define VISUALMESH_ENGINE_CUDA_OPERATION_MAKE_CONTEXT_HPP
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "wrapper.hpp"
+
+namespace visualmesh {
+namespace engine {
+    namespace cuda {
+        namespace operation {
+
+            /**
+             * @brief List the CUDA devices, the devices with the most multiprocessors first
+             *
+             * @return the devices that can be passed to make_context, or an empty list if there is no CUDA driver
+             */
+            inline std::vector<CUdevice> list_devices() {
+                if (::cuInit(0) != CUDA_SUCCESS) { return {}; }
+
+                int count = 0;
+                ::cuDeviceGetCount(&count);
+
+                // Collect the devices with how many multiprocessors they have
+                std::vector<std::pair<int, CUdevice>> found;
+                for (int i = 0; i < count; ++i) {
+                    CUdevice device = 0;
+                    int multiprocessors = 0;
+                    if (::cuDeviceGet(&device, i) == CUDA_SUCCESS) {
+                        ::cuDeviceGetAttribute(&multiprocessors, CU_DEVICE_ATTRIBUTE_MULTIPROCESSOR_COUNT, device);
+                        found.emplace_back(multiprocessors, device);
+                    }
+                }
+
+                // The order the driver listed them in is kept for devices with the same number of multiprocessors
+                std::stable_sort(found.begin(), found.end(), [](const auto& a, const auto& b) {
+                    return a.first > b.first;
+                });
+
+                std::vector<CUdevice> devices;
+                devices.reserve(found.size());
+                for (const auto& d : found) {
+                    devices.push_back(d.second);
+                }
+                return devices;
+            }
+
+            /**
+             * @brief Get the primary context of a device, which is shared with anything else using the device
+             *
+             * @param device the device to use from list_devices, or -1 for the device with the most multiprocessors
+             *
+             * @return the context and the device it was made for
+             */
+            inline std::pair<cu::context, CUdevice> make_context(CUdevice device = -1) {
+                throw_cuda_error(::cuInit(0), "Error initialising the CUDA driver");
+
+                // Pick the device with the most multiprocessors if we weren't given one
+                if (device < 0) {
+                    auto devices = list_devices();
+                    if (devices.empty()) {
+                        throw std::system_error(
+                          CUDA_ERROR_NO_DEVICE, cuda_error_category(), "Error selecting a CUDA device");
+                    }
+                    device = devices.front();
+                }
+
+                CUcontext context = nullptr;
+                throw_cuda_error(::cuDevicePrimaryCtxRetain(&context, device), "Error creating the CUDA context");
+                return std::make_pair(
+                  cu::context(context, [device](CUcontext) { ::cuDevicePrimaryCtxRelease(device); }), device);
+            }
+
+            /**
+             * @brief Make a stream that doesn't synchronise with the legacy default stream
+             *
+             * @param context the context the stream is made in, which must be current
+             *
+             * @return the stream
+             */
+            inline cu::stream make_stream(const cu::context& context) {
+                CUstream stream = nullptr;
+                throw_cuda_error(::cuStreamCreate(&stream, CU_STREAM_NON_BLOCKING), "Error creating a CUDA stream");
+                return cu::stream(stream, [context](CUstream s) {
+                    ScopedContext scope(context);
+                    if (scope.ok()) { ::cuStreamDestroy(s); }
+                });
+            }
+
+        }  // namespace operation
+    }      // namespace cuda
+}  // namespace engine
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_ENGINE_CUDA_OPERATION_MAKE_CONTEXT_HPP
@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_ENGINE_CUDA_OPERATION_MAKE_MODULE_HPP
+#define VISUALMESH_ENGINE_CUDA_OPERATION_MAKE_MODULE_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "visualmesh/utility/atomic_file.hpp"
+#include "wrapper.hpp"
+
+namespace visualmesh {
+namespace engine {
+    namespace cuda {
+        namespace operation {
+
+            /**
+             * @brief Get the compute capability of a device as major * 10 + minor
+             *
+             * @param device the device to query
+             *
+             * @return the compute capability, e.g. 75 for a Turing GPU or 87 for a Jetson Orin
+             */
+            inline int compute_capability(CUdevice device) {
+                int major = 0;
+                int minor = 0;
+                ::cuDeviceGetAttribute(&major, CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MAJOR, device);
+                ::cuDeviceGetAttribute(&minor, CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MINOR, device);
+                return major * 10 + minor;
+            }
+
+            /**
+             * @brief Work out the file the PTX of a module is cached in
+             *
+             * @details
+             *  The name is a 64 bit FNV-1a hash of everything that affects the PTX NVRTC produces and whether the
+             *  driver can load it: the device, the driver and NVRTC versions, the compile options and the source,
+             *  which includes every weight of the network.
+             *
+             * @param cache_directory the directory the PTX is cached in
+             * @param device          the device the module is compiled for
+             * @param source          the source code of the module
+             * @param options         the options the module is compiled with
+             *
+             * @return the path of the cached PTX
+             */
+            inline std::string module_cache_path(const std::string& cache_directory,
+                                                 CUdevice device,
+                                                 const std::string& source,
+                                                 const std::vector<std::string>& options) {
+                uint64_t hash = 0xcbf29ce484222325;
+                auto add      = [&hash](const std::string& s) {
+                    // Include the terminator so the boundaries between the strings are part of the hash
+                    for (const auto& c : s + '\0') {
+                        hash ^= static_cast<unsigned char>(c);
+                        hash *= 0x100000001b3;
+                    }
+                };
+
+                std::vector<char> name(256, '\0');
+                ::cuDeviceGetName(name.data(), int(name.size()), device);
+                int driver = 0;
+                ::cuDriverGetVersion(&driver);
+                int nvrtc_major = 0;
+                int nvrtc_minor = 0;
+                ::nvrtcVersion(&nvrtc_major, &nvrtc_minor);
+
+                add(name.data());
+                add(std::to_string(compute_capability(device)));
+                add(std::to_string(driver));
+                add(std::to_string(nvrtc_major) + "." + std::to_string(nvrtc_minor));
+                for (const auto& option : options) {
+                    add(option);
+                }
+                add(source);
+
+                std::stringstream path;
+                path << cache_directory << "/" << std::hex << std::setw(16) << std::setfill('0') << hash << ".ptx";
+                return path.str();
+            }
+
+            /**
+             * @brief Compile CUDA source code with NVRTC and load it as a module, using PTX from an earlier compile of
+             * the same source if it is cached
+             *
+             * @details
+             *  Compiling a large network can take many seconds, so when a cache directory is given the PTX that NVRTC
+             *  produced is written there after compiling it. Later engines for the same source, device and driver load
+             *  that PTX instead. PTX that can't be read or that the driver rejects is ignored and the source is
+             *  compiled again. Failing to write the cache is not an error, the cache directory must already exist for
+             *  anything to be written.
+             *
+             * @param context         the context to load the module into, which must be current
+             * @param device          the device to compile the module for
+             * @param source          the source code of the module
+             * @param options         the options to pass to NVRTC
+             * @param cache_directory the directory the PTX is cached in, or empty to always compile the source
+             *
+             * @return the module, loaded into the current context which it is unloaded from when it is released
+             */
+            inline cu::module make_module(const cu::context& context,
+                                          CUdevice device,
+                                          const std::string& source,
+                                          const std::vector<std::string>& options,
+                                          const std::string& cache_directory) {
+                // Load PTX into the current context
+                auto load = [&context](const std::string& ptx, cu::module& module) {
+                    CUmodule loaded     = nullptr;
+                    const CUresult code = ::cuModuleLoadData(&loaded, ptx.c_str());
+                    if (code == CUDA_SUCCESS) {
+                        module = cu::module(loaded, [context](CUmodule m) {
+                            ScopedContext scope(context);
+                            if (scope.ok()) { ::cuModuleUnload(m); }
+                        });
+                    }
+                    return code;
+                };
+
+                // Try to load the PTX for this module
+                cu::module module;
+                const std::string path =
+                  cache_directory.empty() ? std::string() : module_cache_path(cache_directory, device, source, options);
+                if (!path.empty()) {
+                    std::ifstream file(path, std::ios::binary);
+                    const std::string ptx((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+                    if (!ptx.empty() && load(ptx, module) == CUDA_SUCCESS) { return module; }
+                }
+
+                nvrtcProgram program = nullptr;
+                throw_nvrtc_error(
+                  ::nvrtcCreateProgram(&program, source.c_str(), "visualmesh.cu", 0, nullptr, nullptr),
+                  "Error adding sources to the CUDA program");
+                std::unique_ptr<_nvrtcProgram, void (*)(nvrtcProgram)> owner(program, [](nvrtcProgram p) {
+                    ::nvrtcDestroyProgram(&p);
+                });
+
+                // Compile the program
+                std::vector<const char*> opts;
+                for (const auto& option : options) {
+                    opts.push_back(option.c_str());
+                }
+                const nvrtcResult error = ::nvrtcCompileProgram(program, int(opts.size()), opts.data());
+                if (error != NVRTC_SUCCESS) {
+                    // Get program build log
+                    std::size_t size = 0;
+                    ::nvrtcGetProgramLogSize(program, &size);
+                    std::vector<char> log(size + 1, '\0');
+                    ::nvrtcGetProgramLog(program, log.data());
+
+                    // Throw an error with the build log
+                    throw_nvrtc_error(error, "Error building CUDA program\n" + std::string(log.data()));
+                }
+
+                std::size_t size = 0;
+                throw_nvrtc_error(::nvrtcGetPTXSize(program, &size), "Error getting the size of the CUDA program");
+                std::vector<char> buffer(size, '\0');
+                throw_nvrtc_error(::nvrtcGetPTX(program, buffer.data()), "Error getting the CUDA program");
+                const std::string ptx(buffer.data());
+
+                throw_cuda_error(load(ptx, module), "Error loading the CUDA program");
+
+                // Save the PTX for next time, writing it to the side first so partial PTX is never loaded
+                if (!path.empty()) { write_atomically(path, ptx); }
+
+                return module;
+            }
+
+        }  // namespace operation
+    }      // namespace cuda
+}  // namespace engine
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_ENGINE_CUDA_OPERATION_MAKE_MODULE_HPP
@@ -0,0 +1,329 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_ENGINE_CUDA_OPERATION_MAKE_NETWORK_HPP
+#define VISUALMESH_ENGINE_CUDA_OPERATION_MAKE_NETWORK_HPP
+
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <type_traits>
+
+#include "visualmesh/compiled_network.hpp"
+#include "visualmesh/quantisation.hpp"
+
+namespace visualmesh {
+namespace engine {
+    namespace cuda {
+        namespace operation {
+
+            namespace detail {
+
+                /**
+                 * @brief Writes a value as a literal of the Scalar type so single precision kernels aren't promoted to
+                 * double precision arithmetic
+                 *
+                 * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+                 */
+                template <typename Scalar>
+                struct literal {
+                    Scalar value;
+
+                    friend std::ostream& operator<<(std::ostream& out, const literal& l) {
+                        // Scientific notation always has a decimal point, so the suffix is valid for whole numbers
+                        out << std::scientific << std::setprecision(std::numeric_limits<Scalar>::digits10 + 2)
+                            << l.value << (std::is_same<Scalar, float>::value ? "f" : "");
+                        return out << std::defaultfloat;
+                    }
+                };
+
+                /**
+                 * @brief Generate the CUDA kernels for a network, the matrix multiplication is provided by the caller
+                 *
+                 * @tparam Scalar   the scalar type used for calculations and storage (normally one of float or double)
+                 * @tparam Network  the type of network, either a CompiledNetwork or a QuantisedNetwork
+                 * @tparam Multiply the type of the function that writes the code for a layer's weights and biases
+                 *
+                 * @param network  the network to generate the kernels from
+                 * @param multiply writes the code that declares in<layer_no + 1> from in<layer_no>, called as
+                 *                 multiply(code, conv_no, layer_no, input_dimensions)
+                 *
+                 * @return the CUDA source code for the kernels to be compiled
+                 */
+                template <typename Scalar, typename Network, typename Multiply>
+                std::string make_network(const Network& network, Multiply&& multiply) {
+                    std::stringstream code;
+
+                    // If our network has no layers, return empty code
+                    if (network.empty()) { return ""; }
+
+                    // First layer has 4 inputs, so that tells us how many neighbours we have (minus ourself)
+                    const unsigned int n_neighbours = (network.layer(0, 0).input_dimensions / 4) - 1;
+
+                    // Keep track of the input and output size of each layer for building the network
+                    // The first layer input is always 4 from the image
+                    unsigned int input_dimensions  = 4;
+                    unsigned int output_dimensions = 0;
+
+                    for (unsigned int conv_no = 0; conv_no < network.size(); ++conv_no) {
+
+                        // Write our CUDA kernel definition, the grid is rounded up so the extra threads return
+                        code << "extern \"C\" __global__ void conv" << conv_no
+                             << "(const int* neighbourhood, const Scalar* input, Scalar* output, const int n_points) {"
+                             << std::endl
+                             << std::endl;
+
+                        code << "  // Get our kernel index" << std::endl;
+                        code << "  const int idx = blockIdx.x * blockDim.x + threadIdx.x;" << std::endl;
+                        code << "  if (idx >= n_points) { return; }" << std::endl << std::endl;
+
+                        /*************************************************
+                         *                    GATHER                     *
+                         *************************************************/
+
+                        code << "  // Gather from our neighbourhood " << std::endl;
+                        code << "  Scalar in0[" << (input_dimensions * (n_neighbours + 1)) << "] = {" << std::endl;
+
+                        // Read the ones for our own index
+                        for (unsigned int j = 0; j < input_dimensions; ++j) {
+                            code << "    input[idx * " << input_dimensions << " + " << j << "]," << std::endl;
+                        }
+
+                        // Read our neighbourhood
+                        for (unsigned int i = 0; i < n_neighbours; ++i) {
+                            for (unsigned int j = 0; j < input_dimensions; ++j) {
+                                code << "    input[neighbourhood[idx * " << n_neighbours << " + " << i << "] * "
+                                     << input_dimensions << " + " << j << "]";
+
+                                // Comma separated except for the end
+                                if (i + 1 < n_neighbours || j + 1 < input_dimensions) { code << ","; }
+                                code << std::endl;
+                            }
+                        }
+                        code << "  };";
+
+                        // We have gathered which increased the size of the input
+                        input_dimensions = input_dimensions * (n_neighbours + 1);
+
+                        code << std::endl << std::endl;
+
+                        /*************************************************
+                         *                WEIGHTS + BIAS                 *
+                         *************************************************/
+
+                        for (unsigned int layer_no = 0; layer_no < network.size(conv_no); ++layer_no) {
+                            const auto activation = network.layer(conv_no, layer_no).activation;
+
+                            // Update our output dimensions
+                            output_dimensions = network.layer(conv_no, layer_no).output_dimensions;
+
+                            // Perform the matrix multiplication
+                            multiply(code, conv_no, layer_no, input_dimensions);
+
+                            /*************************************************
+                             *                  ACTIVATION.                  *
+                             *************************************************/
+
+                            code << "  // Apply the activation function" << std::endl;
+
+                            switch (activation) {
+                                case ActivationFunction::SELU: {
+                                    // selu constants
+                                    const literal<Scalar> lambda{Scalar(1.0507009873554804934193349852946)};
+                                    const literal<Scalar> alpha{Scalar(1.6732632423543772848170429916717)};
+
+                                    code << "  // Apply selu" << std::endl;
+                                    for (unsigned int i = 0; i < output_dimensions; ++i) {
+                                        std::string e =
+                                          "in" + std::to_string(layer_no + 1) + "[" + std::to_string(i) + "]";
+                                        code << "  " << e << " = " << lambda << " * (" << e << " > 0 ? " << e << " : "
+                                             << alpha << " * exp(" << e << ") - " << alpha << ");" << std::endl;
+                                    }
+                                } break;
+                                case ActivationFunction::RELU: {
+                                    code << "  // Apply relu" << std::endl;
+                                    for (unsigned int i = 0; i < output_dimensions; ++i) {
+                                        std::string e =
+                                          "in" + std::to_string(layer_no + 1) + "[" + std::to_string(i) + "]";
+                                        code << "  " << e << " = " << e << " > 0 ? " << e << " : 0;" << std::endl;
+                                    }
+                                } break;
+                                case ActivationFunction::TANH: {
+                                    code << "  // Apply tanh" << std::endl;
+                                    for (unsigned int i = 0; i < output_dimensions; ++i) {
+                                        std::string e =
+                                          "in" + std::to_string(layer_no + 1) + "[" + std::to_string(i) + "]";
+                                        code << "  " << e << " = tanh(" << e << ");" << std::endl;
+                                    }
+                                } break;
+                                case ActivationFunction::SOFTMAX: {
+                                    code << "  // Apply softmax" << std::endl;
+
+                                    // Apply exp to each of the elements
+                                    for (unsigned int i = 0; i < output_dimensions; ++i) {
+                                        std::string e =
+                                          "in" + std::to_string(layer_no + 1) + "[" + std::to_string(i) + "]";
+                                        code << "  " << e << " = exp(" << e << ");" << std::endl;
+                                    }
+
+                                    // Sum up all the values
+                                    code << "  Scalar exp_sum" << layer_no << " = 0;" << std::endl;
+                                    for (unsigned int i = 0; i < output_dimensions; ++i) {
+                                        std::string e =
+                                          "in" + std::to_string(layer_no + 1) + "[" + std::to_string(i) + "]";
+                                        code << "  exp_sum" << layer_no << " += " << e << ";" << std::endl;
+                                    }
+
+                                    // Divide all the values
+                                    for (unsigned int i = 0; i < output_dimensions; ++i) {
+                                        std::string e =
+                                          "in" + std::to_string(layer_no + 1) + "[" + std::to_string(i) + "]";
+                                        code << "  " << e << " /= exp_sum" << layer_no << ";" << std::endl;
+                                    }
+                                } break;
+                            }
+
+                            code << std::endl;
+
+                            // Update our input size for the next loop
+                            input_dimensions = output_dimensions;
+                        }
+
+                        /*************************************************
+                         *                    OUTPUT                     *
+                         *************************************************/
+                        code << "  // Save our value to the output" << std::endl;
+                        for (unsigned int i = 0; i < input_dimensions; ++i) {
+                            code << "  output[idx * " << input_dimensions << " + " << i << "] = in"
+                                 << network.size(conv_no) << "[" << i << "];" << std::endl;
+                        }
+
+                        code << "}" << std::endl << std::endl;
+
+                        // Update our input dimensions for the next round
+                        input_dimensions = output_dimensions;
+                    }
+
+                    return code.str();
+                }
+
+            }  // namespace detail
+
+            /**
+             * @brief Given a compiled network generate the CUDA source code for the kernels needed to execute it
+             *
+             * @details
+             *  These kernels run each point in its own thread in Scalar precision. In half precision the engine runs
+             *  the convs that are wide enough on the tensor cores instead and these kernels are used for the rest.
+             *
+             * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+             *
+             * @param network the compiled network to generate the kernels from
+             *
+             * @return the CUDA source code for the kernels to be compiled
+             */
+            template <typename Scalar>
+            std::string make_network(const CompiledNetwork<Scalar>& network) {
+                using detail::literal;
+                return detail::make_network<Scalar>(
+                  network,
+                  [&](std::ostream& code,
+                      const unsigned int& conv_no,
+                      const unsigned int& layer_no,
+                      const unsigned int& input_dimensions) {
+                      const auto layer = network.layer(conv_no, layer_no);
+
+                      code << "  // Perform our matrix multiplication for weights and add bias for layer " << layer_no
+                           << std::endl;
+                      code << "  Scalar in" << (layer_no + 1) << "[" << layer.output_dimensions << "] = {"
+                           << std::endl;
+                      for (int i = 0; i < layer.output_dimensions; ++i) {
+                          code << "    ";
+                          for (unsigned int j = 0; j < input_dimensions; ++j) {
+                              code << "in" << layer_no << "[" << j << "] * " << literal<Scalar>{layer.weight(j, i)}
+                                   << " + ";
+                          }
+                          code << literal<Scalar>{layer.bias(i)};
+                          if (i + 1 < layer.output_dimensions) { code << ","; }
+                          code << std::endl;
+                      }
+                      code << "  };" << std::endl << std::endl;
+                  });
+            }
+
+            /**
+             * @brief Given a quantised network generate the CUDA source code for the kernels needed to execute it
+             *
+             * @details
+             *  The input of each layer is quantised to 8 bits and multiplied against the integer weights using integer
+             *  arithmetic, and the outputs are dequantised before the activation function is applied.
+             *
+             * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+             *
+             * @param network the quantised network to generate the kernels from
+             *
+             * @return the CUDA source code for the kernels to be compiled
+             */
+            template <typename Scalar>
+            std::string make_network(const QuantisedNetwork<Scalar>& network) {
+                using detail::literal;
+                return detail::make_network<Scalar>(
+                  network,
+                  [&](std::ostream& code,
+                      const unsigned int& conv_no,
+                      const unsigned int& layer_no,
+                      const unsigned int& input_dimensions) {
+                      const auto& layer = network.layer(conv_no, layer_no);
+                      const literal<Scalar> inv{Scalar(1) / layer.input.scale};
+                      const literal<Scalar> offset{Scalar(layer.input.zero_point) + Scalar(0.5)};
+                      const literal<Scalar> max_value{Scalar(QuantisationParameters<Scalar>::MAX_VALUE)};
+
+                      code << "  // Quantise the input for layer " << layer_no << std::endl;
+                      code << "  const int q" << layer_no << "[" << input_dimensions << "] = {" << std::endl;
+                      for (unsigned int j = 0; j < input_dimensions; ++j) {
+                          code << "    int(min(max(in" << layer_no << "[" << j << "] * " << inv << " + " << offset
+                               << ", Scalar(0)), " << max_value << "))";
+                          if (j + 1 < input_dimensions) { code << ","; }
+                          code << std::endl;
+                      }
+                      code << "  };" << std::endl << std::endl;
+
+                      code << "  // Perform our integer matrix multiplication and dequantise for layer " << layer_no
+                           << std::endl;
+                      code << "  Scalar in" << (layer_no + 1) << "[" << layer.output_dimensions << "] = {" << std::endl;
+                      for (int i = 0; i < layer.output_dimensions; ++i) {
+                          code << "    " << literal<Scalar>{layer.biases[i]} << " + "
+                               << literal<Scalar>{layer.scales[i]} << " * Scalar(0";
+                          for (unsigned int j = 0; j < input_dimensions; ++j) {
+                              const int w = layer.weight(j, i);
+                              if (w != 0) { code << " + q" << layer_no << "[" << j << "] * " << w; }
+                          }
+                          code << " - " << layer.offsets[i] << ")";
+                          if (i + 1 < layer.output_dimensions) { code << ","; }
+                          code << std::endl;
+                      }
+                      code << "  };" << std::endl << std::endl;
+                  });
+            }
+
+        }  // namespace operation
+    }      // namespace cuda
+}  // namespace engine
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_ENGINE_CUDA_OPERATION_MAKE_NETWORK_HPP
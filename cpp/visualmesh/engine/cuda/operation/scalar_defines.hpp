@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_ENGINE_CUDA_OPERATION_SCALAR_DEFINES_HPP
+#define VISUALMESH_ENGINE_CUDA_OPERATION_SCALAR_DEFINES_HPP
+
+namespace visualmesh {
+namespace engine {
+    namespace cuda {
+        namespace operation {
+
+            /**
+             * @brief Get the scalar typedefs for single precision floating point
+             *
+             * @return a string containing the typedefs that are needed if the Scalar type is float
+             */
+            inline constexpr auto get_scalar_defines(float /*scalar_type*/) {
+                return "typedef float Scalar;\n"
+                       "typedef float2 Scalar2;\n"
+                       "typedef float3 Scalar3;\n"
+                       "typedef float4 Scalar4;\n";
+            }
+
+            /**
+             * @brief Get the scalar typedefs for double precision floating point
+             *
+             * @return a string containing the typedefs that are needed if the Scalar type is double
+             */
+            inline constexpr auto get_scalar_defines(double /*scalar_type*/) {
+                return "typedef double Scalar;\n"
+                       "typedef double2 Scalar2;\n"
+                       "typedef double3 Scalar3;\n"
+                       "typedef double4 Scalar4;\n";
+            }
+
+        }  // namespace operation
+    }      // namespace cuda
+}  // namespace engine
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_ENGINE_CUDA_OPERATION_SCALAR_DEFINES_HPP
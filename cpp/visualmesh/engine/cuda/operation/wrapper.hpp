@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_ENGINE_CUDA_OPERATION_WRAPPER_HPP
+#define VISUALMESH_ENGINE_CUDA_OPERATION_WRAPPER_HPP
+
+#include <cuda.h>
+#include <nvrtc.h>
+
+#include <memory>
+#include <string>
+#include <system_error>
+#include <type_traits>
+
+#include "cuda_error_category.hpp"
+
+namespace visualmesh {
+namespace engine {
+    namespace cuda {
+
+        /**
+         * @brief A shorthand function to throw a CUDA system error if the error code is not success
+         *
+         * @param code  the error code to check and throw
+         * @param msg   the message to attach to the exception if it is thrown
+         */
+        inline void throw_cuda_error(const CUresult& code, const std::string& msg) {
+            if (code != CUDA_SUCCESS) { throw std::system_error(code, operation::cuda_error_category(), msg); }
+        }
+
+        /**
+         * @brief A shorthand function to throw an NVRTC system error if the error code is not success
+         *
+         * @param code  the error code to check and throw
+         * @param msg   the message to attach to the exception if it is thrown
+         */
+        inline void throw_nvrtc_error(const nvrtcResult& code, const std::string& msg) {
+            if (code != NVRTC_SUCCESS) { throw std::system_error(code, operation::nvrtc_error_category(), msg); }
+        }
+
+        /**
+         * @brief Makes a context current on the calling thread until the end of the scope
+         *
+         * @details
+         *  The driver API works on whichever context is current on the calling thread, so every call into the engine
+         *  and every release of a driver object pushes the engine's context first. Releases can happen on any thread
+         *  and mustn't throw, so a context that can't be made current leaves the scope inactive instead.
+         */
+        class ScopedContext {
+        public:
+            explicit ScopedContext(CUcontext context) : active(::cuCtxPushCurrent(context) == CUDA_SUCCESS) {}
+            ScopedContext(const ScopedContext&) = delete;
+            ScopedContext(ScopedContext&&)      = delete;
+            ScopedContext& operator=(const ScopedContext&) = delete;
+            ScopedContext& operator=(ScopedContext&&) = delete;
+            ~ScopedContext() {
+                CUcontext popped = nullptr;
+                if (active) { ::cuCtxPopCurrent(&popped); }
+            }
+
+            /// @return if the context was made current
+            bool ok() const {
+                return active;
+            }
+
+        private:
+            /// If the context was pushed and so has to be popped again
+            bool active;
+        };
+
+        namespace cu {
+            template <typename T>
+            struct cuda_wrapper : public std::shared_ptr<std::remove_pointer_t<T>> {
+                using std::shared_ptr<std::remove_pointer_t<T>>::shared_ptr;
+
+                operator T() const {
+                    return this->get();
+                }
+            };
+
+            /// Driver handles that are integers rather than pointers, such as device memory and texture objects
+            template <typename T>
+            struct handle_wrapper : public std::shared_ptr<void> {
+                handle_wrapper() = default;
+
+                template <typename Deleter>
+                handle_wrapper(const T& handle, Deleter deleter)
+                  : std::shared_ptr<void>(reinterpret_cast<void*>(handle),
+                                          [deleter](void* ptr) { deleter(reinterpret_cast<T>(ptr)); }) {}
+
+                operator T() const {
+                    return reinterpret_cast<T>(this->get());
+                }
+            };
+
+            using context       = cuda_wrapper<::CUcontext>;
+            using graph         = cuda_wrapper<::CUgraph>;
+            using graph_exec    = cuda_wrapper<::CUgraphExec>;
+            using host_memory   = cuda_wrapper<void*>;
+            using module        = cuda_wrapper<::CUmodule>;
+            using stream        = cuda_wrapper<::CUstream>;
+            using device_memory = handle_wrapper<::CUdeviceptr>;
+            using texture       = handle_wrapper<::CUtexObject>;
+        }  // namespace cu
+
+    }  // namespace cuda
+}  // namespace engine
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_ENGINE_CUDA_OPERATION_WRAPPER_HPP
@@ -0,0 +1,282 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef VISUALMESH_ENGINE_OPENCL_CLASSIFICATION_FUTURE_HPP
+#define VISUALMESH_ENGINE_OPENCL_CLASSIFICATION_FUTURE_HPP
+
+// If OpenCL is disabled then don't provide this file
+#if !defined(VISUALMESH_DISABLE_OPENCL)
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "visualmesh/classified_mesh.hpp"
+#include "visualmesh/engine/opencl/operation/wrapper.hpp"
+
+namespace visualmesh {
+namespace engine {
+    namespace opencl {
+
+        /**
+         * @brief A handle to a classification that has been submitted to an OpenCL device but may not have finished
+         *
+         * @details
+         *  The host buffers that the device is asynchronously reading the results into are owned by this object, so it
+         *  can not be copied. If it is destroyed before the classification has finished it will block until the device
+         *  has finished writing into them.
+         *
+         * @tparam Scalar       the scalar type used for calculations and storage (normally one of float or double)
+         * @tparam N_NEIGHBOURS the number of neighbours that each point has
+         */
+        template <typename Scalar, int N_NEIGHBOURS>
+        class ClassificationFuture {
+        public:
+            /**
+             * @brief Construct a future that is already complete and holds an empty classified mesh
+             */
+            ClassificationFuture() = default;
+
+            /**
+             * @brief Construct a future that completes when the provided events have completed
+             *
+             * @param mesh   the classified mesh whose buffers are being filled by the device
+             * @param events the events that must complete before the classified mesh is available
+             */
+            ClassificationFuture(ClassifiedMesh<Scalar, N_NEIGHBOURS>&& mesh, const std::array<cl::event, 2>& events)
+              : mesh(std::move(mesh)), events(events) {}
+
+            ClassificationFuture(const ClassificationFuture&) = delete;
+            ClassificationFuture& operator=(const ClassificationFuture&) = delete;
+
+            ClassificationFuture(ClassificationFuture&& other) noexcept
+              : mesh(std::move(other.mesh)), events(std::move(other.events)) {
+                other.events = {};
+            }
+
+            ClassificationFuture& operator=(ClassificationFuture&& other) noexcept {
+                if (this != &other) {
+                    block();
+                    mesh         = std::move(other.mesh);
+                    events       = std::move(other.events);
+                    other.events = {};
+                }
+                return *this;
+            }
+
+            ~ClassificationFuture() {
+                // Errors can't be thrown from here, but the buffers still must not be freed while the device writes
+                block();
+            }
+
+            /**
+             * @brief Check if the device has finished the classification without blocking
+             *
+             * @return true if a call to get() will not block
+             */
+            bool ready() const {
+                // Negative statuses are errors which wait() will report
+                return status() <= CL_COMPLETE;
+            }
+
+            /**
+             * @brief Block until the device has finished the classification
+             *
+             * @throws std::system_error if waiting failed or a command of the classification failed on the device
+             */
+            void wait() const {
+                const cl_int error = block();
+                // A command that failed gives a more useful error than the generic one from waiting on it
+                throw_cl_error(std::min(status(), CL_COMPLETE), "Error running a classification");
+                throw_cl_error(error, "Error waiting for a classification");
+            }
+
+            /**
+             * @brief Call a function once the device has finished the classification, without blocking
+             *
+             * @details
+             *  The function is called on a thread of the OpenCL runtime, which must not be blocked by waiting on
+             *  OpenCL, or immediately on this thread if there is nothing to wait for. It may be called before this
+             *  returns so nothing in this future is used after the last callback is registered.
+             *
+             * @param callback the function to call
+             * @param data     the argument to call it with
+             */
+            void on_complete(void (*callback)(void*), void* data) const {
+                std::array<cl_event, 2> pending{};
+                int n_pending = 0;
+                for (const auto& event : events) {
+                    if (event) { pending[n_pending++] = event; }
+                }
+                if (n_pending == 0) {
+                    callback(data);
+                    return;
+                }
+
+                auto* completion = new Completion{{n_pending}, {callback}, data};
+                for (int i = 0; i < n_pending; ++i) {
+                    cl_int error = ::clSetEventCallback(pending[i], CL_COMPLETE, &Completion::complete, completion);
+                    if (error != CL_SUCCESS) {
+                        // The callbacks that were registered still run but must not call back after this has thrown
+                        completion->callback.store(nullptr);
+                        if (completion->remaining.fetch_sub(n_pending - i) == n_pending - i) { delete completion; }
+                        throw_cl_error(error, "Error setting the callback for a classification");
+                    }
+                }
+            }
+
+            /**
+             * @brief Block until the classification has finished and take the classified mesh out of this future
+             *
+             * @return the classified mesh for the submitted frame
+             */
+            ClassifiedMesh<Scalar, N_NEIGHBOURS> get() {
+                wait();
+                events = {};
+                return std::move(mesh);
+            }
+
+            /**
+             * @brief Take the classified mesh out of this future without blocking once the device has finished it
+             *
+             * @details
+             *  Unlike get() this never waits on OpenCL, so it can be called from the thread of the OpenCL runtime that
+             *  on_complete calls back on. It must only be called once the classification is ready.
+             *
+             * @return the classified mesh for the submitted frame
+             */
+            ClassifiedMesh<Scalar, N_NEIGHBOURS> take() {
+                const cl_int state = status();
+                if (state > CL_COMPLETE) {
+                    throw std::logic_error("A classification can't be taken before the device has finished it");
+                }
+
+                // Every command has finished with the buffers, so nothing is left for the destructor to wait on
+                events = {};
+                throw_cl_error(state, "Error running a classification");
+                return std::move(mesh);
+            }
+
+        private:
+            /**
+             * @brief Block until the device has finished the classification without throwing if it failed
+             *
+             * @return the error from waiting on the events
+             */
+            cl_int block() const noexcept {
+                std::array<cl_event, 2> pending{};
+                cl_uint n_pending = 0;
+                for (const auto& event : events) {
+                    if (event) { pending[n_pending++] = event; }
+                }
+                return n_pending > 0 ? ::clWaitForEvents(n_pending, pending.data()) : CL_SUCCESS;
+            }
+
+            /**
+             * @brief Query the status of the commands without blocking
+             *
+             * @return the error of a command that failed, otherwise CL_COMPLETE if every command has finished or a
+             *         positive status while any are still running
+             */
+            cl_int status() const {
+                cl_int result = CL_COMPLETE;
+                for (const auto& event : events) {
+                    if (event) {
+                        cl_int status = CL_COMPLETE;
+                        throw_cl_error(::clGetEventInfo(event,
+                                                        CL_EVENT_COMMAND_EXECUTION_STATUS,
+                                                        sizeof(status),
+                                                        &status,
+                                                        nullptr),
+                                       "Error querying the status of a classification");
+                        if (status < CL_COMPLETE) { return status; }
+                        result = std::max(result, status);
+                    }
+                }
+                return result;
+            }
+
+            /// Counts the events still to complete before on_complete calls its function
+            struct Completion {
+                static void CL_CALLBACK complete(cl_event /*event*/, cl_int /*status*/, void* data) {
+                    auto* completion = static_cast<Completion*>(data);
+                    if (completion->remaining.fetch_sub(1) == 1) {
+                        auto* callback = completion->callback.load();
+                        if (callback != nullptr) { callback(completion->data); }
+                        delete completion;
+                    }
+                }
+
+                std::atomic<int> remaining;
+                /// Cleared if registering the callbacks failed, while the callbacks that were registered may be running
+                std::atomic<void (*)(void*)> callback;
+                void* data;
+            };
+
+            /// The classified mesh whose buffers are the destination of the pending device reads
+            ClassifiedMesh<Scalar, N_NEIGHBOURS> mesh;
+            /// The events for reading the pixel coordinates and classifications off the device
+            std::array<cl::event, 2> events;
+        };
+
+        /**
+         * @brief A classification that a coroutine can await, resuming once the device has finished it
+         *
+         * @details
+         *  The coroutine is resumed from an OpenCL event callback without any thread waiting for it, so it runs on a
+         *  thread of the OpenCL runtime. That thread must not block on OpenCL, so the coroutine should hand off to its
+         *  own executor before it submits more work or waits. This is not a coroutine type itself, so it works with
+         *  any coroutine handle that has from_address.
+         *
+         * @tparam Scalar       the scalar type used for calculations and storage (normally one of float or double)
+         * @tparam N_NEIGHBOURS the number of neighbours that each point has
+         */
+        template <typename Scalar, int N_NEIGHBOURS>
+        class ClassificationAwaitable {
+        public:
+            explicit ClassificationAwaitable(ClassificationFuture<Scalar, N_NEIGHBOURS>&& future)
+              : future(std::move(future)) {}
+
+            bool await_ready() const {
+                return future.ready();
+            }
+
+            template <typename Handle>
+            void await_suspend(Handle handle) const {
+                future.on_complete([](void* address) { Handle::from_address(address).resume(); }, handle.address());
+            }
+
+            ClassifiedMesh<Scalar, N_NEIGHBOURS> await_resume() {
+                // This may be on the thread of the OpenCL runtime, so the mesh is taken without waiting on the events
+                return future.take();
+            }
+
+        private:
+            /// The classification being awaited
+            ClassificationFuture<Scalar, N_NEIGHBOURS> future;
+        };
+
+    }  // namespace opencl
+}  // namespace engine
+}  // namespace visualmesh
+
+#endif  // !defined(VISUALMESH_DISABLE_OPENCL)
+#endif  // VISUALMESH_ENGINE_OPENCL_CLASSIFICATION_FUTURE_HPP
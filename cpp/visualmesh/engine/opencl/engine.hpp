@@ -21,32 +21,63 @@
 // If OpenCL is disabled then don't provide this file
 #if !defined(VISUALMESH_DISABLE_OPENCL)
 
+#include <chrono>
+#include <cmath>
 #include <iomanip>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <numeric>
 #include <sstream>
 #include <tuple>
 
+#include "visualmesh/batch_frame.hpp"
+#include "visualmesh/clusters.hpp"
+#include "visualmesh/compiled_network.hpp"
+#include "visualmesh/engine/opencl/classification_future.hpp"
+#include "visualmesh/engine/opencl/kernels/compact_mesh.cl.hpp"
+#include "visualmesh/engine/opencl/kernels/dense_layer.cl.hpp"
 #include "visualmesh/engine/opencl/kernels/load_image.cl.hpp"
+#include "visualmesh/engine/opencl/kernels/project_load_image.cl.hpp"
 #include "visualmesh/engine/opencl/kernels/project_equidistant.cl.hpp"
 #include "visualmesh/engine/opencl/kernels/project_equisolid.cl.hpp"
 #include "visualmesh/engine/opencl/kernels/project_rectilinear.cl.hpp"
+#include "visualmesh/engine/opencl/operation/autotune.hpp"
 #include "visualmesh/engine/opencl/operation/make_context.hpp"
 #include "visualmesh/engine/opencl/operation/make_network.hpp"
+#include "visualmesh/engine/opencl/operation/make_program.hpp"
 #include "visualmesh/engine/opencl/operation/make_queue.hpp"
 #include "visualmesh/engine/opencl/operation/opencl_error_category.hpp"
 #include "visualmesh/engine/opencl/operation/scalar_defines.hpp"
 #include "visualmesh/engine/opencl/operation/wrapper.hpp"
+#include "visualmesh/instrumentation.hpp"
+#include "visualmesh/lookup_cache.hpp"
 #include "visualmesh/mesh.hpp"
-#include "visualmesh/network_structure.hpp"
 #include "visualmesh/projected_mesh.hpp"
+#include "visualmesh/quantisation.hpp"
+#include "visualmesh/region.hpp"
+#include "visualmesh/thresholded_mesh.hpp"
+#include "visualmesh/utility/buffer_capacity.hpp"
+#include "visualmesh/utility/fourcc.hpp"
 #include "visualmesh/utility/math.hpp"
+#include "visualmesh/utility/object_pool.hpp"
 #include "visualmesh/utility/projection.hpp"
+#include "visualmesh/utility/range_lookup.hpp"
+#include "visualmesh/utility/residency_cache.hpp"
 #include "visualmesh/visualmesh.hpp"
 
 namespace visualmesh {
 namespace engine {
     namespace opencl {
 
+        /// Where the weights of the network are kept on the device
+        enum class WeightStorage {
+            /// Every weight is compiled into generated kernels for each convolution
+            INLINE,
+            /// The weights are uploaded to device buffers and a single generic kernel runs every layer
+            BUFFER,
+        };
+
         /**
          * @brief An OpenCL implementation of the visual mesh inference engine
          *
@@ -54,6 +85,8 @@ namespace engine {
          *  The OpenCL implementation is designed to be used for high performance inference. It is able to take
          *  advantage of either GPUs from Intel, AMD, ARM, NVIDIA etc as well as multithreaded CPU implementations.
          *  This allows it to be very flexible with its deployment on devices.
+         *  The program and the device copies of meshes are shared, while each call takes its own kernels and buffers
+         *  from a pool so a single engine can be used from several threads at once.
          *
          * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
          */
@@ -62,20 +95,73 @@ namespace engine {
         private:
             // OpenCL ::clSetKernelArg functions take the sizeof a pointer as their argument, this is correct
             static constexpr size_t MEM_SIZE = sizeof(cl_mem);
+            /// The number of outputs each work item of the tiled layer kernel accumulates at once
+            static constexpr int LAYER_TILE_OUTPUTS = 8;
+            /// The number of inputs of each point that the tiled layer kernel holds in local memory at once
+            static constexpr int LAYER_TILE_INPUTS = 16;
+            /// The stride between points in the local input block, padded to spread neighbouring points across banks
+            static constexpr int LAYER_TILE_STRIDE = LAYER_TILE_INPUTS + 1;
 
         public:
             /**
              * @brief Construct a new OpenCL Engine object
              *
-             * @param structure the network structure to use classification
+             * @param network         the network to use for classification, a NetworkStructure is compiled implicitly
+             * @param precision       the precision to execute the network with, either FULL or HALF. HALF needs a
+             *                        device that supports cl_khr_fp16
+             * @param cache_directory an existing directory to cache the compiled program in so later engines for the
+             *                        same network and device skip compiling it, or empty to always compile it
+             * @param storage         where the weights are kept on the device. Compiling them into the kernels is
+             *                        fastest for small networks, while keeping them in buffers compiles in the same
+             *                        time for any network and lets the weights be replaced with update_weights. Buffers
+             *                        can only be used at FULL precision
+             * @param device          the device to run on from operation::list_devices, or nullptr for the device with
+             *                        the most compute units
+             */
+            Engine(const CompiledNetwork<Scalar>& network = {},
+                   const Precision& precision             = Precision::FULL,
+                   const std::string& cache_directory     = "",
+                   const WeightStorage& storage           = WeightStorage::INLINE,
+                   cl_device_id device                    = nullptr)
+              : Engine(network, network_source(network, precision, storage), cache_directory, storage, device) {}
+
+            /**
+             * @brief Construct a new OpenCL Engine object that executes an 8 bit quantised network
+             *
+             * @param network         the quantised network to use for classification
+             * @param cache_directory an existing directory to cache the compiled program in so later engines for the
+             *                        same network and device skip compiling it, or empty to always compile it
+             * @param device          the device to run on from operation::list_devices, or nullptr for the device with
+             *                        the most compute units
+             */
+            explicit Engine(const QuantisedNetwork<Scalar>& network,
+                            const std::string& cache_directory = "",
+                            cl_device_id device                = nullptr)
+              : Engine(network, operation::make_network(network), cache_directory, WeightStorage::INLINE, device) {}
+
+        private:
+            /**
+             * @brief Construct a new OpenCL Engine object from the generated source for a network
+             *
+             * @tparam Network the type of network, either a CompiledNetwork or a QuantisedNetwork
+             *
+             * @param network         the network to use for classification
+             * @param network_source  the OpenCL source code for the network's kernels
+             * @param cache_directory the directory to cache the compiled program in, or empty to not cache it
+             * @param storage         where the weights are kept on the device
+             * @param device          the device to run on, or nullptr for the device with the most compute units
              */
-            Engine(const NetworkStructure<Scalar>& structure = {}) {
+            template <typename Network>
+            Engine(const Network& network,
+                   const std::string& network_source,
+                   const std::string& cache_directory,
+                   const WeightStorage& storage,
+                   cl_device_id device) {
 
                 // Create the OpenCL context and command queue
-                cl_int error              = CL_SUCCESS;
-                cl_device_id device       = nullptr;
-                std::tie(context, device) = operation::make_context();
+                std::tie(context, device) = operation::make_context(device);
                 queue                     = operation::make_queue(context, device);
+                transfer_queue            = queue;
 
                 // Get program sources (this does concatenated strings)
                 std::stringstream sources;
@@ -84,63 +170,36 @@ namespace engine {
                 sources << PROJECT_EQUISOLID_CL;
                 sources << PROJECT_RECTILINEAR_CL;
                 sources << LOAD_IMAGE_CL;
-                sources << operation::make_network(structure);
-
-                std::string source = sources.str();
-                const char* cstr   = source.c_str();
-                size_t csize       = source.size();
-
-                program =
-                  cl::program(::clCreateProgramWithSource(context, 1, &cstr, &csize, &error), ::clReleaseProgram);
-                throw_cl_error(error, "Error adding sources to OpenCL program");
-
-                // Compile the program
-                error = ::clBuildProgram(program,
-                                         0,
-                                         nullptr,
-                                         "-cl-single-precision-constant -cl-fast-relaxed-math -cl-mad-enable",
-                                         nullptr,
-                                         nullptr);
-                if (error != CL_SUCCESS) {
-                    // Get program build log
-                    size_t used = 0;
-                    ::clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, nullptr, &used);
-                    std::vector<char> log(used);
-                    ::clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, log.size(), log.data(), &used);
-
-                    // Throw an error with the build log
-                    throw_cl_error(error,
-                                   "Error building OpenCL program\n" + std::string(log.begin(), log.begin() + used));
-                }
-
-                project_rectilinear =
-                  cl::kernel(::clCreateKernel(program, "project_rectilinear", &error), ::clReleaseKernel);
-                throw_cl_error(error, "Error getting project_rectilinear kernel");
-                project_equidistant =
-                  cl::kernel(::clCreateKernel(program, "project_equidistant", &error), ::clReleaseKernel);
-                throw_cl_error(error, "Error getting project_equidistant kernel");
-                project_equisolid =
-                  cl::kernel(::clCreateKernel(program, "project_equisolid", &error), ::clReleaseKernel);
-                throw_cl_error(error, "Error getting project_equisolid kernel");
-                load_image = cl::kernel(::clCreateKernel(program, "load_image", &error), ::clReleaseKernel);
-                throw_cl_error(error, "Failed to create kernel load_image");
-
-                // Grab all the kernels that were generated
-                for (unsigned int i = 0; i < structure.size(); ++i) {
-                    std::string kernel       = "conv" + std::to_string(i);
-                    unsigned int output_size = structure[i].back().biases.size();
-
-                    cl::kernel k(::clCreateKernel(program, kernel.c_str(), &error), ::clReleaseKernel);
-                    throw_cl_error(error, "Failed to create kernel " + kernel);
-                    conv_layers.emplace_back(k, output_size);
-                }
-
-                // Work out what the widest network layer is
+                sources << PROJECT_LOAD_IMAGE_CL;
+                sources << COMPACT_MESH_CL;
+                sources << "#define LAYER_TILE_OUTPUTS " << LAYER_TILE_OUTPUTS << "\n";
+                sources << "#define LAYER_TILE_INPUTS " << LAYER_TILE_INPUTS << "\n";
+                sources << "#define LAYER_TILE_STRIDE " << LAYER_TILE_STRIDE << "\n";
+                sources << DENSE_LAYER_CL;
+                sources << network_source;
+
+                // Compile the program, or load it if it was compiled before
+                const std::string options = "-cl-single-precision-constant -cl-fast-relaxed-math -cl-mad-enable";
+                program = operation::make_program(context, device, sources.str(), options, cache_directory);
+
+                // GPUs gather the inputs of the layers into local memory as a workgroup, other devices don't benefit
+                cl_device_type device_type = 0;
+                ::clGetDeviceInfo(device, CL_DEVICE_TYPE, sizeof(device_type), &device_type, nullptr);
+                tiled_layers = (device_type & CL_DEVICE_TYPE_GPU) != 0;
+
+                // Work out the output width of each kernel and what the widest network layer is
                 max_width = 4;
-                for (const auto& k : conv_layers) {
-                    max_width = std::max(max_width, k.second);
+                if (storage == WeightStorage::BUFFER) { load_weights(network); }
+                else {
+                    for (unsigned int i = 0; i < network.size(); ++i) {
+                        conv_widths.push_back(network.back(i).output_dimensions);
+                        max_width = std::max(max_width, conv_widths.back());
+                    }
                 }
 
+                // Make the kernels for the first frame
+                Frame frame = make_frame();
+
                 // Function to get the preferred workgroup size for a kernel
                 auto workgroup_size_for_kernel = [&device](auto k) {
                     size_t t = 0;
@@ -151,15 +210,46 @@ namespace engine {
 
                 // Go through each of our kernels and see which is the largest preferred size
                 workgroup_size = 1;
-                workgroup_size = std::max(workgroup_size, workgroup_size_for_kernel(project_rectilinear));
-                workgroup_size = std::max(workgroup_size, workgroup_size_for_kernel(project_equisolid));
-                workgroup_size = std::max(workgroup_size, workgroup_size_for_kernel(project_equidistant));
-                workgroup_size = std::max(workgroup_size, workgroup_size_for_kernel(load_image));
-                for (const auto& k : conv_layers) {
+                workgroup_size = std::max(workgroup_size, workgroup_size_for_kernel(frame.project_rectilinear));
+                workgroup_size = std::max(workgroup_size, workgroup_size_for_kernel(frame.project_equisolid));
+                workgroup_size = std::max(workgroup_size, workgroup_size_for_kernel(frame.project_equidistant));
+                workgroup_size = std::max(workgroup_size, workgroup_size_for_kernel(frame.load_bayer_image));
+                workgroup_size = std::max(workgroup_size, workgroup_size_for_kernel(frame.load_yuv_image));
+                workgroup_size = std::max(workgroup_size, workgroup_size_for_kernel(frame.load_interpolated_image));
+                for (int i = 0; i < 3; ++i) {
+                    workgroup_size =
+                      std::max(workgroup_size, workgroup_size_for_kernel(frame.project_load_bayer_image[i]));
+                    workgroup_size =
+                      std::max(workgroup_size, workgroup_size_for_kernel(frame.project_load_yuv_image[i]));
+                    workgroup_size =
+                      std::max(workgroup_size, workgroup_size_for_kernel(frame.project_load_interpolated_image[i]));
+                }
+                for (const auto& k : frame.conv_layers) {
                     workgroup_size = std::max(workgroup_size, workgroup_size_for_kernel(k.first));
                 }
+                point_alignment = workgroup_size;
+
+                // The single dispatch runs one workgroup as large as the device allows, and by default is used while
+                // each of its threads has no more than a few points per convolution
+                if (frame.network) {
+                    network_local_size     = operation::local_size_candidates(frame.network, device).back();
+                    single_dispatch_points = int(4 * network_local_size);
+                }
+
+                // Use the workgroup sizes tuned for each convolution if they were cached for this program and device
+                network_neighbours = network.empty() ? 0 : network.layer(0, 0).input_dimensions / 4 - 1;
+                if (!cache_directory.empty()) {
+                    tuning_path = operation::tuning_cache_path(
+                      operation::program_cache_path(cache_directory, device, sources.str(), options));
+                    use_local_sizes(operation::load_local_sizes(tuning_path, frame.conv_layers.size()));
+                }
+
+                // Fill the pool with the frames that can be in flight
+                frames.put(std::make_unique<Frame>(std::move(frame)));
+                frames.reserve(max_in_flight, [this] { return make_frame(); });
             }
 
+        public:
             /**
              * @brief Projects a provided mesh to pixel coordinates
              *
@@ -175,34 +265,32 @@ namespace engine {
             inline ProjectedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> operator()(const Mesh<Scalar, Model>& mesh,
                                                                                  const mat4<Scalar>& Hoc,
                                                                                  const Lens<Scalar>& lens) const {
-                static constexpr int N_NEIGHBOURS = Model<Scalar>::N_NEIGHBOURS;
-
-                // Perform the projection
-                std::vector<std::array<int, N_NEIGHBOURS>> neighbourhood;
-                std::vector<int> indices;
-                cl::mem cl_pixels;
-                cl::event projected;
-                std::tie(neighbourhood, indices, cl_pixels, projected) = do_project(mesh, Hoc, lens);
-
-                // If we didn't get anything, nothing to return
-                if (indices.empty()) { return ProjectedMesh<Scalar, N_NEIGHBOURS>(); }
-
-                // Read the pixels off the buffer
-                std::vector<std::array<Scalar, 2>> pixels(indices.size());
-                std::array<cl_event, 1> events{{projected}};
-                cl_int error = ::clEnqueueReadBuffer(queue,
-                                                     cl_pixels,
-                                                     true,
-                                                     0,
-                                                     indices.size() * sizeof(std::array<Scalar, 2>),
-                                                     pixels.data(),
-                                                     events.size(),
-                                                     events.data(),
-                                                     nullptr);
-                throw_cl_error(error, "Failed reading projected pixels from the device");
+                return project(mesh, Hoc, lens, nullptr);
+            }
 
-                return ProjectedMesh<Scalar, N_NEIGHBOURS>{
-                  std::move(pixels), std::move(neighbourhood), std::move(indices)};
+            /**
+             * @brief Projects the part of a provided mesh that is inside a region of the image to pixel coordinates
+             *
+             * @details
+             *  Only the points in the region are projected, and the neighbours of a point that are outside of the
+             *  region are the null point the same as the neighbours that are off the screen. The region is always
+             *  looked up on the host, even if the lookup is normally done on the device.
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh   the mesh table that we are projecting to pixel coordinates
+             * @param Hoc    the homogenous transformation matrix from the camera to the observation plane
+             * @param lens   the lens parameters that describe the optics of the camera
+             * @param region the part of the image to project the mesh into
+             *
+             * @return a projected mesh of the points in the region
+             */
+            template <template <typename> class Model>
+            inline ProjectedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> operator()(const Mesh<Scalar, Model>& mesh,
+                                                                                 const mat4<Scalar>& Hoc,
+                                                                                 const Lens<Scalar>& lens,
+                                                                                 const Region<Scalar>& region) const {
+                return project(mesh, Hoc, lens, &region);
             }
 
             /**
@@ -242,186 +330,79 @@ namespace engine {
                                                                            const Lens<Scalar>& lens,
                                                                            const void* image,
                                                                            const uint32_t& format) const {
-                static constexpr int N_NEIGHBOURS = Model<Scalar>::N_NEIGHBOURS;
-                cl_int error                      = CL_SUCCESS;
-
-                // Grab the image memory from the cache
-                cl::mem cl_image = get_image_memory(lens.dimensions, format);
-
-                // Map our image into device memory
-                std::array<size_t, 3> origin = {{0, 0, 0}};
-                std::array<size_t, 3> region = {{size_t(lens.dimensions[0]), size_t(lens.dimensions[1]), 1}};
-
-                cl::event cl_image_loaded;
-                cl_event ev = nullptr;
-                error       = clEnqueueWriteImage(
-                  queue, cl_image, false, origin.data(), region.data(), 0, 0, image, 0, nullptr, &ev);
-                if (ev) { cl_image_loaded = cl::event(ev, ::clReleaseEvent); }
-                throw_cl_error(error, "Error mapping image onto device");
-
-                // Project our visual mesh
-                std::vector<std::array<int, N_NEIGHBOURS>> neighbourhood;
-                std::vector<int> indices;
-                cl::mem cl_pixels;
-                cl::event cl_pixels_loaded;
-                std::tie(neighbourhood, indices, cl_pixels, cl_pixels_loaded) = do_project(mesh, Hoc, lens);
-
-                // If there were no points, nothing to project
-                if (indices.empty()) { return ClassifiedMesh<Scalar, N_NEIGHBOURS>(); }
-
-                // This includes the offscreen point at the end
-                int n_points = neighbourhood.size();
-
-                // Get the neighbourhood memory from cache
-                cl::mem cl_neighbourhood = get_neighbourhood_memory(n_points, N_NEIGHBOURS);
-
-                // Upload the neighbourhood buffer
-                cl::event cl_neighbourhood_loaded;
-                ev    = nullptr;
-                error = ::clEnqueueWriteBuffer(queue,
-                                               cl_neighbourhood,
-                                               false,
-                                               0,
-                                               n_points * sizeof(std::array<int, N_NEIGHBOURS>),
-                                               neighbourhood.data(),
-                                               0,
-                                               nullptr,
-                                               &ev);
-                if (ev) { cl_neighbourhood_loaded = cl::event(ev, ::clReleaseEvent); }
-                throw_cl_error(error, "Error writing neighbourhood points to the device");
-
-                // Grab our ping pong buffers from the cache
-                auto cl_conv_buffers   = get_network_memory(max_width * n_points);
-                cl::mem cl_conv_input  = cl_conv_buffers[0];
-                cl::mem cl_conv_output = cl_conv_buffers[1];
-
-                // Read the pixels into the buffer
-                cl::event img_load_event;
-                cl::event network_complete;
-
-                cl_mem arg = nullptr;
-                arg        = cl_image;
-                throw_cl_error(::clSetKernelArg(load_image, 0, MEM_SIZE, &arg),
-                               "Error setting kernel argument 0 for image load kernel");
-                throw_cl_error(::clSetKernelArg(load_image, 1, sizeof(format), &format),
-                               "Error setting kernel argument 1 for image load kernel");
-                arg = cl_pixels;
-                throw_cl_error(::clSetKernelArg(load_image, 2, MEM_SIZE, &arg),
-                               "Error setting kernel argument 2 for image load kernel");
-                arg = cl_conv_input;
-                throw_cl_error(::clSetKernelArg(load_image, 3, MEM_SIZE, &arg),
-                               "Error setting kernel argument 3 for image load kernel");
-
-                // When calculating global_size we round to the nearest workgroup size
-                size_t offset                      = 0;
-                size_t global_size                 = (((n_points - 1) / workgroup_size) + 1) * workgroup_size;
-                std::array<cl_event, 2> event_list = {cl_pixels_loaded, cl_image_loaded};
-                ev                                 = nullptr;
-                error                              = ::clEnqueueNDRangeKernel(
-                  queue, load_image, 1, &offset, &global_size, &workgroup_size, 2, event_list.data(), &ev);
-                if (ev) { img_load_event = cl::event(ev, ::clReleaseEvent); }
-                throw_cl_error(error, "Error queueing the image load kernel");
-
-                // The offscreen point gets a value of -1.0 to make it easy to distinguish
-                std::array<cl_event, 1> img_loaded_events = {img_load_event};
-                cl::event offscreen_fill_event;
-                Scalar minus_one(-1.0);
-                ev    = nullptr;
-                error = ::clEnqueueFillBuffer(queue,
-                                              cl_conv_input,
-                                              &minus_one,
-                                              sizeof(Scalar),
-                                              (n_points - 1) * sizeof(std::array<Scalar, 4>),
-                                              sizeof(std::array<Scalar, 4>),
-                                              1,
-                                              img_loaded_events.data(),
-                                              &ev);
-                if (ev) { offscreen_fill_event = cl::event(ev, ::clReleaseEvent); }
-                throw_cl_error(error, "Error setting the offscreen pixel values");
-
-
-                // These events are required for our first convolution
-                std::vector<cl::event> events({img_load_event, offscreen_fill_event, cl_neighbourhood_loaded});
-
-                for (const auto& conv : conv_layers) {
-                    cl_mem arg = nullptr;
-                    arg        = cl_neighbourhood;
-                    throw_cl_error(::clSetKernelArg(conv.first, 0, MEM_SIZE, &arg),
-                                   "Error setting argument 0 for convolution kernel");
-                    arg = cl_conv_input;
-                    throw_cl_error(::clSetKernelArg(conv.first, 1, MEM_SIZE, &arg),
-                                   "Error setting argument 1 for convolution kernel");
-                    arg = cl_conv_output;
-                    throw_cl_error(::clSetKernelArg(conv.first, 2, MEM_SIZE, &arg),
-                                   "Error setting argument 2 for convolution kernel");
-
-                    // When calculating global_size we round to the nearest workgroup size
-                    size_t offset      = 0;
-                    size_t global_size = (((n_points - 1) / workgroup_size) + 1) * workgroup_size;
-                    cl::event event;
-                    ev = nullptr;
-                    std::vector<cl_event> cl_events(events.begin(), events.end());
-                    error = ::clEnqueueNDRangeKernel(queue,
-                                                     conv.first,
-                                                     1,
-                                                     &offset,
-                                                     &global_size,
-                                                     &workgroup_size,
-                                                     cl_events.size(),
-                                                     cl_events.data(),
-                                                     &ev);
-                    if (ev) { event = cl::event(ev, ::clReleaseEvent); }
-                    throw_cl_error(error, "Error queueing convolution kernel");
-
-                    // Convert our events into a vector of events and ping pong our buffers
-                    events           = std::vector<cl::event>({event});
-                    network_complete = event;
-                    std::swap(cl_conv_input, cl_conv_output);
-                }
-
-                // Read the pixel coordinates off the device
-                cl::event pixels_read;
-                ev = nullptr;
-                std::vector<std::array<Scalar, 2>> pixels(neighbourhood.size() - 1);
-                cl_event iev = cl_pixels_loaded;
-                error        = ::clEnqueueReadBuffer(queue,
-                                              cl_pixels,
-                                              false,
-                                              0,
-                                              pixels.size() * sizeof(std::array<Scalar, 2>),
-                                              pixels.data(),
-                                              1,
-                                              &iev,
-                                              &ev);
-                if (ev) { pixels_read = cl::event(ev, ::clReleaseEvent); }
-                throw_cl_error(error, "Error reading projected pixels");
-
-                // Read the classifications off the device (they'll be in input)
-                cl::event classes_read;
-                ev  = nullptr;
-                iev = network_complete;
-                std::vector<Scalar> classifications(neighbourhood.size() * conv_layers.back().second);
-                error = ::clEnqueueReadBuffer(queue,
-                                              cl_conv_input,
-                                              false,
-                                              0,
-                                              classifications.size() * sizeof(Scalar),
-                                              classifications.data(),
-                                              1,
-                                              &iev,
-                                              &ev);
-                if (ev) { classes_read = cl::event(ev, ::clReleaseEvent); }
-                throw_cl_error(error, "Error reading classified values");
-
-                // Flush the queue to ensure all the commands have been issued
-                ::clFlush(queue);
+                Profile profile(instrumentation.get());
+                auto classified =
+                  submit(mesh, Hoc, lens, image, format, profile, ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS>())
+                    .get();
+                profile.report();
+                return classified;
+            }
 
-                // Wait for the chain to finish up to where we care about it
-                std::array<cl_event, 2> end_events = {pixels_read, classes_read};
-                ::clWaitForEvents(2, end_events.data());
+            /**
+             * @brief Project and classify a mesh into a classified mesh owned by the caller, reusing its memory
+             *
+             * @details
+             *  The pixel coordinates and classifications are read off the device straight into the output's vectors,
+             *  which keep their capacity, so passing the same output every frame avoids allocating them again.
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh    the mesh table that we are projecting to pixel coordinates
+             * @param Hoc     the homogenous transformation matrix from the camera to the observation plane
+             * @param lens    the lens parameters that describe the optics of the camera
+             * @param image   the data that represents the image the network will run from
+             * @param format  the pixel format of this image as a fourcc code
+             * @param output  the classified mesh to write the result into
+             */
+            template <template <typename> class Model>
+            void operator()(const Mesh<Scalar, Model>& mesh,
+                            const mat4<Scalar>& Hoc,
+                            const Lens<Scalar>& lens,
+                            const void* image,
+                            const uint32_t& format,
+                            ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS>& output) const {
+                Profile profile(instrumentation.get());
+                output = submit(mesh, Hoc, lens, image, format, profile, std::move(output)).get();
+                profile.report();
+            }
 
-                return ClassifiedMesh<Scalar, N_NEIGHBOURS>{
-                  std::move(pixels), std::move(neighbourhood), std::move(indices), std::move(classifications)};
+            /**
+             * @brief Project and classify the part of a mesh that is inside a region of the image
+             *
+             * @details
+             *  Only the points in the region are projected and run through the network, and the neighbours of a point
+             *  that are outside of the region are the null point. The whole image is still uploaded to the device.
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh    the mesh table that we are projecting to pixel coordinates
+             * @param Hoc     the homogenous transformation matrix from the camera to the observation plane
+             * @param lens    the lens parameters that describe the optics of the camera
+             * @param region  the part of the image to classify
+             * @param image   the data that represents the image the network will run from
+             * @param format  the pixel format of this image as a fourcc code
+             *
+             * @return a classified mesh of the points in the region
+             */
+            template <template <typename> class Model>
+            ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> operator()(const Mesh<Scalar, Model>& mesh,
+                                                                           const mat4<Scalar>& Hoc,
+                                                                           const Lens<Scalar>& lens,
+                                                                           const Region<Scalar>& region,
+                                                                           const void* image,
+                                                                           const uint32_t& format) const {
+                Profile profile(instrumentation.get());
+                auto classified = submit(mesh,
+                                         Hoc,
+                                         lens,
+                                         image,
+                                         format,
+                                         profile,
+                                         ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS>(),
+                                         &region)
+                                    .get();
+                profile.report();
+                return classified;
             }
 
             /**
@@ -447,75 +428,2757 @@ namespace engine {
                 return operator()(mesh.height(Hoc[2][3]), Hoc, lens, image, format);
             }
 
-            void clear_cache() {
-                device_points_cache.clear();
-                indices_map_memory.memory         = nullptr;
-                indices_map_memory.n_points       = 0;
-                pixel_coordinates_memory.memory   = nullptr;
-                pixel_coordinates_memory.n_points = 0;
-                neighbourhood_memory.memory       = nullptr;
-                neighbourhood_memory.n_points     = 0;
-                network_memory.memory             = {nullptr, nullptr};
-                network_memory.n_points           = 0;
-                image_memory.memory               = nullptr;
-                image_memory.dimensions           = {0, 0};
-                image_memory.format               = 0;
+            /**
+             * @brief Queue the projection and classification of a mesh without waiting for the device to finish
+             *
+             * @details
+             *  Each submitted frame uses its own set of kernels and device buffers, so the host side work for the next
+             *  frame can overlap the device running this one. Once in_flight() frames are outstanding, submitting
+             *  another waits for the oldest of them to finish so its buffers can be reused. This can be called from
+             *  several threads at once, if more threads are submitting than there are sets of buffers more are made.
+             *  The image is read asynchronously, so it must remain valid until the returned future is ready.
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh    the mesh table that we are projecting to pixel coordinates
+             * @param Hoc     the homogenous transformation matrix from the camera to the observation plane
+             * @param lens    the lens parameters that describe the optics of the camera
+             * @param image   the data that represents the image the network will run from
+             * @param format  the pixel format of this image as a fourcc code
+             *
+             * @return a future that holds the classified mesh once the device has finished
+             */
+            template <template <typename> class Model>
+            ClassificationFuture<Scalar, Model<Scalar>::N_NEIGHBOURS> submit(const Mesh<Scalar, Model>& mesh,
+                                                                             const mat4<Scalar>& Hoc,
+                                                                             const Lens<Scalar>& lens,
+                                                                             const void* image,
+                                                                             const uint32_t& format) const {
+                return submit(mesh, Hoc, lens, image, format, ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS>());
             }
 
-        private:
+            /**
+             * @brief Queue the projection and classification of a mesh, reading the result into recycled storage
+             *
+             * @details
+             *  The same as submit, except the pixel coordinates and classifications are read into the vectors of a
+             *  classified mesh from an earlier frame, so a pool of them can be cycled without allocating every frame.
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh    the mesh table that we are projecting to pixel coordinates
+             * @param Hoc     the homogenous transformation matrix from the camera to the observation plane
+             * @param lens    the lens parameters that describe the optics of the camera
+             * @param image   the data that represents the image the network will run from
+             * @param format  the pixel format of this image as a fourcc code
+             * @param storage a classified mesh that is no longer needed, whose memory is used for the result
+             *
+             * @return a future that holds the classified mesh once the device has finished
+             */
             template <template <typename> class Model>
-            std::tuple<std::vector<std::array<int, Model<Scalar>::N_NEIGHBOURS>>, std::vector<int>, cl::mem, cl::event>
-              do_project(const Mesh<Scalar, Model>& mesh, const mat4<Scalar>& Hoc, const Lens<Scalar>& lens) const {
-                static constexpr int N_NEIGHBOURS = Model<Scalar>::N_NEIGHBOURS;
-
-                // Lookup the on screen ranges
-                auto ranges = mesh.lookup(Hoc, lens);
+            ClassificationFuture<Scalar, Model<Scalar>::N_NEIGHBOURS> submit(
+              const Mesh<Scalar, Model>& mesh,
+              const mat4<Scalar>& Hoc,
+              const Lens<Scalar>& lens,
+              const void* image,
+              const uint32_t& format,
+              ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS>&& storage) const {
+                // Frames that are submitted are not timed as nothing waits for them to finish
+                Profile profile(nullptr);
+                return submit(mesh, Hoc, lens, image, format, profile, std::move(storage));
+            }
 
-                // Reused variables
-                cl_int error = 0;
-                cl_event ev  = nullptr;
+            /**
+             * @brief Queue the projection and classification of a mesh without waiting for the device to finish.
+             * This version takes an aggregate VisualMesh object
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh    the mesh table that we are projecting to pixel coordinates
+             * @param Hoc     the homogenous transformation matrix from the camera to the observation plane
+             * @param lens    the lens parameters that describe the optics of the camera
+             * @param image   the data that represents the image the network will run from
+             * @param format  the pixel format of this image as a fourcc code
+             *
+             * @return a classified mesh for the provided arguments
+             */
+            template <template <typename> class Model>
+            ClassificationFuture<Scalar, Model<Scalar>::N_NEIGHBOURS> submit(const VisualMesh<Scalar, Model>& mesh,
+                                                                             const mat4<Scalar>& Hoc,
+                                                                             const Lens<Scalar>& lens,
+                                                                             const void* image,
+                                                                             const uint32_t& format) const {
+                return submit(mesh.height(Hoc[2][3]), Hoc, lens, image, format);
+            }
 
-                // Pack Rco into a Scalar16
-                // clang-format off
-                std::array<Scalar, 16> Rco{{
-                    Hoc[0][0],     Hoc[1][0],   Hoc[2][0], Scalar(0.0),
-                    Hoc[0][1],     Hoc[1][1],   Hoc[2][1], Scalar(0.0),
-                    Hoc[0][2],     Hoc[1][2],   Hoc[2][2], Scalar(0.0),
-                    Scalar(0.0), Scalar(0.0), Scalar(0.0), Scalar(1.0)
-                }};
-                // clang-format on
+            /**
+             * @brief Project and classify a mesh, awaiting the result from a coroutine without blocking a thread
+             *
+             * @details
+             *  The classification is submitted straight away like submit, and awaiting it suspends the coroutine until
+             *  an event callback reports the device has finished. Any number can be outstanding without a thread each.
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh    the mesh table that we are projecting to pixel coordinates
+             * @param Hoc     the homogenous transformation matrix from the camera to the observation plane
+             * @param lens    the lens parameters that describe the optics of the camera
+             * @param image   the data that represents the image the network will run from
+             * @param format  the pixel format of this image as a fourcc code
+             * @param storage a classified mesh whose pixel coordinate and classification memory is reused
+             *
+             * @return an awaitable that gives the classified mesh once the device has finished
+             */
+            template <template <typename> class Model>
+            ClassificationAwaitable<Scalar, Model<Scalar>::N_NEIGHBOURS> classify_async(
+              const Mesh<Scalar, Model>& mesh,
+              const mat4<Scalar>& Hoc,
+              const Lens<Scalar>& lens,
+              const void* image,
+              const uint32_t& format,
+              ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS>&& storage = {}) const {
+                return ClassificationAwaitable<Scalar, Model<Scalar>::N_NEIGHBOURS>(
+                  submit(mesh, Hoc, lens, image, format, std::move(storage)));
+            }
+
+            /**
+             * @brief Project and classify the closest mesh of an aggregate VisualMesh object, awaiting the result from
+             * a coroutine without blocking a thread
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh    the mesh table that we are projecting to pixel coordinates
+             * @param Hoc     the homogenous transformation matrix from the camera to the observation plane
+             * @param lens    the lens parameters that describe the optics of the camera
+             * @param image   the data that represents the image the network will run from
+             * @param format  the pixel format of this image as a fourcc code
+             *
+             * @return an awaitable that gives the classified mesh once the device has finished
+             */
+            template <template <typename> class Model>
+            ClassificationAwaitable<Scalar, Model<Scalar>::N_NEIGHBOURS> classify_async(
+              const VisualMesh<Scalar, Model>& mesh,
+              const mat4<Scalar>& Hoc,
+              const Lens<Scalar>& lens,
+              const void* image,
+              const uint32_t& format) const {
+                return classify_async(mesh.height(Hoc[2][3]), Hoc, lens, image, format);
+            }
+
+            /**
+             * @brief Project and classify a mesh, reading back only the points whose score for a class passes a
+             * threshold
+             *
+             * @details
+             *  The points are thresholded and packed together on the device, so only the ones that passed are read
+             *  back rather than every point on the screen. When the points on the screen are found on the device their
+             *  graph is also never read back. This blocks until the device has finished.
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh      the mesh table that we are projecting to pixel coordinates
+             * @param Hoc       the homogenous transformation matrix from the camera to the observation plane
+             * @param lens      the lens parameters that describe the optics of the camera
+             * @param image     the data that represents the image the network will run from
+             * @param format    the pixel format of this image as a fourcc code
+             * @param cls       the index of the class in the output of the network to threshold on
+             * @param min_score the lowest score for the class that a point can have and be kept
+             *
+             * @return the points that passed the threshold with the scores of all their classes
+             */
+            template <template <typename> class Model>
+            ThresholdedMesh<Scalar> threshold(const Mesh<Scalar, Model>& mesh,
+                                              const mat4<Scalar>& Hoc,
+                                              const Lens<Scalar>& lens,
+                                              const void* image,
+                                              const uint32_t& format,
+                                              const int& cls,
+                                              const Scalar& min_score) const {
+                return select_points(mesh, Hoc, lens, image, format, cls, min_score, nullptr);
+            }
+
+            /**
+             * @brief Project and classify a mesh, reading back only the points whose score for a class passes a
+             * threshold. This version takes an aggregate VisualMesh object
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh      the mesh table that we are projecting to pixel coordinates
+             * @param Hoc       the homogenous transformation matrix from the camera to the observation plane
+             * @param lens      the lens parameters that describe the optics of the camera
+             * @param image     the data that represents the image the network will run from
+             * @param format    the pixel format of this image as a fourcc code
+             * @param cls       the index of the class in the output of the network to threshold on
+             * @param min_score the lowest score for the class that a point can have and be kept
+             *
+             * @return the points that passed the threshold with the scores of all their classes
+             */
+            template <template <typename> class Model>
+            ThresholdedMesh<Scalar> threshold(const VisualMesh<Scalar, Model>& mesh,
+                                              const mat4<Scalar>& Hoc,
+                                              const Lens<Scalar>& lens,
+                                              const void* image,
+                                              const uint32_t& format,
+                                              const int& cls,
+                                              const Scalar& min_score) const {
+                return threshold(mesh.height(Hoc[2][3]), Hoc, lens, image, format, cls, min_score);
+            }
+
+            /**
+             * @brief Project and classify a mesh, and find the clusters of connected points whose score for a class
+             * passes a threshold
+             *
+             * @details
+             *  The points are thresholded and their connected components labelled on the device using the graph that
+             *  is already there, so only the points that passed and their labels are read back. The clusters are
+             *  then measured on the host. This blocks until the device has finished.
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh       the mesh table that we are projecting to pixel coordinates
+             * @param Hoc        the homogenous transformation matrix from the camera to the observation plane
+             * @param lens       the lens parameters that describe the optics of the camera
+             * @param image      the data that represents the image the network will run from
+             * @param format     the pixel format of this image as a fourcc code
+             * @param cls        the index of the class in the output of the network to threshold on
+             * @param min_score  the lowest score for the class that a point can have and be in a cluster
+             * @param min_points clusters with fewer points than this are dropped
+             *
+             * @return the clusters, in the order their first point is on the screen
+             */
+            template <template <typename> class Model>
+            std::vector<Cluster<Scalar>> cluster(const Mesh<Scalar, Model>& mesh,
+                                                 const mat4<Scalar>& Hoc,
+                                                 const Lens<Scalar>& lens,
+                                                 const void* image,
+                                                 const uint32_t& format,
+                                                 const int& cls,
+                                                 const Scalar& min_score,
+                                                 const std::size_t& min_points = 1) const {
+                std::vector<int> labels;
+                auto selected = select_points(mesh, Hoc, lens, image, format, cls, min_score, &labels);
+                return gather_clusters(mesh, selected.pixel_coordinates, selected.global_indices, labels, min_points);
+            }
+
+            /**
+             * @brief Project and classify a mesh, and find the clusters of connected points whose score for a class
+             * passes a threshold. This version takes an aggregate VisualMesh object
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh       the mesh table that we are projecting to pixel coordinates
+             * @param Hoc        the homogenous transformation matrix from the camera to the observation plane
+             * @param lens       the lens parameters that describe the optics of the camera
+             * @param image      the data that represents the image the network will run from
+             * @param format     the pixel format of this image as a fourcc code
+             * @param cls        the index of the class in the output of the network to threshold on
+             * @param min_score  the lowest score for the class that a point can have and be in a cluster
+             * @param min_points clusters with fewer points than this are dropped
+             *
+             * @return the clusters, in the order their first point is on the screen
+             */
+            template <template <typename> class Model>
+            std::vector<Cluster<Scalar>> cluster(const VisualMesh<Scalar, Model>& mesh,
+                                                 const mat4<Scalar>& Hoc,
+                                                 const Lens<Scalar>& lens,
+                                                 const void* image,
+                                                 const uint32_t& format,
+                                                 const int& cls,
+                                                 const Scalar& min_score,
+                                                 const std::size_t& min_points = 1) const {
+                return cluster(mesh.height(Hoc[2][3]), Hoc, lens, image, format, cls, min_score, min_points);
+            }
+
+            /**
+             * @brief Project and classify a batch of frames, blocking until the device has finished
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param batch the frames to classify
+             *
+             * @return a classified mesh for each frame in the batch, in the same order
+             */
+            template <template <typename> class Model>
+            std::vector<ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS>> operator()(
+              const std::vector<BatchFrame<Scalar, Model>>& batch) const {
+                auto futures = submit(batch);
+                std::vector<ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS>> results;
+                results.reserve(futures.size());
+                for (auto& future : futures) {
+                    results.push_back(future.get());
+                }
+                return results;
+            }
+
+            /**
+             * @brief Queue the projection and classification of a batch of frames without waiting for the device
+             *
+             * @details
+             *  The points of every frame are concatenated into one set of device buffers, each frame padded to a
+             *  multiple of the workgroup size and keeping its own offscreen point. The projection and image load are
+             *  queued once per frame at that frame's offset while each convolution is queued once for the whole batch,
+             *  which amortises the launch overhead of the network over all the frames. The images are read
+             *  asynchronously, so they must remain valid until all the returned futures are ready.
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param batch the frames to classify
+             *
+             * @return a future for the classified mesh of each frame in the batch, in the same order
+             */
+            template <template <typename> class Model>
+            std::vector<ClassificationFuture<Scalar, Model<Scalar>::N_NEIGHBOURS>> submit(
+              const std::vector<BatchFrame<Scalar, Model>>& batch) const {
+                static constexpr int N_NEIGHBOURS = Model<Scalar>::N_NEIGHBOURS;
+                cl_int error                      = CL_SUCCESS;
+                cl_event ev                       = nullptr;
+
+                // Do all the host side work first, the device has nothing to do until we know the layout
+                std::vector<std::vector<int>> indices;
+                std::vector<std::vector<std::array<int, N_NEIGHBOURS>>> neighbourhoods;
+                std::vector<size_t> offsets;
+                indices.reserve(batch.size());
+                neighbourhoods.reserve(batch.size());
+                offsets.reserve(batch.size() + 1);
+                size_t n_points = 0;
+                for (const auto& f : batch) {
+                    RangeLookup remap;
+                    indices.push_back(lookup_indices(*f.mesh, f.Hoc, f.lens, remap));
+                    neighbourhoods.emplace_back();
+                    offsets.push_back(n_points);
+                    // Frames with nothing on screen take no space, otherwise they are padded to a workgroup multiple
+                    if (!indices.back().empty()) {
+                        neighbourhoods.back() = build_neighbourhood(*f.mesh, indices.back(), remap);
+                        n_points += ((neighbourhoods.back().size() - 1) / workgroup_size + 1) * workgroup_size;
+                    }
+                }
+                offsets.push_back(n_points);
+
+                std::vector<ClassificationFuture<Scalar, N_NEIGHBOURS>> futures(batch.size());
+                if (n_points == 0) { return futures; }
+
+                // Take the next set of buffers, waiting for whatever frame was last using them
+                auto lease   = acquire_frame();
+                Frame& frame = *lease;
+
+                // Concatenate the indices and neighbourhoods into the frame so they live until the uploads finish
+                // Padding points project the first point of the mesh and only connect to their frame's offscreen point
+                frame.host_indices.assign(n_points, 0);
+                frame.host_neighbourhood.resize(n_points * N_NEIGHBOURS);
+                for (unsigned int i = 0; i < batch.size(); ++i) {
+                    std::copy(indices[i].begin(), indices[i].end(), std::next(frame.host_indices.begin(), offsets[i]));
+                    const int o = offsets[i];
+                    for (size_t j = offsets[i]; j < offsets[i + 1]; ++j) {
+                        const size_t local = std::min(j - offsets[i], indices[i].size());
+                        for (int k = 0; k < N_NEIGHBOURS; ++k) {
+                            frame.host_neighbourhood[j * N_NEIGHBOURS + k] = neighbourhoods[i][local][k] + o;
+                        }
+                    }
+                }
+
+                // Get the memory for the whole batch
+                cl::mem cl_indices       = get_indices_map_memory(frame, n_points);
+                cl::mem cl_pixels        = get_pixel_coordinates_memory(frame, n_points);
+                cl::mem cl_neighbourhood = get_neighbourhood_memory(frame, n_points, N_NEIGHBOURS);
+                auto cl_conv_buffers     = get_network_memory(frame, max_width * n_points);
+
+                // Upload the indices and the neighbourhood
+                cl::event cl_indices_loaded;
+                ev    = nullptr;
+                error = ::clEnqueueWriteBuffer(transfer_queue,
+                                               cl_indices,
+                                               false,
+                                               0,
+                                               frame.host_indices.size() * sizeof(cl_int),
+                                               frame.host_indices.data(),
+                                               0,
+                                               nullptr,
+                                               &ev);
+                if (ev) { cl_indices_loaded = cl::event(ev, ::clReleaseEvent); }
+                throw_cl_error(error, "Error uploading indices_map to device");
+
+                cl::event cl_neighbourhood_loaded;
+                ev    = nullptr;
+                error = ::clEnqueueWriteBuffer(transfer_queue,
+                                               cl_neighbourhood,
+                                               false,
+                                               0,
+                                               frame.host_neighbourhood.size() * sizeof(cl_int),
+                                               frame.host_neighbourhood.data(),
+                                               0,
+                                               nullptr,
+                                               &ev);
+                if (ev) { cl_neighbourhood_loaded = cl::event(ev, ::clReleaseEvent); }
+                throw_cl_error(error, "Error writing neighbourhood points to the device");
+
+                // Project and load the image of each frame at its offset
+                std::vector<cl::event> projected(batch.size());
+                std::vector<cl::event> events({cl_neighbourhood_loaded});
+                for (unsigned int i = 0; i < batch.size(); ++i) {
+                    if (indices[i].empty()) { continue; }
+                    const auto& f = batch[i];
+
+                    // Get our image onto the device
+                    cl::mem cl_image;
+                    cl::event cl_image_loaded;
+                    std::tie(cl_image, cl_image_loaded) = enqueue_image(frame, i, f.image, f.lens.dimensions, f.format);
+
+                    cl::event offscreen_fill_event;
+                    std::tie(projected[i], offscreen_fill_event) =
+                      enqueue_project_load_image(frame,
+                                                 get_device_points(*f.mesh),
+                                                 cl_indices,
+                                                 cl_pixels,
+                                                 f.Hoc,
+                                                 f.lens,
+                                                 cl_image,
+                                                 f.format,
+                                                 cl_conv_buffers[0],
+                                                 offsets[i],
+                                                 offsets[i + 1] - offsets[i],
+                                                 offsets[i] + indices[i].size(),
+                                                 {cl_indices_loaded, cl_image_loaded});
+                    events.push_back(projected[i]);
+                    events.push_back(offscreen_fill_event);
+                }
+
+                // Run each convolution once for the whole batch
+                cl::event network_complete;
+                cl::mem cl_classifications;
+                Profile profile(nullptr);
+                std::tie(network_complete, cl_classifications) = enqueue_network(
+                  frame, cl_neighbourhood, cl_conv_buffers[0], cl_conv_buffers[1], n_points, events, profile);
+                const size_t width = frame.conv_layers.back().second;
+
+                // Read each frame's pixel coordinates and classifications off the device
+                frame.complete.clear();
+                for (unsigned int i = 0; i < batch.size(); ++i) {
+                    if (indices[i].empty()) { continue; }
+
+                    cl::event pixels_read;
+                    ev = nullptr;
+                    std::vector<std::array<Scalar, 2>> pixels(indices[i].size());
+                    cl_event iev = projected[i];
+                    error        = ::clEnqueueReadBuffer(transfer_queue,
+                                                  cl_pixels,
+                                                  false,
+                                                  offsets[i] * sizeof(std::array<Scalar, 2>),
+                                                  pixels.size() * sizeof(std::array<Scalar, 2>),
+                                                  pixels.data(),
+                                                  1,
+                                                  &iev,
+                                                  &ev);
+                    if (ev) { pixels_read = cl::event(ev, ::clReleaseEvent); }
+                    throw_cl_error(error, "Error reading projected pixels");
+
+                    cl::event classes_read;
+                    ev  = nullptr;
+                    iev = network_complete;
+                    std::vector<Scalar> classifications(neighbourhoods[i].size() * width);
+                    error = ::clEnqueueReadBuffer(transfer_queue,
+                                                  cl_classifications,
+                                                  false,
+                                                  offsets[i] * width * sizeof(Scalar),
+                                                  classifications.size() * sizeof(Scalar),
+                                                  classifications.data(),
+                                                  1,
+                                                  &iev,
+                                                  &ev);
+                    if (ev) { classes_read = cl::event(ev, ::clReleaseEvent); }
+                    throw_cl_error(error, "Error reading classified values");
+
+                    frame.complete.push_back(pixels_read);
+                    frame.complete.push_back(classes_read);
+                    futures[i] = ClassificationFuture<Scalar, N_NEIGHBOURS>(
+                      ClassifiedMesh<Scalar, N_NEIGHBOURS>{std::move(pixels),
+                                                           std::move(neighbourhoods[i]),
+                                                           std::move(indices[i]),
+                                                           std::move(classifications)},
+                      {{pixels_read, classes_read}});
+                }
+
+                // Flush the queue to ensure all the commands have been issued
+                flush();
+
+                return futures;
+            }
+
+            /**
+             * @brief Set how many submitted frames may be in flight on the device at once. Each one holds its own set
+             * of device buffers, so 2 gives double buffering and 3 triple buffering.
+             *
+             * @details
+             *  This releases the buffers of every frame, it must not be called while another thread is using the engine
+             *
+             * @param depth the maximum number of frames that may be in flight (at least 1)
+             */
+            void in_flight(const unsigned int& depth) {
+                if (depth == 0) { throw std::invalid_argument("At least one frame must be able to be in flight"); }
+                max_in_flight = depth;
+                clear_cache();
+            }
+
+            /**
+             * @brief Get how many submitted frames may be in flight on the device at once
+             *
+             * @return the maximum number of frames that may be in flight
+             */
+            unsigned int in_flight() const {
+                return max_in_flight;
+            }
+
+            /**
+             * @brief Move the uploads and downloads of each frame onto their own command queue
+             *
+             * @details
+             *  The engine's queue already runs commands out of order when the device supports it, however many devices
+             *  ignore that and run them in order. With a separate transfer queue those devices can still copy the
+             *  image and graph of the next frame in while the network of the previous frame is running. This waits for
+             *  everything that has been queued, it must not be called while another thread is using the engine.
+             *
+             * @param enabled true to use a separate queue for transfers, false to run everything on a single queue
+             */
+            void separate_transfers(const bool& enabled) {
+                throw_cl_error(::clFinish(queue), "Error waiting for the queued frames to finish");
+                throw_cl_error(::clFinish(transfer_queue), "Error waiting for the queued transfers to finish");
+                if (!enabled) { transfer_queue = queue; }
+                else if (transfer_queue == queue) {
+                    cl_device_id device = nullptr;
+                    throw_cl_error(::clGetCommandQueueInfo(queue, CL_QUEUE_DEVICE, sizeof(device), &device, nullptr),
+                                   "Error getting the device of the command queue");
+                    transfer_queue = operation::make_queue(context, device, instrumentation != nullptr);
+                }
+            }
+
+            /**
+             * @brief Get if the uploads and downloads of each frame are on their own command queue
+             *
+             * @return true if there is a separate queue for transfers
+             */
+            bool separate_transfers() const {
+                return transfer_queue != queue;
+            }
+
+            /**
+             * @brief Report the time spent in each stage of every frame
+             *
+             * @details
+             *  The lookup and graph building are timed on the host, and the uploads, projection, image load, each
+             *  convolutional group and the readbacks are timed by the device using event profiling. The command queues
+             *  are remade with profiling enabled, so this waits for everything that has been queued and must not be
+             *  called while another thread is using the engine. Only projections and single frame classifications are
+             *  reported, frames from submit are not timed as nothing waits for them to finish.
+             *
+             * @param instrumentation where to report every frame, or nullptr to stop timing
+             */
+            void instrument(std::shared_ptr<Instrumentation> instrumentation) {
+                throw_cl_error(::clFinish(queue), "Error waiting for the queued frames to finish");
+                throw_cl_error(::clFinish(transfer_queue), "Error waiting for the queued transfers to finish");
+                const bool separate = transfer_queue != queue;
+                const bool profiling = instrumentation != nullptr;
+                cl_device_id device  = nullptr;
+                throw_cl_error(::clGetCommandQueueInfo(queue, CL_QUEUE_DEVICE, sizeof(device), &device, nullptr),
+                               "Error getting the device of the command queue");
+                queue          = operation::make_queue(context, device, profiling);
+                transfer_queue = separate ? operation::make_queue(context, device, profiling) : queue;
+                this->instrumentation = std::move(instrumentation);
+            }
+
+            /// @return where every frame is reported, or nullptr if the engine isn't being timed
+            const std::shared_ptr<Instrumentation>& instrument() const {
+                return instrumentation;
+            }
+
+            /**
+             * @brief Count the submitted frames that the device has not finished yet
+             *
+             * @details
+             *  Frames that another thread is still in the middle of submitting are not counted. This doesn't block, so
+             *  it can be used to decide which of several engines to give the next frame to.
+             *
+             * @return the number of frames queued on the device that have not completed
+             */
+            unsigned int pending() const {
+                return frames.count_if([](const Frame& frame) {
+                    for (const auto& event : frame.complete) {
+                        if (event) {
+                            cl_int status = CL_COMPLETE;
+                            ::clGetEventInfo(
+                              event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, nullptr);
+                            if (status > CL_COMPLETE) { return true; }
+                        }
+                    }
+                    return false;
+                });
+            }
+
+            /**
+             * @brief Reuse the mesh lookup of previous frames while the camera has only rotated a little
+             *
+             * @details
+             *  Each mesh keeps the lookup of a reference frame, and while the camera stays within the tolerance of it
+             *  only the parts of the mesh near the edge of the screen are checked again. This works best when a single
+             *  camera uses the engine, several cameras sharing a mesh will mostly fall back to full lookups. This must
+             *  not be called while another thread is using the engine.
+             *
+             * @param tolerance the largest rotation in radians that a lookup is reused for, 0 disables reuse
+             */
+            void incremental_lookup(const Scalar& tolerance) {
+                lookup = std::make_shared<IncrementalLookup<Scalar>>(tolerance);
+            }
+
+            /// @return the largest rotation in radians that a lookup is reused for, 0 if reuse is disabled
+            Scalar incremental_lookup() const {
+                return lookup->tolerance;
+            }
+
+            /**
+             * @brief Register a host image buffer so that frames in it are read by the device without being copied
+             *
+             * @details
+             *  The device image is created on top of the buffer, so on devices that share memory with the host (most
+             *  integrated GPUs) classifying from the buffer doesn't copy the frame at all. This suits a ring of buffers
+             *  from a camera driver that are reused for every frame. Once registered, passing the buffer to the engine
+             *  uses its own device image, so it must hold an image of the same dimensions and format each time. It must
+             *  not be written while a frame that uses it is in flight, and it must outlive its registration. Drivers
+             *  may need the buffer to be aligned, usually to 4096 bytes, to avoid a copy.
+             *
+             * @param image      the host buffer that frames will be written to
+             * @param dimensions the dimensions of the images in the buffer
+             * @param format     the pixel format of the images in the buffer as a fourcc code
+             */
+            void register_image(const void* image, const vec2<int>& dimensions, const uint32_t& format) {
+                const vec2<int> extent = image_extent(dimensions, format);
+                cl_image_format fmt    = image_format(format);
+                cl_image_desc desc     = {
+                  CL_MEM_OBJECT_IMAGE2D, size_t(extent[0]), size_t(extent[1]), 1, 1, 0, 0, 0, 0, nullptr};
+
+                // The device only reads from the image, the host pointer is only non const for the API
+                cl_int error = CL_SUCCESS;
+                cl::mem memory(::clCreateImage(context,
+                                               CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
+                                               &fmt,
+                                               &desc,
+                                               const_cast<void*>(image),
+                                               &error),
+                               ::clReleaseMemObject);
+                throw_cl_error(error, "Error creating an image for the registered buffer");
+
+                std::lock_guard<std::mutex> lock(registered_images_mutex);
+                registered_images[image] = RegisteredImage{memory, dimensions, format};
+            }
+
+            /**
+             * @brief Stop using the device image of a registered buffer, so passing the buffer copies it again
+             *
+             * @details
+             *  Frames that used the buffer and are still in flight keep reading from it until they are finished
+             *
+             * @param image the host buffer that was registered
+             */
+            void unregister_image(const void* image) {
+                std::lock_guard<std::mutex> lock(registered_images_mutex);
+                registered_images.erase(image);
+            }
+
+            /**
+             * @brief Find the points on the screen and build their neighbourhood graph on the device
+             *
+             * @details
+             *  Rather than walking the mesh on the host and uploading the result, every point is projected on the
+             *  device and the ones on the screen are packed together there. This trades projecting the whole mesh for
+             *  not having to wait on the host between frames, which suits devices that are fast compared to the host.
+             *  Only single frames use this, batches always look up their meshes on the host. This must not be called
+             *  while another thread is using the engine.
+             *
+             * @param enabled if the lookup should be done on the device
+             */
+            void lookup_on_device(const bool& enabled) {
+                device_lookup = enabled;
+            }
+
+            /// @return if the points on the screen are found on the device
+            bool lookup_on_device() const {
+                return device_lookup;
+            }
+
+            /**
+             * @brief Remove the points a lookup on the host finds that are not on the screen before running the network
+             *
+             * @details
+             *  The lookup on the host finds some points just outside the image, which for fisheye lenses can be many
+             *  points outside the image circle. When this is enabled they are tested against the screen on the device
+             *  and packed out of the points on the screen, so the same points as the CPU engine are classified. This
+             *  costs reading the number of points back before the network can be queued. It has no effect when the
+             *  lookup is done on the device, which already does this, and batches are never culled. This must not be
+             *  called while another thread is using the engine.
+             *
+             * @param enabled if the points that are not on the screen should be removed
+             */
+            void cull_offscreen(const bool& enabled) {
+                offscreen_culling = enabled;
+            }
+
+            /// @return if the points that are not on the screen are removed from a lookup on the host
+            bool cull_offscreen() const {
+                return offscreen_culling;
+            }
+
+            /**
+             * @brief Replace the weights of a network that is kept in buffers without rebuilding the program
+             *
+             * @details
+             *  The new network must have the same shape as the one the engine was made with. This waits for every frame
+             *  that has already been queued to finish, so it must not be called while other threads are submitting.
+             *
+             * @param network the network with the new weights
+             */
+            void update_weights(const CompiledNetwork<Scalar>& network) {
+                if (layer_buffers.empty()) {
+                    throw std::invalid_argument("Only an engine that keeps its weights in buffers can update them");
+                }
+                throw_cl_error(::clFinish(queue), "Error waiting for the queued frames to finish");
+                throw_cl_error(::clFinish(transfer_queue), "Error waiting for the queued transfers to finish");
+                load_weights(network);
+            }
+
+            /**
+             * @brief Get the most points on the screen that a single call has needed device buffers for
+             *
+             * @details
+             *  For a batch this is the total over all of its frames. Passing this to reserve on a later engine lets it
+             *  allocate every buffer up front so it never allocates device memory while running.
+             *
+             * @return the high water mark of the number of points on the screen
+             */
+            int high_water_mark() const {
+                return points_high_water.get();
+            }
+
+            /**
+             * @brief Allocate the per point buffers of every frame that can be in flight for this many points
+             *
+             * @details
+             *  Buffers that are too small otherwise grow geometrically as frames with more points arrive. This must not
+             *  be called while another thread is using the engine, and is undone by clear_cache or in_flight.
+             *
+             * @param n_points     the number of points on the screen to allocate for, such as a high_water_mark
+             * @param n_neighbours the number of neighbours of each point in the mesh model that will be used
+             */
+            void reserve(const int& n_points, const int& n_neighbours) {
+                // Hold every frame at once so that each of them is allocated rather than the same one repeatedly
+                std::vector<typename ObjectPool<Frame>::Lease> leases;
+                for (unsigned int i = 0; i < max_in_flight; ++i) {
+                    leases.push_back(acquire_frame());
+                }
+
+                // Leave room for the offscreen point
+                const int n = n_points + 1;
+                for (auto& frame : leases) {
+                    get_indices_map_memory(*frame, n);
+                    get_pixel_coordinates_memory(*frame, n);
+                    get_neighbourhood_memory(*frame, n, n_neighbours);
+                    get_network_memory(*frame, int(max_width) * n);
+                    if (!frame->conv_layers.empty()) { get_selected_memory(*frame, n); }
+                }
+            }
+
+            /**
+             * @brief Time each convolution with every workgroup size the device allows and run it with the fastest
+             *
+             * @details
+             *  The best workgroup size depends on the device, the width of each convolution and how many points there
+             *  are, and is often far from the preferred multiple the driver reports. Each convolution is timed on this
+             *  many points with a synthetic neighbourhood graph. When the engine has a cache directory the sizes are
+             *  stored beside the compiled program, and later engines for the same network and device use them without
+             *  tuning again. This releases the buffers of every frame, it must not be called while another thread is
+             *  using the engine.
+             *
+             * @param n_points the number of points on the screen to tune for, such as a high_water_mark
+             * @param repeats  the number of times each workgroup size is run, the fastest of them is used
+             */
+            void autotune(const int& n_points, const int& repeats = 5) {
+                throw_cl_error(::clFinish(queue), "Error waiting for the queued frames to finish");
+                throw_cl_error(::clFinish(transfer_queue), "Error waiting for the queued transfers to finish");
+
+                Frame frame = make_frame();
+                if (frame.conv_layers.empty() || n_points <= 0) { return; }
+                cl_device_id device = nullptr;
+                throw_cl_error(::clGetCommandQueueInfo(queue, CL_QUEUE_DEVICE, sizeof(device), &device, nullptr),
+                               "Error getting the device of the command queue");
+
+                // Find the sizes to try for each convolution, the buffers have room for the largest to run past the end
+                std::vector<std::vector<size_t>> candidates;
+                size_t largest = workgroup_size;
+                for (const auto& conv : frame.conv_layers) {
+                    candidates.push_back(operation::local_size_candidates(conv.first, device));
+                    largest = std::max(largest, candidates.back().back());
+                }
+                const size_t n = n_points + largest;
+
+                // Make a graph where each point's neighbours are near it in memory like the rows of a real mesh
+                const int row = std::max(1, int(std::sqrt(n_points)));
+                std::vector<cl_int> graph(n * std::max(network_neighbours, 1));
+                for (size_t i = 0; i < n; ++i) {
+                    for (int j = 0; j < network_neighbours; ++j) {
+                        const long offset = (j % 2 == 0 ? 1 : -1) * (j < 2 ? 1 : row + j / 2 - 1);
+                        graph[i * network_neighbours + j] =
+                          cl_int(((long(i) + offset) % n_points + n_points) % n_points);
+                    }
+                }
+                std::vector<Scalar> values(n * max_width, Scalar(0.5));
+
+                cl_int error = CL_SUCCESS;
+                cl::mem neighbourhood(::clCreateBuffer(context,
+                                                       CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                                       graph.size() * sizeof(cl_int),
+                                                       graph.data(),
+                                                       &error),
+                                      ::clReleaseMemObject);
+                throw_cl_error(error, "Error allocating the neighbourhood buffer for tuning");
+                cl::mem input(::clCreateBuffer(context,
+                                               CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                                               values.size() * sizeof(Scalar),
+                                               values.data(),
+                                               &error),
+                              ::clReleaseMemObject);
+                throw_cl_error(error, "Error allocating the input buffer for tuning");
+                cl::mem output(
+                  ::clCreateBuffer(context, CL_MEM_READ_WRITE, values.size() * sizeof(Scalar), nullptr, &error),
+                  ::clReleaseMemObject);
+                throw_cl_error(error, "Error allocating the output buffer for tuning");
+
+                // Run every convolution with each of its sizes, the first run of each isn't timed as it may compile
+                std::vector<size_t> best(frame.conv_layers.size());
+                for (unsigned int i = 0; i < frame.conv_layers.size(); ++i) {
+                    double fastest = std::numeric_limits<double>::infinity();
+                    for (const auto& local_size : candidates[i]) {
+                        set_conv_arguments(frame, i, neighbourhood, input, output, local_size);
+                        const size_t global_size = ((n_points - 1) / local_size + 1) * local_size;
+                        const size_t offset      = 0;
+                        for (int r = 0; r <= std::max(repeats, 1); ++r) {
+                            const auto start = std::chrono::steady_clock::now();
+                            error = ::clEnqueueNDRangeKernel(queue,
+                                                             frame.conv_layers[i].first,
+                                                             1,
+                                                             &offset,
+                                                             &global_size,
+                                                             &local_size,
+                                                             0,
+                                                             nullptr,
+                                                             nullptr);
+                            // Larger workgroups can need more local memory than the device has
+                            if (error != CL_SUCCESS) { break; }
+                            throw_cl_error(::clFinish(queue), "Error waiting for a convolution while tuning");
+                            const double seconds =
+                              std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                            if (r > 0 && seconds < fastest) {
+                                fastest = seconds;
+                                best[i] = local_size;
+                            }
+                        }
+                    }
+                }
+
+                // Reallocate the buffers of the frames so they have room for the new sizes
+                for (auto& size : best) {
+                    size = size == 0 ? workgroup_size : size;
+                }
+                use_local_sizes(best);
+                if (!tuning_path.empty()) { operation::store_local_sizes(tuning_path, conv_local_sizes); }
+                clear_cache();
+            }
+
+            /**
+             * @brief Set the largest frame that runs the whole network in a single dispatch
+             *
+             * @details
+             *  Each convolution is normally its own dispatch, and for frames of a few thousand points the cost of these
+             *  dispatches can be more than the work in them. Frames with up to this many points run every convolution
+             *  in one dispatch of a single workgroup instead, which waits at a barrier between the convolutions. This
+             *  uses one compute unit, so it is slower for large frames that would fill the device. By default this is
+             *  four times the size of that workgroup. It has no effect when the weights are kept in buffers, and
+             *  changing it is not thread safe.
+             *
+             * @param n_points the most points to run in a single dispatch, 0 to always run each convolution separately
+             */
+            void single_dispatch(const int& n_points) {
+                single_dispatch_points = network_local_size == 0 ? 0 : n_points;
+            }
+
+            /// @return the most points that run the whole network in a single dispatch, 0 if it is never used
+            int single_dispatch() const {
+                return single_dispatch_points;
+            }
+
+            /**
+             * @brief Get the workgroup size each convolution runs with
+             *
+             * @return the workgroup size of each convolution, or empty if they haven't been tuned and all use the
+             *         preferred size of the device
+             */
+            const std::vector<size_t>& local_sizes() const {
+                return conv_local_sizes;
+            }
+
+            /**
+             * @brief Set how much device memory the meshes kept on the device may use
+             *
+             * @details
+             *  Each mesh is uploaded the first time it is used and kept on the device for later frames. Once they use
+             *  more than this the least recently used meshes are dropped, and are uploaded again if they are used
+             *  later. The mesh used most recently is always kept. By default there is no limit.
+             *
+             * @param bytes the memory budget for the meshes in bytes
+             */
+            void device_budget(const std::size_t& bytes) {
+                std::lock_guard<std::mutex> lock(device_points_mutex);
+                device_points_cache.budget(bytes);
+            }
+
+            /// @return how much device memory the meshes kept on the device are using
+            std::size_t device_bytes() const {
+                std::lock_guard<std::mutex> lock(device_points_mutex);
+                return device_points_cache.bytes();
+            }
+
+            /**
+             * @brief Upload a mesh to the device ahead of the frame that will use it
+             *
+             * @details
+             *  This can be called from another thread while the engine is running frames, such as from the prefetch
+             *  callback of a LazyVisualMesh, so that moving to a new height doesn't stall a frame on the upload.
+             *
+             * @tparam Model the mesh model of the mesh
+             *
+             * @param mesh the mesh to upload
+             */
+            template <template <typename> class Model>
+            void preload(const Mesh<Scalar, Model>& mesh) const {
+                if (device_lookup) { get_device_mesh(mesh); }
+                else {
+                    get_device_points(mesh);
+                }
+            }
+
+            /**
+             * @brief Drop the device copy of a mesh, such as when a LazyVisualMesh evicts it
+             *
+             * @tparam Model the mesh model of the mesh
+             *
+             * @param mesh the mesh to drop
+             */
+            template <template <typename> class Model>
+            void evict(const Mesh<Scalar, Model>& mesh) const {
+                std::lock_guard<std::mutex> lock(device_points_mutex);
+                device_points_cache.erase(mesh.id());
+            }
+
+            void clear_cache() {
+                /* mutex scope */ {
+                    std::lock_guard<std::mutex> lock(device_points_mutex);
+                    device_points_cache.clear();
+                }
+                lookup->clear();
+                // OpenCL keeps the buffers alive until any commands that are still using them have finished
+                frames.clear();
+                frames.reserve(max_in_flight, [this] { return make_frame(); });
+            }
+
+        private:
+            /// The recorder of a frame along with the device commands it queued, which are timed once it has finished
+            struct Profile {
+                explicit Profile(Instrumentation* instrumentation) : recorder(instrumentation) {}
+
+                /**
+                 * @brief Add a device command to be timed if the frame is being recorded
+                 *
+                 * @param stage the stage the command is part of
+                 * @param group the convolutional group for a CONVOLUTION stage, -1 for every other stage
+                 * @param event the event of the command
+                 */
+                void add(const Stage& stage, const int& group, const cl::event& event) {
+                    if (recorder.enabled() && event) {
+                        // The first command marks where the device work starts on the host timeline
+                        if (events.empty()) { recorder.submitted(); }
+                        events.emplace_back(stage, group, event);
+                    }
+                }
+
+                /**
+                 * @brief Wait for every command to finish, read the times the device recorded for them and report the
+                 * frame
+                 */
+                void report() {
+                    if (!recorder.enabled()) { return; }
+                    for (const auto& e : events) {
+                        cl_event event = std::get<2>(e);
+                        throw_cl_error(::clWaitForEvents(1, &event), "Error waiting for a profiled command");
+                        cl_ulong start = 0;
+                        cl_ulong end   = 0;
+                        throw_cl_error(::clGetEventProfilingInfo(
+                                         event, CL_PROFILING_COMMAND_START, sizeof(start), &start, nullptr),
+                                       "Error getting the start time of a profiled command");
+                        throw_cl_error(
+                          ::clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end, nullptr),
+                          "Error getting the end time of a profiled command");
+                        recorder.device(std::get<0>(e), std::get<1>(e), start, end);
+                    }
+                    recorder.report();
+                }
+
+                /// The host side of the frame
+                FrameRecorder recorder;
+                /// The stage, convolutional group and event of every device command queued for the frame
+                std::vector<std::tuple<Stage, int, cl::event>> events;
+            };
+
+            /**
+             * @brief Queue the projection and classification of a mesh, adding the device commands of the frame to a
+             * profile so they can be timed once it has finished
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh    the mesh table that we are projecting to pixel coordinates
+             * @param Hoc     the homogenous transformation matrix from the camera to the observation plane
+             * @param lens    the lens parameters that describe the optics of the camera
+             * @param image   the data that represents the image the network will run from
+             * @param format  the pixel format of this image as a fourcc code
+             * @param profile the profile of the frame
+             * @param storage a classified mesh whose pixel coordinate and classification memory is reused
+             * @param region  the part of the image to classify, or null for the whole image
+             *
+             * @return a future that holds the classified mesh once the device has finished
+             */
+            template <template <typename> class Model>
+            ClassificationFuture<Scalar, Model<Scalar>::N_NEIGHBOURS> submit(
+              const Mesh<Scalar, Model>& mesh,
+              const mat4<Scalar>& Hoc,
+              const Lens<Scalar>& lens,
+              const void* image,
+              const uint32_t& format,
+              Profile& profile,
+              ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS>&& storage,
+              const Region<Scalar>* region = nullptr) const {
+                static constexpr int N_NEIGHBOURS = Model<Scalar>::N_NEIGHBOURS;
+
+                // Take the next set of buffers, waiting for whatever frame was last using them
+                auto lease   = acquire_frame();
+                Frame& frame = *lease;
+
+                // Run the network, the graph is read back while it runs if it was built on the device
+                auto classified =
+                  enqueue_classification<N_NEIGHBOURS>(frame, mesh, Hoc, lens, image, format, true, profile, region);
+
+                // If there were no points, nothing to project
+                if (classified.n_points == 0) {
+                    storage.pixel_coordinates.clear();
+                    storage.neighbourhood.clear();
+                    storage.global_indices.clear();
+                    storage.classifications.clear();
+                    return ClassificationFuture<Scalar, N_NEIGHBOURS>(std::move(storage), {});
+                }
+
+                // Read the pixel coordinates off the device, into the storage's memory if it has any
+                cl::event pixels_read;
+                cl_event ev                               = nullptr;
+                std::vector<std::array<Scalar, 2>> pixels = std::move(storage.pixel_coordinates);
+                pixels.resize(classified.n_points);
+                cl_event iev = classified.pixels_loaded;
+                cl_int error = ::clEnqueueReadBuffer(transfer_queue,
+                                                     classified.pixels,
+                                                     false,
+                                                     0,
+                                                     pixels.size() * sizeof(std::array<Scalar, 2>),
+                                                     pixels.data(),
+                                                     1,
+                                                     &iev,
+                                                     &ev);
+                if (ev) { pixels_read = cl::event(ev, ::clReleaseEvent); }
+                throw_cl_error(error, "Error reading projected pixels");
+                profile.add(Stage::READBACK, -1, pixels_read);
+
+                // The mesh isn't ready until the graph from the device has also been read
+                if (classified.graph_read) {
+                    std::array<cl_event, 2> reads = {{pixels_read, classified.graph_read}};
+                    ev                            = nullptr;
+                    error = ::clEnqueueMarkerWithWaitList(transfer_queue, reads.size(), reads.data(), &ev);
+                    if (ev) { pixels_read = cl::event(ev, ::clReleaseEvent); }
+                    throw_cl_error(error, "Error waiting for the reads of the projected mesh");
+                }
+
+                // Read the classifications off the device (they'll be in input)
+                cl::event classes_read;
+                ev  = nullptr;
+                iev = classified.classified;
+                std::vector<Scalar> classifications = std::move(storage.classifications);
+                classifications.resize((classified.n_points + 1) * frame.conv_layers.back().second);
+                error = ::clEnqueueReadBuffer(transfer_queue,
+                                              classified.classifications,
+                                              false,
+                                              0,
+                                              classifications.size() * sizeof(Scalar),
+                                              classifications.data(),
+                                              1,
+                                              &iev,
+                                              &ev);
+                if (ev) { classes_read = cl::event(ev, ::clReleaseEvent); }
+                throw_cl_error(error, "Error reading classified values");
+                profile.add(Stage::READBACK, -1, classes_read);
+
+                // Flush the queue to ensure all the commands have been issued
+                flush();
+
+                // These buffers can't be reused until the chain has finished up to where we care about it
+                frame.complete = {pixels_read, classes_read};
+
+                return ClassificationFuture<Scalar, N_NEIGHBOURS>(
+                  ClassifiedMesh<Scalar, N_NEIGHBOURS>{std::move(pixels),
+                                                       std::move(classified.neighbourhood),
+                                                       std::move(classified.indices),
+                                                       std::move(classifications)},
+                  {{pixels_read, classes_read}});
+            }
+
+            /// The kernels and device buffers used by a single frame, so other frames can be in flight while it is
+            /// running. Kernel arguments can't be set from several threads at once so each frame has its own kernels
+            struct Frame {
+                /// Kernel for projecting rays to pixels using an equidistant projection
+                cl::kernel project_equidistant;
+                /// Kernel for projecting rays to pixels using an equisolid projection
+                cl::kernel project_equisolid;
+                /// Kernel for projecting rays to pixels using a rectilinear projection
+                cl::kernel project_rectilinear;
+                /// Kernels for reading projected pixel coordinates from an image into the network input layer, one each
+                /// for bayer images, YUV images and formats the device can interpolate itself
+                cl::kernel load_bayer_image;
+                cl::kernel load_yuv_image;
+                cl::kernel load_interpolated_image;
+                /// Kernels that project the points and read the image at them in one pass, indexed by LensProjection
+                std::array<cl::kernel, 3> project_load_bayer_image;
+                std::array<cl::kernel, 3> project_load_yuv_image;
+                std::array<cl::kernel, 3> project_load_interpolated_image;
+                /// Kernels for finding the points on screen and packing them together on the device
+                cl::kernel cull_points;
+                cl::kernel scan_blocks;
+                cl::kernel add_block_offsets;
+                cl::kernel compact_points;
+                cl::kernel remap_neighbourhood;
+                /// Kernel for removing the points that are not on the screen from a graph that was built on the host
+                cl::kernel cull_neighbourhood;
+                /// Kernels for packing together the points whose score for a class passes a threshold
+                cl::kernel threshold_points;
+                cl::kernel compact_selected;
+                /// Kernels for labelling the connected components of the points that passed a threshold
+                cl::kernel init_labels;
+                cl::kernel link_labels;
+                cl::kernel flatten_labels;
+                cl::kernel compact_labels;
+                /// A list of kernels to run in sequence to run the network, with the width of each of their outputs
+                std::vector<std::pair<cl::kernel, size_t>> conv_layers;
+                /// The kernel that runs every convolution in one dispatch, null if the program doesn't have one
+                cl::kernel network;
+
+                /// A location to cache the GPU memory allocated for indices map so we don't reallocate between runs
+                struct {
+                    int n_points = 0;
+                    cl::mem memory;
+                } indices_map_memory;
+
+                /// A location to cache the GPU memory allocated for pixel coordinates so we don't reallocate between
+                /// runs
+                struct {
+                    int n_points = 0;
+                    cl::mem memory;
+                } pixel_coordinates_memory;
+
+                /// A location to cache the GPU memory allocated for the ping pong network buffers so we don't
+                /// reallocate between runs
+                struct {
+                    int n_points = 0;
+                    std::array<cl::mem, 2> memory;
+                } network_memory;
+
+                /// A location to cache the GPU memory allocated for the local graph so we don't reallocate between runs
+                struct {
+                    int n_points = 0;
+                    cl::mem memory;
+                } neighbourhood_memory;
+
+                /// A location to cache the GPU memory used to find the points on screen on the device, this is sized
+                /// for every point that is tested rather than the points on screen
+                struct LookupMemory {
+                    int n_nodes = 0;
+                    /// The pixel coordinates of every point that is tested
+                    cl::mem pixels;
+                    /// If each point that is tested is on the screen
+                    cl::mem on_screen;
+                    /// The buffers for each level of the prefix sum, the first is the offset of each point
+                    std::vector<cl::mem> offsets;
+                    /// The number of values in each level of the prefix sum for the points that are being tested
+                    std::vector<int> sizes;
+                    /// The number of points the culling buffers below have room for
+                    int n_culled = 0;
+                    /// The global index of each point that was found by a lookup on the host
+                    cl::mem indices;
+                    /// The neighbourhood graph of the points that were found by a lookup on the host
+                    cl::mem neighbourhood;
+                } lookup_memory;
+
+                /// A location to cache the GPU memory for the points that passed a threshold
+                struct SelectedMemory {
+                    int n_points = 0;
+                    /// The global index of each point
+                    cl::mem indices;
+                    /// The pixel coordinates of each point
+                    cl::mem pixels;
+                    /// The output of the network for each point
+                    cl::mem classifications;
+                    /// The connected component label of each point when clustering
+                    cl::mem labels;
+                } selected_memory;
+
+                /// A location to cache the GPU memory for the connected component label of each point on the screen
+                struct {
+                    int n_points = 0;
+                    cl::mem memory;
+                } labels_memory;
+
+                /// A location to cache the GPU memory allocated for the image so we don't reallocate between runs
+                struct ImageMemory {
+                    vec2<int> dimensions = {0, 0};
+                    uint32_t format      = 0;
+                    cl::mem memory;
+                };
+                /// The cached images, one for each image in a batch
+                std::vector<ImageMemory> image_memory;
+
+                /// The indices of every point in a batch, kept here until the upload has finished
+                std::vector<int> host_indices;
+                /// The neighbourhood of every point in a batch, kept here until the upload has finished
+                std::vector<int> host_neighbourhood;
+
+                /// The events that finish the last frame that used these buffers
+                std::vector<cl::event> complete;
+
+                Frame()                            = default;
+                Frame(const Frame&)                = delete;
+                Frame(Frame&&) noexcept            = default;
+                Frame& operator=(const Frame&)     = delete;
+                Frame& operator=(Frame&&) noexcept = default;
+                // The device may still be reading from the host buffers
+                ~Frame() {
+                    wait(*this);
+                }
+            };
+
+            /**
+             * @brief Block until the last frame that used this set of buffers has finished with them
+             *
+             * @param frame the set of buffers to wait on
+             */
+            static void wait(const Frame& frame) {
+                std::vector<cl_event> pending;
+                for (const auto& event : frame.complete) {
+                    if (event) { pending.push_back(event); }
+                }
+                if (!pending.empty()) { ::clWaitForEvents(pending.size(), pending.data()); }
+            }
+
+            /**
+             * @brief Make sure everything queued so far has been issued to the device, in both queues if transfers
+             * have their own
+             */
+            void flush() const {
+                ::clFlush(queue);
+                if (transfer_queue != queue) { ::clFlush(transfer_queue); }
+            }
+
+            /**
+             * @brief Get the source code for the kernels of a network, empty if the weights are kept in buffers
+             *
+             * @param network   the network to generate the kernels from
+             * @param precision the precision to execute the network with
+             * @param storage   where the weights are kept on the device
+             *
+             * @return the OpenCL source code for the network's kernels
+             */
+            static std::string network_source(const CompiledNetwork<Scalar>& network,
+                                              const Precision& precision,
+                                              const WeightStorage& storage) {
+                if (storage == WeightStorage::INLINE) { return operation::make_network(network, precision); }
+                if (precision != Precision::FULL) {
+                    throw std::invalid_argument("Weights kept in buffers can only be used at full precision");
+                }
+                return "";
+            }
+
+            /**
+             * @brief Upload the weights of each layer of a network to device buffers, or overwrite the buffers if they
+             * have already been made
+             *
+             * @param network the network whose weights are uploaded
+             */
+            void load_weights(const CompiledNetwork<Scalar>& network) {
+                if (network.empty()) { return; }
+
+                // Output major puts each output's weights together in the same order as the gathered input
+                const CompiledNetwork<Scalar> packed(network, 1);
+                const int n_neighbours = packed.layer(0, 0).input_dimensions / 4 - 1;
+
+                std::vector<LayerBuffers> layers;
+                for (unsigned int c = 0; c < packed.size(); ++c) {
+                    for (unsigned int l = 0; l < packed.size(c); ++l) {
+                        const auto layer = packed.layer(c, l);
+                        LayerBuffers buffers;
+                        buffers.n_neighbours      = l == 0 ? n_neighbours : 0;
+                        buffers.input_dimensions  = layer.input_dimensions / (buffers.n_neighbours + 1);
+                        buffers.output_dimensions = layer.output_dimensions;
+                        buffers.activation        = layer.activation;
+                        layers.push_back(buffers);
+                    }
+                }
+
+                // Replacing the weights needs a network of the same shape as the kernels are already set up for it
+                const bool update = !layer_buffers.empty();
+                if (update) {
+                    bool same = layers.size() == layer_buffers.size();
+                    for (unsigned int i = 0; same && i < layers.size(); ++i) {
+                        same = layers[i].n_neighbours == layer_buffers[i].n_neighbours
+                               && layers[i].input_dimensions == layer_buffers[i].input_dimensions
+                               && layers[i].output_dimensions == layer_buffers[i].output_dimensions
+                               && layers[i].activation == layer_buffers[i].activation;
+                    }
+                    if (!same) {
+                        throw std::invalid_argument("The network does not have the same shape as the engine's network");
+                    }
+                }
+
+                unsigned int i = 0;
+                for (unsigned int c = 0; c < packed.size(); ++c) {
+                    for (unsigned int l = 0; l < packed.size(c); ++l, ++i) {
+                        const auto layer     = packed.layer(c, l);
+                        const size_t weights = layer.input_dimensions * layer.output_dimensions * sizeof(Scalar);
+                        const size_t biases  = layer.output_dimensions * sizeof(Scalar);
+
+                        if (update) {
+                            throw_cl_error(::clEnqueueWriteBuffer(queue,
+                                                                  layer_buffers[i].weights,
+                                                                  true,
+                                                                  0,
+                                                                  weights,
+                                                                  layer.weights,
+                                                                  0,
+                                                                  nullptr,
+                                                                  nullptr),
+                                           "Error writing layer weights to the device");
+                            throw_cl_error(::clEnqueueWriteBuffer(queue,
+                                                                  layer_buffers[i].biases,
+                                                                  true,
+                                                                  0,
+                                                                  biases,
+                                                                  layer.biases,
+                                                                  0,
+                                                                  nullptr,
+                                                                  nullptr),
+                                           "Error writing layer biases to the device");
+                        }
+                        else {
+                            // The weights are copied onto the device so they are never written through these pointers
+                            cl_int error       = CL_SUCCESS;
+                            cl_mem_flags flags = CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR;
+                            layers[i].weights  = cl::mem(
+                              ::clCreateBuffer(context, flags, weights, const_cast<Scalar*>(layer.weights), &error),
+                              ::clReleaseMemObject);
+                            throw_cl_error(error, "Error allocating layer weights on device");
+                            layers[i].biases = cl::mem(
+                              ::clCreateBuffer(context, flags, biases, const_cast<Scalar*>(layer.biases), &error),
+                              ::clReleaseMemObject);
+                            throw_cl_error(error, "Error allocating layer biases on device");
+
+                            conv_widths.push_back(layer.output_dimensions);
+                            max_width = std::max(max_width, conv_widths.back());
+                        }
+                    }
+                }
+                if (!update) { layer_buffers = std::move(layers); }
+            }
+
+            /**
+             * @brief A quantised network has its weights compiled into the kernels, so can't be kept in buffers
+             */
+            void load_weights(const QuantisedNetwork<Scalar>& /*network*/) {
+                throw std::invalid_argument("A quantised network can't keep its weights in buffers");
+            }
+
+            /**
+             * @brief Make a new frame with its own kernels from the program. Its buffers are allocated when first used
+             *
+             * @return the new frame
+             */
+            Frame make_frame() const {
+                cl_int error = CL_SUCCESS;
+                Frame frame;
+
+                frame.project_rectilinear =
+                  cl::kernel(::clCreateKernel(program, "project_rectilinear", &error), ::clReleaseKernel);
+                throw_cl_error(error, "Error getting project_rectilinear kernel");
+                frame.project_equidistant =
+                  cl::kernel(::clCreateKernel(program, "project_equidistant", &error), ::clReleaseKernel);
+                throw_cl_error(error, "Error getting project_equidistant kernel");
+                frame.project_equisolid =
+                  cl::kernel(::clCreateKernel(program, "project_equisolid", &error), ::clReleaseKernel);
+                throw_cl_error(error, "Error getting project_equisolid kernel");
+                frame.load_bayer_image =
+                  cl::kernel(::clCreateKernel(program, "load_bayer_image", &error), ::clReleaseKernel);
+                throw_cl_error(error, "Failed to create kernel load_bayer_image");
+                frame.load_yuv_image =
+                  cl::kernel(::clCreateKernel(program, "load_yuv_image", &error), ::clReleaseKernel);
+                throw_cl_error(error, "Failed to create kernel load_yuv_image");
+                frame.load_interpolated_image =
+                  cl::kernel(::clCreateKernel(program, "load_interpolated_image", &error), ::clReleaseKernel);
+                throw_cl_error(error, "Failed to create kernel load_interpolated_image");
+                for (const auto& projection : {std::make_pair(RECTILINEAR, "rectilinear"),
+                                               std::make_pair(EQUISOLID, "equisolid"),
+                                               std::make_pair(EQUIDISTANT, "equidistant")}) {
+                    const std::string bayer = std::string("project_") + projection.second + "_load_bayer_image";
+                    frame.project_load_bayer_image[projection.first] =
+                      cl::kernel(::clCreateKernel(program, bayer.c_str(), &error), ::clReleaseKernel);
+                    throw_cl_error(error, "Failed to create kernel " + bayer);
+                    const std::string yuv = std::string("project_") + projection.second + "_load_yuv_image";
+                    frame.project_load_yuv_image[projection.first] =
+                      cl::kernel(::clCreateKernel(program, yuv.c_str(), &error), ::clReleaseKernel);
+                    throw_cl_error(error, "Failed to create kernel " + yuv);
+                    const std::string interpolated =
+                      std::string("project_") + projection.second + "_load_interpolated_image";
+                    frame.project_load_interpolated_image[projection.first] =
+                      cl::kernel(::clCreateKernel(program, interpolated.c_str(), &error), ::clReleaseKernel);
+                    throw_cl_error(error, "Failed to create kernel " + interpolated);
+                }
+                frame.cull_points = cl::kernel(::clCreateKernel(program, "cull_points", &error), ::clReleaseKernel);
+                throw_cl_error(error, "Failed to create kernel cull_points");
+                frame.scan_blocks = cl::kernel(::clCreateKernel(program, "scan_blocks", &error), ::clReleaseKernel);
+                throw_cl_error(error, "Failed to create kernel scan_blocks");
+                frame.add_block_offsets =
+                  cl::kernel(::clCreateKernel(program, "add_block_offsets", &error), ::clReleaseKernel);
+                throw_cl_error(error, "Failed to create kernel add_block_offsets");
+                frame.compact_points =
+                  cl::kernel(::clCreateKernel(program, "compact_points", &error), ::clReleaseKernel);
+                throw_cl_error(error, "Failed to create kernel compact_points");
+                frame.remap_neighbourhood =
+                  cl::kernel(::clCreateKernel(program, "remap_neighbourhood", &error), ::clReleaseKernel);
+                throw_cl_error(error, "Failed to create kernel remap_neighbourhood");
+                frame.cull_neighbourhood =
+                  cl::kernel(::clCreateKernel(program, "cull_neighbourhood", &error), ::clReleaseKernel);
+                throw_cl_error(error, "Failed to create kernel cull_neighbourhood");
+                frame.threshold_points =
+                  cl::kernel(::clCreateKernel(program, "threshold_points", &error), ::clReleaseKernel);
+                throw_cl_error(error, "Failed to create kernel threshold_points");
+                frame.compact_selected =
+                  cl::kernel(::clCreateKernel(program, "compact_selected", &error), ::clReleaseKernel);
+                throw_cl_error(error, "Failed to create kernel compact_selected");
+                frame.init_labels = cl::kernel(::clCreateKernel(program, "init_labels", &error), ::clReleaseKernel);
+                throw_cl_error(error, "Failed to create kernel init_labels");
+                frame.link_labels = cl::kernel(::clCreateKernel(program, "link_labels", &error), ::clReleaseKernel);
+                throw_cl_error(error, "Failed to create kernel link_labels");
+                frame.flatten_labels =
+                  cl::kernel(::clCreateKernel(program, "flatten_labels", &error), ::clReleaseKernel);
+                throw_cl_error(error, "Failed to create kernel flatten_labels");
+                frame.compact_labels =
+                  cl::kernel(::clCreateKernel(program, "compact_labels", &error), ::clReleaseKernel);
+                throw_cl_error(error, "Failed to create kernel compact_labels");
+
+                // Grab all the kernels that were generated
+                for (unsigned int i = 0; i < conv_widths.size() && layer_buffers.empty(); ++i) {
+                    std::string kernel = "conv" + std::to_string(i);
+
+                    cl::kernel k(::clCreateKernel(program, kernel.c_str(), &error), ::clReleaseKernel);
+                    throw_cl_error(error, "Failed to create kernel " + kernel);
+                    frame.conv_layers.emplace_back(k, conv_widths[i]);
+                }
+
+                // Source that was written by hand may not have the single dispatch kernel, which is fine
+                if (!conv_widths.empty() && layer_buffers.empty()) {
+                    cl_kernel k = ::clCreateKernel(program, "network", &error);
+                    if (error == CL_SUCCESS) { frame.network = cl::kernel(k, ::clReleaseKernel); }
+                }
+
+                // Or make a generic layer kernel for each layer that reads that layer's weights
+                const char* layer_kernel = tiled_layers ? "dense_layer_tiled" : "dense_layer";
+                for (const auto& layer : layer_buffers) {
+                    cl::kernel k(::clCreateKernel(program, layer_kernel, &error), ::clReleaseKernel);
+                    throw_cl_error(error, std::string("Failed to create kernel ") + layer_kernel);
+
+                    cl_mem arg = nullptr;
+                    arg        = layer.weights;
+                    throw_cl_error(::clSetKernelArg(k, 3, MEM_SIZE, &arg),
+                                   "Error setting kernel argument 3 for layer kernel");
+                    arg = layer.biases;
+                    throw_cl_error(::clSetKernelArg(k, 4, MEM_SIZE, &arg),
+                                   "Error setting kernel argument 4 for layer kernel");
+                    throw_cl_error(::clSetKernelArg(k, 5, sizeof(layer.n_neighbours), &layer.n_neighbours),
+                                   "Error setting kernel argument 5 for layer kernel");
+                    throw_cl_error(::clSetKernelArg(k, 6, sizeof(layer.input_dimensions), &layer.input_dimensions),
+                                   "Error setting kernel argument 6 for layer kernel");
+                    throw_cl_error(::clSetKernelArg(k, 7, sizeof(layer.output_dimensions), &layer.output_dimensions),
+                                   "Error setting kernel argument 7 for layer kernel");
+                    throw_cl_error(::clSetKernelArg(k, 8, sizeof(layer.activation), &layer.activation),
+                                   "Error setting kernel argument 8 for layer kernel");
+                    frame.conv_layers.emplace_back(k, layer.output_dimensions);
+                }
+
+                return frame;
+            }
+
+            /**
+             * @brief Lease the frame that has been idle the longest, waiting until the device is no longer using it
+             *
+             * @return the frame the next call should use, which is returned to the pool when the lease is destroyed
+             */
+            typename ObjectPool<Frame>::Lease acquire_frame() const {
+                auto frame = frames.acquire([this] { return make_frame(); });
+                wait(*frame);
+                frame->complete = {};
+                return frame;
+            }
+
+            /**
+             * @brief Projects a provided mesh to pixel coordinates, or just the part of it inside a region
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh   the mesh table that we are projecting to pixel coordinates
+             * @param Hoc    the homogenous transformation matrix from the camera to the observation plane
+             * @param lens   the lens parameters that describe the optics of the camera
+             * @param region the part of the image to project the mesh into, or null for the whole image
+             *
+             * @return a projected mesh for the provided arguments
+             */
+            template <template <typename> class Model>
+            ProjectedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> project(const Mesh<Scalar, Model>& mesh,
+                                                                       const mat4<Scalar>& Hoc,
+                                                                       const Lens<Scalar>& lens,
+                                                                       const Region<Scalar>* region) const {
+                static constexpr int N_NEIGHBOURS = Model<Scalar>::N_NEIGHBOURS;
+                Profile profile(instrumentation.get());
+
+                // Perform the projection, a region is always looked up on the host
+                std::vector<std::array<int, N_NEIGHBOURS>> neighbourhood;
+                std::vector<int> indices;
+                cl::mem cl_pixels;
+                cl::event projected;
+                auto frame = acquire_frame();
+                if (device_lookup && region == nullptr) {
+                    FrameRecorder::Scope scope(profile.recorder, Stage::PROJECT);
+                    auto projection = do_project_on_device(*frame, mesh, Hoc, lens);
+                    std::tie(indices, neighbourhood) = read_device_graph<N_NEIGHBOURS>(projection, true).first;
+                    cl_pixels                        = projection.pixels;
+                    projected                        = projection.compacted;
+                }
+                else if (offscreen_culling && region == nullptr) {
+                    auto projection                  = do_project_culled(*frame, mesh, Hoc, lens, profile);
+                    std::tie(indices, neighbourhood) = read_device_graph<N_NEIGHBOURS>(projection, true).first;
+                    cl_pixels                        = projection.pixels;
+                    projected                        = projection.compacted;
+                }
+                else {
+                    std::tie(neighbourhood, indices, cl_pixels, projected) =
+                      do_project(*frame, mesh, Hoc, lens, profile, region);
+                }
+
+                // If we didn't get anything, nothing to return
+                if (indices.empty()) {
+                    profile.report();
+                    return ProjectedMesh<Scalar, N_NEIGHBOURS>();
+                }
+
+                // Read the pixels off the buffer
+                std::vector<std::array<Scalar, 2>> pixels(indices.size());
+                std::array<cl_event, 1> events{{projected}};
+                cl_event ev  = nullptr;
+                cl_int error = ::clEnqueueReadBuffer(transfer_queue,
+                                                     cl_pixels,
+                                                     true,
+                                                     0,
+                                                     indices.size() * sizeof(std::array<Scalar, 2>),
+                                                     pixels.data(),
+                                                     events.size(),
+                                                     events.data(),
+                                                     &ev);
+                if (ev) { profile.add(Stage::READBACK, -1, cl::event(ev, ::clReleaseEvent)); }
+                throw_cl_error(error, "Failed reading projected pixels from the device");
+
+                profile.report();
+                return ProjectedMesh<Scalar, N_NEIGHBOURS>{
+                  std::move(pixels), std::move(neighbourhood), std::move(indices)};
+            }
+
+            /**
+             * @brief Find the points of the mesh on the screen on the host and project them on the device
+             *
+             * @details
+             *  When an image is given the same kernel also reads it into the first network buffer and the offscreen
+             *  point is filled, so the returned event is for when the network input is ready as well.
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param frame        the frame whose kernels and buffers are used
+             * @param mesh         the mesh table that we are projecting to pixel coordinates
+             * @param Hoc          the homogenous transformation matrix from the camera to the observation plane
+             * @param lens         the lens parameters that describe the optics of the camera
+             * @param profile      where the device commands are added to be timed
+             * @param region       the part of the image to find the points in, or null for the whole image
+             * @param image        the device image to load into the network input, or nothing to only project
+             * @param format       the pixel format of the image as a fourcc code
+             * @param image_loaded the event for when the image is on the device
+             *
+             * @return the neighbourhood and global indices of the points on the screen, their pixel coordinates on the
+             *         device and the event for when they have been projected
+             */
+            template <template <typename> class Model>
+            std::tuple<std::vector<std::array<int, Model<Scalar>::N_NEIGHBOURS>>, std::vector<int>, cl::mem, cl::event>
+              do_project(Frame& frame,
+                         const Mesh<Scalar, Model>& mesh,
+                         const mat4<Scalar>& Hoc,
+                         const Lens<Scalar>& lens,
+                         Profile& profile,
+                         const Region<Scalar>* region  = nullptr,
+                         const cl::mem& image          = cl::mem(),
+                         const uint32_t& format        = 0,
+                         const cl::event& image_loaded = cl::event()) const {
+                static constexpr int N_NEIGHBOURS = Model<Scalar>::N_NEIGHBOURS;
+
+                // Reused variables
+                cl_int error = 0;
+                cl_event ev  = nullptr;
+
+                // Upload our visual mesh unit vectors if we have to
+                cl::mem cl_points = get_device_points(mesh);
+
+                // Build up our list of indices for OpenCL
+                RangeLookup remap;
+                FrameRecorder::Scope lookup(profile.recorder, Stage::LOOKUP);
+                std::vector<int> indices = lookup_indices(mesh, Hoc, lens, remap, region);
+                int n_points             = indices.size();
+                lookup.stop();
+
+                // No point processing if we have no points, return an empty mesh
+                if (n_points == 0) {
+                    return std::make_tuple(
+                      std::vector<std::array<int, N_NEIGHBOURS>>(), std::vector<int>(), cl::mem(), cl::event());
+                }
+
+                // Create buffers for indices map
+                cl::mem indices_map       = get_indices_map_memory(frame, n_points);
+                cl::mem pixel_coordinates = get_pixel_coordinates_memory(frame, n_points);
+
+                // Upload our indices map
+                cl::event indices_event;
+                ev    = nullptr;
+                error = ::clEnqueueWriteBuffer(transfer_queue,
+                                               indices_map,
+                                               false,
+                                               0,
+                                               indices.size() * sizeof(cl_int),
+                                               indices.data(),
+                                               0,
+                                               nullptr,
+                                               &ev);
+                if (ev) { indices_event = cl::event(ev, ::clReleaseEvent); }
+                throw_cl_error(error, "Error uploading indices_map to device");
+                profile.add(Stage::UPLOAD, -1, indices_event);
+
+                // When everything is uploaded, we can run our projection kernel to get the pixel coordinates
+                // When calculating global_size we round to the nearest workgroup size
+                const size_t global_size = (((n_points - 1) / workgroup_size) + 1) * workgroup_size;
+                cl::event projected;
+                if (image) {
+                    // Load the image in the same pass, leaving room for the offscreen point in the network buffer
+                    cl::mem input = get_network_memory(frame, max_width * (n_points + 1))[0];
+                    cl::event loaded;
+                    std::tie(loaded, projected) = enqueue_project_load_image(frame,
+                                                                             cl_points,
+                                                                             indices_map,
+                                                                             pixel_coordinates,
+                                                                             Hoc,
+                                                                             lens,
+                                                                             image,
+                                                                             format,
+                                                                             input,
+                                                                             0,
+                                                                             global_size,
+                                                                             n_points,
+                                                                             {indices_event, image_loaded});
+                    profile.add(Stage::PROJECT, -1, loaded);
+                    profile.add(Stage::LOAD_IMAGE, -1, projected);
+                }
+                else {
+                    projected = enqueue_projection(
+                      frame, cl_points, indices_map, pixel_coordinates, Hoc, lens, 0, global_size, indices_event);
+                    profile.add(Stage::PROJECT, -1, projected);
+                }
+
+                // This can happen on the CPU while the OpenCL device is busy
+                FrameRecorder::Scope graph(profile.recorder, Stage::PROJECT);
+                std::vector<std::array<int, N_NEIGHBOURS>> local_neighbourhood =
+                  build_neighbourhood(mesh, indices, remap);
+                graph.stop();
+
+                // This ensures that all elements in the queue have been issued to the device NOT that they are all
+                // finished If we don't do this here, some of our buffers can go out of scope before the queue picks
+                // them up causing errors
+                flush();
+
+                // Return what we calculated
+                return std::make_tuple(std::move(local_neighbourhood),  // CPU buffer
+                                       std::move(indices),              // CPU buffer
+                                       pixel_coordinates,               // GPU buffer
+                                       projected);                      // GPU event
+            }
+
+            /// The buffers holding a mesh on the device
+            struct DeviceMesh {
+                /// The unit vectors of the mesh
+                cl::mem points;
+                /// The neighbourhood graph of the mesh, only uploaded when the lookup is done on the device
+                cl::mem neighbourhood;
+                /// The index of each point, used to project every point in the mesh
+                cl::mem identity;
+            };
+
+            /// The points of a mesh that were found on the screen by the device
+            struct DeviceProjection {
+                /// The number of points on the screen, not including the offscreen point
+                int n_points;
+                /// The global index of each point on the screen
+                cl::mem indices;
+                /// The pixel coordinates of each point on the screen
+                cl::mem pixels;
+                /// The neighbourhood graph of the points on the screen with the offscreen point last
+                cl::mem neighbourhood;
+                /// The event for when the indices and pixels have been written
+                cl::event compacted;
+                /// The event for when the neighbourhood has been written
+                cl::event remapped;
+            };
+
+            /// A frame whose classification has been queued on the device
+            template <int N_NEIGHBOURS>
+            struct DeviceClassification {
+                /// The number of points on the screen, not including the offscreen point
+                int n_points = 0;
+                /// The global index of each point on the screen, empty if the graph was left on the device
+                std::vector<int> indices;
+                /// The neighbourhood graph of the points on the screen, empty if the graph was left on the device
+                std::vector<std::array<int, N_NEIGHBOURS>> neighbourhood;
+                /// The event for when the graph has been read from the device, if it was built there
+                cl::event graph_read;
+                /// The global index of each point on the screen on the device
+                cl::mem device_indices;
+                /// The pixel coordinates of each point on the screen
+                cl::mem pixels;
+                /// The event for when the indices and pixels have been written
+                cl::event pixels_loaded;
+                /// The output of the network for each point on the screen followed by the offscreen point
+                cl::mem classifications;
+                /// The event for when the network has finished
+                cl::event classified;
+                /// The neighbourhood graph of the points on the screen on the device, with the offscreen point last
+                cl::mem device_neighbourhood;
+            };
+
+            /**
+             * @brief Project every point in the mesh and pack the ones on the screen together on the device
+             *
+             * @details
+             *  Every point is projected and tested against the screen, then a prefix sum over the results gives each
+             *  point on the screen its place in the packed buffers. The only thing read back is the number of points,
+             *  which is needed to size the rest of the buffers for the network.
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param frame the frame whose kernels and buffers are used
+             * @param mesh  the mesh table that we are projecting to pixel coordinates
+             * @param Hoc   the homogenous transformation matrix from the camera to the observation plane
+             * @param lens  the lens parameters that describe the optics of the camera
+             *
+             * @return the device buffers holding the points on the screen
+             */
+            template <template <typename> class Model>
+            DeviceProjection do_project_on_device(Frame& frame,
+                                                  const Mesh<Scalar, Model>& mesh,
+                                                  const mat4<Scalar>& Hoc,
+                                                  const Lens<Scalar>& lens) const {
+                static constexpr int N_NEIGHBOURS = Model<Scalar>::N_NEIGHBOURS;
+
+                const DeviceMesh device_mesh = get_device_mesh(mesh);
+                const int n_nodes            = mesh.nodes.size();
+                auto& memory                 = get_lookup_memory(frame, n_nodes);
+
+                // Project every point in the mesh
+                const size_t mesh_size = ((n_nodes - 1) / workgroup_size + 1) * workgroup_size;
+                cl::event projected    = enqueue_projection(
+                  frame, device_mesh.points, device_mesh.identity, memory.pixels, Hoc, lens, 0, mesh_size, cl::event());
+
+                // Mark which of them are on the screen and count them
+                cl::event scanned =
+                  enqueue_cull(frame, device_mesh.points, device_mesh.identity, Hoc, lens, n_nodes, projected);
+                int n_points = read_scan_total(frame, n_nodes, {scanned});
+
+                DeviceProjection projection;
+                projection.n_points = n_points;
+                if (n_points == 0) { return projection; }
+
+                projection.indices       = get_indices_map_memory(frame, n_points);
+                projection.pixels        = get_pixel_coordinates_memory(frame, n_points);
+                projection.neighbourhood = get_neighbourhood_memory(frame, n_points + 1, N_NEIGHBOURS);
+
+                // Pack the points on the screen together
+                projection.compacted = enqueue_compact(
+                  frame, device_mesh.identity, n_nodes, projection.indices, projection.pixels, scanned);
+
+                // Build the neighbourhood of the packed points from the neighbourhood of the whole mesh
+                cl_mem arg       = nullptr;
+                int n_neighbours = N_NEIGHBOURS;
+                arg              = projection.indices;
+                throw_cl_error(::clSetKernelArg(frame.remap_neighbourhood, 0, MEM_SIZE, &arg),
+                               "Error setting kernel argument 0 for neighbourhood kernel");
+                arg = memory.on_screen;
+                throw_cl_error(::clSetKernelArg(frame.remap_neighbourhood, 1, MEM_SIZE, &arg),
+                               "Error setting kernel argument 1 for neighbourhood kernel");
+                arg = memory.offsets.front();
+                throw_cl_error(::clSetKernelArg(frame.remap_neighbourhood, 2, MEM_SIZE, &arg),
+                               "Error setting kernel argument 2 for neighbourhood kernel");
+                arg = device_mesh.neighbourhood;
+                throw_cl_error(::clSetKernelArg(frame.remap_neighbourhood, 3, MEM_SIZE, &arg),
+                               "Error setting kernel argument 3 for neighbourhood kernel");
+                throw_cl_error(::clSetKernelArg(frame.remap_neighbourhood, 4, sizeof(n_neighbours), &n_neighbours),
+                               "Error setting kernel argument 4 for neighbourhood kernel");
+                throw_cl_error(::clSetKernelArg(frame.remap_neighbourhood, 5, sizeof(n_points), &n_points),
+                               "Error setting kernel argument 5 for neighbourhood kernel");
+                arg = projection.neighbourhood;
+                throw_cl_error(::clSetKernelArg(frame.remap_neighbourhood, 6, MEM_SIZE, &arg),
+                               "Error setting kernel argument 6 for neighbourhood kernel");
+                projection.remapped = enqueue_kernel(
+                  frame.remap_neighbourhood, n_points + 1, workgroup_size, {projection.compacted}, "neighbourhood");
+
+                flush();
+                return projection;
+            }
+
+            /**
+             * @brief Queue marking which projected points are on the screen and the prefix sum that packs them
+             *
+             * @param frame   the frame whose kernels and lookup memory are used, the pixels of the points must be in
+             *                its lookup memory
+             * @param points  the device buffer holding the unit vectors of the mesh
+             * @param indices the device buffer holding the global index of each point being tested
+             * @param Hoc     the homogenous transformation matrix from the camera to the observation plane
+             * @param lens    the lens parameters that describe the optics of the camera
+             * @param n_nodes the number of points being tested
+             * @param wait    the event for when the points have been projected
+             *
+             * @return the event for when the offset of each point on the screen has been found
+             */
+            cl::event enqueue_cull(Frame& frame,
+                                   const cl::mem& points,
+                                   const cl::mem& indices,
+                                   const mat4<Scalar>& Hoc,
+                                   const Lens<Scalar>& lens,
+                                   const int& n_nodes,
+                                   const cl::event& wait) const {
+                const auto& memory = frame.lookup_memory;
+
+                std::array<Scalar, 4> camera_x{{Hoc[0][0], Hoc[1][0], Hoc[2][0], Scalar(0.0)}};
+                Scalar cos_fov = std::cos(lens.fov * Scalar(0.5));
+                cl_mem arg     = nullptr;
+                arg            = points;
+                throw_cl_error(::clSetKernelArg(frame.cull_points, 0, MEM_SIZE, &arg),
+                               "Error setting kernel argument 0 for cull kernel");
+                arg = indices;
+                throw_cl_error(::clSetKernelArg(frame.cull_points, 1, MEM_SIZE, &arg),
+                               "Error setting kernel argument 1 for cull kernel");
+                arg = memory.pixels;
+                throw_cl_error(::clSetKernelArg(frame.cull_points, 2, MEM_SIZE, &arg),
+                               "Error setting kernel argument 2 for cull kernel");
+                throw_cl_error(::clSetKernelArg(frame.cull_points, 3, sizeof(camera_x), camera_x.data()),
+                               "Error setting kernel argument 3 for cull kernel");
+                throw_cl_error(::clSetKernelArg(frame.cull_points, 4, sizeof(cos_fov), &cos_fov),
+                               "Error setting kernel argument 4 for cull kernel");
+                throw_cl_error(::clSetKernelArg(frame.cull_points, 5, sizeof(lens.dimensions), lens.dimensions.data()),
+                               "Error setting kernel argument 5 for cull kernel");
+                throw_cl_error(::clSetKernelArg(frame.cull_points, 6, sizeof(n_nodes), &n_nodes),
+                               "Error setting kernel argument 6 for cull kernel");
+                arg = memory.on_screen;
+                throw_cl_error(::clSetKernelArg(frame.cull_points, 7, MEM_SIZE, &arg),
+                               "Error setting kernel argument 7 for cull kernel");
+                // This includes the offscreen point at the end
+                cl::event culled = enqueue_kernel(frame.cull_points, n_nodes + 1, workgroup_size, {wait}, "cull");
+
+                // The prefix sum gives each point on the screen its position, and the last value is how many there are
+                return enqueue_scan(frame, memory.on_screen, 0, culled);
+            }
+
+            /**
+             * @brief Read how many points were found on the screen, which is needed to size the buffers for the network
+             *
+             * @param frame   the frame whose lookup memory holds the prefix sum
+             * @param n_nodes the number of points that were tested
+             * @param wait    the events that must complete before this returns, including the prefix sum
+             *
+             * @return the number of points on the screen, not including the offscreen point
+             */
+            int read_scan_total(Frame& frame, const int& n_nodes, const std::vector<cl::event>& wait) const {
+                int n_points = 0;
+                std::vector<cl_event> events(wait.begin(), wait.end());
+                // Blocking only flushes the queue the read is in, the kernels it waits on must be flushed as well
+                flush();
+                throw_cl_error(::clEnqueueReadBuffer(transfer_queue,
+                                                     frame.lookup_memory.offsets.front(),
+                                                     true,
+                                                     n_nodes * sizeof(cl_int),
+                                                     sizeof(cl_int),
+                                                     &n_points,
+                                                     events.size(),
+                                                     events.data(),
+                                                     nullptr),
+                               "Error reading the number of points on the screen");
+                return n_points;
+            }
+
+            /**
+             * @brief Queue packing the global index and pixel coordinates of the points on the screen together
+             *
+             * @param frame        the frame whose kernels and lookup memory are used
+             * @param mesh_indices the device buffer holding the global index of each point that was tested
+             * @param n_nodes      the number of points that were tested
+             * @param indices      the device buffer to write the global index of each point on the screen to
+             * @param pixels       the device buffer to write the pixel coordinates of each point on the screen to
+             * @param wait         the event for when the offset of each point on the screen has been found
+             *
+             * @return the event for when the indices and pixels have been written
+             */
+            cl::event enqueue_compact(Frame& frame,
+                                      const cl::mem& mesh_indices,
+                                      const int& n_nodes,
+                                      const cl::mem& indices,
+                                      const cl::mem& pixels,
+                                      const cl::event& wait) const {
+                const auto& memory = frame.lookup_memory;
+
+                cl_mem arg = nullptr;
+                arg        = memory.on_screen;
+                throw_cl_error(::clSetKernelArg(frame.compact_points, 0, MEM_SIZE, &arg),
+                               "Error setting kernel argument 0 for compact kernel");
+                arg = memory.offsets.front();
+                throw_cl_error(::clSetKernelArg(frame.compact_points, 1, MEM_SIZE, &arg),
+                               "Error setting kernel argument 1 for compact kernel");
+                arg = mesh_indices;
+                throw_cl_error(::clSetKernelArg(frame.compact_points, 2, MEM_SIZE, &arg),
+                               "Error setting kernel argument 2 for compact kernel");
+                arg = memory.pixels;
+                throw_cl_error(::clSetKernelArg(frame.compact_points, 3, MEM_SIZE, &arg),
+                               "Error setting kernel argument 3 for compact kernel");
+                throw_cl_error(::clSetKernelArg(frame.compact_points, 4, sizeof(n_nodes), &n_nodes),
+                               "Error setting kernel argument 4 for compact kernel");
+                arg = indices;
+                throw_cl_error(::clSetKernelArg(frame.compact_points, 5, MEM_SIZE, &arg),
+                               "Error setting kernel argument 5 for compact kernel");
+                arg = pixels;
+                throw_cl_error(::clSetKernelArg(frame.compact_points, 6, MEM_SIZE, &arg),
+                               "Error setting kernel argument 6 for compact kernel");
+                return enqueue_kernel(frame.compact_points, n_nodes, workgroup_size, {wait}, "compact");
+            }
+
+            /**
+             * @brief Look up the points on the screen on the host, then remove the ones that are not on the screen on
+             *        the device
+             *
+             * @details
+             *  The lookup on the host is conservative, so it finds points just past the edge of the image and the
+             *  points of a fisheye lens that are outside its image circle. These would be classified for nothing and
+             *  would be read from outside the image. The points that were found are projected and tested against the
+             *  screen on the device, then a prefix sum packs the ones on the screen together and their neighbours
+             *  that were removed are pointed at the offscreen point. This gives the same points as the CPU engine.
+             *  The number of points is read back so the buffers for the network can be sized, which waits for the
+             *  projection to finish.
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param frame   the frame whose kernels and buffers are used
+             * @param mesh    the mesh table that we are projecting to pixel coordinates
+             * @param Hoc     the homogenous transformation matrix from the camera to the observation plane
+             * @param lens    the lens parameters that describe the optics of the camera
+             * @param profile where the host work and device commands are added to be timed
+             *
+             * @return the device buffers holding the points on the screen
+             */
+            template <template <typename> class Model>
+            DeviceProjection do_project_culled(Frame& frame,
+                                               const Mesh<Scalar, Model>& mesh,
+                                               const mat4<Scalar>& Hoc,
+                                               const Lens<Scalar>& lens,
+                                               Profile& profile) const {
+                static constexpr int N_NEIGHBOURS = Model<Scalar>::N_NEIGHBOURS;
+
+                // Reused variables
+                cl_int error = 0;
+                cl_event ev  = nullptr;
+
+                // Upload our visual mesh unit vectors if we have to
+                cl::mem cl_points = get_device_points(mesh);
+
+                // Build up our list of indices for OpenCL
+                RangeLookup remap;
+                FrameRecorder::Scope lookup(profile.recorder, Stage::LOOKUP);
+                std::vector<int> indices = lookup_indices(mesh, Hoc, lens, remap);
+                const int n_nodes        = indices.size();
+                lookup.stop();
+
+                DeviceProjection projection;
+                projection.n_points = 0;
+                if (n_nodes == 0) { return projection; }
+
+                auto& memory = get_cull_memory(frame, n_nodes, N_NEIGHBOURS);
+
+                // Upload our indices map
+                cl::event indices_event;
+                ev    = nullptr;
+                error = ::clEnqueueWriteBuffer(transfer_queue,
+                                               memory.indices,
+                                               false,
+                                               0,
+                                               n_nodes * sizeof(cl_int),
+                                               indices.data(),
+                                               0,
+                                               nullptr,
+                                               &ev);
+                if (ev) { indices_event = cl::event(ev, ::clReleaseEvent); }
+                throw_cl_error(error, "Error uploading indices_map to device");
+                profile.add(Stage::UPLOAD, -1, indices_event);
+
+                // Project the points that were found and mark which of them are on the screen
+                const size_t global_size = (((n_nodes - 1) / workgroup_size) + 1) * workgroup_size;
+                cl::event projected      = enqueue_projection(
+                  frame, cl_points, memory.indices, memory.pixels, Hoc, lens, 0, global_size, indices_event);
+                profile.add(Stage::PROJECT, -1, projected);
+                cl::event scanned = enqueue_cull(frame, cl_points, memory.indices, Hoc, lens, n_nodes, projected);
+                profile.add(Stage::PROJECT, -1, scanned);
+                flush();
+
+                // This can happen on the CPU while the OpenCL device is busy
+                FrameRecorder::Scope graph(profile.recorder, Stage::PROJECT);
+                std::vector<std::array<int, N_NEIGHBOURS>> local_neighbourhood =
+                  build_neighbourhood(mesh, indices, remap);
+                graph.stop();
+
+                // Upload the neighbourhood of the points that were found, including their offscreen point
+                cl::event neighbourhood_event;
+                ev    = nullptr;
+                error = ::clEnqueueWriteBuffer(transfer_queue,
+                                               memory.neighbourhood,
+                                               false,
+                                               0,
+                                               local_neighbourhood.size() * sizeof(std::array<int, N_NEIGHBOURS>),
+                                               local_neighbourhood.data(),
+                                               0,
+                                               nullptr,
+                                               &ev);
+                if (ev) { neighbourhood_event = cl::event(ev, ::clReleaseEvent); }
+                throw_cl_error(error, "Error writing neighbourhood points to the device");
+                profile.add(Stage::UPLOAD, -1, neighbourhood_event);
+
+                // Waiting for the upload as well means the host buffers outlive both of their uploads
+                const int n_points  = read_scan_total(frame, n_nodes, {scanned, neighbourhood_event});
+                projection.n_points = n_points;
+                if (n_points == 0) { return projection; }
+
+                projection.indices       = get_indices_map_memory(frame, n_points);
+                projection.pixels        = get_pixel_coordinates_memory(frame, n_points);
+                projection.neighbourhood = get_neighbourhood_memory(frame, n_points + 1, N_NEIGHBOURS);
+
+                // Pack the points on the screen together
+                projection.compacted =
+                  enqueue_compact(frame, memory.indices, n_nodes, projection.indices, projection.pixels, scanned);
+                profile.add(Stage::PROJECT, -1, projection.compacted);
+
+                // Remove the points that are not on the screen from the neighbourhood graph
+                int n_neighbours = N_NEIGHBOURS;
+                cl_mem arg       = nullptr;
+                arg              = memory.on_screen;
+                throw_cl_error(::clSetKernelArg(frame.cull_neighbourhood, 0, MEM_SIZE, &arg),
+                               "Error setting kernel argument 0 for cull neighbourhood kernel");
+                arg = memory.offsets.front();
+                throw_cl_error(::clSetKernelArg(frame.cull_neighbourhood, 1, MEM_SIZE, &arg),
+                               "Error setting kernel argument 1 for cull neighbourhood kernel");
+                arg = memory.neighbourhood;
+                throw_cl_error(::clSetKernelArg(frame.cull_neighbourhood, 2, MEM_SIZE, &arg),
+                               "Error setting kernel argument 2 for cull neighbourhood kernel");
+                throw_cl_error(::clSetKernelArg(frame.cull_neighbourhood, 3, sizeof(n_neighbours), &n_neighbours),
+                               "Error setting kernel argument 3 for cull neighbourhood kernel");
+                throw_cl_error(::clSetKernelArg(frame.cull_neighbourhood, 4, sizeof(n_nodes), &n_nodes),
+                               "Error setting kernel argument 4 for cull neighbourhood kernel");
+                arg = projection.neighbourhood;
+                throw_cl_error(::clSetKernelArg(frame.cull_neighbourhood, 5, MEM_SIZE, &arg),
+                               "Error setting kernel argument 5 for cull neighbourhood kernel");
+                // This includes the offscreen point at the end
+                projection.remapped = enqueue_kernel(
+                  frame.cull_neighbourhood, n_nodes + 1, workgroup_size, {scanned}, "cull neighbourhood");
+                profile.add(Stage::PROJECT, -1, projection.remapped);
+
+                flush();
+                return projection;
+            }
+
+            /**
+             * @brief Read the indices and neighbourhood graph of the points the device found on the screen
+             *
+             * @tparam N_NEIGHBOURS the number of neighbours each point has
+             *
+             * @param projection the points on the screen that were found by the device
+             * @param blocking   if the reads must be finished before this returns
+             *
+             * @return the indices and neighbourhood graph, and the event for when they have been read
+             */
+            template <int N_NEIGHBOURS>
+            std::pair<std::pair<std::vector<int>, std::vector<std::array<int, N_NEIGHBOURS>>>, cl::event>
+              read_device_graph(const DeviceProjection& projection, const bool& blocking) const {
+                if (projection.n_points == 0) { return {}; }
+
+                std::vector<int> indices(projection.n_points);
+                std::vector<std::array<int, N_NEIGHBOURS>> neighbourhood(projection.n_points + 1);
+
+                cl::event indices_read;
+                cl_event ev  = nullptr;
+                cl_event iev = projection.compacted;
+                cl_int error = ::clEnqueueReadBuffer(transfer_queue,
+                                                     projection.indices,
+                                                     blocking,
+                                                     0,
+                                                     indices.size() * sizeof(int),
+                                                     indices.data(),
+                                                     1,
+                                                     &iev,
+                                                     &ev);
+                if (ev) { indices_read = cl::event(ev, ::clReleaseEvent); }
+                throw_cl_error(error, "Error reading the indices of the points on the screen");
+
+                cl::event neighbourhood_read;
+                ev    = nullptr;
+                iev   = projection.remapped;
+                error = ::clEnqueueReadBuffer(transfer_queue,
+                                              projection.neighbourhood,
+                                              blocking,
+                                              0,
+                                              neighbourhood.size() * sizeof(std::array<int, N_NEIGHBOURS>),
+                                              neighbourhood.data(),
+                                              1,
+                                              &iev,
+                                              &ev);
+                if (ev) { neighbourhood_read = cl::event(ev, ::clReleaseEvent); }
+                throw_cl_error(error, "Error reading the neighbourhood of the points on the screen");
+
+                // Combine the reads so there is a single event to wait on
+                cl::event graph_read;
+                std::array<cl_event, 2> reads = {{indices_read, neighbourhood_read}};
+                ev                            = nullptr;
+                error = ::clEnqueueMarkerWithWaitList(transfer_queue, reads.size(), reads.data(), &ev);
+                if (ev) { graph_read = cl::event(ev, ::clReleaseEvent); }
+                throw_cl_error(error, "Error waiting for the reads of the neighbourhood graph");
+
+                return std::make_pair(std::make_pair(std::move(indices), std::move(neighbourhood)), graph_read);
+            }
+
+            /**
+             * @brief Project and classify a mesh, reading back only the points whose score for a class passes a
+             * threshold and optionally the connected component each of them is in
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh      the mesh table that we are projecting to pixel coordinates
+             * @param Hoc       the homogenous transformation matrix from the camera to the observation plane
+             * @param lens      the lens parameters that describe the optics of the camera
+             * @param image     the data that represents the image the network will run from
+             * @param format    the pixel format of this image as a fourcc code
+             * @param cls       the index of the class in the output of the network to threshold on
+             * @param min_score the lowest score for the class that a point can have and be kept
+             * @param labels    if not nullptr, set to the smallest index on the screen of the points connected to each
+             *                  point that passed
+             *
+             * @return the points that passed the threshold with the scores of all their classes
+             */
+            template <template <typename> class Model>
+            ThresholdedMesh<Scalar> select_points(const Mesh<Scalar, Model>& mesh,
+                                                  const mat4<Scalar>& Hoc,
+                                                  const Lens<Scalar>& lens,
+                                                  const void* image,
+                                                  const uint32_t& format,
+                                                  const int& cls,
+                                                  const Scalar& min_score,
+                                                  std::vector<int>* labels) const {
+                static constexpr int N_NEIGHBOURS = Model<Scalar>::N_NEIGHBOURS;
+                if (labels != nullptr) { labels->clear(); }
+
+                auto lease   = acquire_frame();
+                Frame& frame = *lease;
+
+                int n_classes = frame.conv_layers.back().second;
+                if (cls < 0 || cls >= n_classes) {
+                    throw std::invalid_argument("The class to threshold on is not an output of the network");
+                }
+
+                // Run the network, leaving the graph on the device as it is not needed
+                Profile profile(nullptr);
+                auto classified =
+                  enqueue_classification<N_NEIGHBOURS>(frame, mesh, Hoc, lens, image, format, false, profile);
+                if (classified.n_points == 0) { return ThresholdedMesh<Scalar>(); }
+
+                // The on screen flags and prefix sum are sized for the whole mesh. Once the network has started the
+                // device lookup no longer needs them so they are reused here
+                const int n_nodes = mesh.nodes.size();
+                auto& memory      = get_lookup_memory(frame, n_nodes);
+                int n_points      = classified.n_points;
+                int n             = memory.sizes.front();
+
+                cl_mem arg = nullptr;
+                arg        = classified.classifications;
+                throw_cl_error(::clSetKernelArg(frame.threshold_points, 0, MEM_SIZE, &arg),
+                               "Error setting kernel argument 0 for threshold kernel");
+                throw_cl_error(::clSetKernelArg(frame.threshold_points, 1, sizeof(n_classes), &n_classes),
+                               "Error setting kernel argument 1 for threshold kernel");
+                throw_cl_error(::clSetKernelArg(frame.threshold_points, 2, sizeof(cls), &cls),
+                               "Error setting kernel argument 2 for threshold kernel");
+                throw_cl_error(::clSetKernelArg(frame.threshold_points, 3, sizeof(min_score), &min_score),
+                               "Error setting kernel argument 3 for threshold kernel");
+                throw_cl_error(::clSetKernelArg(frame.threshold_points, 4, sizeof(n_points), &n_points),
+                               "Error setting kernel argument 4 for threshold kernel");
+                throw_cl_error(::clSetKernelArg(frame.threshold_points, 5, sizeof(n), &n),
+                               "Error setting kernel argument 5 for threshold kernel");
+                arg = memory.on_screen;
+                throw_cl_error(::clSetKernelArg(frame.threshold_points, 6, MEM_SIZE, &arg),
+                               "Error setting kernel argument 6 for threshold kernel");
+                cl::event thresholded =
+                  enqueue_kernel(frame.threshold_points, n, workgroup_size, {classified.classified}, "threshold");
+
+                // Label the connected components of the points that passed using the graph that is on the device
+                cl::event labelled = thresholded;
+                cl::mem cl_labels;
+                if (labels != nullptr) {
+                    cl_labels        = get_labels_memory(frame, n_points);
+                    int n_neighbours = N_NEIGHBOURS;
+                    arg              = memory.on_screen;
+                    throw_cl_error(::clSetKernelArg(frame.init_labels, 0, MEM_SIZE, &arg),
+                                   "Error setting kernel argument 0 for init labels kernel");
+                    throw_cl_error(::clSetKernelArg(frame.init_labels, 1, sizeof(n_points), &n_points),
+                                   "Error setting kernel argument 1 for init labels kernel");
+                    arg = cl_labels;
+                    throw_cl_error(::clSetKernelArg(frame.init_labels, 2, MEM_SIZE, &arg),
+                                   "Error setting kernel argument 2 for init labels kernel");
+                    cl::event initialised =
+                      enqueue_kernel(frame.init_labels, n_points, workgroup_size, {thresholded}, "init labels");
+
+                    arg = classified.device_neighbourhood;
+                    throw_cl_error(::clSetKernelArg(frame.link_labels, 0, MEM_SIZE, &arg),
+                                   "Error setting kernel argument 0 for link labels kernel");
+                    throw_cl_error(::clSetKernelArg(frame.link_labels, 1, sizeof(n_neighbours), &n_neighbours),
+                                   "Error setting kernel argument 1 for link labels kernel");
+                    throw_cl_error(::clSetKernelArg(frame.link_labels, 2, sizeof(n_points), &n_points),
+                                   "Error setting kernel argument 2 for link labels kernel");
+                    arg = cl_labels;
+                    throw_cl_error(::clSetKernelArg(frame.link_labels, 3, MEM_SIZE, &arg),
+                                   "Error setting kernel argument 3 for link labels kernel");
+                    cl::event linked =
+                      enqueue_kernel(frame.link_labels, n_points, workgroup_size, {initialised}, "link labels");
+
+                    throw_cl_error(::clSetKernelArg(frame.flatten_labels, 0, sizeof(n_points), &n_points),
+                                   "Error setting kernel argument 0 for flatten labels kernel");
+                    throw_cl_error(::clSetKernelArg(frame.flatten_labels, 1, MEM_SIZE, &arg),
+                                   "Error setting kernel argument 1 for flatten labels kernel");
+                    labelled =
+                      enqueue_kernel(frame.flatten_labels, n_points, workgroup_size, {linked}, "flatten labels");
+                }
+
+                // The last value of the prefix sum is how many points passed
+                cl::event scanned = enqueue_scan(frame, memory.on_screen, 0, labelled);
+                int n_selected    = 0;
+                cl_event iev      = scanned;
+                // Blocking only flushes the queue the read is in, the kernels it waits on must be flushed as well
+                flush();
+                throw_cl_error(::clEnqueueReadBuffer(transfer_queue,
+                                                     memory.offsets.front(),
+                                                     true,
+                                                     (n - 1) * sizeof(cl_int),
+                                                     sizeof(cl_int),
+                                                     &n_selected,
+                                                     1,
+                                                     &iev,
+                                                     nullptr),
+                               "Error reading the number of points that passed the threshold");
+                if (n_selected == 0) { return ThresholdedMesh<Scalar>(); }
+
+                // Pack the points that passed together
+                auto& selected = get_selected_memory(frame, n_selected);
+                arg            = memory.on_screen;
+                throw_cl_error(::clSetKernelArg(frame.compact_selected, 0, MEM_SIZE, &arg),
+                               "Error setting kernel argument 0 for compact selected kernel");
+                arg = memory.offsets.front();
+                throw_cl_error(::clSetKernelArg(frame.compact_selected, 1, MEM_SIZE, &arg),
+                               "Error setting kernel argument 1 for compact selected kernel");
+                arg = classified.device_indices;
+                throw_cl_error(::clSetKernelArg(frame.compact_selected, 2, MEM_SIZE, &arg),
+                               "Error setting kernel argument 2 for compact selected kernel");
+                arg = classified.pixels;
+                throw_cl_error(::clSetKernelArg(frame.compact_selected, 3, MEM_SIZE, &arg),
+                               "Error setting kernel argument 3 for compact selected kernel");
+                arg = classified.classifications;
+                throw_cl_error(::clSetKernelArg(frame.compact_selected, 4, MEM_SIZE, &arg),
+                               "Error setting kernel argument 4 for compact selected kernel");
+                throw_cl_error(::clSetKernelArg(frame.compact_selected, 5, sizeof(n_classes), &n_classes),
+                               "Error setting kernel argument 5 for compact selected kernel");
+                throw_cl_error(::clSetKernelArg(frame.compact_selected, 6, sizeof(n_points), &n_points),
+                               "Error setting kernel argument 6 for compact selected kernel");
+                arg = selected.indices;
+                throw_cl_error(::clSetKernelArg(frame.compact_selected, 7, MEM_SIZE, &arg),
+                               "Error setting kernel argument 7 for compact selected kernel");
+                arg = selected.pixels;
+                throw_cl_error(::clSetKernelArg(frame.compact_selected, 8, MEM_SIZE, &arg),
+                               "Error setting kernel argument 8 for compact selected kernel");
+                arg = selected.classifications;
+                throw_cl_error(::clSetKernelArg(frame.compact_selected, 9, MEM_SIZE, &arg),
+                               "Error setting kernel argument 9 for compact selected kernel");
+                cl::event compacted =
+                  enqueue_kernel(frame.compact_selected, n_points, workgroup_size, {scanned}, "compact selected");
+
+                // The labels are packed in the same order as the points
+                if (labels != nullptr) {
+                    arg = memory.on_screen;
+                    throw_cl_error(::clSetKernelArg(frame.compact_labels, 0, MEM_SIZE, &arg),
+                                   "Error setting kernel argument 0 for compact labels kernel");
+                    arg = memory.offsets.front();
+                    throw_cl_error(::clSetKernelArg(frame.compact_labels, 1, MEM_SIZE, &arg),
+                                   "Error setting kernel argument 1 for compact labels kernel");
+                    arg = cl_labels;
+                    throw_cl_error(::clSetKernelArg(frame.compact_labels, 2, MEM_SIZE, &arg),
+                                   "Error setting kernel argument 2 for compact labels kernel");
+                    throw_cl_error(::clSetKernelArg(frame.compact_labels, 3, sizeof(n_points), &n_points),
+                                   "Error setting kernel argument 3 for compact labels kernel");
+                    arg = selected.labels;
+                    throw_cl_error(::clSetKernelArg(frame.compact_labels, 4, MEM_SIZE, &arg),
+                                   "Error setting kernel argument 4 for compact labels kernel");
+                    compacted =
+                      enqueue_kernel(frame.compact_labels, n_points, workgroup_size, {compacted}, "compact labels");
+                }
+
+                // Read back only the points that passed
+                ThresholdedMesh<Scalar> result;
+                result.global_indices.resize(n_selected);
+                result.pixel_coordinates.resize(n_selected);
+                result.classifications.resize(n_selected * n_classes);
+                std::vector<cl_event> reads;
+                auto read = [&](const cl::mem& buffer, void* data, const size_t& size) {
+                    cl_event ev  = nullptr;
+                    cl_event iev = compacted;
+                    cl_int error = ::clEnqueueReadBuffer(transfer_queue, buffer, false, 0, size, data, 1, &iev, &ev);
+                    if (ev) {
+                        frame.complete.emplace_back(ev, ::clReleaseEvent);
+                        reads.push_back(ev);
+                    }
+                    throw_cl_error(error, "Error reading the points that passed the threshold");
+                };
+                read(selected.indices, result.global_indices.data(), n_selected * sizeof(int));
+                read(selected.pixels, result.pixel_coordinates.data(), n_selected * sizeof(std::array<Scalar, 2>));
+                read(selected.classifications,
+                     result.classifications.data(),
+                     result.classifications.size() * sizeof(Scalar));
+                if (labels != nullptr) {
+                    labels->resize(n_selected);
+                    read(selected.labels, labels->data(), n_selected * sizeof(int));
+                }
+                flush();
+                throw_cl_error(::clWaitForEvents(reads.size(), reads.data()),
+                               "Error waiting for the points that passed the threshold");
+
+                return result;
+            }
+
+            /**
+             * @brief Queue the projection and classification of a mesh, leaving the results on the device
+             *
+             * @tparam N_NEIGHBOURS the number of neighbours each point has
+             * @tparam Model        the mesh model that we are projecting
+             *
+             * @param frame      the frame whose kernels and buffers are used
+             * @param mesh       the mesh table that we are projecting to pixel coordinates
+             * @param Hoc        the homogenous transformation matrix from the camera to the observation plane
+             * @param lens       the lens parameters that describe the optics of the camera
+             * @param image      the data that represents the image the network will run from
+             * @param format     the pixel format of this image as a fourcc code
+             * @param read_graph if a graph that was built on the device should be read back while the network runs
+             * @param profile    where the device commands are added to be timed
+             * @param region     the part of the image to classify, or null for the whole image
+             *
+             * @return the device buffers holding the classified points and the graph if it is on the host
+             */
+            template <int N_NEIGHBOURS, template <typename> class Model>
+            DeviceClassification<N_NEIGHBOURS> enqueue_classification(Frame& frame,
+                                                                      const Mesh<Scalar, Model>& mesh,
+                                                                      const mat4<Scalar>& Hoc,
+                                                                      const Lens<Scalar>& lens,
+                                                                      const void* image,
+                                                                      const uint32_t& format,
+                                                                      const bool& read_graph,
+                                                                      Profile& profile,
+                                                                      const Region<Scalar>* region = nullptr) const {
+                DeviceClassification<N_NEIGHBOURS> classified;
+                cl_int error = CL_SUCCESS;
+
+                // Get our image onto the device
+                cl::mem cl_image;
+                cl::event cl_image_loaded;
+                std::tie(cl_image, cl_image_loaded) = enqueue_image(frame, 0, image, lens.dimensions, format);
+                profile.add(Stage::UPLOAD, -1, cl_image_loaded);
+                cl_event ev = nullptr;
+
+                // Project our visual mesh
+                cl::mem cl_neighbourhood;
+                cl::event cl_neighbourhood_loaded;
+                // The image is loaded separately when the points are packed together on the device, which is never
+                // done for a region as it is always looked up on the host
+                const bool device_projection = region == nullptr && (device_lookup || offscreen_culling);
+                if (device_projection) {
+                    DeviceProjection projection;
+                    if (device_lookup) {
+                        projection = do_project_on_device(frame, mesh, Hoc, lens);
+                        profile.add(Stage::LOOKUP, -1, projection.compacted);
+                        profile.add(Stage::PROJECT, -1, projection.remapped);
+                    }
+                    else {
+                        projection = do_project_culled(frame, mesh, Hoc, lens, profile);
+                    }
+                    classified.n_points = projection.n_points;
+                    if (read_graph) {
+                        auto graph = read_device_graph<N_NEIGHBOURS>(projection, false);
+                        std::tie(classified.indices, classified.neighbourhood) = std::move(graph.first);
+                        classified.graph_read                                  = graph.second;
+                        profile.add(Stage::READBACK, -1, classified.graph_read);
+                    }
+                    classified.device_indices = projection.indices;
+                    classified.pixels         = projection.pixels;
+                    classified.pixels_loaded  = projection.compacted;
+                    cl_neighbourhood          = projection.neighbourhood;
+                    cl_neighbourhood_loaded   = projection.remapped;
+                }
+                else {
+                    // The image is loaded into the network input by the projection kernel
+                    std::tie(
+                      classified.neighbourhood, classified.indices, classified.pixels, classified.pixels_loaded) =
+                      do_project(frame, mesh, Hoc, lens, profile, region, cl_image, format, cl_image_loaded);
+                    classified.n_points = classified.indices.size();
+                    // The indices were uploaded to this buffer for the projection
+                    if (classified.n_points > 0) {
+                        classified.device_indices = get_indices_map_memory(frame, classified.n_points);
+                    }
+                }
+
+                // If there were no points, nothing to project
+                if (classified.n_points == 0) { return classified; }
+
+                // This includes the offscreen point at the end
+                int n_points = classified.n_points + 1;
+
+                if (!device_projection) {
+                    // Get the neighbourhood memory from cache
+                    cl_neighbourhood = get_neighbourhood_memory(frame, n_points, N_NEIGHBOURS);
+
+                    // Upload the neighbourhood buffer
+                    ev    = nullptr;
+                    error = ::clEnqueueWriteBuffer(transfer_queue,
+                                                   cl_neighbourhood,
+                                                   false,
+                                                   0,
+                                                   n_points * sizeof(std::array<int, N_NEIGHBOURS>),
+                                                   classified.neighbourhood.data(),
+                                                   0,
+                                                   nullptr,
+                                                   &ev);
+                    if (ev) { cl_neighbourhood_loaded = cl::event(ev, ::clReleaseEvent); }
+                    throw_cl_error(error, "Error writing neighbourhood points to the device");
+                    profile.add(Stage::UPLOAD, -1, cl_neighbourhood_loaded);
+                }
+
+                // Grab our ping pong buffers from the cache
+                auto cl_conv_buffers   = get_network_memory(frame, max_width * n_points);
+                cl::mem cl_conv_input  = cl_conv_buffers[0];
+                cl::mem cl_conv_output = cl_conv_buffers[1];
+
+                // Read the pixels into the buffer and give the offscreen point its value, unless the projection did
+                cl::event img_load_event       = classified.pixels_loaded;
+                cl::event offscreen_fill_event = classified.pixels_loaded;
+                if (device_projection) {
+                    std::tie(img_load_event, offscreen_fill_event) =
+                      enqueue_load_image(frame,
+                                         cl_image,
+                                         format,
+                                         lens.dimensions,
+                                         classified.pixels,
+                                         cl_conv_input,
+                                         0,
+                                         (((n_points - 1) / workgroup_size) + 1) * workgroup_size,
+                                         n_points - 1,
+                                         {classified.pixels_loaded, cl_image_loaded});
+                    profile.add(Stage::LOAD_IMAGE, -1, img_load_event);
+                    profile.add(Stage::LOAD_IMAGE, -1, offscreen_fill_event);
+                }
+
+                classified.device_neighbourhood = cl_neighbourhood;
+
+                // These events are required for our first convolution
+                std::tie(classified.classified, classified.classifications) =
+                  enqueue_network(frame,
+                                  cl_neighbourhood,
+                                  cl_conv_input,
+                                  cl_conv_output,
+                                  (((n_points - 1) / workgroup_size) + 1) * workgroup_size,
+                                  {img_load_event, offscreen_fill_event, cl_neighbourhood_loaded},
+                                  profile);
+
+                return classified;
+            }
+
+            /**
+             * @brief Queue an exclusive prefix sum of a buffer into the offsets of the lookup memory at a level
+             *
+             * @details
+             *  Each workgroup sums its own block, then the totals of the blocks are summed by the next level and added
+             *  back on to each block. The last level holds the total of everything.
+             *
+             * @param frame the frame whose kernels and lookup memory are used
+             * @param input the values to sum, which may be the offsets of this level
+             * @param level the level of the lookup memory to write the sums to
+             * @param wait  the event that must complete before the sum can start
+             *
+             * @return the event for when the prefix sum has finished
+             */
+            cl::event enqueue_scan(Frame& frame,
+                                   const cl::mem& input,
+                                   const size_t& level,
+                                   const cl::event& wait) const {
+                const auto& memory = frame.lookup_memory;
+                int n              = memory.sizes[level];
+                int block_size     = scan_size();
+
+                cl_mem arg = nullptr;
+                arg        = input;
+                throw_cl_error(::clSetKernelArg(frame.scan_blocks, 0, MEM_SIZE, &arg),
+                               "Error setting kernel argument 0 for scan kernel");
+                arg = memory.offsets[level];
+                throw_cl_error(::clSetKernelArg(frame.scan_blocks, 1, MEM_SIZE, &arg),
+                               "Error setting kernel argument 1 for scan kernel");
+                arg = memory.offsets[level + 1];
+                throw_cl_error(::clSetKernelArg(frame.scan_blocks, 2, MEM_SIZE, &arg),
+                               "Error setting kernel argument 2 for scan kernel");
+                throw_cl_error(::clSetKernelArg(frame.scan_blocks, 3, sizeof(n), &n),
+                               "Error setting kernel argument 3 for scan kernel");
+                throw_cl_error(::clSetKernelArg(frame.scan_blocks, 4, block_size * sizeof(cl_int), nullptr),
+                               "Error setting kernel argument 4 for scan kernel");
+                cl::event scanned = enqueue_kernel(frame.scan_blocks, n, block_size, {wait}, "scan");
+
+                // A single block already has its final sums
+                if (memory.sizes[level + 1] == 1) { return scanned; }
+
+                // Sum the totals of the blocks in place and add them on to each block
+                cl::event blocks_scanned = enqueue_scan(frame, memory.offsets[level + 1], level + 1, scanned);
+                arg                      = memory.offsets[level];
+                throw_cl_error(::clSetKernelArg(frame.add_block_offsets, 0, MEM_SIZE, &arg),
+                               "Error setting kernel argument 0 for block offset kernel");
+                arg = memory.offsets[level + 1];
+                throw_cl_error(::clSetKernelArg(frame.add_block_offsets, 1, MEM_SIZE, &arg),
+                               "Error setting kernel argument 1 for block offset kernel");
+                throw_cl_error(::clSetKernelArg(frame.add_block_offsets, 2, sizeof(block_size), &block_size),
+                               "Error setting kernel argument 2 for block offset kernel");
+                throw_cl_error(::clSetKernelArg(frame.add_block_offsets, 3, sizeof(n), &n),
+                               "Error setting kernel argument 3 for block offset kernel");
+                return enqueue_kernel(frame.add_block_offsets, n, block_size, {blocks_scanned}, "block offset");
+            }
+
+            /**
+             * @brief Queue a kernel whose arguments have been set over enough workgroups to cover a number of items
+             *
+             * @param kernel     the kernel to run
+             * @param n          the number of items the kernel needs to run over
+             * @param local_size the workgroup size to run the kernel with
+             * @param wait       the event that must complete before the kernel can start
+             * @param name       the name of the kernel for error messages
+             *
+             * @return the event for when the kernel has finished
+             */
+            cl::event enqueue_kernel(const cl::kernel& kernel,
+                                     const int& n,
+                                     const size_t& local_size,
+                                     const std::array<cl::event, 1>& wait,
+                                     const std::string& name) const {
+                size_t offset      = 0;
+                size_t global_size = ((n - 1) / local_size + 1) * local_size;
+                cl_event iev       = wait[0];
+                cl::event event;
+                cl_event ev  = nullptr;
+                cl_int error = ::clEnqueueNDRangeKernel(
+                  queue, kernel, 1, &offset, &global_size, &local_size, iev ? 1 : 0, iev ? &iev : nullptr, &ev);
+                if (ev) { event = cl::event(ev, ::clReleaseEvent); }
+                throw_cl_error(error, "Error queueing the " + name + " kernel");
+                return event;
+            }
+
+            /**
+             * @brief Get the unit vectors of a mesh on the device, uploading them the first time the mesh is used
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh the mesh whose unit vectors we need
+             *
+             * @return the device buffer holding the unit vectors of the mesh
+             */
+            template <template <typename> class Model>
+            cl::mem get_device_points(const Mesh<Scalar, Model>& mesh) const {
+                cl_int error = 0;
+
+                /* mutex scope */ {
+                    std::lock_guard<std::mutex> lock(device_points_mutex);
+                    const DeviceMesh* device_mesh = device_points_cache.find(mesh.id());
+                    if (device_mesh != nullptr && device_mesh->points) { return device_mesh->points; }
+                }
+
+                cl::mem cl_points =
+                  cl::mem(::clCreateBuffer(
+                            context, CL_MEM_READ_ONLY, sizeof(vec4<Scalar>) * mesh.nodes.size(), nullptr, &error),
+                          ::clReleaseMemObject);
+
+                // Interleave our rays as the kernels load them as 4d vectors
+                std::vector<vec4<Scalar>> rays(mesh.nodes.size());
+                for (std::size_t i = 0; i < rays.size(); ++i) {
+                    const auto& ray = mesh.nodes[i].ray;
+                    rays[i]         = vec4<Scalar>{ray[0], ray[1], ray[2], 0};
+                }
+
+                // Write the points buffer to the device and cache it
+                error = ::clEnqueueWriteBuffer(
+                  queue, cl_points, true, 0, rays.size() * sizeof(vec4<Scalar>), rays.data(), 0, nullptr, nullptr);
+                throw_cl_error(error, "Error writing points to the device buffer");
+
+                // Cache for future runs, unless another thread uploaded it while we were
+                std::lock_guard<std::mutex> lock(device_points_mutex);
+                DeviceMesh& device_mesh = device_points_cache[mesh.id()];
+                if (device_mesh.points) { return device_mesh.points; }
+                device_mesh.points = cl_points;
+                device_points_cache.allocated(mesh.id(), rays.size() * sizeof(vec4<Scalar>));
+                return cl_points;
+            }
+
+            /**
+             * @brief Get a mesh on the device including its neighbourhood graph, uploading what isn't there yet
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh the mesh whose buffers we need
+             *
+             * @return the device buffers holding the mesh
+             */
+            template <template <typename> class Model>
+            DeviceMesh get_device_mesh(const Mesh<Scalar, Model>& mesh) const {
+                static constexpr int N_NEIGHBOURS = Model<Scalar>::N_NEIGHBOURS;
+                cl_int error                      = CL_SUCCESS;
 
-                // Convenience variables
-                const auto& nodes = mesh.nodes;
+                cl::mem cl_points = get_device_points(mesh);
 
-                // Upload our visual mesh unit vectors if we have to
-                cl::mem cl_points;
+                std::lock_guard<std::mutex> lock(device_points_mutex);
+                DeviceMesh& device_mesh = device_points_cache[mesh.id()];
+                if (device_mesh.neighbourhood) { return device_mesh; }
 
-                auto device_mesh = device_points_cache.find(&mesh);
-                if (device_mesh == device_points_cache.end()) {
-                    cl_points =
-                      cl::mem(::clCreateBuffer(
-                                context, CL_MEM_READ_ONLY, sizeof(vec4<Scalar>) * mesh.nodes.size(), nullptr, &error),
-                              ::clReleaseMemObject);
+                // Another thread may have dropped the points since we got them, if so they are ours again
+                if (!device_mesh.points) {
+                    device_mesh.points = cl_points;
+                    device_points_cache.allocated(mesh.id(), mesh.nodes.size() * sizeof(vec4<Scalar>));
+                }
 
-                    // Flatten our rays
-                    std::vector<vec4<Scalar>> rays;
-                    rays.reserve(mesh.nodes.size());
-                    for (const auto& n : mesh.nodes) {
-                        rays.emplace_back(vec4<Scalar>{n.ray[0], n.ray[1], n.ray[2], 0});
-                    }
+                // The projection kernels are run over a multiple of the workgroup size, the extra indices repeat the
+                // last point so they stay in bounds
+                const int n_nodes = mesh.nodes.size();
+                std::vector<int> identity(((n_nodes - 1) / workgroup_size + 1) * workgroup_size);
+                for (int i = 0; i < int(identity.size()); ++i) {
+                    identity[i] = std::min(i, n_nodes - 1);
+                }
+                std::vector<std::array<int, N_NEIGHBOURS>> neighbourhood(n_nodes);
+                for (int i = 0; i < n_nodes; ++i) {
+                    neighbourhood[i] = mesh.nodes[i].neighbours;
+                }
 
-                    // Write the points buffer to the device and cache it
-                    error = ::clEnqueueWriteBuffer(
-                      queue, cl_points, true, 0, rays.size() * sizeof(vec4<Scalar>), rays.data(), 0, nullptr, nullptr);
-                    throw_cl_error(error, "Error writing points to the device buffer");
+                cl::mem cl_identity(
+                  ::clCreateBuffer(context, CL_MEM_READ_ONLY, identity.size() * sizeof(cl_int), nullptr, &error),
+                  ::clReleaseMemObject);
+                throw_cl_error(error, "Error allocating the mesh index buffer on device");
+                error = ::clEnqueueWriteBuffer(queue,
+                                               cl_identity,
+                                               true,
+                                               0,
+                                               identity.size() * sizeof(cl_int),
+                                               identity.data(),
+                                               0,
+                                               nullptr,
+                                               nullptr);
+                throw_cl_error(error, "Error writing the mesh indices to the device");
+
+                cl::mem cl_neighbourhood(::clCreateBuffer(context,
+                                                          CL_MEM_READ_ONLY,
+                                                          neighbourhood.size() * sizeof(std::array<int, N_NEIGHBOURS>),
+                                                          nullptr,
+                                                          &error),
+                                         ::clReleaseMemObject);
+                throw_cl_error(error, "Error allocating the mesh neighbourhood buffer on device");
+                error = ::clEnqueueWriteBuffer(queue,
+                                               cl_neighbourhood,
+                                               true,
+                                               0,
+                                               neighbourhood.size() * sizeof(std::array<int, N_NEIGHBOURS>),
+                                               neighbourhood.data(),
+                                               0,
+                                               nullptr,
+                                               nullptr);
+                throw_cl_error(error, "Error writing the mesh neighbourhood to the device");
+
+                device_mesh.identity      = cl_identity;
+                device_mesh.neighbourhood = cl_neighbourhood;
+                device_points_cache.allocated(
+                  mesh.id(),
+                  identity.size() * sizeof(cl_int) + neighbourhood.size() * sizeof(std::array<int, N_NEIGHBOURS>));
+                return device_mesh;
+            }
 
-                    // Cache for future runs
-                    device_points_cache[&mesh] = cl_points;
-                }
+            /**
+             * @brief Find the indices of the points in the mesh that may be on screen
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh   the mesh table that we are projecting to pixel coordinates
+             * @param Hoc    the homogenous transformation matrix from the camera to the observation plane
+             * @param lens   the lens parameters that describe the optics of the camera
+             * @param remap  set to map indices in the mesh to their position in the returned indices
+             * @param region the part of the image to find the points in, or null for the whole image
+             *
+             * @return the indices of every point in the on screen ranges of the mesh
+             */
+            template <template <typename> class Model>
+            std::vector<int> lookup_indices(const Mesh<Scalar, Model>& mesh,
+                                            const mat4<Scalar>& Hoc,
+                                            const Lens<Scalar>& lens,
+                                            RangeLookup& remap,
+                                            const Region<Scalar>* region = nullptr) const {
+                // Lookup the on screen ranges, a region doesn't use the incremental lookup
+                std::vector<std::pair<int, int>> ranges;
+                if (region != nullptr) { mesh.lookup(Hoc, lens, *region, ranges); }
                 else {
-                    cl_points = device_mesh->second;
+                    (*lookup)(mesh, Hoc, lens, ranges);
                 }
+                remap.reset(ranges);
 
                 // First count the size of the buffer we will need to allocate
                 int n_points = 0;
@@ -523,13 +3186,6 @@ namespace engine {
                     n_points += range.second - range.first;
                 }
 
-                // No point processing if we have no points, return an empty mesh
-                if (n_points == 0) {
-                    return std::make_tuple(
-                      std::vector<std::array<int, N_NEIGHBOURS>>(), std::vector<int>(), cl::mem(), cl::event());
-                }
-
-                // Build up our list of indices for OpenCL
                 // Use iota to fill in the numbers
                 std::vector<int> indices(n_points);
                 auto it = indices.begin();
@@ -538,178 +3194,778 @@ namespace engine {
                     std::iota(it, n, range.first);
                     it = n;
                 }
+                return indices;
+            }
 
-                // Create buffers for indices map
-                cl::mem indices_map       = get_indices_map_memory(n_points);
-                cl::mem pixel_coordinates = get_pixel_coordinates_memory(n_points);
-
-                // Upload our indices map
-                cl::event indices_event;
-                ev    = nullptr;
-                error = ::clEnqueueWriteBuffer(
-                  queue, indices_map, false, 0, indices.size() * sizeof(cl_int), indices.data(), 0, nullptr, &ev);
-                if (ev) { indices_event = cl::event(ev, ::clReleaseEvent); }
-                throw_cl_error(error, "Error uploading indices_map to device");
+            /**
+             * @brief Build the packed neighbourhood map for a set of points with an extra offscreen point at the end
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh    the mesh table the points come from
+             * @param indices the indices of the points in the mesh
+             * @param remap   the lookup from indices in the mesh to their position in indices, where the offscreen
+             *                point is one past the end
+             *
+             * @return the neighbourhood of each point as indices into the points, with the offscreen point last
+             */
+            template <template <typename> class Model>
+            static std::vector<std::array<int, Model<Scalar>::N_NEIGHBOURS>> build_neighbourhood(
+              const Mesh<Scalar, Model>& mesh,
+              const std::vector<int>& indices,
+              const RangeLookup& remap) {
+                const auto& nodes  = mesh.nodes;
+                const int n_points = indices.size();
 
-                // When everything is uploaded, we can run our projection kernel to get the pixel coordinates
-                cl::event projected;
+                // Build the packed neighbourhood map with an extra offscreen point at the end
+                std::vector<std::array<int, Model<Scalar>::N_NEIGHBOURS>> local_neighbourhood(n_points + 1);
+                for (unsigned int i = 0; i < indices.size(); ++i) {
+                    const auto& node = nodes[indices[i]];
+                    for (unsigned int j = 0; j < node.neighbours.size(); ++j) {
+                        const auto& n             = node.neighbours[j];
+                        local_neighbourhood[i][j] = remap(n);
+                    }
+                }
+                // Fill in the final offscreen point which connects only to itself
+                local_neighbourhood[n_points].fill(n_points);
 
-                cl::kernel projection_kernel;
+                return local_neighbourhood;
+            }
 
-                // Select a projection kernel
-                switch (lens.projection) {
-                    case RECTILINEAR: projection_kernel = project_rectilinear; break;
-                    case EQUIDISTANT: projection_kernel = project_equidistant; break;
-                    case EQUISOLID: projection_kernel = project_equisolid; break;
-                }
+            /**
+             * @brief Set the arguments that the projection kernels share with the fused projection and image load ones
+             *
+             * @param kernel            the kernel to set the arguments of
+             * @param points            the device buffer holding the unit vectors of the mesh
+             * @param indices_map       the device buffer holding the index of each point in the mesh
+             * @param pixel_coordinates the device buffer the pixel coordinates of each point are written to
+             * @param Hoc               the homogenous transformation matrix from the camera to the observation plane
+             * @param lens              the lens parameters that describe the optics of the camera
+             */
+            void set_projection_arguments(const cl::kernel& kernel,
+                                          const cl::mem& points,
+                                          const cl::mem& indices_map,
+                                          const cl::mem& pixel_coordinates,
+                                          const mat4<Scalar>& Hoc,
+                                          const Lens<Scalar>& lens) const {
+                // Pack Rco into a Scalar16
+                // clang-format off
+                std::array<Scalar, 16> Rco{{
+                    Hoc[0][0],     Hoc[1][0],   Hoc[2][0], Scalar(0.0),
+                    Hoc[0][1],     Hoc[1][1],   Hoc[2][1], Scalar(0.0),
+                    Hoc[0][2],     Hoc[1][2],   Hoc[2][2], Scalar(0.0),
+                    Scalar(0.0), Scalar(0.0), Scalar(0.0), Scalar(1.0)
+                }};
+                // clang-format on
 
                 // Calculate the coefficients for performing a distortion to give to the engine
                 vec4<Scalar> ik = inverse_coefficients(lens.k);
 
                 // Load the arguments
                 cl_mem arg = nullptr;
-                arg        = cl_points;
-                throw_cl_error(::clSetKernelArg(projection_kernel, 0, MEM_SIZE, &arg),
+                arg        = points;
+                throw_cl_error(::clSetKernelArg(kernel, 0, MEM_SIZE, &arg),
                                "Error setting kernel argument 0 for projection kernel");
                 arg = indices_map;
-                throw_cl_error(::clSetKernelArg(projection_kernel, 1, MEM_SIZE, &arg),
+                throw_cl_error(::clSetKernelArg(kernel, 1, MEM_SIZE, &arg),
                                "Error setting kernel argument 1 for projection kernel");
-                throw_cl_error(::clSetKernelArg(projection_kernel, 2, sizeof(Rco), Rco.data()),
+                throw_cl_error(::clSetKernelArg(kernel, 2, sizeof(Rco), Rco.data()),
                                "Error setting kernel argument 2 for projection kernel");
-                throw_cl_error(::clSetKernelArg(projection_kernel, 3, sizeof(lens.focal_length), &lens.focal_length),
+                throw_cl_error(::clSetKernelArg(kernel, 3, sizeof(lens.focal_length), &lens.focal_length),
                                "Error setting kernel argument 3 for projection kernel");
-                throw_cl_error(::clSetKernelArg(projection_kernel, 4, sizeof(lens.centre), lens.centre.data()),
+                throw_cl_error(::clSetKernelArg(kernel, 4, sizeof(lens.centre), lens.centre.data()),
                                "Error setting kernel argument 4 for projection kernel");
-                throw_cl_error(::clSetKernelArg(projection_kernel, 5, sizeof(ik), ik.data()),
+                throw_cl_error(::clSetKernelArg(kernel, 5, sizeof(ik), ik.data()),
                                "Error setting kernel argument 5 for projection kernel");
-                throw_cl_error(::clSetKernelArg(projection_kernel, 6, sizeof(lens.dimensions), lens.dimensions.data()),
+                throw_cl_error(::clSetKernelArg(kernel, 6, sizeof(lens.dimensions), lens.dimensions.data()),
                                "Error setting kernel argument 6 for projection kernel");
                 arg = pixel_coordinates;
-                throw_cl_error(::clSetKernelArg(projection_kernel, 7, MEM_SIZE, &arg),
+                throw_cl_error(::clSetKernelArg(kernel, 7, MEM_SIZE, &arg),
                                "Error setting kernel argument 7 for projection kernel");
+            }
+
+            /**
+             * @brief Queue the projection kernel for a range of points in the indices map
+             *
+             * @param frame             the frame whose projection kernels are used
+             * @param points            the device buffer holding the unit vectors of the mesh
+             * @param indices_map       the device buffer holding the index of each point in the mesh
+             * @param pixel_coordinates the device buffer the pixel coordinates of each point are written to
+             * @param Hoc               the homogenous transformation matrix from the camera to the observation plane
+             * @param lens              the lens parameters that describe the optics of the camera
+             * @param offset            the first point in the indices map to project
+             * @param global_size       the number of points to project, a multiple of the workgroup size
+             * @param wait              the event that must complete before the projection can start, if there is one
+             *
+             * @return the event for when the projection has finished
+             */
+            cl::event enqueue_projection(const Frame& frame,
+                                         const cl::mem& points,
+                                         const cl::mem& indices_map,
+                                         const cl::mem& pixel_coordinates,
+                                         const mat4<Scalar>& Hoc,
+                                         const Lens<Scalar>& lens,
+                                         const size_t& offset,
+                                         const size_t& global_size,
+                                         const cl::event& wait) const {
+                cl::kernel projection_kernel;
+
+                // Select a projection kernel
+                switch (lens.projection) {
+                    case RECTILINEAR: projection_kernel = frame.project_rectilinear; break;
+                    case EQUIDISTANT: projection_kernel = frame.project_equidistant; break;
+                    case EQUISOLID: projection_kernel = frame.project_equisolid; break;
+                }
+                set_projection_arguments(projection_kernel, points, indices_map, pixel_coordinates, Hoc, lens);
 
                 // Project!
-                // When calculating global_size we round to the nearest workgroup size
-                size_t offset      = 0;
-                size_t global_size = (((n_points - 1) / workgroup_size) + 1) * workgroup_size;
-                ev                 = nullptr;
-                cl_event iev       = indices_event;
-                error              = ::clEnqueueNDRangeKernel(
-                  queue, projection_kernel, 1, &offset, &global_size, &workgroup_size, 1, &iev, &ev);
+                cl::event projected;
+                cl_event ev  = nullptr;
+                cl_event iev = wait;
+                cl_int error = ::clEnqueueNDRangeKernel(queue,
+                                                        projection_kernel,
+                                                        1,
+                                                        &offset,
+                                                        &global_size,
+                                                        &workgroup_size,
+                                                        iev ? 1 : 0,
+                                                        iev ? &iev : nullptr,
+                                                        &ev);
                 if (ev) { projected = cl::event(ev, ::clReleaseEvent); }
                 throw_cl_error(error, "Error queueing the projection kernel");
 
-                // This can happen on the CPU while the OpenCL device is busy
-                // Build the reverse lookup map where the offscreen point is one past the end
-                std::vector<int> r_indices(nodes.size() + 1, n_points);
-                for (unsigned int i = 0; i < indices.size(); ++i) {
-                    r_indices[indices[i]] = i;
+                return projected;
+            }
+
+            /**
+             * @brief Queue the kernel that projects a range of points and reads the image at them into the network
+             *
+             * @details
+             *  This does the work of enqueue_projection and enqueue_load_image in one kernel, so the image load doesn't
+             *  need its own launch or to read the pixel coordinates back out of global memory. The pixel coordinates
+             *  are still written as they are part of the results.
+             *
+             * @param frame             the frame whose fused kernels are used
+             * @param points            the device buffer holding the unit vectors of the mesh
+             * @param indices_map       the device buffer holding the index of each point in the mesh
+             * @param pixel_coordinates the device buffer the pixel coordinates of each point are written to
+             * @param Hoc               the homogenous transformation matrix from the camera to the observation plane
+             * @param lens              the lens parameters that describe the optics of the camera
+             * @param image             the device image to read from
+             * @param format            the pixel format of this image as a fourcc code
+             * @param input             the network buffer the pixel values are written to
+             * @param offset            the first point in the indices map to project
+             * @param global_size       the number of points to project, a multiple of the workgroup size
+             * @param offscreen         the index of the offscreen point, which gets a value of -1.0 after the load
+             * @param wait              the events that must complete before the kernel can start
+             *
+             * @return the events for when the points have been projected and loaded and when the offscreen point has
+             *         been filled
+             */
+            std::pair<cl::event, cl::event> enqueue_project_load_image(const Frame& frame,
+                                                                       const cl::mem& points,
+                                                                       const cl::mem& indices_map,
+                                                                       const cl::mem& pixel_coordinates,
+                                                                       const mat4<Scalar>& Hoc,
+                                                                       const Lens<Scalar>& lens,
+                                                                       const cl::mem& image,
+                                                                       const uint32_t& format,
+                                                                       const cl::mem& input,
+                                                                       const size_t& offset,
+                                                                       const size_t& global_size,
+                                                                       const size_t& offscreen,
+                                                                       const std::array<cl::event, 2>& wait) const {
+                // Pick the kernel for the projection and format once so the kernel doesn't switch for every point
+                const bool bayer  = is_bayer(format);
+                const bool yuv    = is_yuv(format);
+                cl::kernel kernel = bayer ? frame.project_load_bayer_image[lens.projection]
+                                    : yuv ? frame.project_load_yuv_image[lens.projection]
+                                          : frame.project_load_interpolated_image[lens.projection];
+                set_projection_arguments(kernel, points, indices_map, pixel_coordinates, Hoc, lens);
+
+                cl_uint n_args = 8;
+                cl_mem arg     = nullptr;
+                arg            = image;
+                throw_cl_error(::clSetKernelArg(kernel, n_args++, MEM_SIZE, &arg),
+                               "Error setting image argument for projection and image load kernel");
+                if (bayer) {
+                    const std::array<cl_float, 2> first_red = bayer_first_red<cl_float>(format);
+                    throw_cl_error(::clSetKernelArg(kernel, n_args++, sizeof(first_red), first_red.data()),
+                                   "Error setting first red argument for projection and image load kernel");
+                }
+                if (yuv) {
+                    const std::array<cl_int, 8> layout = yuv_layout(format, lens.dimensions);
+                    throw_cl_error(::clSetKernelArg(kernel, n_args++, sizeof(layout), layout.data()),
+                                   "Error setting layout argument for projection and image load kernel");
+                }
+                arg = input;
+                throw_cl_error(::clSetKernelArg(kernel, n_args++, MEM_SIZE, &arg),
+                               "Error setting network argument for projection and image load kernel");
+
+                cl::event loaded;
+                std::vector<cl_event> event_list;
+                for (const auto& e : wait) {
+                    if (e) { event_list.push_back(e); }
+                }
+                cl_event ev  = nullptr;
+                cl_int error = ::clEnqueueNDRangeKernel(queue,
+                                                        kernel,
+                                                        1,
+                                                        &offset,
+                                                        &global_size,
+                                                        &workgroup_size,
+                                                        event_list.size(),
+                                                        event_list.empty() ? nullptr : event_list.data(),
+                                                        &ev);
+                if (ev) { loaded = cl::event(ev, ::clReleaseEvent); }
+                throw_cl_error(error, "Error queueing the projection and image load kernel");
+
+                return std::make_pair(loaded, enqueue_offscreen_fill(input, offscreen, loaded));
+            }
+
+            /**
+             * @brief Queue the kernel that reads the pixels for a range of points from an image into the network input
+             *
+             * @param frame       the frame whose image load kernel is used
+             * @param image       the device image to read from
+             * @param format      the pixel format of this image as a fourcc code
+             * @param dimensions  the dimensions of the image
+             * @param pixels      the device buffer holding the pixel coordinates of each point
+             * @param input       the network buffer the pixel values are written to
+             * @param offset      the first point to load
+             * @param global_size the number of points to load, a multiple of the workgroup size
+             * @param offscreen   the index of the offscreen point, which gets a value of -1.0 once the load is done
+             * @param wait        the events that must complete before the load can start
+             *
+             * @return the events for when the image has been loaded and when the offscreen point has been filled
+             */
+            std::pair<cl::event, cl::event> enqueue_load_image(const Frame& frame,
+                                                               const cl::mem& image,
+                                                               const uint32_t& format,
+                                                               const vec2<int>& dimensions,
+                                                               const cl::mem& pixels,
+                                                               const cl::mem& input,
+                                                               const size_t& offset,
+                                                               const size_t& global_size,
+                                                               const size_t& offscreen,
+                                                               const std::array<cl::event, 2>& wait) const {
+                // Pick the kernel for the format once so the kernel doesn't switch on it for every point
+                const bool bayer = is_bayer(format);
+                const bool yuv   = is_yuv(format);
+                cl_kernel kernel = bayer ? frame.load_bayer_image
+                                   : yuv ? frame.load_yuv_image
+                                         : frame.load_interpolated_image;
+                cl_uint n_args   = 0;
+                cl_mem arg       = nullptr;
+                arg              = image;
+                throw_cl_error(::clSetKernelArg(kernel, n_args++, MEM_SIZE, &arg),
+                               "Error setting image argument for image load kernel");
+                if (bayer) {
+                    const std::array<cl_float, 2> first_red = bayer_first_red<cl_float>(format);
+                    throw_cl_error(::clSetKernelArg(kernel, n_args++, sizeof(first_red), first_red.data()),
+                                   "Error setting first red argument for image load kernel");
                 }
+                if (yuv) {
+                    const std::array<cl_int, 8> layout = yuv_layout(format, dimensions);
+                    throw_cl_error(::clSetKernelArg(kernel, n_args++, sizeof(layout), layout.data()),
+                                   "Error setting layout argument for image load kernel");
+                }
+                arg = pixels;
+                throw_cl_error(::clSetKernelArg(kernel, n_args++, MEM_SIZE, &arg),
+                               "Error setting pixel coordinates argument for image load kernel");
+                arg = input;
+                throw_cl_error(::clSetKernelArg(kernel, n_args++, MEM_SIZE, &arg),
+                               "Error setting network argument for image load kernel");
 
-                // Build the packed neighbourhood map with an extra offscreen point at the end
-                std::vector<std::array<int, N_NEIGHBOURS>> local_neighbourhood(n_points + 1);
-                for (unsigned int i = 0; i < indices.size(); ++i) {
-                    const auto& node = nodes[indices[i]];
-                    for (unsigned int j = 0; j < node.neighbours.size(); ++j) {
-                        const auto& n             = node.neighbours[j];
-                        local_neighbourhood[i][j] = r_indices[n];
+                cl::event img_load_event;
+                std::array<cl_event, 2> event_list = {wait[0], wait[1]};
+                cl_event ev                        = nullptr;
+                cl_int error                       = ::clEnqueueNDRangeKernel(
+                  queue, kernel, 1, &offset, &global_size, &workgroup_size, 2, event_list.data(), &ev);
+                if (ev) { img_load_event = cl::event(ev, ::clReleaseEvent); }
+                throw_cl_error(error, "Error queueing the image load kernel");
+
+                return std::make_pair(img_load_event, enqueue_offscreen_fill(input, offscreen, img_load_event));
+            }
+
+            /**
+             * @brief Queue giving the offscreen point of the network input a value of -1.0 so it is easy to distinguish
+             *
+             * @param input     the network buffer holding the loaded image values
+             * @param offscreen the index of the offscreen point
+             * @param wait      the event for when the image has been loaded into the network buffer
+             *
+             * @return the event for when the offscreen point has been filled
+             */
+            cl::event enqueue_offscreen_fill(const cl::mem& input,
+                                             const size_t& offscreen,
+                                             const cl::event& wait) const {
+                cl_event iev = wait;
+                cl::event offscreen_fill_event;
+                Scalar minus_one(-1.0);
+                cl_event ev  = nullptr;
+                cl_int error = ::clEnqueueFillBuffer(queue,
+                                                     input,
+                                                     &minus_one,
+                                                     sizeof(Scalar),
+                                                     offscreen * sizeof(std::array<Scalar, 4>),
+                                                     sizeof(std::array<Scalar, 4>),
+                                                     iev ? 1 : 0,
+                                                     iev ? &iev : nullptr,
+                                                     &ev);
+                if (ev) { offscreen_fill_event = cl::event(ev, ::clReleaseEvent); }
+                throw_cl_error(error, "Error setting the offscreen pixel values");
+                return offscreen_fill_event;
+            }
+
+            /**
+             * @brief Queue every convolution of the network, ping ponging between the two network buffers
+             *
+             * @param frame         the frame whose convolution kernels are used
+             * @param neighbourhood the device buffer holding the neighbourhood graph
+             * @param input         the network buffer holding the input to the first convolution
+             * @param output        the other network buffer
+             * @param global_size   the number of points to run the network on, a multiple of the workgroup size
+             * @param events        the events that must complete before the first convolution can start
+             * @param profile       where each convolution is added to be timed
+             *
+             * @return the event for when the network has finished and which buffer holds the classifications
+             */
+            std::pair<cl::event, cl::mem> enqueue_network(const Frame& frame,
+                                                          const cl::mem& neighbourhood,
+                                                          cl::mem input,
+                                                          cl::mem output,
+                                                          const size_t& global_size,
+                                                          std::vector<cl::event> events,
+                                                          Profile& profile) const {
+                // Small frames run every convolution in a single workgroup so they only pay for one dispatch
+                if (frame.network && global_size <= size_t(single_dispatch_points)) {
+                    const cl_int n_points = cl_int(global_size);
+                    cl_mem arg            = nullptr;
+                    arg                   = neighbourhood;
+                    throw_cl_error(::clSetKernelArg(frame.network, 0, MEM_SIZE, &arg),
+                                   "Error setting argument 0 for network kernel");
+                    arg = input;
+                    throw_cl_error(::clSetKernelArg(frame.network, 1, MEM_SIZE, &arg),
+                                   "Error setting argument 1 for network kernel");
+                    arg = output;
+                    throw_cl_error(::clSetKernelArg(frame.network, 2, MEM_SIZE, &arg),
+                                   "Error setting argument 2 for network kernel");
+                    throw_cl_error(::clSetKernelArg(frame.network, 3, sizeof(n_points), &n_points),
+                                   "Error setting argument 3 for network kernel");
+
+                    size_t offset = 0;
+                    cl::event event;
+                    cl_event ev = nullptr;
+                    std::vector<cl_event> cl_events(events.begin(), events.end());
+                    cl_int error = ::clEnqueueNDRangeKernel(queue,
+                                                            frame.network,
+                                                            1,
+                                                            &offset,
+                                                            &network_local_size,
+                                                            &network_local_size,
+                                                            cl_events.size(),
+                                                            cl_events.data(),
+                                                            &ev);
+                    if (ev) { event = cl::event(ev, ::clReleaseEvent); }
+                    throw_cl_error(error, "Error queueing network kernel");
+
+                    // The whole network is timed as the first convolution
+                    profile.add(Stage::CONVOLUTION, 0, event);
+                    return std::make_pair(event, frame.conv_layers.size() % 2 == 0 ? input : output);
+                }
+
+                cl::event network_complete;
+                for (unsigned int i = 0; i < frame.conv_layers.size(); ++i) {
+                    const auto& conv = frame.conv_layers[i];
+
+                    // Each convolution runs with its own workgroup size once they have been tuned
+                    const size_t local_size = conv_local_sizes.empty() ? workgroup_size : conv_local_sizes[i];
+                    const size_t conv_size  = ((global_size - 1) / local_size + 1) * local_size;
+                    set_conv_arguments(frame, i, neighbourhood, input, output, local_size);
+
+                    size_t offset = 0;
+                    cl::event event;
+                    cl_event ev = nullptr;
+                    std::vector<cl_event> cl_events(events.begin(), events.end());
+                    cl_int error = ::clEnqueueNDRangeKernel(queue,
+                                                            conv.first,
+                                                            1,
+                                                            &offset,
+                                                            &conv_size,
+                                                            &local_size,
+                                                            cl_events.size(),
+                                                            cl_events.data(),
+                                                            &ev);
+                    if (ev) { event = cl::event(ev, ::clReleaseEvent); }
+                    throw_cl_error(error, "Error queueing convolution kernel");
+                    profile.add(Stage::CONVOLUTION, i, event);
+
+                    // Convert our events into a vector of events and ping pong our buffers
+                    events           = std::vector<cl::event>({event});
+                    network_complete = event;
+                    std::swap(input, output);
+                }
+                return std::make_pair(network_complete, input);
+            }
+
+            /**
+             * @brief Set the buffers a convolution reads and writes, and the local memory of the tiled layers
+             *
+             * @param frame         the frame whose convolution kernel is used
+             * @param i             the index of the convolution
+             * @param neighbourhood the device buffer holding the neighbourhood graph
+             * @param input         the network buffer holding the input to the convolution
+             * @param output        the network buffer the convolution writes to
+             * @param local_size    the workgroup size the convolution will run with
+             */
+            void set_conv_arguments(const Frame& frame,
+                                    const unsigned int& i,
+                                    const cl::mem& neighbourhood,
+                                    const cl::mem& input,
+                                    const cl::mem& output,
+                                    const size_t& local_size) const {
+                const auto& conv = frame.conv_layers[i];
+                cl_mem arg       = nullptr;
+                arg              = neighbourhood;
+                throw_cl_error(::clSetKernelArg(conv.first, 0, MEM_SIZE, &arg),
+                               "Error setting argument 0 for convolution kernel");
+                arg = input;
+                throw_cl_error(::clSetKernelArg(conv.first, 1, MEM_SIZE, &arg),
+                               "Error setting argument 1 for convolution kernel");
+                arg = output;
+                throw_cl_error(::clSetKernelArg(conv.first, 2, MEM_SIZE, &arg),
+                               "Error setting argument 2 for convolution kernel");
+
+                // The local memory for the tiled layers depends on the workgroup size
+                if (tiled_layers && !layer_buffers.empty()) {
+                    size_t points  = local_size * (layer_buffers[i].n_neighbours + 1) * sizeof(cl_int);
+                    size_t inputs  = local_size * LAYER_TILE_STRIDE * sizeof(Scalar);
+                    size_t weights = LAYER_TILE_OUTPUTS * LAYER_TILE_INPUTS * sizeof(Scalar);
+                    throw_cl_error(::clSetKernelArg(conv.first, 9, points, nullptr),
+                                   "Error setting argument 9 for convolution kernel");
+                    throw_cl_error(::clSetKernelArg(conv.first, 10, inputs, nullptr),
+                                   "Error setting argument 10 for convolution kernel");
+                    throw_cl_error(::clSetKernelArg(conv.first, 11, weights, nullptr),
+                                   "Error setting argument 11 for convolution kernel");
+                }
+            }
+
+            /**
+             * @brief Run the convolutions with these workgroup sizes, padding the per point buffers so they fit
+             *
+             * @param sizes the workgroup size of each convolution, or empty to use the preferred size of the device
+             */
+            void use_local_sizes(std::vector<size_t> sizes) {
+                conv_local_sizes = std::move(sizes);
+
+                // The buffers are padded to a multiple of every workgroup size so no convolution runs past their end
+                point_alignment = workgroup_size;
+                for (const auto& size : conv_local_sizes) {
+                    size_t a = point_alignment;
+                    size_t b = size;
+                    while (b != 0) {
+                        a = a % b;
+                        std::swap(a, b);
                     }
+                    point_alignment = point_alignment / a * size;
                 }
-                // Fill in the final offscreen point which connects only to itself
-                local_neighbourhood[n_points].fill(n_points);
+            }
 
-                // This ensures that all elements in the queue have been issued to the device NOT that they are all
-                // finished If we don't do this here, some of our buffers can go out of scope before the queue picks
-                // them up causing errors
-                ::clFlush(queue);
+            /// @return the workgroup size for the prefix sum, which needs at least two values per block to finish
+            size_t scan_size() const {
+                return std::max(workgroup_size, size_t(2));
+            }
 
-                // Return what we calculated
-                return std::make_tuple(std::move(local_neighbourhood),  // CPU buffer
-                                       std::move(indices),              // CPU buffer
-                                       pixel_coordinates,               // GPU buffer
-                                       projected);                      // GPU event
+            /// @return the number of values in each level of a prefix sum over some points and the offscreen point
+            std::vector<int> scan_sizes(const int& n_nodes) const {
+                // Each level of the prefix sum holds the totals of the workgroups of the level before it
+                std::vector<int> sizes = {n_nodes + 1};
+                do {
+                    sizes.push_back((sizes.back() - 1) / scan_size() + 1);
+                } while (sizes.back() > 1);
+                return sizes;
+            }
+
+            typename Frame::LookupMemory& get_lookup_memory(Frame& frame, const int& n_nodes) const {
+                auto& memory = frame.lookup_memory;
+
+                if (memory.n_nodes < n_nodes) {
+                    const int capacity = grow_capacity(memory.n_nodes, n_nodes);
+                    cl_int error       = 0;
+
+                    // The projection writes a pixel for every point in the last workgroup
+                    size_t size   = ((capacity - 1) / workgroup_size + 1) * workgroup_size * sizeof(Scalar) * 2;
+                    memory.pixels = cl::mem(
+                      ::clCreateBuffer(context, CL_MEM_READ_WRITE, size, nullptr, &error), ::clReleaseMemObject);
+                    throw_cl_error(error, "Error allocating lookup pixel coordinates buffer on device");
+
+                    memory.on_screen = cl::mem(
+                      ::clCreateBuffer(context, CL_MEM_READ_WRITE, (capacity + 1) * sizeof(cl_int), nullptr, &error),
+                      ::clReleaseMemObject);
+                    throw_cl_error(error, "Error allocating on screen buffer on device");
+                    memory.offsets.clear();
+                    for (const auto& n : scan_sizes(capacity)) {
+                        memory.offsets.emplace_back(
+                          ::clCreateBuffer(context, CL_MEM_READ_WRITE, n * sizeof(cl_int), nullptr, &error),
+                          ::clReleaseMemObject);
+                        throw_cl_error(error, "Error allocating prefix sum buffer on device");
+                    }
+                    memory.n_nodes = capacity;
+                }
+
+                // Fewer points never need more levels or larger levels than the buffers were made for
+                memory.sizes = scan_sizes(n_nodes);
+                return memory;
+            }
+
+            typename Frame::LookupMemory& get_cull_memory(Frame& frame,
+                                                          const int& n_nodes,
+                                                          const int& n_neighbours) const {
+                auto& memory = get_lookup_memory(frame, n_nodes);
+
+                if (memory.n_culled < n_nodes) {
+                    const int capacity = grow_capacity(memory.n_culled, n_nodes);
+                    cl_int error       = 0;
+
+                    // The projection reads an index for every point in the last workgroup
+                    size_t size    = ((capacity - 1) / workgroup_size + 1) * workgroup_size * sizeof(cl_int);
+                    memory.indices = cl::mem(
+                      ::clCreateBuffer(context, CL_MEM_READ_WRITE, size, nullptr, &error), ::clReleaseMemObject);
+                    throw_cl_error(error, "Error allocating culling indices buffer on device");
+
+                    // This includes the offscreen point at the end
+                    size                 = (capacity + 1) * n_neighbours * sizeof(cl_int);
+                    memory.neighbourhood = cl::mem(
+                      ::clCreateBuffer(context, CL_MEM_READ_WRITE, size, nullptr, &error), ::clReleaseMemObject);
+                    throw_cl_error(error, "Error allocating culling neighbourhood buffer on device");
+                    memory.n_culled = capacity;
+                }
+                return memory;
+            }
+
+            typename Frame::SelectedMemory& get_selected_memory(Frame& frame, const int& n_points) const {
+                auto& memory = frame.selected_memory;
+
+                if (memory.n_points < n_points) {
+                    const int capacity = grow_capacity(memory.n_points, n_points);
+                    cl_int error       = 0;
+                    size_t width       = frame.conv_layers.back().second;
+                    memory.indices =
+                      cl::mem(::clCreateBuffer(context, CL_MEM_READ_WRITE, capacity * sizeof(int), nullptr, &error),
+                              ::clReleaseMemObject);
+                    throw_cl_error(error, "Error allocating selected indices buffer on device");
+                    memory.pixels = cl::mem(
+                      ::clCreateBuffer(context, CL_MEM_READ_WRITE, capacity * sizeof(Scalar) * 2, nullptr, &error),
+                      ::clReleaseMemObject);
+                    throw_cl_error(error, "Error allocating selected pixel coordinates buffer on device");
+                    memory.classifications = cl::mem(
+                      ::clCreateBuffer(context, CL_MEM_READ_WRITE, capacity * sizeof(Scalar) * width, nullptr, &error),
+                      ::clReleaseMemObject);
+                    throw_cl_error(error, "Error allocating selected classifications buffer on device");
+                    memory.labels =
+                      cl::mem(::clCreateBuffer(context, CL_MEM_READ_WRITE, capacity * sizeof(int), nullptr, &error),
+                              ::clReleaseMemObject);
+                    throw_cl_error(error, "Error allocating selected labels buffer on device");
+                    memory.n_points = capacity;
+                }
+                return memory;
+            }
+
+            cl::mem get_labels_memory(Frame& frame, const int& n_points) const {
+                if (frame.labels_memory.n_points < n_points) {
+                    const int capacity = grow_capacity(frame.labels_memory.n_points, n_points);
+                    cl_int error       = 0;
+                    frame.labels_memory.memory =
+                      cl::mem(::clCreateBuffer(context, CL_MEM_READ_WRITE, capacity * sizeof(int), nullptr, &error),
+                              ::clReleaseMemObject);
+                    throw_cl_error(error, "Error allocating labels buffer on device");
+                    frame.labels_memory.n_points = capacity;
+                }
+                return frame.labels_memory.memory;
             }
 
-            cl::mem get_indices_map_memory(const int& n_points) const {
+            cl::mem get_indices_map_memory(Frame& frame, const int& n_points) const {
 
-                if (indices_map_memory.n_points < n_points) {
+                if (frame.indices_map_memory.n_points < n_points) {
+                    const int capacity = grow_capacity(frame.indices_map_memory.n_points, n_points);
                     // Align the size to the nearest workgroup size
-                    size_t size               = ((n_points - 1) / workgroup_size + 1) * workgroup_size * sizeof(int);
-                    cl_int error              = 0;
-                    indices_map_memory.memory = cl::mem(
+                    size_t size  = ((capacity - 1) / workgroup_size + 1) * workgroup_size * sizeof(int);
+                    cl_int error = 0;
+                    frame.indices_map_memory.memory = cl::mem(
                       ::clCreateBuffer(context, CL_MEM_READ_WRITE, size, nullptr, &error), ::clReleaseMemObject);
                     throw_cl_error(error, "Error allocating indices map buffer on device");
-                    indices_map_memory.n_points = n_points;
+                    frame.indices_map_memory.n_points = capacity;
                 }
-                return indices_map_memory.memory;
+                return frame.indices_map_memory.memory;
             }
 
-            cl::mem get_pixel_coordinates_memory(const int& n_points) const {
+            cl::mem get_pixel_coordinates_memory(Frame& frame, const int& n_points) const {
+                // Every call needs pixel coordinates for its points on the screen, so this is where they are counted
+                points_high_water.update(n_points);
 
-                if (pixel_coordinates_memory.n_points < n_points) {
+                if (frame.pixel_coordinates_memory.n_points < n_points) {
+                    const int capacity = grow_capacity(frame.pixel_coordinates_memory.n_points, n_points);
                     // Align the size to the nearest workgroup size
-                    size_t size  = ((n_points - 1) / workgroup_size + 1) * workgroup_size * sizeof(Scalar) * 2;
+                    size_t size  = ((capacity - 1) / workgroup_size + 1) * workgroup_size * sizeof(Scalar) * 2;
                     cl_int error = 0;
-                    pixel_coordinates_memory.memory = cl::mem(
+                    frame.pixel_coordinates_memory.memory = cl::mem(
                       ::clCreateBuffer(context, CL_MEM_READ_WRITE, size, nullptr, &error), ::clReleaseMemObject);
                     throw_cl_error(error, "Error allocating pixel coordinates buffer on device");
-                    pixel_coordinates_memory.n_points = n_points;
+                    frame.pixel_coordinates_memory.n_points = capacity;
                 }
-                return pixel_coordinates_memory.memory;
+                return frame.pixel_coordinates_memory.memory;
             }
 
-            std::array<cl::mem, 2> get_network_memory(const int& n_points) const {
-                if (network_memory.n_points < n_points) {
+            std::array<cl::mem, 2> get_network_memory(Frame& frame, const int& n_points) const {
+                if (frame.network_memory.n_points < n_points) {
+                    const int capacity = grow_capacity(frame.network_memory.n_points, n_points);
                     // Align the size to the nearest workgroup size
-                    size_t size  = ((n_points - 1) / workgroup_size + 1) * workgroup_size * sizeof(Scalar) * max_width;
+                    size_t size = ((capacity - 1) / point_alignment + 1) * point_alignment * sizeof(Scalar) * max_width;
                     cl_int error = 0;
-                    network_memory.memory[0] = cl::mem(
+                    frame.network_memory.memory[0] = cl::mem(
                       ::clCreateBuffer(context, CL_MEM_READ_WRITE, size, nullptr, &error), ::clReleaseMemObject);
                     throw_cl_error(error, "Error allocating ping pong buffer 1 on device");
-                    network_memory.memory[1] = cl::mem(
+                    frame.network_memory.memory[1] = cl::mem(
                       ::clCreateBuffer(context, CL_MEM_READ_WRITE, size, nullptr, &error), ::clReleaseMemObject);
-                    network_memory.n_points = n_points;
+                    frame.network_memory.n_points = capacity;
                     throw_cl_error(error, "Error allocating ping pong buffer 2 on device");
                 }
-                return network_memory.memory;
+                return frame.network_memory.memory;
             }
 
-            cl::mem get_neighbourhood_memory(const int& n_points, int n_neighbours) const {
+            cl::mem get_neighbourhood_memory(Frame& frame, const int& n_points, int n_neighbours) const {
 
-                if (neighbourhood_memory.n_points < n_points) {
+                if (frame.neighbourhood_memory.n_points < n_points) {
+                    const int capacity = grow_capacity(frame.neighbourhood_memory.n_points, n_points);
                     // Align the size to the nearest workgroup size
-                    size_t size  = ((n_points - 1) / workgroup_size + 1) * workgroup_size * sizeof(int) * n_neighbours;
+                    size_t size = ((capacity - 1) / point_alignment + 1) * point_alignment * sizeof(int) * n_neighbours;
                     cl_int error = 0;
-                    neighbourhood_memory.memory = cl::mem(
+                    frame.neighbourhood_memory.memory = cl::mem(
                       ::clCreateBuffer(context, CL_MEM_READ_WRITE, size, nullptr, &error), ::clReleaseMemObject);
                     throw_cl_error(error, "Error allocating neighbourhood buffer on device");
-                    neighbourhood_memory.n_points = n_points;
+                    frame.neighbourhood_memory.n_points = capacity;
                 }
-                return neighbourhood_memory.memory;
+                return frame.neighbourhood_memory.memory;
             }
 
-            cl::mem get_image_memory(vec2<int> dimensions, uint32_t format) const {
+            /**
+             * @brief Get the OpenCL image format that holds the pixels of a fourcc format
+             *
+             * @param format the pixel format of the image as a fourcc code
+             *
+             * @return the image format the device reads the pixels with
+             */
+            static cl_image_format image_format(const uint32_t& format) {
+                switch (format) {
+                    // Bayer
+                    case fourcc("GRBG"):
+                    case fourcc("RGGB"):
+                    case fourcc("GBRG"):
+                    case fourcc("BGGR"): return cl_image_format{CL_R, CL_UNORM_INT8};
+                    // YUV, read a byte at a time by the YUV image load kernels
+                    case fourcc("NV12"):
+                    case fourcc("YUYV"):
+                    case fourcc("YUY2"):
+                    case fourcc("UYVY"): return cl_image_format{CL_R, CL_UNORM_INT8};
+                    case fourcc("GRAY"):
+                    case fourcc("GREY"):
+                    case fourcc("Y8  "): return cl_image_format{CL_LUMINANCE, CL_UNORM_INT8};
+                    case fourcc("BGRA"): return cl_image_format{CL_BGRA, CL_UNORM_INT8};
+                    case fourcc("RGBA"): return cl_image_format{CL_RGBA, CL_UNORM_INT8};
+                    // Oh no...
+                    default: throw std::runtime_error("Unsupported image format " + fourcc_text(format));
+                }
+            }
 
-                // If our dimensions and format haven't changed from last time we can reuse the same memory location
-                if (dimensions != image_memory.dimensions || format != image_memory.format) {
-                    cl_image_format fmt;
-                    switch (format) {
-                        // Bayer
-                        case fourcc("GRBG"):
-                        case fourcc("RGGB"):
-                        case fourcc("GBRG"):
-                        case fourcc("BGGR"): fmt = cl_image_format{CL_R, CL_UNORM_INT8}; break;
-                        case fourcc("GRAY"):
-                        case fourcc("GREY"):
-                        case fourcc("Y8  "): fmt = cl_image_format{CL_LUMINANCE, CL_UNORM_INT8}; break;
-                        case fourcc("BGRA"): fmt = cl_image_format{CL_BGRA, CL_UNORM_INT8}; break;
-                        case fourcc("RGBA"): fmt = cl_image_format{CL_RGBA, CL_UNORM_INT8}; break;
-                        // Oh no...
-                        default: throw std::runtime_error("Unsupported image format " + fourcc_text(format));
+            /**
+             * @brief Queue an image so that it can be read on the device, either by copying it to device memory or by
+             * using the device image that was registered for it
+             *
+             * @param frame      the frame whose image memory is used for images that aren't registered
+             * @param index      the index of the image in the batch
+             * @param image      the data that represents the image
+             * @param dimensions the dimensions of the image
+             * @param format     the pixel format of this image as a fourcc code
+             *
+             * @return the device image and the event for when it holds the contents of the image
+             */
+            std::pair<cl::mem, cl::event> enqueue_image(Frame& frame,
+                                                        const size_t& index,
+                                                        const void* image,
+                                                        const vec2<int>& dimensions,
+                                                        const uint32_t& format) const {
+                const vec2<int> extent       = image_extent(dimensions, format);
+                std::array<size_t, 3> origin = {{0, 0, 0}};
+                std::array<size_t, 3> region = {{size_t(extent[0]), size_t(extent[1]), 1}};
+                cl_int error                 = CL_SUCCESS;
+                cl_event ev                  = nullptr;
+
+                RegisteredImage registered;
+                /* mutex scope */ {
+                    std::lock_guard<std::mutex> lock(registered_images_mutex);
+                    auto it = registered_images.find(image);
+                    if (it != registered_images.end()) { registered = it->second; }
+                }
+
+                if (registered.memory) {
+                    if (dimensions != registered.dimensions || format != registered.format) {
+                        throw std::invalid_argument("The image does not match the dimensions and format it was "
+                                                    "registered with");
                     }
 
-                    cl_image_desc desc = {
-                      CL_MEM_OBJECT_IMAGE2D, size_t(dimensions[0]), size_t(dimensions[1]), 1, 1, 0, 0, 0, 0, nullptr};
+                    // Mapping and unmapping the whole image tells the device the host has written new contents. When
+                    // the device shares memory with the host this doesn't copy anything
+                    cl::event mapped;
+                    size_t row_pitch = 0;
+                    void* ptr        = ::clEnqueueMapImage(transfer_queue,
+                                                           registered.memory,
+                                                           false,
+                                                           CL_MAP_WRITE_INVALIDATE_REGION,
+                                                           origin.data(),
+                                                           region.data(),
+                                                           &row_pitch,
+                                                           nullptr,
+                                                           0,
+                                                           nullptr,
+                                                           &ev,
+                                                           &error);
+                    if (ev) { mapped = cl::event(ev, ::clReleaseEvent); }
+                    throw_cl_error(error, "Error mapping registered image");
+
+                    cl::event unmapped;
+                    cl_event iev = mapped;
+                    ev           = nullptr;
+                    error        = ::clEnqueueUnmapMemObject(transfer_queue, registered.memory, ptr, 1, &iev, &ev);
+                    if (ev) { unmapped = cl::event(ev, ::clReleaseEvent); }
+                    throw_cl_error(error, "Error unmapping registered image");
+
+                    return std::make_pair(registered.memory, unmapped);
+                }
+
+                // Copy our image into device memory
+                cl::mem cl_image = get_image_memory(frame, index, dimensions, format);
+                cl::event cl_image_loaded;
+                error = ::clEnqueueWriteImage(
+                  transfer_queue, cl_image, false, origin.data(), region.data(), 0, 0, image, 0, nullptr, &ev);
+                if (ev) { cl_image_loaded = cl::event(ev, ::clReleaseEvent); }
+                throw_cl_error(error, "Error mapping image onto device");
+
+                return std::make_pair(cl_image, cl_image_loaded);
+            }
+
+            cl::mem get_image_memory(Frame& frame, const size_t& index, vec2<int> dimensions, uint32_t format) const {
+
+                // Each image in a batch has its own memory
+                if (frame.image_memory.size() <= index) { frame.image_memory.resize(index + 1); }
+                auto& image_memory = frame.image_memory[index];
+
+                // If our dimensions and format haven't changed from last time we can reuse the same memory location
+                if (dimensions != image_memory.dimensions || format != image_memory.format) {
+                    const vec2<int> extent = image_extent(dimensions, format);
+                    cl_image_format fmt    = image_format(format);
+                    cl_image_desc desc     = {
+                      CL_MEM_OBJECT_IMAGE2D, size_t(extent[0]), size_t(extent[1]), 1, 1, 0, 0, 0, 0, nullptr};
 
                     // Create a buffer for our image
                     cl_int error = 0;
@@ -732,60 +3988,83 @@ namespace engine {
 
             /// OpenCL command queue
             cl::command_queue queue;
+            /// The command queue for uploading and downloading the data of each frame, the same as queue unless
+            /// separate_transfers is enabled
+            cl::command_queue transfer_queue;
 
             /// OpenCL program
             cl::program program;
-            /// Kernel for projecting rays to pixels using an equidistant projection
-            cl::kernel project_equidistant;
-            /// Kernel for projecting rays to pixels using an equisolid projection
-            cl::kernel project_equisolid;
-            /// Kernel for projecting rays to pixels using a rectilinear projection
-            cl::kernel project_rectilinear;
-            /// Kernel for reading projected pixel coordinates from an image into the network input layer
-            cl::kernel load_image;
-            /// A list of kernels to run in sequence to run the network
-            std::vector<std::pair<cl::kernel, size_t>> conv_layers;
-
-            /// A location to cache the GPU memory allocated for indices map so we don't reallocate between runs
-            mutable struct {
-                int n_points = 0;
-                cl::mem memory;
-            } indices_map_memory;
-
-            /// A location to cache the GPU memory allocated for pixel coordinates so we don't reallocate between runs
-            mutable struct {
-                int n_points = 0;
-                cl::mem memory;
-            } pixel_coordinates_memory;
-
-            /// A location to cache the GPU memory allocated for the ping pong network buffers so we don't reallocate
-            /// between runs
-            mutable struct {
-                int n_points = 0;
-                std::array<cl::mem, 2> memory;
-            } network_memory;
-
-            /// A location to cache the GPU memory allocated for the local graph so we don't reallocate between runs
-            mutable struct {
-                int n_points = 0;
-                cl::mem memory;
-            } neighbourhood_memory;
-
-            /// A location to cache the GPU memory allocated for the image so we don't reallocate between runs
-            mutable struct {
-                vec2<int> dimensions = {0, 0};
-                uint32_t format      = 0;
-                cl::mem memory;
-            } image_memory;
+            /// The width of the output of each convolution in the network
+            std::vector<size_t> conv_widths;
+
+            /// The weights of a single layer of the network in device buffers
+            struct LayerBuffers {
+                /// The weights of the layer, output major
+                cl::mem weights;
+                /// The bias for each output of the layer
+                cl::mem biases;
+                /// The number of neighbours the layer gathers, 0 if it doesn't start a convolution
+                cl_int n_neighbours;
+                /// The number of values each point has in the input before it is gathered
+                cl_int input_dimensions;
+                /// The number of values each point has in the output
+                cl_int output_dimensions;
+                /// The activation function of the layer
+                cl_int activation;
+            };
+            /// The weights of each layer in order when they are kept in buffers rather than compiled into the kernels
+            std::vector<LayerBuffers> layer_buffers;
+            /// If the layers in buffers are run by workgroups that share their inputs through local memory
+            bool tiled_layers = false;
+
+            /// The frames that are not being used by a call, the one that has been idle the longest is used next
+            mutable ObjectPool<Frame> frames;
+            /// How many frames can be in flight at once when submitting from a single thread
+            unsigned int max_in_flight = 2;
 
             /// The width of the maximumally wide layer in the network (always at least 4 because of the input)
             size_t max_width = 4;
 
             /// The largest preferred workgroup size so we can overallocate memory
             size_t workgroup_size;
-
-            /// Cache of opencl buffers from mesh objects
-            mutable std::map<const void*, cl::mem> device_points_cache;
+            /// The workgroup size of each convolution once they have been tuned, otherwise they use workgroup_size
+            std::vector<size_t> conv_local_sizes;
+            /// The workgroup size of the single dispatch network kernel, 0 if there isn't one
+            size_t network_local_size = 0;
+            /// Frames with up to this many points run the network in a single dispatch
+            int single_dispatch_points = 0;
+            /// The multiple the network and neighbourhood buffers are padded to so every convolution fits in them
+            size_t point_alignment = 1;
+            /// The number of neighbours the network gathers for each point
+            int network_neighbours = 0;
+            /// The file the tuned workgroup sizes are cached in, or empty if they aren't cached
+            std::string tuning_path;
+            /// The most points on the screen that a single call has needed buffers for
+            mutable HighWaterMark points_high_water;
+
+            /// The opencl buffers of the meshes that are on the device, keyed by the identifier of the mesh
+            mutable ResidencyCache<DeviceMesh> device_points_cache;
+            /// Guards the device points cache when the engine is used from several threads
+            mutable std::mutex device_points_mutex;
+            /// A device image that was created on top of a host buffer
+            struct RegisteredImage {
+                cl::mem memory;
+                vec2<int> dimensions;
+                uint32_t format;
+            };
+            /// The device images for the host buffers that have been registered
+            std::map<const void*, RegisteredImage> registered_images;
+            /// Guards the registered images as frames can be submitted from several threads
+            mutable std::mutex registered_images_mutex;
+
+            /// If the points on the screen are found by the device rather than by walking the mesh on the host
+            bool device_lookup = false;
+            /// If the points found by walking the mesh on the host are tested against the screen on the device
+            bool offscreen_culling = false;
+            /// Runs the mesh lookups, keeping the state of previous lookups when incremental lookup is enabled
+            std::shared_ptr<IncrementalLookup<Scalar>> lookup = std::make_shared<IncrementalLookup<Scalar>>();
+            /// Where the time spent in each stage of a frame is reported, or nullptr if the engine isn't being timed
+            std::shared_ptr<Instrumentation> instrumentation;
         };
 
     }  // namespace opencl
@@ -0,0 +1,367 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/**
+ * Marks which points of the visual mesh are on the screen from their projected pixel coordinates
+ *
+ * @param points      VisualMesh unit vectors as 4d vectors [x, y, z, 0]
+ * @param indices     the global index of each point being tested
+ * @param pixels      the pixel coordinates of each point being tested
+ * @param camera_x    the x axis of the camera in observation plane space, the direction the lens points
+ * @param cos_fov     the cos of half the field of view of the lens
+ * @param dimensions  the dimensions of the input image
+ * @param n_nodes     the number of points being tested, the flag at n_nodes is for the offscreen point
+ * @param on_screen   set to 1 for each point that is on the screen and 0 otherwise
+ */
+kernel void cull_points(global const Scalar4* points,
+                        global const int* indices,
+                        global const Scalar2* pixels,
+                        const Scalar4 camera_x,
+                        const Scalar cos_fov,
+                        const int2 dimensions,
+                        const int n_nodes,
+                        global int* on_screen) {
+
+    const int index = get_global_id(0);
+
+    if (index < n_nodes) {
+        // The same check the CPU engine uses to remove points off the edge of the image
+        const Scalar2 px = pixels[index];
+        on_screen[index] = dot(camera_x, points[indices[index]]) > cos_fov && 0 <= px.x && px.x + 1 <= dimensions.x
+                           && 0 <= px.y && px.y + 1 <= dimensions.y;
+    }
+    // The offscreen point is never on the screen, which is also what makes the last offset the number of points
+    else if (index == n_nodes) {
+        on_screen[index] = 0;
+    }
+}
+
+/**
+ * Computes the exclusive prefix sum of each workgroup sized block of values, and the total of each block
+ *
+ * @details
+ *  The input and output may be the same buffer as each value is read before any are written. The totals of the blocks
+ *  must then be scanned and added to each block with add_block_offsets to get the prefix sum of the whole buffer.
+ *
+ * @param input      the values to sum
+ * @param output     the sum of all the values before each value in its block
+ * @param block_sums the total of each block
+ * @param n          the number of values
+ * @param scratch    local memory with space for a value for each work item
+ */
+kernel void scan_blocks(global const int* input,
+                        global int* output,
+                        global int* block_sums,
+                        const int n,
+                        local int* scratch) {
+
+    const int index = get_global_id(0);
+    const int lid   = get_local_id(0);
+    const int size  = get_local_size(0);
+
+    const int value = index < n ? input[index] : 0;
+    scratch[lid]    = value;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // Each step adds the value from twice as far back as the last
+    for (int offset = 1; offset < size; offset <<= 1) {
+        const int add = lid >= offset ? scratch[lid - offset] : 0;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        scratch[lid] += add;
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    // The scratch holds the inclusive sum so remove our own value
+    if (index < n) { output[index] = scratch[lid] - value; }
+    if (lid == size - 1) { block_sums[get_group_id(0)] = scratch[lid]; }
+}
+
+/**
+ * Adds the scanned totals of the blocks to each value in the block to finish a prefix sum
+ *
+ * @param values        the values that were scanned by scan_blocks
+ * @param block_offsets the exclusive prefix sum of the totals of the blocks
+ * @param block_size    the workgroup size that scan_blocks was run with
+ * @param n             the number of values
+ */
+kernel void add_block_offsets(global int* values,
+                              global const int* block_offsets,
+                              const int block_size,
+                              const int n) {
+
+    const int index = get_global_id(0);
+    if (index < n) { values[index] += block_offsets[index / block_size]; }
+}
+
+/**
+ * Packs the points that are on the screen together, writing their global index and pixel coordinates
+ *
+ * @param on_screen     1 for each point that was tested and is on the screen and 0 otherwise
+ * @param offsets       the exclusive prefix sum of on_screen, which is the local index of each point on the screen
+ * @param mesh_indices  the global index of each point that was tested
+ * @param mesh_pixels   the pixel coordinates of each point that was tested
+ * @param n_nodes       the number of points that were tested
+ * @param indices       the global index of each point on the screen
+ * @param pixels        the pixel coordinates of each point on the screen
+ */
+kernel void compact_points(global const int* on_screen,
+                           global const int* offsets,
+                           global const int* mesh_indices,
+                           global const Scalar2* mesh_pixels,
+                           const int n_nodes,
+                           global int* indices,
+                           global Scalar2* pixels) {
+
+    const int index = get_global_id(0);
+    if (index < n_nodes && on_screen[index]) {
+        const int i = offsets[index];
+        indices[i]  = mesh_indices[index];
+        pixels[i]   = mesh_pixels[index];
+    }
+}
+
+/**
+ * Builds the neighbourhood graph of the points on the screen, neighbours that are not on the screen point to the
+ * offscreen point which comes after the last point and is connected only to itself
+ *
+ * @param indices       the global index of each point on the screen
+ * @param on_screen     1 for each point in the mesh that is on the screen and 0 otherwise, 0 for the offscreen point
+ * @param offsets       the local index of each point on the screen
+ * @param neighbours    the neighbourhood graph of the whole mesh using global indices
+ * @param n_neighbours  the number of neighbours each point has
+ * @param n_points      the number of points on the screen, which is the index of the offscreen point
+ * @param neighbourhood the neighbourhood graph of the points on the screen using local indices
+ */
+kernel void remap_neighbourhood(global const int* indices,
+                                global const int* on_screen,
+                                global const int* offsets,
+                                global const int* neighbours,
+                                const int n_neighbours,
+                                const int n_points,
+                                global int* neighbourhood) {
+
+    const int index = get_global_id(0);
+
+    if (index < n_points) {
+        const int id = indices[index];
+        for (int j = 0; j < n_neighbours; ++j) {
+            const int n                             = neighbours[id * n_neighbours + j];
+            neighbourhood[index * n_neighbours + j] = on_screen[n] ? offsets[n] : n_points;
+        }
+    }
+    else if (index == n_points) {
+        for (int j = 0; j < n_neighbours; ++j) {
+            neighbourhood[index * n_neighbours + j] = n_points;
+        }
+    }
+}
+
+/**
+ * Removes the points that are not on the screen from a neighbourhood graph that was built by a lookup on the host,
+ * neighbours that were removed point to the offscreen point instead
+ *
+ * @details
+ *  The lookup on the host finds a few points just outside the image, especially for fisheye lenses, so these are
+ *  culled before the network runs on them. Each point that was looked up moves to its packed position and the
+ *  offscreen point of the lookup becomes the offscreen point after the last point on the screen.
+ *
+ * @param on_screen     1 for each point that was looked up and is on the screen and 0 otherwise, 0 for the offscreen
+ *                      point
+ * @param offsets       the exclusive prefix sum of on_screen, the last value being the number of points on the screen
+ * @param neighbours    the neighbourhood graph of the points that were looked up, with the offscreen point last
+ * @param n_neighbours  the number of neighbours each point has
+ * @param n_nodes       the number of points that were looked up, which is the index of their offscreen point
+ * @param neighbourhood the neighbourhood graph of the points on the screen using local indices
+ */
+kernel void cull_neighbourhood(global const int* on_screen,
+                               global const int* offsets,
+                               global const int* neighbours,
+                               const int n_neighbours,
+                               const int n_nodes,
+                               global int* neighbourhood) {
+
+    const int index    = get_global_id(0);
+    const int n_points = offsets[n_nodes];
+
+    if (index < n_nodes && on_screen[index]) {
+        const int i = offsets[index];
+        for (int j = 0; j < n_neighbours; ++j) {
+            const int n                         = neighbours[index * n_neighbours + j];
+            neighbourhood[i * n_neighbours + j] = on_screen[n] ? offsets[n] : n_points;
+        }
+    }
+    else if (index == n_nodes) {
+        for (int j = 0; j < n_neighbours; ++j) {
+            neighbourhood[n_points * n_neighbours + j] = n_points;
+        }
+    }
+}
+
+/**
+ * Marks which points on the screen have a score for a class that is at least a threshold
+ *
+ * @param classifications the output of the network for each point on the screen
+ * @param n_classes       the number of classes the network outputs for each point
+ * @param cls             the index of the class to threshold on
+ * @param threshold       the lowest score a point can have for the class and be kept
+ * @param n_points        the number of points on the screen, not including the offscreen point
+ * @param n               the number of flags to write, the flags after the points on the screen are all 0
+ * @param selected        set to 1 for each point that passes the threshold and 0 otherwise
+ */
+kernel void threshold_points(global const Scalar* classifications,
+                             const int n_classes,
+                             const int cls,
+                             const Scalar threshold,
+                             const int n_points,
+                             const int n,
+                             global int* selected) {
+
+    const int index = get_global_id(0);
+    if (index < n) { selected[index] = index < n_points && classifications[index * n_classes + cls] >= threshold; }
+}
+
+/**
+ * Packs the points that passed a threshold together, writing their global index, pixel coordinates and class scores
+ *
+ * @param selected         1 for each point on the screen that passed the threshold and 0 otherwise
+ * @param offsets          the exclusive prefix sum of selected, which is the index of each point that passed
+ * @param indices          the global index of each point on the screen
+ * @param pixels           the pixel coordinates of each point on the screen
+ * @param classifications  the output of the network for each point on the screen
+ * @param n_classes        the number of classes the network outputs for each point
+ * @param n_points         the number of points on the screen, not including the offscreen point
+ * @param selected_indices the global index of each point that passed
+ * @param selected_pixels  the pixel coordinates of each point that passed
+ * @param selected_classes the output of the network for each point that passed
+ */
+kernel void compact_selected(global const int* selected,
+                             global const int* offsets,
+                             global const int* indices,
+                             global const Scalar2* pixels,
+                             global const Scalar* classifications,
+                             const int n_classes,
+                             const int n_points,
+                             global int* selected_indices,
+                             global Scalar2* selected_pixels,
+                             global Scalar* selected_classes) {
+
+    const int index = get_global_id(0);
+    if (index < n_points && selected[index]) {
+        const int i         = offsets[index];
+        selected_indices[i] = indices[index];
+        selected_pixels[i]  = pixels[index];
+        for (int j = 0; j < n_classes; ++j) {
+            selected_classes[i * n_classes + j] = classifications[index * n_classes + j];
+        }
+    }
+}
+
+/**
+ * Finds the root of the set a point is in for the connected components labelling, halving the path as it goes. Roots
+ * are only ever linked below smaller roots, so a parent that another work item has since changed is still in the set.
+ *
+ * @param labels the parent of each point in its set, a point that is its own parent is the root
+ * @param x      the point to find the root for
+ *
+ * @return the root of the set that the point is in
+ */
+int find_label(volatile global int* labels, int x) {
+    int p = labels[x];
+    while (p != x) {
+        const int g = labels[p];
+        if (g != p) { atomic_cmpxchg(&labels[x], p, g); }
+        x = p;
+        p = labels[x];
+    }
+    return x;
+}
+
+/**
+ * Starts the connected components labelling with every point that passed a threshold in a set of its own
+ *
+ * @param selected 1 for each point on the screen that passed the threshold and 0 otherwise
+ * @param n_points the number of points on the screen, not including the offscreen point
+ * @param labels   set to the index of each point that passed and -1 for the others
+ */
+kernel void init_labels(global const int* selected, const int n_points, global int* labels) {
+    const int index = get_global_id(0);
+    if (index < n_points) { labels[index] = selected[index] ? index : -1; }
+}
+
+/**
+ * Joins the set of each point that passed a threshold with the sets of its neighbours that also passed. The sets are
+ * joined with atomics so every edge is handled in a single pass
+ *
+ * @param neighbourhood the neighbourhood graph of the points on the screen with the offscreen point last
+ * @param n_neighbours  the number of neighbours each point has
+ * @param n_points      the number of points on the screen, not including the offscreen point
+ * @param labels        the parent of each point that passed in its set and -1 for the others
+ */
+kernel void link_labels(global const int* neighbourhood,
+                        const int n_neighbours,
+                        const int n_points,
+                        volatile global int* labels) {
+    const int index = get_global_id(0);
+    if (index < n_points && labels[index] >= 0) {
+        for (int j = 0; j < n_neighbours; ++j) {
+            const int n = neighbourhood[index * n_neighbours + j];
+            if (n < n_points && labels[n] >= 0) {
+                int a = index;
+                int b = n;
+                while (true) {
+                    a = find_label(labels, a);
+                    b = find_label(labels, b);
+                    if (a == b) { break; }
+                    // Link the larger root below the smaller one, unless another work item got to it first
+                    const int larger  = max(a, b);
+                    const int smaller = min(a, b);
+                    if (atomic_cmpxchg(&labels[larger], larger, smaller) == larger) { break; }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Labels each point that passed a threshold with the root of its set, which is the smallest index in it
+ *
+ * @param n_points the number of points on the screen, not including the offscreen point
+ * @param labels   the parent of each point that passed in its set and -1 for the others
+ */
+kernel void flatten_labels(const int n_points, volatile global int* labels) {
+    const int index = get_global_id(0);
+    if (index < n_points && labels[index] >= 0) { labels[index] = find_label(labels, index); }
+}
+
+/**
+ * Packs the labels of the points that passed a threshold together in the same order as compact_selected
+ *
+ * @param selected        1 for each point on the screen that passed the threshold and 0 otherwise
+ * @param offsets         the exclusive prefix sum of selected, which is the index of each point that passed
+ * @param labels          the label of each point on the screen
+ * @param n_points        the number of points on the screen, not including the offscreen point
+ * @param selected_labels the label of each point that passed
+ */
+kernel void compact_labels(global const int* selected,
+                           global const int* offsets,
+                           global const int* labels,
+                           const int n_points,
+                           global int* selected_labels) {
+    const int index = get_global_id(0);
+    if (index < n_points && selected[index]) { selected_labels[offsets[index]] = labels[index]; }
+}
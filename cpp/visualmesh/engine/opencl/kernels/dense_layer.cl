@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/**
+ * Runs a single layer of the network with weights that are read from buffers, so the same kernel can run any layer
+ *
+ * @details
+ *  The first layer of each convolution gathers the values of each point's neighbours as its input, the rest of the
+ *  layers in the convolution take the output of the layer before them. The weights are stored output major, so each
+ *  output's weights are contiguous and ordered the same way as the gathered input.
+ *
+ * @param neighbourhood     the neighbourhood graph of the points
+ * @param input             the values of each point that are the input of this layer
+ * @param output            the values of each point after this layer
+ * @param weights           the weights of the layer as [output_dimensions][input_dimensions * (n_neighbours + 1)]
+ * @param biases            the bias for each output of the layer
+ * @param n_neighbours      the number of neighbours to gather, 0 for layers that don't start a convolution
+ * @param input_dimensions  the number of values each point has in the input
+ * @param output_dimensions the number of values each point has in the output
+ * @param activation        the activation function to apply, 0 for selu, 1 for relu, 2 for softmax and 3 for tanh
+ */
+kernel void dense_layer(global const int* neighbourhood,
+                        global const Scalar* input,
+                        global Scalar* output,
+                        global const Scalar* weights,
+                        global const Scalar* biases,
+                        const int n_neighbours,
+                        const int input_dimensions,
+                        const int output_dimensions,
+                        const int activation) {
+
+    // selu constants
+    const Scalar lambda = 1.0507009873554804934193349852946f;
+    const Scalar alpha  = 1.6732632423543772848170429916717f;
+
+    const int idx   = get_global_id(0);
+    const int width = input_dimensions * (n_neighbours + 1);
+
+    global Scalar* out = output + idx * output_dimensions;
+    for (int i = 0; i < output_dimensions; ++i) {
+
+        // Our own values come first followed by each of our neighbours
+        Scalar v = biases[i];
+        for (int n = 0; n <= n_neighbours; ++n) {
+            const int p             = n == 0 ? idx : neighbourhood[idx * n_neighbours + n - 1];
+            global const Scalar* in = input + p * input_dimensions;
+            global const Scalar* w  = weights + i * width + n * input_dimensions;
+            for (int j = 0; j < input_dimensions; ++j) {
+                v += in[j] * w[j];
+            }
+        }
+
+        switch (activation) {
+            case 0: v = lambda * (v > 0 ? v : alpha * exp(v) - alpha); break;
+            case 1: v = v > 0 ? v : 0; break;
+            case 2: v = exp(v); break;
+            case 3: v = tanh(v); break;
+        }
+        out[i] = v;
+    }
+
+    // Softmax needs every output before it can be normalised
+    if (activation == 2) {
+        Scalar exp_sum = 0;
+        for (int i = 0; i < output_dimensions; ++i) {
+            exp_sum += out[i];
+        }
+        for (int i = 0; i < output_dimensions; ++i) {
+            out[i] /= exp_sum;
+        }
+    }
+}
+
+/**
+ * Runs a single layer of the network with weights that are read from buffers, with the points of each workgroup
+ * cooperating to gather their inputs into local memory
+ *
+ * @details
+ *  This computes the same thing as dense_layer, but as a small matrix multiplication for each workgroup. Blocks of the
+ *  gathered inputs of every point in the workgroup and the weights for a block of outputs are loaded into local memory
+ *  together, with consecutive work items reading consecutive values so the reads are coalesced. As the mesh is stored
+ *  in the order of its BSP, the neighbours of the points in a workgroup are mostly near each other in the input too.
+ *  Each work item then accumulates a block of outputs for its own point from local memory. The sizes of the blocks,
+ *  LAYER_TILE_OUTPUTS and LAYER_TILE_INPUTS, and the padded stride of the input block LAYER_TILE_STRIDE are defined by
+ *  the engine as it also sizes the local memory.
+ *
+ * @param neighbourhood     the neighbourhood graph of the points
+ * @param input             the values of each point that are the input of this layer
+ * @param output            the values of each point after this layer
+ * @param weights           the weights of the layer as [output_dimensions][input_dimensions * (n_neighbours + 1)]
+ * @param biases            the bias for each output of the layer
+ * @param n_neighbours      the number of neighbours to gather, 0 for layers that don't start a convolution
+ * @param input_dimensions  the number of values each point has in the input
+ * @param output_dimensions the number of values each point has in the output
+ * @param activation        the activation function to apply, 0 for selu, 1 for relu, 2 for softmax and 3 for tanh
+ * @param points            local memory for the index of every point gathered by the workgroup, local size * (n + 1)
+ * @param inputs            local memory for a block of inputs, local size * LAYER_TILE_STRIDE
+ * @param tile_weights      local memory for a block of weights, LAYER_TILE_OUTPUTS * LAYER_TILE_INPUTS
+ */
+kernel void dense_layer_tiled(global const int* neighbourhood,
+                              global const Scalar* input,
+                              global Scalar* output,
+                              global const Scalar* weights,
+                              global const Scalar* biases,
+                              const int n_neighbours,
+                              const int input_dimensions,
+                              const int output_dimensions,
+                              const int activation,
+                              local int* points,
+                              local Scalar* inputs,
+                              local Scalar* tile_weights) {
+
+    // selu constants
+    const Scalar lambda = 1.0507009873554804934193349852946f;
+    const Scalar alpha  = 1.6732632423543772848170429916717f;
+
+    const int idx    = get_global_id(0);
+    const int lid    = get_local_id(0);
+    const int size   = get_local_size(0);
+    const int first  = get_group_id(0) * size;
+    const int stride = n_neighbours + 1;
+    const int width  = input_dimensions * stride;
+
+    // Find the point each part of the gathered input comes from, our own point first and then our neighbours
+    for (int t = lid; t < size * stride; t += size) {
+        const int p = first + t / stride;
+        const int n = t % stride;
+        points[t]   = n == 0 ? p : neighbourhood[p * n_neighbours + n - 1];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    global Scalar* out = output + idx * output_dimensions;
+    for (int o = 0; o < output_dimensions; o += LAYER_TILE_OUTPUTS) {
+
+        Scalar acc[LAYER_TILE_OUTPUTS];
+        for (int i = 0; i < LAYER_TILE_OUTPUTS; ++i) {
+            acc[i] = 0;
+        }
+
+        for (int k = 0; k < width; k += LAYER_TILE_INPUTS) {
+            // Gather a block of the inputs for every point in the workgroup, zero past the end of the inputs
+            for (int t = lid; t < size * LAYER_TILE_INPUTS; t += size) {
+                const int p = t / LAYER_TILE_INPUTS;
+                const int j = k + t % LAYER_TILE_INPUTS;
+                inputs[p * LAYER_TILE_STRIDE + t % LAYER_TILE_INPUTS] =
+                  j < width ? input[points[p * stride + j / input_dimensions] * input_dimensions + j % input_dimensions]
+                            : 0;
+            }
+            // Load the weights for this block of inputs and outputs
+            for (int t = lid; t < LAYER_TILE_OUTPUTS * LAYER_TILE_INPUTS; t += size) {
+                const int i     = o + t / LAYER_TILE_INPUTS;
+                const int j     = k + t % LAYER_TILE_INPUTS;
+                tile_weights[t] = i < output_dimensions && j < width ? weights[i * width + j] : 0;
+            }
+            barrier(CLK_LOCAL_MEM_FENCE);
+
+            for (int j = 0; j < LAYER_TILE_INPUTS; ++j) {
+                const Scalar x = inputs[lid * LAYER_TILE_STRIDE + j];
+                for (int i = 0; i < LAYER_TILE_OUTPUTS; ++i) {
+                    acc[i] += x * tile_weights[i * LAYER_TILE_INPUTS + j];
+                }
+            }
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+
+        for (int i = 0; i < LAYER_TILE_OUTPUTS && o + i < output_dimensions; ++i) {
+            Scalar v = acc[i] + biases[o + i];
+            switch (activation) {
+                case 0: v = lambda * (v > 0 ? v : alpha * exp(v) - alpha); break;
+                case 1: v = v > 0 ? v : 0; break;
+                case 2: v = exp(v); break;
+                case 3: v = tanh(v); break;
+            }
+            out[o + i] = v;
+        }
+    }
+
+    // Softmax needs every output before it can be normalised
+    if (activation == 2) {
+        Scalar exp_sum = 0;
+        for (int i = 0; i < output_dimensions; ++i) {
+            exp_sum += out[i];
+        }
+        for (int i = 0; i < output_dimensions; ++i) {
+            out[i] /= exp_sum;
+        }
+    }
+}
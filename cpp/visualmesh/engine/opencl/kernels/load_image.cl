@@ -18,34 +18,6 @@
 const sampler_t bayer_sampler  = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP | CLK_FILTER_NEAREST;
 const sampler_t interp_sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP | CLK_FILTER_LINEAR;
 
-enum FOURCC {
-    GREY    = 0x59455247,
-    Y12     = 0x20323159,
-    Y16     = 0x20363159,
-    GRBG    = 0x47425247,
-    RGGB    = 0x42474752,
-    GBRG    = 0x47524247,
-    BGGR    = 0x52474742,
-    GR12    = 0x32315247,
-    RG12    = 0x32314752,
-    GB12    = 0x32314247,
-    BG12    = 0x32314742,
-    GR16    = 0x36315247,
-    RG16    = 0x36314752,
-    GB16    = 0x36314247,
-    BG16    = 0x36314742,
-    Y411    = 0x31313459,
-    UYVY    = 0x59565955,
-    YUYV    = 0x56595559,
-    YM24    = 0x34324d59,
-    RGB3    = 0x33424752,
-    RGBA    = 0x41424752,
-    BGR3    = 0x33524742,
-    BGRA    = 0x41524742,
-    JPEG    = 0x4745504a,
-    UNKNOWN = 0
-};
-
 /**
  * @brief Given an image, fetches the r component for use with debayering
  *
@@ -165,46 +137,107 @@ float4 bayerToRGB(read_only image2d_t raw_image, sampler_t sampler, float2 coord
 }
 
 /**
- * @brief Reads a pixel at a position and returns a vec4 value
+ * @brief Reads a single pixel from a YUV image and converts it to RGB
+ *
+ * @details
+ *  YUV images are held as a single channel image of their bytes and the layout says where the luma and chroma of each
+ *  pixel are stored. The conversion uses the BT.601 limited range coefficients, the same as the CPU engine.
+ *
+ * @param image  the bytes of the YUV image
+ * @param layout the luma bytes per pixel, the luma offset, the chroma bytes per pair of pixels, the U offset, the V
+ *               offset, the number of rows that share chroma as a shift, and the width and height of the image
+ * @param px     the pixel to read, which must be inside the image
  *
- * @param image   the image to read from
- * @param format  the fourcc code for the image to decode from
- * @param pos
+ * @return the RGB pixel at the given location in the YUV image
  */
-float4 read_image(read_only image2d_t image, const enum FOURCC format, const float2 coord) {
-    switch (format) {
-        // Bayer formats use the bayer sampler (nearest neighbour)
-        case GRBG: return bayerToRGB(image, bayer_sampler, coord, (float2)(1.0, 0.0));
-        case RGGB: return bayerToRGB(image, bayer_sampler, coord, (float2)(0.0, 0.0));
-        case GBRG: return bayerToRGB(image, bayer_sampler, coord, (float2)(0.0, 1.0));
-        case BGGR: return bayerToRGB(image, bayer_sampler, coord, (float2)(1.0, 1.0));
-        // RGB formats read with interpolation
-        case RGB3:
-        case BGRA:
-        case RGBA: {
-            return read_imagef(image, interp_sampler, coord);
-        }
-        default: {
-            return (float4)(0);
-        }
-    }
+float4 yuv_pixel(read_only image2d_t image, const int8 layout, const int2 px) {
+    // With chroma on every other row (NV12) the chroma plane starts after the luma plane
+    const int cx = layout.s2 * (px.x >> 1);
+    const int cy = (px.y >> layout.s5) + layout.s5 * layout.s7;
+
+    const float y = read_imagef(image, bayer_sampler, (int2)(layout.s0 * px.x + layout.s1, px.y)).x;
+    const float u = read_imagef(image, bayer_sampler, (int2)(cx + layout.s3, cy)).x - 0.5019608f;
+    const float v = read_imagef(image, bayer_sampler, (int2)(cx + layout.s4, cy)).x - 0.5019608f;
+    const float l = 1.164f * (y - 0.0627451f);
+
+    return (float4)(clamp((float3)(l + 1.596f * v, l - 0.813f * v - 0.391f * u, l + 2.018f * u), 0.0f, 1.0f), 1.0f);
+}
+
+/**
+ * @brief Bilinearly interpolates the four YUV pixels around a coordinate, converting each of them to RGB
+ *
+ * @details
+ *  The device can't filter an image whose pixels aren't stored together, so the four taps are read and mixed here.
+ *  Pixel centres are on whole coordinates to match the CPU engine.
+ *
+ * @param image  the bytes of the YUV image
+ * @param layout the layout of the YUV image as described for yuv_pixel
+ * @param coord  the coordinate to read from
+ *
+ * @return the RGB pixel at the given location in the YUV image
+ */
+float4 yuvToRGB(read_only image2d_t image, const int8 layout, const float2 coord) {
+    const int2 last = (int2)(layout.s6, layout.s7) - 1;
+    const float2 f  = floor(coord);
+    const int2 p1   = clamp(convert_int2(f), (int2)(0, 0), last);
+    const int2 p2   = min(p1 + 1, last);
+    const float2 t  = clamp(coord - f, 0.0f, 1.0f);
+
+    const float4 top    = mix(yuv_pixel(image, layout, p1), yuv_pixel(image, layout, (int2)(p2.x, p1.y)), t.x);
+    const float4 bottom = mix(yuv_pixel(image, layout, (int2)(p1.x, p2.y)), yuv_pixel(image, layout, p2), t.x);
+    return mix(top, bottom, t.y);
+}
+
+/**
+ * @brief Reads data from a bayer image into a network layer using the projected visual mesh points
+ *
+ * @details
+ *  The host picks this kernel, load_yuv_image or load_interpolated_image once from the format of the image, so the
+ *  kernel doesn't need to branch on the format for every point.
+ *
+ * @param image     the raw bayer image to read from
+ * @param first_red the coordinate of the first red pixel in the bayer pattern
+ * @param coords    the pixel coordinates for each element in the visual mesh graph
+ * @param network   the memory storage for the first layer of the network
+ */
+kernel void load_bayer_image(read_only image2d_t image,
+                             const float2 first_red,
+                             global float2* coords,
+                             global float4* network) {
+
+    const int idx = get_global_id(0);
+
+    network[idx] = bayerToRGB(image, bayer_sampler, coords[idx], first_red);
+}
+
+/**
+ * @brief Reads data from an image the device can interpolate into a network layer using the projected mesh points
+ *
+ * @param image   the image to read from, whose channel order is handled by the image format it was created with
+ * @param coords  the pixel coordinates for each element in the visual mesh graph
+ * @param network the memory storage for the first layer of the network
+ */
+kernel void load_interpolated_image(read_only image2d_t image, global float2* coords, global float4* network) {
+
+    const int idx = get_global_id(0);
+
+    network[idx] = read_imagef(image, interp_sampler, coords[idx]);
 }
 
 /**
- * @brief Reads data from an image into a network layer using the projected visual mesh points
+ * @brief Reads data from a YUV image into a network layer using the projected visual mesh points
  *
- * @param image   the image to read from
- * @param format  the format that the image is encoded in
+ * @param image   the bytes of the YUV image
+ * @param layout  the layout of the YUV image as described for yuv_pixel
  * @param coords  the pixel coordinates for each element in the visual mesh graph
  * @param network the memory storage for the first layer of the network
  */
-kernel void load_image(read_only image2d_t image,
-                       const enum FOURCC format,
-                       global float2* coords,
-                       global float4* network) {
+kernel void load_yuv_image(read_only image2d_t image,
+                           const int8 layout,
+                           global float2* coords,
+                           global float4* network) {
 
     const int idx = get_global_id(0);
 
-    // Read our pixel coordinate into the image
-    network[idx] = read_image(image, format, coords[idx]);
+    network[idx] = yuvToRGB(image, layout, coords[idx]);
 }
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * Makes the kernels that project visual mesh points and read the image at them into the network input in one pass,
+ * one each for bayer images, YUV images and formats the device can interpolate itself. This saves launching the image
+ * load separately and reading the pixel coordinates back out of global memory. The projections and the image load
+ * functions are in the other files of this program.
+ *
+ * The arguments are the same as the projection kernel followed by the same as the image load kernel without the
+ * coordinates.
+ *
+ * @param points      VisualMesh unit vectors as 4d vectors [x, y, z, 0]
+ * @param indices     map from local indices to global indices
+ * @param Rco         rotation from the observation space to camera space
+ * @param f           the focal length of the lens measured in pixels
+ * @param centre      the offset from the centre of the lens axis to the centre of the image in pixels
+ * @param k           the inverse distortion coefficients to apply the distortion to the image
+ * @param dimensions  the dimensions of the input image
+ * @param out         the output image coordinates, which are still needed for the results
+ * @param image       the image to read from
+ * @param first_red   the coordinate of the first red pixel in the bayer pattern
+ * @param layout      the layout of a YUV image as described for yuv_pixel
+ * @param network     the memory storage for the first layer of the network
+ */
+#define PROJECT_LOAD_IMAGE(projection)                                                                                 \
+    kernel void project_##projection##_load_bayer_image(global const Scalar4* points,                                  \
+                                                        global int* indices,                                           \
+                                                        const Scalar16 Rco,                                            \
+                                                        const Scalar f,                                                \
+                                                        const Scalar2 centre,                                          \
+                                                        const Scalar4 k,                                               \
+                                                        const int2 dimensions,                                         \
+                                                        global Scalar2* out,                                           \
+                                                        read_only image2d_t image,                                     \
+                                                        const float2 first_red,                                        \
+                                                        global float4* network) {                                      \
+        const int index     = get_global_id(0);                                                                        \
+        const Scalar2 pixel = projection##_pixel(points[indices[index]], Rco, f, centre, k, dimensions);               \
+        out[index]          = pixel;                                                                                   \
+        network[index]      = bayerToRGB(image, bayer_sampler, convert_float2(pixel), first_red);                      \
+    }                                                                                                                  \
+                                                                                                                       \
+    kernel void project_##projection##_load_yuv_image(global const Scalar4* points,                                    \
+                                                      global int* indices,                                             \
+                                                      const Scalar16 Rco,                                              \
+                                                      const Scalar f,                                                  \
+                                                      const Scalar2 centre,                                            \
+                                                      const Scalar4 k,                                                 \
+                                                      const int2 dimensions,                                           \
+                                                      global Scalar2* out,                                             \
+                                                      read_only image2d_t image,                                       \
+                                                      const int8 layout,                                               \
+                                                      global float4* network) {                                        \
+        const int index     = get_global_id(0);                                                                        \
+        const Scalar2 pixel = projection##_pixel(points[indices[index]], Rco, f, centre, k, dimensions);               \
+        out[index]          = pixel;                                                                                   \
+        network[index]      = yuvToRGB(image, layout, convert_float2(pixel));                                          \
+    }                                                                                                                  \
+                                                                                                                       \
+    kernel void project_##projection##_load_interpolated_image(global const Scalar4* points,                           \
+                                                               global int* indices,                                    \
+                                                               const Scalar16 Rco,                                     \
+                                                               const Scalar f,                                         \
+                                                               const Scalar2 centre,                                   \
+                                                               const Scalar4 k,                                        \
+                                                               const int2 dimensions,                                  \
+                                                               global Scalar2* out,                                    \
+                                                               read_only image2d_t image,                              \
+                                                               global float4* network) {                               \
+        const int index     = get_global_id(0);                                                                        \
+        const Scalar2 pixel = projection##_pixel(points[indices[index]], Rco, f, centre, k, dimensions);               \
+        out[index]          = pixel;                                                                                   \
+        network[index]      = read_imagef(image, interp_sampler, convert_float2(pixel));                               \
+    }
+
+PROJECT_LOAD_IMAGE(rectilinear)
+PROJECT_LOAD_IMAGE(equidistant)
+PROJECT_LOAD_IMAGE(equisolid)
+
+#undef PROJECT_LOAD_IMAGE
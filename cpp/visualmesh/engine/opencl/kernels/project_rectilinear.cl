@@ -20,10 +20,9 @@
 #endif
 
 /**
- * Projects visual mesh points to a rectilinear camera
+ * Projects a single visual mesh point to a rectilinear camera
  *
- * @param points      VisualMesh unit vectors as 4d vectors [x, y, z, 0]
- * @param indices     map from local indices to global indices
+ * @param ray         the VisualMesh unit vector as a 4d vector [x, y, z, 0]
  * @param Rco         rotation from the observation space to camera space
  *                    note that while this is a 4x4, that is for memory alignment, no translation should exist
  *                    (or would be applied anyway)
@@ -31,24 +30,15 @@
  * @param centre      the offset from the centre of the lens axis to the centre of the image in pixels
  * @param k           the inverse distortion coefficients to apply the distortion to the image
  * @param dimensions  the dimensions of the input image
- * @param out         the output image coordinates
+ *
+ * @return the image coordinates of the point
  */
-kernel void project_rectilinear(global const Scalar4* points,
-                                global int* indices,
-                                const Scalar16 Rco,
-                                const Scalar f,
-                                const Scalar2 centre,
-                                const Scalar4 k,
-                                const int2 dimensions,
-                                global Scalar2* out) {
-
-    const int index = get_global_id(0);
-
-    // Get our real index
-    const int id = indices[index];
-
-    // Get our LUT point
-    Scalar4 ray = points[id];
+Scalar2 rectilinear_pixel(Scalar4 ray,
+                          const Scalar16 Rco,
+                          const Scalar f,
+                          const Scalar2 centre,
+                          const Scalar4 k,
+                          const int2 dimensions) {
 
     // Rotate our ray by our matrix to put it into camera space
     ray = (Scalar4)(dot(Rco.s0123, ray), dot(Rco.s4567, ray), dot(Rco.s89ab, ray), 0);
@@ -71,10 +61,35 @@ kernel void project_rectilinear(global const Scalar4* points,
 
     // Apply our offset to move into image space (0 at top left, x to the right, y down)
     // Then apply the offset to the centre of our lens
-    const Scalar2 image =
-      (Scalar2)((Scalar)(dimensions.x - 1) * (Scalar)(0.5), (Scalar)(dimensions.y - 1) * (Scalar)(0.5)) - screen
-      - centre;
+    return (Scalar2)((Scalar)(dimensions.x - 1) * (Scalar)(0.5), (Scalar)(dimensions.y - 1) * (Scalar)(0.5)) - screen
+           - centre;
+}
+
+/**
+ * Projects visual mesh points to a rectilinear camera
+ *
+ * @param points      VisualMesh unit vectors as 4d vectors [x, y, z, 0]
+ * @param indices     map from local indices to global indices
+ * @param Rco         rotation from the observation space to camera space
+ *                    note that while this is a 4x4, that is for memory alignment, no translation should exist
+ *                    (or would be applied anyway)
+ * @param f           the focal length of the lens measured in pixels
+ * @param centre      the offset from the centre of the lens axis to the centre of the image in pixels
+ * @param k           the inverse distortion coefficients to apply the distortion to the image
+ * @param dimensions  the dimensions of the input image
+ * @param out         the output image coordinates
+ */
+kernel void project_rectilinear(global const Scalar4* points,
+                                global int* indices,
+                                const Scalar16 Rco,
+                                const Scalar f,
+                                const Scalar2 centre,
+                                const Scalar4 k,
+                                const int2 dimensions,
+                                global Scalar2* out) {
+
+    const int index = get_global_id(0);
 
-    // Store our output coordinates
-    out[index] = image;
+    // Project the LUT point of our real index and store our output coordinates
+    out[index] = rectilinear_pixel(points[indices[index]], Rco, f, centre, k, dimensions);
 }
@@ -0,0 +1,477 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef VISUALMESH_ENGINE_OPENCL_MULTI_ENGINE_HPP
+#define VISUALMESH_ENGINE_OPENCL_MULTI_ENGINE_HPP
+
+// If OpenCL is disabled then don't provide this file
+#if !defined(VISUALMESH_DISABLE_OPENCL)
+
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "visualmesh/batch_frame.hpp"
+#include "visualmesh/classified_mesh.hpp"
+#include "visualmesh/compiled_network.hpp"
+#include "visualmesh/engine/opencl/classification_future.hpp"
+#include "visualmesh/engine/opencl/engine.hpp"
+#include "visualmesh/engine/opencl/operation/make_context.hpp"
+#include "visualmesh/engine/opencl/operation/wrapper.hpp"
+#include "visualmesh/mesh.hpp"
+#include "visualmesh/projected_mesh.hpp"
+#include "visualmesh/quantisation.hpp"
+#include "visualmesh/visualmesh.hpp"
+
+namespace visualmesh {
+namespace engine {
+    namespace opencl {
+
+        /**
+         * @brief Runs the visual mesh over several OpenCL devices at once, with an Engine for each device
+         *
+         * @details
+         *  Each frame is given to a single device. A camera can be pinned to a device so all of its frames go there,
+         *  which keeps its meshes and lookups on that device. The frames of cameras that are not pinned go to whichever
+         *  device has the fewest frames queued for its number of compute units. A batch of frames is split into one
+         *  batch per device in proportion to their compute units. Like Engine this can be used from several threads.
+         *
+         * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+         */
+        template <typename Scalar>
+        class MultiEngine {
+        public:
+            /**
+             * @brief Construct a new OpenCL Engine for each of the provided devices
+             *
+             * @param network         the network to use for classification
+             * @param precision       the precision to execute the network with, either FULL or HALF
+             * @param cache_directory an existing directory to cache the compiled programs in, or empty to always
+             *                        compile them
+             * @param storage         where the weights are kept on the devices
+             * @param devices         the devices to run on, by default every device that is available
+             */
+            explicit MultiEngine(const CompiledNetwork<Scalar>& network   = {},
+                                 const Precision& precision               = Precision::FULL,
+                                 const std::string& cache_directory       = "",
+                                 const WeightStorage& storage             = WeightStorage::INLINE,
+                                 const std::vector<cl_device_id>& devices = operation::list_devices()) {
+                for (const auto& device : devices) {
+                    add(std::make_unique<Engine<Scalar>>(network, precision, cache_directory, storage, device),
+                        device);
+                }
+                if (engines.empty()) { throw std::invalid_argument("At least one OpenCL device is needed"); }
+            }
+
+            /**
+             * @brief Construct a new OpenCL Engine for each of the provided devices that executes a quantised network
+             *
+             * @param network         the quantised network to use for classification
+             * @param cache_directory an existing directory to cache the compiled programs in, or empty to always
+             *                        compile them
+             * @param devices         the devices to run on, by default every device that is available
+             */
+            explicit MultiEngine(const QuantisedNetwork<Scalar>& network,
+                                 const std::string& cache_directory       = "",
+                                 const std::vector<cl_device_id>& devices = operation::list_devices()) {
+                for (const auto& device : devices) {
+                    add(std::make_unique<Engine<Scalar>>(network, cache_directory, device), device);
+                }
+                if (engines.empty()) { throw std::invalid_argument("At least one OpenCL device is needed"); }
+            }
+
+            /**
+             * @brief Get the number of devices this engine runs on
+             *
+             * @return the number of devices, and the number of per device engines
+             */
+            size_t size() const {
+                return engines.size();
+            }
+
+            /**
+             * @brief Get the engine for a single device, to configure it or to run a frame on that device directly
+             *
+             * @param index the index of the device, in the order the devices were given
+             *
+             * @return the engine that runs on that device
+             */
+            Engine<Scalar>& device(const size_t& index) {
+                return *engines.at(index).engine;
+            }
+            const Engine<Scalar>& device(const size_t& index) const {
+                return *engines.at(index).engine;
+            }
+
+            /**
+             * @brief Send every frame from a camera to a single device
+             *
+             * @param camera an identifier for the camera, the same one that is given when submitting its frames
+             * @param index  the index of the device to run its frames on
+             */
+            void pin(const int& camera, const size_t& index) {
+                if (index >= engines.size()) { throw std::out_of_range("There is no OpenCL device with this index"); }
+                std::lock_guard<std::mutex> lock(pins_mutex);
+                pins[camera] = index;
+            }
+
+            /**
+             * @brief Let the frames from a camera go to whichever device is least loaded again
+             *
+             * @param camera the identifier of the camera that was pinned
+             */
+            void unpin(const int& camera) {
+                std::lock_guard<std::mutex> lock(pins_mutex);
+                pins.erase(camera);
+            }
+
+            /**
+             * @brief Get the device that the next frame from a camera will be run on
+             *
+             * @param camera the identifier of the camera
+             *
+             * @return the device it is pinned to, or the device that currently has the least work queued
+             */
+            size_t select(const int& camera) const {
+                /* mutex scope */ {
+                    std::lock_guard<std::mutex> lock(pins_mutex);
+                    auto it = pins.find(camera);
+                    if (it != pins.end()) { return it->second; }
+                }
+
+                // Compare (pending + 1) / compute units without dividing, so an idle device with more compute wins
+                size_t best            = 0;
+                unsigned int best_load = engines[0].engine->pending() + 1;
+                for (size_t i = 1; i < engines.size(); ++i) {
+                    unsigned int load = engines[i].engine->pending() + 1;
+                    if (load * engines[best].compute_units < best_load * engines[i].compute_units) {
+                        best      = i;
+                        best_load = load;
+                    }
+                }
+                return best;
+            }
+
+            /**
+             * @brief Projects a provided mesh to pixel coordinates on the device chosen for this camera
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param camera the identifier of the camera the frame is from
+             * @param mesh   the mesh table that we are projecting to pixel coordinates
+             * @param Hoc    the homogenous transformation matrix from the camera to the observation plane
+             * @param lens   the lens parameters that describe the optics of the camera
+             *
+             * @return a projected mesh for the provided arguments
+             */
+            template <template <typename> class Model>
+            ProjectedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> operator()(const int& camera,
+                                                                          const Mesh<Scalar, Model>& mesh,
+                                                                          const mat4<Scalar>& Hoc,
+                                                                          const Lens<Scalar>& lens) const {
+                return (*engines[select(camera)].engine)(mesh, Hoc, lens);
+            }
+
+            /**
+             * @brief Projects a provided mesh to pixel coordinates on the device chosen for this camera
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param camera the identifier of the camera the frame is from
+             * @param mesh   the visual mesh that we are projecting to pixel coordinates
+             * @param Hoc    the homogenous transformation matrix from the camera to the observation plane
+             * @param lens   the lens parameters that describe the optics of the camera
+             *
+             * @return a projected mesh for the provided arguments
+             */
+            template <template <typename> class Model>
+            ProjectedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> operator()(const int& camera,
+                                                                          const VisualMesh<Scalar, Model>& mesh,
+                                                                          const mat4<Scalar>& Hoc,
+                                                                          const Lens<Scalar>& lens) const {
+                return operator()(camera, mesh.height(Hoc[2][3]), Hoc, lens);
+            }
+
+            /**
+             * @brief Project and classify a mesh on the device chosen for this camera
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param camera the identifier of the camera the frame is from
+             * @param mesh   the mesh table that we are projecting to pixel coordinates
+             * @param Hoc    the homogenous transformation matrix from the camera to the observation plane
+             * @param lens   the lens parameters that describe the optics of the camera
+             * @param image  the data that represents the image the network will run from
+             * @param format the pixel format of this image as a fourcc code
+             *
+             * @return a classified mesh for the provided arguments
+             */
+            template <template <typename> class Model>
+            ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> operator()(const int& camera,
+                                                                           const Mesh<Scalar, Model>& mesh,
+                                                                           const mat4<Scalar>& Hoc,
+                                                                           const Lens<Scalar>& lens,
+                                                                           const void* image,
+                                                                           const uint32_t& format) const {
+                return submit(camera, mesh, Hoc, lens, image, format).get();
+            }
+
+            /**
+             * @brief Project and classify a mesh on the device chosen for this camera
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param camera the identifier of the camera the frame is from
+             * @param mesh   the visual mesh that we are projecting to pixel coordinates
+             * @param Hoc    the homogenous transformation matrix from the camera to the observation plane
+             * @param lens   the lens parameters that describe the optics of the camera
+             * @param image  the data that represents the image the network will run from
+             * @param format the pixel format of this image as a fourcc code
+             *
+             * @return a classified mesh for the provided arguments
+             */
+            template <template <typename> class Model>
+            ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> operator()(const int& camera,
+                                                                           const VisualMesh<Scalar, Model>& mesh,
+                                                                           const mat4<Scalar>& Hoc,
+                                                                           const Lens<Scalar>& lens,
+                                                                           const void* image,
+                                                                           const uint32_t& format) const {
+                return operator()(camera, mesh.height(Hoc[2][3]), Hoc, lens, image, format);
+            }
+
+            /**
+             * @brief Queue the projection and classification of a mesh on the device chosen for this camera without
+             * waiting for it to finish
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param camera the identifier of the camera the frame is from
+             * @param mesh   the mesh table that we are projecting to pixel coordinates
+             * @param Hoc    the homogenous transformation matrix from the camera to the observation plane
+             * @param lens   the lens parameters that describe the optics of the camera
+             * @param image  the data that represents the image the network will run from, which must remain valid
+             *               until the returned future is ready
+             * @param format the pixel format of this image as a fourcc code
+             *
+             * @return a future that holds the classified mesh once the device has finished
+             */
+            template <template <typename> class Model>
+            ClassificationFuture<Scalar, Model<Scalar>::N_NEIGHBOURS> submit(const int& camera,
+                                                                             const Mesh<Scalar, Model>& mesh,
+                                                                             const mat4<Scalar>& Hoc,
+                                                                             const Lens<Scalar>& lens,
+                                                                             const void* image,
+                                                                             const uint32_t& format) const {
+                return engines[select(camera)].engine->submit(mesh, Hoc, lens, image, format);
+            }
+
+            /**
+             * @brief Project and classify a batch of frames split over every device, blocking until they have finished
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param batch the frames to classify
+             *
+             * @return a classified mesh for each frame in the batch, in the same order
+             */
+            template <template <typename> class Model>
+            std::vector<ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS>> operator()(
+              const std::vector<BatchFrame<Scalar, Model>>& batch) const {
+                auto futures = submit(batch);
+                std::vector<ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS>> results;
+                results.reserve(futures.size());
+                for (auto& future : futures) {
+                    results.push_back(future.get());
+                }
+                return results;
+            }
+
+            /**
+             * @brief Queue the projection and classification of a batch of frames split over every device
+             *
+             * @details
+             *  The batch is cut into consecutive runs of frames, one for each device, with the length of each run in
+             *  proportion to the compute units of its device. Pins are ignored as a batch has no cameras. The images
+             *  must remain valid until all the returned futures are ready.
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param batch the frames to classify
+             *
+             * @return a future for the classified mesh of each frame in the batch, in the same order
+             */
+            template <template <typename> class Model>
+            std::vector<ClassificationFuture<Scalar, Model<Scalar>::N_NEIGHBOURS>> submit(
+              const std::vector<BatchFrame<Scalar, Model>>& batch) const {
+
+                size_t total_units = 0;
+                for (const auto& e : engines) {
+                    total_units += e.compute_units;
+                }
+
+                std::vector<ClassificationFuture<Scalar, Model<Scalar>::N_NEIGHBOURS>> futures;
+                futures.reserve(batch.size());
+                size_t start = 0;
+                size_t units = 0;
+                for (const auto& e : engines) {
+                    // Round the end of each run so the frames that are left over are shared out rather than all
+                    // landing on the last device
+                    units += e.compute_units;
+                    const size_t end = (batch.size() * units + total_units / 2) / total_units;
+                    if (end > start) {
+                        auto part = e.engine->submit(std::vector<BatchFrame<Scalar, Model>>(
+                          std::next(batch.begin(), start), std::next(batch.begin(), end)));
+                        for (auto& f : part) {
+                            futures.push_back(std::move(f));
+                        }
+                    }
+                    start = end;
+                }
+                return futures;
+            }
+
+            /**
+             * @brief Replace the weights of the network on every device
+             *
+             * @param network the network with the new weights
+             */
+            void update_weights(const CompiledNetwork<Scalar>& network) {
+                for (auto& e : engines) {
+                    e.engine->update_weights(network);
+                }
+            }
+
+            /**
+             * @brief Set how many submitted frames may be in flight on each device at once
+             *
+             * @param depth the maximum number of frames that may be in flight on each device (at least 1)
+             */
+            void in_flight(const unsigned int& depth) {
+                for (auto& e : engines) {
+                    e.engine->in_flight(depth);
+                }
+            }
+
+            /**
+             * @brief Find the points on the screen on the devices rather than by walking the mesh on the host
+             *
+             * @param enabled true to find the points on the screen on the devices
+             */
+            void lookup_on_device(const bool& enabled) {
+                for (auto& e : engines) {
+                    e.engine->lookup_on_device(enabled);
+                }
+            }
+
+            /**
+             * @brief Remove the points the host lookup finds that are not on the screen on the devices
+             *
+             * @param enabled true to remove the points that are not on the screen before running the network
+             */
+            void cull_offscreen(const bool& enabled) {
+                for (auto& e : engines) {
+                    e.engine->cull_offscreen(enabled);
+                }
+            }
+
+            /**
+             * @brief Set how much memory the meshes kept on each device may use
+             *
+             * @param bytes the memory budget for the meshes on each device in bytes
+             */
+            void device_budget(const std::size_t& bytes) {
+                for (auto& e : engines) {
+                    e.engine->device_budget(bytes);
+                }
+            }
+
+            /**
+             * @brief Upload a mesh to every device ahead of the frames that will use it
+             *
+             * @tparam Model the mesh model of the mesh
+             *
+             * @param mesh the mesh to upload
+             */
+            template <template <typename> class Model>
+            void preload(const Mesh<Scalar, Model>& mesh) const {
+                for (const auto& e : engines) {
+                    e.engine->preload(mesh);
+                }
+            }
+
+            /**
+             * @brief Drop the copies of a mesh on every device
+             *
+             * @tparam Model the mesh model of the mesh
+             *
+             * @param mesh the mesh to drop
+             */
+            template <template <typename> class Model>
+            void evict(const Mesh<Scalar, Model>& mesh) const {
+                for (const auto& e : engines) {
+                    e.engine->evict(mesh);
+                }
+            }
+
+            void clear_cache() {
+                for (auto& e : engines) {
+                    e.engine->clear_cache();
+                }
+            }
+
+        private:
+            /**
+             * @brief Add an engine for a device, weighted by how many compute units the device has
+             *
+             * @param engine the engine that runs on the device
+             * @param device the device the engine runs on
+             */
+            void add(std::unique_ptr<Engine<Scalar>>&& engine, cl_device_id device) {
+                cl_uint compute_units = 0;
+                ::clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(compute_units), &compute_units, nullptr);
+                engines.push_back(DeviceEngine{std::move(engine), std::max(compute_units, cl_uint(1))});
+            }
+
+            /// An engine for a single device along with how fast the device is
+            struct DeviceEngine {
+                /// The engine that runs on this device
+                std::unique_ptr<Engine<Scalar>> engine;
+                /// How many compute units the device has, used to weight how much work it is given
+                cl_uint compute_units;
+            };
+            /// The engine for each device, in the order the devices were given
+            std::vector<DeviceEngine> engines;
+
+            /// The device each pinned camera's frames are sent to
+            std::map<int, size_t> pins;
+            /// Guards the pins as frames can be submitted from several threads
+            mutable std::mutex pins_mutex;
+        };
+
+    }  // namespace opencl
+}  // namespace engine
+}  // namespace visualmesh
+
+#endif  // !defined(VISUALMESH_DISABLE_OPENCL)
+#endif  // VISUALMESH_ENGINE_OPENCL_MULTI_ENGINE_HPP
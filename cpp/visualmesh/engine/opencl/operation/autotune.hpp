@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_OPENCL_OPERATION_AUTOTUNE_HPP
+#define VISUALMESH_OPENCL_OPERATION_AUTOTUNE_HPP
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "visualmesh/utility/atomic_file.hpp"
+#include "wrapper.hpp"
+
+namespace visualmesh {
+namespace engine {
+    namespace opencl {
+        namespace operation {
+
+            /**
+             * @brief Get the workgroup sizes worth trying for a kernel on a device
+             *
+             * @details
+             *  These are the kernel's preferred multiple doubled until it reaches the most the kernel can run with on
+             *  the device, capped at 1024.
+             *
+             * @param kernel the kernel to find workgroup sizes for
+             * @param device the device the kernel runs on
+             *
+             * @return the workgroup sizes from smallest to largest
+             */
+            inline std::vector<size_t> local_size_candidates(cl_kernel kernel, cl_device_id device) {
+                size_t multiple = 1;
+                size_t largest  = 1;
+                ::clGetKernelWorkGroupInfo(
+                  kernel, device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(multiple), &multiple, nullptr);
+                ::clGetKernelWorkGroupInfo(
+                  kernel, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(largest), &largest, nullptr);
+
+                std::vector<size_t> sizes;
+                for (size_t size = std::max(multiple, size_t(1)); size <= std::min(largest, size_t(1024)); size *= 2) {
+                    sizes.push_back(size);
+                }
+                if (sizes.empty()) { sizes.push_back(1); }
+                return sizes;
+            }
+
+            /**
+             * @brief Work out the file the tuned workgroup sizes of a program are cached in
+             *
+             * @details
+             *  They are kept beside the program's binary, with the same name, as they depend on the same device, driver
+             *  and source.
+             *
+             * @param program_path the path of the program's cached binary
+             *
+             * @return the path of the cached workgroup sizes
+             */
+            inline std::string tuning_cache_path(const std::string& program_path) {
+                return program_path.substr(0, program_path.rfind('.')) + ".tune";
+            }
+
+            /**
+             * @brief Read the tuned workgroup size of each convolution from the cache
+             *
+             * @param path    the file the workgroup sizes are cached in
+             * @param n_convs the number of convolutions in the network
+             *
+             * @return the workgroup size of each convolution, or empty if there is none cached for this many
+             */
+            inline std::vector<size_t> load_local_sizes(const std::string& path, const size_t& n_convs) {
+                std::ifstream file(path);
+                std::vector<size_t> sizes;
+                size_t size = 0;
+                while (file >> size) {
+                    sizes.push_back(size);
+                }
+                if (sizes.size() != n_convs || std::find(sizes.begin(), sizes.end(), 0) != sizes.end()) { return {}; }
+                return sizes;
+            }
+
+            /**
+             * @brief Write the tuned workgroup size of each convolution to the cache
+             *
+             * @details
+             *  The sizes are written to the side first so a partial file is never read. Failing to write the cache is
+             *  not an error, the cache directory must already exist for anything to be written.
+             *
+             * @param path  the file to cache the workgroup sizes in
+             * @param sizes the workgroup size of each convolution
+             */
+            inline void store_local_sizes(const std::string& path, const std::vector<size_t>& sizes) {
+                std::stringstream file;
+                for (const auto& size : sizes) {
+                    file << size << std::endl;
+                }
+                write_atomically(path, file.str());
+            }
+
+        }  // namespace operation
+    }      // namespace opencl
+}  // namespace engine
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_OPENCL_OPERATION_AUTOTUNE_HPP
@@ -18,6 +18,7 @@
 #ifndef VISUALMESH_OPENCL_OPERATION_MAKE_CONTEXT_HPP
 #define VISUALMESH_OPENCL_OPERATION_MAKE_CONTEXT_HPP
 
+#include <algorithm>
 #include <utility>
 #include <vector>
 
@@ -29,12 +30,11 @@ namespace engine {
         namespace operation {
 
             /**
-             * @brief Find and create an OpenCL command context for a specific device. Or the best device if a specific
-             * device is not provided.
+             * @brief Find every OpenCL device on every platform, ordered from the most to the fewest compute units
              *
-             * @return a pair of the context that was created as well as the device it was created for
+             * @return the devices that are available, the first being the one make_context picks by default
              */
-            inline std::pair<cl::context, cl_device_id> make_context() {
+            inline std::vector<cl_device_id> list_devices() {
 
                 // Get our platforms
                 cl_uint platform_count = 0;
@@ -42,11 +42,8 @@ namespace engine {
                 std::vector<cl_platform_id> platforms(platform_count);
                 ::clGetPlatformIDs(platforms.size(), platforms.data(), nullptr);
 
-                // Which device/platform we are going to use
-                cl_device_id best_device   = nullptr;
-                cl_uint best_compute_units = 0;
-
-                // Go through our platforms
+                // Go through our platforms and collect their devices with how many compute units they have
+                std::vector<std::pair<cl_uint, cl_device_id>> found;
                 for (const auto& platform : platforms) {
 
                     cl_uint device_count = 0;
@@ -54,34 +51,57 @@ namespace engine {
                     std::vector<cl_device_id> devices(device_count);
                     ::clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, device_count, devices.data(), nullptr);
 
-                    // Go through our devices on the platform
                     for (const auto& device : devices) {
-
                         cl_uint max_compute_units = 0;
                         ::clGetDeviceInfo(
                           device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(max_compute_units), &max_compute_units, nullptr);
-
-                        if (max_compute_units > best_compute_units) {
-                            best_compute_units = max_compute_units;
-                            best_device        = device;
-                        }
+                        found.emplace_back(max_compute_units, device);
                     }
                 }
 
+                // The order the platforms listed them in is kept for devices with the same number of compute units
+                std::stable_sort(found.begin(), found.end(), [](const auto& a, const auto& b) {
+                    return a.first > b.first;
+                });
+
+                std::vector<cl_device_id> devices;
+                devices.reserve(found.size());
+                for (const auto& d : found) {
+                    devices.push_back(d.second);
+                }
+                return devices;
+            }
+
+            /**
+             * @brief Find and create an OpenCL command context for a specific device. Or the best device if a specific
+             * device is not provided.
+             *
+             * @param device the device to create the context for, or nullptr for the device with the most compute units
+             *
+             * @return a pair of the context that was created as well as the device it was created for
+             */
+            inline std::pair<cl::context, cl_device_id> make_context(cl_device_id device = nullptr) {
+
+                // Pick the device with the most compute units if we weren't given one
+                if (device == nullptr) {
+                    auto devices = list_devices();
+                    if (!devices.empty()) { device = devices.front(); }
+                }
+
                 // Print information about our selected device
-                if (best_device == nullptr) {
+                if (device == nullptr) {
                     throw std::system_error(
                       CL_INVALID_DEVICE, opencl_error_category(), "Error selecting an OpenCL device");
                 }
 
                 // Make context
                 cl_int error        = 0;
-                cl::context context = cl::context(::clCreateContext(nullptr, 1, &best_device, nullptr, nullptr, &error),
+                cl::context context = cl::context(::clCreateContext(nullptr, 1, &device, nullptr, nullptr, &error),
                                                   ::clReleaseContext);
                 if (error != 0) {
                     throw std::system_error(error, opencl_error_category(), "Error creating the OpenCL context");
                 }
-                return std::make_pair(context, best_device);
+                return std::make_pair(context, device);
             }
 
         }  // namespace operation
@@ -19,10 +19,13 @@
 #define VISUALMESH_OPENCL_OPERATION_MAKE_NETWORK_HPP
 
 #include <iostream>
+#include <stdexcept>
+#include <string>
 #include <utility>
 #include <vector>
 
-#include "visualmesh/network_structure.hpp"
+#include "visualmesh/compiled_network.hpp"
+#include "visualmesh/quantisation.hpp"
 #include "wrapper.hpp"
 
 namespace visualmesh {
@@ -30,187 +33,323 @@ namespace engine {
     namespace opencl {
         namespace operation {
 
-            /**
-             * @brief Given a network structure object generate the OpenCL source code for the kernels needed to execute
-             * it
-             *
-             * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
-             *
-             * @param structure the network structure to generate the kernels from
-             *
-             * @return the OpenCL source code for the kernels to be built
-             */
-            template <typename Scalar>
-            std::string make_network(const NetworkStructure<Scalar>& structure) {
-                // Generate the OpenCL kernels for the network
-                std::stringstream code;
-
-                // If our structure has no layers, return empty code
-                if (structure.empty() || structure.front().empty()) { return ""; }
-
-                // First layer has 4 inputs, so that tells us how many neighbours we have (minus ourself)
-                const unsigned int n_neighbours = (structure.front().front().weights.size() / 4) - 1;
-
-                // Set our precision for how many digits our scalar has
-                code << std::setprecision(std::numeric_limits<Scalar>::digits10 + 2);
-
-                // Keep track of the input and output size of each layer for building the network
-                // The first layer input is always 4 from the image
-                unsigned int input_dimensions  = 4;
-                unsigned int output_dimensions = 0;
-
-                for (unsigned int conv_no = 0; conv_no < structure.size(); ++conv_no) {
-                    auto& conv = structure[conv_no];
-
-                    // Write our OpenCL kernel definition
-                    code << "kernel void conv" << conv_no
-                         << "(global const int* neighbourhood, global const Scalar* input, global Scalar* output) {"
-                         << std::endl
-                         << std::endl;
-
-                    code << "  // Get our kernel index" << std::endl;
-                    code << "  const int idx = get_global_id(0);" << std::endl << std::endl;
-
-                    /*************************************************
-                     *                    GATHER                     *
-                     *************************************************/
+            namespace detail {
+
+                /**
+                 * @brief Generate the OpenCL kernels for a network, the matrix multiplication is provided by the caller
+                 *
+                 * @details
+                 *  Each convolution is written as a function that computes a single point, which the convN kernel runs
+                 *  for its global id. The network kernel runs every convolution in a single dispatch of one workgroup,
+                 *  which strides over the points for each convolution and then waits at a barrier before the next, so
+                 *  small frames only pay for one dispatch instead of one for each convolution.
+                 *
+                 * @tparam Scalar   the scalar type used for calculations and storage (normally one of float or double)
+                 * @tparam Network  the type of network, either a CompiledNetwork or a QuantisedNetwork
+                 * @tparam Multiply the type of the function that writes the code for a layer's weights and biases
+                 *
+                 * @param network  the network to generate the kernels from
+                 * @param compute  the OpenCL type that the intermediate values of the network are stored as
+                 * @param multiply writes the code that declares in<layer_no + 1> from in<layer_no>, called as
+                 *                 multiply(code, conv_no, layer_no, input_dimensions)
+                 *
+                 * @return the OpenCL source code for the kernels to be built
+                 */
+                template <typename Scalar, typename Network, typename Multiply>
+                std::string make_network(const Network& network, const std::string& compute, Multiply&& multiply) {
+                    // Generate the OpenCL kernels for the network
+                    std::stringstream code;
+
+                    // If our network has no layers, return empty code
+                    if (network.empty()) { return ""; }
+
+                    // First layer has 4 inputs, so that tells us how many neighbours we have (minus ourself)
+                    const unsigned int n_neighbours = (network.layer(0, 0).input_dimensions / 4) - 1;
+
+                    // Set our precision for how many digits our scalar has
+                    code << std::setprecision(std::numeric_limits<Scalar>::digits10 + 2);
+
+                    // Keep track of the input and output size of each layer for building the network
+                    // The first layer input is always 4 from the image
+                    unsigned int input_dimensions  = 4;
+                    unsigned int output_dimensions = 0;
+
+                    for (unsigned int conv_no = 0; conv_no < network.size(); ++conv_no) {
+
+                        // Write the function that computes a single point of this convolution
+                        code << "void conv" << conv_no << "_point(const int idx, global const int* neighbourhood, "
+                             << "global const Scalar* input, global Scalar* output) {" << std::endl
+                             << std::endl;
 
-                    code << "  // Gather from our neighbourhood " << std::endl;
-                    code << "  Scalar in0[" << (input_dimensions * (n_neighbours + 1)) << "] = {" << std::endl;
+                        /*************************************************
+                         *                    GATHER                     *
+                         *************************************************/
 
-                    // Read the ones for our own index
-                    for (unsigned int j = 0; j < input_dimensions; ++j) {
-                        code << "    input[idx * " << input_dimensions << " + " << j << "]," << std::endl;
-                    }
+                        code << "  // Gather from our neighbourhood " << std::endl;
+                        code << "  " << compute << " in0[" << (input_dimensions * (n_neighbours + 1)) << "] = {"
+                             << std::endl;
 
-                    // Read our neighbourhood
-                    for (unsigned int i = 0; i < n_neighbours; ++i) {
+                        // Read the ones for our own index
                         for (unsigned int j = 0; j < input_dimensions; ++j) {
-                            code << "    input[neighbourhood[idx * " << n_neighbours << " + " << i << "] * "
-                                 << input_dimensions << " + " << j << "]";
-
-                            // Comma separated except for the end
-                            if (i < n_neighbours || j + 1 < input_dimensions) { code << ","; }
-                            code << std::endl;
+                            code << "    input[idx * " << input_dimensions << " + " << j << "]," << std::endl;
                         }
-                    }
-                    code << "  };";
 
+                        // Read our neighbourhood
+                        for (unsigned int i = 0; i < n_neighbours; ++i) {
+                            for (unsigned int j = 0; j < input_dimensions; ++j) {
+                                code << "    input[neighbourhood[idx * " << n_neighbours << " + " << i << "] * "
+                                     << input_dimensions << " + " << j << "]";
 
-                    // We have gathered which increased the size of the input
-                    input_dimensions = input_dimensions * (n_neighbours + 1);
+                                // Comma separated except for the end
+                                if (i < n_neighbours || j + 1 < input_dimensions) { code << ","; }
+                                code << std::endl;
+                            }
+                        }
+                        code << "  };";
 
-                    code << std::endl << std::endl;
 
-                    /*************************************************
-                     *                WEIGHTS + BIAS                 *
-                     *************************************************/
+                        // We have gathered which increased the size of the input
+                        input_dimensions = input_dimensions * (n_neighbours + 1);
 
-                    // Now we have to do our layer operations
-                    for (unsigned int layer_no = 0; layer_no < conv.size(); ++layer_no) {
-                        const auto& weights    = conv[layer_no].weights;
-                        const auto& biases     = conv[layer_no].biases;
-                        const auto& activation = conv[layer_no].activation;
+                        code << std::endl << std::endl;
 
-                        // Update our output dimensions
-                        output_dimensions = biases.size();
+                        /*************************************************
+                         *                WEIGHTS + BIAS                 *
+                         *************************************************/
 
-                        // Perform the matrix multiplication
-                        code << "  // Perform our matrix multiplication for weights and add bias for layer " << layer_no
-                             << std::endl;
-                        code << "  Scalar in" << (layer_no + 1) << "[" << output_dimensions << "] = {" << std::endl;
-                        for (unsigned int i = 0; i < output_dimensions; ++i) {
-                            code << "    ";
-                            for (unsigned int j = 0; j < input_dimensions; ++j) {
-                                code << "in" << layer_no << "[" << j << "] * " << weights[j][i] << " + ";
+                        // Now we have to do our layer operations
+                        for (unsigned int layer_no = 0; layer_no < network.size(conv_no); ++layer_no) {
+                            const auto activation = network.layer(conv_no, layer_no).activation;
+
+                            // Update our output dimensions
+                            output_dimensions = network.layer(conv_no, layer_no).output_dimensions;
+
+                            // Perform the matrix multiplication
+                            multiply(code, conv_no, layer_no, input_dimensions);
+
+
+                            /*************************************************
+                             *                  ACTIVATION.                  *
+                             *************************************************/
+
+                            // Apply our activation function
+                            code << "  // Apply the activation function" << std::endl;
+
+                            switch (activation) {
+                                case ActivationFunction::SELU: {
+                                    // selu constants
+                                    constexpr const Scalar lambda = 1.0507009873554804934193349852946;
+                                    constexpr const Scalar alpha  = 1.6732632423543772848170429916717;
+
+                                    code << "  // Apply selu" << std::endl;
+                                    for (unsigned int i = 0; i < output_dimensions; ++i) {
+                                        std::string e =
+                                          "in" + std::to_string(layer_no + 1) + "[" + std::to_string(i) + "]";
+                                        code << "  " << e << " = " << lambda << "f * (" << e << " > 0 ? " << e << " : "
+                                             << alpha << "f * exp(" << e << ") - " << alpha << "f);" << std::endl;
+                                    }
+                                } break;
+                                case ActivationFunction::RELU: {
+                                    code << "  // Apply relu" << std::endl;
+                                    for (unsigned int i = 0; i < output_dimensions; ++i) {
+                                        std::string e =
+                                          "in" + std::to_string(layer_no + 1) + "[" + std::to_string(i) + "]";
+                                        code << "  " << e << " = " << e << " > 0 ? " << e << " : 0;" << std::endl;
+                                    }
+                                } break;
+                                case ActivationFunction::TANH: {
+                                    code << "  // Apply tanh" << std::endl;
+                                    for (unsigned int i = 0; i < output_dimensions; ++i) {
+                                        std::string e =
+                                          "in" + std::to_string(layer_no + 1) + "[" + std::to_string(i) + "]";
+                                        code << "  " << e << " = tanh(" << e << ");" << std::endl;
+                                    }
+                                } break;
+                                case ActivationFunction::SOFTMAX: {
+                                    code << "  // Apply softmax" << std::endl;
+
+                                    // Apply exp to each of the elements
+                                    for (unsigned int i = 0; i < output_dimensions; ++i) {
+                                        std::string e =
+                                          "in" + std::to_string(layer_no + 1) + "[" + std::to_string(i) + "]";
+                                        code << "  " << e << " = exp(" << e << ");" << std::endl;
+                                    }
+
+                                    // Sum up all the values
+                                    code << "Scalar exp_sum = 0;" << std::endl;
+                                    for (unsigned int i = 0; i < output_dimensions; ++i) {
+                                        std::string e =
+                                          "in" + std::to_string(layer_no + 1) + "[" + std::to_string(i) + "]";
+                                        code << "  exp_sum += " << e << ";" << std::endl;
+                                    }
+
+                                    // Divide all the values
+                                    for (unsigned int i = 0; i < output_dimensions; ++i) {
+                                        std::string e =
+                                          "in" + std::to_string(layer_no + 1) + "[" + std::to_string(i) + "]";
+                                        code << "  " << e << " /= exp_sum;" << std::endl;
+                                    }
+                                } break;
                             }
-                            code << biases[i];
-                            if (i + 1 < output_dimensions) { code << ","; }
+
                             code << std::endl;
-                        }
-                        code << "  };" << std::endl << std::endl;
 
+                            // Update our input size for the next loop
+                            input_dimensions = output_dimensions;
+                        }
 
                         /*************************************************
-                         *                  ACTIVATION.                  *
+                         *                    OUTPUT                     *
                          *************************************************/
-
-                        // Apply our activation function
-                        code << "  // Apply the activation function" << std::endl;
-
-                        switch (activation) {
-                            case ActivationFunction::SELU: {
-                                // selu constants
-                                constexpr const Scalar lambda = 1.0507009873554804934193349852946;
-                                constexpr const Scalar alpha  = 1.6732632423543772848170429916717;
-
-                                code << "  // Apply selu" << std::endl;
-                                for (unsigned int i = 0; i < output_dimensions; ++i) {
-                                    std::string e = "in" + std::to_string(layer_no + 1) + "[" + std::to_string(i) + "]";
-                                    code << "  " << e << " = " << lambda << "f * (" << e << " > 0 ? " << e << " : "
-                                         << alpha << "f * exp(" << e << ") - " << alpha << "f);" << std::endl;
-                                }
-                            } break;
-                            case ActivationFunction::RELU: {
-                                code << "  // Apply relu" << std::endl;
-                                for (unsigned int i = 0; i < output_dimensions; ++i) {
-                                    std::string e = "in" + std::to_string(layer_no + 1) + "[" + std::to_string(i) + "]";
-                                    code << "  " << e << " = " << e << " > 0 ? " << e << " : 0;" << std::endl;
-                                }
-                            } break;
-                            case ActivationFunction::TANH: {
-                                code << "  // Apply tanh" << std::endl;
-                                for (unsigned int i = 0; i < output_dimensions; ++i) {
-                                    std::string e = "in" + std::to_string(layer_no + 1) + "[" + std::to_string(i) + "]";
-                                    code << "  " << e << " = tanh(" << e << ");" << std::endl;
-                                }
-                            } break;
-                            case ActivationFunction::SOFTMAX: {
-                                code << "  // Apply softmax" << std::endl;
-
-                                // Apply exp to each of the elements
-                                for (unsigned int i = 0; i < output_dimensions; ++i) {
-                                    std::string e = "in" + std::to_string(layer_no + 1) + "[" + std::to_string(i) + "]";
-                                    code << "  " << e << " = exp(" << e << ");" << std::endl;
-                                }
-
-                                // Sum up all the values
-                                code << "Scalar exp_sum = 0;" << std::endl;
-                                for (unsigned int i = 0; i < output_dimensions; ++i) {
-                                    std::string e = "in" + std::to_string(layer_no + 1) + "[" + std::to_string(i) + "]";
-                                    code << "  exp_sum += " << e << ";" << std::endl;
-                                }
-
-                                // Divide all the values
-                                for (unsigned int i = 0; i < output_dimensions; ++i) {
-                                    std::string e = "in" + std::to_string(layer_no + 1) + "[" + std::to_string(i) + "]";
-                                    code << "  " << e << " /= exp_sum;" << std::endl;
-                                }
-                            } break;
+                        code << "  // Save our value to the output" << std::endl;
+                        for (unsigned int i = 0; i < input_dimensions; ++i) {
+                            code << "  output[idx * " << input_dimensions << " + " << i << "] = in"
+                                 << network.size(conv_no) << "[" << i << "];" << std::endl;
                         }
 
-                        code << std::endl;
+                        code << "}" << std::endl << std::endl;
 
-                        // Update our input size for the next loop
+                        // Write our OpenCL kernel definition which runs the function for its index
+                        code << "kernel void conv" << conv_no
+                             << "(global const int* neighbourhood, global const Scalar* input, global Scalar* output) {"
+                             << std::endl;
+                        code << "  conv" << conv_no << "_point(get_global_id(0), neighbourhood, input, output);"
+                             << std::endl;
+                        code << "}" << std::endl << std::endl;
+
+                        // Update our input dimensions for the next round
                         input_dimensions = output_dimensions;
                     }
 
                     /*************************************************
-                     *                    OUTPUT                     *
+                     *                SINGLE DISPATCH                *
                      *************************************************/
-                    code << "  // Save our value to the output" << std::endl;
-                    for (unsigned int i = 0; i < input_dimensions; ++i) {
-                        code << "  output[idx * " << input_dimensions << " + " << i << "] = in" << conv.size() << "["
-                             << i << "];" << std::endl;
-                    }
 
+                    // Run every convolution in one workgroup, ping ponging between the buffers like separate kernels
+                    code << "kernel void network(global const int* neighbourhood, global Scalar* a, global Scalar* b, "
+                         << "const int n_points) {" << std::endl;
+                    code << "  const int step = get_local_size(0);" << std::endl;
+                    for (unsigned int conv_no = 0; conv_no < network.size(); ++conv_no) {
+                        const char* input  = conv_no % 2 == 0 ? "a" : "b";
+                        const char* output = conv_no % 2 == 0 ? "b" : "a";
+                        if (conv_no > 0) {
+                            code << "  // Wait for every point of the last convolution to be written" << std::endl;
+                            code << "  barrier(CLK_GLOBAL_MEM_FENCE);" << std::endl;
+                        }
+                        code << "  for (int idx = get_local_id(0); idx < n_points; idx += step) {" << std::endl;
+                        code << "    conv" << conv_no << "_point(idx, neighbourhood, " << input << ", " << output
+                             << ");" << std::endl;
+                        code << "  }" << std::endl;
+                    }
                     code << "}" << std::endl << std::endl;
 
-                    // Update our input dimensions for the next round
-                    input_dimensions = output_dimensions;
+                    return code.str();
                 }
 
-                return code.str();
+            }  // namespace detail
+
+            /**
+             * @brief Given a compiled network generate the OpenCL source code for the kernels needed to execute it
+             *
+             * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+             *
+             * @param network   the compiled network to generate the kernels from
+             * @param precision the precision to execute the network with, either FULL or HALF. HALF needs a device
+             *                  that supports cl_khr_fp16
+             *
+             * @return the OpenCL source code for the kernels to be built
+             */
+            template <typename Scalar>
+            std::string make_network(const CompiledNetwork<Scalar>& network,
+                                     const Precision& precision = Precision::FULL) {
+                if (precision == Precision::INT8) {
+                    throw std::invalid_argument("An INT8 OpenCL network must be generated from a QuantisedNetwork");
+                }
+
+                // In half precision the weights are cast so the multiplication isn't promoted back to Scalar
+                const bool half       = precision == Precision::HALF;
+                const std::string cast = half ? "(half)" : "";
+
+                std::string code = detail::make_network<Scalar>(
+                  network,
+                  half ? "half" : "Scalar",
+                  [&](std::ostream& code,
+                      const unsigned int& conv_no,
+                      const unsigned int& layer_no,
+                      const unsigned int& input_dimensions) {
+                      const auto layer = network.layer(conv_no, layer_no);
+
+                      code << "  // Perform our matrix multiplication for weights and add bias for layer " << layer_no
+                           << std::endl;
+                      code << "  " << (half ? "half" : "Scalar") << " in" << (layer_no + 1) << "["
+                           << layer.output_dimensions << "] = {" << std::endl;
+                      for (int i = 0; i < layer.output_dimensions; ++i) {
+                          code << "    ";
+                          for (unsigned int j = 0; j < input_dimensions; ++j) {
+                              code << "in" << layer_no << "[" << j << "] * " << cast << layer.weight(j, i) << " + ";
+                          }
+                          code << cast << layer.bias(i);
+                          if (i + 1 < layer.output_dimensions) { code << ","; }
+                          code << std::endl;
+                      }
+                      code << "  };" << std::endl << std::endl;
+                  });
+
+                return half && !code.empty() ? "#pragma OPENCL EXTENSION cl_khr_fp16 : enable\n" + code : code;
+            }
+
+            /**
+             * @brief Given a quantised network generate the OpenCL source code for the kernels needed to execute it
+             *
+             * @details
+             *  The input of each layer is quantised to 8 bits and multiplied against the integer weights using integer
+             *  arithmetic, which devices with integer dot product support can execute as packed 8 bit dot products.
+             *  The outputs are dequantised before the activation function is applied.
+             *
+             * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+             *
+             * @param network the quantised network to generate the kernels from
+             *
+             * @return the OpenCL source code for the kernels to be built
+             */
+            template <typename Scalar>
+            std::string make_network(const QuantisedNetwork<Scalar>& network) {
+                return detail::make_network<Scalar>(
+                  network,
+                  "Scalar",
+                  [&](std::ostream& code,
+                      const unsigned int& conv_no,
+                      const unsigned int& layer_no,
+                      const unsigned int& input_dimensions) {
+                      const auto& layer   = network.layer(conv_no, layer_no);
+                      const Scalar inv    = Scalar(1) / layer.input.scale;
+                      const Scalar offset = Scalar(layer.input.zero_point) + Scalar(0.5);
+
+                      code << "  // Quantise the input for layer " << layer_no << std::endl;
+                      code << "  const int q" << layer_no << "[" << input_dimensions << "] = {" << std::endl;
+                      for (unsigned int j = 0; j < input_dimensions; ++j) {
+                          code << "    (int)clamp(in" << layer_no << "[" << j << "] * " << inv << " + " << offset
+                               << ", (Scalar)0, (Scalar)" << QuantisationParameters<Scalar>::MAX_VALUE << ")";
+                          if (j + 1 < input_dimensions) { code << ","; }
+                          code << std::endl;
+                      }
+                      code << "  };" << std::endl << std::endl;
+
+                      code << "  // Perform our integer matrix multiplication and dequantise for layer " << layer_no
+                           << std::endl;
+                      code << "  Scalar in" << (layer_no + 1) << "[" << layer.output_dimensions << "] = {" << std::endl;
+                      for (int i = 0; i < layer.output_dimensions; ++i) {
+                          code << "    " << layer.biases[i] << " + " << layer.scales[i] << " * (Scalar)(0";
+                          for (unsigned int j = 0; j < input_dimensions; ++j) {
+                              const int w = layer.weight(j, i);
+                              if (w != 0) { code << " + q" << layer_no << "[" << j << "] * " << w; }
+                          }
+                          code << " - " << layer.offsets[i] << ")";
+                          if (i + 1 < layer.output_dimensions) { code << ","; }
+                          code << std::endl;
+                      }
+                      code << "  };" << std::endl << std::endl;
+                  });
             }
 
         }  // namespace operation
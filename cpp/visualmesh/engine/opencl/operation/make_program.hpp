@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_OPENCL_OPERATION_MAKE_PROGRAM_HPP
+#define VISUALMESH_OPENCL_OPERATION_MAKE_PROGRAM_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "opencl_error_category.hpp"
+#include "visualmesh/utility/atomic_file.hpp"
+#include "wrapper.hpp"
+
+namespace visualmesh {
+namespace engine {
+    namespace opencl {
+        namespace operation {
+
+            /**
+             * @brief Get a string property of a device
+             *
+             * @param device the device to query
+             * @param param  the property to get
+             *
+             * @return the value of the property
+             */
+            inline std::string device_info(cl_device_id device, cl_device_info param) {
+                size_t size = 0;
+                ::clGetDeviceInfo(device, param, 0, nullptr, &size);
+                std::vector<char> value(size);
+                ::clGetDeviceInfo(device, param, value.size(), value.data(), nullptr);
+                return std::string(value.begin(), std::find(value.begin(), value.end(), '\0'));
+            }
+
+            /**
+             * @brief Work out the file a program binary is cached in
+             *
+             * @details
+             *  The name is a 64 bit FNV-1a hash of everything that affects the binary the driver produces: the device,
+             *  the driver version, the build options and the source, which includes every weight of the network.
+             *
+             * @param cache_directory the directory the binaries are cached in
+             * @param device          the device the program is built for
+             * @param source          the source code of the program
+             * @param options         the options the program is built with
+             *
+             * @return the path of the cached binary
+             */
+            inline std::string program_cache_path(const std::string& cache_directory,
+                                                  cl_device_id device,
+                                                  const std::string& source,
+                                                  const std::string& options) {
+                uint64_t hash = 0xcbf29ce484222325;
+                auto add      = [&hash](const std::string& s) {
+                    // Include the terminator so the boundaries between the strings are part of the hash
+                    for (const auto& c : s + '\0') {
+                        hash ^= static_cast<unsigned char>(c);
+                        hash *= 0x100000001b3;
+                    }
+                };
+                add(device_info(device, CL_DEVICE_VENDOR));
+                add(device_info(device, CL_DEVICE_NAME));
+                add(device_info(device, CL_DEVICE_VERSION));
+                add(device_info(device, CL_DRIVER_VERSION));
+                add(options);
+                add(source);
+
+                std::stringstream path;
+                path << cache_directory << "/" << std::hex << std::setw(16) << std::setfill('0') << hash << ".clbin";
+                return path.str();
+            }
+
+            /**
+             * @brief Build an OpenCL program, using a binary from an earlier build of the same program if one is cached
+             *
+             * @details
+             *  Compiling a large network can take many seconds, so when a cache directory is given the binary the
+             *  driver produced is written there after the program is built from source. Later builds of the same
+             *  program for the same device and driver load that binary instead. A binary that can't be read or that the
+             *  driver rejects is ignored and the program is built from source. Failing to write the cache is not an
+             *  error, the cache directory must already exist for anything to be written.
+             *
+             * @param context         the context to make the program for
+             * @param device          the device to build the program for
+             * @param source          the source code of the program
+             * @param options         the options to build the program with
+             * @param cache_directory the directory the binaries are cached in, or empty to always build from source
+             *
+             * @return the built program
+             */
+            inline cl::program make_program(cl_context context,
+                                            cl_device_id device,
+                                            const std::string& source,
+                                            const std::string& options,
+                                            const std::string& cache_directory) {
+                cl_int error = CL_SUCCESS;
+
+                // Try to load a binary for this program
+                const std::string path = cache_directory.empty()
+                                           ? std::string()
+                                           : program_cache_path(cache_directory, device, source, options);
+                if (!path.empty()) {
+                    std::ifstream file(path, std::ios::binary);
+                    std::vector<unsigned char> binary((std::istreambuf_iterator<char>(file)),
+                                                      std::istreambuf_iterator<char>());
+                    if (!binary.empty()) {
+                        const unsigned char* data = binary.data();
+                        size_t size               = binary.size();
+                        cl_int status             = CL_SUCCESS;
+                        cl::program program(
+                          ::clCreateProgramWithBinary(context, 1, &device, &size, &data, &status, &error),
+                          ::clReleaseProgram);
+                        if (error == CL_SUCCESS && status == CL_SUCCESS
+                            && ::clBuildProgram(program, 1, &device, options.c_str(), nullptr, nullptr) == CL_SUCCESS) {
+                            return program;
+                        }
+                    }
+                }
+
+                const char* cstr = source.c_str();
+                size_t csize     = source.size();
+
+                cl::program program(::clCreateProgramWithSource(context, 1, &cstr, &csize, &error), ::clReleaseProgram);
+                throw_cl_error(error, "Error adding sources to OpenCL program");
+
+                // Compile the program
+                error = ::clBuildProgram(program, 1, &device, options.c_str(), nullptr, nullptr);
+                if (error != CL_SUCCESS) {
+                    // Get program build log
+                    size_t used = 0;
+                    ::clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, nullptr, &used);
+                    std::vector<char> log(used);
+                    ::clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, log.size(), log.data(), &used);
+
+                    // Throw an error with the build log
+                    throw_cl_error(error,
+                                   "Error building OpenCL program\n" + std::string(log.begin(), log.begin() + used));
+                }
+
+                // Save the binary for next time, writing it to the side first so a partial binary is never loaded
+                if (!path.empty()) {
+                    size_t size = 0;
+                    ::clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size), &size, nullptr);
+                    std::vector<unsigned char> binary(size);
+                    unsigned char* data = binary.data();
+                    if (size > 0
+                        && ::clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(data), &data, nullptr)
+                             == CL_SUCCESS) {
+                        write_atomically(path, std::string(binary.begin(), binary.end()));
+                    }
+                }
+
+                return program;
+            }
+
+        }  // namespace operation
+    }      // namespace opencl
+}  // namespace engine
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_OPENCL_OPERATION_MAKE_PROGRAM_HPP
@@ -28,17 +28,21 @@ namespace engine {
             /**
              * @brief Make an OpenCL command queue
              *
-             * @param context the context to make the queue for
-             * @param device  the device to make the queue for
+             * @param context   the context to make the queue for
+             * @param device    the device to make the queue for
+             * @param profiling if the device should record when each command in the queue starts and ends
              *
              * @return a reference counted tracker of a command queue
              */
-            inline cl::command_queue make_queue(cl_context context, cl_device_id device) {
+            inline cl::command_queue make_queue(cl_context context, cl_device_id device, const bool& profiling = false) {
                 cl_command_queue queue = nullptr;
                 cl_int error           = 0;
+
                 // Use out of order execution if we can
-                queue = ::clCreateCommandQueue(context, device, CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE, &error);
-                if (error == CL_INVALID_VALUE) { queue = ::clCreateCommandQueue(context, device, 0, &error); }
+                const cl_command_queue_properties properties = profiling ? CL_QUEUE_PROFILING_ENABLE : 0;
+                queue = ::clCreateCommandQueue(
+                  context, device, properties | CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE, &error);
+                if (error == CL_INVALID_VALUE) { queue = ::clCreateCommandQueue(context, device, properties, &error); }
                 throw_cl_error(error, "Error creating the OpenCL command queue");
                 return cl::command_queue(queue, ::clReleaseCommandQueue);
             }
@@ -21,14 +21,21 @@
 // If OpenCL is disabled then don't provide this file
 #if !defined(VISUALMESH_DISABLE_VULKAN)
 
+#include <deque>
+#include <exception>
 #include <fstream>
 #include <iomanip>
+#include <memory>
+#include <mutex>
 #include <numeric>
 #include <spirv/unified1/spirv.hpp11>
 #include <sstream>
+#include <stdexcept>
 #include <tuple>
 #include <type_traits>
+#include <vector>
 
+#include "visualmesh/compiled_network.hpp"
 #include "visualmesh/engine/vulkan/kernels/load_image.hpp"
 #include "visualmesh/engine/vulkan/kernels/make_network.hpp"
 #include "visualmesh/engine/vulkan/kernels/reprojection.hpp"
@@ -37,13 +44,20 @@
 #include "visualmesh/engine/vulkan/operation/create_descriptor_set.hpp"
 #include "visualmesh/engine/vulkan/operation/create_device.hpp"
 #include "visualmesh/engine/vulkan/operation/create_image.hpp"
+#include "visualmesh/engine/vulkan/operation/fence_reactor.hpp"
+#include "visualmesh/engine/vulkan/operation/pipeline_cache.hpp"
 #include "visualmesh/engine/vulkan/operation/vulkan_error_category.hpp"
 #include "visualmesh/engine/vulkan/operation/wrapper.hpp"
+#include "visualmesh/instrumentation.hpp"
 #include "visualmesh/mesh.hpp"
-#include "visualmesh/network_structure.hpp"
 #include "visualmesh/projected_mesh.hpp"
+#include "visualmesh/quantisation.hpp"
+#include "visualmesh/utility/buffer_capacity.hpp"
+#include "visualmesh/utility/fourcc.hpp"
 #include "visualmesh/utility/math.hpp"
 #include "visualmesh/utility/projection.hpp"
+#include "visualmesh/utility/range_lookup.hpp"
+#include "visualmesh/utility/residency_cache.hpp"
 #include "visualmesh/utility/static_if.hpp"
 #include "visualmesh/visualmesh.hpp"
 
@@ -58,6 +72,8 @@ namespace engine {
          *  The Vulkan implementation is designed to be used for high performance inference. It is able to take
          * advantage of either GPUs from Intel, AMD, ARM, NVIDIA etc as well as multithreaded CPU implementations. This
          * allows it to be very flexible with its deployment on devices.
+         *  The engine can be shared between threads, however the reprojection resources are reused between calls so
+         *  calls from several threads take turns.
          *
          * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
          */
@@ -67,9 +83,44 @@ namespace engine {
             /**
              * @brief Construct a new Vulkan Engine object
              *
-             * @param structure the network structure to use classification
+             * @param network the network to use for classification, a NetworkStructure is compiled implicitly
              */
-            Engine(const NetworkStructure<Scalar>& structure = {}) : max_width(4) {
+            Engine(const CompiledNetwork<Scalar>& network = {}) : Engine(network, Build{}) {}
+
+            /**
+             * @brief Construct a new Vulkan Engine object that executes an 8 bit quantised network
+             *
+             * @param network the quantised network to use for classification
+             */
+            explicit Engine(const QuantisedNetwork<Scalar>& network) : Engine(network, Build{}) {}
+
+        private:
+            /// Tag used to select the constructor that does the work for both network types
+            struct Build {};
+
+            /// A classification from classify_async that is waiting for the device. Its functions other than resume are
+            /// called with the mutex held
+            struct PendingClassification {
+                virtual ~PendingClassification() = default;
+                /// Submit the classification to the device, signalling network_fence when it is done
+                virtual void submit() = 0;
+                /// Read the results once network_fence has been signalled
+                virtual void read() = 0;
+                /// Resume the coroutine that is waiting for the classification
+                virtual void resume() = 0;
+                /// The error that stopped the classification, rethrown in the coroutine
+                std::exception_ptr error;
+            };
+
+            /**
+             * @brief Construct a new Vulkan Engine object from either a compiled or a quantised network
+             *
+             * @tparam Network the type of network, either a CompiledNetwork or a QuantisedNetwork
+             *
+             * @param network the network to use for classification
+             */
+            template <typename Network>
+            Engine(const Network& network, Build /*tag*/) : max_width(4) {
                 // Get a Vulkan instance
                 const VkApplicationInfo app_info = {
                   VK_STRUCTURE_TYPE_APPLICATION_INFO, 0, "VisualMesh", 0, "", 0, VK_MAKE_VERSION(1, 1, 0)};
@@ -97,13 +148,29 @@ namespace engine {
                       operation::create_command_pool(context, context.transfer_queue_family);
                 }
 
+                // The generated SPIR-V and the compiled pipelines are reused from disk when the same device, driver
+                // and network have been seen before. The fixed programs only depend on the scalar type and debug flag
+                operation::PipelineCache pipeline_cache(context);
+                uint64_t program_key = 0xcbf29ce484222325;
+                const std::array<uint32_t, 2> program_config{{uint32_t(sizeof(Scalar)), uint32_t(debug)}};
+                operation::PipelineCache::add_hash(program_key, program_config.data(), sizeof(program_config));
+
                 // Created the projection kernel sources and programs
                 std::vector<uint32_t> equidistant_reprojection_source =
-                  kernels::build_reprojection<Scalar>("project_equidistant", kernels::equidistant_reprojection<Scalar>);
+                  pipeline_cache.module("project_equidistant", program_key, [] {
+                      return kernels::build_reprojection<Scalar>("project_equidistant",
+                                                                 kernels::equidistant_reprojection<Scalar>);
+                  });
                 std::vector<uint32_t> equisolid_reprojection_source =
-                  kernels::build_reprojection<Scalar>("project_equisolid", kernels::equisolid_reprojection<Scalar>);
+                  pipeline_cache.module("project_equisolid", program_key, [] {
+                      return kernels::build_reprojection<Scalar>("project_equisolid",
+                                                                 kernels::equisolid_reprojection<Scalar>);
+                  });
                 std::vector<uint32_t> rectilinear_reprojection_source =
-                  kernels::build_reprojection<Scalar>("project_rectilinear", kernels::rectilinear_reprojection<Scalar>);
+                  pipeline_cache.module("project_rectilinear", program_key, [] {
+                      return kernels::build_reprojection<Scalar>("project_rectilinear",
+                                                                 kernels::rectilinear_reprojection<Scalar>);
+                  });
 
                 if (debug) {
                     std::ofstream ofs;
@@ -220,8 +287,12 @@ namespace engine {
                   reprojection_pipeline_layout,
                   0,
                   0};
-                throw_vk_error(vkCreateComputePipelines(
-                                 context.device, 0, 1, &equidistant_pipeline_create_info, 0, &project_equidistant),
+                throw_vk_error(vkCreateComputePipelines(context.device,
+                                                        pipeline_cache,
+                                                        1,
+                                                        &equidistant_pipeline_create_info,
+                                                        0,
+                                                        &project_equidistant),
                                "Failed to create equidistant reprojection pipeline");
 
                 VkComputePipelineCreateInfo equisolid_pipeline_create_info = {
@@ -238,8 +309,12 @@ namespace engine {
                   reprojection_pipeline_layout,
                   0,
                   0};
-                throw_vk_error(vkCreateComputePipelines(
-                                 context.device, 0, 1, &equisolid_pipeline_create_info, 0, &project_equisolid),
+                throw_vk_error(vkCreateComputePipelines(context.device,
+                                                        pipeline_cache,
+                                                        1,
+                                                        &equisolid_pipeline_create_info,
+                                                        0,
+                                                        &project_equisolid),
                                "Failed to create equisolid reprojection pipeline");
 
                 VkComputePipelineCreateInfo rectilinear_pipeline_create_info = {
@@ -256,8 +331,12 @@ namespace engine {
                   reprojection_pipeline_layout,
                   0,
                   0};
-                throw_vk_error(vkCreateComputePipelines(
-                                 context.device, 0, 1, &rectilinear_pipeline_create_info, 0, &project_rectilinear),
+                throw_vk_error(vkCreateComputePipelines(context.device,
+                                                        pipeline_cache,
+                                                        1,
+                                                        &rectilinear_pipeline_create_info,
+                                                        0,
+                                                        &project_rectilinear),
                                "Failed to create rectilinear reprojection pipeline");
 
                 // ******************
@@ -266,15 +345,25 @@ namespace engine {
 
                 // Created the load_image kernel source and program
                 std::vector<uint32_t> load_GRBG_image_source =
-                  kernels::load_image<Scalar, debug>(kernels::load_GRBG_image<Scalar>);
+                  pipeline_cache.module("load_GRBG_image", program_key, [] {
+                      return kernels::load_image<Scalar, debug>(kernels::load_GRBG_image<Scalar>);
+                  });
                 std::vector<uint32_t> load_RGGB_image_source =
-                  kernels::load_image<Scalar, debug>(kernels::load_RGGB_image<Scalar>);
+                  pipeline_cache.module("load_RGGB_image", program_key, [] {
+                      return kernels::load_image<Scalar, debug>(kernels::load_RGGB_image<Scalar>);
+                  });
                 std::vector<uint32_t> load_GBRG_image_source =
-                  kernels::load_image<Scalar, debug>(kernels::load_GBRG_image<Scalar>);
+                  pipeline_cache.module("load_GBRG_image", program_key, [] {
+                      return kernels::load_image<Scalar, debug>(kernels::load_GBRG_image<Scalar>);
+                  });
                 std::vector<uint32_t> load_BGGR_image_source =
-                  kernels::load_image<Scalar, debug>(kernels::load_BGGR_image<Scalar>);
+                  pipeline_cache.module("load_BGGR_image", program_key, [] {
+                      return kernels::load_image<Scalar, debug>(kernels::load_BGGR_image<Scalar>);
+                  });
                 std::vector<uint32_t> load_RGBA_image_source =
-                  kernels::load_image<Scalar, debug>(kernels::load_RGBA_image<Scalar>);
+                  pipeline_cache.module("load_RGBA_image", program_key, [] {
+                      return kernels::load_image<Scalar, debug>(kernels::load_RGBA_image<Scalar>);
+                  });
                 if (debug) {
                     std::ofstream ofs;
                     ofs.open("load_GRBG_image.spv", std::ios::binary | std::ios::out);
@@ -452,7 +541,12 @@ namespace engine {
                   0,
                   0};
                 throw_vk_error(
-                  vkCreateComputePipelines(context.device, 0, 1, &load_GRBG_image_pipeline_info, 0, &load_GRBG_image),
+                  vkCreateComputePipelines(context.device,
+                                           pipeline_cache,
+                                           1,
+                                           &load_GRBG_image_pipeline_info,
+                                           0,
+                                           &load_GRBG_image),
                   "Failed to create load_GRBG_image pipeline");
 
                 VkComputePipelineCreateInfo load_RGGB_image_pipeline_info = {
@@ -470,7 +564,12 @@ namespace engine {
                   0,
                   0};
                 throw_vk_error(
-                  vkCreateComputePipelines(context.device, 0, 1, &load_RGGB_image_pipeline_info, 0, &load_RGGB_image),
+                  vkCreateComputePipelines(context.device,
+                                           pipeline_cache,
+                                           1,
+                                           &load_RGGB_image_pipeline_info,
+                                           0,
+                                           &load_RGGB_image),
                   "Failed to create load_RGGB_image pipeline");
 
                 VkComputePipelineCreateInfo load_GBRG_image_pipeline_info = {
@@ -488,7 +587,12 @@ namespace engine {
                   0,
                   0};
                 throw_vk_error(
-                  vkCreateComputePipelines(context.device, 0, 1, &load_GBRG_image_pipeline_info, 0, &load_GBRG_image),
+                  vkCreateComputePipelines(context.device,
+                                           pipeline_cache,
+                                           1,
+                                           &load_GBRG_image_pipeline_info,
+                                           0,
+                                           &load_GBRG_image),
                   "Failed to create load_GBRG_image pipeline");
 
                 VkComputePipelineCreateInfo load_BGGR_image_pipeline_info = {
@@ -506,7 +610,12 @@ namespace engine {
                   0,
                   0};
                 throw_vk_error(
-                  vkCreateComputePipelines(context.device, 0, 1, &load_BGGR_image_pipeline_info, 0, &load_BGGR_image),
+                  vkCreateComputePipelines(context.device,
+                                           pipeline_cache,
+                                           1,
+                                           &load_BGGR_image_pipeline_info,
+                                           0,
+                                           &load_BGGR_image),
                   "Failed to create load_BGGR_image pipeline");
 
                 VkComputePipelineCreateInfo load_RGBA_image_pipeline_info = {
@@ -524,9 +633,71 @@ namespace engine {
                   0,
                   0};
                 throw_vk_error(
-                  vkCreateComputePipelines(context.device, 0, 1, &load_RGBA_image_pipeline_info, 0, &load_RGBA_image),
+                  vkCreateComputePipelines(context.device,
+                                           pipeline_cache,
+                                           1,
+                                           &load_RGBA_image_pipeline_info,
+                                           0,
+                                           &load_RGBA_image),
                   "Failed to create load_RGBA_image pipeline");
 
+                // The YUV formats are built from the same shader with different layouts, indexed as in
+                // get_image_pipeline
+                const std::array<const char*, 3> yuv_names = {
+                  {"load_NV12_image", "load_YUYV_image", "load_UYVY_image"}};
+                const std::array<std::vector<uint32_t>, 3> load_yuv_image_source = {{
+                  pipeline_cache.module("load_NV12_image",
+                                        program_key,
+                                        [] {
+                                            return kernels::load_image<Scalar, debug>(kernels::load_NV12_image<Scalar>);
+                                        }),
+                  pipeline_cache.module("load_YUYV_image",
+                                        program_key,
+                                        [] {
+                                            return kernels::load_image<Scalar, debug>(kernels::load_YUYV_image<Scalar>);
+                                        }),
+                  pipeline_cache.module("load_UYVY_image",
+                                        program_key,
+                                        [] {
+                                            return kernels::load_image<Scalar, debug>(kernels::load_UYVY_image<Scalar>);
+                                        }),
+                }};
+                for (size_t i = 0; i < yuv_names.size(); ++i) {
+                    const std::vector<uint32_t>& source = load_yuv_image_source[i];
+                    if (debug) {
+                        std::ofstream ofs(std::string(yuv_names[i]) + ".spv", std::ios::binary | std::ios::out);
+                        ofs.write(reinterpret_cast<const char*>(source.data()), source.size() * sizeof(uint32_t));
+                    }
+                    VkShaderModuleCreateInfo info = {VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+                                                     0,
+                                                     0,
+                                                     static_cast<uint32_t>(source.size()) * sizeof(uint32_t),
+                                                     source.data()};
+                    VkShaderModule shader;
+                    throw_vk_error(vkCreateShaderModule(context.device, &info, nullptr, &shader),
+                                   "Failed to create load_image shader module");
+                    load_yuv_image_program[i] = vk::shader_module(
+                      shader, [this](auto p) { vkDestroyShaderModule(context.device, p, nullptr); });
+
+                    VkComputePipelineCreateInfo pipeline_info = {
+                      VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+                      nullptr,
+                      0,
+                      {VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                       nullptr,
+                       0,
+                       VK_SHADER_STAGE_COMPUTE_BIT,
+                       load_yuv_image_program[i],
+                       yuv_names[i],
+                       0},
+                      load_image_pipeline_layout,
+                      0,
+                      0};
+                    throw_vk_error(vkCreateComputePipelines(
+                                     context.device, pipeline_cache, 1, &pipeline_info, 0, &load_yuv_image[i]),
+                                   std::string("Failed to create ") + yuv_names[i] + " pipeline");
+                }
+
                 // ***************
                 // *** Network ***
                 // ***************
@@ -557,8 +728,17 @@ namespace engine {
                   vkCreatePipelineLayout(context.device, &conv_pipeline_layout_info, 0, &conv_pipeline_layout),
                   "Failed to create conv pipeline layout");
 
-                std::vector<std::pair<uint32_t, std::vector<uint32_t>>> conv_sources =
-                  kernels::make_network<Scalar, debug>(structure);
+                // The network programs are keyed by everything in the network as well
+                std::stringstream network_bytes;
+                BinaryWriter network_writer(network_bytes);
+                network.save(network_writer);
+                const std::string network_data = network_bytes.str();
+                uint64_t network_key           = program_key;
+                operation::PipelineCache::add_hash(network_key, network_data.data(), network_data.size());
+                const bool quantised     = !std::is_same<Network, CompiledNetwork<Scalar>>::value;
+                const char* network_name = quantised ? "quantised" : "network";
+                std::vector<std::pair<uint32_t, std::vector<uint32_t>>> conv_sources = pipeline_cache.modules(
+                  network_name, network_key, [&] { return kernels::make_network<Scalar, debug>(network); });
                 for (const auto& conv_source : conv_sources) {
                     std::string kernel = "conv" + std::to_string(conv_source.first);
                     if (debug) {
@@ -596,19 +776,65 @@ namespace engine {
                       0,
                       0};
                     VkPipeline pipeline;
-                    throw_vk_error(vkCreateComputePipelines(context.device, 0, 1, &conv_pipeline_info, 0, &pipeline),
+                    throw_vk_error(vkCreateComputePipelines(context.device,
+                                                            pipeline_cache,
+                                                            1,
+                                                            &conv_pipeline_info,
+                                                            0,
+                                                            &pipeline),
                                    "Failed to create conv pipeline");
-                    conv_layers.emplace_back(pipeline, structure[conv_source.first].back().biases.size());
+                    conv_layers.emplace_back(pipeline, network.back(conv_source.first).output_dimensions);
                 }
 
+                // Every pipeline has been made so store what the driver compiled for the next engine
+                pipeline_cache.save();
+
                 // Work out what the widest network layer is
                 max_width = 4;
                 for (const auto& k : conv_layers) {
                     max_width = std::max(max_width, k.second);
                 }
+
+                // Create the command buffers and synchronisation objects once, they are re-recorded and reused for
+                // every call since the mutex ensures only one call is using them at a time
+                reprojection_command_buffer =
+                  operation::create_command_buffer(context, context.compute_command_pool, true);
+                network_command_buffer = operation::create_command_buffer(context, context.compute_command_pool, true);
+                reprojection_semaphore = operation::create_semaphore(context);
+                reprojection_fence     = operation::create_fence(context);
+                network_fence          = operation::create_fence(context);
+
+                // The load image and conv descriptor sets only need their bindings rewritten each call
+                // Descriptor Set 0: {image+sampler, coordinates, network}
+                load_image_descriptor_pool = operation::create_descriptor_pool(
+                  context,
+                  {VkDescriptorPoolSize{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1},
+                   VkDescriptorPoolSize{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2}});
+                load_image_descriptor_set =
+                  operation::create_descriptor_set(context, load_image_descriptor_pool, {load_image_descriptor_layout})
+                    .back();
+
+                // Descriptor Set 0: {neighbourhood_ptr, input_ptr, output_ptr}
+                conv_descriptor_pool = operation::create_descriptor_pool(
+                  context, {VkDescriptorPoolSize{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3}}, conv_layers.size());
+                conv_descriptor_sets = operation::create_descriptor_set(
+                  context,
+                  conv_descriptor_pool,
+                  std::vector<VkDescriptorSetLayout>(conv_layers.size(), conv_descriptor_layout));
             }
 
+        public:
             ~Engine() {
+                // Stop calling back before finishing what classify_async has queued, failing anything not started
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    stopping = true;
+                }
+                reactor.reset();
+                {
+                    Lock lock(*this);
+                }
+
                 vkDestroyDescriptorSetLayout(context.device, reprojection_descriptor_layout, nullptr);
                 vkDestroyPipelineLayout(context.device, reprojection_pipeline_layout, nullptr);
                 vkDestroyPipeline(context.device, project_equidistant, nullptr);
@@ -620,6 +846,9 @@ namespace engine {
                 vkDestroyPipeline(context.device, load_GBRG_image, nullptr);
                 vkDestroyPipeline(context.device, load_BGGR_image, nullptr);
                 vkDestroyPipeline(context.device, load_RGBA_image, nullptr);
+                for (const auto& pipeline : load_yuv_image) {
+                    vkDestroyPipeline(context.device, pipeline, nullptr);
+                }
                 vkDestroyDescriptorSetLayout(context.device, load_image_descriptor_layout, nullptr);
 
                 vkDestroyDescriptorSetLayout(context.device, conv_descriptor_layout, nullptr);
@@ -645,34 +874,30 @@ namespace engine {
                                                                                  const mat4<Scalar>& Hoc,
                                                                                  const Lens<Scalar>& lens) const {
                 static constexpr int N_NEIGHBOURS = Model<Scalar>::N_NEIGHBOURS;
+                Lock lock(*this);
+                FrameRecorder recorder(instrumentation.get());
 
                 std::vector<std::array<int, N_NEIGHBOURS>> neighbourhood;
                 std::vector<int> indices;
                 std::pair<vk::buffer, vk::device_memory> vk_pixels;
                 vk::fence fence;
 
-                std::tie(neighbourhood, indices, vk_pixels, fence) = do_project<Model, vk::fence>(mesh, Hoc, lens);
+                std::tie(neighbourhood, indices, vk_pixels, fence) =
+                  do_project<Model, vk::fence>(mesh, Hoc, lens, recorder);
 
-                // Wait 10,000 * 1,000 nanoseconds = 10,000 * 1us = 10ms
-                VkResult res;
-                VkFence vk_fence = fence;
-                for (uint32_t timeout_count = 0; timeout_count < 10000; ++timeout_count) {
-                    res = vkWaitForFences(context.device, 1, &vk_fence, VK_TRUE, static_cast<uint64_t>(1e3));
-                    if (res == VK_SUCCESS) { break; }
-                    else if (res == VK_ERROR_DEVICE_LOST) {
-                        throw_vk_error(VK_ERROR_DEVICE_LOST, "Lost device while waiting for reprojection to complete");
-                    }
-                }
-                if (res != VK_SUCCESS) { throw_vk_error(res, "Timed out waiting for reprojection to complete"); }
+                // Block until the reprojection has finished
+                operation::wait_for_fence(context, fence, "Failed waiting for reprojection to complete");
 
                 // Read the pixels off the buffer
+                FrameRecorder::Scope readback(recorder, Stage::READBACK);
                 std::vector<vec2<Scalar>> pixels(indices.size());
                 operation::map_memory<void>(context, 0, VK_WHOLE_SIZE, vk_pixels.second, [&pixels](void* payload) {
                     std::memcpy(pixels.data(), payload, pixels.size() * sizeof(vec2<Scalar>));
                 });
+                readback.stop();
+                recorder.report();
 
-                // Perform cleanup
-                reprojection_command_buffer.reset();
+                // Perform cleanup, the command buffer is kept to be re-recorded next call
                 reprojection_descriptor_pool.reset();
                 reprojection_buffers.clear();
 
@@ -717,30 +942,602 @@ namespace engine {
                                                                            const Lens<Scalar>& lens,
                                                                            const void* image,
                                                                            const uint32_t& format) const {
-                static constexpr int N_NEIGHBOURS = Model<Scalar>::N_NEIGHBOURS;
+                ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> output;
+                operator()(mesh, Hoc, lens, image, format, output);
+                return output;
+            }
+
+            /**
+             * @brief Project and classify a mesh into a classified mesh owned by the caller, reusing its memory
+             *
+             * @details
+             *  The pixel coordinates and classifications are copied out of the mapped device memory straight into the
+             *  output's vectors, which keep their capacity, so passing the same output every frame avoids allocating
+             *  them again.
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh    the mesh table that we are projecting to pixel coordinates
+             * @param Hoc     the homogenous transformation matrix from the camera to the observation plane
+             * @param lens    the lens parameters that describe the optics of the camera
+             * @param image   the data that represents the image the network will run from
+             * @param format  the pixel format of this image as a fourcc code
+             * @param output  the classified mesh to write the result into
+             */
+            template <template <typename> class Model>
+            void operator()(const Mesh<Scalar, Model>& mesh,
+                            const mat4<Scalar>& Hoc,
+                            const Lens<Scalar>& lens,
+                            const void* image,
+                            const uint32_t& format,
+                            ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS>& output) const {
+                Lock lock(*this);
+                FrameRecorder recorder(instrumentation.get());
+                const ClassificationBuffers buffers =
+                  submit_classification(mesh, Hoc, lens, image, format, output, recorder);
+
+                // ***************************
+                // *** WAIT FOR COMPLETION ***
+                // ***************************
+
+                operation::wait_for_fence(context, network_fence, "Failed waiting for network to complete");
+                read_classification(buffers, output, recorder);
+            }
+
+            /**
+             * @brief Project and classify a mesh using the neural network that is loaded into this engine.
+             * This version takes an aggregate VisualMesh object
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh    the mesh table that we are projecting to pixel coordinates
+             * @param Hoc     the homogenous transformation matrix from the camera to the observation plane
+             * @param lens    the lens parameters that describe the optics of the camera
+             * @param image   the data that represents the image the network will run from
+             * @param format  the pixel format of this image as a fourcc code
+             *
+             * @return a classified mesh for the provided arguments
+             */
+            template <template <typename> class Model>
+            ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> operator()(const VisualMesh<Scalar, Model>& mesh,
+                                                                           const mat4<Scalar>& Hoc,
+                                                                           const Lens<Scalar>& lens,
+                                                                           const void* image,
+                                                                           const uint32_t& format) const {
+                return operator()(mesh.height(Hoc[2][3]), Hoc, lens, image, format);
+            }
+
+            /**
+             * @brief An awaitable classification from classify_async
+             *
+             * @details
+             *  Awaiting it queues the classification on the engine and suspends the coroutine without blocking a
+             *  thread. The engine runs one classification on the device at a time, and the coroutine is resumed on
+             *  the engine's fence reactor thread once its results have been read, so it should hand off to its own
+             *  executor before doing much work. It is not a coroutine type itself, so it works with any coroutine
+             *  handle that has from_address.
+             *
+             * @tparam Model the mesh model that is being classified
+             */
+            template <template <typename> class Model>
+            class Classification : private PendingClassification {
+            public:
+                Classification(const Engine& engine,
+                               const Mesh<Scalar, Model>& mesh,
+                               const mat4<Scalar>& Hoc,
+                               const Lens<Scalar>& lens,
+                               const void* image,
+                               const uint32_t& format,
+                               ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS>&& storage)
+                  : engine(&engine)
+                  , mesh(&mesh)
+                  , Hoc(Hoc)
+                  , lens(lens)
+                  , image(image)
+                  , format(format)
+                  , output(std::move(storage))
+                  , recorder(engine.instrumentation.get()) {}
+
+                bool await_ready() const noexcept {
+                    return false;
+                }
+
+                template <typename Handle>
+                void await_suspend(Handle handle) {
+                    continuation = handle.address();
+                    resumer      = [](void* address) { Handle::from_address(address).resume(); };
+                    // Once queued this may be resumed on another thread at any time, so nothing is touched after
+                    engine->enqueue(this);
+                }
+
+                ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> await_resume() {
+                    if (error) { std::rethrow_exception(error); }
+                    return std::move(output);
+                }
+
+            private:
+                void submit() override {
+                    buffers = engine->submit_classification(*mesh, Hoc, lens, image, format, output, recorder);
+                }
+
+                void read() override {
+                    engine->read_classification(buffers, output, recorder);
+                    buffers = ClassificationBuffers();
+                }
+
+                void resume() override {
+                    resumer(continuation);
+                }
 
-                std::vector<std::pair<vk::semaphore, VkPipelineStageFlags>> wait_semaphores;
+                /// The engine that runs the classification
+                const Engine* engine;
+                /// The mesh to classify, which must outlive the classification
+                const Mesh<Scalar, Model>* mesh;
+                /// The homogenous transformation matrix from the camera to the observation plane
+                mat4<Scalar> Hoc;
+                /// The lens parameters that describe the optics of the camera
+                Lens<Scalar> lens;
+                /// The image to classify, which must stay valid until the classification has finished
+                const void* image;
+                /// The pixel format of the image as a fourcc code
+                uint32_t format;
+                /// The classified mesh the results are read into
+                ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> output;
+                /// The recorder of the frame
+                FrameRecorder recorder;
+                /// The buffers the device is using while the classification runs
+                ClassificationBuffers buffers;
+                /// The address of the suspended coroutine
+                void* continuation = nullptr;
+                /// Resumes the coroutine at an address using the coroutine handle type it was suspended with
+                void (*resumer)(void*) = nullptr;
+            };
+
+            /**
+             * @brief Project and classify a mesh, awaiting the result from a coroutine without blocking a thread
+             *
+             * @details
+             *  Nothing is run until the result is awaited, and each awaited classification waits its turn on the
+             *  device without a thread, so any number of them can be outstanding. The mesh and the image must stay
+             *  valid until the await has finished.
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh    the mesh table that we are projecting to pixel coordinates
+             * @param Hoc     the homogenous transformation matrix from the camera to the observation plane
+             * @param lens    the lens parameters that describe the optics of the camera
+             * @param image   the data that represents the image the network will run from
+             * @param format  the pixel format of this image as a fourcc code
+             * @param storage a classified mesh whose memory is reused for the result
+             *
+             * @return an awaitable that gives the classified mesh for the provided arguments
+             */
+            template <template <typename> class Model>
+            Classification<Model> classify_async(
+              const Mesh<Scalar, Model>& mesh,
+              const mat4<Scalar>& Hoc,
+              const Lens<Scalar>& lens,
+              const void* image,
+              const uint32_t& format,
+              ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS>&& storage = {}) const {
+                return Classification<Model>(*this, mesh, Hoc, lens, image, format, std::move(storage));
+            }
+
+            /**
+             * @brief Project and classify the closest mesh of an aggregate VisualMesh object, awaiting the result from
+             * a coroutine without blocking a thread
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh    the mesh table that we are projecting to pixel coordinates
+             * @param Hoc     the homogenous transformation matrix from the camera to the observation plane
+             * @param lens    the lens parameters that describe the optics of the camera
+             * @param image   the data that represents the image the network will run from
+             * @param format  the pixel format of this image as a fourcc code
+             *
+             * @return an awaitable that gives the classified mesh for the provided arguments
+             */
+            template <template <typename> class Model>
+            Classification<Model> classify_async(const VisualMesh<Scalar, Model>& mesh,
+                                                 const mat4<Scalar>& Hoc,
+                                                 const Lens<Scalar>& lens,
+                                                 const void* image,
+                                                 const uint32_t& format) const {
+                return classify_async(mesh.height(Hoc[2][3]), Hoc, lens, image, format);
+            }
+
+            /**
+             * @brief Import a camera frame buffer that was exported as a DMA-BUF so frames in it are sampled by the
+             * device without being copied
+             *
+             * @details
+             *  This suits the ring of buffers a V4L2 camera or ISP writes its frames to, each of them is imported once
+             *  and then passing the address the buffer is mapped at to the engine reads the frame directly. For Bayer
+             *  formats this means the raw frame is only ever touched by the demosaic in the load image shader. The
+             *  buffer must hold an image of the same dimensions and format each time, with rows at the pitch the device
+             *  uses for a linear image. The image is acquired from the foreign queue family for each frame and released
+             *  back once it has been sampled. This needs the VK_KHR_external_memory_fd, VK_EXT_external_memory_dma_buf
+             *  and VK_EXT_queue_family_foreign device extensions.
+             *
+             * @param image      the address the buffer is mapped at on the host, used to recognise frames from it
+             * @param fd         the DMA-BUF file descriptor of the buffer, which is duplicated rather than taken
+             * @param dimensions the dimensions of the images in the buffer
+             * @param format     the pixel format of the images in the buffer as a fourcc code
+             * @param row_pitch  the number of bytes between the start of each row in the buffer
+             */
+            void import_image(const void* image,
+                              const int& fd,
+                              const vec2<int>& dimensions,
+                              const uint32_t& format,
+                              const size_t& row_pitch) {
+                Lock lock(*this);
+                const vec2<int> extent = image_extent(dimensions, format);
+                VkExtent3D vk_extent   = {static_cast<uint32_t>(extent[0]), static_cast<uint32_t>(extent[1]), 1};
+                imported_images[image] = ImportedImage{
+                  operation::import_image(context, vk_extent, get_image_format(format), fd, row_pitch),
+                  dimensions,
+                  format};
+            }
+
+            /**
+             * @brief Release a frame buffer that was imported, so passing it copies the frame again
+             *
+             * @param image the address the buffer is mapped at on the host
+             */
+            void release_image(const void* image) {
+                Lock lock(*this);
+                imported_images.erase(image);
+            }
+
+            /**
+             * @brief Get the most points on the screen that a single call has needed device buffers for
+             *
+             * @return the high water mark of the number of points on the screen
+             */
+            int high_water_mark() const {
+                return points_high_water.get();
+            }
+
+            /**
+             * @brief Allocate the per point buffers for this many points so that later calls don't allocate them
+             *
+             * @param n_points     the number of points on the screen to allocate for, such as a high_water_mark
+             * @param n_neighbours the number of neighbours of each point in the mesh model that will be used
+             */
+            void reserve(const int& n_points, const int& n_neighbours) {
+                Lock lock(*this);
+                // Leave room for the offscreen point
+                const int n = n_points + 1;
+                get_indices_memory(n);
+                get_pixel_memory(n);
+                get_neighbourhood_memory(n * n_neighbours);
+                get_network_memory(int(max_width) * n);
+            }
+
+            /**
+             * @brief Report the time spent in each stage of every frame
+             *
+             * @details
+             *  The lookup, graph building, uploads and readbacks are timed on the host, and the image load and each
+             *  conv layer are timed on the device with timestamp queries.
+             *
+             * @param instrumentation where to report every frame, or nullptr to stop timing
+             */
+            void instrument(std::shared_ptr<Instrumentation> instrumentation) {
+                Lock lock(*this);
+
+                if (instrumentation != nullptr && !timestamps) {
+                    // The compute queue must be able to write timestamps for the device stages to be timed
+                    uint32_t n_families = 0;
+                    vkGetPhysicalDeviceQueueFamilyProperties(context.phys_device, &n_families, nullptr);
+                    std::vector<VkQueueFamilyProperties> families(n_families);
+                    vkGetPhysicalDeviceQueueFamilyProperties(context.phys_device, &n_families, families.data());
+                    const uint32_t valid_bits = families[context.compute_queue_family].timestampValidBits;
+                    if (valid_bits == 0) {
+                        throw std::runtime_error("The compute queue of this device does not support timestamps");
+                    }
+                    timestamp_mask = valid_bits >= 64 ? ~uint64_t(0) : (uint64_t(1) << valid_bits) - 1;
+
+                    VkPhysicalDeviceProperties properties;
+                    vkGetPhysicalDeviceProperties(context.phys_device, &properties);
+                    timestamp_period = properties.limits.timestampPeriod;
+
+                    VkQueryPoolCreateInfo pool_info = {VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+                                                       nullptr,
+                                                       0,
+                                                       VK_QUERY_TYPE_TIMESTAMP,
+                                                       static_cast<uint32_t>(conv_layers.size() + 2),
+                                                       0};
+                    VkQueryPool pool;
+                    throw_vk_error(vkCreateQueryPool(context.device, &pool_info, nullptr, &pool),
+                                   "Failed to create timestamp query pool");
+                    timestamps =
+                      vk::query_pool(pool, [this](auto p) { vkDestroyQueryPool(context.device, p, nullptr); });
+                }
+
+                this->instrumentation = std::move(instrumentation);
+            }
+
+            /// @return where every frame is reported, or nullptr if the engine isn't being timed
+            std::shared_ptr<Instrumentation> instrument() const {
+                std::lock_guard<std::mutex> lock(mutex);
+                return instrumentation;
+            }
+
+            /**
+             * @brief Set how much device memory the meshes kept on the device may use
+             *
+             * @details
+             *  Once the meshes use more than this the least recently used ones are dropped, and are uploaded again if
+             *  they are used later. The mesh used most recently is always kept. By default there is no limit.
+             *
+             * @param bytes the memory budget for the meshes in bytes
+             */
+            void device_budget(const std::size_t& bytes) {
+                Lock lock(*this);
+                device_points_cache.budget(bytes);
+            }
+
+            /// @return how much device memory the meshes kept on the device are using
+            std::size_t device_bytes() const {
+                std::lock_guard<std::mutex> lock(mutex);
+                return device_points_cache.bytes();
+            }
+
+            /**
+             * @brief Upload a mesh to the device ahead of the frame that will use it
+             *
+             * @details
+             *  This can be called from another thread, such as from the prefetch callback of a LazyVisualMesh. As the
+             *  engine runs one call at a time it waits for any frame that is running.
+             *
+             * @tparam Model the mesh model of the mesh
+             *
+             * @param mesh the mesh to upload
+             */
+            template <template <typename> class Model>
+            void preload(const Mesh<Scalar, Model>& mesh) const {
+                Lock lock(*this);
+                get_device_points(mesh);
+            }
+
+            /**
+             * @brief Drop the device copy of a mesh, such as when a LazyVisualMesh evicts it
+             *
+             * @tparam Model the mesh model of the mesh
+             *
+             * @param mesh the mesh to drop
+             */
+            template <template <typename> class Model>
+            void evict(const Mesh<Scalar, Model>& mesh) const {
+                Lock lock(*this);
+                device_points_cache.erase(mesh.id());
+            }
+
+            void clear_cache() {
+                Lock lock(*this);
+                device_points_cache.clear();
+                image_memory.memory           = std::make_pair(nullptr, nullptr);
+                image_memory.dimensions       = {0, 0};
+                image_memory.format           = VK_FORMAT_UNDEFINED;
+                neighbourhood_memory.memory   = std::make_pair(nullptr, nullptr);
+                neighbourhood_memory.max_size = 0;
+                network_memory.memory         = {std::make_pair(nullptr, nullptr), std::make_pair(nullptr, nullptr)};
+                network_memory.max_size       = 0;
+                indices_memory.max_size       = 0;
+                indices_memory.memory         = std::make_pair(nullptr, nullptr);
+                pixel_memory.max_size         = 0;
+                pixel_memory.memory           = std::make_pair(nullptr, nullptr);
+            }
+
+        private:
+            /**
+             * @brief Holds the mutex, first finishing the classification from classify_async that is on the device
+             *
+             * @details
+             *  When released it submits the next waiting classification and then, without the mutex, resumes the
+             *  coroutines whose classifications finished. Every call that uses the device or its buffers takes one.
+             */
+            class Lock {
+            public:
+                /**
+                 * @brief Take the mutex
+                 *
+                 * @param engine the engine to lock
+                 * @param finish whether to wait for the classification on the device, which is only left running when
+                 *               nothing on the device is being used
+                 */
+                explicit Lock(const Engine& engine, const bool& finish = true) : engine(engine), lock(engine.mutex) {
+                    if (finish) { engine.finish_in_flight(); }
+                }
+                Lock(const Lock&) = delete;
+                Lock(Lock&&)      = delete;
+                Lock& operator=(const Lock&) = delete;
+                Lock& operator=(Lock&&) = delete;
+
+                ~Lock() {
+                    engine.start_waiting();
+                    std::vector<PendingClassification*> finished;
+                    std::swap(finished, engine.finished);
+                    lock.unlock();
+                    for (auto& pending : finished) {
+                        pending->resume();
+                    }
+                }
+
+            private:
+                const Engine& engine;
+                std::unique_lock<std::mutex> lock;
+            };
+
+            /**
+             * @brief Queue a classification from classify_async, it is submitted as soon as the device is free
+             *
+             * @param pending the classification to queue
+             */
+            void enqueue(PendingClassification* pending) const {
+                // Releasing the lock submits it if the device is free, otherwise the reactor submits it when the
+                // classification on the device finishes
+                Lock lock(*this, false);
+                if (!reactor) { reactor = std::make_unique<operation::FenceReactor>(context.device); }
+                waiting.push_back(pending);
+            }
+
+            /**
+             * @brief Wait for the classification from classify_async that is on the device and read its results. Must
+             * be called with the mutex held.
+             */
+            void finish_in_flight() const {
+                if (in_flight == nullptr) { return; }
+                PendingClassification* pending = in_flight;
+                in_flight                       = nullptr;
+
+                // The reactor must be done with the fence before it is reset, it is gone if the engine is stopping
+                if (reactor) { reactor->forget(network_fence); }
+                try {
+                    operation::wait_for_fence(context, network_fence, "Failed waiting for network to complete");
+                    pending->read();
+                }
+                catch (...) {
+                    pending->error = std::current_exception();
+                }
+                finished.push_back(pending);
+            }
+
+            /**
+             * @brief Submit the next waiting classification from classify_async if the device is free. Must be called
+             * with the mutex held.
+             */
+            void start_waiting() const noexcept {
+                while (in_flight == nullptr && !waiting.empty()) {
+                    PendingClassification* pending = waiting.front();
+                    waiting.pop_front();
+                    try {
+                        if (stopping) { throw std::runtime_error("The engine was destroyed before classifying"); }
+                        pending->submit();
+                    }
+                    catch (...) {
+                        pending->error = std::current_exception();
+                        finished.push_back(pending);
+                        continue;
+                    }
+                    in_flight = pending;
+
+                    // If the reactor can't watch it the next lock taken finishes it instead
+                    try {
+                        reactor->watch(network_fence, [this] { Lock lock(*this); });
+                    }
+                    catch (...) {
+                    }
+                }
+            }
+
+            /**
+             * @brief Read the timestamps of the network from the last call and add them to the frame
+             *
+             * @param recorder the recorder of the frame whose network has just finished
+             */
+            void read_timestamps(FrameRecorder& recorder) const {
+                std::vector<uint64_t> ticks(conv_layers.size() + 2);
+                throw_vk_error(vkGetQueryPoolResults(context.device,
+                                                     timestamps,
+                                                     0,
+                                                     static_cast<uint32_t>(ticks.size()),
+                                                     ticks.size() * sizeof(uint64_t),
+                                                     ticks.data(),
+                                                     sizeof(uint64_t),
+                                                     VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT),
+                               "Failed to read the timestamps of the network");
+
+                // Convert the ticks to nanoseconds, each stage runs from the timestamp before it to its own
+                std::vector<uint64_t> ns(ticks.size());
+                for (size_t i = 0; i < ticks.size(); ++i) {
+                    ns[i] = uint64_t(double(ticks[i] & timestamp_mask) * timestamp_period);
+                }
+                recorder.device(Stage::LOAD_IMAGE, -1, ns[0], ns[1]);
+                for (size_t i = 0; i < conv_layers.size(); ++i) {
+                    recorder.device(Stage::CONVOLUTION, int(i), ns[i + 1], ns[i + 2]);
+                }
+            }
+
+            /// Everything the device uses while running a classification that was submitted, so they outlive it
+            struct ClassificationBuffers {
+                /// The pixel coordinates of the points that were projected
+                std::pair<vk::buffer, vk::device_memory> pixels;
+                /// The image the network reads from
+                std::pair<vk::image, vk::device_memory> image;
+                /// The view of the image that the load image shader samples
+                vk::image_view image_view;
+                /// The neighbourhood graph of the points on the screen
+                std::pair<vk::buffer, vk::device_memory> neighbourhood;
+                /// The buffer the last layer of the network writes the classifications into
+                std::pair<vk::buffer, vk::device_memory> classifications;
+                /// The other ping pong buffer of the network
+                std::pair<vk::buffer, vk::device_memory> scratch;
+                /// Signalled by the projection which the network waits on
+                vk::semaphore projected;
+            };
+
+            /**
+             * @brief Project a mesh, load the image and submit the network, signalling network_fence when it is done.
+             * Must be called with the mutex held.
+             *
+             * @tparam Model the mesh model that we are projecting
+             *
+             * @param mesh     the mesh table that we are projecting to pixel coordinates
+             * @param Hoc      the homogenous transformation matrix from the camera to the observation plane
+             * @param lens     the lens parameters that describe the optics of the camera
+             * @param image    the data that represents the image the network will run from
+             * @param format   the pixel format of this image as a fourcc code
+             * @param output   the classified mesh that the neighbourhood and global indices are written into
+             * @param recorder the recorder of the frame
+             *
+             * @return the buffers that must be kept until network_fence is signalled
+             */
+            template <template <typename> class Model>
+            ClassificationBuffers submit_classification(const Mesh<Scalar, Model>& mesh,
+                                                        const mat4<Scalar>& Hoc,
+                                                        const Lens<Scalar>& lens,
+                                                        const void* image,
+                                                        const uint32_t& format,
+                                                        ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS>& output,
+                                                        FrameRecorder& recorder) const {
+                static constexpr int N_NEIGHBOURS = Model<Scalar>::N_NEIGHBOURS;
+                const bool timed                  = recorder.enabled();
 
                 // *******************************
                 // *** PROJECT OUR VISUAL MESH ***
                 // *******************************
 
-                std::vector<std::array<int, N_NEIGHBOURS>> neighbourhood;
-                std::vector<int> indices;
+                auto& neighbourhood = output.neighbourhood;
+                auto& indices       = output.global_indices;
                 std::pair<vk::buffer, vk::device_memory> vk_pixels;
-                vk::semaphore reprojection_semaphore;
-                std::tie(neighbourhood, indices, vk_pixels, reprojection_semaphore) =
-                  do_project<Model, vk::semaphore>(mesh, Hoc, lens);
-
-                wait_semaphores.push_back(std::make_pair(reprojection_semaphore, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT));
+                vk::semaphore projected;
+                std::tie(neighbourhood, indices, vk_pixels, projected) =
+                  do_project<Model, vk::semaphore>(mesh, Hoc, lens, recorder);
 
                 // ****************************
                 // *** LOAD IMAGE TO DEVICE ***
                 // ****************************
 
-                // Grab the image memory from the cache
-                std::pair<vk::image, vk::device_memory> vk_image = get_image_memory(lens.dimensions, format);
-                operation::copy_image_to_device(context, image, lens.dimensions, vk_image, get_image_format(format));
+                FrameRecorder::Scope upload(recorder, Stage::UPLOAD);
+
+                // Imported frames are already on the device, anything else is copied into the cached image memory
+                std::pair<vk::image, vk::device_memory> vk_image;
+                auto imported      = imported_images.find(image);
+                const bool foreign = imported != imported_images.end();
+                if (foreign) {
+                    if (lens.dimensions != imported->second.dimensions || format != imported->second.format) {
+                        throw std::invalid_argument("The image does not match the dimensions and format it was "
+                                                    "imported with");
+                    }
+                    vk_image = imported->second.memory;
+                }
+                else {
+                    vk_image = get_image_memory(lens.dimensions, format);
+                    operation::copy_image_to_device(
+                      context, image, image_extent(lens.dimensions, format), vk_image, get_image_format(format));
+                }
 
                 // This includes the offscreen point at the end
                 int n_points = neighbourhood.size();
@@ -754,6 +1551,7 @@ namespace engine {
                   context, 0, VK_WHOLE_SIZE, vk_neighbourhood.second, [&neighbourhood](void* payload) {
                       std::memcpy(payload, neighbourhood.data(), neighbourhood.size() * N_NEIGHBOURS * sizeof(int));
                   });
+                upload.stop();
 
                 // Grab our ping pong buffers from the cache
                 auto vk_conv_mem                                        = get_network_memory(max_width * n_points);
@@ -768,19 +1566,7 @@ namespace engine {
                                               [&n_points](Scalar* payload) { payload[0] = Scalar(-1); });
 
                 // Read the pixels into the buffer
-                // Create a descriptor pool
                 // Descriptor Set 0: {image+sampler, coordinates, network}
-                std::vector<VkDescriptorPoolSize> load_image_pool_size = {
-                  VkDescriptorPoolSize{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1},
-                  VkDescriptorPoolSize{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2},
-                };
-                vk::descriptor_pool load_image_pool = operation::create_descriptor_pool(context, load_image_pool_size);
-
-                // Allocate the descriptor set
-                VkDescriptorSet descriptor_set =
-                  operation::create_descriptor_set(context, load_image_pool, {load_image_descriptor_layout}).back();
-
-                // Load the arguments
                 std::array<VkDescriptorBufferInfo, 2> buffer_infos = {
                   VkDescriptorBufferInfo{vk_pixels.first, 0, VK_WHOLE_SIZE},
                   VkDescriptorBufferInfo{vk_conv_input.first, 0, VK_WHOLE_SIZE},
@@ -792,7 +1578,7 @@ namespace engine {
                 std::array<VkWriteDescriptorSet, 3> write_descriptors;
                 write_descriptors[0] = {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
                                         nullptr,
-                                        descriptor_set,
+                                        load_image_descriptor_set,
                                         0,
                                         0,
                                         1,
@@ -803,7 +1589,7 @@ namespace engine {
                 for (size_t i = 0; i < buffer_infos.size(); ++i) {
                     write_descriptors[i + 1] = {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
                                                 nullptr,
-                                                descriptor_set,
+                                                load_image_descriptor_set,
                                                 static_cast<uint32_t>(i + 1),
                                                 0,
                                                 1,
@@ -815,66 +1601,61 @@ namespace engine {
 
                 vkUpdateDescriptorSets(context.device, write_descriptors.size(), write_descriptors.data(), 0, nullptr);
 
-                vk::command_buffer command_buffer =
-                  operation::create_command_buffer(context, context.compute_command_pool, true);
+                // The load image kernel and every conv layer are recorded into a single command buffer with barriers
+                // between them so the device runs the whole network from one submission
+                operation::reset_command_buffer(network_command_buffer);
 
-                vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, get_image_pipeline(format));
+                // When timed a timestamp is written before the image is loaded and after it and each conv layer
+                if (timed) {
+                    vkCmdResetQueryPool(network_command_buffer, timestamps, 0, conv_layers.size() + 2);
+                    vkCmdWriteTimestamp(network_command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestamps, 0);
+                }
+
+                // An imported frame is owned by the device that wrote it until it is acquired for sampling
+                if (foreign) {
+                    operation::transfer_foreign_image(context, network_command_buffer, vk_image.first, true);
+                }
 
-                vkCmdBindDescriptorSets(command_buffer,
+                vkCmdBindPipeline(network_command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, get_image_pipeline(format));
+
+                vkCmdBindDescriptorSets(network_command_buffer,
                                         VK_PIPELINE_BIND_POINT_COMPUTE,
                                         load_image_pipeline_layout,
                                         0,
                                         1,
-                                        &descriptor_set,
+                                        &load_image_descriptor_set,
                                         0,
                                         nullptr);
 
-                vkCmdDispatch(command_buffer, static_cast<uint32_t>(n_points - 1), 1, 1);
+                vkCmdDispatch(network_command_buffer, static_cast<uint32_t>(n_points - 1), 1, 1);
+                if (timed) {
+                    vkCmdWriteTimestamp(network_command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, timestamps, 1);
+                }
 
-                VkSemaphoreCreateInfo semaphore_info = {VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO, nullptr, 0};
-                VkSemaphore semaphore;
-                throw_vk_error(vkCreateSemaphore(context.device, &semaphore_info, nullptr, &semaphore),
-                               "Failed to create reprojection semaphore");
-                vk::semaphore load_image_semaphore =
-                  vk::semaphore(semaphore, [this](auto p) { vkDestroySemaphore(context.device, p, nullptr); });
-                operation::submit_command_buffer(
-                  context.compute_queue, command_buffer, {wait_semaphores.back()}, {load_image_semaphore});
-                wait_semaphores.push_back(std::make_pair(load_image_semaphore, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT));
+                // Nothing samples the frame after the load image kernel, so it goes back to its device straight away
+                if (foreign) {
+                    operation::transfer_foreign_image(context, network_command_buffer, vk_image.first, false);
+                }
 
                 // *******************
                 // *** RUN NETWORK ***
                 // *******************
 
-                // Create a descriptor pool
-                // Descriptor Set 0: {neighbourhood_ptr, input_ptr, output_ptr}
-                std::vector<VkDescriptorPoolSize> conv_pool_size = {
-                  VkDescriptorPoolSize{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3},
-                };
-                vk::descriptor_pool conv_layer_pool =
-                  operation::create_descriptor_pool(context, conv_pool_size, conv_layers.size());
-
-                // Allocate the descriptor set
-                std::vector<VkDescriptorSet> conv_descriptor_sets = operation::create_descriptor_set(
-                  context,
-                  conv_layer_pool,
-                  std::vector<VkDescriptorSetLayout>(conv_layers.size(), conv_descriptor_layout));
+                // Each layer must see the writes of the one before it
+                const VkMemoryBarrier layer_barrier = {
+                  VK_STRUCTURE_TYPE_MEMORY_BARRIER, nullptr, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT};
 
-                std::vector<std::array<VkDescriptorBufferInfo, 3>> conv_buffer_infos;
-                std::vector<std::array<VkWriteDescriptorSet, 3>> conv_write_descriptors;
-                std::vector<vk::command_buffer> conv_command_buffers;
-                vk::fence fence;
+                std::vector<std::array<VkDescriptorBufferInfo, 3>> conv_buffer_infos(conv_layers.size());
                 for (size_t conv_no = 0; conv_no < conv_layers.size(); ++conv_no) {
                     auto& conv = conv_layers[conv_no];
 
-                    // Load the arguments
-                    std::array<VkDescriptorBufferInfo, 3> buffer_infos = {
-                      VkDescriptorBufferInfo{vk_neighbourhood.first, 0, VK_WHOLE_SIZE},
-                      VkDescriptorBufferInfo{vk_conv_input.first, 0, VK_WHOLE_SIZE},
-                      VkDescriptorBufferInfo{vk_conv_output.first, 0, VK_WHOLE_SIZE}};
-                    conv_buffer_infos.push_back(buffer_infos);
+                    // Descriptor Set 0: {neighbourhood_ptr, input_ptr, output_ptr}
+                    conv_buffer_infos[conv_no] = {VkDescriptorBufferInfo{vk_neighbourhood.first, 0, VK_WHOLE_SIZE},
+                                                  VkDescriptorBufferInfo{vk_conv_input.first, 0, VK_WHOLE_SIZE},
+                                                  VkDescriptorBufferInfo{vk_conv_output.first, 0, VK_WHOLE_SIZE}};
 
                     std::array<VkWriteDescriptorSet, 3> write_descriptors;
-                    for (size_t i = 0; i < buffer_infos.size(); ++i) {
+                    for (size_t i = 0; i < conv_buffer_infos[conv_no].size(); ++i) {
                         write_descriptors[i] = {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
                                                 nullptr,
                                                 conv_descriptor_sets[conv_no],
@@ -883,21 +1664,27 @@ namespace engine {
                                                 1,
                                                 VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
                                                 nullptr,
-                                                &conv_buffer_infos.back()[i],
+                                                &conv_buffer_infos[conv_no][i],
                                                 nullptr};
                     }
-                    conv_write_descriptors.push_back(write_descriptors);
 
                     vkUpdateDescriptorSets(
                       context.device, write_descriptors.size(), write_descriptors.data(), 0, nullptr);
 
-                    // Project!
-                    conv_command_buffers.push_back(
-                      operation::create_command_buffer(context, context.compute_command_pool, true));
+                    vkCmdPipelineBarrier(network_command_buffer,
+                                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                         0,
+                                         1,
+                                         &layer_barrier,
+                                         0,
+                                         nullptr,
+                                         0,
+                                         nullptr);
 
-                    vkCmdBindPipeline(conv_command_buffers.back(), VK_PIPELINE_BIND_POINT_COMPUTE, conv.first);
+                    vkCmdBindPipeline(network_command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, conv.first);
 
-                    vkCmdBindDescriptorSets(conv_command_buffers.back(),
+                    vkCmdBindDescriptorSets(network_command_buffer,
                                             VK_PIPELINE_BIND_POINT_COMPUTE,
                                             conv_pipeline_layout,
                                             0,
@@ -906,117 +1693,123 @@ namespace engine {
                                             0,
                                             nullptr);
 
-                    vkCmdDispatch(conv_command_buffers.back(), static_cast<uint32_t>(n_points), 1, 1);
-
-                    VkSemaphoreCreateInfo semaphore_info = {VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO, nullptr, 0};
-                    VkSemaphore semaphore;
-                    throw_vk_error(vkCreateSemaphore(context.device, &semaphore_info, nullptr, &semaphore),
-                                   "Failed to create conv layer semaphore");
-                    vk::semaphore conv_layer_semaphore =
-                      vk::semaphore(semaphore, [this](auto p) { vkDestroySemaphore(context.device, p, nullptr); });
-
-                    if (conv_no + 1 == conv_layers.size()) {
-                        VkFence f;
-                        VkFenceCreateInfo fence_info = {VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, nullptr, 0};
-                        throw_vk_error(vkCreateFence(context.device, &fence_info, nullptr, &f),
-                                       "Failed to create reprojection semaphore");
-                        fence = vk::fence(f, [this](auto p) { vkDestroyFence(context.device, p, nullptr); });
-                        operation::submit_command_buffer(
-                          context.compute_queue, conv_command_buffers.back(), fence, {wait_semaphores.back()});
-                    }
-                    else {
-                        operation::submit_command_buffer(context.compute_queue,
-                                                         conv_command_buffers.back(),
-                                                         {wait_semaphores.back()},
-                                                         {conv_layer_semaphore});
+                    vkCmdDispatch(network_command_buffer, static_cast<uint32_t>(n_points), 1, 1);
+                    if (timed) {
+                        vkCmdWriteTimestamp(network_command_buffer,
+                                            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                            timestamps,
+                                            static_cast<uint32_t>(conv_no + 2));
                     }
 
-                    wait_semaphores.push_back(std::make_pair(conv_layer_semaphore, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT));
-
-                    // Convert our events into a vector of events and ping pong our buffers
+                    // Ping pong our buffers
                     std::swap(vk_conv_input, vk_conv_output);
                 }
 
-                // ***************************
-                // *** WAIT FOR COMPLETION ***
-                // ***************************
+                // Wait for the reprojection before we start reading the pixel coordinates
+                recorder.submitted();
+                operation::submit_command_buffer(context.compute_queue,
+                                                 network_command_buffer,
+                                                 network_fence,
+                                                 {std::make_pair(projected, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT)});
+
+                return ClassificationBuffers{vk_pixels,
+                                             vk_image,
+                                             image_view,
+                                             vk_neighbourhood,
+                                             vk_conv_input,
+                                             vk_conv_output,
+                                             projected};
+            }
 
-                // Wait 10,000 * 1,000 nanoseconds = 10,000 * 1us = 10ms
-                VkResult res;
-                VkFence vk_fence = fence;
-                for (uint32_t timeout_count = 0; timeout_count < 10000; ++timeout_count) {
-                    res = vkWaitForFences(context.device, 1, &vk_fence, VK_TRUE, static_cast<uint64_t>(1e3));
-                    if (res == VK_SUCCESS) { break; }
-                    else if (res == VK_ERROR_DEVICE_LOST) {
-                        throw_vk_error(VK_ERROR_DEVICE_LOST, "Lost device while waiting for network to complete");
-                    }
-                }
-                if (res != VK_SUCCESS) { throw_vk_error(res, "Timed out waiting for network to complete"); }
+            /**
+             * @brief Read the results of a submitted classification once network_fence has been signalled. Must be
+             * called with the mutex held.
+             *
+             * @tparam N_NEIGHBOURS the number of neighbours that each point has
+             *
+             * @param buffers  the buffers that the classification was submitted with
+             * @param output   the classified mesh to read the pixel coordinates and classifications into
+             * @param recorder the recorder of the frame
+             */
+            template <int N_NEIGHBOURS>
+            void read_classification(const ClassificationBuffers& buffers,
+                                     ClassifiedMesh<Scalar, N_NEIGHBOURS>& output,
+                                     FrameRecorder& recorder) const {
+                if (recorder.enabled()) { read_timestamps(recorder); }
 
                 // ************************
                 // *** RETRIEVE RESULTS ***
                 // ************************
 
                 // Read the pixels off the buffer
-                std::vector<vec2<Scalar>> pixels(neighbourhood.size() - 1);
-                operation::map_memory<void>(context, 0, VK_WHOLE_SIZE, vk_pixels.second, [&pixels](void* payload) {
+                FrameRecorder::Scope readback(recorder, Stage::READBACK);
+                auto& pixels = output.pixel_coordinates;
+                pixels.resize(output.neighbourhood.size() - 1);
+                operation::map_memory<void>(context, 0, VK_WHOLE_SIZE, buffers.pixels.second, [&pixels](void* payload) {
                     std::memcpy(pixels.data(), payload, pixels.size() * sizeof(vec2<Scalar>));
                 });
 
                 // Read the classifications off the device (they'll be in input)
-                std::vector<Scalar> classifications(neighbourhood.size() * conv_layers.back().second);
+                auto& classifications = output.classifications;
+                classifications.resize(output.neighbourhood.size() * conv_layers.back().second);
                 operation::map_memory<void>(
-                  context, 0, VK_WHOLE_SIZE, vk_conv_input.second, [&classifications](void* payload) {
+                  context, 0, VK_WHOLE_SIZE, buffers.classifications.second, [&classifications](void* payload) {
                       std::memcpy(classifications.data(), payload, classifications.size() * sizeof(Scalar));
                   });
-
-                return ClassifiedMesh<Scalar, N_NEIGHBOURS>{
-                  std::move(pixels), std::move(neighbourhood), std::move(indices), std::move(classifications)};
+                readback.stop();
+                recorder.report();
             }
 
             /**
-             * @brief Project and classify a mesh using the neural network that is loaded into this engine.
-             * This version takes an aggregate VisualMesh object
+             * @brief Get the unit vectors of a mesh on the device, uploading them if they aren't there. Must be called
+             * with the mutex held.
              *
              * @tparam Model the mesh model that we are projecting
              *
-             * @param mesh    the mesh table that we are projecting to pixel coordinates
-             * @param Hoc     the homogenous transformation matrix from the camera to the observation plane
-             * @param lens    the lens parameters that describe the optics of the camera
-             * @param image   the data that represents the image the network will run from
-             * @param format  the pixel format of this image as a fourcc code
+             * @param mesh the mesh whose unit vectors we need
              *
-             * @return a classified mesh for the provided arguments
+             * @return the device buffer and memory holding the unit vectors of the mesh
              */
             template <template <typename> class Model>
-            ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> operator()(const VisualMesh<Scalar, Model>& mesh,
-                                                                           const mat4<Scalar>& Hoc,
-                                                                           const Lens<Scalar>& lens,
-                                                                           const void* image,
-                                                                           const uint32_t& format) const {
-                return operator()(mesh.height(Hoc[2][3]), Hoc, lens, image, format);
-            }
+            std::pair<vk::buffer, vk::device_memory> get_device_points(const Mesh<Scalar, Model>& mesh) const {
+                if (const auto* cached = device_points_cache.find(mesh.id())) { return *cached; }
 
-            void clear_cache() {
-                device_points_cache.clear();
-                image_memory.memory           = std::make_pair(nullptr, nullptr);
-                image_memory.dimensions       = {0, 0};
-                image_memory.format           = VK_FORMAT_UNDEFINED;
-                neighbourhood_memory.memory   = std::make_pair(nullptr, nullptr);
-                neighbourhood_memory.max_size = 0;
-                network_memory.memory         = {std::make_pair(nullptr, nullptr), std::make_pair(nullptr, nullptr)};
-                network_memory.max_size       = 0;
-                indices_memory.max_size       = 0;
-                indices_memory.memory         = std::make_pair(nullptr, nullptr);
+                const std::size_t bytes                            = sizeof(vec4<Scalar>) * mesh.nodes.size();
+                std::pair<vk::buffer, vk::device_memory> vk_points = operation::create_buffer(
+                  context,
+                  bytes,
+                  VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                  VK_SHARING_MODE_EXCLUSIVE,
+                  {context.transfer_queue_family},
+                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+                // Write the points buffer to the device
+                operation::map_memory<vec4<Scalar>>(
+                  context, 0, VK_WHOLE_SIZE, vk_points.second, [&mesh](vec4<Scalar>* payload) {
+                      size_t index = 0;
+                      for (const auto& n : mesh.nodes) {
+                          payload[index] =
+                            vec4<Scalar>{Scalar(n.ray[0]), Scalar(n.ray[1]), Scalar(n.ray[2]), Scalar(0)};
+                          index++;
+                      }
+                  });
+                operation::bind_buffer(context, vk_points.first, vk_points.second, 0);
+
+                // Cache for future runs
+                device_points_cache[mesh.id()] = vk_points;
+                device_points_cache.allocated(mesh.id(), bytes);
+                return vk_points;
             }
 
-        private:
             template <template <typename> class Model, typename CheckpointType>
             std::tuple<std::vector<std::array<int, Model<Scalar>::N_NEIGHBOURS>>,
                        std::vector<int>,
                        std::pair<vk::buffer, vk::device_memory>,
                        CheckpointType>
-              do_project(const Mesh<Scalar, Model>& mesh, const mat4<Scalar>& Hoc, const Lens<Scalar>& lens) const {
+              do_project(const Mesh<Scalar, Model>& mesh,
+                         const mat4<Scalar>& Hoc,
+                         const Lens<Scalar>& lens,
+                         FrameRecorder& recorder) const {
                 static constexpr int N_NEIGHBOURS = Model<Scalar>::N_NEIGHBOURS;
 
                 // We only support VkSemaphore and VkFence here.
@@ -1027,7 +1820,9 @@ namespace engine {
                   "Unknown checkpoint type. Must be one of VkFence or VkSemaphore");
 
                 // Lookup the on screen ranges
+                FrameRecorder::Scope lookup(recorder, Stage::LOOKUP);
                 auto ranges = mesh.lookup(Hoc, lens);
+                lookup.stop();
 
                 // Transfer Rco to the device
                 reprojection_buffers["vk_rco"] =
@@ -1121,36 +1916,7 @@ namespace engine {
                 const auto& nodes = mesh.nodes;
 
                 // Upload our visual mesh unit vectors if we have to
-                std::pair<vk::buffer, vk::device_memory> vk_points;
-
-                auto device_mesh = device_points_cache.find(&mesh);
-                if (device_mesh == device_points_cache.end()) {
-                    vk_points = operation::create_buffer(
-                      context,
-                      sizeof(vec4<Scalar>) * mesh.nodes.size(),
-                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-                      VK_SHARING_MODE_EXCLUSIVE,
-                      {context.transfer_queue_family},
-                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-                    // Write the points buffer to the device and cache it
-                    operation::map_memory<vec4<Scalar>>(
-                      context, 0, VK_WHOLE_SIZE, vk_points.second, [&mesh](vec4<Scalar>* payload) {
-                          size_t index = 0;
-                          for (const auto& n : mesh.nodes) {
-                              payload[index] =
-                                vec4<Scalar>{Scalar(n.ray[0]), Scalar(n.ray[1]), Scalar(n.ray[2]), Scalar(0)};
-                              index++;
-                          }
-                      });
-                    operation::bind_buffer(context, vk_points.first, vk_points.second, 0);
-
-                    // Cache for future runs
-                    device_points_cache[&mesh] = vk_points;
-                }
-                else {
-                    vk_points = device_mesh->second;
-                }
+                const std::pair<vk::buffer, vk::device_memory> vk_points = get_device_points(mesh);
 
                 // First count the size of the buffer we will need to allocate
                 int points = 0;
@@ -1185,15 +1951,8 @@ namespace engine {
                       std::memcpy(payload, indices.data(), indices.size() * sizeof(int));
                   });
 
-                // Create output buffer for pixel_coordinates
-                std::pair<vk::buffer, vk::device_memory> vk_pixels =
-                  operation::create_buffer(context,
-                                           sizeof(vec2<Scalar>) * points,
-                                           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-                                           VK_SHARING_MODE_EXCLUSIVE,
-                                           {context.transfer_queue_family},
-                                           VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-                operation::bind_buffer(context, vk_pixels.first, vk_pixels.second, 0);
+                // Get the output buffer for pixel_coordinates from cache
+                std::pair<vk::buffer, vk::device_memory> vk_pixels = get_pixel_memory(points);
 
                 // --------------------------------------------------
                 // At this point the point and the indices should be
@@ -1257,8 +2016,7 @@ namespace engine {
                 vkUpdateDescriptorSets(context.device, write_descriptors.size(), write_descriptors.data(), 0, nullptr);
 
                 // Project!
-                reprojection_command_buffer =
-                  operation::create_command_buffer(context, context.compute_command_pool, true);
+                operation::reset_command_buffer(reprojection_command_buffer);
 
                 vkCmdBindPipeline(reprojection_command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, reprojection_pipeline);
 
@@ -1273,31 +2031,21 @@ namespace engine {
 
                 vkCmdDispatch(reprojection_command_buffer, static_cast<int32_t>(points), 1, 1);
 
+                // Signal one of our persistent synchronisation objects rather than creating a new one each call
                 CheckpointType checkpoint;
                 static_if<std::is_same<CheckpointType, vk::semaphore>::value>([&](auto f) {
-                    VkSemaphore semaphore;
-                    VkSemaphoreCreateInfo semaphore_info = {VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO, nullptr, 0};
-                    throw_vk_error(vkCreateSemaphore(context.device, &semaphore_info, nullptr, &semaphore),
-                                   "Failed to create reprojection semaphore");
-                    f(checkpoint) =
-                      vk::semaphore(semaphore, [this](auto p) { vkDestroySemaphore(context.device, p, nullptr); });
+                    f(checkpoint) = reprojection_semaphore;
                     operation::submit_command_buffer(
                       context.compute_queue, reprojection_command_buffer, {}, {f(checkpoint)});
                 }).else_([&](auto f) {
-                    VkFence fence;
-                    VkFenceCreateInfo fence_info = {VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, nullptr, 0};
-                    throw_vk_error(vkCreateFence(context.device, &fence_info, nullptr, &fence),
-                                   "Failed to create reprojection semaphore");
-                    f(checkpoint) = vk::fence(fence, [this](auto p) { vkDestroyFence(context.device, p, nullptr); });
+                    f(checkpoint) = reprojection_fence;
                     operation::submit_command_buffer(context.compute_queue, reprojection_command_buffer, f(checkpoint));
                 });
 
                 // This can happen on the CPU while the Vulkan device is busy
-                // Build the reverse lookup map where the offscreen point is one past the end
-                std::vector<int> r_indices(nodes.size() + 1, points);
-                for (unsigned int i = 0; i < indices.size(); ++i) {
-                    r_indices[indices[i]] = i;
-                }
+                // Build the reverse lookup map from the ranges where the offscreen point is one past the end
+                FrameRecorder::Scope graph(recorder, Stage::PROJECT);
+                const RangeLookup remap(ranges);
 
                 // Build the packed neighbourhood map with an extra offscreen point at the end
                 std::vector<std::array<int, N_NEIGHBOURS>> local_neighbourhood(points + 1);
@@ -1305,11 +2053,12 @@ namespace engine {
                     const auto& node = nodes[indices[i]];
                     for (unsigned int j = 0; j < node.neighbours.size(); ++j) {
                         const auto& n             = node.neighbours[j];
-                        local_neighbourhood[i][j] = r_indices[n];
+                        local_neighbourhood[i][j] = remap(n);
                     }
                 }
                 // Fill in the final offscreen point which connects only to itself
                 local_neighbourhood[points].fill(points);
+                graph.stop();
 
                 // Return what we calculated
                 return std::make_tuple(std::move(local_neighbourhood),  // CPU buffer
@@ -1325,6 +2074,11 @@ namespace engine {
                     case fourcc("RGGB"):
                     case fourcc("GBRG"):
                     case fourcc("BGGR"): return 1;
+                    // YUV is held a byte at a time
+                    case fourcc("NV12"):
+                    case fourcc("YUYV"):
+                    case fourcc("YUY2"):
+                    case fourcc("UYVY"): return 1;
                     case fourcc("BGRA"):
                     case fourcc("RGBA"): return 4;
                     // Oh no...
@@ -1340,6 +2094,11 @@ namespace engine {
                     case fourcc("RGGB"):
                     case fourcc("GBRG"):
                     case fourcc("BGGR"): return VK_FORMAT_R8_UNORM;
+                    // YUV
+                    case fourcc("NV12"):
+                    case fourcc("YUYV"):
+                    case fourcc("YUY2"):
+                    case fourcc("UYVY"): return VK_FORMAT_R8_UNORM;
                     case fourcc("BGRA"): return VK_FORMAT_B8G8R8A8_UNORM;
                     case fourcc("RGBA"): return VK_FORMAT_R8G8B8A8_UNORM;
                     // Oh no...
@@ -1355,6 +2114,11 @@ namespace engine {
                     case fourcc("RGGB"):
                     case fourcc("GBRG"):
                     case fourcc("BGGR"): return bayer_sampler;
+                    // YUV
+                    case fourcc("NV12"):
+                    case fourcc("YUYV"):
+                    case fourcc("YUY2"):
+                    case fourcc("UYVY"): return bayer_sampler;
                     case fourcc("BGRA"):
                     case fourcc("RGBA"): return interp_sampler;
                     // Oh no...
@@ -1395,6 +2159,11 @@ namespace engine {
                     case fourcc("RGGB"): return load_RGGB_image;
                     case fourcc("GBRG"): return load_GBRG_image;
                     case fourcc("BGGR"): return load_BGGR_image;
+                    // YUV
+                    case fourcc("NV12"): return load_yuv_image[0];
+                    case fourcc("YUYV"):
+                    case fourcc("YUY2"): return load_yuv_image[1];
+                    case fourcc("UYVY"): return load_yuv_image[2];
                     case fourcc("BGRA"):
                     case fourcc("RGBA"): return load_RGBA_image;
                     // Oh no...
@@ -1408,9 +2177,9 @@ namespace engine {
 
                 // If our dimensions and format haven't changed from last time we can reuse the same memory location
                 if (dimensions != image_memory.dimensions || format != image_memory.format) {
-                    VkFormat vk_format   = get_image_format(format);
-                    VkExtent3D vk_extent = {
-                      static_cast<uint32_t>(dimensions[0]), static_cast<uint32_t>(dimensions[1]), 1};
+                    const vec2<int> extent = image_extent(dimensions, format);
+                    VkFormat vk_format     = get_image_format(format);
+                    VkExtent3D vk_extent   = {static_cast<uint32_t>(extent[0]), static_cast<uint32_t>(extent[1]), 1};
 
                     image_memory.memory =
                       operation::create_image(context,
@@ -1433,22 +2202,23 @@ namespace engine {
 
             std::array<std::pair<vk::buffer, vk::device_memory>, 2> get_network_memory(const int& max_size) const {
                 if (network_memory.max_size < max_size) {
+                    const int capacity       = grow_capacity(network_memory.max_size, max_size);
                     network_memory.memory[0] = operation::create_buffer(
                       context,
-                      max_size * sizeof(Scalar),
+                      capacity * sizeof(Scalar),
                       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
                       VK_SHARING_MODE_EXCLUSIVE,
                       {context.transfer_queue_family},
                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
                     network_memory.memory[1] = operation::create_buffer(
                       context,
-                      max_size * sizeof(Scalar),
+                      capacity * sizeof(Scalar),
                       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
                       VK_SHARING_MODE_EXCLUSIVE,
                       {context.transfer_queue_family},
                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
-                    network_memory.max_size = max_size;
+                    network_memory.max_size = capacity;
                     operation::bind_buffer(context, network_memory.memory[0].first, network_memory.memory[0].second, 0);
                     operation::bind_buffer(context, network_memory.memory[1].first, network_memory.memory[1].second, 0);
                 }
@@ -1457,30 +2227,50 @@ namespace engine {
 
             std::pair<vk::buffer, vk::device_memory> get_neighbourhood_memory(const int& max_size) const {
                 if (neighbourhood_memory.max_size < max_size) {
+                    const int capacity          = grow_capacity(neighbourhood_memory.max_size, max_size);
                     neighbourhood_memory.memory = operation::create_buffer(
                       context,
-                      max_size * sizeof(int),
+                      capacity * sizeof(int),
                       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
                       VK_SHARING_MODE_EXCLUSIVE,
                       {context.transfer_queue_family},
                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-                    neighbourhood_memory.max_size = max_size;
+                    neighbourhood_memory.max_size = capacity;
                     operation::bind_buffer(
                       context, neighbourhood_memory.memory.first, neighbourhood_memory.memory.second, 0);
                 }
                 return neighbourhood_memory.memory;
             }
 
+            std::pair<vk::buffer, vk::device_memory> get_pixel_memory(const int& max_size) const {
+                // Every call needs pixel coordinates for its points on the screen, so this is where they are counted
+                points_high_water.update(max_size);
+                if (pixel_memory.max_size < max_size) {
+                    const int capacity  = grow_capacity(pixel_memory.max_size, max_size);
+                    pixel_memory.memory = operation::create_buffer(
+                      context,
+                      capacity * sizeof(vec2<Scalar>),
+                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                      VK_SHARING_MODE_EXCLUSIVE,
+                      {context.transfer_queue_family},
+                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+                    pixel_memory.max_size = capacity;
+                    operation::bind_buffer(context, pixel_memory.memory.first, pixel_memory.memory.second, 0);
+                }
+                return pixel_memory.memory;
+            }
+
             std::pair<vk::buffer, vk::device_memory> get_indices_memory(const int& max_size) const {
                 if (indices_memory.max_size < max_size) {
+                    const int capacity    = grow_capacity(indices_memory.max_size, max_size);
                     indices_memory.memory = operation::create_buffer(
                       context,
-                      max_size * sizeof(int),
+                      capacity * sizeof(int),
                       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
                       VK_SHARING_MODE_EXCLUSIVE,
                       {context.transfer_queue_family},
                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-                    indices_memory.max_size = max_size;
+                    indices_memory.max_size = capacity;
                     operation::bind_buffer(context, indices_memory.memory.first, indices_memory.memory.second, 0);
                 }
                 return indices_memory.memory;
@@ -1511,6 +2301,10 @@ namespace engine {
             mutable vk::command_buffer reprojection_command_buffer;
             /// Memory buffers for the reprojection pipelines
             mutable std::map<std::string, std::pair<vk::buffer, vk::device_memory>> reprojection_buffers;
+            /// Signalled by the reprojection when the device will continue on to classify
+            vk::semaphore reprojection_semaphore;
+            /// Signalled by the reprojection when the host is waiting for the projected pixels
+            vk::fence reprojection_fence;
 
             /// DescriptorSetLayouts for the load_image kernel
             VkDescriptorSetLayout load_image_descriptor_layout;
@@ -1525,12 +2319,15 @@ namespace engine {
             vk::shader_module load_GBRG_image_program;
             vk::shader_module load_BGGR_image_program;
             vk::shader_module load_RGBA_image_program;
+            std::array<vk::shader_module, 3> load_yuv_image_program;
             /// Kernel for reading projected pixel coordinates from an image into the network input layer
             VkPipeline load_GRBG_image;
             VkPipeline load_RGGB_image;
             VkPipeline load_GBRG_image;
             VkPipeline load_BGGR_image;
             VkPipeline load_RGBA_image;
+            /// Kernels for reading YUV images, NV12, YUYV and UYVY
+            std::array<VkPipeline, 3> load_yuv_image;
 
             /// DescriptorSetLayout for the conv kernels
             VkDescriptorSetLayout conv_descriptor_layout;
@@ -1541,12 +2338,32 @@ namespace engine {
             /// A list of kernels to run in sequence to run the network
             std::vector<std::pair<VkPipeline, size_t>> conv_layers;
 
+            /// Descriptor pool and set that bind the buffers for the load image kernel
+            vk::descriptor_pool load_image_descriptor_pool;
+            VkDescriptorSet load_image_descriptor_set;
+            /// Descriptor pool and one set per conv layer that bind the network buffers
+            vk::descriptor_pool conv_descriptor_pool;
+            std::vector<VkDescriptorSet> conv_descriptor_sets;
+            /// Command buffer holding the load image and conv dispatches, re-recorded each call
+            mutable vk::command_buffer network_command_buffer;
+            /// Signalled when the network has finished running
+            vk::fence network_fence;
+
             mutable struct {
                 vec2<int> dimensions = {0, 0};
                 VkFormat format      = VK_FORMAT_UNDEFINED;
                 std::pair<vk::image, vk::device_memory> memory;
             } image_memory;
 
+            /// A camera frame buffer that has been imported into device memory
+            struct ImportedImage {
+                std::pair<vk::image, vk::device_memory> memory;
+                vec2<int> dimensions;
+                uint32_t format;
+            };
+            /// The imported frame buffers by the address they are mapped at on the host
+            std::map<const void*, ImportedImage> imported_images;
+
             mutable struct {
                 int max_size = 0;
                 std::array<std::pair<vk::buffer, vk::device_memory>, 2> memory;
@@ -1562,11 +2379,40 @@ namespace engine {
                 std::pair<vk::buffer, vk::device_memory> memory;
             } indices_memory;
 
+            mutable struct {
+                int max_size = 0;
+                std::pair<vk::buffer, vk::device_memory> memory;
+            } pixel_memory;
+
+            /// The most points on the screen that a single call has needed buffers for
+            mutable HighWaterMark points_high_water;
+
             // The width of the maximumally wide layer in the network
             size_t max_width;
 
-            // Cache of Vulkan buffers from mesh objects
-            mutable std::map<const void*, std::pair<vk::buffer, vk::device_memory>> device_points_cache;
+            /// The Vulkan buffers of the meshes that are on the device, keyed by the identifier of the mesh
+            mutable ResidencyCache<std::pair<vk::buffer, vk::device_memory>> device_points_cache;
+            /// Serialises calls from several threads as they share the reprojection resources and cached buffers
+            mutable std::mutex mutex;
+            /// The classification from classify_async that is running on the device
+            mutable PendingClassification* in_flight = nullptr;
+            /// The classifications from classify_async waiting for the device
+            mutable std::deque<PendingClassification*> waiting;
+            /// The classifications that have finished and are waiting for the mutex to be released to be resumed
+            mutable std::vector<PendingClassification*> finished;
+            /// Calls back when the classification from classify_async on the device has finished
+            mutable std::unique_ptr<operation::FenceReactor> reactor;
+            /// Set when the engine is destroyed so that waiting classifications fail rather than start
+            bool stopping = false;
+
+            /// Where the time spent in each stage of a frame is reported, or nullptr if the engine isn't being timed
+            std::shared_ptr<Instrumentation> instrumentation;
+            /// The timestamps written around the load image and conv dispatches when the engine is timed
+            vk::query_pool timestamps;
+            /// The number of nanoseconds per tick of a timestamp
+            float timestamp_period = 1.0f;
+            /// The bits of a timestamp that hold the time, the rest are undefined
+            uint64_t timestamp_mask = 0;
         };
 
     }  // namespace vulkan
@@ -18,6 +18,8 @@
 #ifndef VISUALMESH_ENGINE_VULKAN_KERNELS_LOAD_IMAGE_HPP
 #define VISUALMESH_ENGINE_VULKAN_KERNELS_LOAD_IMAGE_HPP
 
+#include <array>
+#include <string>
 #include <vector>
 
 #include "visualmesh/engine/vulkan/vulkan_compute.hpp"
@@ -559,6 +561,321 @@ namespace engine {
                 program.end_function();
             }
 
+            template <typename Scalar>
+            inline uint32_t yuv_pixel_function(Program& program,
+                                               const uint32_t& float_type,
+                                               const uint32_t& image_type,
+                                               const uint32_t& sampler_type,
+                                               const uint32_t& fvec2,
+                                               const uint32_t& uvec2,
+                                               const uint32_t& fvec3,
+                                               const uint32_t& fvec4,
+                                               const uint32_t& fetch_func) {
+                // Read the luma and chroma of the pixel "params[3]" from the bytes of a YUV image and convert it to RGB
+                // using the BT.601 limited range coefficients, the same as the CPU engine.
+                // "params[4]" scales and offsets the pixel to the luma byte. The chroma bytes are at the pixel scaled
+                // by "params[5].xy", floored, scaled by "params[5].zw" and offset by "params[6]" for U and "params[7]"
+                // for V
+                auto params =
+                  program.begin_function("yuv_pixel",
+                                         {fvec4, image_type, sampler_type, fvec2, fvec4, fvec4, fvec2, fvec2},
+                                         spv::FunctionControlMask::Pure);
+
+                uint32_t luma = program.add_name(
+                  program.fadd(program.fmul(params[3], program.swizzle(params[4], fvec2, {0, 1}), fvec2),
+                               program.swizzle(params[4], fvec2, {2, 3}),
+                               fvec2),
+                  "luma");
+                uint32_t pair = program.add_name(
+                  program.fmul(program.floor(program.fmul(params[3], program.swizzle(params[5], fvec2, {0, 1}), fvec2),
+                                             fvec2,
+                                             uvec2),
+                               program.swizzle(params[5], fvec2, {2, 3}),
+                               fvec2),
+                  "pair");
+
+                // float y = fetch(luma);
+                // float u = fetch(pair + u_offset) - 128 / 255;
+                // float v = fetch(pair + v_offset) - 128 / 255;
+                uint32_t half = program.add_constant(float_type, {Scalar(128.0 / 255.0)});
+                uint32_t Y    = program.add_name(
+                  program.call_function(fetch_func, float_type, {params[1], params[2], luma}), "Y");
+                uint32_t U = program.add_name(
+                  program.fsub(program.call_function(
+                                 fetch_func, float_type, {params[1], params[2], program.fadd(pair, params[6], fvec2)}),
+                               half,
+                               float_type),
+                  "U");
+                uint32_t V = program.add_name(
+                  program.fsub(program.call_function(
+                                 fetch_func, float_type, {params[1], params[2], program.fadd(pair, params[7], fvec2)}),
+                               half,
+                               float_type),
+                  "V");
+
+                // float l = 1.164 * (y - 16 / 255);
+                uint32_t L = program.add_name(
+                  program.fmul(program.add_constant(float_type, {Scalar(1.164)}),
+                               program.fsub(Y, program.add_constant(float_type, {Scalar(16.0 / 255.0)}), float_type),
+                               float_type),
+                  "L");
+
+                // float3 rgb = clamp((l + 1.596 * v, l - 0.813 * v - 0.391 * u, l + 2.018 * u), 0.0, 1.0);
+                uint32_t R = program.fadd(
+                  L, program.fmul(program.add_constant(float_type, {Scalar(1.596)}), V, float_type), float_type);
+                uint32_t G = program.fsub(
+                  program.fsub(
+                    L, program.fmul(program.add_constant(float_type, {Scalar(0.813)}), V, float_type), float_type),
+                  program.fmul(program.add_constant(float_type, {Scalar(0.391)}), U, float_type),
+                  float_type);
+                uint32_t B = program.fadd(
+                  L, program.fmul(program.add_constant(float_type, {Scalar(2.018)}), U, float_type), float_type);
+                uint32_t RGB = program.add_name(
+                  program.fclamp(program.create_vector(fvec3, {R, G, B}),
+                                 program.add_constant(fvec3, {Scalar(0.0), Scalar(0.0), Scalar(0.0)}),
+                                 program.add_constant(fvec3, {Scalar(1.0), Scalar(1.0), Scalar(1.0)}),
+                                 fvec3),
+                  "RGB");
+
+                program.return_function(
+                  program.create_vector(fvec4, {RGB, program.add_constant(float_type, {Scalar(1.0)})}));
+                program.end_function();
+
+                return params[0];
+            }
+
+            template <typename Scalar>
+            inline uint32_t yuv_to_rgb_function(Program& program,
+                                                const uint32_t& float_type,
+                                                const uint32_t& image_type,
+                                                const uint32_t& sampler_type,
+                                                const uint32_t& fvec2,
+                                                const uint32_t& uvec2,
+                                                const uint32_t& fvec4,
+                                                const uint32_t& yuv_pixel_func) {
+                // Bilinearly interpolate the four YUV pixels around "params[3]" with pixel centres on whole coordinates
+                // to match the CPU engine. The device can't filter pixels that aren't stored together so the taps are
+                // read and mixed here. "params[4]" to "params[7]" are the layout passed on to yuv_pixel and "params[8]"
+                // is the last pixel in the image
+                auto params =
+                  program.begin_function("yuv_to_rgb",
+                                         {fvec4, image_type, sampler_type, fvec2, fvec4, fvec4, fvec2, fvec2, fvec2},
+                                         spv::FunctionControlMask::Pure);
+
+                uint32_t zero = program.add_constant(fvec2, {Scalar(0.0), Scalar(0.0)});
+                uint32_t one  = program.add_constant(fvec2, {Scalar(1.0), Scalar(1.0)});
+
+                // float2 f  = floor(coord);
+                // float2 p1 = clamp(f, 0, last);
+                // float2 p2 = clamp(p1 + 1, 0, last);
+                // float2 t  = clamp(coord - f, 0, 1);
+                uint32_t f  = program.add_name(program.floor(params[3], fvec2, uvec2), "f");
+                uint32_t p1 = program.add_name(program.fclamp(f, zero, params[8], fvec2), "p1");
+                uint32_t p2 =
+                  program.add_name(program.fclamp(program.fadd(p1, one, fvec2), zero, params[8], fvec2), "p2");
+                uint32_t t = program.add_name(program.fclamp(program.fsub(params[3], f, fvec2), zero, one, fvec2), "t");
+
+                uint32_t p1_x = program.vector_component(float_type, p1, 0);
+                uint32_t p1_y = program.vector_component(float_type, p1, 1);
+                uint32_t p2_x = program.vector_component(float_type, p2, 0);
+                uint32_t p2_y = program.vector_component(float_type, p2, 1);
+                uint32_t t_x  = program.vector_component(float_type, t, 0);
+                uint32_t t_y  = program.vector_component(float_type, t, 1);
+
+                auto tap = [&](const uint32_t& px) {
+                    return program.call_function(
+                      yuv_pixel_func, fvec4, {params[1], params[2], px, params[4], params[5], params[6], params[7]});
+                };
+
+                // Mix needs the weights to be a vector of the same size as the operands
+                uint32_t w_x = program.create_vector(fvec4, {t_x, t_x, t_x, t_x});
+                uint32_t w_y = program.create_vector(fvec4, {t_y, t_y, t_y, t_y});
+
+                uint32_t top = program.add_name(
+                  program.fmix(tap(p1), tap(program.create_vector(fvec2, {p2_x, p1_y})), w_x, fvec4), "top");
+                uint32_t bottom = program.add_name(
+                  program.fmix(tap(program.create_vector(fvec2, {p1_x, p2_y})), tap(p2), w_x, fvec4), "bottom");
+
+                program.return_function(program.fmix(top, bottom, w_y, fvec4));
+                program.end_function();
+
+                return params[0];
+            }
+
+            /**
+             * @brief Build the entry point that reads the pixels of a YUV image into the network input
+             *
+             * @details
+             *  YUV images are held as a single channel image of their bytes. The layout gives the luma bytes per
+             *  pixel, the luma offset, the chroma bytes per pair of pixels, the U offset, the V offset, the chroma rows
+             *  per image row, and the scale from the dimensions of the device image to the dimensions of the image.
+             *  When chroma is shared between rows it is in a plane after the luma plane.
+             */
+            template <typename Scalar>
+            inline void load_yuv_image(Program& program,
+                                       const uint32_t& global_id,
+                                       const uint32_t& network_ptr,
+                                       const uint32_t& image_ptr,
+                                       const uint32_t& image_type,
+                                       const uint32_t& sampler,
+                                       const uint32_t& sampler_type,
+                                       const uint32_t& coords_ptr,
+                                       const std::string& name,
+                                       const std::array<Scalar, 8>& layout) {
+
+                uint32_t uint_type          = program.add_type(spv::Op::OpTypeInt, {32, 0});
+                uint32_t float_type         = program.add_type(spv::Op::OpTypeFloat, {8 * sizeof(Scalar)});
+                uint32_t uvec2              = program.add_vec_type(spv::Op::OpTypeInt, {32, 0}, 2);
+                uint32_t ivec2              = program.add_vec_type(spv::Op::OpTypeInt, {32, 1}, 2);
+                uint32_t fvec2              = program.add_vec_type(spv::Op::OpTypeFloat, {8 * sizeof(Scalar)}, 2);
+                uint32_t fvec3              = program.add_vec_type(spv::Op::OpTypeFloat, {8 * sizeof(Scalar)}, 3);
+                uint32_t fvec4              = program.add_vec_type(spv::Op::OpTypeFloat, {8 * sizeof(Scalar)}, 4);
+                uint32_t fvec2_ptr          = program.add_pointer(fvec2, spv::StorageClass::StorageBuffer);
+                uint32_t fvec4_ptr          = program.add_pointer(fvec4, spv::StorageClass::StorageBuffer);
+                uint32_t uint_ptr           = program.add_pointer(uint_type, spv::StorageClass::Input);
+                uint32_t sampled_image_type = program.add_sampled_image_type(image_type);
+
+                uint32_t fetch_func =
+                  fetch_function(program, float_type, image_type, sampler_type, sampled_image_type, fvec2, fvec4);
+                uint32_t yuv_pixel_func = yuv_pixel_function<Scalar>(
+                  program, float_type, image_type, sampler_type, fvec2, uvec2, fvec3, fvec4, fetch_func);
+                uint32_t yuv_to_rgb_func = yuv_to_rgb_function<Scalar>(
+                  program, float_type, image_type, sampler_type, fvec2, uvec2, fvec4, yuv_pixel_func);
+
+                // Constant parts of the layout, sampling at the centre of each byte
+                const Scalar plane = layout[5] < Scalar(1.0) ? Scalar(1.0) : Scalar(0.0);
+                uint32_t luma =
+                  program.add_constant(fvec4, {layout[0], Scalar(1.0), layout[1] + Scalar(0.5), Scalar(0.5)});
+                uint32_t chroma = program.add_constant(fvec4, {Scalar(0.5), layout[5], layout[2], Scalar(1.0)});
+
+                uint32_t idx0 = program.add_constant(uint_type, {0u});
+                program.begin_entry_point(name, {global_id});
+                uint32_t idx   = program.load_variable(program.member_access(global_id, {idx0}, uint_ptr), uint_type);
+                uint32_t image = program.load_variable(image_ptr, image_type);
+
+                // The dimensions of the image from the dimensions of the device image holding its bytes
+                uint32_t dimensions = program.floor(
+                  program.fadd(program.fmul(program.cast_int_to_float(program.image_size(image, ivec2), fvec2),
+                                            program.add_constant(fvec2, {layout[6], layout[7]}),
+                                            fvec2),
+                               program.add_constant(fvec2, {Scalar(0.5), Scalar(0.5)}),
+                               fvec2),
+                  fvec2,
+                  uvec2);
+                uint32_t last =
+                  program.fsub(dimensions, program.add_constant(fvec2, {Scalar(1.0), Scalar(1.0)}), fvec2);
+                uint32_t row = program.fadd(
+                  program.fmul(program.vector_component(float_type, dimensions, 1),
+                               program.add_constant(float_type, {plane}),
+                               float_type),
+                  program.add_constant(float_type, {Scalar(0.5)}),
+                  float_type);
+                uint32_t u_offset =
+                  program.create_vector(fvec2, {program.add_constant(float_type, {layout[3] + Scalar(0.5)}), row});
+                uint32_t v_offset =
+                  program.create_vector(fvec2, {program.add_constant(float_type, {layout[4] + Scalar(0.5)}), row});
+
+                program.store_variable(
+                  program.member_access(network_ptr, {idx0, idx}, fvec4_ptr),
+                  program.call_function(
+                    yuv_to_rgb_func,
+                    fvec4,
+                    {image,
+                     program.load_variable(sampler, sampler_type),
+                     program.load_variable(program.member_access(coords_ptr, {idx0, idx}, fvec2_ptr), fvec2),
+                     luma,
+                     chroma,
+                     u_offset,
+                     v_offset,
+                     last}));
+                program.return_function();
+                program.end_function();
+            }
+
+            template <typename Scalar>
+            inline void load_NV12_image(Program& program,
+                                        const uint32_t& global_id,
+                                        const uint32_t& network_ptr,
+                                        const uint32_t& image_ptr,
+                                        const uint32_t& image_type,
+                                        const uint32_t& sampler,
+                                        const uint32_t& sampler_type,
+                                        const uint32_t& coords_ptr) {
+                load_yuv_image<Scalar>(program,
+                                       global_id,
+                                       network_ptr,
+                                       image_ptr,
+                                       image_type,
+                                       sampler,
+                                       sampler_type,
+                                       coords_ptr,
+                                       "load_NV12_image",
+                                       {{Scalar(1.0),
+                                         Scalar(0.0),
+                                         Scalar(2.0),
+                                         Scalar(0.0),
+                                         Scalar(1.0),
+                                         Scalar(0.5),
+                                         Scalar(1.0),
+                                         Scalar(2.0 / 3.0)}});
+            }
+
+            template <typename Scalar>
+            inline void load_YUYV_image(Program& program,
+                                        const uint32_t& global_id,
+                                        const uint32_t& network_ptr,
+                                        const uint32_t& image_ptr,
+                                        const uint32_t& image_type,
+                                        const uint32_t& sampler,
+                                        const uint32_t& sampler_type,
+                                        const uint32_t& coords_ptr) {
+                load_yuv_image<Scalar>(program,
+                                       global_id,
+                                       network_ptr,
+                                       image_ptr,
+                                       image_type,
+                                       sampler,
+                                       sampler_type,
+                                       coords_ptr,
+                                       "load_YUYV_image",
+                                       {{Scalar(2.0),
+                                         Scalar(0.0),
+                                         Scalar(4.0),
+                                         Scalar(1.0),
+                                         Scalar(3.0),
+                                         Scalar(1.0),
+                                         Scalar(0.5),
+                                         Scalar(1.0)}});
+            }
+
+            template <typename Scalar>
+            inline void load_UYVY_image(Program& program,
+                                        const uint32_t& global_id,
+                                        const uint32_t& network_ptr,
+                                        const uint32_t& image_ptr,
+                                        const uint32_t& image_type,
+                                        const uint32_t& sampler,
+                                        const uint32_t& sampler_type,
+                                        const uint32_t& coords_ptr) {
+                load_yuv_image<Scalar>(program,
+                                       global_id,
+                                       network_ptr,
+                                       image_ptr,
+                                       image_type,
+                                       sampler,
+                                       sampler_type,
+                                       coords_ptr,
+                                       "load_UYVY_image",
+                                       {{Scalar(2.0),
+                                         Scalar(1.0),
+                                         Scalar(4.0),
+                                         Scalar(0.0),
+                                         Scalar(2.0),
+                                         Scalar(1.0),
+                                         Scalar(0.5),
+                                         Scalar(1.0)}});
+            }
+
             template <typename Scalar, bool debug, typename LoadImageFunc>
             inline std::vector<uint32_t> load_image(LoadImageFunc&& load_image_func) {
                 // Initialise the program.
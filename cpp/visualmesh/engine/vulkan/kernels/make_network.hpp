@@ -24,30 +24,85 @@
 #include <vector>
 
 #include "visualmesh/engine/vulkan/vulkan_compute.hpp"
-#include "visualmesh/network_structure.hpp"
+#include "visualmesh/compiled_network.hpp"
+#include "visualmesh/quantisation.hpp"
 
 namespace visualmesh {
 namespace engine {
     namespace vulkan {
         namespace kernels {
 
+            namespace detail {
+
+                /// The quantisation of a full precision layer's input, there is none
+                template <typename Scalar>
+                const QuantisationParameters<Scalar>* input_quantisation(const LayerView<Scalar>& /*layer*/) {
+                    return nullptr;
+                }
+                /// The quantisation of a quantised layer's input
+                template <typename Scalar>
+                const QuantisationParameters<Scalar>* input_quantisation(const QuantisedLayer<Scalar>& layer) {
+                    return &layer.input;
+                }
+
+                /// The weight that connects input j to output i in a full precision layer
+                template <typename Scalar>
+                Scalar weight(const LayerView<Scalar>& layer, const int& j, const int& i) {
+                    return layer.weight(j, i);
+                }
+                /// The integer weight that connects input j to output i in a quantised layer
+                template <typename Scalar>
+                Scalar weight(const QuantisedLayer<Scalar>& layer, const int& j, const int& i) {
+                    return Scalar(layer.weight(j, i));
+                }
+
+                /// The bias of output i in a full precision layer
+                template <typename Scalar>
+                Scalar bias(const LayerView<Scalar>& layer, const int& i) {
+                    return layer.bias(i);
+                }
+                /// The bias of output i in a quantised layer
+                template <typename Scalar>
+                Scalar bias(const QuantisedLayer<Scalar>& layer, const int& i) {
+                    return layer.biases[i];
+                }
+
+                /// The scale that dequantises output i of a quantised layer
+                template <typename Scalar>
+                Scalar scale(const QuantisedLayer<Scalar>& layer, const int& i) {
+                    return layer.scales[i];
+                }
+                /// Full precision layers are never dequantised
+                template <typename Scalar>
+                Scalar scale(const LayerView<Scalar>& /*layer*/, const int& /*i*/) {
+                    return Scalar(1);
+                }
+
+            }  // namespace detail
+
             /**
-             * @brief Given a network structure object generate the SPIRV source code for the kernels needed to execute
-             * it
+             * @brief Given a network generate the SPIRV source code for the kernels needed to execute it
              *
-             * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+             * @details
+             *  For a QuantisedNetwork each layer's input is quantised to 8 bits and multiplied against the integer
+             *  weights before being dequantised. The SPIR-V we generate is restricted to 32 bit arithmetic so this is
+             *  done in floating point, which is exact for the integer products, and gives the same results as the
+             *  other engines' 8 bit integer kernels.
              *
-             * @param structure the network structure to generate the kernels from
+             * @tparam Scalar  the scalar type used for calculations and storage (normally one of float or double)
+             * @tparam debug   if debug names and source lines should be added to the generated code
+             * @tparam Network the type of network, either a CompiledNetwork or a QuantisedNetwork
+             *
+             * @param network the network to generate the kernels from
              *
              * @return the SPIRV source code for the kernels to be built
              */
-            template <typename Scalar, bool debug>
-            std::vector<std::pair<uint32_t, std::vector<uint32_t>>> make_network(
-              const NetworkStructure<Scalar>& structure) {
+            template <typename Scalar, bool debug, typename Network>
+            std::vector<std::pair<uint32_t, std::vector<uint32_t>>> make_network(const Network& network) {
                 std::vector<std::pair<uint32_t, std::vector<uint32_t>>> programs;
 
-                // If our structure has no layers, return empty code
-                if (structure.empty() || structure.front().empty()) { return programs; }
+                // If our network has no layers, return empty code
+                if (network.empty()) { return programs; }
 
                 // Keep track of the input and output size of each layer for building the network
                 // The first layer input is always 4 from the image
@@ -55,10 +110,9 @@ namespace engine {
                 uint32_t output_dimensions = 0;
 
                 // First layer has 4 inputs, so that tells us how many neighbours we have (minus ourself)
-                const uint32_t n_neighbours = (structure.front().front().weights.size() / 4) - 1;
+                const uint32_t n_neighbours = (network.layer(0, 0).input_dimensions / 4) - 1;
 
-                for (uint32_t conv_no = 0; conv_no < structure.size(); ++conv_no) {
-                    auto& conv = structure[conv_no];
+                for (uint32_t conv_no = 0; conv_no < network.size(); ++conv_no) {
 
                     // Initialise the program.
                     Program::Config config;
@@ -142,16 +196,32 @@ namespace engine {
 
                     program.add_source_line(__FILE__, __LINE__, conv_no);
 
-                    for (uint32_t layer_no = 0; layer_no < conv.size(); ++layer_no) {
+                    for (uint32_t layer_no = 0; layer_no < network.size(conv_no); ++layer_no) {
+                        const uint32_t layer_outputs = network.layer(conv_no, layer_no).output_dimensions;
                         layers.push_back(program.add_name(
                           program.add_variable(
                             program.add_pointer(
                               program.add_array_type(
                                 float_type,
-                                program.add_constant(uint_type, {static_cast<uint32_t>(conv[layer_no].biases.size())})),
+                                program.add_constant(uint_type, {layer_outputs})),
                               spv::StorageClass::Function),
                             spv::StorageClass::Function),
-                          compose_string<debug>("in{}[{}]", layer_no + 1, conv[layer_no].biases.size())));
+                          compose_string<debug>("in{}[{}]", layer_no + 1, layer_outputs)));
+                    }
+
+                    // Quantised networks also need somewhere to store the quantised input of each layer
+                    std::vector<uint32_t> quantised;
+                    for (uint32_t layer_no = 0; layer_no < network.size(conv_no); ++layer_no) {
+                        const auto& layer = network.layer(conv_no, layer_no);
+                        if (detail::input_quantisation(layer) == nullptr) { break; }
+                        const uint32_t layer_inputs = layer.input_dimensions;
+                        quantised.push_back(program.add_name(
+                          program.add_variable(
+                            program.add_pointer(
+                              program.add_array_type(float_type, program.add_constant(uint_type, {layer_inputs})),
+                              spv::StorageClass::Function),
+                            spv::StorageClass::Function),
+                          compose_string<debug>("q{}[{}]", layer_no, layer_inputs)));
                     }
 
                     program.add_source_line(__FILE__, __LINE__, conv_no);
@@ -277,11 +347,55 @@ namespace engine {
                     program.add_source_line(__FILE__, __LINE__, conv_no);
 
                     // Now we have to do our layer operations
-                    for (uint32_t layer_no = 0; layer_no < conv.size(); ++layer_no) {
-                        const auto& weights = conv[layer_no].weights;
-                        const auto& biases  = conv[layer_no].biases;
+                    for (uint32_t layer_no = 0; layer_no < network.size(conv_no); ++layer_no) {
+                        const auto& layer       = network.layer(conv_no, layer_no);
+                        const auto quantisation = detail::input_quantisation(layer);
 
-                        output_dimensions = biases.size();
+                        output_dimensions = layer.output_dimensions;
+
+                        /*************************************************
+                         *                QUANTISE INPUT                 *
+                         *************************************************/
+
+                        // The multiplication reads from the quantised copy of the input, offset by the zero point
+                        uint32_t source = layers[layer_no];
+                        if (quantisation != nullptr) {
+                            program.add_source_line(__FILE__, __LINE__, conv_no);
+
+                            uint32_t inv = program.add_constant(float_type, {Scalar(1) / quantisation->scale});
+                            uint32_t offset =
+                              program.add_constant(float_type, {Scalar(quantisation->zero_point) + Scalar(0.5)});
+                            uint32_t zero = program.add_constant(float_type, {Scalar(0)});
+                            uint32_t max_value =
+                              program.add_constant(float_type, {Scalar(QuantisationParameters<Scalar>::MAX_VALUE)});
+                            uint32_t zero_point = program.add_constant(float_type, {Scalar(quantisation->zero_point)});
+
+                            for (uint32_t j = 0; j < input_dimensions; ++j) {
+                                // q[j] = clamp(floor(in[j] * inv + offset), 0, 255) - zero_point
+                                uint32_t current_val = program.load_variable(
+                                  program.member_access(
+                                    layers[layer_no], {program.add_constant(uint_type, {j})}, float_ptr_func),
+                                  float_type);
+                                current_val = program.floor(
+                                  program.fadd(program.fmul(current_val, inv, float_type), offset, float_type),
+                                  float_type,
+                                  uint_type);
+                                current_val = program.select(
+                                  float_type, program.fgeq(current_val, zero), current_val, zero);
+                                current_val = program.select(
+                                  float_type, program.fgeq(current_val, max_value), max_value, current_val);
+                                current_val = program.add_name(program.fsub(current_val, zero_point, float_type),
+                                                               compose_string<debug>("q{}[{}]", layer_no, j));
+
+                                program.store_variable(
+                                  program.member_access(
+                                    quantised[layer_no], {program.add_constant(uint_type, {j})}, float_ptr_func),
+                                  current_val);
+
+                                program.add_source_line(__FILE__, __LINE__, conv_no);
+                            }
+                            source = quantised[layer_no];
+                        }
 
                         /*************************************************
                          *                WEIGHTS + BIAS                 *
@@ -291,9 +405,11 @@ namespace engine {
 
                         // Perform our matrix multiplication for weights and add bias for layer
                         for (uint32_t i = 0; i < output_dimensions; ++i) {
-                            uint32_t total_val =
-                              program.add_name(program.add_constant(float_type, {biases[i]}),
-                                               compose_string<debug>("in{}[{}]_bias[{}]", layer_no, i, i));
+                            // Quantised layers accumulate the integer products and add the bias after dequantising
+                            uint32_t total_val = program.add_name(
+                              program.add_constant(float_type,
+                                                   {quantisation == nullptr ? detail::bias(layer, i) : Scalar(0)}),
+                              compose_string<debug>("in{}[{}]_bias[{}]", layer_no, i, i));
 
                             program.add_source_line(__FILE__, __LINE__, conv_no);
 
@@ -301,15 +417,16 @@ namespace engine {
                                 uint32_t current_val = program.add_name(
                                   program.load_variable(
                                     program.member_access(
-                                      layers[layer_no], {program.add_constant(uint_type, {j})}, float_ptr_func),
+                                      source, {program.add_constant(uint_type, {j})}, float_ptr_func),
                                     float_type),
                                   compose_string<debug>("in{}[{}]", layer_no, j));
 
                                 program.add_source_line(__FILE__, __LINE__, conv_no);
 
                                 current_val = program.add_name(
-                                  program.fmul(
-                                    current_val, program.add_constant(float_type, {weights[j][i]}), float_type),
+                                  program.fmul(current_val,
+                                               program.add_constant(float_type, {detail::weight(layer, j, i)}),
+                                               float_type),
                                   "current_mul_weight");
 
                                 program.add_source_line(__FILE__, __LINE__, conv_no);
@@ -320,6 +437,16 @@ namespace engine {
                                 program.add_source_line(__FILE__, __LINE__, conv_no);
                             }
 
+                            if (quantisation != nullptr) {
+                                total_val = program.add_name(
+                                  program.fadd(program.fmul(total_val,
+                                                            program.add_constant(float_type, {detail::scale(layer, i)}),
+                                                            float_type),
+                                               program.add_constant(float_type, {detail::bias(layer, i)}),
+                                               float_type),
+                                  "dequantised");
+                            }
+
                             program.add_source_line(__FILE__, __LINE__, conv_no);
 
                             program.store_variable(
@@ -339,7 +466,7 @@ namespace engine {
                          *************************************************/
 
                         // Apply selu
-                        if (conv_no + 1 < structure.size() || layer_no + 1 < conv.size()) {
+                        if (conv_no + 1 < network.size() || layer_no + 1 < network.size(conv_no)) {
                             program.add_source_line(__FILE__, __LINE__, conv_no);
 
                             for (uint32_t i = 0; i < output_dimensions; ++i) {
@@ -23,6 +23,8 @@ extern "C" {
 }
 
 #include <array>
+#include <cstdint>
+#include <string>
 #include <vector>
 
 #include "wrapper.hpp"
@@ -33,8 +35,11 @@ namespace engine {
         namespace operation {
 
             inline vk::command_pool create_command_pool(const VulkanContext& context, const uint32_t& queue_family) {
-                VkCommandPoolCreateInfo create_info = {
-                  VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO, nullptr, 0, queue_family};
+                // Command buffers from this pool may be reset individually so the engine can re-record them
+                VkCommandPoolCreateInfo create_info = {VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+                                                       nullptr,
+                                                       VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+                                                       queue_family};
                 VkCommandPool command_pool;
                 throw_vk_error(vkCreateCommandPool(context.device, &create_info, 0, &command_pool),
                                "Failed to create a command pool");
@@ -69,6 +74,50 @@ namespace engine {
                 return command_buffer;
             }
 
+            /**
+             * @brief Resets a command buffer that was previously submitted and begins recording into it again.
+             * The caller must ensure the device has finished executing the buffer before calling this.
+             *
+             * @param command_buffer the command buffer to reset
+             */
+            inline void reset_command_buffer(const vk::command_buffer& command_buffer) {
+                throw_vk_error(vkResetCommandBuffer(command_buffer, 0), "Failed to reset a command buffer");
+
+                VkCommandBufferBeginInfo begin_info = {
+                  VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO, nullptr, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT, 0};
+
+                throw_vk_error(vkBeginCommandBuffer(command_buffer, &begin_info), "Failed to begin a command buffer");
+            }
+
+            inline vk::semaphore create_semaphore(const VulkanContext& context) {
+                VkSemaphoreCreateInfo semaphore_info = {VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO, nullptr, 0};
+                VkSemaphore semaphore;
+                throw_vk_error(vkCreateSemaphore(context.device, &semaphore_info, nullptr, &semaphore),
+                               "Failed to create a semaphore");
+                return vk::semaphore(semaphore,
+                                     [&context](auto p) { vkDestroySemaphore(context.device, p, nullptr); });
+            }
+
+            inline vk::fence create_fence(const VulkanContext& context) {
+                VkFenceCreateInfo fence_info = {VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, nullptr, 0};
+                VkFence fence;
+                throw_vk_error(vkCreateFence(context.device, &fence_info, nullptr, &fence), "Failed to create a fence");
+                return vk::fence(fence, [&context](auto p) { vkDestroyFence(context.device, p, nullptr); });
+            }
+
+            /**
+             * @brief Blocks until the fence is signalled and then resets it so it can be used for the next submission
+             *
+             * @param context the Vulkan context that owns the fence
+             * @param fence   the fence to wait on
+             * @param msg     the message to attach to the exception if the wait fails
+             */
+            inline void wait_for_fence(const VulkanContext& context, const vk::fence& fence, const std::string& msg) {
+                VkFence vk_fence = fence;
+                throw_vk_error(vkWaitForFences(context.device, 1, &vk_fence, VK_TRUE, UINT64_MAX), msg);
+                throw_vk_error(vkResetFences(context.device, 1, &vk_fence), "Failed to reset a fence");
+            }
+
             inline void submit_command_buffer(
               const VkQueue& queue,
               const vk::command_buffer& command_buffer,
@@ -22,6 +22,7 @@ extern "C" {
 #include <vulkan/vulkan.h>
 }
 
+#include <cstring>
 #include <iomanip>
 #include <iostream>
 #include <vector>
@@ -282,6 +283,33 @@ namespace engine {
                 context.compute_queue_family  = best_compute_queue_family;
                 context.transfer_queue_family = best_transfer_queue_family;
 
+                // Enable importing camera frames from DMA-BUF file descriptors when the device supports it
+                uint32_t extension_count = 0;
+                vkEnumerateDeviceExtensionProperties(context.phys_device, nullptr, &extension_count, nullptr);
+                std::vector<VkExtensionProperties> extensions(extension_count);
+                vkEnumerateDeviceExtensionProperties(
+                  context.phys_device, nullptr, &extension_count, extensions.data());
+                auto has_extension = [&extensions](const char* name) {
+                    for (const auto& e : extensions) {
+                        if (std::strcmp(e.extensionName, name) == 0) { return true; }
+                    }
+                    return false;
+                };
+                std::vector<const char*> enabled_extensions;
+                // The foreign queue family is how ownership of the frames is passed to and from the camera
+                if (has_extension(VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME)
+                    && has_extension(VK_EXT_EXTERNAL_MEMORY_DMA_BUF_EXTENSION_NAME)
+                    && has_extension(VK_EXT_QUEUE_FAMILY_FOREIGN_EXTENSION_NAME)) {
+                    enabled_extensions.push_back(VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME);
+                    enabled_extensions.push_back(VK_EXT_EXTERNAL_MEMORY_DMA_BUF_EXTENSION_NAME);
+                    enabled_extensions.push_back(VK_EXT_QUEUE_FAMILY_FOREIGN_EXTENSION_NAME);
+                    // Core in Vulkan 1.1 but 1.0 drivers still expose it as an extension
+                    if (has_extension(VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME)) {
+                        enabled_extensions.push_back(VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME);
+                    }
+                    context.dma_buf = true;
+                }
+
                 // Create device and queues
                 float queue_priority = 1.0f;
                 std::array<VkDeviceQueueCreateInfo, 2> queue_create_info;
@@ -299,8 +327,8 @@ namespace engine {
                                           queue_create_info.data(),
                                           0,
                                           nullptr,
-                                          0,
-                                          nullptr,
+                                          static_cast<uint32_t>(enabled_extensions.size()),
+                                          enabled_extensions.data(),
                                           nullptr};
                 }
                 else {
@@ -311,8 +339,8 @@ namespace engine {
                                           queue_create_info.data(),
                                           0,
                                           nullptr,
-                                          0,
-                                          nullptr,
+                                          static_cast<uint32_t>(enabled_extensions.size()),
+                                          enabled_extensions.data(),
                                           nullptr};
                 }
 
@@ -19,6 +19,7 @@
 #define VISUALMESH_ENGINE_VULKAN_OPERATION_CREATE_IMAGE_HPP
 
 extern "C" {
+#include <unistd.h>
 #include <vulkan/vulkan.h>
 }
 
@@ -109,7 +110,9 @@ namespace engine {
             inline void transition_image_layout(const VulkanContext& context,
                                                 const vk::image& image,
                                                 const VkImageLayout& old_layout,
-                                                const VkImageLayout& new_layout) {
+                                                const VkImageLayout& new_layout,
+                                                const uint32_t& src_queue_family = VK_QUEUE_FAMILY_IGNORED,
+                                                const uint32_t& dst_queue_family = VK_QUEUE_FAMILY_IGNORED) {
 
                 vk::command_buffer command_buffer =
                   operation::create_command_buffer(context, context.compute_command_pool, true);
@@ -120,8 +123,8 @@ namespace engine {
                                                 0,
                                                 old_layout,
                                                 new_layout,
-                                                VK_QUEUE_FAMILY_IGNORED,
-                                                VK_QUEUE_FAMILY_IGNORED,
+                                                src_queue_family,
+                                                dst_queue_family,
                                                 image,
                                                 {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1}};
 
@@ -143,14 +146,22 @@ namespace engine {
                     source_stage      = VK_PIPELINE_STAGE_TRANSFER_BIT;
                     destination_stage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
                 }
+                else if (old_layout == VK_IMAGE_LAYOUT_PREINITIALIZED && new_layout == VK_IMAGE_LAYOUT_GENERAL) {
+                    barrier.srcAccessMask = 0;
+                    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+                    source_stage      = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+                    destination_stage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+                }
                 else {
                     throw_vk_error(VK_ERROR_FORMAT_NOT_SUPPORTED, "Unsupported layout transition");
                 }
 
                 vkCmdPipelineBarrier(
                   command_buffer, source_stage, destination_stage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-                submit_command_buffer(context.transfer_queue, command_buffer, {}, {});
-                vkQueueWaitIdle(context.transfer_queue);
+                // The command buffer is from the compute pool, and a release of ownership has to run on that family
+                submit_command_buffer(context.compute_queue, command_buffer, {}, {});
+                vkQueueWaitIdle(context.compute_queue);
             }
 
             inline void copy_image_to_device(const VulkanContext& context,
@@ -207,6 +218,179 @@ namespace engine {
                                         VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
             }
 
+            /**
+             * @brief Create an image on top of memory that was exported from another device as a DMA-BUF, such as the
+             * buffers a camera driver writes its frames to
+             *
+             * @details
+             *  The image uses linear tiling so that it matches the layout the camera wrote. It is left in the general
+             *  layout and released to the foreign queue family, so the device that writes the frames owns it between
+             *  classifications and each one acquires it with transfer_foreign_image. The file descriptor is
+             *  duplicated, so the caller keeps ownership of the one it passed in.
+             *
+             * @param context   the Vulkan context holding the device to import the memory to
+             * @param extent    the dimensions of the image
+             * @param format    the format of the pixels in the image
+             * @param fd        the DMA-BUF file descriptor of the memory
+             * @param row_pitch the number of bytes between the start of each row in the memory
+             *
+             * @return the image and the imported memory that is bound to it
+             */
+            inline std::pair<vk::image, vk::device_memory> import_image(const VulkanContext& context,
+                                                                        const VkExtent3D& extent,
+                                                                        const VkFormat& format,
+                                                                        const int& fd,
+                                                                        const VkDeviceSize& row_pitch) {
+                if (!context.dma_buf) {
+                    throw_vk_error(VK_ERROR_EXTENSION_NOT_PRESENT, "The device does not support importing DMA-BUFs");
+                }
+
+                // Create an image that can be bound to DMA-BUF memory
+                VkExternalMemoryImageCreateInfo external_info = {VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO,
+                                                                 nullptr,
+                                                                 VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT};
+                VkImageCreateInfo image_info = {VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+                                                &external_info,
+                                                0,
+                                                VK_IMAGE_TYPE_2D,
+                                                format,
+                                                extent,
+                                                1,
+                                                1,
+                                                VK_SAMPLE_COUNT_1_BIT,  // 1 sample per pixel
+                                                VK_IMAGE_TILING_LINEAR,
+                                                VK_IMAGE_USAGE_SAMPLED_BIT,
+                                                VK_SHARING_MODE_EXCLUSIVE,
+                                                1,
+                                                &context.compute_queue_family,
+                                                VK_IMAGE_LAYOUT_PREINITIALIZED};
+
+                VkImage img;
+                throw_vk_error(vkCreateImage(context.device, &image_info, nullptr, &img), "Failed to create image");
+                vk::image image(img, [&context](auto p) { vkDestroyImage(context.device, p, nullptr); });
+
+                // Without explicit DRM format modifiers the device picks the row pitch, so it has to match the frames
+                VkImageSubresource subresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0};
+                VkSubresourceLayout layout;
+                vkGetImageSubresourceLayout(context.device, image, &subresource, &layout);
+                if (layout.rowPitch != row_pitch) {
+                    throw_vk_error(VK_ERROR_FORMAT_NOT_SUPPORTED,
+                                   "The device needs a different row pitch than the imported image has");
+                }
+
+                // Find a memory type that both the image and the DMA-BUF can use
+                auto get_memory_fd_properties = reinterpret_cast<PFN_vkGetMemoryFdPropertiesKHR>(
+                  vkGetDeviceProcAddr(context.device, "vkGetMemoryFdPropertiesKHR"));
+                VkMemoryFdPropertiesKHR fd_properties = {VK_STRUCTURE_TYPE_MEMORY_FD_PROPERTIES_KHR, nullptr, 0};
+                throw_vk_error(get_memory_fd_properties(
+                                 context.device, VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT, fd, &fd_properties),
+                               "Failed to get the properties of the DMA-BUF");
+
+                VkMemoryRequirements mem_requirements;
+                vkGetImageMemoryRequirements(context.device, image, &mem_requirements);
+                const uint32_t memory_types = mem_requirements.memoryTypeBits & fd_properties.memoryTypeBits;
+
+                uint32_t heap_index = VK_MAX_MEMORY_TYPES;
+                for (uint32_t k = 0; k < VK_MAX_MEMORY_TYPES; k++) {
+                    if (memory_types & (1 << k)) {
+                        heap_index = k;
+                        break;
+                    }
+                }
+                throw_vk_error(heap_index == VK_MAX_MEMORY_TYPES ? VK_ERROR_OUT_OF_DEVICE_MEMORY : VK_SUCCESS,
+                               "Failed to find a memory type for the DMA-BUF");
+
+                // A successful import takes ownership of the file descriptor so give it a copy
+                const int import_fd = ::dup(fd);
+                throw_vk_error(import_fd < 0 ? VK_ERROR_INVALID_EXTERNAL_HANDLE : VK_SUCCESS,
+                               "Failed to duplicate the DMA-BUF file descriptor");
+
+                VkMemoryDedicatedAllocateInfo dedicated_info = {
+                  VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO, nullptr, image, VK_NULL_HANDLE};
+                VkImportMemoryFdInfoKHR import_info = {VK_STRUCTURE_TYPE_IMPORT_MEMORY_FD_INFO_KHR,
+                                                       &dedicated_info,
+                                                       VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT,
+                                                       import_fd};
+                VkMemoryAllocateInfo memory_alloc_info = {
+                  VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO, &import_info, mem_requirements.size, heap_index};
+
+                VkDeviceMemory mem;
+                VkResult result = vkAllocateMemory(context.device, &memory_alloc_info, 0, &mem);
+                if (result != VK_SUCCESS) { ::close(import_fd); }
+                throw_vk_error(result, "Failed to import the DMA-BUF");
+                vk::device_memory memory(mem, [&context](auto p) { vkFreeMemory(context.device, p, nullptr); });
+
+                bind_image(context, image, memory, 0);
+                transition_image_layout(context,
+                                        image,
+                                        VK_IMAGE_LAYOUT_PREINITIALIZED,
+                                        VK_IMAGE_LAYOUT_GENERAL,
+                                        context.compute_queue_family,
+                                        VK_QUEUE_FAMILY_FOREIGN_EXT);
+
+                return std::make_pair(image, memory);
+            }
+
+            /**
+             * @brief Record the transfer of an imported image between the device that writes the frames to it and the
+             * compute queue
+             *
+             * @details
+             *  Between classifications the image is owned by the foreign queue family in the general layout. It is
+             *  acquired into the shader read only layout before it is sampled and released back once the sampling has
+             *  finished, so the device that writes the frames sees it the way it left it.
+             *
+             * @param context        the Vulkan context holding the compute queue family
+             * @param command_buffer the command buffer to record the barrier into
+             * @param image          the imported image
+             * @param acquire        true to acquire the image for the compute queue, false to release it again
+             */
+            inline void transfer_foreign_image(const VulkanContext& context,
+                                               const vk::command_buffer& command_buffer,
+                                               const vk::image& image,
+                                               const bool& acquire) {
+                VkImageMemoryBarrier barrier = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                                                nullptr,
+                                                0,
+                                                0,
+                                                VK_IMAGE_LAYOUT_GENERAL,
+                                                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                                                VK_QUEUE_FAMILY_FOREIGN_EXT,
+                                                context.compute_queue_family,
+                                                image,
+                                                {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1}};
+
+                // The access of the other queue family is ignored, so only the sampling on this side is listed
+                if (acquire) {
+                    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+                    vkCmdPipelineBarrier(command_buffer,
+                                         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                         0,
+                                         0,
+                                         nullptr,
+                                         0,
+                                         nullptr,
+                                         1,
+                                         &barrier);
+                }
+                else {
+                    std::swap(barrier.oldLayout, barrier.newLayout);
+                    std::swap(barrier.srcQueueFamilyIndex, barrier.dstQueueFamilyIndex);
+                    barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+                    vkCmdPipelineBarrier(command_buffer,
+                                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                         VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                                         0,
+                                         0,
+                                         nullptr,
+                                         0,
+                                         nullptr,
+                                         1,
+                                         &barrier);
+                }
+            }
+
         }  // namespace operation
     }      // namespace vulkan
 }  // namespace engine
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_ENGINE_VULKAN_OPERATION_FENCE_REACTOR_HPP
+#define VISUALMESH_ENGINE_VULKAN_OPERATION_FENCE_REACTOR_HPP
+
+extern "C" {
+#include <vulkan/vulkan.h>
+}
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace visualmesh {
+namespace engine {
+    namespace vulkan {
+        namespace operation {
+
+            /**
+             * @brief Calls a function when a fence is signalled, waiting for every watched fence on one thread
+             *
+             * @details
+             *  The thread sleeps while nothing is watched. Otherwise it waits for any of the watched fences with a
+             *  short timeout, so fences watched during a wait are picked up by the next one. The callbacks are run
+             *  on this thread and the fences are not reset.
+             */
+            class FenceReactor {
+            public:
+                explicit FenceReactor(const VkDevice& device) : device(device), thread([this] { run(); }) {}
+
+                FenceReactor(const FenceReactor&) = delete;
+                FenceReactor(FenceReactor&&)      = delete;
+                FenceReactor& operator=(const FenceReactor&) = delete;
+                FenceReactor& operator=(FenceReactor&&) = delete;
+
+                /**
+                 * @brief Stops the thread, the callbacks of fences that have not been signalled are never called
+                 */
+                ~FenceReactor() {
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        stopping = true;
+                    }
+                    wake.notify_all();
+                    thread.join();
+                }
+
+                /**
+                 * @brief Call a function once the fence is signalled, or once waiting for it has failed
+                 *
+                 * @param fence    the fence to wait for
+                 * @param callback the function to call on the reactor's thread
+                 */
+                void watch(const VkFence& fence, std::function<void()> callback) {
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        watches.emplace_back(fence, std::move(callback));
+                    }
+                    wake.notify_all();
+                }
+
+                /**
+                 * @brief Stop watching a fence without calling its callbacks
+                 *
+                 * @details
+                 *  Once this returns the reactor is not using the fence, so the caller may reset or destroy it.
+                 *
+                 * @param fence the fence to stop watching
+                 */
+                void forget(const VkFence& fence) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    watches.erase(std::remove_if(watches.begin(),
+                                                 watches.end(),
+                                                 [&](const std::pair<VkFence, std::function<void()>>& watch) {
+                                                     return watch.first == fence;
+                                                 }),
+                                  watches.end());
+                }
+
+            private:
+                void run() {
+                    std::vector<VkFence> fences;
+                    std::vector<std::function<void()>> ready;
+                    while (true) {
+                        {
+                            // The lock is held while waiting so forget() knows when the fences are no longer in use
+                            std::unique_lock<std::mutex> lock(mutex);
+                            wake.wait(lock, [this] { return stopping || !watches.empty(); });
+                            if (stopping) { return; }
+
+                            fences.clear();
+                            for (const auto& watch : watches) {
+                                fences.push_back(watch.first);
+                            }
+                            VkResult result = vkWaitForFences(
+                              device, static_cast<uint32_t>(fences.size()), fences.data(), VK_FALSE, timeout);
+
+                            // On an error every callback is called so its owner finds the error when it waits itself
+                            for (auto it = watches.begin(); it != watches.end();) {
+                                if (result < 0 || vkGetFenceStatus(device, it->first) != VK_NOT_READY) {
+                                    ready.push_back(std::move(it->second));
+                                    it = watches.erase(it);
+                                }
+                                else {
+                                    ++it;
+                                }
+                            }
+                        }
+
+                        for (auto& callback : ready) {
+                            callback();
+                        }
+                        ready.clear();
+                    }
+                }
+
+                /// How long in nanoseconds a wait lasts before checking for newly watched fences
+                static constexpr uint64_t timeout = 1000000;
+
+                /// The device the fences belong to
+                VkDevice device;
+                /// Protects the watches and the stopping flag
+                std::mutex mutex;
+                /// Wakes the thread when a fence is watched or the reactor is stopping
+                std::condition_variable wake;
+                /// The fences being waited for and the functions to call when they are signalled
+                std::vector<std::pair<VkFence, std::function<void()>>> watches;
+                /// Set when the reactor is destroyed to end the thread
+                bool stopping = false;
+                /// The thread that waits for the fences and runs the callbacks
+                std::thread thread;
+            };
+
+        }  // namespace operation
+    }      // namespace vulkan
+}  // namespace engine
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_ENGINE_VULKAN_OPERATION_FENCE_REACTOR_HPP
@@ -0,0 +1,267 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_ENGINE_VULKAN_OPERATION_PIPELINE_CACHE_HPP
+#define VISUALMESH_ENGINE_VULKAN_OPERATION_PIPELINE_CACHE_HPP
+
+extern "C" {
+#include <vulkan/vulkan.h>
+}
+
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "visualmesh/utility/atomic_file.hpp"
+#include "visualmesh/utility/serialisation.hpp"
+#include "vulkan_error_category.hpp"
+#include "wrapper.hpp"
+
+namespace visualmesh {
+namespace engine {
+    namespace vulkan {
+        namespace operation {
+
+            /**
+             * @brief Stores the SPIR-V modules and the driver's compiled pipelines for an engine on disk
+             *
+             * @details
+             *  Building the SPIR-V for the network and having the driver compile it into pipelines is most of the time
+             *  it takes to construct an engine. The generated modules are written to the cache directory keyed by a
+             *  hash of what they were generated from, and a VkPipelineCache is loaded from and saved back to the same
+             *  directory so the driver can skip compiling pipelines it has seen before. Everything is kept in a
+             *  subdirectory named from the vendor, device, driver version and pipeline cache UUID of the physical
+             *  device so that a driver update or a different device never reads stale data.
+             *
+             *  The cache directory is `$VISUALMESH_PIPELINE_CACHE` if it is set, otherwise `visualmesh/vulkan` in
+             *  `$XDG_CACHE_HOME` or `$HOME/.cache`. Setting `VISUALMESH_PIPELINE_CACHE` to an empty string disables
+             *  the disk cache, in which case the pipeline cache only lives as long as this object. Files are written to
+             *  a temporary name and renamed into place so that several processes can share the directory, and a file
+             *  that can't be read is treated as a miss.
+             */
+            class PipelineCache {
+            public:
+                /// The type of a list of numbered SPIR-V modules, as made by make_network
+                using Modules = std::vector<std::pair<uint32_t, std::vector<uint32_t>>>;
+
+                PipelineCache(const VulkanContext& context) : context(context) {
+                    const std::string root = cache_directory();
+                    if (!root.empty()) {
+                        VkPhysicalDeviceProperties properties;
+                        vkGetPhysicalDeviceProperties(context.phys_device, &properties);
+                        uint64_t hash = 0xcbf29ce484222325;
+                        add_hash(hash, &properties.vendorID, sizeof(properties.vendorID));
+                        add_hash(hash, &properties.deviceID, sizeof(properties.deviceID));
+                        add_hash(hash, &properties.driverVersion, sizeof(properties.driverVersion));
+                        add_hash(hash, properties.pipelineCacheUUID, sizeof(properties.pipelineCacheUUID));
+                        directory = root + "/" + hex(hash);
+                    }
+
+                    // Seed the pipeline cache with what the driver saved last time, it checks the header itself and
+                    // ignores data that doesn't match
+                    std::vector<char> initial = directory.empty() ? std::vector<char>() : read(pipelines_path());
+                    VkPipelineCacheCreateInfo info = {
+                      VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO, nullptr, 0, initial.size(), initial.data()};
+                    throw_vk_error(vkCreatePipelineCache(context.device, &info, nullptr, &cache),
+                                   "Failed to create a pipeline cache");
+                }
+
+                PipelineCache(const PipelineCache&) = delete;
+                PipelineCache& operator=(const PipelineCache&) = delete;
+
+                ~PipelineCache() {
+                    vkDestroyPipelineCache(context.device, cache, nullptr);
+                }
+
+                /// The pipeline cache to pass to vkCreateComputePipelines
+                operator VkPipelineCache() const {
+                    return cache;
+                }
+
+                /**
+                 * @brief Get a list of SPIR-V modules from the disk cache, generating and storing them on a miss
+                 *
+                 * @tparam Generate the type of the function that makes the modules
+                 *
+                 * @param name     the name of the modules, used as the file name
+                 * @param key      a hash of everything the modules are generated from
+                 * @param generate a function returning the modules, only called if they are not in the cache
+                 *
+                 * @return the modules
+                 */
+                template <typename Generate>
+                Modules modules(const std::string& name, const uint64_t& key, Generate&& generate) const {
+                    if (directory.empty()) { return generate(); }
+
+                    const std::string path = directory + "/" + name + "-" + hex(key) + ".spv";
+                    Modules result;
+                    if (read_modules(path, key, result)) { return result; }
+
+                    result = generate();
+                    std::stringstream out;
+                    BinaryWriter writer(out);
+                    writer.write_bytes(magic(), 4);
+                    writer.write(uint32_t(VERSION));
+                    writer.write(key);
+                    writer.write(uint64_t(result.size()));
+                    for (const auto& m : result) {
+                        writer.write(m.first);
+                        writer.write(uint64_t(m.second.size()));
+                        writer.write_array(m.second.data(), m.second.size());
+                    }
+                    write(path, out.str());
+                    return result;
+                }
+
+                /**
+                 * @brief Get a single SPIR-V module from the disk cache, generating and storing it on a miss
+                 *
+                 * @tparam Generate the type of the function that makes the module
+                 *
+                 * @param name     the name of the module, used as the file name
+                 * @param key      a hash of everything the module is generated from
+                 * @param generate a function returning the module, only called if it is not in the cache
+                 *
+                 * @return the words of the module
+                 */
+                template <typename Generate>
+                std::vector<uint32_t> module(const std::string& name, const uint64_t& key, Generate&& generate) const {
+                    return modules(name, key, [&] { return Modules{{0, generate()}}; }).front().second;
+                }
+
+                /**
+                 * @brief Write the driver's pipeline cache to disk, call once every pipeline has been created
+                 */
+                void save() const {
+                    if (directory.empty()) { return; }
+                    std::size_t size = 0;
+                    if (vkGetPipelineCacheData(context.device, cache, &size, nullptr) != VK_SUCCESS || size == 0) {
+                        return;
+                    }
+                    std::string data(size, '\0');
+                    if (vkGetPipelineCacheData(context.device, cache, &size, &data[0]) != VK_SUCCESS) { return; }
+                    data.resize(size);
+                    write(pipelines_path(), data);
+                }
+
+                /**
+                 * @brief Add bytes to a 64 bit FNV-1a hash
+                 *
+                 * @param hash the hash to update, start from 0xcbf29ce484222325
+                 * @param data the bytes to add
+                 * @param size the number of bytes
+                 */
+                static void add_hash(uint64_t& hash, const void* data, const std::size_t& size) {
+                    const auto* bytes = static_cast<const unsigned char*>(data);
+                    for (std::size_t i = 0; i < size; ++i) {
+                        hash ^= bytes[i];
+                        hash *= 0x100000001b3;
+                    }
+                }
+
+                /// Get the root directory for the disk cache, or an empty string if it is disabled
+                static std::string cache_directory() {
+#ifdef VISUALMESH_HAVE_MMAP
+                    if (const char* dir = std::getenv("VISUALMESH_PIPELINE_CACHE")) { return dir; }
+                    if (const char* dir = std::getenv("XDG_CACHE_HOME")) {
+                        return *dir ? std::string(dir) + "/visualmesh/vulkan" : "";
+                    }
+                    if (const char* dir = std::getenv("HOME")) {
+                        return *dir ? std::string(dir) + "/.cache/visualmesh/vulkan" : "";
+                    }
+#endif
+                    return "";
+                }
+
+            private:
+                /// Bytes at the start of a SPIR-V cache file
+                static const char* magic() {
+                    return "VMSV";
+                }
+                /// Changes whenever the SPIR-V generators or this file format change so old files are not read
+                static constexpr uint32_t VERSION = 1;
+
+                /// The path of the driver's pipeline cache data
+                std::string pipelines_path() const {
+                    return directory + "/pipelines.bin";
+                }
+
+                /// Format a hash as 16 hex digits
+                static std::string hex(const uint64_t& value) {
+                    std::stringstream s;
+                    s << std::hex << std::setw(16) << std::setfill('0') << value;
+                    return s.str();
+                }
+
+                /// Read a whole file, returning nothing if it can't be read
+                static std::vector<char> read(const std::string& path) {
+                    std::ifstream in(path, std::ios::binary);
+                    if (!in) { return {}; }
+                    return std::vector<char>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+                }
+
+                /// Read a SPIR-V cache file, returning false if it is missing, for another key or damaged
+                static bool read_modules(const std::string& path, const uint64_t& key, Modules& result) {
+                    const std::vector<char> data = read(path);
+                    if (data.size() < 4 || std::string(data.data(), 4) != magic()) { return false; }
+                    try {
+                        BinaryReader reader(data.data() + 4, data.size() - 4);
+                        if (reader.read<uint32_t>() != VERSION || reader.read<uint64_t>() != key) { return false; }
+                        const uint64_t n = reader.read<uint64_t>();
+                        if (n > reader.remaining()) { return false; }
+                        result.resize(n);
+                        for (auto& m : result) {
+                            m.first                = reader.read<uint32_t>();
+                            const uint64_t n_words = reader.read<uint64_t>();
+                            if (n_words > reader.remaining() / sizeof(uint32_t)) { return false; }
+                            m.second.resize(n_words);
+                            reader.read_array(m.second.data(), m.second.size());
+                            // Every module must at least start with the SPIR-V magic number
+                            if (m.second.empty() || m.second.front() != 0x07230203) { return false; }
+                        }
+                        return reader.remaining() == 0;
+                    }
+                    catch (const std::runtime_error&) {
+                        return false;
+                    }
+                }
+
+                /// Write a file into the cache directory atomically, failing to store is not an error
+                void write(const std::string& path, const std::string& data) const {
+                    if (make_directories(directory)) { write_atomically(path, data); }
+                }
+
+                /// The context whose device owns the pipeline cache
+                const VulkanContext& context;
+                /// The directory this device's files are stored in, empty if the disk cache is disabled
+                std::string directory;
+                /// The driver's pipeline cache
+                VkPipelineCache cache = VK_NULL_HANDLE;
+            };
+
+        }  // namespace operation
+    }      // namespace vulkan
+}  // namespace engine
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_ENGINE_VULKAN_OPERATION_PIPELINE_CACHE_HPP
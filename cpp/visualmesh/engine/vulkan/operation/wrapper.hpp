@@ -66,6 +66,7 @@ namespace engine {
             using descriptor_buffer_info = vulkan_wrapper<::VkDescriptorBufferInfo>;
             using semaphore              = vulkan_wrapper<::VkSemaphore>;
             using fence                  = vulkan_wrapper<::VkFence>;
+            using query_pool             = vulkan_wrapper<::VkQueryPool>;
         }  // namespace vk
 
         enum class DeviceType { CPU, GPU, INTEGRATED_GPU, DISCRETE_GPU, VIRTUAL_GPU, ANY };
@@ -80,6 +81,8 @@ namespace engine {
             VkQueue transfer_queue;
             vk::command_pool compute_command_pool;
             vk::command_pool transfer_command_pool;
+            /// If the device can import DMA-BUF file descriptors as device memory
+            bool dma_buf = false;
         };
     }  // namespace vulkan
 }  // namespace engine
@@ -159,6 +159,9 @@ struct Program {
         // Uses the Shader Execution Model.
         operation(output, spv::Op::OpCapability, {static_cast<uint32_t>(spv::Capability::Shader)});
 
+        // Uses OpImageQuerySizeLod to find the dimensions of an image.
+        operation(output, spv::Op::OpCapability, {static_cast<uint32_t>(spv::Capability::ImageQuery)});
+
         // Uses extended image formats (like R8 = single 8-bit unsigned normalised integer channel)
         operation(output, spv::Op::OpCapability, {static_cast<uint32_t>(spv::Capability::StorageImageExtendedFormats)});
 
@@ -763,6 +766,35 @@ struct Program {
         return id;
     }
 
+    uint32_t fclamp(const uint32_t& x, const uint32_t& min_val, const uint32_t& max_val, const uint32_t& type) {
+        if (config.enable_glsl_extensions) {
+            uint32_t id = id_generator++;
+            operation(functions,
+                      spv::Op::OpExtInst,
+                      {type, id, 1, static_cast<uint32_t>(GLSLstd450::GLSLstd450FClamp), x, min_val, max_val});
+            return id;
+        }
+
+        else {
+            throw std::system_error(std::make_error_code(std::errc::function_not_supported),
+                                    "FClamp function only supported when GLSL extensions are enabled");
+        }
+    }
+
+    uint32_t fmix(const uint32_t& x, const uint32_t& y, const uint32_t& a, const uint32_t& type) {
+        if (config.enable_glsl_extensions) {
+            uint32_t id = id_generator++;
+            operation(
+              functions, spv::Op::OpExtInst, {type, id, 1, static_cast<uint32_t>(GLSLstd450::GLSLstd450FMix), x, y, a});
+            return id;
+        }
+
+        else {
+            throw std::system_error(std::make_error_code(std::errc::function_not_supported),
+                                    "FMix function only supported when GLSL extensions are enabled");
+        }
+    }
+
     uint32_t fmod(const uint32_t& u, const uint32_t& v, const uint32_t& type) {
         uint32_t id = id_generator++;
         // GLSLstd450::GLSLstd450Modf has the wrong semantics so we would need to do the calculation manually
@@ -1130,6 +1162,14 @@ struct Program {
         return id2;
     }
 
+    uint32_t image_size(const uint32_t& image_id, const uint32_t& size_type) {
+        uint32_t id = id_generator++;
+        operation(functions,
+                  spv::Op::OpImageQuerySizeLod,
+                  {size_type, id, image_id, add_constant(add_type(spv::Op::OpTypeInt, {32, 1}), {0u})});
+        return id;
+    }
+
     // Conditional routines
     uint32_t select(const uint32_t& type,
                     const uint32_t& condition,
@@ -0,0 +1,529 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_FRAME_PIPELINE_HPP
+#define VISUALMESH_FRAME_PIPELINE_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "visualmesh/classified_mesh.hpp"
+#include "visualmesh/lens.hpp"
+#include "visualmesh/mesh.hpp"
+#include "visualmesh/utility/affinity.hpp"
+#include "visualmesh/utility/bounded_queue.hpp"
+#include "visualmesh/utility/math.hpp"
+#include "visualmesh/visualmesh.hpp"
+
+namespace visualmesh {
+
+/// What a FramePipeline does with a new frame when it can't hold any more
+enum class OverloadPolicy {
+    /// Wait in push until there is room for the frame
+    BLOCK,
+    /// Drop the new frame
+    DROP_NEWEST,
+    /// Drop the oldest frame that hasn't started yet to make room for the new one
+    DROP_OLDEST
+};
+
+/**
+ * @brief Settings for a FramePipeline
+ */
+struct FramePipelineOptions {
+    /// The number of frames each stage can have waiting for it, which also limits the frames on the device at once
+    std::size_t depth = 4;
+    /// What to do with new frames when the pipeline is full
+    OverloadPolicy overload = OverloadPolicy::DROP_OLDEST;
+    /// The processors the thread for each stage may run on, any of them if empty
+    std::vector<int> lookup_cpus;
+    std::vector<int> submit_cpus;
+    std::vector<int> readback_cpus;
+    std::vector<int> deliver_cpus;
+};
+
+namespace pipeline_detail {
+
+    /**
+     * @brief Lets threads sleep until another thread has made progress that they are waiting on
+     *
+     * @details
+     *  The thread making progress only touches the mutex when someone is actually asleep, so while every stage is busy
+     *  the queues are passed through without taking any locks. Before sleeping a waiter yields a few times, as the
+     *  next frame often arrives in less time than it takes to sleep and wake up again.
+     */
+    class Wakeup {
+    public:
+        /**
+         * @brief Wait until a condition is true
+         *
+         * @param ready checks the condition, it may be called several times and from under the lock
+         */
+        template <typename Ready>
+        void wait(Ready&& ready) {
+            for (int i = 0; i < 16; ++i) {
+                if (ready()) { return; }
+                std::this_thread::yield();
+            }
+            std::unique_lock<std::mutex> lock(mutex);
+            waiters.fetch_add(1);
+            cv.wait(lock, ready);
+            waiters.fetch_sub(1);
+        }
+
+        /// Wake the threads that are waiting so they check their condition again
+        void notify() {
+            // Being a read-modify-write this reads the latest count, and if a waiter's increment comes after it the
+            // waiter is guaranteed to see the progress when it checks its condition
+            if (waiters.fetch_add(0) > 0) {
+                std::lock_guard<std::mutex> lock(mutex);
+                cv.notify_all();
+            }
+        }
+
+    private:
+        std::atomic<int> waiters{0};
+        std::mutex mutex;
+        std::condition_variable cv;
+    };
+
+    /**
+     * @brief A bounded queue between two stages that threads can wait on, and that can be closed once no more values
+     * will be pushed
+     */
+    template <typename T>
+    class Channel {
+    public:
+        explicit Channel(const std::size_t& capacity) : queue(capacity) {}
+
+        /// Push a value if there is room for it without waiting, false if there wasn't
+        bool try_push(T& value) {
+            if (closed.load() || !queue.try_push(value)) { return false; }
+            not_empty.notify();
+            return true;
+        }
+
+        /// Push a value waiting for room for it, false if the channel was closed first
+        bool push(T& value) {
+            bool pushed = false;
+            not_full.wait([&] { return (pushed = !closed.load() && queue.try_push(value)) || closed.load(); });
+            if (pushed) { not_empty.notify(); }
+            return pushed;
+        }
+
+        /// Pop a value if there is one without waiting, false if there wasn't
+        bool try_pop(T& value) {
+            if (!queue.try_pop(value)) { return false; }
+            not_full.notify();
+            return true;
+        }
+
+        /// Pop a value waiting for one, false once the channel is closed and empty
+        bool pop(T& value) {
+            bool popped = false;
+            not_empty.wait([&] { return (popped = queue.try_pop(value)) || closed.load(); });
+            if (popped) { not_full.notify(); }
+            return popped;
+        }
+
+        /// Stop any more values being pushed, the ones already in the channel can still be popped
+        void close() {
+            closed.store(true);
+            not_empty.notify();
+            not_full.notify();
+        }
+
+        /// @return if the channel has been closed
+        bool is_closed() const {
+            return closed.load();
+        }
+
+    private:
+        BoundedQueue<T> queue;
+        std::atomic<bool> closed{false};
+        Wakeup not_empty;
+        Wakeup not_full;
+    };
+
+    template <typename...>
+    struct voider {
+        using type = void;
+    };
+
+    /// The result of submitting a frame to an engine with submit
+    template <typename Scalar, typename Engine, typename Mesh, typename Classified>
+    using submit_result = decltype(std::declval<const Engine&>().submit(std::declval<const Mesh&>(),
+                                                                        std::declval<const mat4<Scalar>&>(),
+                                                                        std::declval<const Lens<Scalar>&>(),
+                                                                        std::declval<const void*>(),
+                                                                        std::declval<const uint32_t&>(),
+                                                                        std::declval<Classified&&>()));
+
+    /**
+     * @brief How an engine classifies a frame, engines with submit return a future that the readback stage waits on
+     * and the rest classify straight into the result
+     */
+    template <typename Scalar, typename Engine, typename Mesh, typename Classified, typename = void>
+    struct Submission {
+        static constexpr bool async = false;
+        using type                  = Classified;
+    };
+
+    template <typename Scalar, typename Engine, typename Mesh, typename Classified>
+    struct Submission<Scalar,
+                      Engine,
+                      Mesh,
+                      Classified,
+                      typename voider<submit_result<Scalar, Engine, Mesh, Classified>>::type> {
+        static constexpr bool async = true;
+        using type                  = submit_result<Scalar, Engine, Mesh, Classified>;
+    };
+
+}  // namespace pipeline_detail
+
+/**
+ * @brief Runs frames from a camera through mesh lookup, classification and a callback on a thread per stage
+ *
+ * @details
+ *  A frame pushed into the pipeline goes through four stages, each on its own thread and connected by bounded
+ *  lock-free queues:
+ *   - lookup picks the mesh for the height of the camera, which for a LazyVisualMesh may need to generate it
+ *   - submit uploads the image and queues the classification, with an engine that has submit (OpenCL) this returns
+ *     as soon as the work is queued on the device, with the other engines the classification happens here
+ *   - readback waits for the device to finish and takes the classified mesh
+ *   - deliver calls the callback with the classified mesh
+ *  So while the device classifies one frame the next is being uploaded and queued, the one before is being read back
+ *  and the one before that is with the callback. The classified meshes are recycled once the callback returns, so
+ *  once the pipeline is warm it doesn't allocate them.
+ *
+ *  Frames that can't be held are dropped as the overload policy says, only before any work has been done on them.
+ *  The dropped callback is called with each frame that is dropped, along with the exception if it was dropped because
+ *  a stage failed. Either the callback or the dropped callback is called exactly once for every frame that push
+ *  accepted, so they are where the image buffer of a frame can be given back to the camera.
+ *
+ *  Stopping the pipeline, or destroying it, lets the frames that have already been pushed finish.
+ *
+ * @tparam Scalar     the scalar type used for calculations and storage (normally one of float or double)
+ * @tparam Model      the model of the meshes that are classified
+ * @tparam Engine     the engine that classifies the frames
+ * @tparam MeshSource the source of meshes for each height, a VisualMesh or LazyVisualMesh
+ */
+template <typename Scalar,
+          template <typename>
+          class Model,
+          typename Engine,
+          typename MeshSource = VisualMesh<Scalar, Model>>
+class FramePipeline {
+public:
+    using Classified = ClassifiedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS>;
+
+    /**
+     * @brief A frame from the camera
+     */
+    struct Frame {
+        /// The homogenous transformation matrix from the camera to the observation plane
+        mat4<Scalar> Hoc;
+        /// The lens parameters that describe the optics of the camera
+        Lens<Scalar> lens;
+        /// The image data, which must stay valid until the frame is delivered or dropped
+        const void* image = nullptr;
+        /// The pixel format of the image as a fourcc code
+        uint32_t format = 0;
+        /// An identifier for the frame chosen by the caller, such as the sequence number of the capture
+        uint64_t id = 0;
+    };
+
+    /// Called on the deliver thread with each frame and its classified mesh, which is recycled once this returns
+    using Callback = std::function<void(const Frame&, Classified&)>;
+    /// Called with each frame that is dropped, with the exception that caused it or null if it was dropped to make room
+    using Dropped = std::function<void(const Frame&, std::exception_ptr)>;
+
+    /**
+     * @brief Start the threads of a new pipeline
+     *
+     * @param meshes   the source of the mesh for each height, which must outlive the pipeline
+     * @param engine   the engine to classify with, which must outlive the pipeline
+     * @param callback called with each frame once it is classified
+     * @param options  the depth of the queues, what to do when they are full and where to run each stage
+     * @param dropped  called with each frame that is dropped
+     */
+    FramePipeline(MeshSource& meshes,
+                  const Engine& engine,
+                  Callback callback,
+                  const FramePipelineOptions& options,
+                  Dropped dropped = Dropped())
+      : meshes(meshes)
+      , engine(engine)
+      , callback(std::move(callback))
+      , dropped_callback(std::move(dropped))
+      , overload(options.overload)
+      , input(options.depth)
+      , looked_up(options.depth)
+      , in_flight(options.depth)
+      , classified(options.depth)
+      , recycled(options.depth * 4 + 4) {
+        threads.emplace_back([this] { lookup(); });
+        pin_thread(threads.back(), options.lookup_cpus);
+        threads.emplace_back([this] { submit(); });
+        pin_thread(threads.back(), options.submit_cpus);
+        threads.emplace_back([this] { readback(); });
+        pin_thread(threads.back(), options.readback_cpus);
+        threads.emplace_back([this] { deliver(); });
+        pin_thread(threads.back(), options.deliver_cpus);
+    }
+
+    /**
+     * @brief Start the threads of a new pipeline with the default options
+     *
+     * @param meshes   the source of the mesh for each height, which must outlive the pipeline
+     * @param engine   the engine to classify with, which must outlive the pipeline
+     * @param callback called with each frame once it is classified
+     */
+    FramePipeline(MeshSource& meshes, const Engine& engine, Callback callback)
+      : FramePipeline(meshes, engine, std::move(callback), FramePipelineOptions()) {}
+
+    FramePipeline(const FramePipeline&) = delete;
+    FramePipeline(FramePipeline&&)      = delete;
+    FramePipeline& operator=(const FramePipeline&) = delete;
+    FramePipeline& operator=(FramePipeline&&) = delete;
+
+    ~FramePipeline() {
+        stop();
+    }
+
+    /**
+     * @brief Push a frame from the camera into the pipeline
+     *
+     * @details
+     *  This may be called from several threads. If the pipeline is full the frame, or an older one, is dropped
+     *  depending on the overload policy, or this waits for room if the policy is to block.
+     *
+     * @param frame the frame to classify
+     *
+     * @return true if the frame was accepted, false if it was dropped or the pipeline has been stopped
+     */
+    bool push(const Frame& frame) {
+        Frame f = frame;
+        switch (overload) {
+            case OverloadPolicy::BLOCK: return input.push(f);
+            case OverloadPolicy::DROP_NEWEST:
+                if (input.try_push(f)) { return true; }
+                if (!input.is_closed()) { drop(frame, nullptr); }
+                return false;
+            case OverloadPolicy::DROP_OLDEST:
+                while (!input.try_push(f)) {
+                    if (input.is_closed()) { return false; }
+                    Frame oldest;
+                    if (input.try_pop(oldest)) { drop(oldest, nullptr); }
+                }
+                return true;
+            default: throw std::invalid_argument("Unknown overload policy");
+        }
+    }
+
+    /**
+     * @brief Stop accepting frames and wait for the ones that were accepted to be delivered
+     */
+    void stop() {
+        input.close();
+        for (auto& thread : threads) {
+            if (thread.joinable()) { thread.join(); }
+        }
+    }
+
+    /// @return the number of frames that have been delivered to the callback
+    uint64_t delivered() const {
+        return n_delivered.load();
+    }
+
+    /// @return the number of frames that have been dropped
+    uint64_t dropped() const {
+        return n_dropped.load();
+    }
+
+private:
+    using Submission = pipeline_detail::Submission<Scalar, Engine, Mesh<Scalar, Model>, Classified>;
+    using MeshHandle = std::shared_ptr<const Mesh<Scalar, Model>>;
+
+    /// A frame whose mesh has been found
+    struct LookedUp {
+        Frame frame;
+        MeshHandle mesh;
+    };
+
+    /// A frame whose classification has been submitted
+    struct InFlight {
+        Frame frame;
+        MeshHandle mesh;
+        typename Submission::type result;
+    };
+
+    /// A frame whose classification has finished
+    struct Done {
+        Frame frame;
+        Classified classified;
+    };
+
+    /// Meshes from a VisualMesh are owned by it, so the handle doesn't own them
+    static MeshHandle handle(const Mesh<Scalar, Model>& mesh) {
+        return MeshHandle(MeshHandle(), &mesh);
+    }
+
+    /// Meshes from a LazyVisualMesh are held until the frame is classified in case the cache drops them
+    static MeshHandle handle(MeshHandle mesh) {
+        return mesh;
+    }
+
+    typename Submission::type classify(const InFlight& f, Classified&& storage, std::true_type /*async*/) {
+        return engine.submit(*f.mesh, f.frame.Hoc, f.frame.lens, f.frame.image, f.frame.format, std::move(storage));
+    }
+
+    typename Submission::type classify(const InFlight& f, Classified&& storage, std::false_type /*async*/) {
+        engine(*f.mesh, f.frame.Hoc, f.frame.lens, f.frame.image, f.frame.format, storage);
+        return std::move(storage);
+    }
+
+    static Classified result(typename Submission::type& pending, std::true_type /*async*/) {
+        return pending.get();
+    }
+
+    static Classified result(typename Submission::type& pending, std::false_type /*async*/) {
+        return std::move(pending);
+    }
+
+    void drop(const Frame& frame, std::exception_ptr error) {
+        ++n_dropped;
+        if (dropped_callback) { dropped_callback(frame, error); }
+    }
+
+    void lookup() {
+        Frame frame;
+        while (input.pop(frame)) {
+            LookedUp l;
+            l.frame = frame;
+            try {
+                l.mesh = handle(meshes.height(frame.Hoc[2][3]));
+            }
+            catch (...) {
+                drop(frame, std::current_exception());
+                continue;
+            }
+            looked_up.push(l);
+        }
+        looked_up.close();
+    }
+
+    void submit() {
+        LookedUp l;
+        while (looked_up.pop(l)) {
+            InFlight f;
+            f.frame = l.frame;
+            f.mesh  = std::move(l.mesh);
+
+            // Reuse the memory of a classified mesh that has been delivered if there is one
+            Classified storage;
+            recycled.try_pop(storage);
+            try {
+                f.result = classify(f, std::move(storage), std::integral_constant<bool, Submission::async>());
+            }
+            catch (...) {
+                drop(f.frame, std::current_exception());
+                continue;
+            }
+            in_flight.push(f);
+        }
+        in_flight.close();
+    }
+
+    void readback() {
+        InFlight f;
+        while (in_flight.pop(f)) {
+            Done d;
+            d.frame = f.frame;
+            try {
+                d.classified = result(f.result, std::integral_constant<bool, Submission::async>());
+            }
+            catch (...) {
+                drop(f.frame, std::current_exception());
+                continue;
+            }
+            f.mesh.reset();
+            classified.push(d);
+        }
+        classified.close();
+    }
+
+    void deliver() {
+        Done d;
+        while (classified.pop(d)) {
+            try {
+                callback(d.frame, d.classified);
+                ++n_delivered;
+            }
+            catch (...) {
+                drop(d.frame, std::current_exception());
+            }
+            // If there are already plenty of spare meshes this one is freed
+            recycled.try_push(d.classified);
+        }
+    }
+
+    /// The source of the mesh for each height
+    MeshSource& meshes;
+    /// The engine that classifies the frames
+    const Engine& engine;
+    /// Called with each classified frame
+    Callback callback;
+    /// Called with each dropped frame
+    Dropped dropped_callback;
+    /// What to do with new frames when the pipeline is full
+    OverloadPolicy overload;
+
+    /// Frames waiting for their mesh to be found
+    pipeline_detail::Channel<Frame> input;
+    /// Frames waiting to be submitted to the engine
+    pipeline_detail::Channel<LookedUp> looked_up;
+    /// Frames being classified
+    pipeline_detail::Channel<InFlight> in_flight;
+    /// Frames waiting for the callback
+    pipeline_detail::Channel<Done> classified;
+    /// Classified meshes that have been delivered, whose memory is used for later frames
+    BoundedQueue<Classified> recycled;
+
+    /// The number of frames that have been delivered
+    std::atomic<uint64_t> n_delivered{0};
+    /// The number of frames that have been dropped
+    std::atomic<uint64_t> n_dropped{0};
+
+    /// The threads running each stage
+    std::vector<std::thread> threads;
+};
+
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_FRAME_PIPELINE_HPP
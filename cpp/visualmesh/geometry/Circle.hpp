@@ -39,7 +39,79 @@ namespace geometry {
          * @param intersections the number of intersections to ensure with this object
          * @param max_distance  the maximum distance we want to look for this object
          */
-        Circle(const Scalar& radius) : r(radius) {}
+        constexpr Circle(const Scalar& radius) : r(radius) {}
+
+        /**
+         * @brief The terms of the circle equations that only depend on the radius and the camera height
+         *
+         * @details
+         *  The circle equations are already cheap so this only holds the offset height, it exists so that code written
+         *  against the coefficients of a shape works for circles as well as spheres.
+         */
+        struct Coefficients {
+            /**
+             * @brief Calculate the coefficients for a circle at a camera height
+             *
+             * @param r the radius of the circle
+             * @param h the height of the camera above the observation plane
+             */
+            constexpr Coefficients(const Scalar& r, const Scalar& h) : r(r), h(h), h_r(h - r) {}
+
+            /**
+             * @brief Given a number of radial jumps (n), give the phi angle required to reach this point
+             *
+             * @param n the number of whole objects to jump from the origin to reach this point (from object centres)
+             *
+             * @return the phi angle to the centre of the object
+             */
+            Scalar phi(const Scalar& n) const {
+                return std::atan((Scalar(2.0) * n * r) / h);
+            }
+
+            /**
+             * @brief Given a phi angle calculate how many object jumps from the origin are required to reach it
+             *
+             * @param phi the phi angle measured from below the camera
+             *
+             * @return the number of object jumps that would be required to reach the angle to the centre of the object
+             */
+            Scalar n(const Scalar& phi) const {
+                return (h * std::tan(phi)) / (Scalar(2.0) * r);
+            }
+
+            /**
+             * @brief Given a value for n, return the angular width for an object
+             *
+             * @param n the n value for the ring we are calculating theta on
+             *
+             * @return the angular width of the object around a phi circle
+             */
+            Scalar theta(const Scalar& n) const {
+
+                // If n is < 0.5 then theta doesn't make sense, we interpolate from 2π to π to get a sensible
+                // approximation
+                return n <= 0.5 ? Scalar(2.0 * M_PI) / (1.0 + n * Scalar(2.0))
+                                : Scalar(2.0) * std::asin(r / (h_r * std::tan(phi(n))));
+            }
+
+            /// The radius of the circle
+            Scalar r;
+            /// The height of the camera above the observation plane
+            Scalar h;
+            /// The height of the camera above the observation plane less the radius of the circle
+            Scalar h_r;
+        };
+
+        /**
+         * @brief Calculate the coefficients of this circle for a camera height
+         *
+         * @param h the height of the camera above the observation plane
+         *
+         * @return the coefficients that can be used to evaluate this circle at this height
+         */
+        constexpr Coefficients coefficients(const Scalar& h) const {
+            return Coefficients(r, h);
+        }
 
         /**
          * @brief Given a number of radial jumps (n) give the phi angle required
@@ -60,7 +132,7 @@ namespace geometry {
          * end visually
          */
         Scalar phi(const Scalar& n, const Scalar& h) const {
-            return std::atan((Scalar(2.0) * n * r) / h);
+            return coefficients(h).phi(n);
         }
 
         /**
@@ -80,7 +152,7 @@ namespace geometry {
          * @return the number of object jumps that would be required to reach the angle to the centre of the object
          */
         Scalar n(const Scalar& phi, const Scalar& h) const {
-            return (h * std::tan(phi)) / (Scalar(2.0) * r);
+            return coefficients(h).n(phi);
         }
 
         /**
@@ -103,7 +175,7 @@ namespace geometry {
          * @return the ratio of intersections between the mesh with h_0 and h_1. To get the actual difference in
          *         intersections multiply the output of this by k
          */
-        Scalar k(const Scalar& h_0, const Scalar& h_1) const {
+        constexpr Scalar k(const Scalar& h_0, const Scalar& h_1) const {
             return h_0 / h_1;
         }
 
@@ -114,7 +186,7 @@ namespace geometry {
          *
          * @return Scalar the height of the centre of the object above the observation plane
          */
-        Scalar c() const {
+        constexpr Scalar c() const {
             return Scalar(0.0);
         }
 
@@ -131,10 +203,7 @@ namespace geometry {
          * @return the angular width of the object around a phi circle
          */
         Scalar theta(const Scalar& n, const Scalar& h) const {
-
-            // If n is < 0.5 then theta doesn't make sense, we interpolate from 2π to π to get a sensible approximation
-            return n <= 0.5 ? Scalar(2.0 * M_PI) / (1.0 + n * Scalar(2.0))
-                            : Scalar(2.0) * std::asin(r / ((h - r) * std::tan(phi(n, h))));
+            return coefficients(h).theta(n);
         }
 
         // The radius of the circle
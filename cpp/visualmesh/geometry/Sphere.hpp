@@ -37,7 +37,79 @@ namespace geometry {
          *
          * @param radius the radius of the sphere
          */
-        Sphere(const Scalar& radius) : r(radius) {}
+        constexpr Sphere(const Scalar& radius) : r(radius) {}
+
+        /**
+         * @brief The terms of the sphere equations that only depend on the radius and the camera height
+         *
+         * @details
+         *  Code that evaluates many n or φ values at a single height can make one of these first so the logarithm and
+         *  the offset height are only calculated once rather than once for each point.
+         */
+        struct Coefficients {
+            /**
+             * @brief Calculate the coefficients for a sphere at a camera height
+             *
+             * @param r the radius of the sphere
+             * @param h the height of the camera above the observation plane
+             */
+            Coefficients(const Scalar& r, const Scalar& h) : r(r), h_r(h - r), rate(std::log1p(-Scalar(2.0) * r / h)) {}
+
+            /**
+             * @brief Given a number of radial jumps (n), give the phi angle required to reach this point
+             *
+             * @param n the number of whole objects to jump from the origin to reach this point (from object centres)
+             *
+             * @return the phi angle to the centre of the object
+             */
+            Scalar phi(const Scalar& n) const {
+                return -std::atan(std::sinh(n * rate));
+            }
+
+            /**
+             * @brief Given a phi angle calculate how many object jumps from the origin are required to reach it
+             *
+             * @param phi the phi angle measured from below the camera
+             *
+             * @return the number of object jumps that would be required to reach the angle to the centre of the object
+             */
+            Scalar n(const Scalar& phi) const {
+                return std::asinh(std::tan(-phi)) / rate;
+            }
+
+            /**
+             * @brief Given a value for n, return the angular width for an object
+             *
+             * @param n the n value for the ring we are calculating theta on
+             *
+             * @return the angular width of the object around a phi circle
+             */
+            Scalar theta(const Scalar& n) const {
+
+                // If n is < 0.5 then theta doesn't make sense, we interpolate from 2π to π to get a sensible
+                // approximation
+                return n <= 0.5 ? Scalar(2.0 * M_PI) / (1.0 + n * Scalar(2.0))
+                                : Scalar(2.0) * std::asin(r / (h_r * std::tan(phi(n))));
+            }
+
+            /// The radius of the sphere
+            Scalar r;
+            /// The height of the camera above the centre of the sphere
+            Scalar h_r;
+            /// The logarithm that scales n to the hyperbolic angle to the object
+            Scalar rate;
+        };
+
+        /**
+         * @brief Calculate the coefficients of this sphere for a camera height
+         *
+         * @param h the height of the camera above the observation plane
+         *
+         * @return the coefficients that can be used to evaluate this sphere at this height
+         */
+        Coefficients coefficients(const Scalar& h) const {
+            return Coefficients(r, h);
+        }
 
         /**
          * @brief Given a number of radial jumps (n), give the phi angle required to reach this point
@@ -53,7 +125,7 @@ namespace geometry {
          * end visually
          */
         Scalar phi(const Scalar& n, const Scalar& h) const {
-            return -std::atan(std::sinh(n * std::log1p(-Scalar(2.0) * r / h)));
+            return coefficients(h).phi(n);
         }
 
         /**
@@ -77,7 +149,7 @@ namespace geometry {
          * @return the number of object jumps that would be required to reach the angle to the centre of the object
          */
         Scalar n(const Scalar& phi, const Scalar& h) const {
-            return std::asinh(std::tan(-phi)) / std::log1p(-Scalar(2.0) * r / h);
+            return coefficients(h).n(phi);
         }
 
         /**
@@ -110,7 +182,7 @@ namespace geometry {
          *
          * @return Scalar the height of the centre of the object above the observation plane
          */
-        const inline Scalar& c() const {
+        constexpr const Scalar& c() const {
             return r;
         }
 
@@ -127,10 +199,7 @@ namespace geometry {
          * @return the angular width of the object around a phi circle
          */
         Scalar theta(const Scalar& n, const Scalar& h) const {
-
-            // If n is < 0.5 then theta doesn't make sense, we interpolate from 2π to π to get a sensible approximation
-            return n <= 0.5 ? Scalar(2.0 * M_PI) / (1.0 + n * Scalar(2.0))
-                            : Scalar(2.0) * std::asin(r / ((h - r) * std::tan(phi(n, h))));
+            return coefficients(h).theta(n);
         }
 
         // The radius of the sphere
@@ -0,0 +1,355 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_INSTRUMENTATION_HPP
+#define VISUALMESH_INSTRUMENTATION_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace visualmesh {
+
+/// The stages of a frame that the engines time
+enum class Stage {
+    /// Finding the ranges of the mesh that are on the screen
+    LOOKUP,
+    /// Projecting the points to pixel coordinates and building their neighbourhood graph
+    PROJECT,
+    /// Copying the image, indices or graph to the device
+    UPLOAD,
+    /// Reading the pixels of every point from the image into the input of the network
+    LOAD_IMAGE,
+    /// A single convolutional group of the network
+    CONVOLUTION,
+    /// The early exit head and the rest of the network for the uncertain points
+    CASCADE,
+    /// Copying the results back from the device
+    READBACK
+};
+
+/**
+ * @brief Get a human readable name for a stage
+ *
+ * @param stage the stage to name
+ *
+ * @return the name of the stage in lowercase
+ */
+inline const char* stage_name(const Stage& stage) {
+    switch (stage) {
+        case Stage::LOOKUP: return "lookup";
+        case Stage::PROJECT: return "project";
+        case Stage::UPLOAD: return "upload";
+        case Stage::LOAD_IMAGE: return "load image";
+        case Stage::CONVOLUTION: return "convolution";
+        case Stage::CASCADE: return "cascade";
+        case Stage::READBACK: return "readback";
+        default: return "unknown";
+    }
+}
+
+/// The time a single stage of a frame took
+struct StageTiming {
+    /// The stage that was timed
+    Stage stage;
+    /// The convolutional group for a CONVOLUTION stage, -1 for every other stage
+    int group;
+    /// When the stage started relative to the start of the frame
+    std::chrono::nanoseconds start;
+    /// How long the stage took
+    std::chrono::nanoseconds duration;
+    /// If the stage was timed by the device rather than by the host
+    bool device;
+};
+
+/// The timing of every stage of a single frame
+struct FrameStats {
+    /// When the frame started on the host
+    std::chrono::steady_clock::time_point start;
+    /// How long the whole frame took on the host, including waiting for the device
+    std::chrono::nanoseconds total{0};
+    /// Every stage that was timed in the order they were recorded
+    std::vector<StageTiming> stages;
+
+    /**
+     * @brief Get the total time of every instance of a stage in this frame
+     *
+     * @param stage the stage to sum
+     *
+     * @return the sum of the durations of every timing for the stage
+     */
+    std::chrono::nanoseconds time(const Stage& stage) const {
+        std::chrono::nanoseconds sum{0};
+        for (const auto& s : stages) {
+            if (s.stage == stage) { sum += s.duration; }
+        }
+        return sum;
+    }
+};
+
+/**
+ * @brief Receives the stats of every frame that an instrumented engine runs
+ *
+ * @details
+ *  Frames are reported from the thread that ran them once they have finished, so an implementation must be safe to
+ *  call from several threads at once if the engine is.
+ */
+class Instrumentation {
+public:
+    Instrumentation()                       = default;
+    Instrumentation(const Instrumentation&) = default;
+    Instrumentation(Instrumentation&&)      = default;
+    Instrumentation& operator=(const Instrumentation&) = default;
+    Instrumentation& operator=(Instrumentation&&) = default;
+    virtual ~Instrumentation()                    = default;
+
+    /**
+     * @brief Called once for every frame after it has finished
+     *
+     * @param stats the timing of every stage of the frame
+     */
+    virtual void frame(const FrameStats& stats) = 0;
+};
+
+/**
+ * @brief Calls a function with the stats of every frame
+ */
+class FrameCallback : public Instrumentation {
+public:
+    explicit FrameCallback(std::function<void(const FrameStats&)> callback) : callback(std::move(callback)) {}
+
+    void frame(const FrameStats& stats) override {
+        callback(stats);
+    }
+
+private:
+    std::function<void(const FrameStats&)> callback;
+};
+
+/**
+ * @brief Writes every frame as Chrome trace events, which can be opened in chrome://tracing or Perfetto
+ *
+ * @details
+ *  Host stages are put on the thread that ran them and device stages on a separate device track. The stream must
+ *  outlive this object, the closing bracket of the trace is written when it is destroyed.
+ */
+class ChromeTrace : public Instrumentation {
+public:
+    explicit ChromeTrace(std::ostream& stream) : stream(stream), epoch(std::chrono::steady_clock::now()) {
+        stream << "[";
+    }
+
+    ChromeTrace(const ChromeTrace&) = delete;
+    ChromeTrace(ChromeTrace&&)      = delete;
+    ChromeTrace& operator=(const ChromeTrace&) = delete;
+    ChromeTrace& operator=(ChromeTrace&&) = delete;
+
+    ~ChromeTrace() override {
+        stream << "\n]\n";
+        stream.flush();
+    }
+
+    void frame(const FrameStats& stats) override {
+        using namespace std::chrono;  // NOLINT(google-build-using-namespace) fine in function scope
+
+        const auto tid    = std::hash<std::thread::id>()(std::this_thread::get_id()) % 1000000;
+        const double base = duration_cast<duration<double, std::micro>>(stats.start - epoch).count();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        event("frame", "frame", base, duration_cast<duration<double, std::micro>>(stats.total).count(), tid);
+        for (const auto& s : stats.stages) {
+            std::string name = stage_name(s.stage);
+            if (s.group >= 0) { name += " " + std::to_string(s.group); }
+            event(name,
+                  s.device ? "device" : "host",
+                  base + duration_cast<duration<double, std::micro>>(s.start).count(),
+                  duration_cast<duration<double, std::micro>>(s.duration).count(),
+                  s.device ? 0 : tid);
+        }
+        stream.flush();
+    }
+
+private:
+    void event(const std::string& name,
+               const char* category,
+               const double& ts,
+               const double& dur,
+               const std::size_t& tid) {
+        stream << (first ? "\n" : ",\n") << R"({"name":")" << name << R"(","cat":")" << category
+               << R"(","ph":"X","pid":1,"tid":)" << tid << R"(,"ts":)" << std::to_string(ts) << R"(,"dur":)"
+               << std::to_string(dur) << "}";
+        first = false;
+    }
+
+    /// The stream the trace is written to
+    std::ostream& stream;
+    /// The time that the trace timestamps are relative to
+    std::chrono::steady_clock::time_point epoch;
+    /// If no events have been written yet, so no comma is needed
+    bool first = true;
+    /// Serialises frames reported from several threads
+    std::mutex mutex;
+};
+
+#if !defined(VISUALMESH_DISABLE_INSTRUMENTATION)
+
+/**
+ * @brief Collects the timing of the stages of a single frame inside an engine and reports it when the frame finishes
+ *
+ * @details
+ *  A recorder made without an instrumentation does nothing, so an engine that isn't instrumented only pays for a
+ *  branch on each stage. Defining VISUALMESH_DISABLE_INSTRUMENTATION removes the recorder entirely.
+ */
+class FrameRecorder {
+public:
+    /**
+     * @brief Start recording a frame
+     *
+     * @param instrumentation where to report the frame, or nullptr to not record anything
+     */
+    explicit FrameRecorder(Instrumentation* instrumentation) : instrumentation(instrumentation) {
+        if (instrumentation != nullptr) {
+            stats.start = std::chrono::steady_clock::now();
+            anchor      = stats.start;
+        }
+    }
+
+    /// @return true if this recorder is recording
+    bool enabled() const {
+        return instrumentation != nullptr;
+    }
+
+    /// Times a stage on the host from when it is made until it is destroyed
+    class Scope {
+    public:
+        Scope(FrameRecorder& recorder, const Stage& stage, const int& group = -1)
+          : recorder(recorder.enabled() ? &recorder : nullptr), stage(stage), group(group) {
+            if (this->recorder != nullptr) { start = std::chrono::steady_clock::now(); }
+        }
+        Scope(const Scope&) = delete;
+        Scope(Scope&&)      = delete;
+        Scope& operator=(const Scope&) = delete;
+        Scope& operator=(Scope&&) = delete;
+        ~Scope() {
+            stop();
+        }
+
+        /// End the stage before the scope does, later calls do nothing
+        void stop() {
+            if (recorder != nullptr) {
+                const auto end = std::chrono::steady_clock::now();
+                recorder->stats.stages.push_back(
+                  StageTiming{stage, group, start - recorder->stats.start, end - start, false});
+                recorder = nullptr;
+            }
+        }
+
+    private:
+        FrameRecorder* recorder;
+        Stage stage;
+        int group;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    /**
+     * @brief Mark the time on the host that the device work of this frame was submitted
+     *
+     * @details
+     *  Device clocks are not the same as the host clock, so device stages are placed on the host timeline with the
+     *  first of them starting when the work was submitted. If this isn't called they start with the frame.
+     */
+    void submitted() {
+        if (enabled()) { anchor = std::chrono::steady_clock::now(); }
+    }
+
+    /**
+     * @brief Add a stage that was timed by the device
+     *
+     * @param stage the stage that was timed
+     * @param group the convolutional group for a CONVOLUTION stage, -1 for every other stage
+     * @param start when the stage started in nanoseconds on the device clock
+     * @param end   when the stage ended in nanoseconds on the device clock
+     */
+    void device(const Stage& stage, const int& group, const uint64_t& start, const uint64_t& end) {
+        if (enabled()) {
+            device_start = std::min(device_start, start);
+            stats.stages.push_back(StageTiming{stage,
+                                               group,
+                                               std::chrono::nanoseconds(start),
+                                               std::chrono::nanoseconds(end > start ? end - start : 0),
+                                               true});
+        }
+    }
+
+    /**
+     * @brief Finish the frame and report it to the instrumentation
+     */
+    void report() {
+        if (!enabled()) { return; }
+        stats.total = std::chrono::steady_clock::now() - stats.start;
+
+        // Move the device stages from the device clock onto the timeline of the frame
+        const auto offset = (anchor - stats.start) - std::chrono::nanoseconds(device_start);
+        for (auto& s : stats.stages) {
+            if (s.device) { s.start += offset; }
+        }
+        instrumentation->frame(stats);
+    }
+
+private:
+    /// Where the frame is reported, or nullptr if it isn't being recorded
+    Instrumentation* instrumentation;
+    /// The stats of the frame so far
+    FrameStats stats;
+    /// The host time that the first device stage is placed at
+    std::chrono::steady_clock::time_point anchor;
+    /// The earliest start of a device stage on the device clock
+    uint64_t device_start = std::numeric_limits<uint64_t>::max();
+};
+
+#else
+
+/// Does nothing as instrumentation has been disabled
+class FrameRecorder {
+public:
+    explicit FrameRecorder(Instrumentation* /*instrumentation*/) {}
+    constexpr bool enabled() const {
+        return false;
+    }
+    class Scope {
+    public:
+        Scope(FrameRecorder& /*recorder*/, const Stage& /*stage*/, const int& /*group*/ = -1) {}
+        void stop() {}
+    };
+    void submitted() {}
+    void device(const Stage& /*stage*/, const int& /*group*/, const uint64_t& /*start*/, const uint64_t& /*end*/) {}
+    void report() {}
+};
+
+#endif  // !defined(VISUALMESH_DISABLE_INSTRUMENTATION)
+
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_INSTRUMENTATION_HPP
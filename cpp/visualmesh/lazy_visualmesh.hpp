@@ -0,0 +1,352 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef VISUALMESH_LAZY_VISUALMESH_HPP
+#define VISUALMESH_LAZY_VISUALMESH_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "visualmesh/mesh.hpp"
+#include "visualmesh/model/ring6.hpp"
+#include "visualmesh/visualmesh.hpp"
+
+namespace visualmesh {
+
+/**
+ * @brief A VisualMesh that only generates the meshes for heights as they are used and keeps them within a memory budget
+ *
+ * @details
+ *  The heights are chosen the same way as VisualMesh, however a Mesh is not generated for a height until it is first
+ *  requested. Once the meshes that are held use more than the memory budget the least recently used ones are dropped,
+ *  and they will be generated again if they are requested later. Meshes are handed out as shared pointers so a mesh
+ *  that is dropped stays valid for anyone still using it. Optionally the meshes for the heights either side of a
+ *  requested height are generated on a background thread so that they are ready if the camera moves to them. These
+ *  prefetched meshes go in as the least recently used so they don't push out the meshes that are being used, and the
+ *  mesh that was last returned is never dropped.
+ *
+ *  All the functions are thread safe. If several threads request a height that isn't generated yet it is only
+ *  generated once and the other threads wait for it.
+ *
+ *  The OpenCL and Vulkan engines keep a copy of each mesh on the device. Passing a callback that calls the engine's
+ *  evict when a mesh is dropped frees its device copy straight away rather than when the engine's budget needs it, and
+ *  a callback that calls the engine's preload for the prefetched heights uploads them before they are needed.
+ *
+ * @tparam Scalar the type that will hold the vectors <float, double>
+ * @tparam Model  the model used to generate the mesh in each of the individual heights
+ */
+template <typename Scalar = float, template <typename> class Model = model::Ring6>
+class LazyVisualMesh {
+public:
+    /// Called with each mesh that is dropped from the cache, before the cache releases it
+    using Evicted = std::function<void(const Mesh<Scalar, Model>&)>;
+    /// Called on the prefetch thread with the mesh for each height either side of a requested height
+    using Prefetched = std::function<void(const Mesh<Scalar, Model>&)>;
+
+    /**
+     * @brief Setup a lazy visual mesh for the given shape, no meshes are generated until they are requested
+     *
+     * @tparam Shape the shape type that this mesh will generate using
+     *
+     * @param shape        the shape we are generating a visual mesh for
+     * @param min_height   the minimum height that our camera will be at
+     * @param max_height   the maximum height our camera will be at
+     * @param k            the number of intersections with the object
+     * @param max_error    the maximum amount of error in terms of k that a mesh can have
+     * @param max_distance the maximum distance that this mesh will project for
+     * @param max_bytes    the memory budget for the generated meshes, the most recently used mesh is always kept
+     * @param prefetch     generate the neighbouring heights of each requested height on a background thread
+     * @param evicted      called with each mesh as it is dropped from the cache
+     * @param prefetched   called with each neighbouring mesh once it is generated, even if it already was
+     */
+    template <typename Shape>
+    LazyVisualMesh(const Shape& shape,
+                   const Scalar& min_height,
+                   const Scalar& max_height,
+                   const Scalar& k,
+                   const Scalar& max_error,
+                   const Scalar& max_distance,
+                   const std::size_t& max_bytes,
+                   const bool& prefetch   = false,
+                   const Evicted& evicted       = Evicted(),
+                   const Prefetched& prefetched = Prefetched())
+      : heights(VisualMesh<Scalar, Model>::required_heights(shape, min_height, max_height, k, max_error))
+      , slots(heights.size())
+      , max_bytes(max_bytes)
+      , evicted(evicted)
+      , prefetched(prefetched)
+      , generate([shape, k, max_distance](const Scalar& h) {
+          return std::make_shared<const Mesh<Scalar, Model>>(shape, h, k, max_distance);
+      }) {
+        if (prefetch) { prefetcher = std::thread([this] { run_prefetch(); }); }
+    }
+
+    LazyVisualMesh(const LazyVisualMesh&) = delete;
+    LazyVisualMesh(LazyVisualMesh&&)      = delete;
+    LazyVisualMesh& operator=(const LazyVisualMesh&) = delete;
+    LazyVisualMesh& operator=(LazyVisualMesh&&) = delete;
+
+    ~LazyVisualMesh() {
+        /* mutex scope */ {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+        wake.notify_all();
+        if (prefetcher.joinable()) { prefetcher.join(); }
+    }
+
+    /**
+     * @brief Get the mesh for the height that is closest to the requested height, generating it if needed
+     *
+     * @details
+     *  If this lookup is out of range, it will return the highest or lowest mesh (whichever is closer)
+     *
+     * @param height the height above the observation plane for the mesh we are trying to find
+     *
+     * @return the closest visual mesh to the provided height
+     */
+    std::shared_ptr<const Mesh<Scalar, Model>> height(const Scalar& height) {
+        const std::size_t i = closest(height);
+        auto mesh           = get(i, false);
+
+        if (prefetcher.joinable()) {
+            /* mutex scope */ {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (i > 0) { queue(i - 1); }
+                if (i + 1 < slots.size()) { queue(i + 1); }
+            }
+            wake.notify_one();
+        }
+
+        return mesh;
+    }
+
+    /**
+     * @brief Get the heights that meshes will be generated at
+     *
+     * @return the heights sorted from lowest to highest
+     */
+    const std::vector<Scalar>& mesh_heights() const {
+        return heights;
+    }
+
+    /**
+     * @brief Get the amount of memory that is used by the meshes currently held
+     *
+     * @return the number of bytes held by the cached meshes
+     */
+    std::size_t bytes() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return used_bytes;
+    }
+
+private:
+    /// The state of the mesh for one of the heights
+    struct Slot {
+        /// The mesh if it has been generated and not evicted
+        std::shared_ptr<const Mesh<Scalar, Model>> mesh;
+        /// If a thread is currently generating this mesh
+        bool building = false;
+        /// If this slot is waiting in the prefetch queue
+        bool queued = false;
+        /// The memory used by the mesh
+        std::size_t bytes = 0;
+        /// The position of this slot in the least recently used list
+        typename std::list<std::size_t>::iterator lru;
+    };
+
+    /**
+     * @brief Find the index of the height closest to the requested height
+     *
+     * @param height the height to look for
+     *
+     * @return the index into heights of the closest height
+     */
+    std::size_t closest(const Scalar& height) const {
+        auto it = std::lower_bound(heights.begin(), heights.end(), height);
+
+        // First element that is >= is the first one (we are off the low end)
+        if (it == heights.begin()) { return 0; }
+
+        // We don't have an element that >= height (we are off the high end)
+        if (it == heights.end()) { return heights.size() - 1; }
+
+        // Otherwise see if this element has less error than the previous one
+        const std::size_t i = std::distance(heights.begin(), it);
+        return std::abs(*it - height) < std::abs(*std::prev(it) - height) ? i : i - 1;
+    }
+
+    /**
+     * @brief Get the mesh in a slot, generating it if it isn't held and waiting for it if another thread is
+     *
+     * @param i        the index of the slot
+     * @param prefetch true if the mesh is for the prefetch thread rather than for a caller, which leaves it as the
+     *                 least recently used
+     *
+     * @return the mesh for the slot
+     */
+    std::shared_ptr<const Mesh<Scalar, Model>> get(const std::size_t& i, const bool& prefetch) {
+        std::unique_lock<std::mutex> lock(mutex);
+        Slot& slot = slots[i];
+        built.wait(lock, [&slot] { return !slot.building; });
+
+        // Already generated, move it to the front of the list if a caller is using it
+        if (slot.mesh != nullptr) {
+            if (!prefetch) {
+                lru.splice(lru.begin(), lru, slot.lru);
+                last = i;
+            }
+            return slot.mesh;
+        }
+
+        // Generate it without holding the lock so other heights can still be used
+        slot.building = true;
+        lock.unlock();
+        std::shared_ptr<const Mesh<Scalar, Model>> mesh;
+        try {
+            mesh = generate(heights[i]);
+        }
+        catch (...) {
+            lock.lock();
+            slot.building = false;
+            built.notify_all();
+            throw;
+        }
+        lock.lock();
+
+        slot.building = false;
+        slot.mesh     = mesh;
+        slot.bytes    = mesh->bytes();
+        used_bytes += slot.bytes;
+        if (prefetch) { slot.lru = lru.insert(lru.end(), i); }
+        else {
+            slot.lru = lru.insert(lru.begin(), i);
+            last     = i;
+        }
+
+        // Drop the least recently used meshes until we are within budget, but always keep the one we just made and the
+        // one that was last returned to a caller
+        std::vector<std::shared_ptr<const Mesh<Scalar, Model>>> dropped;
+        for (auto it = lru.end(); used_bytes > max_bytes && it != lru.begin();) {
+            --it;
+            if (*it == i || *it == last) { continue; }
+            Slot& old = slots[*it];
+            it        = lru.erase(it);
+            used_bytes -= old.bytes;
+            old.bytes = 0;
+            dropped.push_back(std::move(old.mesh));
+            old.mesh = nullptr;
+        }
+        built.notify_all();
+        lock.unlock();
+
+        // Tell the user about the dropped meshes without the lock held in case they call back into us
+        if (evicted) {
+            for (const auto& m : dropped) {
+                evicted(*m);
+            }
+        }
+
+        return mesh;
+    }
+
+    /**
+     * @brief Add a slot to the prefetch queue if it isn't being generated, and either isn't held or there is a
+     * prefetched callback to give it to. Must be called with the lock held.
+     *
+     * @param i the index of the slot
+     */
+    void queue(const std::size_t& i) {
+        Slot& slot = slots[i];
+        if ((slot.mesh == nullptr || prefetched) && !slot.building && !slot.queued) {
+            slot.queued = true;
+            prefetch_queue.push_back(i);
+        }
+    }
+
+    /// The main loop for the prefetch thread
+    void run_prefetch() {
+        while (true) {
+            std::size_t i;
+            /* mutex scope */ {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return !running || !prefetch_queue.empty(); });
+                if (!running) { return; }
+                i = prefetch_queue.front();
+                prefetch_queue.pop_front();
+                slots[i].queued = false;
+            }
+
+            // If generating fails here the error will be seen again when the height is actually requested
+            try {
+                auto mesh = get(i, true);
+                if (prefetched) { prefetched(*mesh); }
+            }
+            catch (...) {
+            }
+        }
+    }
+
+    /// The heights that meshes are generated at
+    std::vector<Scalar> heights;
+    /// The state of the mesh for each height
+    std::vector<Slot> slots;
+    /// The slots that hold a mesh, most recently used first
+    std::list<std::size_t> lru;
+    /// The slot that was last returned to a caller, which is never dropped
+    std::size_t last = std::numeric_limits<std::size_t>::max();
+    /// The memory used by the meshes that are held
+    std::size_t used_bytes = 0;
+    /// The memory budget for the meshes
+    std::size_t max_bytes;
+    /// Called when a mesh is dropped
+    Evicted evicted;
+    /// Called with each mesh the prefetch thread has made sure of
+    Prefetched prefetched;
+    /// Generates the mesh for a height
+    std::function<std::shared_ptr<const Mesh<Scalar, Model>>(const Scalar&)> generate;
+
+    /// Slots waiting to be generated by the prefetch thread
+    std::deque<std::size_t> prefetch_queue;
+    /// If the prefetch thread should keep running
+    bool running = true;
+    /// Guards the slots, the lru list and the prefetch queue
+    mutable std::mutex mutex;
+    /// Used to wake threads waiting for a mesh that another thread is generating
+    std::condition_variable built;
+    /// Used to wake the prefetch thread
+    std::condition_variable wake;
+    /// The thread that generates neighbouring heights in the background
+    std::thread prefetcher;
+};
+
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_LAZY_VISUALMESH_HPP
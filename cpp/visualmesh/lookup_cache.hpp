@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef VISUALMESH_LOOKUP_CACHE_HPP
+#define VISUALMESH_LOOKUP_CACHE_HPP
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "lens.hpp"
+#include "utility/math.hpp"
+
+namespace visualmesh {
+
+/**
+ * @brief The state kept between consecutive lookups of a mesh so that a lookup can reuse the work of the last one
+ *
+ * @details
+ *  When the camera has rotated by less than the tolerance since the reference frame, the parts of the BSP that were
+ *  entirely on or entirely off the screen for any rotation within the tolerance are reused as is and only the BSP
+ *  elements near the edge of the screen are checked again. Once the camera moves further than the tolerance, or the
+ *  lens or mesh changes, the frontier is rebuilt from the current frame.
+ *
+ * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+ */
+template <typename Scalar>
+struct LookupCache {
+    /// How a segment of the mesh is treated when the cache is reused
+    enum Kind : int8_t { INSIDE, OUTSIDE, CHECK };
+
+    /// A contiguous range of the mesh that is handled the same way
+    struct Segment {
+        /// The bounds of the range (start to one past the end)
+        std::pair<int, int> range;
+        /// The BSP element that must be checked again for CHECK segments, -1 otherwise
+        int element;
+        /// If the range is on screen, off screen, or needs to be checked again each lookup
+        Kind kind;
+    };
+
+    /**
+     * @brief Construct a new empty lookup cache
+     *
+     * @param tolerance the largest rotation of the camera in radians that the cache will be reused for. Larger values
+     *                  rebuild less often but leave more points to be checked individually.
+     */
+    explicit LookupCache(const Scalar& tolerance = Scalar(0.005)) : tolerance(tolerance) {}
+
+    /**
+     * @brief Check if two lenses project rays identically, in which case the frontier can be reused between them
+     *
+     * @return true if every parameter of the two lenses is the same
+     */
+    static bool same_lens(const Lens<Scalar>& a, const Lens<Scalar>& b) {
+        return a.dimensions == b.dimensions && a.projection == b.projection && a.focal_length == b.focal_length
+               && a.centre == b.centre && a.k == b.k && a.fov == b.fov;
+    }
+
+    /**
+     * @brief Check if the frontier in this cache can be used for the provided mesh and camera
+     *
+     * @param mesh_id the identifier of the mesh that is being looked up
+     * @param Rco     the rotation from observation plane space to camera space for this frame
+     * @param lens    the lens that is used for this frame
+     *
+     * @return true if the frontier was built for this mesh and lens, and the camera is within the tolerance of it
+     */
+    bool valid(const uint64_t& mesh_id, const mat3<Scalar>& Rco, const Lens<Scalar>& lens) const {
+        if (mesh_id != mesh || !same_lens(reference_lens, lens)) { return false; }
+
+        // The angle of the rotation between two rotation matrices comes from the trace of Rᵀ R' = 1 + 2 cos(θ)
+        Scalar trace = 0;
+        for (int i = 0; i < 3; ++i) {
+            trace += dot(reference_Rco[i], Rco[i]);
+        }
+        return (trace - Scalar(1.0)) * Scalar(0.5) >= std::cos(tolerance);
+    }
+
+    /**
+     * @brief Add a segment to the end of the frontier, merging inside and outside segments with the last segment if it
+     * is the same kind
+     *
+     * @param range   the range of the mesh that the segment represents
+     * @param kind    how this range is to be treated when the cache is reused
+     * @param element the BSP element to check again for CHECK segments
+     */
+    void add(const std::pair<int, int>& range, const Kind& kind, const int& element = -1) {
+        if (kind != CHECK && !frontier.empty() && frontier.back().kind == kind
+            && frontier.back().range.second == range.first) {
+            frontier.back().range.second = range.second;
+        }
+        else {
+            frontier.push_back(Segment{range, element, kind});
+        }
+    }
+
+    /// Forget the reference frame so the next lookup rebuilds the frontier
+    void clear() {
+        mesh = 0;
+        frontier.clear();
+    }
+
+    /// The largest rotation in radians from the reference frame that the frontier is valid for
+    Scalar tolerance;
+    /// The identifier of the mesh the frontier was built for, 0 if there is no frontier
+    uint64_t mesh = 0;
+    /// The rotation from observation plane space to camera space of the reference frame
+    mat3<Scalar> reference_Rco{};
+    /// The lens of the reference frame
+    Lens<Scalar> reference_lens{};
+    /// The segments of the mesh in the order a lookup produces them
+    std::vector<Segment> frontier;
+    /// The number of times the frontier has been rebuilt
+    std::size_t rebuilds = 0;
+};
+
+/**
+ * @brief Runs mesh lookups for an engine, reusing a LookupCache per mesh when incremental lookup is enabled
+ *
+ * @details
+ *  Each mesh gets its own cache. If two threads look up the same mesh at once, one of them does a full lookup rather
+ *  than waiting, so several cameras can share an engine and a mesh, but they will mostly fall back to full lookups as
+ *  each camera invalidates the reference frame of the other.
+ *
+ * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+ */
+template <typename Scalar>
+class IncrementalLookup {
+public:
+    /**
+     * @brief Construct a new incremental lookup
+     *
+     * @param tolerance the largest rotation in radians that a cache is reused for, 0 disables incremental lookup
+     */
+    explicit IncrementalLookup(const Scalar& tolerance = Scalar(0)) : tolerance(tolerance) {}
+
+    /**
+     * @brief Lookup which ranges in the mesh are on screen
+     *
+     * @tparam MeshType the type of the mesh that is being looked up
+     *
+     * @param mesh  the mesh to lookup
+     * @param Hoc   the homogenous transformation matrix that transforms from camera space to observation plane space
+     * @param lens  the lens object describing the type and geometry of the lens that is used
+     *
+     * @return pairs of start/end ranges that are the points which are on the screen
+     */
+    template <typename MeshType>
+    std::vector<std::pair<int, int>> operator()(const MeshType& mesh,
+                                                const mat4<Scalar>& Hoc,
+                                                const Lens<Scalar>& lens) const {
+        std::vector<std::pair<int, int>> ranges;
+        (*this)(mesh, Hoc, lens, ranges);
+        return ranges;
+    }
+
+    /**
+     * @brief Lookup which ranges in the mesh are on screen, writing them into an existing list
+     *
+     * @details
+     *  The list is cleared first but keeps its memory, so once it is large enough a lookup doesn't allocate.
+     *
+     * @tparam MeshType the type of the mesh that is being looked up
+     *
+     * @param mesh   the mesh to lookup
+     * @param Hoc    the homogenous transformation matrix that transforms from camera space to observation plane space
+     * @param lens   the lens object describing the type and geometry of the lens that is used
+     * @param output the list to write the pairs of start/end ranges of the points which are on the screen into
+     */
+    template <typename MeshType>
+    void operator()(const MeshType& mesh,
+                    const mat4<Scalar>& Hoc,
+                    const Lens<Scalar>& lens,
+                    std::vector<std::pair<int, int>>& output) const {
+        if (tolerance <= 0) { return mesh.lookup(Hoc, lens, output); }
+
+        std::shared_ptr<Entry> entry;
+        /* mutex scope */ {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto& e = caches[&mesh];
+            if (!e) { e = std::make_shared<Entry>(tolerance); }
+            entry = e;
+        }
+
+        // Don't make someone else wait on this mesh, a full lookup is cheaper than waiting
+        std::unique_lock<std::mutex> lock(entry->mutex, std::try_to_lock);
+        if (!lock.owns_lock()) { return mesh.lookup(Hoc, lens, output); }
+        mesh.lookup(Hoc, lens, entry->cache, output);
+    }
+
+    /// Clear the caches for every mesh
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        caches.clear();
+    }
+
+    /// The largest rotation in radians that a cache is reused for, 0 if incremental lookup is disabled
+    const Scalar tolerance;
+
+private:
+    /// The cache for a single mesh and the mutex that guards it
+    struct Entry {
+        explicit Entry(const Scalar& tolerance) : cache(tolerance) {}
+        std::mutex mutex;
+        LookupCache<Scalar> cache;
+    };
+
+    /// Guards the map of caches
+    mutable std::mutex mutex;
+    /// The caches for each mesh that has been looked up
+    mutable std::map<const void*, std::shared_ptr<Entry>> caches;
+};
+
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_LOOKUP_CACHE_HPP
@@ -20,22 +20,31 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cmath>
+#include <cstdint>
+#include <cstddef>
 #include <cstdlib>
 #include <iterator>
 #include <limits>
+#include <memory>
 #include <numeric>
 #include <stdexcept>
+#include <string>
 #include <tuple>
 #include <type_traits>
 #include <utility>
 #include <vector>
 
 #include "lens.hpp"
+#include "lookup_cache.hpp"
 #include "node.hpp"
+#include "region.hpp"
 #include "utility/cone.hpp"
 #include "utility/math.hpp"
 #include "utility/projection.hpp"
+#include "utility/serialisation.hpp"
+#include "utility/thread_pool.hpp"
 
 namespace visualmesh {
 
@@ -47,8 +56,8 @@ namespace visualmesh {
  *  transforms it into a structure that is suppored as a BSP tree. It then uses this tree to lookup the mesh given
  *  different lens paramters. Note that because of the way it does the lookup, this lookup isn't perfect esperically for
  *  fisheye lenses. In this case it will sometimes give points that are outside the bounds of the image. The CPU engine
- *  removes these extra points however the OpenCL engine does not. So if you are relying on these pixel coordinates
- *  being in bounds you should ensure that you use either use the CPU engine or filter them out afterwards yourself.
+ *  removes these extra points, and the OpenCL engine does when it looks up or culls the points on the device. So if you
+ *  are relying on these pixel coordinates being in bounds you should use one of those or filter them out yourself.
  *
  * @tparam Scalar     the scalar type used for calculations and storage (normally one of float or double)
  * @tparam Model      the model that is used to build the Visual Mesh graph
@@ -81,6 +90,55 @@ private:
         std::pair<vec3<Scalar>, vec2<Scalar>> cone;
     };
 
+    /**
+     * @brief An element of the BSP as it is stored for lookup.
+     *
+     * @details
+     *  The elements are stored in depth first order, so the first child of an element is always the element after it
+     *  and its second child is the element after the end of the first child's subtree. Rather than child indices each
+     *  element stores skip, the element after the end of its own subtree. A lookup then walks forward through the list
+     *  without a stack, moving to the next element to descend and to skip to jump over a subtree that is decided. An
+     *  element is a leaf when skip is the next element.
+     */
+    struct LookupElement {
+        /// The cone axis and the cos and sin of the cone angle, as in BSP
+        std::pair<vec3<Scalar>, vec2<Scalar>> cone;
+        /// The bounds of the range that this element represents (start to one past the end)
+        std::pair<int, int> range;
+        /// The element after the end of the subtree of this element
+        int skip;
+    };
+
+    /**
+     * @brief A subtree of the BSP whose construction has been deferred so that it can be built on another thread
+     *
+     * @tparam Iterator the type of the iterator over the node indices
+     */
+    template <typename Iterator>
+    struct BSPTask {
+        /// The range of node indices this subtree covers
+        Iterator start;
+        Iterator end;
+        /// The offset from the start of the nodes list to the region this subtree represents
+        int offset;
+        /// The depth of the root of this subtree
+        int depth;
+        /// The element in the main tree that will be replaced with the root of this subtree
+        int index;
+        /// The elements of this subtree where the element at 0 is the root
+        std::vector<BSP> tree;
+    };
+
+    /// Parameters controlling how the BSP is built
+    struct BSPOptions {
+        /// The number of points that the algorithm terminates at
+        int min_points;
+        /// Elements above this depth use approximate_cone instead of bounding_cone
+        int approximate_depth;
+        /// Elements at this depth are deferred as tasks rather than built, or -1 to build everything
+        int task_depth;
+    };
+
     /**
      * @brief Given a set of points, find the smallest cone that contains all points
      *
@@ -117,6 +175,37 @@ private:
                               vec2<Scalar>{cone.second, std::sqrt(Scalar(1.0) - cone.second * cone.second)});
     }
 
+    /**
+     * @brief Find a cone that contains all the points in a single pass
+     *
+     * @details
+     *  The axis of the cone is the mean of the rays and the angle is the widest ray from that axis. This is not the
+     *  smallest cone, so a few more points may be checked during lookup, however it always contains every point so the
+     *  lookup remains correct. If the mean is degenerate (the rays cancel out) this falls back to bounding_cone.
+     *
+     * @tparam Iterator the type of the iterator passed in
+     *
+     * @param start the start iterator of points to consider for the cone
+     * @param end   the end iterator of points to consider for the cone
+     */
+    template <typename Iterator>
+    std::pair<vec3<Scalar>, vec2<Scalar>> approximate_cone(Iterator start, Iterator end) {
+        vec3<Scalar> sum = {0, 0, 0};
+        for (auto it = start; it != end; ++it) {
+            sum = add(sum, nodes[*it].ray);
+        }
+        if (norm(sum) < std::numeric_limits<Scalar>::epsilon() * std::distance(start, end)) {
+            return bounding_cone(start, end);
+        }
+
+        const vec3<Scalar> axis = normalise(sum);
+        Scalar cos_theta        = Scalar(1.0);
+        for (auto it = start; it != end; ++it) {
+            cos_theta = std::min(cos_theta, dot(axis, nodes[*it].ray));
+        }
+        return std::make_pair(axis, vec2<Scalar>{cos_theta, std::sqrt(Scalar(1.0) - cos_theta * cos_theta)});
+    }
+
     /**
      * @brief Given an iterator to a set of Visual Mesh nodes, calculate a binary search partition for it
      *
@@ -127,26 +216,36 @@ private:
      *
      * @tparam Iterator the type of the iterator passed in, must evalute to an object of type Node
      *
-     * @param start       the start iterator of points to sort into the bsp
-     * @param end         the end iterator of points to sort into the bsp
-     * @param min_points  the number of points that the algorithm terminates at
-     * @param offset      the offset from the start of the nodes list to the region this BSP node represents
+     * @param start   the start iterator of points to sort into the bsp
+     * @param end     the end iterator of points to sort into the bsp
+     * @param tree    the list of bsp elements to add the new elements to
+     * @param options the parameters controlling how the tree is built
+     * @param tasks   the list that subtrees at options.task_depth are deferred to
+     * @param depth   the depth of the element being built in the whole tree
+     * @param offset  the offset from the start of the nodes list to the region this BSP node represents
      */
     template <typename Iterator>
-    int build_bsp(Iterator start, Iterator end, int min_points = 8, int offset = 0) {
+    int build_bsp(Iterator start,
+                  Iterator end,
+                  std::vector<BSP>& tree,
+                  const BSPOptions& options,
+                  std::vector<BSPTask<Iterator>>* tasks = nullptr,
+                  int depth                             = 0,
+                  int offset                            = 0) {
         // No points in this partition, this should never happen
         if (std::distance(start, end) == 0) { throw std::runtime_error("We tried to make a tree with no nodes"); }
 
         // If we have few enough points, terminate the search here and return what we have. It can be cheaper to project
         // a list of pixels than to do more BSP steps. This also makes it cheaper to build the BSP and less memory to
         // store.
-        if (std::distance(start, end) <= min_points) {
-            int elem = bsp.size();
+        if (std::distance(start, end) <= options.min_points) {
+            int elem = tree.size();
 
             // Add this element with children -1,-1 to signify it has no children
-            bsp.push_back(BSP{std::make_pair(offset, static_cast<int>(offset + std::distance(start, end))),
-                              {{-1, -1}},
-                              bounding_cone(start, end)});
+            tree.push_back(BSP{std::make_pair(offset, static_cast<int>(offset + std::distance(start, end))),
+                               {{-1, -1}},
+                               depth < options.approximate_depth ? approximate_cone(start, end)
+                                                                 : bounding_cone(start, end)});
 
             // By default, sort by index that they were generated with to remove the remaining randomness
             std::sort(start, end);
@@ -154,8 +253,18 @@ private:
             return elem;
         }
 
+        // Leave a placeholder for this subtree so it can be built later, possibly on another thread
+        if (tasks != nullptr && depth == options.task_depth) {
+            int elem = tree.size();
+            tree.push_back(BSP{std::make_pair(offset, static_cast<int>(offset + std::distance(start, end))),
+                               {{-1, -1}},
+                               {}});
+            tasks->push_back(BSPTask<Iterator>{start, end, offset, depth, elem, {}});
+            return elem;
+        }
+
         // We treat the first element specially
-        if (bsp.empty()) {
+        if (depth == 0) {
             // The first tree is always a split in the theta angle, and it split between +y from -y so that future loops
             // can sort purely based on x value making for a faster algorithm
 
@@ -176,21 +285,22 @@ private:
             // Partition based on the sign of the y component
             Iterator mid = std::partition(start, end, [this](const int& a) { return nodes[a].ray[1] > 0; });
 
-            bsp.push_back(BSP{
-              std::make_pair(offset, static_cast<int>(std::distance(start, end))),
+            int elem = tree.size();
+            tree.push_back(BSP{
+              std::make_pair(offset, static_cast<int>(offset + std::distance(start, end))),
               {{-1, -1}},
               cone,
             });
-            bsp.front().children = {{
-              build_bsp(start, mid, min_points, 0),
-              build_bsp(mid, end, min_points, std::distance(start, mid)),
-            }};
-            return 0;
+            // Evaluate the children in order so the left subtree is always laid out first
+            const int left  = build_bsp(start, mid, tree, options, tasks, depth + 1, offset);
+            const int right = build_bsp(mid, end, tree, options, tasks, depth + 1, offset + std::distance(start, mid));
+            tree[elem].children = {{left, right}};
+            return elem;
         }
 
         // Calculate our bounding cone for this cluster. We have to do a random sort of our segment here so that the
         // performance of the bounding cone algorithm is expected to be linear
-        auto cone = bounding_cone(start, end);
+        auto cone = depth < options.approximate_depth ? approximate_cone(start, end) : bounding_cone(start, end);
 
         // Find the extents of our data
         Scalar min_phi   = std::numeric_limits<Scalar>::max();
@@ -234,19 +344,119 @@ private:
                   return nodes[a].ray[0] / std::sqrt(1 - nodes[a].ray[2] * nodes[a].ray[2]) < split_theta;
               });
 
-        int elem = bsp.size();
-        bsp.push_back(BSP{
+        int elem = tree.size();
+        tree.push_back(BSP{
           std::make_pair(offset, static_cast<int>(offset + std::distance(start, end))),
           {{-1, -1}},
           cone,
         });
-        bsp[elem].children = {{
-          build_bsp(start, mid, min_points, offset),
-          build_bsp(mid, end, min_points, offset + std::distance(start, mid)),
-        }};
+        const int left      = build_bsp(start, mid, tree, options, tasks, depth + 1, offset);
+        const int right     = build_bsp(mid, end, tree, options, tasks, depth + 1, offset + std::distance(start, mid));
+        tree[elem].children = {{left, right}};
         return elem;
     }
 
+    /**
+     * @brief Build the BSP splitting the work between the threads of a thread pool
+     *
+     * @details
+     *  The top of the tree is built on the calling thread until there are enough subtrees to keep every thread busy.
+     *  These subtrees cover disjoint ranges of the nodes so they are then built concurrently each into their own list.
+     *  Finally the subtrees are joined into the tree. The subtrees are not in depth first order in the joined tree, but
+     *  once flatten has laid it out the result is the same as building the whole tree on one thread.
+     *
+     * @tparam Iterator the type of the iterator passed in, must evalute to an object of type Node
+     *
+     * @param start   the start iterator of points to sort into the bsp
+     * @param end     the end iterator of points to sort into the bsp
+     * @param options the parameters controlling how the tree is built, the task_depth is chosen from the pool size
+     * @param pool    the thread pool to build the subtrees on
+     *
+     * @return the elements of the tree where the element at 0 is the root
+     */
+    template <typename Iterator>
+    std::vector<BSP> build_bsp(Iterator start, Iterator end, BSPOptions options, ThreadPool& pool) {
+        // Aim for a few subtrees per thread so that uneven subtrees balance out
+        options.task_depth = 0;
+        while ((1u << options.task_depth) < pool.size() * 4) {
+            ++options.task_depth;
+        }
+        // The root split is special so it always needs to be built here
+        options.task_depth = std::max(options.task_depth, 1);
+
+        std::vector<BSPTask<Iterator>> tasks;
+        std::vector<BSP> tree;
+        build_bsp(start, end, tree, options, &tasks);
+
+        pool.parallel_for(tasks.size(), [&](const std::size_t& first, const std::size_t& last) {
+            for (std::size_t i = first; i < last; ++i) {
+                auto& task = tasks[i];
+                build_bsp<Iterator>(task.start, task.end, task.tree, options, nullptr, task.depth, task.offset);
+            }
+        });
+
+        // Put the root of each subtree in its placeholder and the rest at the end, moving their child indices to match
+        for (auto& task : tasks) {
+            const int base   = static_cast<int>(tree.size()) - 1;
+            auto relocate    = [&](std::array<int, 2>& children) {
+                for (int& c : children) {
+                    if (c > 0) { c += base; }
+                }
+            };
+            tree[task.index] = task.tree.front();
+            relocate(tree[task.index].children);
+            for (auto it = std::next(task.tree.begin()); it != task.tree.end(); ++it) {
+                tree.push_back(*it);
+                relocate(tree.back().children);
+            }
+        }
+
+        return tree;
+    }
+
+    /**
+     * @brief Lay out a BSP tree for lookup.
+     *
+     * @details
+     *  The tree is laid out depth first, first child first, which is the order a single threaded build produces. Every
+     *  element must be reachable from the root exactly once.
+     *
+     * @param tree the elements of the tree where the element at 0 is the root
+     *
+     * @throws std::runtime_error if the elements do not form a tree
+     */
+    void flatten(const std::vector<BSP>& tree) {
+        bsp.clear();
+        bsp.reserve(tree.size());
+        if (tree.empty()) { return; }
+
+        // Each entry is the element in the tree and the element of the flattened tree whose skip it ends
+        std::vector<char> visited(tree.size(), 0);
+        std::vector<std::pair<int, int>> stack(1, std::make_pair(0, -1));
+        while (!stack.empty()) {
+            const std::pair<int, int> next = stack.back();
+            stack.pop_back();
+
+            // The element before is the last element of the subtree that ends here
+            if (next.second >= 0) { bsp[next.second].skip = bsp.size(); }
+            if (next.first < 0) { continue; }
+            if (visited[next.first]) { throw std::runtime_error("Mesh BSP is not a tree"); }
+            visited[next.first] = 1;
+
+            const auto& elem = tree[next.first];
+            const int i      = bsp.size();
+            bsp.push_back(LookupElement{elem.cone, elem.range, i + 1});
+
+            // The end of the subtree is marked after both children, the second child begins after the first
+            if (elem.children[0] >= 0) {
+                stack.push_back(std::make_pair(-1, i));
+                stack.push_back(std::make_pair(elem.children[1], -1));
+                stack.push_back(std::make_pair(elem.children[0], -1));
+            }
+        }
+        if (bsp.size() != tree.size()) { throw std::runtime_error("Mesh BSP is not a tree"); }
+    }
+
     /**
      * Given the lens, get the cone objects that best fit each edge of the screen (or planes for the rectilinear case)
      * This is arranged as the axis (or normal) and the cos and sin of the angle for each of the edges.
@@ -310,6 +520,11 @@ private:
                  */
                 // Get the lens axis centre coordinates
                 vec2<Scalar> centre = add(multiply(dimensions, Scalar(0.5)), lens.centre);
+                // If this is off the screen (such as for a lens cropped to part of the image) use the middle of each
+                // edge instead, otherwise the three points on an edge aren't spread along it
+                if (centre[0] < 1 || centre[0] > dimensions[0] || centre[1] < 1 || centre[1] > dimensions[1]) {
+                    centre = multiply(dimensions, Scalar(0.5));
+                }
 
                 // Unproject the centre of each of the edges using the lens axis as the centre and rotate into world
                 // space
@@ -321,13 +536,44 @@ private:
                 }};
 
                 // Calculate cones from each of the four screen edges
-                const std::array<std::pair<vec3<Scalar>, Scalar>, 4> cones{{
+                std::array<std::pair<vec3<Scalar>, Scalar>, 4> cones{{
                   cone_from_points(rNCo[1], rECo[0], rNCo[0]),
                   cone_from_points(rNCo[2], rECo[1], rNCo[1]),
                   cone_from_points(rNCo[3], rECo[2], rNCo[2]),
                   cone_from_points(rNCo[0], rECo[3], rNCo[3]),
                 }};
 
+                // Each cone holds the outside of its edge, when the lens axis isn't on the screen an edge can curve
+                // the other way so the cone is flipped if it holds the middle of the screen instead
+                const vec3<Scalar> rCCo =
+                  multiply(Roc, visualmesh::unproject(multiply(cast<Scalar>(lens.dimensions), Scalar(0.5)), lens));
+                for (auto& cone : cones) {
+                    if (dot(cone.first, rCCo) > cone.second) {
+                        cone.first  = multiply(cone.first, Scalar(-1));
+                        cone.second = -cone.second;
+                    }
+                }
+
+                // Three points only pin the cone to the edge at those points, between them it can cut into the screen
+                // by a few pixels, more so for the off centre edges of a cropped lens. Narrow each cone so the points
+                // spread along its edge are not inside it, trading that underselection for a little overselection
+                constexpr int N_SAMPLES                   = 8;
+                const std::array<vec2<Scalar>, 4> corners = {{
+                  vec2<Scalar>{1, 1},
+                  vec2<Scalar>{dimensions[0], 1},
+                  vec2<Scalar>{dimensions[0], dimensions[1]},
+                  vec2<Scalar>{1, dimensions[1]},
+                }};
+                for (int e = 0; e < 4; ++e) {
+                    const vec2<Scalar>& a = corners[(e + 1) % 4];
+                    const vec2<Scalar>& b = corners[e];
+                    for (int i = 1; i <= N_SAMPLES; ++i) {
+                        const vec2<Scalar> px = add(a, multiply(subtract(b, a), Scalar(i) / Scalar(N_SAMPLES + 1)));
+                        const vec3<Scalar> p  = multiply(Roc, visualmesh::unproject(px, lens));
+                        cones[e].second       = std::max(cones[e].second, dot(cones[e].first, p));
+                    }
+                }
+
                 // Add in sin_theta
                 return std::array<std::pair<vec3<Scalar>, vec2<Scalar>>, 4>{{
                   std::make_pair(
@@ -348,82 +594,486 @@ private:
         }
     }
 
+    /// The cones that describe the edges of the screen, stored by component so every edge can be checked at once
+    struct ScreenEdges {
+        explicit ScreenEdges(const std::array<std::pair<vec3<Scalar>, vec2<Scalar>>, 4>& edges) {
+            for (int e = 0; e < 4; ++e) {
+                for (int c = 0; c < 3; ++c) {
+                    axis[c][e] = edges[e].first[c];
+                }
+                cos[e] = edges[e].second[0];
+                sin[e] = edges[e].second[1];
+            }
+        }
+
+        /// Each component of the axis of the four edges
+        std::array<std::array<Scalar, 4>, 3> axis;
+        /// The cos and sin of the angle of the four edges
+        std::array<Scalar, 4> cos;
+        std::array<Scalar, 4> sin;
+    };
+
     /**
      * @brief Check if a point is on the screen, given a description of the edges of the screen as cones, and the axis
      *
+     * @details
+     *  The tests against the four edges are written as loops over the edges so they can be done as a single vector
+     *  operation. The cone axis is only projected when the edge tests could make the cone inside or outside.
+     *
      * @param Rco     the 3x3 rotation matrix which rotates from observation plane space to camera space
      * @param cone    the cone object that we are checking if it is on the screen
      * @param lens    the lens object describing the type and geometry of the lens that is used
-     * @param edges   the matrix of 4 cone objects that describe the edge of the screen
+     * @param edges   the 4 cone objects that describe the edge of the screen
      *
      * @return two booleans that describe if this cone is inside (first) the screen and outside(second) the screen. If
      *         both are true then the cone is intersecting the screen edge.
      */
-    static inline std::pair<bool, bool> check_on_screen(
-      const mat3<Scalar>& Rco,
-      const std::pair<vec3<Scalar>, vec2<Scalar>>& cone,
-      const Lens<Scalar>& lens,
-      const std::array<std::pair<vec3<Scalar>, vec2<Scalar>>, 4>& edges) {
+    static inline std::pair<bool, bool> check_on_screen(const mat3<Scalar>& Rco,
+                                                        const std::pair<vec3<Scalar>, vec2<Scalar>>& cone,
+                                                        const Lens<Scalar>& lens,
+                                                        const ScreenEdges& edges) {
+
+        std::array<Scalar, 4> angles;
+        for (int e = 0; e < 4; ++e) {
+            angles[e] =
+              cone.first[0] * edges.axis[0][e] + cone.first[1] * edges.axis[1][e] + cone.first[2] * edges.axis[2][e];
+        }
 
-        // Firstly check if the cone axis is on the screen
+        // Check if our cone is entirely contained within a screen edge
+        // acos(dot(cone_axis, edge_axis)) < edge_angle - cone_angle
+        // And check if we intersect with any of the edges of the screen
+        // acos(dot(cone_axis, edge_axis) > edge_angle + cone_angle
+        int contains   = 0;
+        int intersects = 0;
+        for (int e = 0; e < 4; ++e) {
+            contains += angles[e] > edges.cos[e] * cone.second[0] + edges.sin[e] * cone.second[1];
+            intersects += angles[e] < edges.cos[e] * cone.second[0] - edges.sin[e] * cone.second[1];
+        }
+        if (contains == 0 && intersects < 4) { return std::make_pair(false, false); }
+
+        // Check if the cone axis is on the screen
         vec2<Scalar> px = ::visualmesh::project(multiply(Rco, cone.first), lens);
         bool axis_on_screen =
           0 <= px[0] && px[0] + 1 <= lens.dimensions[0] && 0 <= px[1] && px[1] + 1 <= lens.dimensions[1];
 
-        std::array<Scalar, 4> angles{{
-          dot(cone.first, edges[0].first),
-          dot(cone.first, edges[1].first),
-          dot(cone.first, edges[2].first),
-          dot(cone.first, edges[3].first),
-        }};
-
-        // Check if our cone is entirely contained within a screen edge
-        // acos(dot(cone_axis, edge_axis)) < edge_angle - cone_angle
-        std::array<bool, 4> contains{{
-          angles[0] > edges[0].second[0] * cone.second[0] + edges[0].second[1] * cone.second[1],
-          angles[1] > edges[1].second[0] * cone.second[0] + edges[1].second[1] * cone.second[1],
-          angles[2] > edges[2].second[0] * cone.second[0] + edges[2].second[1] * cone.second[1],
-          angles[3] > edges[3].second[0] * cone.second[0] + edges[3].second[1] * cone.second[1],
-        }};
-
         // If we are off the screen, we are not on it?
-        const bool outside = !axis_on_screen && (contains[0] || contains[1] || contains[2] || contains[3]);
+        const bool outside = !axis_on_screen && contains > 0;
         if (outside) { return std::make_pair(false, true); }
 
-        // Check if we intersect with any of the edges of the screen
-        // acos(dot(cone_axis, edge_axis) > edge_angle + cone_angle
-        std::array<bool, 4> intersects{{
-          angles[0] < edges[0].second[0] * cone.second[0] - edges[0].second[1] * cone.second[1],
-          angles[1] < edges[1].second[0] * cone.second[0] - edges[1].second[1] * cone.second[1],
-          angles[2] < edges[2].second[0] * cone.second[0] - edges[2].second[1] * cone.second[1],
-          angles[3] < edges[3].second[0] * cone.second[0] - edges[3].second[1] * cone.second[1],
-        }};
-
         // Inside if the axis is on the screen and we don't intersect with any of the edges
-        const bool inside = axis_on_screen && intersects[0] && intersects[1] && intersects[2] && intersects[3];
+        const bool inside = axis_on_screen && intersects == 4;
 
         return std::make_pair(inside, outside);
     }
 
+    /// The values that are shared between every check made in a single lookup
+    struct LookupFrame {
+        LookupFrame(const mat4<Scalar>& Hoc, const Lens<Scalar>& lens)
+          // Multiply by 0.5 to get the cone angle
+          : cos_fov(std::cos(lens.fov * Scalar(0.5)))
+          , sin_fov(std::sin(lens.fov * Scalar(0.5)))
+          , Rco(block<3, 3>(transpose(Hoc)))
+          , rXCo(Rco[0])
+          , edges(screen_edges(Hoc, lens))
+          , lens(lens)
+          , limited(false)
+          , region_axis(vec3<Scalar>{0, 0, 1})
+          , region_angle(vec2<Scalar>{-1, 0}) {}
+
+        LookupFrame(const mat4<Scalar>& Hoc, const Lens<Scalar>& lens, const Region<Scalar>& region)
+          : LookupFrame(Hoc, lens) {
+            limited      = region.limits_rays();
+            region_axis  = region.axis;
+            region_angle = region.angle;
+        }
+
+        /// The cos and sin of half the field of view of the lens
+        Scalar cos_fov;
+        Scalar sin_fov;
+        /// The rotation from observation plane space to camera space
+        mat3<Scalar> Rco;
+        /// Camera x in world space
+        vec3<Scalar> rXCo;
+        /// The cone equations that describe the edges of the screen
+        ScreenEdges edges;
+        /// The lens that is being looked up
+        const Lens<Scalar>& lens;
+        /// If the lookup is limited to a cone of rays
+        bool limited;
+        /// The axis of the cone of rays the lookup is limited to
+        vec3<Scalar> region_axis;
+        /// The cos and sin of half the angle of the cone of rays the lookup is limited to
+        vec2<Scalar> region_angle;
+    };
 
-public:
     /**
-     * @brief Construct a new Mesh object
+     * @brief Work out if a cone is entirely on the screen, entirely off the screen, or crossing an edge of the screen
+     *
+     * @param frame the camera and lens that is being looked up
+     * @param cone  the cone being checked
+     *
+     * @return two booleans that describe if this cone is inside (first) the screen and outside (second) the screen. If
+     *         neither are true then the cone is intersecting the screen edge.
+     */
+    static inline std::pair<bool, bool> classify(const LookupFrame& frame,
+                                                 const std::pair<vec3<Scalar>, vec2<Scalar>>& cone) {
+        // A cone that misses the region is outside, and it can only be inside if it is entirely within the region
+        bool in_region = true;
+        if (frame.limited) {
+            const Scalar delta = dot(frame.region_axis, cone.first);
+            const auto& a      = frame.region_angle;
+            if (delta < a[0] * cone.second[0] - a[1] * cone.second[1]) { return std::make_pair(false, true); }
+            in_region = a[0] <= cone.second[0] && delta > a[0] * cone.second[0] + a[1] * cone.second[1];
+        }
+
+        // Check if we are outside the field of view of the lens using an easy check
+        // To check if we are inside or outside the cone we need to check how angle between the cones compares
+        // outside == dot(cam, axis) < cos(fov + acos(gradient))
+        // However given that the thetas don't change and we have gradient naturally from the dot product it's
+        // easier to calculate it using the compound angle formula
+        const Scalar delta = dot(frame.rXCo, cone.first);
+        bool outside       = delta < frame.cos_fov * cone.second[0] - frame.sin_fov * cone.second[1];
+        bool inside        = delta > frame.cos_fov * cone.second[0] + frame.sin_fov * cone.second[1];
+
+        // The FOV can either entirely exclude our points, or split based on intersection. If it can't do either of
+        // these (entirely inside) we need to use the screen edges to do a proper check.
+        if (!outside && inside) {
+            std::tie(inside, outside) = check_on_screen(frame.Rco, cone, frame.lens, frame.edges);
+        }
+        return std::make_pair(inside && in_region, outside);
+    }
+
+    /**
+     * @brief Check if a single ray of the mesh is on the screen
+     *
+     * @param frame the camera and lens that is being looked up
+     * @param ray   the unit vector in observation plane space to check
+     *
+     * @return true if the ray projects to a pixel on the screen
+     */
+    static inline bool on_screen(const LookupFrame& frame, const vec3<Scalar>& ray) {
+        // Only project the rays that are inside the field of view and the region
+        if (dot(frame.rXCo, ray) <= frame.cos_fov) { return false; }
+        if (frame.limited && dot(frame.region_axis, ray) <= frame.region_angle[0]) { return false; }
+        auto px = visualmesh::project(multiply(frame.Rco, ray), frame.lens);
+        return 0 <= px[0] && px[0] + 1 <= frame.lens.dimensions[0] && 0 <= px[1]
+               && px[1] + 1 <= frame.lens.dimensions[1];
+    }
+
+    /// Joins the parts of the mesh found by a lookup into contiguous ranges in the order they are found
+    struct RangeBuilder {
+        /// Start building into an output list, any ranges already in it are removed but its memory is kept
+        explicit RangeBuilder(std::vector<std::pair<int, int>>& ranges) : ranges(ranges) {
+            ranges.clear();
+        }
+
+        /// An entire range is on the screen
+        void inside(const std::pair<int, int>& range) {
+            // If we are building just update our end point
+            if (building) { range_end = range.second; }
+            else {
+                range_start = range.first;
+                range_end   = range.second;
+                building    = true;
+            }
+        }
+
+        /// An entire range is off the screen, so we have finished building our range
+        void outside() {
+            if (building) {
+                ranges.emplace_back(std::make_pair(range_start, range_end));
+                building = false;
+            }
+        }
+
+        /// A single point that has been checked individually
+        void point(const int& i, const bool& on_screen) {
+            if (on_screen && building) {
+                // Extend the end
+                range_end = i + 1;
+            }
+            else if (!on_screen && building) {
+                // Add the range we just closed
+                ranges.emplace_back(std::make_pair(range_start, range_end));
+                building = false;
+            }
+            else if (on_screen && !building) {
+                // Start a new range
+                range_start = i;
+                range_end   = i + 1;
+                building    = true;
+            }
+        }
+
+        /// Add the last range if we finished while building
+        void finish() {
+            if (building) { ranges.emplace_back(std::make_pair(range_start, range_end)); }
+            building = false;
+        }
+
+        std::vector<std::pair<int, int>>& ranges;
+        bool building   = false;
+        int range_start = 0;
+        int range_end   = 0;
+    };
+
+    /**
+     * @brief Go through a subtree of the BSP to work out which segments of the mesh are on screen
+     *
+     * @param frame  the camera and lens that is being looked up
+     * @param root   the BSP element at the root of the subtree
+     * @param ranges the ranges that the segments on screen are added to
+     */
+    void traverse(const LookupFrame& frame, const int& root, RangeBuilder& ranges) const {
+        // The elements are in depth first order so the subtree is every element up to the skip of the root
+        const int end = bsp[root].skip;
+        for (int i = root; i < end;) {
+            // Get the data from our bsp element
+            const auto& elem = bsp[i];
+
+            bool inside  = false;
+            bool outside = false;
+            std::tie(inside, outside) = classify(frame, elem.cone);
+
+            if (inside) { ranges.inside(elem.range); }
+            // If we found an outside point we have finished building our range
+            else if (outside) {
+                ranges.outside();
+            }
+            // We have reached the end of a tree, from here we need to check each point on screen individually
+            else if (elem.skip == i + 1) {
+                for (int j = elem.range.first; j < elem.range.second; ++j) {
+                    ranges.point(j, on_screen(frame, nodes[j].ray));
+                }
+            }
+            // Move to the first child, which is the next element
+            else {
+                ++i;
+                continue;
+            }
+            // Jump over the subtree of this element
+            i = elem.skip;
+        }
+    }
+
+    /// The cameras of a lookup of several views, and a cone around all of their fields of view
+    struct ViewsFrame {
+        explicit ViewsFrame(const std::vector<std::pair<mat4<Scalar>, Lens<Scalar>>>& views) : bounded(false) {
+            frames.reserve(views.size());
+            vec3<Scalar> sum = {0, 0, 0};
+            for (const auto& view : views) {
+                frames.emplace_back(view.first, view.second);
+                sum = add(sum, frames.back().rXCo);
+            }
+
+            // The bounding cone is around the mean direction of the cameras and only rules out the parts of the mesh
+            // that none of the cameras can see, so it is no use once it covers the whole sphere
+            const Scalar n = norm(sum);
+            if (n > Scalar(1e-3)) {
+                axis         = multiply(sum, Scalar(1) / n);
+                Scalar angle = 0;
+                for (std::size_t i = 0; i < views.size(); ++i) {
+                    const Scalar delta = std::min(Scalar(1), std::max(Scalar(-1), dot(axis, frames[i].rXCo)));
+                    angle              = std::max(angle, std::acos(delta) + views[i].second.fov * Scalar(0.5));
+                }
+                bounded = angle < Scalar(M_PI);
+                cos_a   = std::cos(angle);
+                sin_a   = std::sin(angle);
+            }
+        }
+
+        /// @return true if a cone can't be seen by any of the cameras
+        bool outside(const std::pair<vec3<Scalar>, vec2<Scalar>>& cone) const {
+            // The compound angle only holds while the two angles together are less than half a turn
+            return bounded && cone.second[0] > -cos_a
+                   && dot(axis, cone.first) < cos_a * cone.second[0] - sin_a * cone.second[1];
+        }
+
+        /// The camera and lens of each view
+        std::vector<LookupFrame> frames;
+        /// If the cameras have a bounding cone that can rule out parts of the mesh
+        bool bounded;
+        /// The axis of the cone around every field of view
+        vec3<Scalar> axis;
+        /// The cos and sin of half the angle of the cone around every field of view
+        Scalar cos_a;
+        Scalar sin_a;
+    };
+
+    /**
+     * @brief Go through the BSP for several views at once to work out which segments are on each screen
      *
      * @details
-     *  Constructs a new Mesh object using the provided model type. This mesh object generates a BSP tree and holds the
-     *  logic needed to quickly lookup points that are on screen and return valid index ranges.
+     *  Each bit of the mask is a view that hasn't decided the current element yet. A view leaves the mask as soon as an
+     *  element is inside or outside its screen, so only the views that cross the edges of an element descend into its
+     *  children and the tree is walked once for all of them. The mask of the parent is put back once the walk reaches
+     *  the end of the subtree it descended into.
      *
-     * @tparam Shape     the type of shape that will be used to generate the Visual Mesh
+     * @param views  the cameras and lenses that are being looked up
+     * @param first  the index of the view that is the first bit of the mask
+     * @param n      the number of views from first to look up, at most the number of bits in the mask
+     * @param ranges the ranges that the segments on screen are added to for each view
+     */
+    void traverse(const ViewsFrame& views, const int& first, const int& n, std::vector<RangeBuilder>& ranges) const {
+        if (n < 0 || n > 64) {
+            throw std::invalid_argument("At most 64 views can be looked up in one walk of the tree, got "
+                                        + std::to_string(n));
+        }
+
+        const LookupFrame* frames = views.frames.data() + first;
+        RangeBuilder* builders    = ranges.data() + first;
+
+        // The end of each subtree that has been descended into and the mask to go back to after it
+        std::vector<std::pair<int, uint64_t>> stack;
+
+        uint64_t active = n == 64 ? ~uint64_t(0) : (uint64_t(1) << n) - 1;
+        for (int i = 0; i < int(bsp.size());) {
+            const auto& elem = bsp[i];
+
+            // One check rules the element out for every view when none of the cameras are looking at it
+            uint64_t undecided = 0;
+            if (views.outside(elem.cone)) {
+                for (int v = 0; v < n; ++v) {
+                    if ((active >> v) & 1) { builders[v].outside(); }
+                }
+            }
+            else {
+                for (int v = 0; v < n; ++v) {
+                    if (((active >> v) & 1) == 0) { continue; }
+                    bool inside  = false;
+                    bool outside = false;
+                    std::tie(inside, outside) = classify(frames[v], elem.cone);
+                    if (inside) { builders[v].inside(elem.range); }
+                    else if (outside) {
+                        builders[v].outside();
+                    }
+                    else {
+                        undecided |= uint64_t(1) << v;
+                    }
+                }
+            }
+
+            // At a leaf each point is checked for the views that are still undecided
+            if (undecided != 0 && elem.skip == i + 1) {
+                for (int v = 0; v < n; ++v) {
+                    if (((undecided >> v) & 1) == 0) { continue; }
+                    const LookupFrame& frame = frames[v];
+                    RangeBuilder& builder    = builders[v];
+                    for (int j = elem.range.first; j < elem.range.second; ++j) {
+                        builder.point(j, on_screen(frame, nodes[j].ray));
+                    }
+                }
+            }
+            // Move to the first child, which is the next element, with only the views that are still undecided
+            else if (undecided != 0) {
+                stack.emplace_back(elem.skip, active);
+                active = undecided;
+                ++i;
+                continue;
+            }
+
+            // Jump over the subtree of this element, and back out of every subtree that ends here
+            i = elem.skip;
+            while (!stack.empty() && stack.back().first == i) {
+                active = stack.back().second;
+                stack.pop_back();
+            }
+        }
+    }
+
+    /**
+     * @brief Rebuild the frontier of a lookup cache using the current frame as the reference frame.
+     *
+     * @details
+     *  Every cone is grown by the tolerance of the cache before it is checked. Any ray in a cone rotated by at most the
+     *  tolerance stays within the grown cone, so the parts of the tree that are inside, or outside the field of view,
+     *  with the grown cones stay that way for any camera within the tolerance. Elements that are outside because of the
+     *  screen edges also depend on where their axis projects, so these and the leaves that can't be decided are checked
+     *  again on each lookup.
      *
-     * @param shape         the shape instance that will be used to generate the Visual Mesh
-     * @param h             the height of the camera above the observation plane
-     * @param k             the number of cross section intersections that are needed for the object
-     * @param max_distance  the maximum distance to generate the Visual Mesh for
+     * @param frame the camera and lens that is being looked up
+     * @param cache the cache to build the frontier in
+     */
+    void build_frontier(const LookupFrame& frame, LookupCache<Scalar>& cache) const {
+        cache.frontier.clear();
+        cache.mesh           = uid;
+        cache.reference_Rco  = frame.Rco;
+        cache.reference_lens = frame.lens;
+        ++cache.rebuilds;
+
+        const Scalar cos_t = std::cos(cache.tolerance);
+        const Scalar sin_t = std::sin(cache.tolerance);
+
+        for (int i = 0; i < int(bsp.size());) {
+            const auto& elem = bsp[i];
+
+            // Grow the cone angle by the tolerance using the compound angle formula
+            const std::pair<vec3<Scalar>, vec2<Scalar>> cone = std::make_pair(
+              elem.cone.first,
+              vec2<Scalar>{elem.cone.second[0] * cos_t - elem.cone.second[1] * sin_t,
+                           elem.cone.second[1] * cos_t + elem.cone.second[0] * sin_t});
+
+            // Once a cone is wider than a hemisphere the checks no longer hold so it can't be decided
+            bool inside  = false;
+            bool outside = false;
+            if (cone.second[1] >= 0) {
+                const Scalar delta = dot(frame.rXCo, cone.first);
+                outside            = delta < frame.cos_fov * cone.second[0] - frame.sin_fov * cone.second[1];
+                if (!outside) { std::tie(inside, outside) = classify(frame, cone); }
+                else {
+                    cache.add(elem.range, LookupCache<Scalar>::OUTSIDE);
+                    i = elem.skip;
+                    continue;
+                }
+            }
+
+            if (inside) { cache.add(elem.range, LookupCache<Scalar>::INSIDE); }
+            else if (outside || elem.skip == i + 1) {
+                cache.add(elem.range, LookupCache<Scalar>::CHECK, i);
+            }
+            else {
+                ++i;
+                continue;
+            }
+            i = elem.skip;
+        }
+    }
+
+    /// @return a new identifier for a mesh so caches can tell meshes apart even if they share an address
+    static uint64_t next_uid() {
+        static std::atomic<uint64_t> counter(0);
+        return ++counter;
+    }
+
+    /// Make an empty mesh that the nodes and BSP are generated or converted into
+    Mesh(const Scalar& h, const Scalar& max_distance) : h(h), max_distance(max_distance) {}
+
+    /**
+     * @brief Generate the nodes of the mesh and the BSP tree that is used to look them up
+     *
+     * @details
+     *  The nodes are put in the order of the leaves of the BSP so each element covers a contiguous range. This is done
+     *  in place by following the cycles of the permutation, so the only memory needed besides the nodes is an index for
+     *  each node and the tree while it is being built.
+     *
+     * @tparam Shape the type of shape that will be used to generate the Visual Mesh
+     *
+     * @param shape             the shape instance that will be used to generate the Visual Mesh
+     * @param k                 the number of cross section intersections that are needed for the object
+     * @param concurrency       the number of threads to build the BSP tree with, the tree is the same for any value
+     * @param approximate_depth the number of levels at the top of the BSP tree that use a cheaper bounding cone
+     * @param cpus              the processors to pin the threads to, or empty to leave them unpinned
      */
     template <typename Shape>
-    Mesh(const Shape& shape, const Scalar& h, const Scalar& k, const Scalar& max_distance)
-      : h(h), max_distance(max_distance), nodes(Model<Scalar>::generate(shape, h, k, max_distance)) {
+    void generate(const Shape& shape,
+                  const Scalar& k,
+                  const unsigned int& concurrency,
+                  const int& approximate_depth,
+                  const std::vector<int>& cpus) {
+
+        // The same threads generate the nodes and build the BSP tree
+        std::unique_ptr<ThreadPool> pool = concurrency > 1 ? std::make_unique<ThreadPool>(concurrency, cpus) : nullptr;
+        nodes                            = Model<Scalar>::generate(shape, h, k, max_distance, pool.get());
 
         // To ensure that later we can fix the graph we need to perform our sorting on an index list
         std::vector<int> sorting(nodes.size());
@@ -441,29 +1091,131 @@ public:
             std::swap(sorting[i], sorting[x % i]);
         }
 
-        // Build our bsp tree
-        // Reserve enough memory for the bsp as we know how many nodes it will need
-        bsp.reserve(nodes.size() * 2);
-        build_bsp(sorting.begin(), sorting.end());
+        /* tree scope */ {
+            BSPOptions options{8, approximate_depth, -1};
+            std::vector<BSP> tree;
+            if (pool != nullptr) { tree = build_bsp(sorting.begin(), sorting.end(), options, *pool); }
+            else {
+                // Each leaf holds up to min_points nodes and is usually at least half full, so this is enough for most
+                // meshes without holding memory for a tree of single node leaves
+                tree.reserve(4 * nodes.size() / options.min_points + 1);
+                build_bsp(sorting.begin(), sorting.end(), tree, options);
+            }
+            flatten(tree);
+        }
 
-        // Make our reverse lookup so we can correct the neighbourhood indices
+        // Replace the sorting with its reverse so we can correct the neighbourhood indices, the offscreen point stays
         std::vector<int> r_sorting(nodes.size() + 1);
         r_sorting[nodes.size()] = nodes.size();
         for (unsigned int i = 0; i < nodes.size(); ++i) {
             r_sorting[sorting[i]] = i;
         }
+        std::vector<int>().swap(sorting);
 
-        // Sort the nodes and correct the neighbourhood graph based on our BSP sorting
-        std::vector<Node<Scalar, Model<Scalar>::N_NEIGHBOURS>> sorted_nodes;
-        sorted_nodes.reserve(nodes.size());
-        for (const auto& i : sorting) {
-            sorted_nodes.push_back(nodes[i]);
-            for (int& n : sorted_nodes.back().neighbours) {
+        for (auto& node : nodes) {
+            for (int& n : node.neighbours) {
                 n = r_sorting[n];
             }
         }
 
-        nodes = std::move(sorted_nodes);
+        // Move each node to its sorted position by following the cycles of the permutation, marking each node that
+        // has been moved by flipping the bits of its destination
+        for (int i = 0; i < int(nodes.size()); ++i) {
+            if (r_sorting[i] < 0) { continue; }
+            Node<Scalar, Model<Scalar>::N_NEIGHBOURS> moving = nodes[i];
+            int target                                       = r_sorting[i];
+            r_sorting[i]                                     = ~target;
+            while (target != i) {
+                std::swap(moving, nodes[target]);
+                const int next    = r_sorting[target];
+                r_sorting[target] = ~next;
+                target            = next;
+            }
+            nodes[i] = moving;
+        }
+    }
+
+
+public:
+    /**
+     * @brief Construct a new Mesh object
+     *
+     * @details
+     *  Constructs a new Mesh object using the provided model type. This mesh object generates a BSP tree and holds the
+     *  logic needed to quickly lookup points that are on screen and return valid index ranges.
+     *
+     * @tparam Shape     the type of shape that will be used to generate the Visual Mesh
+     *
+     * @param shape             the shape instance that will be used to generate the Visual Mesh
+     * @param h                 the height of the camera above the observation plane
+     * @param k                 the number of cross section intersections that are needed for the object
+     * @param max_distance      the maximum distance to generate the Visual Mesh for
+     * @param concurrency       the number of threads to build the BSP tree with, the tree is the same for any value
+     * @param approximate_depth the number of levels at the top of the BSP tree that use a cheaper bounding cone. These
+     *                          cones are a little larger than needed so lookup may check more points, but they are
+     *                          much faster to find for the large upper levels. 0 uses the smallest cones everywhere.
+     * @param cpus              the processors to pin the threads that build the mesh to, empty leaves them unpinned
+     */
+    template <typename Shape>
+    Mesh(const Shape& shape,
+         const Scalar& h,
+         const Scalar& k,
+         const Scalar& max_distance,
+         const unsigned int& concurrency = 1,
+         const int& approximate_depth    = 0,
+         const std::vector<int>& cpus    = {})
+      : h(h), max_distance(max_distance) {
+        generate(shape, k, concurrency, approximate_depth, cpus);
+    }
+
+    /**
+     * @brief Generate a mesh using a more precise Scalar type and store it in this Scalar type
+     *
+     * @details
+     *  Generating the mesh in double precision and then storing it as float gives more accurate rays, especially as
+     *  distances increase. This is the same as converting a mesh that was generated in the more precise type, but each
+     *  of the buffers of the more precise mesh is freed as soon as it has been converted, so far less memory is used at
+     *  once.
+     *
+     * @tparam Precision the Scalar type to generate the mesh with
+     * @tparam Shape     the type of shape that will be used to generate the Visual Mesh
+     *
+     * @param shape             the shape instance that will be used to generate the Visual Mesh
+     * @param h                 the height of the camera above the observation plane
+     * @param k                 the number of cross section intersections that are needed for the object
+     * @param max_distance      the maximum distance to generate the Visual Mesh for
+     * @param concurrency       the number of threads to build the BSP tree with, the tree is the same for any value
+     * @param approximate_depth the number of levels at the top of the BSP tree that use a cheaper bounding cone
+     * @param cpus              the processors to pin the threads that build the mesh to, empty leaves them unpinned
+     *
+     * @return the mesh generated with Precision and stored with Scalar
+     */
+    template <typename Precision, typename Shape>
+    static Mesh generated_in(const Shape& shape,
+                             const Scalar& h,
+                             const Scalar& k,
+                             const Scalar& max_distance,
+                             const unsigned int& concurrency = 1,
+                             const int& approximate_depth    = 0,
+                             const std::vector<int>& cpus    = {}) {
+        Mesh<Precision, Model> generated(static_cast<Precision>(h), static_cast<Precision>(max_distance));
+        generated.generate(shape, static_cast<Precision>(k), concurrency, approximate_depth, cpus);
+
+        Mesh mesh(h, max_distance);
+        mesh.nodes.reserve(generated.nodes.size());
+        for (const auto& n : generated.nodes) {
+            mesh.nodes.push_back(Node<Scalar, Model<Scalar>::N_NEIGHBOURS>{cast<Scalar>(n.ray), n.neighbours});
+        }
+        std::vector<Node<Precision, Model<Precision>::N_NEIGHBOURS>>().swap(generated.nodes);
+
+        mesh.bsp.reserve(generated.bsp.size());
+        for (const auto& b : generated.bsp) {
+            mesh.bsp.push_back(
+              LookupElement{std::make_pair(cast<Scalar>(b.cone.first), cast<Scalar>(b.cone.second)), b.range, b.skip});
+        }
+        std::vector<typename Mesh<Precision, Model>::LookupElement>().swap(generated.bsp);
+
+        return mesh;
     }
 
     /**
@@ -483,7 +1235,164 @@ public:
         }
         for (const auto& b : b.bsp) {
             bsp.push_back(
-              BSP{b.range, b.children, std::make_pair(cast<Scalar>(b.cone.first), cast<Scalar>(b.cone.second))});
+              LookupElement{std::make_pair(cast<Scalar>(b.cone.first), cast<Scalar>(b.cone.second)), b.range, b.skip});
+        }
+    }
+
+    /**
+     * @brief Make a copy of a mesh that is corrected to be used with the camera at a different height
+     *
+     * @details
+     *  Each ray is moved to the phi angle that the same number of object jumps reaches at the new height while keeping
+     *  its angle around the z axis. In the radial direction this is the ray that the mesh would have been generated
+     *  with at the new height, so a single mesh can be used over a wider range of heights before the error in k grows.
+     *  The graph and the layout of the BSP are kept and only the cones are found again for the new rays, which is much
+     *  cheaper than generating a new mesh.
+     *
+     * @tparam Shape the type of shape that the mesh was generated with
+     *
+     * @param source the mesh to correct
+     * @param shape  the shape that the mesh was generated with
+     * @param h      the height of the camera above the observation plane to correct the mesh for
+     */
+    template <typename Shape>
+    Mesh(const Mesh& source, const Shape& shape, const Scalar& h)
+      : h(h), max_distance(source.max_distance), nodes(source.nodes), bsp(source.bsp) {
+        const auto from = shape.coefficients(source.h);
+        const auto to   = shape.coefficients(h);
+
+        for (auto& node : nodes) {
+            vec3<Scalar>& ray = node.ray;
+            const Scalar rho  = std::sqrt(ray[0] * ray[0] + ray[1] * ray[1]);
+
+            // The ray straight down is the same at every height
+            if (rho > 0) {
+                const Scalar phi = to.phi(from.n(std::acos(-ray[2])));
+                const Scalar s   = std::sin(phi) / rho;
+                ray              = vec3<Scalar>{{ray[0] * s, ray[1] * s, -std::cos(phi)}};
+            }
+        }
+
+        // Find the cone of every element again for the new rays
+        std::vector<int> indices(nodes.size());
+        std::iota(indices.begin(), indices.end(), 0);
+        for (int i = 0; i < int(bsp.size()); ++i) {
+            LookupElement& elem = bsp[i];
+            const auto start    = std::next(indices.begin(), elem.range.first);
+            const auto end      = std::next(indices.begin(), elem.range.second);
+
+            // The root is a cone around the -z axis as it is when the tree is built
+            if (i == 0) {
+                const int top = *std::max_element(
+                  start, end, [this](const int& a, const int& b) { return nodes[a].ray[2] < nodes[b].ray[2]; });
+                const Scalar cone_cos = -nodes[top].ray[2];
+                elem.cone             = std::make_pair(vec3<Scalar>{0, 0, -1},
+                                           vec2<Scalar>{cone_cos, std::sqrt(1 - cone_cos * cone_cos)});
+            }
+            else if (elem.skip == i + 1) {
+                elem.cone = bounding_cone(start, end);
+            }
+            else {
+                elem.cone = approximate_cone(start, end);
+            }
+        }
+    }
+
+    /**
+     * @brief Load a Mesh object that was previously written using save
+     *
+     * @details
+     *  This restores the nodes and the BSP tree exactly as they were built so none of the generation work is repeated.
+     *  The indices in the data are checked so that a corrupt file is rejected rather than causing out of bounds lookup.
+     *
+     * @param reader the reader positioned at the start of the mesh data
+     */
+    explicit Mesh(BinaryReader& reader) : h(reader.read<Scalar>()), max_distance(reader.read<Scalar>()) {
+        static constexpr int N_NEIGHBOURS = Model<Scalar>::N_NEIGHBOURS;
+
+        const uint64_t n_nodes = reader.read<uint64_t>();
+        if (n_nodes > reader.remaining() / (3 * sizeof(Scalar) + N_NEIGHBOURS * sizeof(int32_t))) {
+            throw std::runtime_error("Mesh data is truncated");
+        }
+        nodes.resize(n_nodes);
+        for (auto& node : nodes) {
+            for (auto& v : node.ray) {
+                v = reader.read<Scalar>();
+            }
+            for (auto& n : node.neighbours) {
+                n = reader.read<int32_t>();
+                // Neighbours may point one past the end which is the offscreen point
+                if (n < 0 || uint64_t(n) > n_nodes) { throw std::runtime_error("Mesh neighbour index out of range"); }
+            }
+        }
+
+        const uint64_t n_bsp = reader.read<uint64_t>();
+        if (n_bsp > reader.remaining() / (4 * sizeof(int32_t) + 5 * sizeof(Scalar))) {
+            throw std::runtime_error("Mesh data is truncated");
+        }
+        std::vector<BSP> tree(n_bsp);
+        for (auto& elem : tree) {
+            elem.range.first  = reader.read<int32_t>();
+            elem.range.second = reader.read<int32_t>();
+            for (auto& c : elem.children) {
+                c = reader.read<int32_t>();
+                if (c < -1 || (c >= 0 && uint64_t(c) >= n_bsp)) {
+                    throw std::runtime_error("Mesh BSP child index out of range");
+                }
+            }
+            for (auto& v : elem.cone.first) {
+                v = reader.read<Scalar>();
+            }
+            for (auto& v : elem.cone.second) {
+                v = reader.read<Scalar>();
+            }
+            if (elem.range.first < 0 || elem.range.first > elem.range.second
+                || uint64_t(elem.range.second) > n_nodes) {
+                throw std::runtime_error("Mesh BSP range out of range");
+            }
+        }
+        if (tree.empty() && !nodes.empty()) { throw std::runtime_error("Mesh data has no BSP tree"); }
+        flatten(tree);
+    }
+
+    /**
+     * @brief Write this mesh so that it can be loaded again without regenerating it
+     *
+     * @details
+     *  The format is the height and maximum distance, followed by the count and contents of the nodes and then the BSP
+     *  tree. Every value is written in little endian order by the writer.
+     *
+     * @param writer the writer to output the mesh data to
+     */
+    void save(BinaryWriter& writer) const {
+        writer.write(h);
+        writer.write(max_distance);
+
+        writer.write(uint64_t(nodes.size()));
+        for (const auto& node : nodes) {
+            for (const auto& v : node.ray) {
+                writer.write(v);
+            }
+            for (const auto& n : node.neighbours) {
+                writer.write(int32_t(n));
+            }
+        }
+
+        // The tree is written with child indices, the first child is the next element and the second follows it
+        writer.write(uint64_t(bsp.size()));
+        for (int i = 0; i < int(bsp.size()); ++i) {
+            const auto& elem = bsp[i];
+            writer.write(int32_t(elem.range.first));
+            writer.write(int32_t(elem.range.second));
+            const bool leaf = elem.skip == i + 1;
+            writer.write(int32_t(leaf ? -1 : i + 1));
+            writer.write(int32_t(leaf ? -1 : bsp[i + 1].skip));
+            for (const auto& v : elem.cone.first) {
+                writer.write(v);
+            }
+            for (const auto& v : elem.cone.second) {
+                writer.write(v);
+            }
         }
     }
 
@@ -497,103 +1406,207 @@ public:
      * @return pairs of start/end ranges that are the points which are on the screen
      */
     std::vector<std::pair<int, int>> lookup(const mat4<Scalar>& Hoc, const Lens<Scalar>& lens) const {
+        std::vector<std::pair<int, int>> ranges;
+        lookup(Hoc, lens, ranges);
+        return ranges;
+    }
 
-        // Our FOV is an easy check to exclude things outside our view
-        // Multiply by 0.5 to get the cone angle
-        const Scalar cos_fov = std::cos(lens.fov * Scalar(0.5));
-        const Scalar sin_fov = std::sin(lens.fov * Scalar(0.5));
-
-        // Get the x axis of the camera in world space and the cone equations that describe the edges of the screen
-        const mat3<Scalar> Rco(block<3, 3>(transpose(Hoc)));
-        const vec3<Scalar>& rXCo = Rco[0];  // Camera x in world space
-        const auto edges         = screen_edges(Hoc, lens);
+    /**
+     * @brief Lookup which ranges in the Visual Mesh are on screen, writing them into an existing list.
+     *
+     * @details
+     *  The list is cleared first but keeps its memory, so reusing the same list for every frame means that once it has
+     *  grown large enough a lookup doesn't allocate.
+     *
+     * @param Hoc    the homogenous transformation matrix that transforms from camera space to observation plane space
+     * @param lens   the lens object describing the type and geometry of the lens that is used
+     * @param output the list to write the pairs of start/end ranges of the points which are on the screen into
+     */
+    void lookup(const mat4<Scalar>& Hoc, const Lens<Scalar>& lens, std::vector<std::pair<int, int>>& output) const {
+        const LookupFrame frame(Hoc, lens);
+        RangeBuilder ranges(output);
+        if (!bsp.empty()) { traverse(frame, 0, ranges); }
+        ranges.finish();
+    }
 
-        // Go through our BSP tree to work out which segments of the mesh are on screen
-        // The first element of the tree is the root element of the bsp
-        std::vector<int> stack(1, 0);
+    /**
+     * @brief Lookup which ranges in the Visual Mesh are on screen and inside a region of the image.
+     *
+     * @param Hoc    the homogenous transformation matrix that transforms from camera space to observation plane space
+     * @param lens   the lens object describing the type and geometry of the lens that is used
+     * @param region the part of the image to find the points in
+     *
+     * @return pairs of start/end ranges that are the points which are on the screen and in the region
+     */
+    std::vector<std::pair<int, int>> lookup(const mat4<Scalar>& Hoc,
+                                            const Lens<Scalar>& lens,
+                                            const Region<Scalar>& region) const {
         std::vector<std::pair<int, int>> ranges;
-        bool building   = false;
-        int range_start = 0;
-        int range_end   = 0;
-        while (!stack.empty()) {
-            // Grab our next bsp element
-            int i = stack.back();
-            stack.pop_back();
+        lookup(Hoc, lens, region, ranges);
+        return ranges;
+    }
 
-            // Get the data from our bsp element
-            const auto& elem = bsp[i];
-            const auto& cone = elem.cone;
-
-            // Check if we are outside the field of view of the lens using an easy check
-            // To check if we are inside or outside the cone we need to check how angle between the cones compares
-            // outside == dot(cam, axis) < cos(fov + acos(gradient))
-            // However given that the thetas don't change and we have gradient naturally from the dot product it's
-            // easier to calculate it using the compound angle formula
-            const Scalar delta = dot(rXCo, cone.first);
-            bool outside       = delta < cos_fov * cone.second[0] - sin_fov * cone.second[1];
-            bool inside        = delta > cos_fov * cone.second[0] + sin_fov * cone.second[1];
-
-            // The FOV can either entirely exclude our points, or split based on intersection. If it can't do either of
-            // these (entirely inside) we need to use the screen edges to do a proper check.
-            if (!outside && inside) { std::tie(inside, outside) = check_on_screen(Rco, cone, lens, edges); }
-
-            if (inside) {
-                // If we are building just update our end point
-                if (building) {
-                    range_end = elem.range.second;  //
-                }
-                else {
-                    range_start = elem.range.first;
-                    range_end   = elem.range.second;
-                    building    = true;
-                }
-            }
-            else if (outside) {
-                // If we found an outside point we have finished building our range
-                if (building) {
-                    ranges.emplace_back(std::make_pair(range_start, range_end));
-                    building = false;
-                }
-            }
-            // We have reached the end of a tree, from here we need to check each point on screen individually
-            else if (elem.children[0] < 0) {
-                for (int i = elem.range.first; i < elem.range.second; ++i) {
-                    // Check if the pixel is on the screen
-                    auto px              = visualmesh::project(multiply(Rco, nodes[i].ray), lens);
-                    const bool on_screen = dot(rXCo, nodes[i].ray) > cos_fov && 0 <= px[0]
-                                           && px[0] + 1 <= lens.dimensions[0] && 0 <= px[1]
-                                           && px[1] + 1 <= lens.dimensions[1];
-
-                    if (on_screen && building) {
-                        // Extend the end
-                        range_end = i + 1;
-                    }
-                    else if (!on_screen && building) {
-                        // Add the range we just closed
-                        ranges.emplace_back(std::make_pair(range_start, range_end));
-                        building = false;
-                    }
-                    else if (on_screen && !building) {
-                        // Start a new range
-                        range_start = i;
-                        range_end   = i + 1;
-                        building    = true;
-                    }
-                }
-            }
+    /**
+     * @brief Lookup which ranges in the Visual Mesh are on screen and inside a region of the image, writing them into
+     * an existing list.
+     *
+     * @details
+     *  The BSP is checked against the cone of the region as it is traversed, and the rectangle of the region is looked
+     *  up by cropping the lens to it, so the parts of the mesh outside of the region cost no more than those off the
+     *  screen. Points up to a couple of pixels outside the rectangle may be included, or around ten for fisheye lenses.
+     *  Lookups of a region don't use or change any lookup cache.
+     *
+     * @param Hoc    the homogenous transformation matrix that transforms from camera space to observation plane space
+     * @param lens   the lens object describing the type and geometry of the lens that is used
+     * @param region the part of the image to find the points in
+     * @param output the list to write the pairs of start/end ranges of the points which are in the region into
+     */
+    void lookup(const mat4<Scalar>& Hoc,
+                const Lens<Scalar>& lens,
+                const Region<Scalar>& region,
+                std::vector<std::pair<int, int>>& output) const {
+        // The screen edges of a cropped lens fit its rectangle less closely, so a couple of pixels around the rectangle
+        // are included to make sure nothing inside it is missed
+        Region<Scalar> grown = region;
+        for (int i = 0; i < 2; ++i) {
+            grown.offset[i]     = region.offset[i] - 2;
+            grown.dimensions[i] = int(std::min<long>(long(region.dimensions[i]) + 4, std::numeric_limits<int>::max()));
+        }
+        const Lens<Scalar> cropped = crop(lens, grown);
+        RangeBuilder ranges(output);
+        if (!bsp.empty() && cropped.dimensions[0] > 0 && cropped.dimensions[1] > 0) {
+            const LookupFrame frame(Hoc, cropped, region);
+            traverse(frame, 0, ranges);
+        }
+        ranges.finish();
+    }
 
-            else {
-                // Add the children of this to the search in order 1,0 so we pop 0 first (contiguous indices)
-                stack.push_back(elem.children[1]);
-                stack.push_back(elem.children[0]);
-            }
+    /**
+     * @brief Lookup which ranges in the Visual Mesh are on screen for several cameras at once.
+     *
+     * @details
+     *  Cameras on the same robot share a height and so a mesh, and their fields of view often overlap. Rather than
+     *  walking the BSP for each camera, it is walked once and each element is checked against the cameras that haven't
+     *  decided it yet. A cone around every field of view rules out the parts of the tree no camera can see with a
+     *  single check, and the parts every camera has decided are never visited. The checks of the elements and points
+     *  that are near the edge of a screen are still made once per camera, and the ranges for each camera are the same
+     *  as a lookup of it alone.
+     *
+     * @param views the homogenous transformation matrix from camera space to observation plane space and the lens of
+     *              each camera
+     *
+     * @return pairs of start/end ranges that are the points which are on the screen, for each view in order
+     */
+    std::vector<std::vector<std::pair<int, int>>> lookup(
+      const std::vector<std::pair<mat4<Scalar>, Lens<Scalar>>>& views) const {
+        std::vector<std::vector<std::pair<int, int>>> ranges;
+        lookup(views, ranges);
+        return ranges;
+    }
+
+    /**
+     * @brief Lookup which ranges in the Visual Mesh are on screen for several cameras at once, writing them into
+     * existing lists.
+     *
+     * @param views  the homogenous transformation matrix from camera space to observation plane space and the lens of
+     *               each camera
+     * @param output the lists to write the pairs of start/end ranges into, resized to one for each view
+     */
+    void lookup(const std::vector<std::pair<mat4<Scalar>, Lens<Scalar>>>& views,
+                std::vector<std::vector<std::pair<int, int>>>& output) const {
+        output.resize(views.size());
+        std::vector<RangeBuilder> ranges;
+        ranges.reserve(views.size());
+        for (auto& o : output) {
+            ranges.emplace_back(o);
+        }
+
+        // Each walk of the tree handles as many views as there are bits in the mask
+        const ViewsFrame frame(views);
+        const int n_views = int(views.size());
+        for (int first = 0; first < n_views; first += 64) {
+            traverse(frame, first, std::min(64, n_views - first), ranges);
+        }
+        for (auto& r : ranges) {
+            r.finish();
         }
-        // If we finished while building add the last point
-        if (building) { ranges.emplace_back(std::make_pair(range_start, range_end)); }
+    }
 
+    /**
+     * @brief Lookup which ranges in the Visual Mesh are on screen, reusing the work of previous lookups.
+     *
+     * @details
+     *  If the camera has rotated by less than the tolerance of the cache since its reference frame, only the BSP
+     *  elements that are near the edge of the screen are checked, the rest of the ranges come from the cache. Otherwise
+     *  the BSP is traversed with every cone grown by the tolerance to build a new reference frame. Every point that
+     *  lookup finds on screen is found, however elements that were decided in the reference frame are not checked again
+     *  so a few more of the points just outside the image may be included for fisheye lenses.
+     *
+     * @param Hoc   the homogenous transformation matrix that transforms from camera space to observation plane space
+     * @param lens  the lens object describing the type and geometry of the lens that is used
+     * @param cache the state kept from previous lookups, this is updated when the reference frame is rebuilt
+     *
+     * @return pairs of start/end ranges that are the points which are on the screen
+     */
+    std::vector<std::pair<int, int>> lookup(const mat4<Scalar>& Hoc,
+                                            const Lens<Scalar>& lens,
+                                            LookupCache<Scalar>& cache) const {
+        std::vector<std::pair<int, int>> ranges;
+        lookup(Hoc, lens, cache, ranges);
         return ranges;
     }
 
+    /**
+     * @brief Lookup which ranges in the Visual Mesh are on screen using a cache, writing them into an existing list.
+     *
+     * @param Hoc    the homogenous transformation matrix that transforms from camera space to observation plane space
+     * @param lens   the lens object describing the type and geometry of the lens that is used
+     * @param cache  the state kept from previous lookups, this is updated when the reference frame is rebuilt
+     * @param output the list to write the pairs of start/end ranges of the points which are on the screen into
+     */
+    void lookup(const mat4<Scalar>& Hoc,
+                const Lens<Scalar>& lens,
+                LookupCache<Scalar>& cache,
+                std::vector<std::pair<int, int>>& output) const {
+
+        const LookupFrame frame(Hoc, lens);
+        if (!cache.valid(uid, frame.Rco, lens)) { build_frontier(frame, cache); }
+
+        RangeBuilder ranges(output);
+        for (const auto& segment : cache.frontier) {
+            switch (segment.kind) {
+                case LookupCache<Scalar>::INSIDE: ranges.inside(segment.range); break;
+                case LookupCache<Scalar>::OUTSIDE: ranges.outside(); break;
+                case LookupCache<Scalar>::CHECK: traverse(frame, segment.element, ranges); break;
+            }
+        }
+
+        ranges.finish();
+    }
+
+    /**
+     * @brief Get the approximate amount of memory used by this mesh, used for budgeting caches of meshes
+     *
+     * @return the number of bytes held by this mesh and its tables
+     */
+    std::size_t bytes() const {
+        return sizeof(*this) + nodes.capacity() * sizeof(typename decltype(nodes)::value_type)
+               + bsp.capacity() * sizeof(LookupElement);
+    }
+
+    /**
+     * @brief Get the identifier of this mesh, which the engines use to key the copies of it they keep on the device
+     *
+     * @details
+     *  Every mesh that is built or loaded gets a new identifier, so a mesh that is created at the address of one that
+     *  was freed is never mistaken for it. Copies of a mesh share its identifier.
+     *
+     * @return the identifier of this mesh
+     */
+    uint64_t id() const {
+        return uid;
+    }
+
     /// The height that this mesh is designed to run at
     Scalar h;
     /// The maximum distance this mesh is setup for
@@ -602,11 +1615,15 @@ public:
     std::vector<Node<Scalar, Model<Scalar>::N_NEIGHBOURS>> nodes;
 
 private:
-    /// The binary search tree that is used for looking up which points are on screen in the mesh
-    std::vector<BSP> bsp;
+    /// The binary search tree that is used for looking up which points are on screen in the mesh, in depth first order
+    std::vector<LookupElement> bsp;
+    /// Identifies this mesh to lookup caches, copies of a mesh share the identifier as they share the same tree
+    uint64_t uid = next_uid();
 
     template <typename S, template <typename> class M>
     friend class Mesh;
+    template <typename S, template <typename> class M>
+    friend class RingLookup;
 };
 
 }  // namespace visualmesh
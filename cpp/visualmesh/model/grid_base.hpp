@@ -19,12 +19,17 @@
 #define VISUALMESH_MODEL_GRID_BASE_HPP
 
 #include <array>
-#include <map>
-#include <set>
-#include <stack>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
 #include "visualmesh/node.hpp"
+#include "visualmesh/utility/math.hpp"
+#include "visualmesh/utility/thread_pool.hpp"
 
 namespace visualmesh {
 namespace model {
@@ -75,70 +80,104 @@ namespace model {
     template <typename Scalar, template <typename> class Map, int N_NEIGHBOURS>
     struct GridBase : public Map<Scalar> {
     public:
+        /**
+         * @brief Generates the visual mesh vectors and graph for a grid model
+         *
+         * @details
+         *  A flood fill out from the origin finds every grid coordinate that is within the max distance. The fill
+         *  expands a whole ring of coordinates at a time so every coordinate in the ring can be mapped independently.
+         *  Once all the coordinates have their place in the output the neighbours of every node are looked up
+         *  independently as well. Both of these are split over the threads of the pool if one is provided.
+         *
+         * @tparam Shape  the type of shape that this model will use to create the mesh
+         *
+         * @param shape         the shape instance that is used for calculating details
+         * @param h             the height of the camera above the observation plane
+         * @param k             the number of intersections per object
+         * @param max_distance  the maximum distance that this mesh will be targeted for
+         * @param pool          the threads to generate the nodes with, or nullptr to generate them on this thread
+         *
+         * @return the visual mesh graph that was generated
+         */
         template <typename Shape>
         static std::vector<Node<Scalar, N_NEIGHBOURS>> generate(const Shape& shape,
                                                                 const Scalar& h,
                                                                 const Scalar& k,
-                                                                const Scalar& max_distance) {
+                                                                const Scalar& max_distance,
+                                                                ThreadPool* pool = nullptr) {
+            static_assert(N_NEIGHBOURS == 4 || N_NEIGHBOURS == 6 || N_NEIGHBOURS == 8,
+                          "You must choose 4, 6 or 8 neighbours");
 
             // Our jumps are based on if we are hexagonal or a quad base
             const Scalar jump = 1.0 / k;
 
-            // Hold the final nodes, as well as a map to create the link locations
+            // Grid coordinates are packed into a single integer so they can be hashed
+            auto key = [](const vec2<int>& e) { return (uint64_t(uint32_t(e[0])) << 32) | uint64_t(uint32_t(e[1])); };
+
+            // Run a loop over a range on the pool if we have one
+            auto run = [&](const std::size_t& n, const std::function<void(std::size_t, std::size_t)>& fn) {
+                if (pool != nullptr) { pool->parallel_for(n, fn, 64); }
+                else {
+                    fn(0, n);
+                }
+            };
+
+            // Hold the final nodes, as well as their coordinates and a map to create the link locations
             std::vector<Node<Scalar, N_NEIGHBOURS>> output;
-            std::map<vec2<int>, int> locations;
+            std::vector<vec2<int>> coords;
+            std::unordered_map<uint64_t, int> locations;
 
             // Perform a flood fill to find all the points that are on the screen
-            std::set<vec2<int>> seen;
-            std::stack<vec2<int>> stack;
-            seen.insert(vec2<int>{{0, 0}});
-            stack.push(vec2<int>{{0, 0}});
-            while (!stack.empty()) {
-                // Get the next point to inspect on the stack
-                auto e = stack.top();
-                stack.pop();
-
-                // 6 Neighbours are using hexagonal axial coordinates so need special calculations
-                vec2<Scalar> nm =
-                  N_NEIGHBOURS == 6 ? multiply(
-                    vec2<Scalar>{{e[0] + Scalar(0.5) * e[1], std::sqrt(Scalar(3)) * Scalar(0.5) * e[1]}}, jump)
-                                    : multiply(cast<Scalar>(e), jump);
-                static_assert(N_NEIGHBOURS == 4 || N_NEIGHBOURS == 6 || N_NEIGHBOURS == 8,
-                              "You must choose 4, 6 or 8 neighbours");
-
-                // Map the point using our mapping function
-                vec3<Scalar> vec = Map<Scalar>::map(shape, h, nm);
-                Scalar distance  = norm(head<2>(vec));
-
-                // We only work with this point if we didn't exceed our max distance
-                if (distance <= max_distance) {
-                    // Add the element to the output and store where this coordinate ended up so we can find it later
-                    Node<Scalar, N_NEIGHBOURS> node{};
-                    node.ray = normalise(vec);
-                    locations.emplace(e, output.size());
-                    output.push_back(node);
-
-                    // Add in each of our neighbours to be checked
-                    for (const auto& o : GridOffsets<N_NEIGHBOURS, int>::offsets) {
-                        vec2<int> n = add(e, o);
-                        if (seen.count(n) == 0) {
-                            seen.insert(n);
-                            stack.push(n);
+            std::unordered_set<uint64_t> seen;
+            std::vector<vec2<int>> frontier(1, vec2<int>{{0, 0}});
+            std::vector<vec3<Scalar>> vecs;
+            seen.insert(key(frontier.front()));
+            while (!frontier.empty()) {
+                // Map every point in the frontier using our mapping function
+                vecs.resize(frontier.size());
+                run(frontier.size(), [&](const std::size_t& begin, const std::size_t& end) {
+                    for (std::size_t i = begin; i < end; ++i) {
+                        const vec2<int>& e = frontier[i];
+
+                        // 6 Neighbours are using hexagonal axial coordinates so need special calculations
+                        vec2<Scalar> nm =
+                          N_NEIGHBOURS == 6 ? multiply(
+                            vec2<Scalar>{{e[0] + Scalar(0.5) * e[1], std::sqrt(Scalar(3)) * Scalar(0.5) * e[1]}}, jump)
+                                            : multiply(cast<Scalar>(e), jump);
+                        vecs[i] = Map<Scalar>::map(shape, h, nm);
+                    }
+                });
+
+                std::vector<vec2<int>> next;
+                for (std::size_t i = 0; i < frontier.size(); ++i) {
+                    // We only work with this point if we didn't exceed our max distance
+                    if (norm(head<2>(vecs[i])) <= max_distance) {
+                        // Add the element to the output and store where this coordinate ended up so we can find it
+                        Node<Scalar, N_NEIGHBOURS> node{};
+                        node.ray = normalise(vecs[i]);
+                        locations.emplace(key(frontier[i]), int(output.size()));
+                        coords.push_back(frontier[i]);
+                        output.push_back(node);
+
+                        // Add in each of our neighbours to be checked
+                        for (const auto& o : GridOffsets<N_NEIGHBOURS, int>::offsets) {
+                            vec2<int> n = add(frontier[i], o);
+                            if (seen.insert(key(n)).second) { next.push_back(n); }
                         }
                     }
                 }
+                frontier = std::move(next);
             }
 
             // Set all the neighbours using the map
-            for (const auto& loc : locations) {
-                const vec2<int>& coord           = loc.first;
-                Node<Scalar, N_NEIGHBOURS>& node = output[loc.second];
-
-                for (int i = 0; i < N_NEIGHBOURS; ++i) {
-                    vec2<int> target   = add(coord, GridOffsets<N_NEIGHBOURS, int>::offsets[i]);
-                    node.neighbours[i] = locations.count(target) > 0 ? locations.find(target)->second : output.size();
+            run(output.size(), [&](const std::size_t& begin, const std::size_t& end) {
+                for (std::size_t i = begin; i < end; ++i) {
+                    for (int j = 0; j < N_NEIGHBOURS; ++j) {
+                        auto target = locations.find(key(add(coords[i], GridOffsets<N_NEIGHBOURS, int>::offsets[j])));
+                        output[i].neighbours[j] = target != locations.end() ? target->second : int(output.size());
+                    }
                 }
-            }
+            });
 
             return output;
         }
@@ -18,6 +18,9 @@
 #ifndef VISUALMESH_MODEL_NMGRID_MAP_HPP
 #define VISUALMESH_MODEL_NMGRID_MAP_HPP
 
+#include <cmath>
+#include <limits>
+
 #include "visualmesh/utility/math.hpp"
 
 namespace visualmesh {
@@ -105,21 +108,42 @@ namespace model {
             // then the 2nd coordinate would be out of range as it cannot exceed this amount
             Scalar lo(h);
             Scalar hi((h - c) / std::cos(shape.phi(m, h)) + c);
-            Scalar h_n((lo + hi) * 0.5);
 
-            // Optimise as far as we can
-            while (true) {
-                if (h_n == lo || h_n == hi) { break; }
+            // How far the m at each bound is from the target, guess_m increases with h so these bracket the solution
+            Scalar f_lo = guess_m(shape, h, n, lo) - m;
+            Scalar f_hi = guess_m(shape, h, n, hi) - m;
+            Scalar h_n  = f_lo >= 0 ? lo : hi;
 
-                // Work out what m would be if this was our h
-                const Scalar& m_g   = guess_m(shape, h, n, h_n);
-                (m_g > m ? hi : lo) = h_n;
+            // Optimise with the Illinois variant of false position which shrinks the bracket from both sides so it
+            // converges in a handful of steps rather than the ~50 a bisection needs to run out of precision
+            int side = 0;
+            while (f_lo < 0 && f_hi > 0 && hi - lo > std::numeric_limits<Scalar>::epsilon() * hi) {
+                h_n = (lo * f_hi - hi * f_lo) / (f_hi - f_lo);
 
-                // If we didn't move the bisection finish
-                if (h_n == (lo + hi) * 0.5) { break; }
+                // If the estimate is no longer inside the bracket it can't be refined any further
+                if (!(h_n > lo && h_n < hi)) {
+                    h_n = (lo + hi) * 0.5;
+                    if (h_n == lo || h_n == hi) { break; }
+                }
 
-                // Update the bisection
-                h_n = (lo + hi) * 0.5;
+                // Work out what m would be if this was our h
+                const Scalar f = guess_m(shape, h, n, h_n) - m;
+                if (f > 0) {
+                    hi   = h_n;
+                    f_hi = f;
+                    // Halve the value at the bound that was kept twice in a row so it doesn't stall
+                    if (side == 1) { f_lo *= Scalar(0.5); }
+                    side = 1;
+                }
+                else if (f < 0) {
+                    lo   = h_n;
+                    f_lo = f;
+                    if (side == -1) { f_hi *= Scalar(0.5); }
+                    side = -1;
+                }
+                else {
+                    break;
+                }
             }
 
             // Make the vector and flip the vectors to point to the correct directions
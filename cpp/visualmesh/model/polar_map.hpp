@@ -60,10 +60,11 @@ namespace model {
             // This is the same as a positive n but with a +pi offset to theta
 
             // Work out the phi ring from the n value
-            const Scalar phi = shape.phi(std::abs(nm[0]), h);
+            const auto coefficients = shape.coefficients(h);
+            const Scalar phi        = coefficients.phi(std::abs(nm[0]));
 
             // Work out the radial value from the m value
-            const Scalar d_theta = shape.theta(std::abs(nm[0]), h);
+            const Scalar d_theta = coefficients.theta(std::abs(nm[0]));
 
             // If n is negative, then add a pi offset as we went through the origin to the other side
             const Scalar theta = d_theta * nm[1] + (nm[0] < 0 ? M_PI : 0.0);
@@ -86,10 +87,11 @@ namespace model {
         static vec2<Scalar> unmap(const Shape& shape, const Scalar& h, const vec3<Scalar>& u) {
 
             // Phi value measured from the -z axis
-            const Scalar n = shape.n(std::acos(-u[2]), h);
+            const auto coefficients = shape.coefficients(h);
+            const Scalar n          = coefficients.n(std::acos(-u[2]));
 
             // Work out theta from x/y
-            const Scalar d_theta = shape.theta(n, h);
+            const Scalar d_theta = coefficients.theta(n);
             const Scalar theta   = std::fmod(2.0 * M_PI + std::atan2(u[1], u[0]), 2.0 * M_PI);
 
             return vec2<Scalar>{{n, theta / d_theta}};
@@ -112,8 +114,9 @@ namespace model {
             const Scalar n_d = std::abs(a[0]) - std::abs(b[0]);
 
             // Calculate the angles for both m components
-            const Scalar a_dtheta = shape.theta(std::abs(a[0]), h);
-            const Scalar b_dtheta = shape.theta(std::abs(b[0]), h);
+            const auto coefficients = shape.coefficients(h);
+            const Scalar a_dtheta   = coefficients.theta(std::abs(a[0]));
+            const Scalar b_dtheta   = coefficients.theta(std::abs(b[0]));
 
             // If n is negative we went down past the origin which gives us a π offset
             const Scalar a_theta = a[1] * a_dtheta + (a[0] < 0 ? M_PI : 0.0);
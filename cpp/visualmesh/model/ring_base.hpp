@@ -18,13 +18,16 @@
 #ifndef VISUALMESH_MODEL_RING_BASE_HPP
 #define VISUALMESH_MODEL_RING_BASE_HPP
 
+#include <algorithm>
 #include <array>
 #include <cmath>
+#include <iterator>
 #include <vector>
 
 #include "polar_map.hpp"
 #include "visualmesh/node.hpp"
 #include "visualmesh/utility/math.hpp"
+#include "visualmesh/utility/thread_pool.hpp"
 
 namespace visualmesh {
 namespace model {
@@ -41,12 +44,18 @@ namespace model {
         /**
          * @brief Generates the visual mesh vectors and graph using the Ring4 method
          *
+         * @details
+         *  The number of points in every ring only depends on the shape, so these are counted first to find where each
+         *  ring starts in the output. Every node can then be filled in independently, which is split over the threads
+         *  of the pool if one is provided.
+         *
          * @tparam Shape  the type of shape that this model will use to create the mesh
          *
          * @param shape         the shape instance that is used for calculating details
          * @param h             the height of the camera above the observation plane
          * @param k             the number of radial intersections per object
          * @param max_distance  the maximum distance that this mesh will be targeted for
+         * @param pool          the threads to generate the nodes with, or nullptr to generate them on this thread
          *
          * @return the visual mesh graph that was generated
          */
@@ -54,61 +63,72 @@ namespace model {
         static std::vector<Node<Scalar, N_NEIGHBOURS>> generate(const Shape& shape,
                                                                 const Scalar& h,
                                                                 const Scalar& k,
-                                                                const Scalar& max_distance) {
+                                                                const Scalar& max_distance,
+                                                                ThreadPool* pool = nullptr) {
+
+            const Scalar jump       = 1.0 / k;
+            const auto coefficients = shape.coefficients(h);
+
+            // Count the rings until we reach our max distance
+            int n_rings = 1;
+            while (h * std::tan(coefficients.phi(n_rings * jump)) < max_distance) {
+                ++n_rings;
+            }
 
-            std::vector<Node<Scalar, N_NEIGHBOURS>> nodes;
-            const Scalar jump = 1.0 / k;
-            int start         = 1;
+            // Calculate the number of slices for each ring, and the one after the last so its neighbours can be found
+            // Specifically for the case where n == 0 we have 1 point (origin ring)
+            std::vector<Scalar> slices(n_rings + 1);
+            std::vector<int> counts(n_rings + 1);
+            std::vector<int> offsets(n_rings + 1);
+            slices[0]  = Scalar(1.0);
+            counts[0]  = 1;
+            offsets[0] = 0;
+            for (int i = 1; i <= n_rings; ++i) {
+                slices[i]  = k * Scalar(2.0 * M_PI) / coefficients.theta(i * jump);
+                counts[i]  = int(std::ceil(slices[i]));
+                offsets[i] = offsets[i - 1] + counts[i - 1];
+            }
+            const int n_nodes = offsets[n_rings];
 
             // Create the origin node and connect it
-            nodes.emplace_back(Node<Scalar, N_NEIGHBOURS>{
-              vec3<Scalar>{{0.0, 0.0, -1.0}},
-              std::array<int, N_NEIGHBOURS>{},
-            });
-            int n_first       = int(std::ceil((k * Scalar(2.0 * M_PI)) / shape.theta(jump, h)));
-            Scalar first_jump = Scalar(n_first) / Scalar(N_NEIGHBOURS);
+            std::vector<Node<Scalar, N_NEIGHBOURS>> nodes(n_nodes);
+            nodes.front().ray = vec3<Scalar>{{0.0, 0.0, -1.0}};
+            Scalar first_jump = Scalar(counts[1]) / Scalar(N_NEIGHBOURS);
             for (unsigned int i = 0; i < N_NEIGHBOURS; ++i) {
-                nodes.front().neighbours[i] = int(i * first_jump) + start;
+                nodes.front().neighbours[i] = std::min(int(i * first_jump) + 1, n_nodes);
             }
 
-            // Loop through until we reach our max distance
-            for (int i = 1; h * std::tan(shape.phi(i * jump, h)) < max_distance; ++i) {
-                // Calculate the n values for our ring and adjacent rings
-                const Scalar& n_p = (i - 1) * jump;
-                const Scalar& n_c = i * jump;
-                const Scalar& n_n = (i + 1) * jump;
+            // Generate all the theta slices of every ring
+            auto fill = [&](const std::size_t& begin, const std::size_t& end) {
+                for (int idx = std::max(int(begin), 1); idx < int(end); ++idx) {
+                    // Find which ring this node is in
+                    const auto ring = std::upper_bound(offsets.begin(), offsets.end(), idx);
+                    const int i     = int(std::distance(offsets.begin(), ring)) - 1;
+                    const int j     = idx - offsets[i];
+                    const int start = offsets[i];
 
-                // Calculate the number of slices for each ring
-                // Specifically for the case where n == 0 we have 1 point (origin ring)
-                const Scalar s_p = i == 1 ? Scalar(1.0) : k * Scalar(2.0 * M_PI) / shape.theta(n_p, h);
-                const Scalar s_c = k * Scalar(2.0 * M_PI) / shape.theta(n_c, h);
-                const Scalar s_n = k * Scalar(2.0 * M_PI) / shape.theta(n_n, h);
+                    // Calculate how much we should jump in m space to make an even number of points by oversampling
+                    // by one
+                    const Scalar m_jump = slices[i] / (k * counts[i]);
 
-                // Calculate how much we should jump in m space to make an even number of points by oversampling by one
-                const Scalar m_jump = s_c / (k * std::ceil(s_c));
+                    Node<Scalar, N_NEIGHBOURS>& n = nodes[idx];
 
-                // Loop through and generate all the theta slices
-                start = int(nodes.size());
-                for (int j = 0; j < int(std::ceil(s_c)); ++j) {
-                    Node<Scalar, N_NEIGHBOURS> n{};
-                    n.ray = PolarMap<Scalar>::map(shape, h, vec2<Scalar>{{n_c, j * m_jump}});
+                    n.ray = PolarMap<Scalar>::map(shape, h, vec2<Scalar>{{i * jump, j * m_jump}});
 
                     // Get the neighbours using our specific class
                     n.neighbours.fill(start);
                     n.neighbours =
-                      add(n.neighbours, Ring<Scalar>::neighbours(j, std::ceil(s_p), std::ceil(s_c), std::ceil(s_n)));
-
-                    // Add to the list
-                    nodes.push_back(n);
-                }
-            }
+                      add(n.neighbours, Ring<Scalar>::neighbours(j, counts[i - 1], counts[i], counts[i + 1]));
 
-            // Clip all neighbours that are past the end to one past the end
-            // We start at start - 1 as a hack so that if there is only a single point (the origin) it will be corrected
-            for (int i = start - 1; i < int(nodes.size()); ++i) {
-                for (auto& n : nodes[i].neighbours) {
-                    n = std::min(n, int(nodes.size()));
+                    // Clip all neighbours that are past the end to one past the end
+                    for (auto& neighbour : n.neighbours) {
+                        neighbour = std::min(neighbour, n_nodes);
+                    }
                 }
+            };
+            if (pool != nullptr) { pool->parallel_for(n_nodes, fill, 256); }
+            else {
+                fill(0, n_nodes);
             }
 
             return nodes;
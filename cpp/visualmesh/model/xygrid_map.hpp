@@ -38,10 +38,12 @@ namespace model {
          */
         template <typename Shape>
         static vec3<Scalar> map(const Shape& shape, const Scalar& h, const vec2<Scalar>& nm) {
-            const Scalar phi_x = shape.phi(nm[0], h);
+            const auto coefficients = shape.coefficients(h);
+
+            const Scalar phi_x = coefficients.phi(nm[0]);
             const Scalar x     = (h - shape.c()) * std::tan(phi_x);
 
-            const Scalar phi_y = shape.phi(nm[1], h);
+            const Scalar phi_y = coefficients.phi(nm[1]);
             const Scalar y     = (h - shape.c()) * std::tan(phi_y);
 
             return vec3<Scalar>{x, y, shape.c() - h};
@@ -71,7 +73,11 @@ namespace model {
             const Scalar phi_n = std::atan(-std::abs(v[0]) / std::abs(c - h));
             const Scalar phi_m = std::atan(-std::abs(v[1]) / std::abs(c - h));
 
-            vec2<Scalar> nm = {{shape.n(phi_n, h) * (u[0] >= 0 ? -1 : 1), shape.n(phi_m, h) * (u[1] >= 0 ? -1 : 1)}};
+            // Work out how many jumps each phi would take
+            const auto coefficients = shape.coefficients(h);
+            vec2<Scalar> nm         = {{coefficients.n(phi_n), coefficients.n(phi_m)}};
+            nm[0] *= u[0] >= 0 ? -1 : 1;
+            nm[1] *= u[1] >= 0 ? -1 : 1;
 
             return nm;
         }
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef VISUALMESH_NETWORK_FILE_HPP
+#define VISUALMESH_NETWORK_FILE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+
+#include "compiled_network.hpp"
+#include "quantisation.hpp"
+#include "utility/serialisation.hpp"
+
+namespace visualmesh {
+
+/**
+ * @brief A trained network in the binary network format, ready to give to an engine
+ *
+ * @details
+ *  The file holds the network in the compiled layout so loading it is a bounds checked copy out of a memory mapping
+ *  rather than parsing text. It can optionally also hold an already quantised version of the network so 8 bit engines
+ *  don't need to be calibrated again. `training/export.py` writes this format next to the YAML model.
+ *
+ * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+ */
+template <typename Scalar>
+struct NetworkFile {
+    /// The full precision network
+    CompiledNetwork<Scalar> network;
+    /// The quantised network, empty if the file doesn't have one
+    QuantisedNetwork<Scalar> quantised;
+
+    /**
+     * @brief Write the network to a binary file
+     *
+     * @details
+     *  The file starts with a magic number and format version, followed by the compiled network and then a flag saying
+     *  whether a quantised network follows it. All values are little endian.
+     *
+     * @param path the path of the file to write
+     */
+    void save(const std::string& path) const {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        if (!out) { throw std::runtime_error("Failed to open " + path + " for writing"); }
+        save(out);
+    }
+
+    /**
+     * @brief Write the network to a stream in the binary format
+     *
+     * @param out the stream to write to
+     */
+    void save(std::ostream& out) const {
+        BinaryWriter writer(out);
+        writer.write_bytes(FILE_MAGIC, sizeof(FILE_MAGIC));
+        writer.write(FILE_VERSION);
+        network.save(writer);
+        writer.write(uint32_t(quantised.empty() ? 0 : 1));
+        if (!quantised.empty()) { quantised.save(writer); }
+    }
+
+    /**
+     * @brief Load a network that was written in the binary format
+     *
+     * @details
+     *  The file is memory mapped and the weights are copied directly from the mapping into the network's arena. A file
+     *  that was written with the other floating point type is converted as it is loaded.
+     *
+     * @param path the path of the file to load
+     *
+     * @return the network stored in the file
+     */
+    static NetworkFile load(const std::string& path) {
+        MappedFile file(path);
+        BinaryReader reader = file.reader();
+
+        if (std::memcmp(reader.take(sizeof(FILE_MAGIC)), FILE_MAGIC, sizeof(FILE_MAGIC)) != 0) {
+            throw std::runtime_error(path + " is not a Visual Mesh network file");
+        }
+        if (reader.read<uint32_t>() != FILE_VERSION) {
+            throw std::runtime_error(path + " was written with an unsupported version of the network format");
+        }
+
+        NetworkFile result;
+        result.network = CompiledNetwork<Scalar>(reader);
+        if (reader.read<uint32_t>() != 0) { result.quantised = QuantisedNetwork<Scalar>(reader); }
+        return result;
+    }
+
+private:
+    /// The magic number at the start of every network file
+    static constexpr char FILE_MAGIC[4] = {'V', 'M', 'N', 'N'};
+    /// The version of the binary format, increment this whenever the layout changes
+    static constexpr uint32_t FILE_VERSION = 1;
+};
+
+template <typename Scalar>
+constexpr char NetworkFile<Scalar>::FILE_MAGIC[4];
+template <typename Scalar>
+constexpr uint32_t NetworkFile<Scalar>::FILE_VERSION;
+
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_NETWORK_FILE_HPP
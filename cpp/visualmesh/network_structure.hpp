@@ -51,6 +51,25 @@ using ConvolutionalGroup = std::vector<Layer<Scalar>>;
 template <typename Scalar>
 using NetworkStructure = std::vector<ConvolutionalGroup<Scalar>>;
 
+/**
+ * @brief An early exit head that classifies the points a network is already confident about part way through
+ *
+ * @details
+ *  The head is a list of dense layers that is applied to each point after the first few convolutional groups, ending
+ *  in a softmax with the same outputs as the network. Points where the largest output of the head reaches the
+ *  threshold take the head's classification, and the rest of the network is only run for the other points and the
+ *  neighbours they need.
+ */
+template <typename Scalar>
+struct Cascade {
+    /// The number of convolutional groups that are run before the head
+    unsigned int groups;
+    /// The dense layers of the head, which don't gather any neighbours
+    std::vector<Layer<Scalar>> head;
+    /// A point exits early when the largest output of the head is at least this
+    Scalar threshold;
+};
+
 }  // namespace visualmesh
 
 #endif  // VISUALMESH_NETWORKSTRUCTURE_HPP
@@ -0,0 +1,479 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef VISUALMESH_QUANTISATION_HPP
+#define VISUALMESH_QUANTISATION_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "classified_mesh.hpp"
+#include "compiled_network.hpp"
+#include "utility/aligned_allocator.hpp"
+#include "utility/serialisation.hpp"
+
+namespace visualmesh {
+
+/// The precision that an engine executes the network with
+enum class Precision {
+    /// Calculations are done using the engine's Scalar type
+    FULL,
+    /// Calculations are done using 16 bit floating point, storage is still the engine's Scalar type
+    HALF,
+    /// Each layer's input is quantised to 8 bit unsigned values and multiplied against 8 bit signed weights
+    INT8,
+};
+
+/**
+ * @brief The affine mapping between a real value and an 8 bit unsigned quantised value
+ *
+ * @details
+ *  A real value x is represented by the quantised value q where x = scale * (q - zero_point). The zero point is always
+ *  a valid quantised value so zero can be represented exactly.
+ *
+ * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+ */
+template <typename Scalar>
+struct QuantisationParameters {
+    /// The largest quantised value
+    static constexpr int32_t MAX_VALUE = 255;
+
+    /**
+     * @brief Work out the parameters that cover a range of values
+     *
+     * @param min the smallest value that needs to be represented
+     * @param max the largest value that needs to be represented
+     *
+     * @return the parameters that map the range (extended to include zero) onto [0, 255]
+     */
+    static QuantisationParameters from_range(Scalar min, Scalar max) {
+        min = std::min(min, Scalar(0));
+        max = std::max(max, Scalar(0));
+
+        QuantisationParameters p;
+        p.scale      = max > min ? (max - min) / Scalar(MAX_VALUE) : Scalar(1);
+        p.zero_point = std::min(MAX_VALUE, std::max(int32_t(0), int32_t(std::lround(-min / p.scale))));
+        return p;
+    }
+
+    /// @return the quantised value that best represents x, saturated to [0, 255]
+    int32_t quantise(const Scalar& x) const {
+        const Scalar q = std::floor(x * (Scalar(1) / scale) + Scalar(zero_point) + Scalar(0.5));
+        return int32_t(std::min(Scalar(MAX_VALUE), std::max(Scalar(0), q)));
+    }
+
+    /// @return the real value that q represents
+    Scalar dequantise(const int32_t& q) const {
+        return scale * Scalar(q - zero_point);
+    }
+
+    /// The size of a single quantisation step
+    Scalar scale = Scalar(1);
+    /// The quantised value that represents zero
+    int32_t zero_point = 0;
+};
+
+template <typename Scalar>
+constexpr int32_t QuantisationParameters<Scalar>::MAX_VALUE;
+
+/**
+ * @brief The range of values that were observed at the input of each layer of a network
+ *
+ * @details
+ *  A calibration is built by running the full precision network over a sample dataset and observing the input of every
+ *  layer (see cpu::Engine::calibrate). The observed ranges are used to choose the quantisation parameters for each
+ *  layer's input.
+ *
+ * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+ */
+template <typename Scalar>
+class Calibration {
+public:
+    /**
+     * @brief Extend the observed range for the input of a layer
+     *
+     * @param conv  the convolution the layer is in
+     * @param layer the index of the layer in the convolution
+     * @param begin the first input value to observe
+     * @param end   one past the last input value to observe
+     */
+    template <typename Iterator>
+    void observe(const std::size_t& conv, const std::size_t& layer, Iterator begin, Iterator end) {
+        if (ranges.size() <= conv) { ranges.resize(conv + 1); }
+        if (ranges[conv].size() <= layer) {
+            ranges[conv].resize(
+              layer + 1, std::make_pair(std::numeric_limits<Scalar>::max(), std::numeric_limits<Scalar>::lowest()));
+        }
+        auto& r = ranges[conv][layer];
+        for (auto it = begin; it != end; ++it) {
+            r.first  = std::min(r.first, Scalar(*it));
+            r.second = std::max(r.second, Scalar(*it));
+        }
+    }
+
+    /// @return true if nothing has been observed
+    bool empty() const {
+        return ranges.empty();
+    }
+
+    /// @return true if the input of the layer has been observed
+    bool contains(const std::size_t& conv, const std::size_t& layer) const {
+        return conv < ranges.size() && layer < ranges[conv].size()
+               && ranges[conv][layer].first <= ranges[conv][layer].second;
+    }
+
+    /// @return the smallest and largest value that was observed at the input of the layer
+    const std::pair<Scalar, Scalar>& range(const std::size_t& conv, const std::size_t& layer) const {
+        return ranges[conv][layer];
+    }
+
+    /// @return the quantisation parameters that cover the observed input of the layer
+    QuantisationParameters<Scalar> parameters(const std::size_t& conv, const std::size_t& layer) const {
+        const auto& r = range(conv, layer);
+        return QuantisationParameters<Scalar>::from_range(r.first, r.second);
+    }
+
+private:
+    /// The minimum and maximum observed input for each layer grouped by convolution
+    std::vector<std::vector<std::pair<Scalar, Scalar>>> ranges;
+};
+
+/**
+ * @brief A single layer that multiplies 8 bit unsigned inputs against 8 bit signed weights
+ *
+ * @details
+ *  The layer's input is quantised using the parameters from a calibration, and each output's weights are quantised
+ *  symmetrically with their own scale. The dot products are accumulated as 32 bit integers and each output is then
+ *  dequantised as
+ *
+ *      y[j] = bias[j] + scale[j] * (sum_i(q[i] * w[i][j]) - offset[j])
+ *
+ *  where offset[j] = zero_point * sum_i(w[i][j]) removes the contribution of the input zero point.
+ *
+ *  The weights are stored in blocks of BLOCK outputs, and within a block as groups of GROUP consecutive inputs for each
+ *  output. This is the layout consumed by four way byte dot product instructions, where one register holds the weights
+ *  of GROUP inputs for BLOCK outputs. The number of inputs is padded to a multiple of GROUP with zero weights.
+ *
+ * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+ */
+template <typename Scalar>
+struct QuantisedLayer {
+    /// The number of outputs in each block of weights
+    static constexpr int BLOCK = 16;
+    /// The number of consecutive inputs stored together for each output
+    static constexpr int GROUP = 4;
+
+    /// @return the position in weights of the weight that connects input i to output j
+    std::size_t index(const int& i, const int& j) const {
+        return (((j / BLOCK) * (padded_inputs / GROUP) + i / GROUP) * BLOCK + j % BLOCK) * GROUP + i % GROUP;
+    }
+
+    /// @return the quantised weight that connects input i to output j
+    const int8_t& weight(const int& i, const int& j) const {
+        return weights[index(i, j)];
+    }
+
+    /// The number of values in each input point
+    int input_dimensions;
+    /// The number of inputs including the padding up to a multiple of GROUP
+    int padded_inputs;
+    /// The number of values in each output point
+    int output_dimensions;
+    /// The number of blocks of outputs
+    int n_blocks;
+    /// The quantisation of the input to this layer
+    QuantisationParameters<Scalar> input;
+    /// The quantised weights, [n_blocks][padded_inputs / GROUP][BLOCK][GROUP]
+    aligned_vector<int8_t> weights;
+    /// The combined input and weight scale for each output, zero padded to n_blocks * BLOCK
+    aligned_vector<Scalar> scales;
+    /// The input zero point multiplied by the sum of each output's weights, zero padded to n_blocks * BLOCK
+    aligned_vector<int32_t> offsets;
+    /// The biases for each output, zero padded to n_blocks * BLOCK
+    aligned_vector<Scalar> biases;
+    /// The activation function to apply after this layer
+    ActivationFunction activation;
+};
+
+template <typename Scalar>
+constexpr int QuantisedLayer<Scalar>::BLOCK;
+template <typename Scalar>
+constexpr int QuantisedLayer<Scalar>::GROUP;
+
+/**
+ * @brief A network where every layer has been quantised to 8 bits using the ranges observed by a calibration
+ *
+ * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+ */
+template <typename Scalar>
+class QuantisedNetwork {
+public:
+    using Layer = QuantisedLayer<Scalar>;
+
+    QuantisedNetwork() = default;
+
+    /**
+     * @brief Quantise a network using the input ranges observed by a calibration
+     *
+     * @param network     the full precision network to quantise
+     * @param calibration the observed inputs of every layer in the network
+     */
+    QuantisedNetwork(const CompiledNetwork<Scalar>& network, const Calibration<Scalar>& calibration) {
+        convs.resize(network.size());
+        for (std::size_t c = 0; c < network.size(); ++c) {
+            for (std::size_t l = 0; l < network.size(c); ++l) {
+                if (!calibration.contains(c, l)) {
+                    throw std::invalid_argument("The calibration does not cover every layer of the network");
+                }
+                convs[c].push_back(quantise(network.layer(c, l), calibration.parameters(c, l)));
+            }
+        }
+    }
+
+    /**
+     * @brief Load a quantised network that was previously written using save
+     *
+     * @param reader the reader positioned at the start of the quantised network data
+     */
+    explicit QuantisedNetwork(BinaryReader& reader) {
+        const uint32_t width = reader.read<uint32_t>();
+        if (width != sizeof(float) && width != sizeof(double)) {
+            throw std::runtime_error("Unsupported floating point width in binary network data");
+        }
+
+        // Every count is checked against the data that is left so a corrupt file can't make a huge allocation
+        auto count = [&reader](const std::size_t& bytes_each) {
+            const uint64_t n = reader.read<uint64_t>();
+            if (n > reader.remaining() / bytes_each) { throw std::runtime_error("Unexpected end of binary data"); }
+            return std::size_t(n);
+        };
+
+        convs.resize(count(sizeof(uint64_t)));
+        for (auto& conv : convs) {
+            conv.resize(count(3 * sizeof(uint32_t)));
+            for (auto& layer : conv) {
+                layer.input_dimensions  = int(reader.read<uint32_t>());
+                layer.output_dimensions = int(reader.read<uint32_t>());
+                layer.activation        = ActivationFunction(reader.read<uint32_t>());
+                if (layer.input_dimensions < 1 || layer.output_dimensions < 1 || layer.activation < SELU
+                    || layer.activation > TANH) {
+                    throw std::runtime_error("Invalid layer in binary network data");
+                }
+                layer.padded_inputs = ((layer.input_dimensions + Layer::GROUP - 1) / Layer::GROUP) * Layer::GROUP;
+                layer.n_blocks      = (layer.output_dimensions + Layer::BLOCK - 1) / Layer::BLOCK;
+                reader.read_floats(&layer.input.scale, 1, width);
+                layer.input.zero_point = reader.read<int32_t>();
+
+                const std::size_t padded_outputs = layer.n_blocks * Layer::BLOCK;
+                if (padded_outputs * layer.padded_inputs > reader.remaining()) {
+                    throw std::runtime_error("Unexpected end of binary data");
+                }
+                layer.weights.resize(padded_outputs * layer.padded_inputs);
+                layer.scales.resize(padded_outputs);
+                layer.offsets.resize(padded_outputs);
+                layer.biases.resize(padded_outputs);
+                reader.read_array(layer.weights.data(), layer.weights.size());
+                reader.read_floats(layer.scales.data(), layer.scales.size(), width);
+                reader.read_array(layer.offsets.data(), layer.offsets.size());
+                reader.read_floats(layer.biases.data(), layer.biases.size(), width);
+            }
+        }
+    }
+
+    /**
+     * @brief Write this network so it can be loaded without calibrating and quantising it again
+     *
+     * @details
+     *  The format is the size of the Scalar type, followed by the number of convolutional groups and for each group its
+     *  number of layers. Each layer is then its dimensions, activation and input quantisation followed by its padded
+     *  weights, scales, offsets and biases exactly as they are stored. Every value is written in little endian order.
+     *
+     * @param writer the writer to output the network to
+     */
+    void save(BinaryWriter& writer) const {
+        writer.write(uint32_t(sizeof(Scalar)));
+        writer.write(uint64_t(convs.size()));
+        for (const auto& conv : convs) {
+            writer.write(uint64_t(conv.size()));
+            for (const auto& layer : conv) {
+                writer.write(uint32_t(layer.input_dimensions));
+                writer.write(uint32_t(layer.output_dimensions));
+                writer.write(uint32_t(layer.activation));
+                writer.write(layer.input.scale);
+                writer.write(layer.input.zero_point);
+                writer.write_array(layer.weights.data(), layer.weights.size());
+                writer.write_array(layer.scales.data(), layer.scales.size());
+                writer.write_array(layer.offsets.data(), layer.offsets.size());
+                writer.write_array(layer.biases.data(), layer.biases.size());
+            }
+        }
+    }
+
+    /// @return the number of convolutional groups in the network
+    std::size_t size() const {
+        return convs.size();
+    }
+
+    /// @return the number of layers in a convolutional group
+    std::size_t size(const std::size_t& conv) const {
+        return convs[conv].size();
+    }
+
+    /// @return true if the network has no layers to execute
+    bool empty() const {
+        return convs.empty() || convs.front().empty();
+    }
+
+    /// @return a layer in the network
+    const Layer& layer(const std::size_t& conv, const std::size_t& layer) const {
+        return convs[conv][layer];
+    }
+
+    /// @return the last layer in a convolutional group, which gives the output of the group
+    const Layer& back(const std::size_t& conv) const {
+        return convs[conv].back();
+    }
+
+private:
+    static Layer quantise(const LayerView<Scalar>& view, const QuantisationParameters<Scalar>& input) {
+        Layer layer;
+        layer.input_dimensions  = view.input_dimensions;
+        layer.padded_inputs     = ((view.input_dimensions + Layer::GROUP - 1) / Layer::GROUP) * Layer::GROUP;
+        layer.output_dimensions = view.output_dimensions;
+        layer.n_blocks          = (view.output_dimensions + Layer::BLOCK - 1) / Layer::BLOCK;
+        layer.input             = input;
+        layer.activation        = view.activation;
+
+        const std::size_t padded_outputs = layer.n_blocks * Layer::BLOCK;
+        layer.weights.assign(padded_outputs * layer.padded_inputs, 0);
+        layer.scales.assign(padded_outputs, Scalar(0));
+        layer.offsets.assign(padded_outputs, 0);
+        layer.biases.assign(padded_outputs, Scalar(0));
+
+        for (int j = 0; j < view.output_dimensions; ++j) {
+            // Symmetric quantisation for each output so the largest weight maps to +-127
+            Scalar max_weight = Scalar(0);
+            for (int i = 0; i < view.input_dimensions; ++i) {
+                max_weight = std::max(max_weight, std::abs(view.weight(i, j)));
+            }
+            const Scalar weight_scale = max_weight > Scalar(0) ? max_weight / Scalar(127) : Scalar(1);
+
+            int32_t sum = 0;
+            for (int i = 0; i < view.input_dimensions; ++i) {
+                const long q = std::min(127L, std::max(-127L, std::lround(view.weight(i, j) / weight_scale)));
+                layer.weights[layer.index(i, j)] = int8_t(q);
+                sum += int32_t(q);
+            }
+
+            layer.scales[j]  = input.scale * weight_scale;
+            layer.offsets[j] = input.zero_point * sum;
+            layer.biases[j]  = view.bias(j);
+        }
+
+        return layer;
+    }
+
+    /// The layers of the network grouped by convolution
+    std::vector<std::vector<Layer>> convs;
+};
+
+/**
+ * @brief How much the classifications from one engine differ from a reference classification
+ *
+ * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+ */
+template <typename Scalar>
+struct ClassificationDrift {
+    /// The number of points that were in both classifications
+    std::size_t n_points = 0;
+    /// The largest absolute difference of any class value
+    Scalar max_error = Scalar(0);
+    /// The mean absolute difference over all the class values
+    Scalar mean_error = Scalar(0);
+    /// The fraction of points whose most likely class is the same
+    Scalar agreement = Scalar(1);
+};
+
+/**
+ * @brief Measure the drift of a classification (e.g. from a quantised network) against a reference classification
+ *
+ * @details
+ *  Points are matched by their global index so the two classifications may come from engines that projected slightly
+ *  different sets of points. Points that only appear in one of the classifications are ignored.
+ *
+ * @tparam Scalar       the scalar type used for calculations and storage (normally one of float or double)
+ * @tparam N_NEIGHBOURS the number of neighbours that each point has
+ *
+ * @param reference the classification to compare against, normally from a full precision network
+ * @param test      the classification to measure
+ *
+ * @return the drift of the test classification
+ */
+template <typename Scalar, int N_NEIGHBOURS>
+ClassificationDrift<Scalar> drift(const ClassifiedMesh<Scalar, N_NEIGHBOURS>& reference,
+                                  const ClassifiedMesh<Scalar, N_NEIGHBOURS>& test) {
+    ClassificationDrift<Scalar> result;
+    if (reference.neighbourhood.empty() || test.neighbourhood.empty()) { return result; }
+
+    const std::size_t width = reference.classifications.size() / reference.neighbourhood.size();
+    if (width == 0 || width != test.classifications.size() / test.neighbourhood.size()) {
+        throw std::invalid_argument("The classifications being compared have a different number of classes");
+    }
+
+    std::unordered_map<int, std::size_t> rows;
+    for (std::size_t i = 0; i < test.global_indices.size(); ++i) {
+        rows[test.global_indices[i]] = i;
+    }
+
+    double total      = 0.0;
+    std::size_t agree = 0;
+    for (std::size_t i = 0; i < reference.global_indices.size(); ++i) {
+        auto row = rows.find(reference.global_indices[i]);
+        if (row == rows.end()) { continue; }
+
+        const auto r = std::next(reference.classifications.begin(), i * width);
+        const auto t = std::next(test.classifications.begin(), row->second * width);
+        for (std::size_t k = 0; k < width; ++k) {
+            const Scalar error = std::abs(r[k] - t[k]);
+            result.max_error   = std::max(result.max_error, error);
+            total += error;
+        }
+        if (std::distance(r, std::max_element(r, std::next(r, width)))
+            == std::distance(t, std::max_element(t, std::next(t, width)))) {
+            ++agree;
+        }
+        ++result.n_points;
+    }
+
+    if (result.n_points > 0) {
+        result.mean_error = Scalar(total / double(result.n_points * width));
+        result.agreement  = Scalar(double(agree) / double(result.n_points));
+    }
+    return result;
+}
+
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_QUANTISATION_HPP
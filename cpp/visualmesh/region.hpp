@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_REGION_HPP
+#define VISUALMESH_REGION_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+
+#include "lens.hpp"
+#include "utility/math.hpp"
+
+namespace visualmesh {
+
+/**
+ * @brief Limits a lookup to part of the image, used to only classify the area around an object being tracked
+ *
+ * @details
+ *  A region is a rectangle of pixels in the image and a cone of rays in observation plane space, and a point is in the
+ *  region when it is inside both. The BSP of the mesh is checked against the region while it is traversed, so the
+ *  parts of the mesh outside of it are skipped as quickly as the parts off the screen are.
+ *
+ * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+ */
+template <typename Scalar>
+struct Region {
+    /// The top left pixel of the rectangle
+    std::array<int, 2> offset;
+    /// The size of the rectangle in pixels
+    std::array<int, 2> dimensions;
+    /// The axis of the cone of rays in observation plane space
+    vec3<Scalar> axis;
+    /// The cos and sin of half the angle of the cone, a cos of -1 allows every ray
+    vec2<Scalar> angle;
+
+    /// @return true if the cone of this region excludes any rays
+    bool limits_rays() const {
+        return angle[0] > Scalar(-1);
+    }
+};
+
+/**
+ * @brief Make a region that covers a rectangle of pixels in the image
+ *
+ * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+ *
+ * @param offset     the top left pixel of the rectangle
+ * @param dimensions the size of the rectangle in pixels
+ *
+ * @return a region covering the rectangle with every ray allowed
+ */
+template <typename Scalar>
+inline Region<Scalar> pixel_region(const std::array<int, 2>& offset, const std::array<int, 2>& dimensions) {
+    return Region<Scalar>{offset, dimensions, vec3<Scalar>{0, 0, 1}, vec2<Scalar>{-1, 0}};
+}
+
+/**
+ * @brief Make a region that covers a cone of rays anywhere in the image
+ *
+ * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+ *
+ * @param axis  the unit vector at the centre of the cone in observation plane space
+ * @param angle the angle in radians from the axis to the edge of the cone
+ *
+ * @return a region covering the cone of rays with every pixel allowed
+ */
+template <typename Scalar>
+inline Region<Scalar> cone_region(const vec3<Scalar>& axis, const Scalar& angle) {
+    return Region<Scalar>{{{0, 0}},
+                          {{std::numeric_limits<int>::max(), std::numeric_limits<int>::max()}},
+                          axis,
+                          vec2<Scalar>{std::cos(angle), std::sin(angle)}};
+}
+
+/**
+ * @brief Make a lens whose image is only the rectangle of a region
+ *
+ * @details
+ *  The rectangle is clamped to the image. Anything on the screen of the returned lens projects to the same place as it
+ *  does with the original lens, shifted by the offset of the rectangle.
+ *
+ * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+ *
+ * @param lens   the lens that the image was taken through
+ * @param region the region to crop the image to
+ *
+ * @return a lens for just the rectangle of the region
+ */
+template <typename Scalar>
+inline Lens<Scalar> crop(const Lens<Scalar>& lens, const Region<Scalar>& region) {
+    std::array<int, 2> start;
+    std::array<int, 2> end;
+    for (int i = 0; i < 2; ++i) {
+        start[i] = std::min(std::max(region.offset[i], 0), lens.dimensions[i]);
+        // Compute the end in a long so a region that reaches to the edge of any image doesn't overflow
+        const long last = std::min<long>(long(region.offset[i]) + region.dimensions[i], lens.dimensions[i]);
+        end[i]          = std::max(start[i], int(last));
+    }
+
+    // Move the centre so the middle of the new image is at the same place relative to the lens
+    Lens<Scalar> cropped = lens;
+    for (int i = 0; i < 2; ++i) {
+        cropped.dimensions[i] = end[i] - start[i];
+        cropped.centre[i]     = lens.centre[i] + start[i] + Scalar(cropped.dimensions[i] - lens.dimensions[i]) * 0.5;
+    }
+    return cropped;
+}
+
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_REGION_HPP
@@ -0,0 +1,331 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_RING_LOOKUP_HPP
+#define VISUALMESH_RING_LOOKUP_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "lens.hpp"
+#include "mesh.hpp"
+#include "model/ring_base.hpp"
+#include "utility/math.hpp"
+
+namespace visualmesh {
+
+/**
+ * @brief Looks up which points of a ring model mesh are on the screen by working out the visible part of each ring
+ *
+ * @details
+ *  The ring models place their points in rings of the same phi, evenly spaced around theta. The rays of a ring all have
+ *  the same z, so the test against a screen edge or the field of view, dot(axis, ray) compared to the cos of the cone
+ *  angle, is a sinusoid in theta and the part of the ring on the right side of it is a single arc that is found with
+ *  one acos. Intersecting these arcs for the four screen edges and the field of view gives the visible arcs of the ring
+ *  without visiting the BSP, so a lookup costs a few checks per ring rather than per BSP element. Each arc is grown by
+ *  a couple of pixels and then its ends are trimmed by projecting the points, so even for fisheye lenses where the
+ *  screen edges are only approximate the points found are those that project onto the screen. The exceptions are the
+ *  few points where a ring leaves the screen by less than the growth between two arcs, which are kept, and the odd
+ *  point where a fisheye edge is further than the growth from its cone, which is missed far less often than by a BSP
+ *  lookup.
+ *
+ *  The mesh keeps its nodes in the order of the leaves of its BSP, so the points in an arc are not next to each other
+ *  in the mesh. The points of each ring are held here sorted by theta, and the points in the arcs are marked in a set
+ *  of bits over the mesh which is then read out as the ranges a Mesh lookup returns. The bits cost a sixty fourth of
+ *  the mesh to clear and read, which is far less than the points that are on the screen.
+ *
+ * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+ * @tparam Model  the ring model that the mesh was generated with
+ */
+template <typename Scalar, template <typename> class Model>
+class RingLookup {
+public:
+    static_assert(
+      std::is_base_of<model::RingBase<Scalar, Model, Model<Scalar>::N_NEIGHBOURS>, Model<Scalar>>::value,
+      "RingLookup can only be used with the ring models");
+
+    /**
+     * @brief Find the rings of a mesh and sort the points of each around theta
+     *
+     * @param mesh the mesh to build the lookup for, this lookup can then be used with it or any copy of it
+     */
+    explicit RingLookup(const Mesh<Scalar, Model>& mesh) : mesh(mesh.id()), n_nodes(int(mesh.nodes.size())) {
+        order.resize(n_nodes);
+        thetas.resize(n_nodes);
+        std::iota(order.begin(), order.end(), 0);
+        std::vector<Scalar> theta(n_nodes);
+        for (int i = 0; i < n_nodes; ++i) {
+            const Scalar t = std::atan2(mesh.nodes[i].ray[1], mesh.nodes[i].ray[0]);
+            theta[i]       = t < 0 ? t + Scalar(2.0 * M_PI) : t;
+        }
+
+        // Every point in a ring is made from the same phi so they share exactly the same z
+        const auto z = [&](const int& n) { return mesh.nodes[n].ray[2]; };
+        std::sort(order.begin(), order.end(), [&](const int& a, const int& b) {
+            return z(a) < z(b) || (z(a) == z(b) && theta[a] < theta[b]);
+        });
+        for (int i = 0; i < n_nodes; ++i) {
+            thetas[i] = theta[order[i]];
+            if (i == 0 || z(order[i]) != z(order[i - 1])) {
+                const auto& ray = mesh.nodes[order[i]].ray;
+                rings.push_back(Ring{ray[2], std::sqrt(ray[0] * ray[0] + ray[1] * ray[1]), i, 0});
+            }
+            ++rings.back().count;
+        }
+        words.resize((n_nodes + 63) / 64);
+    }
+
+    /**
+     * @brief Lookup which ranges of the mesh are on screen
+     *
+     * @param source the mesh this lookup was built for, or a copy of it
+     * @param Hoc    the homogenous transformation matrix that transforms from camera space to observation plane space
+     * @param lens   the lens object describing the type and geometry of the lens that is used
+     *
+     * @return pairs of start/end ranges that are the points which are on the screen
+     */
+    std::vector<std::pair<int, int>> lookup(const Mesh<Scalar, Model>& source,
+                                            const mat4<Scalar>& Hoc,
+                                            const Lens<Scalar>& lens) {
+        std::vector<std::pair<int, int>> ranges;
+        lookup(source, Hoc, lens, ranges);
+        return ranges;
+    }
+
+    /**
+     * @brief Lookup which ranges of the mesh are on screen, writing them into an existing list.
+     *
+     * @details
+     *  The list is cleared first but keeps its memory. The ranges are sorted and don't overlap, the same as those from
+     *  a lookup of the mesh. This lookup reuses memory it holds between calls, so each thread needs its own.
+     *
+     * @param source the mesh this lookup was built for, or a copy of it
+     * @param Hoc    the homogenous transformation matrix that transforms from camera space to observation plane space
+     * @param lens   the lens object describing the type and geometry of the lens that is used
+     * @param output the list to write the pairs of start/end ranges of the points which are on the screen into
+     */
+    void lookup(const Mesh<Scalar, Model>& source,
+                const mat4<Scalar>& Hoc,
+                const Lens<Scalar>& lens,
+                std::vector<std::pair<int, int>>& output) {
+        if (source.id() != mesh) { throw std::runtime_error("RingLookup used with a mesh it was not built for"); }
+
+        using Frame = typename Mesh<Scalar, Model>::LookupFrame;
+        const Frame frame(Hoc, lens);
+        std::fill(words.begin(), words.end(), uint64_t(0));
+
+        // Grow every cone by a couple of pixels so the arcs hold every point that could be on the screen, the ends are
+        // then trimmed back to the points that really are
+        const Scalar grow  = std::min(Scalar(2.0) / lens.focal_length, Scalar(0.1));
+        const Scalar cos_g = std::cos(grow);
+        const Scalar sin_g = std::sin(grow);
+        const Scalar fov   = lens.fov * Scalar(0.5) + grow;
+
+        for (const auto& ring : rings) {
+            auto visible = [&](const int& p) {
+                return Mesh<Scalar, Model>::on_screen(frame, source.nodes[order[ring.start + p]].ray);
+            };
+
+            // The origin, or a ring too small to have any width, is just checked directly
+            if (ring.count == 1 || ring.xy <= 0) {
+                for (int p = 0; p < ring.count; ++p) {
+                    if (visible(p)) { mark(order[ring.start + p]); }
+                }
+                continue;
+            }
+
+            arcs.clear();
+            arcs.emplace_back(Scalar(0.0), Scalar(2.0 * M_PI));
+            if (fov < Scalar(M_PI)) { intersect(ring, frame.rXCo, std::cos(fov), true); }
+            for (int e = 0; e < 4 && !arcs.empty(); ++e) {
+                // The edge cone less the growth, when the growth is larger than the cone nothing is cut by this edge
+                const Scalar sin_e = frame.edges.sin[e] * cos_g - frame.edges.cos[e] * sin_g;
+                if (sin_e < 0) { continue; }
+                const vec3<Scalar> axis = {{frame.edges.axis[0][e], frame.edges.axis[1][e], frame.edges.axis[2][e]}};
+                intersect(ring, axis, frame.edges.cos[e] * cos_g + frame.edges.sin[e] * sin_g, false);
+            }
+
+            // Find the points in each arc, an arc that reaches 2π continues from the arc that starts at 0
+            const auto begin = std::next(thetas.begin(), ring.start);
+            const auto end   = std::next(begin, ring.count);
+            points.clear();
+            for (const auto& arc : arcs) {
+                const int lo = int(std::distance(begin, std::lower_bound(begin, end, arc.first)));
+                const int hi = int(std::distance(begin, std::lower_bound(begin, end, arc.second)));
+                if (lo < hi) { points.emplace_back(lo, hi); }
+            }
+            if (points.size() > 1 && points.front().first == 0 && points.back().second == ring.count) {
+                points.back().second += points.front().second;
+                points.erase(points.begin());
+            }
+
+            for (auto range : points) {
+                // Trim each end in to the first point that is on the screen, stopping if they pass each other
+                while (range.first < range.second && !visible(range.first % ring.count)) {
+                    ++range.first;
+                }
+                while (range.first < range.second && !visible((range.second - 1) % ring.count)) {
+                    --range.second;
+                }
+                // Then take any points just past each end that are still on the screen
+                if (range.first < range.second) {
+                    while (range.second - range.first < ring.count
+                           && visible((range.first - 1 + ring.count) % ring.count)) {
+                        --range.first;
+                    }
+                    while (range.second - range.first < ring.count && visible(range.second % ring.count)) {
+                        ++range.second;
+                    }
+                }
+                for (int p = range.first; p < range.second; ++p) {
+                    mark(order[ring.start + (p + ring.count) % ring.count]);
+                }
+            }
+        }
+
+        // Read the marked points out as ranges
+        output.clear();
+        int start = -1;
+        for (int w = 0; w < int(words.size()); ++w) {
+            uint64_t word = words[w];
+            int bit       = 0;
+            while (bit < 64) {
+                // Skip to the next bit that changes from the state we are in
+                const uint64_t remaining = (start < 0 ? word : ~word) >> bit;
+                if (remaining == 0) { break; }
+                bit += count_trailing_zeros(remaining);
+                if (start < 0) { start = w * 64 + bit; }
+                else {
+                    output.emplace_back(start, w * 64 + bit);
+                    start = -1;
+                }
+            }
+        }
+        if (start >= 0) { output.emplace_back(start, n_nodes); }
+    }
+
+private:
+    /// The points of one ring of the mesh
+    struct Ring {
+        /// The z of every ray in the ring
+        Scalar z;
+        /// The length of the rays of the ring in the xy plane
+        Scalar xy;
+        /// Where the ring starts in the sorted order
+        int start;
+        /// The number of points in the ring
+        int count;
+    };
+
+    /// Mark a point of the mesh as being on the screen
+    void mark(const int& i) {
+        words[i / 64] |= uint64_t(1) << (i % 64);
+    }
+
+    /// @return the number of zero bits below the lowest set bit of a non zero value
+    static int count_trailing_zeros(uint64_t v) {
+        int n = 0;
+        while ((v & 0xFFFFFFFF) == 0) {
+            v >>= 32;
+            n += 32;
+        }
+        while ((v & 1) == 0) {
+            v >>= 1;
+            ++n;
+        }
+        return n;
+    }
+
+    /**
+     * @brief Cut the visible arcs of a ring down to the part of the ring on one side of a cone
+     *
+     * @details
+     *  Around the ring dot(axis, ray) = R cos(theta - alpha) + axis_z z, with R and alpha the length and angle of the
+     *  axis in the xy plane scaled by the ring. The part of the ring above or below a limit is then a single arc about
+     *  alpha or the opposite side of the ring.
+     *
+     * @param ring  the ring that is being looked up
+     * @param axis  the axis of the cone
+     * @param limit the cos of the cone angle
+     * @param above true to keep the points where dot(axis, ray) is above the limit, false for those below it
+     */
+    void intersect(const Ring& ring, const vec3<Scalar>& axis, const Scalar& limit, const bool& above) {
+        const Scalar R = ring.xy * std::sqrt(axis[0] * axis[0] + axis[1] * axis[1]);
+        const Scalar d = limit - axis[2] * ring.z;
+
+        // A corner of the screen that the lens can't unproject gives an edge that isn't a number, which can't cut
+        if (std::isnan(R) || std::isnan(d)) { return; }
+
+        // The whole ring is on one side of the limit
+        if (d >= R || d <= -R) {
+            if ((d >= R) == above) { arcs.clear(); }
+            return;
+        }
+
+        const Scalar alpha = std::atan2(axis[1], axis[0]) + (above ? Scalar(0.0) : Scalar(M_PI));
+        const Scalar half  = above ? std::acos(d / R) : Scalar(M_PI) - std::acos(d / R);
+
+        // Split the arc where it passes 2π so every piece is increasing
+        Scalar s = std::fmod(alpha - half, Scalar(2.0 * M_PI));
+        s        = s < 0 ? s + Scalar(2.0 * M_PI) : s;
+        const Scalar e = s + 2 * half;
+        std::array<std::pair<Scalar, Scalar>, 2> pieces{{
+          std::make_pair(s, std::min(e, Scalar(2.0 * M_PI))),
+          std::make_pair(Scalar(0.0), e - Scalar(2.0 * M_PI)),
+        }};
+
+        cut.clear();
+        for (const auto& arc : arcs) {
+            for (const auto& piece : pieces) {
+                const Scalar lo = std::max(arc.first, piece.first);
+                const Scalar hi = std::min(arc.second, piece.second);
+                if (lo < hi) { cut.emplace_back(lo, hi); }
+            }
+        }
+        std::sort(cut.begin(), cut.end());
+        std::swap(arcs, cut);
+    }
+
+    /// The identifier of the mesh this lookup was built for
+    uint64_t mesh;
+    /// The number of nodes in the mesh
+    int n_nodes;
+    /// The index in the mesh of each point, sorted by ring and then by theta
+    std::vector<int> order;
+    /// The theta of each point in the sorted order
+    std::vector<Scalar> thetas;
+    /// The rings of the mesh from the bottom up
+    std::vector<Ring> rings;
+    /// A bit for every point of the mesh that is on the screen
+    std::vector<uint64_t> words;
+    /// The visible arcs of the current ring, and space to cut them into
+    std::vector<std::pair<Scalar, Scalar>> arcs;
+    std::vector<std::pair<Scalar, Scalar>> cut;
+    /// The ranges of the sorted points of the current ring in the visible arcs
+    std::vector<std::pair<int, int>> points;
+};
+
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_RING_LOOKUP_HPP
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_THRESHOLDED_MESH_HPP
+#define VISUALMESH_THRESHOLDED_MESH_HPP
+
+#include <array>
+#include <vector>
+
+namespace visualmesh {
+
+/**
+ * @brief Holds the points of a classified visual mesh whose score for a class passed a threshold
+ *
+ * @details
+ *  This is what is left of a classified mesh once every point whose score for a chosen class is below a threshold has
+ *  been removed. As only the surviving points are kept there is no neighbourhood graph, the global_indices can be used
+ *  to map back into the original mesh if the neighbours of a point are needed.
+ *
+ * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+ */
+template <typename Scalar>
+struct ThresholdedMesh {
+
+    /// The pixel coordinates (x,y) of the points that passed the threshold
+    std::vector<std::array<Scalar, 2>> pixel_coordinates;
+    /// The original indicies of these points in the visual mesh
+    std::vector<int> global_indices;
+    /// The final output of classification for these points, with the score of every class for each point
+    std::vector<Scalar> classifications;
+};
+
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_THRESHOLDED_MESH_HPP
@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_UTILITY_AFFINITY_HPP
+#define VISUALMESH_UTILITY_AFFINITY_HPP
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif  // defined(__linux__)
+
+namespace visualmesh {
+
+/**
+ * @brief Restrict a thread to run on a set of processors
+ *
+ * @details
+ *  Only Linux supports this, on other platforms the thread is left for the scheduler to place.
+ *
+ * @param thread the thread to restrict
+ * @param cpus   the indices of the processors the thread may run on, if empty the thread may run on any of them
+ *
+ * @return true if the thread was restricted to the processors
+ */
+inline bool pin_thread(std::thread& thread, const std::vector<int>& cpus) {
+    if (cpus.empty()) { return false; }
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (const auto& cpu : cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) { CPU_SET(cpu, &set); }
+    }
+    return ::pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+#else
+    (void) thread;
+    return false;
+#endif  // defined(__linux__)
+}
+
+/**
+ * @brief Parse a list of processors in the format Linux uses in sysfs, such as "0-3,8,10-11"
+ *
+ * @param list the text of the list
+ *
+ * @return the processors in the list, in the order they are listed
+ */
+inline std::vector<int> parse_cpu_list(const std::string& list) {
+    std::vector<int> cpus;
+    const char* c = list.c_str();
+    while (*c != '\0') {
+        char* end       = nullptr;
+        const long from = std::strtol(c, &end, 10);
+        if (end == c) { break; }
+        long to = from;
+        c       = end;
+        if (*c == '-') {
+            to = std::strtol(c + 1, &end, 10);
+            c  = end;
+        }
+        for (long cpu = from; cpu <= to; ++cpu) {
+            cpus.push_back(int(cpu));
+        }
+        if (*c == ',') { ++c; }
+    }
+    return cpus;
+}
+
+namespace affinity_detail {
+    /// @return the first line of a file, or an empty string if it can't be read
+    inline std::string read_line(const std::string& path) {
+        std::ifstream file(path);
+        std::string line;
+        std::getline(file, line);
+        return line;
+    }
+}  // namespace affinity_detail
+
+/**
+ * @brief Find the processors that are in each NUMA node
+ *
+ * @details
+ *  This reads the topology from sysfs on Linux. Where it isn't available, a single node holding no processors is
+ *  returned so callers can treat every processor as local.
+ *
+ * @return the processors of each online NUMA node
+ */
+inline std::vector<std::vector<int>> numa_nodes() {
+    std::vector<std::vector<int>> nodes;
+#if defined(__linux__)
+    for (const auto& node : parse_cpu_list(affinity_detail::read_line("/sys/devices/system/node/online"))) {
+        const std::string path = "/sys/devices/system/node/node" + std::to_string(node) + "/cpulist";
+        nodes.push_back(parse_cpu_list(affinity_detail::read_line(path)));
+    }
+#endif  // defined(__linux__)
+    if (nodes.empty()) { nodes.emplace_back(); }
+    return nodes;
+}
+
+/**
+ * @brief Find the fastest processors of the system, such as the big cores of an ARM big.LITTLE processor
+ *
+ * @details
+ *  Processors are ranked by the capacity the kernel gives them for scheduling, or by their maximum frequency where
+ *  that isn't available, and those that share the highest rank are returned. If every processor is the same they are
+ *  all returned, and if none can be ranked the list is empty which pin_thread treats as any processor.
+ *
+ * @return the online processors that have the highest capacity
+ */
+inline std::vector<int> performance_cpus() {
+    std::vector<int> cpus;
+#if defined(__linux__)
+    long best = 0;
+    for (const auto& cpu : parse_cpu_list(affinity_detail::read_line("/sys/devices/system/cpu/online"))) {
+        const std::string base = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+        std::string rank       = affinity_detail::read_line(base + "/cpu_capacity");
+        if (rank.empty()) { rank = affinity_detail::read_line(base + "/cpufreq/cpuinfo_max_freq"); }
+        const long value = std::atol(rank.c_str());
+        if (value <= 0) { continue; }
+        if (value > best) {
+            best = value;
+            cpus.clear();
+        }
+        if (value == best) { cpus.push_back(cpu); }
+    }
+#endif  // defined(__linux__)
+    return cpus;
+}
+
+/**
+ * @brief Find which of a set of NUMA nodes a processor belongs to
+ *
+ * @param cpu   the processor to find
+ * @param nodes the processors of each NUMA node, as returned by numa_nodes
+ *
+ * @return the index of the node holding the processor, or 0 if it isn't in any of them
+ */
+inline int numa_node_of(const int& cpu, const std::vector<std::vector<int>>& nodes) {
+    for (int n = 0; n < int(nodes.size()); ++n) {
+        if (std::find(nodes[n].begin(), nodes[n].end(), cpu) != nodes[n].end()) { return n; }
+    }
+    return 0;
+}
+
+/// @return the processor the calling thread is running on, or -1 if it can't be found
+inline int current_cpu() {
+#if defined(__linux__)
+    return ::sched_getcpu();
+#else
+    return -1;
+#endif  // defined(__linux__)
+}
+
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_UTILITY_AFFINITY_HPP
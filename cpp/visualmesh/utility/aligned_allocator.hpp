@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef VISUALMESH_UTILITY_ALIGNED_ALLOCATOR_HPP
+#define VISUALMESH_UTILITY_ALIGNED_ALLOCATOR_HPP
+
+#include <cstddef>
+#include <cstdlib>
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+#include <new>
+#include <vector>
+
+namespace visualmesh {
+
+/**
+ * @brief A standard library compatible allocator that aligns its allocations to a fixed boundary
+ *
+ * @details
+ *  This is used for buffers that are accessed using vector instructions so that every block starts on a cache line
+ *  and vector loads never split across two lines.
+ *
+ * @tparam T     the type of the elements being allocated
+ * @tparam Align the alignment of the allocations in bytes, must be a power of two
+ */
+template <typename T, std::size_t Align = 64>
+struct AlignedAllocator {
+    using value_type = T;
+
+    template <typename U>
+    struct rebind {
+        using other = AlignedAllocator<U, Align>;
+    };
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Align>& /*other*/) {}
+
+    T* allocate(const std::size_t& n) {
+        // Aligned alloc requires the size to be a multiple of the alignment
+        const std::size_t bytes = ((n * sizeof(T) + Align - 1) / Align) * Align;
+#if defined(_WIN32)
+        void* ptr = ::_aligned_malloc(bytes, Align);
+        if (ptr == nullptr) { throw std::bad_alloc(); }
+#else
+        void* ptr = nullptr;
+        if (::posix_memalign(&ptr, Align, bytes) != 0) { throw std::bad_alloc(); }
+#endif
+        return static_cast<T*>(ptr);
+    }
+
+    void deallocate(T* ptr, const std::size_t& /*n*/) {
+#if defined(_WIN32)
+        ::_aligned_free(ptr);
+#else
+        ::free(ptr);  // NOLINT(cppcoreguidelines-no-malloc) memory came from posix_memalign
+#endif
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Align>& /*other*/) const {
+        return true;
+    }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, Align>& /*other*/) const {
+        return false;
+    }
+};
+
+/// A vector whose storage is aligned to a cache line
+template <typename T>
+using aligned_vector = std::vector<T, AlignedAllocator<T>>;
+
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_UTILITY_ALIGNED_ALLOCATOR_HPP
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_UTILITY_ATOMIC_FILE_HPP
+#define VISUALMESH_UTILITY_ATOMIC_FILE_HPP
+
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <sys/stat.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#elif defined(_WIN32)
+#include <direct.h>
+#include <process.h>
+#endif
+
+namespace visualmesh {
+
+/**
+ * @brief Make a directory and any of its parents that don't exist yet
+ *
+ * @param directory the directory to make
+ *
+ * @return true if the directory exists once this returns
+ */
+inline bool make_directories(const std::string& directory) {
+    // Each parent is made in turn and the directory itself is made last, when there are no more separators
+    for (std::size_t pos = directory.find('/', 1);; pos = directory.find('/', pos + 1)) {
+#if defined(_WIN32)
+        ::_mkdir(directory.substr(0, pos).c_str());
+#else
+        ::mkdir(directory.substr(0, pos).c_str(), 0755);
+#endif
+        if (pos == std::string::npos) { break; }
+    }
+    struct stat info;
+    return !directory.empty() && ::stat(directory.c_str(), &info) == 0 && (info.st_mode & S_IFDIR) != 0;
+}
+
+/**
+ * @brief Write a file so that a reader only ever sees the old file or the whole of the new one
+ *
+ * @details
+ *  The bytes are written to a temporary file next to the target that is then renamed over it. Each process and thread
+ *  gets its own temporary file, so several of them writing the same file at once can't mix their output. If anything
+ *  fails the temporary file is removed and the target is left as it was.
+ *
+ * @param path  the file to write
+ * @param bytes the contents of the file
+ *
+ * @return true if the file was written
+ */
+inline bool write_atomically(const std::string& path, const std::string& bytes) {
+    std::stringstream name;
+#if defined(_WIN32)
+    name << path << "." << ::_getpid() << ".";
+#else
+    name << path << "." << ::getpid() << ".";
+#endif
+    name << std::hash<std::thread::id>()(std::this_thread::get_id()) << ".tmp";
+    const std::string temporary = name.str();
+
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+    file.write(bytes.data(), std::streamsize(bytes.size()));
+    file.close();
+    if (!file || std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_UTILITY_ATOMIC_FILE_HPP
@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_UTILITY_BOUNDED_QUEUE_HPP
+#define VISUALMESH_UTILITY_BOUNDED_QUEUE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace visualmesh {
+
+/**
+ * @brief A fixed size lock-free queue that any number of threads can push to and pop from
+ *
+ * @details
+ *  This is the bounded queue by Dmitry Vyukov. Each slot holds a sequence number that says whether it is ready to be
+ *  written or read for the current lap of the ring, so producers and consumers only contend on claiming a position
+ *  and never wait on each other while the value is being moved in or out. A full or empty queue is reported straight
+ *  away rather than waited on, anyone who wants to block builds that on top. With a single producer and a single
+ *  consumer the claims never fail, so it serves as an SPSC queue as well.
+ *
+ * @tparam T the type of the values in the queue, which must be default constructible and move assignable
+ */
+template <typename T>
+class BoundedQueue {
+public:
+    /**
+     * @brief Construct a new empty queue
+     *
+     * @param capacity the number of values the queue can hold, which is rounded up to a power of two
+     */
+    explicit BoundedQueue(const std::size_t& capacity) {
+        std::size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        mask  = size - 1;
+        slots = std::unique_ptr<Slot[]>(new Slot[size]);
+        for (std::size_t i = 0; i < size; ++i) {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    /**
+     * @brief Move a value onto the back of the queue if there is room for it
+     *
+     * @param value the value to push, which is only moved from if the push succeeds
+     *
+     * @return true if the value was pushed, false if the queue was full
+     */
+    bool try_push(T& value) {
+        std::size_t pos = tail.value.load(std::memory_order_relaxed);
+        while (true) {
+            Slot& slot             = slots[pos & mask];
+            const std::size_t s    = slot.sequence.load(std::memory_order_acquire);
+            const std::ptrdiff_t d = std::ptrdiff_t(s) - std::ptrdiff_t(pos);
+            if (d == 0) {
+                if (tail.value.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    slot.value = std::move(value);
+                    slot.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            // The slot still holds a value from the last lap
+            else if (d < 0) {
+                return false;
+            }
+            else {
+                pos = tail.value.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * @brief Move the value at the front of the queue out if there is one
+     *
+     * @param value where to move the value to
+     *
+     * @return true if a value was popped, false if the queue was empty
+     */
+    bool try_pop(T& value) {
+        std::size_t pos = head.value.load(std::memory_order_relaxed);
+        while (true) {
+            Slot& slot             = slots[pos & mask];
+            const std::size_t s    = slot.sequence.load(std::memory_order_acquire);
+            const std::ptrdiff_t d = std::ptrdiff_t(s) - std::ptrdiff_t(pos + 1);
+            if (d == 0) {
+                if (head.value.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = std::move(slot.value);
+                    // Leave nothing behind that holds on to resources until the slot is reused
+                    slot.value = T();
+                    slot.sequence.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            // The slot hasn't been written for this lap yet
+            else if (d < 0) {
+                return false;
+            }
+            else {
+                pos = head.value.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /// @return the number of values the queue can hold
+    std::size_t capacity() const {
+        return mask + 1;
+    }
+
+private:
+    struct Slot {
+        std::atomic<std::size_t> sequence;
+        T value;
+    };
+
+    /// A position in the ring, padded to a cache line so that producers and consumers don't write to the same one
+    struct Position {
+        std::atomic<std::size_t> value{0};
+        char pad[64 - sizeof(std::atomic<std::size_t>)];
+    };
+
+    /// The slots of the ring
+    std::unique_ptr<Slot[]> slots;
+    /// One less than the number of slots, for wrapping positions into the ring
+    std::size_t mask;
+    /// The next position to pop from
+    Position head;
+    /// The next position to push to
+    Position tail;
+};
+
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_UTILITY_BOUNDED_QUEUE_HPP
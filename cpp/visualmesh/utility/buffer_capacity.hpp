@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef VISUALMESH_UTILITY_BUFFER_CAPACITY_HPP
+#define VISUALMESH_UTILITY_BUFFER_CAPACITY_HPP
+
+#include <algorithm>
+#include <atomic>
+
+namespace visualmesh {
+
+/**
+ * @brief Work out how many elements a cached device buffer should be reallocated for when it is too small
+ *
+ * @details
+ *  The number of points on the screen changes every frame with the pitch of the camera, so allocating exactly what each
+ *  frame needs reallocates every time a frame has a few more points than any before it. Instead the capacity grows to
+ *  at least one and a half times what it was, rounded up to a size class of the form m * 2^k where m is between 4 and
+ *  7. This way a buffer only reallocates a handful of times before it fits the largest frame.
+ *
+ * @param capacity the number of elements the buffer can currently hold
+ * @param needed   the number of elements that are needed
+ *
+ * @return the number of elements to allocate the buffer for, which is at least needed
+ */
+inline int grow_capacity(const int& capacity, const int& needed) {
+    const int target = std::max(needed, capacity + capacity / 2);
+
+    // Find the smallest power of two that puts the target in the size class m * 2^k with m at most 7
+    int k = 0;
+    while ((7 << k) < target) {
+        ++k;
+    }
+    return ((target + (1 << k) - 1) >> k) << k;
+}
+
+/**
+ * @brief The largest number of elements that a set of cached buffers has been asked to hold
+ *
+ * @details
+ *  This is thread safe so that it can be updated by every call to an engine. Once a program has run over
+ *  representative data its engine can report this, and later engines can reserve that many elements up front so they
+ *  never allocate device memory while running.
+ */
+class HighWaterMark {
+public:
+    /**
+     * @brief Record that a buffer needed to hold this many elements
+     *
+     * @param n the number of elements that were needed
+     */
+    void update(const int& n) {
+        int current = value.load(std::memory_order_relaxed);
+        while (current < n && !value.compare_exchange_weak(current, n, std::memory_order_relaxed)) {}
+    }
+
+    /**
+     * @brief Get the largest number of elements that has been recorded
+     *
+     * @return the high water mark
+     */
+    int get() const {
+        return value.load(std::memory_order_relaxed);
+    }
+
+private:
+    /// The largest number of elements that has been recorded
+    std::atomic<int> value{0};
+};
+
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_UTILITY_BUFFER_CAPACITY_HPP
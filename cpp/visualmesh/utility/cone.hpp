@@ -18,6 +18,10 @@
 #ifndef VISUALMESH_UTILITY_CONE_HPP
 #define VISUALMESH_UTILITY_CONE_HPP
 
+#include <cstddef>
+#include <utility>
+#include <vector>
+
 #include "math.hpp"
 
 namespace visualmesh {
@@ -98,6 +102,40 @@ inline std::pair<vec3<Scalar>, Scalar> cone_from_points(const vec3<Scalar>& p1,
     return std::make_pair(axis, cos_theta);
 }
 
+/**
+ * @brief Find the smallest cone that contains a set of rays
+ *
+ * @details
+ *  Uses welzls algorithm for circles adapted to cones, the same as the mesh uses for its BSP tree. The rays should be
+ *  in a random order, otherwise it can suffer from very poor performance.
+ *
+ * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+ *
+ * @param rays the unit vectors to find the cone around
+ *
+ * @return the axis of the cone and the cosine of its half angle
+ */
+template <typename Scalar>
+inline std::pair<vec3<Scalar>, Scalar> smallest_cone(const std::vector<vec3<Scalar>>& rays) {
+    std::pair<vec3<Scalar>, Scalar> cone(cone_from_points<Scalar>());
+    for (std::size_t i = 0; i < rays.size(); ++i) {
+        if (dot(cone.first, rays[i]) < cone.second) {
+            cone = cone_from_points(rays[i]);
+            for (std::size_t j = 0; j < i; ++j) {
+                if (dot(cone.first, rays[j]) < cone.second) {
+                    cone = cone_from_points(rays[i], rays[j]);
+                    for (std::size_t k = 0; k < j; ++k) {
+                        if (dot(cone.first, rays[k]) < cone.second) {
+                            cone = cone_from_points(rays[i], rays[j], rays[k]);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return cone;
+}
+
 }  // namespace visualmesh
 
 #endif  // VISUALMESH_UTILITY_CONE_HPP
@@ -18,8 +18,13 @@
 #ifndef VISUALMESH_UTILITY_FOURCC_HPP
 #define VISUALMESH_UTILITY_FOURCC_HPP
 
+#include <array>
+#include <cstdint>
+#include <stdexcept>
 #include <string>
 
+#include "math.hpp"
+
 namespace visualmesh {
 
 /**
@@ -45,6 +50,77 @@ inline std::string fourcc_text(const uint32_t& code) {
     return std::string({char(code & 0xFF), char(code >> 8 & 0xFF), char(code >> 16 & 0xFF), char(code >> 24 & 0xFF)});
 }
 
+/// @return if the format is a bayer pattern, a single channel image where each 2x2 tile holds one red and blue pixel
+inline bool is_bayer(const uint32_t& format) {
+    return format == fourcc("GRBG") || format == fourcc("RGGB") || format == fourcc("GBRG") || format == fourcc("BGGR");
+}
+
+/// @return if the format is a YUV format, where the luma and chroma of each pixel are stored apart
+inline bool is_yuv(const uint32_t& format) {
+    return format == fourcc("NV12") || format == fourcc("YUYV") || format == fourcc("YUY2") || format == fourcc("UYVY");
+}
+
+/**
+ * @brief Get the coordinate of the first red pixel of a bayer pattern
+ *
+ * @tparam T the type the coordinate is given in, the image load kernels take it as floating point
+ *
+ * @param format the bayer pattern as a fourcc code
+ *
+ * @return the column and row of the red pixel in each 2x2 tile
+ */
+template <typename T = int>
+inline vec2<T> bayer_first_red(const uint32_t& format) {
+    switch (format) {
+        case fourcc("GRBG"): return {{T(1), T(0)}};
+        case fourcc("RGGB"): return {{T(0), T(0)}};
+        case fourcc("GBRG"): return {{T(0), T(1)}};
+        case fourcc("BGGR"): return {{T(1), T(1)}};
+        default: throw std::runtime_error("The fourcc code provided is not a valid bayer pattern");
+    }
+}
+
+/**
+ * @brief Get where the luma and chroma of each pixel are in a YUV image for the YUV image load kernels
+ *
+ * @param format     the YUV format as a fourcc code
+ * @param dimensions the dimensions of the image
+ *
+ * @return the luma bytes per pixel, the luma offset, the chroma bytes per pair of pixels, the U offset, the V offset,
+ *         the number of rows that share chroma as a shift, and the width and height of the image
+ */
+inline std::array<int, 8> yuv_layout(const uint32_t& format, const vec2<int>& dimensions) {
+    switch (format) {
+        case fourcc("NV12"): return {{1, 0, 2, 0, 1, 1, dimensions[0], dimensions[1]}};
+        case fourcc("YUYV"):
+        case fourcc("YUY2"): return {{2, 0, 4, 1, 3, 0, dimensions[0], dimensions[1]}};
+        case fourcc("UYVY"): return {{2, 1, 4, 0, 2, 0, dimensions[0], dimensions[1]}};
+        default: throw std::runtime_error("The fourcc code provided is not a valid YUV format");
+    }
+}
+
+/**
+ * @brief Get the dimensions of the device image that holds an image
+ *
+ * @details
+ *  YUV images don't store each pixel together so they are held as a single channel image of their bytes, an NV12 image
+ *  has half as many rows again for its chroma and a packed 4:2:2 image has two bytes per pixel.
+ *
+ * @param dimensions the dimensions of the image
+ * @param format     the pixel format of the image as a fourcc code
+ *
+ * @return the width and height of the device image
+ */
+inline vec2<int> image_extent(const vec2<int>& dimensions, const uint32_t& format) {
+    switch (format) {
+        case fourcc("NV12"): return {{dimensions[0], dimensions[1] + dimensions[1] / 2}};
+        case fourcc("YUYV"):
+        case fourcc("YUY2"):
+        case fourcc("UYVY"): return {{dimensions[0] * 2, dimensions[1]}};
+        default: return dimensions;
+    }
+}
+
 }  // namespace visualmesh
 
 #endif  // VISUALMESH_UTILITY_FOURCC_HPP
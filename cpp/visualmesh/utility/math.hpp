@@ -20,6 +20,7 @@
 
 #include <array>
 #include <cmath>
+#include <limits>
 
 namespace visualmesh {
 
@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef VISUALMESH_UTILITY_OBJECT_POOL_HPP
+#define VISUALMESH_UTILITY_OBJECT_POOL_HPP
+
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+namespace visualmesh {
+
+/**
+ * @brief A thread safe pool of reusable objects that are leased out to one caller at a time
+ *
+ * @details
+ *  The engines use this to hold the scratch state for a single call so that an engine can be shared between threads.
+ *  Each caller leases an object for the duration of its call and it is returned to the pool when the lease is
+ *  destroyed. If there are no idle objects a new one is made, so the pool grows to the number of concurrent callers.
+ *  Objects are leased out in the order they were returned so the one that has been idle the longest is used first.
+ *  The lock is only held to take or return an object. The pool must outlive every lease taken from it.
+ *
+ * @tparam T the type of object held in the pool
+ */
+template <typename T>
+class ObjectPool {
+private:
+    /// Returns an object to the pool when its lease is destroyed
+    struct Release {
+        ObjectPool* pool;
+        void operator()(T* object) const {
+            pool->put(std::unique_ptr<T>(object));
+        }
+    };
+
+public:
+    /// An object leased from the pool, which is returned when this is destroyed
+    using Lease = std::unique_ptr<T, Release>;
+
+    ObjectPool()                  = default;
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool(ObjectPool&&)      = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+    ObjectPool& operator=(ObjectPool&&) = delete;
+    ~ObjectPool()                       = default;
+
+    /**
+     * @brief Lease an object from the pool, making a new one if there are none idle
+     *
+     * @tparam Factory the type of the function used to make a new object
+     *
+     * @param make a function returning a new T, called without the lock held if the pool has no idle objects
+     *
+     * @return a lease for the object which returns it to the pool when destroyed
+     */
+    template <typename Factory>
+    Lease acquire(Factory&& make) {
+        std::unique_ptr<T> object;
+        /* mutex scope */ {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!idle.empty()) {
+                object = std::move(idle.front());
+                idle.pop_front();
+            }
+        }
+        if (!object) { object = std::make_unique<T>(make()); }
+        return Lease(object.release(), Release{this});
+    }
+
+    /**
+     * @brief Lease an object from the pool, default constructing a new one if there are none idle
+     *
+     * @return a lease for the object which returns it to the pool when destroyed
+     */
+    Lease acquire() {
+        return acquire([] { return T(); });
+    }
+
+    /**
+     * @brief Add an object to the idle objects in the pool
+     *
+     * @param object the object to add
+     */
+    void put(std::unique_ptr<T>&& object) {
+        std::lock_guard<std::mutex> lock(mutex);
+        idle.push_back(std::move(object));
+    }
+
+    /**
+     * @brief Make new objects until there are at least n idle objects in the pool
+     *
+     * @tparam Factory the type of the function used to make a new object
+     *
+     * @param n    the number of idle objects the pool should hold
+     * @param make a function returning a new T
+     */
+    template <typename Factory>
+    void reserve(const std::size_t& n, Factory&& make) {
+        while (size() < n) {
+            put(std::make_unique<T>(make()));
+        }
+    }
+
+    /**
+     * @brief Release all the idle objects in the pool. Objects that are currently leased are not affected
+     */
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        idle.clear();
+    }
+
+    /**
+     * @brief Count the idle objects in the pool that satisfy a predicate. The lock is held while it is tested
+     *
+     * @tparam Predicate the type of the function used to test each object
+     *
+     * @param predicate a function taking a const T& and returning true if it should be counted
+     *
+     * @return the number of idle objects the predicate returned true for
+     */
+    template <typename Predicate>
+    std::size_t count_if(Predicate&& predicate) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::size_t count = 0;
+        for (const auto& object : idle) {
+            if (predicate(*object)) { ++count; }
+        }
+        return count;
+    }
+
+    /**
+     * @brief Get the number of idle objects in the pool
+     *
+     * @return the number of objects that can be leased without making a new one
+     */
+    std::size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return idle.size();
+    }
+
+private:
+    /// Guards the idle objects
+    mutable std::mutex mutex;
+    /// The objects that are not currently leased, in the order they were returned
+    std::deque<std::unique_ptr<T>> idle;
+};
+
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_UTILITY_OBJECT_POOL_HPP
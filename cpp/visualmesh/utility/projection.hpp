@@ -18,6 +18,11 @@
 #ifndef VISUALMESH_UTILITY_PROJECTION_HPP
 #define VISUALMESH_UTILITY_PROJECTION_HPP
 
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+
 #include "math.hpp"
 #include "visualmesh/lens.hpp"
 
@@ -86,6 +91,27 @@ inline vec4<Scalar> inverse_coefficients(const vec2<Scalar>& k) {
     }};
 }
 
+/**
+ * @brief Distorts a radial distance using inverse coefficients that have already been calculated
+ *
+ * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+ *
+ * @param r  the radial distance from the optical centre
+ * @param ik the inverse distortion coefficients from inverse_coefficients
+ *
+ * @return the distorted radial distance from the optical centre
+ */
+template <typename Scalar>
+inline Scalar distort(const Scalar& r, const vec4<Scalar>& ik) {
+    return r
+           * (1.0                                                  //
+              + ik[0] * (r * r)                                    //
+              + ik[1] * ((r * r) * (r * r))                        //
+              + ik[2] * ((r * r) * (r * r)) * (r * r)              //
+              + ik[3] * ((r * r) * (r * r)) * ((r * r) * (r * r))  //
+           );
+}
+
 /**
  * @brief Undistorts radial distortion using the provided distortion coefficients
  *
@@ -108,15 +134,7 @@ inline Scalar distort(const Scalar& r, const vec2<Scalar>& k) {
     // https://www.ncbi.nlm.nih.gov/pmc/articles/PMC4934233/pdf/sensors-16-00807.pdf
     // These terms have been stripped back to only include k1 and k2 and only uses the first 4 terms
     // if more are needed in the future go and get them from the original paper
-    // TODO(thouliston): if performance ever becomes an issue, this can be precomputed for the same k values
-    const vec4<Scalar> ik = inverse_coefficients(k);
-    return r
-           * (1.0                                                  //
-              + ik[0] * (r * r)                                    //
-              + ik[1] * ((r * r) * (r * r))                        //
-              + ik[2] * ((r * r) * (r * r)) * (r * r)              //
-              + ik[3] * ((r * r) * (r * r)) * ((r * r) * (r * r))  //
-           );
+    return distort(r, inverse_coefficients(k));
 }
 
 /**
@@ -224,6 +242,211 @@ vec3<Scalar> unproject(const vec2<Scalar>& px, const Lens<Scalar>& lens) {
     return vec3<Scalar>{{std::cos(theta), sin_theta * screen[0] / r_d, sin_theta * screen[1] / r_d}};
 }
 
+/**
+ * @brief The radial part of a lens projection written in terms of the cos and sin of the angle from the optical axis
+ *
+ * @details
+ *  Resolving the projection at compile time means the loops in the batch projections have no branches, and working
+ *  from the cos of the angle rather than the angle itself lets the equisolid and rectilinear lenses use closed forms
+ *  without any trigonometric functions.
+ *
+ * @tparam Scalar     the scalar type used for calculations and storage (normally one of float or double)
+ * @tparam Projection the lens projection this model is for
+ */
+template <typename Scalar, LensProjection Projection>
+struct ProjectionModel;
+
+template <typename Scalar>
+struct ProjectionModel<Scalar, EQUIDISTANT> {
+    explicit ProjectionModel(const Scalar& f) : f(f) {}
+
+    /// @return the undistorted radius for a ray with the provided cos of its angle from the optical axis
+    inline Scalar r(const Scalar& cos_theta) const {
+        return f * std::acos(cos_theta);
+    }
+
+    /// @return the cos and sin of the angle from the optical axis for an undistorted radius
+    inline vec2<Scalar> angle(const Scalar& r) const {
+        return vec2<Scalar>{{std::cos(r / f), std::sin(r / f)}};
+    }
+
+    Scalar f;
+};
+
+template <typename Scalar>
+struct ProjectionModel<Scalar, EQUISOLID> {
+    explicit ProjectionModel(const Scalar& f) : f(f) {}
+
+    /// @return the undistorted radius for a ray with the provided cos of its angle from the optical axis
+    inline Scalar r(const Scalar& cos_theta) const {
+        // 2f sin(theta / 2) using the half angle formula
+        return f * std::sqrt(std::max(Scalar(2.0) * (Scalar(1.0) - cos_theta), Scalar(0.0)));
+    }
+
+    /// @return the cos and sin of the angle from the optical axis for an undistorted radius
+    inline vec2<Scalar> angle(const Scalar& r) const {
+        // h is sin(theta / 2) so these are the double angle formulas
+        const Scalar h = r / (Scalar(2.0) * f);
+        return vec2<Scalar>{{Scalar(1.0) - Scalar(2.0) * h * h, Scalar(2.0) * h * std::sqrt(Scalar(1.0) - h * h)}};
+    }
+
+    Scalar f;
+};
+
+template <typename Scalar>
+struct ProjectionModel<Scalar, RECTILINEAR> {
+    explicit ProjectionModel(const Scalar& f) : f(f), r_max(rectilinear::r(Scalar(M_PI_2), f)) {}
+
+    /// @return the undistorted radius for a ray with the provided cos of its angle from the optical axis
+    inline Scalar r(const Scalar& cos_theta) const {
+        // f tan(theta), which is clamped at 90 degrees the same as rectilinear::r
+        const Scalar sin_theta = std::sqrt(std::max(Scalar(1.0) - cos_theta * cos_theta, Scalar(0.0)));
+        return cos_theta > 0 ? f * sin_theta / cos_theta : r_max;
+    }
+
+    /// @return the cos and sin of the angle from the optical axis for an undistorted radius
+    inline vec2<Scalar> angle(const Scalar& r) const {
+        const Scalar t         = r / f;
+        const Scalar cos_theta = Scalar(1.0) / std::sqrt(Scalar(1.0) + t * t);
+        return vec2<Scalar>{{cos_theta, t * cos_theta}};
+    }
+
+    Scalar f;
+    /// The radius at 90 degrees from the optical axis
+    Scalar r_max;
+};
+
+/**
+ * @brief Projects many unit vectors into pixel coordinates using a lens projection that is known at compile time
+ *
+ * @tparam Projection the lens projection to project with
+ * @tparam Scalar     the scalar type used for calculations and storage (normally one of float or double)
+ *
+ * @param x      the x component of each unit vector in camera space
+ * @param y      the y component of each unit vector in camera space
+ * @param z      the z component of each unit vector in camera space
+ * @param n      the number of unit vectors
+ * @param lens   the paramters that describe the lens that we are using to project
+ * @param pixels the pixel coordinate of each unit vector is written here
+ */
+template <LensProjection Projection, typename Scalar>
+void project(const Scalar* x,
+             const Scalar* y,
+             const Scalar* z,
+             const std::size_t& n,
+             const Lens<Scalar>& lens,
+             vec2<Scalar>* pixels) {
+
+    const ProjectionModel<Scalar, Projection> model(lens.focal_length);
+    const vec4<Scalar> ik = inverse_coefficients(lens.k);
+    const vec2<Scalar> c  = subtract(multiply(cast<Scalar>(lens.dimensions), Scalar(0.5)), lens.centre);
+
+    for (std::size_t i = 0; i < n; ++i) {
+        const Scalar r_d = distort(model.r(x[i]), ik);
+        // Rays at or past the optical axis due to floating point error land on the centre
+        const Scalar scale = x[i] >= 1 ? Scalar(0.0) : r_d / std::sqrt(Scalar(1.0) - x[i] * x[i]);
+        pixels[i]          = vec2<Scalar>{{c[0] - scale * y[i], c[1] - scale * z[i]}};
+    }
+}
+
+/**
+ * @brief Projects many unit vectors into pixel coordinates, selecting the lens projection once for all of them
+ *
+ * @details
+ *  This gives the same pixels as calling project for each unit vector, apart from floating point rounding. The unit
+ *  vectors are passed as separate arrays of components so the loop can be vectorised.
+ *
+ * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+ *
+ * @param x      the x component of each unit vector in camera space
+ * @param y      the y component of each unit vector in camera space
+ * @param z      the z component of each unit vector in camera space
+ * @param n      the number of unit vectors
+ * @param lens   the paramters that describe the lens that we are using to project
+ * @param pixels the pixel coordinate of each unit vector is written here
+ */
+template <typename Scalar>
+void project(const Scalar* x,
+             const Scalar* y,
+             const Scalar* z,
+             const std::size_t& n,
+             const Lens<Scalar>& lens,
+             vec2<Scalar>* pixels) {
+    switch (lens.projection) {
+        case RECTILINEAR: project<RECTILINEAR>(x, y, z, n, lens, pixels); break;
+        case EQUISOLID: project<EQUISOLID>(x, y, z, n, lens, pixels); break;
+        case EQUIDISTANT: project<EQUIDISTANT>(x, y, z, n, lens, pixels); break;
+        default: throw std::runtime_error("Cannot project: Unknown lens type"); break;
+    }
+}
+
+/**
+ * @brief Unprojects many pixel coordinates into unit vectors using a lens projection that is known at compile time
+ *
+ * @tparam Projection the lens projection to unproject with
+ * @tparam Scalar     the scalar type used for calculations and storage (normally one of float or double)
+ *
+ * @param pixels the pixel coordinates to unproject
+ * @param n      the number of pixel coordinates
+ * @param lens   the paramters that describe the lens that we are using to unproject
+ * @param x      the x component of each unit vector in camera space is written here
+ * @param y      the y component of each unit vector in camera space is written here
+ * @param z      the z component of each unit vector in camera space is written here
+ */
+template <LensProjection Projection, typename Scalar>
+void unproject(const vec2<Scalar>* pixels,
+               const std::size_t& n,
+               const Lens<Scalar>& lens,
+               Scalar* x,
+               Scalar* y,
+               Scalar* z) {
+
+    const ProjectionModel<Scalar, Projection> model(lens.focal_length);
+    const vec2<Scalar> c = subtract(multiply(cast<Scalar>(lens.dimensions), Scalar(0.5)), lens.centre);
+
+    for (std::size_t i = 0; i < n; ++i) {
+        const Scalar sx      = c[0] - pixels[i][0];
+        const Scalar sy      = c[1] - pixels[i][1];
+        const Scalar r_d     = std::sqrt(sx * sx + sy * sy);
+        const vec2<Scalar> a = model.angle(undistort(r_d, lens.k));
+        // The centre of the lens is straight down the optical axis
+        const Scalar scale = r_d == 0 ? Scalar(0.0) : a[1] / r_d;
+        x[i]               = r_d == 0 ? Scalar(1.0) : a[0];
+        y[i]               = scale * sx;
+        z[i]               = scale * sy;
+    }
+}
+
+/**
+ * @brief Unprojects many pixel coordinates into unit vectors, selecting the lens projection once for all of them
+ *
+ * @details
+ *  This gives the same unit vectors as calling unproject for each pixel coordinate, apart from floating point rounding.
+ *
+ * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+ *
+ * @param pixels the pixel coordinates to unproject
+ * @param n      the number of pixel coordinates
+ * @param lens   the paramters that describe the lens that we are using to unproject
+ * @param x      the x component of each unit vector in camera space is written here
+ * @param y      the y component of each unit vector in camera space is written here
+ * @param z      the z component of each unit vector in camera space is written here
+ */
+template <typename Scalar>
+void unproject(const vec2<Scalar>* pixels,
+               const std::size_t& n,
+               const Lens<Scalar>& lens,
+               Scalar* x,
+               Scalar* y,
+               Scalar* z) {
+    switch (lens.projection) {
+        case RECTILINEAR: unproject<RECTILINEAR>(pixels, n, lens, x, y, z); break;
+        case EQUISOLID: unproject<EQUISOLID>(pixels, n, lens, x, y, z); break;
+        case EQUIDISTANT: unproject<EQUIDISTANT>(pixels, n, lens, x, y, z); break;
+        default: throw std::runtime_error("Cannot project: Unknown lens type"); break;
+    }
+}
+
 }  // namespace visualmesh
 
 #endif  // VISUALMESH_UTILITY_PROJECTION_HPP
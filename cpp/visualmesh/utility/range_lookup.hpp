@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_UTILITY_RANGE_LOOKUP_HPP
+#define VISUALMESH_UTILITY_RANGE_LOOKUP_HPP
+
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace visualmesh {
+
+/**
+ * @brief Maps indices in a mesh to their position in the points of the ranges that a lookup found on screen
+ *
+ * @details
+ *  When the points in the ranges returned by a mesh lookup are packed one after another, a point's new index is the
+ *  offset of its range plus how far it is into that range. To find the range quickly the indices up to the end of the
+ *  last range are split into buckets of 2^SHIFT points, each holding the first range that ends after the bucket
+ *  starts, so a point is found by stepping over the few ranges that end within its bucket. Most buckets lie entirely
+ *  inside one range, and for these the difference between the packed and mesh index is stored so they are found with
+ *  a single load. This costs memory and time
+ *  in the number of ranges plus a sixty fourth of the mesh, rather than the whole mesh like a dense reverse lookup
+ *  table does. The ranges must be sorted and not overlap, which is the order a mesh lookup returns them in.
+ */
+class RangeLookup {
+public:
+    RangeLookup() = default;
+
+    /**
+     * @brief Construct a new lookup for a set of ranges
+     *
+     * @param ranges the sorted start/end ranges of the points that are packed together
+     */
+    explicit RangeLookup(const std::vector<std::pair<int, int>>& ranges) {
+        reset(ranges);
+    }
+
+    /**
+     * @brief Replace the ranges of this lookup, keeping the memory it has already allocated
+     *
+     * @param ranges the sorted start/end ranges of the points that are packed together
+     */
+    void reset(const std::vector<std::pair<int, int>>& ranges) {
+        starts.clear();
+        ends.clear();
+        offsets.clear();
+        buckets.clear();
+        deltas.clear();
+        n_points = 0;
+        for (const auto& range : ranges) {
+            starts.push_back(range.first);
+            ends.push_back(range.second);
+            offsets.push_back(n_points);
+            n_points += range.second - range.first;
+        }
+
+        // Find the first range that ends after the start of each bucket
+        limit = ranges.empty() ? 0 : ranges.back().second;
+        int r = 0;
+        for (int b = 0; (b << SHIFT) < limit; ++b) {
+            while (ends[r] <= (b << SHIFT)) {
+                ++r;
+            }
+            buckets.push_back(r);
+            const bool whole = starts[r] <= (b << SHIFT) && ((b + 1) << SHIFT) <= ends[r];
+            deltas.push_back(whole ? offsets[r] - starts[r] : SPLIT);
+        }
+    }
+
+    /// @return the number of points in all the ranges, which is also the index given to points outside them
+    int size() const {
+        return n_points;
+    }
+
+    /**
+     * @brief Find the packed index of a point in the mesh
+     *
+     * @param index the index of the point in the mesh
+     *
+     * @return the index of the point once the ranges are packed together, or size() if it is not in any of them
+     */
+    int operator()(const int& index) const {
+        if (index < 0 || index >= limit) { return n_points; }
+
+        // Most points are in a bucket that is entirely inside one range
+        const int delta = deltas[index >> SHIFT];
+        if (delta != SPLIT) { return index + delta; }
+
+        // The last range ends at the limit so this always stops on a valid range
+        int r = buckets[index >> SHIFT];
+        while (ends[r] <= index) {
+            ++r;
+        }
+        return starts[r] <= index ? offsets[r] + (index - starts[r]) : n_points;
+    }
+
+private:
+    /// The number of points in each bucket is 2^SHIFT
+    static constexpr int SHIFT = 6;
+    /// The delta of a bucket that isn't entirely inside one range
+    static constexpr int SPLIT = std::numeric_limits<int>::min();
+
+    /// The first index of each range
+    std::vector<int> starts;
+    /// One past the last index of each range
+    std::vector<int> ends;
+    /// The packed index of the first point in each range
+    std::vector<int> offsets;
+    /// The first range that ends after the start of each bucket
+    std::vector<int> buckets;
+    /// The packed index minus the mesh index for each bucket inside a single range, or SPLIT
+    std::vector<int> deltas;
+    /// One past the last index in any range
+    int limit = 0;
+    /// The total number of points in the ranges
+    int n_points = 0;
+};
+
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_UTILITY_RANGE_LOOKUP_HPP
@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_UTILITY_RESIDENCY_CACHE_HPP
+#define VISUALMESH_UTILITY_RESIDENCY_CACHE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <list>
+#include <map>
+#include <utility>
+
+namespace visualmesh {
+
+/**
+ * @brief Holds the device copies of meshes, dropping the least recently used ones to stay within a memory budget
+ *
+ * @details
+ *  Entries are keyed by the identifier of the mesh rather than its address, so a mesh that is freed and replaced by a
+ *  new one at the same address is never mistaken for it. An entry for a mesh that no longer exists is simply never
+ *  used again and is dropped once the budget needs its memory. The entry that was used or added most recently is
+ *  always kept even if it is larger than the budget on its own.
+ *
+ *  This is not thread safe, the engines guard it with the same mutex they use for the rest of their device mesh state.
+ *  The entries should own their device memory through reference counted handles so that dropping an entry while a
+ *  frame in flight still uses it only releases the memory once that frame is done with it.
+ *
+ * @tparam Entry the device buffers that are held for each mesh
+ */
+template <typename Entry>
+class ResidencyCache {
+public:
+    /**
+     * @brief Find the entry for a mesh and mark it as the most recently used
+     *
+     * @param id the identifier of the mesh
+     *
+     * @return the entry, or nullptr if the mesh isn't on the device
+     */
+    Entry* find(const uint64_t& id) {
+        auto it = entries.find(id);
+        if (it == entries.end()) { return nullptr; }
+        lru.splice(lru.begin(), lru, it->second.lru);
+        return &it->second.entry;
+    }
+
+    /**
+     * @brief Get the entry for a mesh, adding an empty one if it isn't there, and mark it as the most recently used
+     *
+     * @param id the identifier of the mesh
+     *
+     * @return the entry for the mesh
+     */
+    Entry& operator[](const uint64_t& id) {
+        if (Entry* entry = find(id)) { return *entry; }
+        lru.push_front(id);
+        Slot& slot = entries[id];
+        slot.lru   = lru.begin();
+        return slot.entry;
+    }
+
+    /**
+     * @brief Record that more device memory is now used by the entry for a mesh, dropping other entries if needed
+     *
+     * @details
+     *  The entry is made the most recently used so it is never the one that is dropped.
+     *
+     * @param id    the identifier of the mesh
+     * @param bytes the number of bytes that were allocated for it
+     */
+    void allocated(const uint64_t& id, const std::size_t& bytes) {
+        operator[](id);
+        entries[id].bytes += bytes;
+        used += bytes;
+        trim();
+    }
+
+    /**
+     * @brief Drop the entry for a mesh if there is one
+     *
+     * @param id the identifier of the mesh
+     */
+    void erase(const uint64_t& id) {
+        auto it = entries.find(id);
+        if (it == entries.end()) { return; }
+        used -= it->second.bytes;
+        lru.erase(it->second.lru);
+        entries.erase(it);
+    }
+
+    /// Drop every entry
+    void clear() {
+        entries.clear();
+        lru.clear();
+        used = 0;
+    }
+
+    /**
+     * @brief Set how much device memory the entries may use, dropping the least recently used ones to fit
+     *
+     * @param bytes the memory budget in bytes
+     */
+    void budget(const std::size_t& bytes) {
+        max_bytes = bytes;
+        trim();
+    }
+
+    /// @return how much device memory the entries may use
+    std::size_t budget() const {
+        return max_bytes;
+    }
+
+    /// @return how much device memory the entries are using
+    std::size_t bytes() const {
+        return used;
+    }
+
+    /// @return the number of meshes that are on the device
+    std::size_t size() const {
+        return entries.size();
+    }
+
+private:
+    /// An entry along with its bookkeeping
+    struct Slot {
+        /// The device buffers of the mesh
+        Entry entry;
+        /// The device memory the buffers use
+        std::size_t bytes = 0;
+        /// The position of this mesh in the least recently used list
+        std::list<uint64_t>::iterator lru;
+    };
+
+    /// Drop the least recently used entries until we are within budget, always keeping the most recent one
+    void trim() {
+        while (used > max_bytes && lru.size() > 1) {
+            erase(lru.back());
+        }
+    }
+
+    /// The entry for each mesh on the device
+    std::map<uint64_t, Slot> entries;
+    /// The identifiers of the meshes on the device, most recently used first
+    std::list<uint64_t> lru;
+    /// The device memory used by every entry
+    std::size_t used = 0;
+    /// The memory budget for the entries
+    std::size_t max_bytes = std::numeric_limits<std::size_t>::max();
+};
+
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_UTILITY_RESIDENCY_CACHE_HPP
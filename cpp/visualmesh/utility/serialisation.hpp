@@ -0,0 +1,294 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef VISUALMESH_UTILITY_SERIALISATION_HPP
+#define VISUALMESH_UTILITY_SERIALISATION_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define VISUALMESH_HAVE_MMAP
+#endif
+
+namespace visualmesh {
+
+/**
+ * @brief Writes integers and floating point values to a stream in little endian byte order
+ *
+ * @details
+ *  Values are always written least significant byte first regardless of the host so that a file written on one machine
+ *  can be read on any other. Floating point values are written as their IEEE754 bit patterns.
+ */
+class BinaryWriter {
+public:
+    explicit BinaryWriter(std::ostream& out) : out(out) {}
+
+    /**
+     * @brief Write a single arithmetic value
+     *
+     * @tparam T the type of the value, must be an integer or floating point type of 1, 2, 4 or 8 bytes
+     *
+     * @param value the value to write
+     */
+    template <typename T>
+    void write(const T& value) {
+        static_assert(std::is_arithmetic<T>::value, "Only arithmetic values can be written");
+        unsigned char bytes[sizeof(T)];
+        std::memcpy(bytes, &value, sizeof(T));
+        if (!little_endian()) { std::reverse(std::begin(bytes), std::end(bytes)); }
+        out.write(reinterpret_cast<const char*>(bytes), sizeof(T));
+        if (!out) { throw std::runtime_error("Failed to write to the output stream"); }
+    }
+
+    /**
+     * @brief Write a contiguous array of arithmetic values
+     *
+     * @details
+     *  On a little endian host the array is written in a single call, otherwise each value is swapped as it is written.
+     *
+     * @tparam T the type of the values
+     *
+     * @param values the first value to write
+     * @param n      the number of values
+     */
+    template <typename T>
+    void write_array(const T* values, const std::size_t& n) {
+        static_assert(std::is_arithmetic<T>::value, "Only arithmetic values can be written");
+        if (little_endian()) { write_bytes(reinterpret_cast<const char*>(values), n * sizeof(T)); }
+        else {
+            for (std::size_t i = 0; i < n; ++i) {
+                write(values[i]);
+            }
+        }
+    }
+
+    /**
+     * @brief Write raw bytes, used for magic numbers
+     *
+     * @param data  the bytes to write
+     * @param size  the number of bytes
+     */
+    void write_bytes(const char* data, const std::size_t& size) {
+        out.write(data, size);
+        if (!out) { throw std::runtime_error("Failed to write to the output stream"); }
+    }
+
+    /// Returns true if this host stores values least significant byte first
+    static bool little_endian() {
+        const uint32_t probe = 1;
+        unsigned char first;
+        std::memcpy(&first, &probe, 1);
+        return first == 1;
+    }
+
+private:
+    /// The stream we are writing to
+    std::ostream& out;
+};
+
+/**
+ * @brief Reads values written by a BinaryWriter from a block of memory
+ *
+ * @details
+ *  The reader does not own the memory it reads from. Every read is bounds checked and throws if it would run off the
+ *  end of the block, so a truncated or corrupted file gives an exception rather than undefined behaviour.
+ */
+class BinaryReader {
+public:
+    BinaryReader(const char* data, const std::size_t& size) : data(data), end(data + size) {}
+
+    /**
+     * @brief Read a single arithmetic value
+     *
+     * @tparam T the type of the value to read
+     *
+     * @return the value read from the block
+     */
+    template <typename T>
+    T read() {
+        static_assert(std::is_arithmetic<T>::value, "Only arithmetic values can be read");
+        unsigned char bytes[sizeof(T)];
+        std::memcpy(bytes, take(sizeof(T)), sizeof(T));
+        if (!BinaryWriter::little_endian()) { std::reverse(std::begin(bytes), std::end(bytes)); }
+        T value;
+        std::memcpy(&value, bytes, sizeof(T));
+        return value;
+    }
+
+    /**
+     * @brief Read a contiguous array of arithmetic values
+     *
+     * @details
+     *  On a little endian host the array is copied directly out of the block, otherwise each value is swapped.
+     *
+     * @tparam T the type of the values
+     *
+     * @param values where to store the values
+     * @param n      the number of values to read
+     */
+    template <typename T>
+    void read_array(T* values, const std::size_t& n) {
+        static_assert(std::is_arithmetic<T>::value, "Only arithmetic values can be read");
+        if (n > remaining() / sizeof(T)) { throw std::runtime_error("Unexpected end of binary data"); }
+        if (BinaryWriter::little_endian()) { std::memcpy(values, take(n * sizeof(T)), n * sizeof(T)); }
+        else {
+            for (std::size_t i = 0; i < n; ++i) {
+                values[i] = read<T>();
+            }
+        }
+    }
+
+    /**
+     * @brief Read a contiguous array of floating point values that were written as either float or double
+     *
+     * @details
+     *  When the values were written with the same width as T they are copied directly, otherwise each is converted.
+     *
+     * @tparam T the floating point type to read into
+     *
+     * @param values where to store the values
+     * @param n      the number of values to read
+     * @param width  the number of bytes each value was written with, either 4 or 8
+     */
+    template <typename T>
+    void read_floats(T* values, const std::size_t& n, const uint32_t& width) {
+        static_assert(std::is_floating_point<T>::value, "Only floating point values can be converted");
+        if (width == sizeof(T)) { read_array(values, n); }
+        else if (width == sizeof(float)) {
+            for (std::size_t i = 0; i < n; ++i) {
+                values[i] = T(read<float>());
+            }
+        }
+        else if (width == sizeof(double)) {
+            for (std::size_t i = 0; i < n; ++i) {
+                values[i] = T(read<double>());
+            }
+        }
+        else {
+            throw std::runtime_error("Unsupported floating point width in binary data");
+        }
+    }
+
+    /**
+     * @brief Get a pointer to the next bytes in the block and move past them
+     *
+     * @param size the number of bytes to take
+     *
+     * @return a pointer to the start of the bytes
+     */
+    const char* take(const std::size_t& size) {
+        if (std::size_t(end - data) < size) { throw std::runtime_error("Unexpected end of binary data"); }
+        const char* start = data;
+        data += size;
+        return start;
+    }
+
+    /// The number of bytes that have not been read yet
+    std::size_t remaining() const {
+        return end - data;
+    }
+
+private:
+    /// The next byte to read
+    const char* data;
+    /// One past the last byte in the block
+    const char* end;
+};
+
+/**
+ * @brief A read only view of the contents of a file
+ *
+ * @details
+ *  On POSIX systems the file is memory mapped so the operating system pages it in on demand and nothing is copied
+ *  until it is decoded. On other systems the whole file is read into memory instead.
+ */
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) {
+#ifdef VISUALMESH_HAVE_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) { throw std::runtime_error("Failed to open " + path); }
+        struct stat info;
+        if (::fstat(fd, &info) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Failed to stat " + path);
+        }
+        length = static_cast<std::size_t>(info.st_size);
+        if (length > 0) {
+            void* address = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (address == MAP_FAILED) { throw std::runtime_error("Failed to map " + path); }
+            memory = std::shared_ptr<const char>(static_cast<const char*>(address), [size = length](const char* p) {
+                ::munmap(const_cast<char*>(p), size);  // NOLINT(cppcoreguidelines-pro-type-const-cast)
+            });
+        }
+        else {
+            ::close(fd);
+        }
+#else
+        std::ifstream in(path, std::ios::binary);
+        if (!in) { throw std::runtime_error("Failed to open " + path); }
+        std::shared_ptr<std::vector<char>> buffer = std::make_shared<std::vector<char>>(
+          std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        length = buffer->size();
+        memory = std::shared_ptr<const char>(buffer, buffer->data());
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /// A pointer to the start of the file contents
+    const char* data() const {
+        return memory.get();
+    }
+
+    /// The number of bytes in the file
+    std::size_t size() const {
+        return length;
+    }
+
+    /// A reader over the whole file
+    BinaryReader reader() const {
+        return BinaryReader(data(), size());
+    }
+
+private:
+    /// The contents of the file, released by unmapping or freeing depending on how it was loaded
+    std::shared_ptr<const char> memory;
+    /// The number of bytes in the file
+    std::size_t length = 0;
+};
+
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_UTILITY_SERIALISATION_HPP
@@ -0,0 +1,277 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_UTILITY_THREAD_POOL_HPP
+#define VISUALMESH_UTILITY_THREAD_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "affinity.hpp"
+
+namespace visualmesh {
+
+/**
+ * @brief A persistent pool of worker threads that executes data parallel loops over index ranges
+ *
+ * @details
+ *  The pool is designed for the fork/join style workloads found in the engines and mesh builders where a loop over a
+ *  large number of points is split into contiguous chunks. The threads are created once and then sleep between jobs so
+ *  that there is no thread creation cost on each frame. The thread that calls parallel_for also takes part in the work
+ *  so a pool of size n holds n - 1 worker threads. Only one parallel_for may execute at a time, concurrent callers will
+ *  be serialised.
+ *
+ *  The workers can be pinned to a set of processors, such as the performance cores from performance_cpus, so they
+ *  aren't moved between cores during a job. When the pinned workers span several NUMA nodes each loop is split into a
+ *  contiguous part for each node, sized by its share of the threads. Threads take chunks from the part of their own
+ *  node and only take from the other parts once it is empty. The same node then works on the same part of a buffer
+ *  every time it is looped over, so the pages it first touched stay local to it.
+ */
+class ThreadPool {
+public:
+    /**
+     * @brief Construct a new Thread Pool object
+     *
+     * @param n_threads the total number of threads that will execute work, including the calling thread
+     * @param cpus      the processors to pin the workers to, one each in turn, or empty to leave them unpinned. The
+     *                  calling thread is never pinned.
+     */
+    explicit ThreadPool(const unsigned int& n_threads = std::thread::hardware_concurrency(),
+                        const std::vector<int>& cpus  = {})
+      : n_threads(std::max(1u, n_threads)) {
+
+        // Give each worker the NUMA node of its processor, numbering only the nodes that have a worker
+        numa = cpus.empty() ? std::vector<std::vector<int>>(1) : numa_nodes();
+        for (unsigned int i = 1; i < this->n_threads; ++i) {
+            const int node = cpus.empty() ? 0 : numa_node_of(cpus[(i - 1) % cpus.size()], numa);
+            const auto it  = std::find(nodes.begin(), nodes.end(), node);
+            domains.push_back(int(std::distance(nodes.begin(), it)));
+            if (it == nodes.end()) { nodes.push_back(node); }
+        }
+        if (nodes.empty()) { nodes.push_back(0); }
+        parts = std::vector<Part>(nodes.size());
+
+        workers.reserve(this->n_threads - 1);
+        for (unsigned int i = 1; i < this->n_threads; ++i) {
+            const int domain = domains[i - 1];
+            workers.emplace_back([this, domain] { run(domain); });
+            if (!cpus.empty()) { pin_thread(workers.back(), {cpus[(i - 1) % cpus.size()]}); }
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool(ThreadPool&&)      = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    ThreadPool& operator=(ThreadPool&&) = delete;
+
+    ~ThreadPool() {
+        /* mutex scope */ {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+        wake.notify_all();
+        for (auto& w : workers) {
+            w.join();
+        }
+    }
+
+    /**
+     * @brief Get the number of threads that take part in executing a job
+     *
+     * @return the number of threads including the calling thread
+     */
+    unsigned int size() const {
+        return n_threads;
+    }
+
+    /**
+     * @brief Execute a function over the range [0, n) split into contiguous chunks across all the threads in the pool
+     *
+     * @details
+     *  The function is called as fn(begin, end) for each chunk and must be safe to call concurrently for disjoint
+     *  ranges. This function blocks until every chunk has been processed. If any invocation throws, the first exception
+     *  is rethrown on the calling thread once all the threads have finished.
+     *
+     * @tparam Func the type of the function that is executed for each chunk
+     *
+     * @param n     the number of elements in the range
+     * @param fn    the function to execute for each chunk
+     * @param grain the minimum number of elements in a chunk, to avoid splitting small loops too finely
+     */
+    template <typename Func>
+    void parallel_for(const std::size_t& n, Func&& fn, const std::size_t& grain = 1) {
+        if (n == 0) { return; }
+
+        // Split into a few chunks per thread so that uneven chunks will balance out
+        const std::size_t chunk = std::max(std::max(grain, std::size_t(1)), (n + n_threads * 4 - 1) / (n_threads * 4));
+
+        // Not worth waking anyone up for a single chunk
+        if (n_threads == 1 || chunk >= n) {
+            fn(std::size_t(0), n);
+            return;
+        }
+
+        std::lock_guard<std::mutex> job_lock(job_mutex);
+
+        // The calling thread works on the part of the node it is running on, or the first if it isn't on any of them
+        int domain = 0;
+        if (nodes.size() > 1) {
+            const auto it = std::find(nodes.begin(), nodes.end(), numa_node_of(current_cpu(), numa));
+            domain        = it == nodes.end() ? 0 : int(std::distance(nodes.begin(), it));
+        }
+
+        /* mutex scope */ {
+            std::lock_guard<std::mutex> lock(mutex);
+            job.fn        = std::ref(fn);
+            job.n         = n;
+            job.chunk     = chunk;
+            job.exception = nullptr;
+            split(n, chunk, domain);
+            job.active = n_threads - 1;
+            ++generation;
+        }
+        wake.notify_all();
+
+        // Do our part of the work and then wait for everyone else to finish theirs
+        execute(domain);
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return job.active == 0; });
+        job.fn = nullptr;
+
+        if (job.exception) { std::rethrow_exception(job.exception); }
+    }
+
+private:
+    /// A contiguous part of the current job that the threads of one NUMA node work through first
+    struct Part {
+        /// The start of the next chunk to be taken
+        std::atomic<std::size_t> next{0};
+        /// One past the last element of the part
+        std::size_t end = 0;
+    };
+
+    /**
+     * @brief Split a job into a part for each NUMA node, sized by how many threads each node has
+     *
+     * @param n      the number of elements in the job
+     * @param chunk  the number of elements taken at a time, each part except the last is a multiple of this
+     * @param caller the node of the calling thread
+     */
+    void split(const std::size_t& n, const std::size_t& chunk, const int& caller) {
+        std::vector<unsigned int> threads(parts.size(), 0);
+        ++threads[caller];
+        for (const auto& d : domains) {
+            ++threads[d];
+        }
+
+        std::size_t start = 0;
+        unsigned int seen = 0;
+        for (std::size_t d = 0; d < parts.size(); ++d) {
+            seen += threads[d];
+            const std::size_t share = (n * seen / n_threads + chunk - 1) / chunk * chunk;
+            const std::size_t end   = d + 1 == parts.size() ? n : std::min(n, share);
+            parts[d].next.store(start);
+            parts[d].end = end;
+            start        = std::max(start, end);
+        }
+    }
+
+    /// Grab chunks from the current job until there are none left, starting with the part of the given NUMA node
+    void execute(const int& domain) {
+        for (std::size_t i = 0; i < parts.size(); ++i) {
+            Part& part = parts[(domain + i) % parts.size()];
+            for (std::size_t begin = part.next.fetch_add(job.chunk); begin < part.end;
+                 begin             = part.next.fetch_add(job.chunk)) {
+                try {
+                    job.fn(begin, std::min(begin + job.chunk, part.end));
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!job.exception) { job.exception = std::current_exception(); }
+                }
+            }
+        }
+    }
+
+    /// The main loop for each worker thread, which works on the part of the given NUMA node first
+    void run(const int& domain) {
+        unsigned int seen = 0;
+        while (true) {
+            /* mutex scope */ {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return !running || generation != seen; });
+                if (!running) { return; }
+                seen = generation;
+            }
+
+            execute(domain);
+
+            /* mutex scope */ {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--job.active == 0) { done.notify_one(); }
+            }
+        }
+    }
+
+    /// The number of threads that work on a job including the calling thread
+    unsigned int n_threads;
+    /// The threads waiting for work
+    std::vector<std::thread> workers;
+    /// The processors of each NUMA node of the system
+    std::vector<std::vector<int>> numa;
+    /// The NUMA nodes that the workers are pinned to, the index into this is the domain a thread works on first
+    std::vector<int> nodes;
+    /// The domain of each worker
+    std::vector<int> domains;
+    /// The parts of the current job, one for each of the nodes
+    std::vector<Part> parts;
+
+    /// The job that is currently being executed
+    struct {
+        std::function<void(std::size_t, std::size_t)> fn;
+        std::size_t n       = 0;
+        std::size_t chunk   = 1;
+        unsigned int active = 0;
+        std::exception_ptr exception;
+    } job;
+
+    /// Incremented each time a new job is posted so the workers know there is something to do
+    unsigned int generation = 0;
+    /// If the pool is still running, set to false to shut down the workers
+    bool running = true;
+
+    /// Guards the job state and the condition variables
+    std::mutex mutex;
+    /// Serialises callers of parallel_for
+    std::mutex job_mutex;
+    /// Used to wake the workers when a new job is posted
+    std::condition_variable wake;
+    /// Used to tell the caller that all the workers have finished
+    std::condition_variable done;
+};
+
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_UTILITY_THREAD_POOL_HPP
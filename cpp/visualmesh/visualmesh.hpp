@@ -18,9 +18,22 @@
 #ifndef VISUALMESH_HPP
 #define VISUALMESH_HPP
 
+#include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
 #include <iterator>
+#include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -28,6 +41,8 @@
 #include "visualmesh/mesh.hpp"
 #include "visualmesh/model/ring6.hpp"
 #include "visualmesh/utility/math.hpp"
+#include "visualmesh/utility/serialisation.hpp"
+#include "visualmesh/utility/thread_pool.hpp"
 
 namespace visualmesh {
 
@@ -36,7 +51,7 @@ namespace visualmesh {
  *
  * @details
  *  Provides convenience functions for accessing projection and classification of the mesh using different engines.
- *  The available engines are currently limited to OpenCL and CPU, however CUDA and Vulkan can be added later.
+ *  The available engines are CPU, OpenCL, Vulkan and CUDA.
  *
  * @tparam Scalar the type that will hold the vectors <float, double>
  * @tparam Model  the model used to generate the mesh in each of the individual heights
@@ -49,9 +64,20 @@ public:
      */
     VisualMesh() = default;
 
+    /**
+     * @brief Called after each height has been built with the height, how many of the heights have been built so far,
+     * the total number of heights and how long that height took to build in seconds
+     */
+    using Progress = std::function<void(const Scalar&, const std::size_t&, const std::size_t&, const double&)>;
+
     /**
      * @brief Generate a new visual mesh for the given shape.
      *
+     * @details
+     *  The heights that are needed are found first using required_heights. The meshes for each height are independent
+     *  of each other so they are then built concurrently. The resulting meshes are identical regardless of the number
+     *  of threads used.
+     *
      * @tparam Shape the shape type that this mesh will generate using
      *
      * @param shape        the shape we are generating a visual mesh for
@@ -60,6 +86,8 @@ public:
      * @param k            the number of intersections with the object
      * @param max_error    the maximum amount of error in terms of k that a mesh can have
      * @param max_distance the maximum distance that this mesh will project for
+     * @param concurrency  the number of threads to build meshes with, 1 builds them all on the calling thread
+     * @param progress     called as each height is built, calls are serialised so it need not be thread safe
      */
     template <typename Shape>
     explicit VisualMesh(const Shape& shape,
@@ -67,11 +95,68 @@ public:
                         const Scalar& max_height,
                         const Scalar& k,
                         const Scalar& max_error,
-                        const Scalar& max_distance) {
+                        const Scalar& max_distance,
+                        const unsigned int& concurrency = std::thread::hardware_concurrency(),
+                        const Progress& progress        = Progress()) {
+
+        const std::vector<Scalar> heights = required_heights(shape, min_height, max_height, k, max_error);
 
+        // Build each of the meshes into its own slot so the result doesn't depend on the order they finish in
+        std::vector<std::unique_ptr<Mesh<Scalar, Model>>> meshes(heights.size());
+        std::mutex progress_mutex;
+        std::size_t built = 0;
+        auto build        = [&](const std::size_t& begin, const std::size_t& end) {
+            for (std::size_t i = begin; i < end; ++i) {
+                auto start = std::chrono::steady_clock::now();
+                meshes[i]  = std::make_unique<Mesh<Scalar, Model>>(shape, heights[i], k, max_distance);
+
+                std::chrono::duration<double> elapsed(std::chrono::steady_clock::now() - start);
+
+                if (progress) {
+                    std::lock_guard<std::mutex> lock(progress_mutex);
+                    progress(heights[i], ++built, heights.size(), elapsed.count());
+                }
+            }
+        };
+
+        if (concurrency > 1 && heights.size() > 1) {
+            ThreadPool pool(std::min<std::size_t>(concurrency, heights.size()));
+            pool.parallel_for(heights.size(), build);
+        }
+        else {
+            build(0, heights.size());
+        }
+
+        for (std::size_t i = 0; i < heights.size(); ++i) {
+            luts.insert(std::make_pair(heights[i], std::move(*meshes[i])));
+        }
+    }
+
+    /**
+     * @brief Find the heights a mesh needs to be generated at so that the error in k is within tolerance everywhere
+     *
+     * @details
+     *  The height range is split in two repeatedly until the error in k between each height and its neighbours is no
+     *  more than max_error. This only depends on the shape, so it is cheap compared to generating the meshes.
+     *
+     * @tparam Shape the shape type that this mesh will generate using
+     *
+     * @param shape      the shape we are generating a visual mesh for
+     * @param min_height the minimum height that our camera will be at
+     * @param max_height the maximum height our camera will be at
+     * @param k          the number of intersections with the object
+     * @param max_error  the maximum amount of error in terms of k that a mesh can have
+     *
+     * @return the heights sorted from lowest to highest
+     */
+    template <typename Shape>
+    static std::vector<Scalar> required_heights(const Shape& shape,
+                                                const Scalar& min_height,
+                                                const Scalar& max_height,
+                                                const Scalar& k,
+                                                const Scalar& max_error) {
         // Add an element for the min and max height
-        luts.insert(std::make_pair(min_height, Mesh<Scalar, Model>(shape, min_height, k, max_distance)));
-        luts.insert(std::make_pair(max_height, Mesh<Scalar, Model>(shape, max_height, k, max_distance)));
+        std::vector<Scalar> heights = {min_height, max_height};
 
         // Run through a stack splitting the range in two until the region is filled appropriately
         std::vector<vec2<Scalar>> stack;
@@ -88,11 +173,17 @@ public:
 
             // If we aren't close enough to both elements
             if (lower_err > max_error || upper_err > max_error) {
-                luts.insert(std::make_pair(h, Mesh<Scalar, Model>(shape, h, k, max_distance)));
+                heights.push_back(h);
                 stack.emplace_back(vec2<Scalar>{range[0], h});
                 stack.emplace_back(vec2<Scalar>{h, range[1]});
             }
         }
+
+        // Each height gets one mesh, as an entry in the map of a VisualMesh or a slot in the least recently used cache
+        // of a LazyVisualMesh, so a duplicate height would only be built twice for nothing
+        std::sort(heights.begin(), heights.end());
+        heights.erase(std::unique(heights.begin(), heights.end()), heights.end());
+        return heights;
     }
 
     /**
@@ -110,6 +201,78 @@ public:
         }
     }
 
+    /**
+     * @brief Write every mesh in this VisualMesh to a binary file so it can be loaded later without regenerating it
+     *
+     * @details
+     *  The file starts with a magic number and format version followed by the size of the Scalar type and the number of
+     *  neighbours of the model so that a file can't be loaded into a VisualMesh of a different type. After that is the
+     *  number of heights and then each height followed by its Mesh. All values are little endian.
+     *
+     * @param path the path of the file to write
+     */
+    void save(const std::string& path) const {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        if (!out) { throw std::runtime_error("Failed to open " + path + " for writing"); }
+        save(out);
+    }
+
+    /**
+     * @brief Write every mesh in this VisualMesh to a stream in the binary format
+     *
+     * @param out the stream to write to
+     */
+    void save(std::ostream& out) const {
+        BinaryWriter writer(out);
+        writer.write_bytes(FILE_MAGIC, sizeof(FILE_MAGIC));
+        writer.write(FILE_VERSION);
+        writer.write(uint32_t(sizeof(Scalar)));
+        writer.write(uint32_t(Model<Scalar>::N_NEIGHBOURS));
+
+        writer.write(uint64_t(luts.size()));
+        for (const auto& lut : luts) {
+            writer.write(lut.first);
+            lut.second.save(writer);
+        }
+    }
+
+    /**
+     * @brief Load a VisualMesh that was previously written with save
+     *
+     * @details
+     *  The file is memory mapped and the meshes are decoded directly from the mapping. This is much faster than
+     *  generating the meshes as none of the model generation or BSP building needs to be done again.
+     *
+     * @param path the path of the file to load
+     *
+     * @return the VisualMesh that was stored in the file
+     */
+    static VisualMesh load(const std::string& path) {
+        MappedFile file(path);
+        BinaryReader reader = file.reader();
+
+        if (std::memcmp(reader.take(sizeof(FILE_MAGIC)), FILE_MAGIC, sizeof(FILE_MAGIC)) != 0) {
+            throw std::runtime_error(path + " is not a Visual Mesh file");
+        }
+        if (reader.read<uint32_t>() != FILE_VERSION) {
+            throw std::runtime_error(path + " was written with an unsupported version of the Visual Mesh format");
+        }
+        if (reader.read<uint32_t>() != sizeof(Scalar)) {
+            throw std::runtime_error(path + " was written with a different Scalar type");
+        }
+        if (reader.read<uint32_t>() != uint32_t(Model<Scalar>::N_NEIGHBOURS)) {
+            throw std::runtime_error(path + " was written with a model with a different number of neighbours");
+        }
+
+        VisualMesh mesh;
+        const uint64_t n_luts = reader.read<uint64_t>();
+        for (uint64_t i = 0; i < n_luts; ++i) {
+            const Scalar h = reader.read<Scalar>();
+            mesh.luts.insert(std::make_pair(h, Mesh<Scalar, Model>(reader)));
+        }
+        return mesh;
+    }
+
     /**
      * Find a visual mesh that exists at a specific height above the observation plane.
      * This only looks up meshes that were created during instantiation.
@@ -134,6 +297,28 @@ public:
                                                                                       : std::prev(it)->second;
     }
 
+    /**
+     * @brief Find the closest generated visual mesh to a height and correct it to be used at exactly that height
+     *
+     * @details
+     *  The rays of the mesh are moved so that the radial spacing of the points matches the height, see the correcting
+     *  constructor of Mesh. For the ring models the error in k between heights then only comes from the spacing
+     *  around each ring, so the VisualMesh can be built with a larger max_error and far fewer heights. The
+     *  corrected mesh is a new mesh each time, so keep it while the height stays close rather than making one for
+     *  every frame as engines cache their device data for each mesh.
+     *
+     * @tparam Shape the type of shape that the meshes were generated with
+     *
+     * @param shape  the shape that the meshes were generated with
+     * @param height the height above the observation plane to correct the mesh for
+     *
+     * @return the closest generated visual mesh corrected for the provided height
+     */
+    template <typename Shape>
+    Mesh<Scalar, Model> height(const Shape& shape, const Scalar& height) const {
+        return Mesh<Scalar, Model>(this->height(height), shape, height);
+    }
+
     /**
      * Performs a visual mesh lookup using the description of the lens provided to find visual mesh points on the image.
      *
@@ -151,7 +336,49 @@ public:
         return mesh->lookup(Hoc, lens);
     }
 
+    /**
+     * @brief Performs a visual mesh lookup for several cameras at once
+     *
+     * @details
+     *  Each camera uses the mesh for its own height, and the cameras that share a mesh are looked up together in a
+     *  single walk of its tree. See the lookup of several views in Mesh.
+     *
+     * @param views the homogenous transformation matrix from camera space to observation plane space and the lens of
+     *              each camera
+     *
+     * @return the mesh that was used for each view and a vector of start/end indices that are on its screen, in the
+     *         same order as the views
+     */
+    std::vector<std::pair<const Mesh<Scalar, Model>*, std::vector<std::pair<int, int>>>> lookup(
+      const std::vector<std::pair<mat4<Scalar>, Lens<Scalar>>>& views) const {
+
+        // Group the views by the mesh for their z height
+        std::map<const Mesh<Scalar, Model>*, std::vector<std::size_t>> groups;
+        for (std::size_t i = 0; i < views.size(); ++i) {
+            groups[&height(views[i].first[2][3])].push_back(i);
+        }
+
+        std::vector<std::pair<const Mesh<Scalar, Model>*, std::vector<std::pair<int, int>>>> result(views.size());
+        std::vector<std::pair<mat4<Scalar>, Lens<Scalar>>> group;
+        for (const auto& g : groups) {
+            group.clear();
+            for (const auto& i : g.second) {
+                group.push_back(views[i]);
+            }
+            auto ranges = g.first->lookup(group);
+            for (std::size_t k = 0; k < g.second.size(); ++k) {
+                result[g.second[k]] = std::make_pair(g.first, std::move(ranges[k]));
+            }
+        }
+        return result;
+    }
+
 private:
+    /// The magic number at the start of a Visual Mesh file
+    static constexpr char FILE_MAGIC[4] = {'V', 'M', 'S', 'H'};
+    /// The version of the binary format, increment this whenever the layout changes
+    static constexpr uint32_t FILE_VERSION = 1;
+
     /// A map from heights to visual mesh tables
     std::map<Scalar, const Mesh<Scalar, Model>> luts;
 
@@ -159,6 +386,11 @@ private:
     friend class VisualMesh;
 };
 
+template <typename Scalar, template <typename> class Model>
+constexpr char VisualMesh<Scalar, Model>::FILE_MAGIC[4];
+template <typename Scalar, template <typename> class Model>
+constexpr uint32_t VisualMesh<Scalar, Model>::FILE_VERSION;
+
 }  // namespace visualmesh
 
 #endif  // VISUALMESH_HPP
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef HISTOGRAM_HPP
+#define HISTOGRAM_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+/**
+ * @brief A high dynamic range histogram of durations in nanoseconds.
+ *
+ * @details
+ *  Each power of two range is split into a fixed number of linear sub buckets, so every recorded value is kept to
+ *  within 1% of its true value no matter if it is a microsecond or a second. Recording is a couple of shifts and an
+ *  increment, so it can be done on every frame without disturbing what is being measured.
+ */
+class Histogram {
+public:
+    /// The number of bits of precision kept for each value
+    static constexpr int SUB_BUCKET_BITS = 7;
+    static constexpr uint64_t SUB_BUCKETS = uint64_t(1) << SUB_BUCKET_BITS;
+
+    Histogram() : counts((64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS, 0) {}
+
+    /**
+     * @brief Add a single value to the histogram
+     *
+     * @param v the value in nanoseconds
+     */
+    void record(const uint64_t& v) {
+        ++counts[index(v)];
+        ++n;
+        total += v;
+        lowest  = std::min(lowest, v);
+        highest = std::max(highest, v);
+    }
+
+    /**
+     * @brief Add all the values from another histogram into this one
+     *
+     * @param other the histogram to merge in
+     */
+    void merge(const Histogram& other) {
+        for (std::size_t i = 0; i < counts.size(); ++i) {
+            counts[i] += other.counts[i];
+        }
+        n += other.n;
+        total += other.total;
+        lowest  = std::min(lowest, other.lowest);
+        highest = std::max(highest, other.highest);
+    }
+
+    /**
+     * @brief Find the value that the given percentage of the recorded values are less than or equal to
+     *
+     * @param p the percentile to find in the range [0, 100]
+     *
+     * @return the upper edge of the bucket that holds the percentile, clamped to the largest recorded value
+     */
+    uint64_t percentile(const double& p) const {
+        if (n == 0) { return 0; }
+        const uint64_t target = std::max(uint64_t(1), uint64_t(p / 100.0 * double(n) + 0.5));
+        uint64_t seen         = 0;
+        for (std::size_t i = 0; i < counts.size(); ++i) {
+            seen += counts[i];
+            if (seen >= target) { return std::min(value(i), highest); }
+        }
+        return highest;
+    }
+
+    uint64_t count() const {
+        return n;
+    }
+    uint64_t min() const {
+        return n == 0 ? 0 : lowest;
+    }
+    uint64_t max() const {
+        return highest;
+    }
+    double mean() const {
+        return n == 0 ? 0.0 : double(total) / double(n);
+    }
+
+private:
+    static std::size_t index(const uint64_t& v) {
+        // Small values are stored exactly
+        if (v < SUB_BUCKETS) { return v; }
+
+        // Shift until only the top SUB_BUCKET_BITS + 1 bits are left, the leading one picks the power of two range
+        int shift = 0;
+        while ((v >> shift) >= 2 * SUB_BUCKETS) {
+            ++shift;
+        }
+        return (shift + 1) * SUB_BUCKETS + ((v >> shift) - SUB_BUCKETS);
+    }
+
+    static uint64_t value(const std::size_t& i) {
+        if (i < SUB_BUCKETS) { return i; }
+        const uint64_t shift = i / SUB_BUCKETS - 1;
+        const uint64_t sub   = i % SUB_BUCKETS + SUB_BUCKETS;
+        return ((sub + 1) << shift) - 1;
+    }
+
+    std::vector<uint64_t> counts;
+    uint64_t n       = 0;
+    uint64_t total   = 0;
+    uint64_t lowest  = std::numeric_limits<uint64_t>::max();
+    uint64_t highest = 0;
+};
+
+#endif  // HISTOGRAM_HPP
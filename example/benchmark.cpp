@@ -15,15 +15,20 @@
  * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include <time.h>
+
 #include <array>
 #include <chrono>
+#include <cstdint>
+#include <iomanip>
 #include <iostream>
-#include <map>
+#include <random>
 #include <string>
 #include <thread>
 #include <type_traits>
 #include <vector>
 
+#include "Histogram.hpp"
 #include "Timer.hpp"
 #include "dataset.hpp"
 #include "load_model.hpp"
@@ -38,23 +43,104 @@
 
 using Scalar = float;
 
+/**
+ * @brief How frames are fed to an engine
+ */
+struct LoadProfile {
+    /// The number of frames each thread processes
+    int frames;
+    /// The number of threads, each of which acts as a separate camera
+    unsigned int threads;
+    /// The rate each camera produces frames at in Hz, or 0 to run the frames back to back as fast as possible
+    double rate;
+    /// How far each frame may arrive from its ideal time as a fraction of the frame period, should be less than 0.5
+    double jitter;
+    /// If a standalone projection is timed before each frame so the time spent in each stage can be reported
+    bool stages;
+};
+
+/**
+ * @brief The wall and CPU time spent in one stage of the pipeline
+ */
+struct StageTime {
+    std::chrono::nanoseconds wall{0};
+    std::chrono::nanoseconds cpu{0};
+    uint64_t count = 0;
+
+    void merge(const StageTime& other) {
+        wall += other.wall;
+        cpu += other.cpu;
+        count += other.count;
+    }
+};
+
+/**
+ * @brief The CPU time used by either this thread or the whole process
+ *
+ * @param clock CLOCK_THREAD_CPUTIME_ID or CLOCK_PROCESS_CPUTIME_ID
+ */
+inline std::chrono::nanoseconds cpu_time(const clockid_t& clock) {
+    ::timespec ts{};
+    ::clock_gettime(clock, &ts);
+    return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+
+/**
+ * @brief Times a call on both the wall clock and this threads CPU clock and adds it to a stage
+ */
+template <typename Func>
+void time_stage(StageTime& stage, Func&& func) {
+    const auto wall = std::chrono::steady_clock::now();
+    const auto cpu  = cpu_time(CLOCK_THREAD_CPUTIME_ID);
+    func();
+    stage.cpu += cpu_time(CLOCK_THREAD_CPUTIME_ID) - cpu;
+    stage.wall += std::chrono::steady_clock::now() - wall;
+    ++stage.count;
+}
+
 template <typename Engine, typename Mesh>
 class Benchmarker {
 public:
-    Benchmarker(const visualmesh::NetworkStructure<Scalar>& network,
+    Benchmarker(const Engine& engine,
                 const Mesh& mesh,
                 const std::vector<dataset_element<Scalar>>& dataset,
-                const int& loops)
-      : total(0), engine(network), mesh(mesh), dataset(dataset), loops(loops) {}
-
-    void start() {
-        thread = std::thread([this] {
-            for (int i = 0; i < loops; ++i) {
-                for (const auto& element : dataset) {
-                    // steady_clock::time_point start = steady_clock::now();
-                    engine(mesh, element.Hoc, element.lens, element.image.data, visualmesh::fourcc("BGRA"));
-                    // total += steady_clock::now() - start;
+                const LoadProfile& profile,
+                const unsigned int& camera)
+      : engine(engine), mesh(mesh), dataset(dataset), profile(profile), camera(camera) {}
+
+    /**
+     * @brief Start feeding frames to the engine
+     *
+     * @param epoch the time the first frame of the first camera arrives, shared by every benchmarker in a scenario
+     */
+    void start(const std::chrono::steady_clock::time_point& epoch) {
+        thread = std::thread([this, epoch] {
+            using namespace std::chrono;  // NOLINT(google-build-using-namespace) fine in function scope
+
+            // Spread the cameras evenly over a frame period so they don't all arrive at once
+            const duration<double> period(profile.rate > 0 ? 1.0 / profile.rate : 0.0);
+            const auto offset = period * (double(camera) / double(profile.threads));
+            std::mt19937 rng(camera);
+            std::uniform_real_distribution<double> jitter(-profile.jitter, profile.jitter);
+
+            for (int i = 0; i < profile.frames; ++i) {
+                const auto& element = dataset[(camera + i) % dataset.size()];
+
+                // When paced, latency is measured from when the frame should have arrived rather than when we got to
+                // it, so a slow frame also counts against the frames that had to queue up behind it
+                steady_clock::time_point arrival = steady_clock::now();
+                if (profile.rate > 0) {
+                    arrival = epoch + duration_cast<steady_clock::duration>(offset + period * (i + jitter(rng)));
+                    std::this_thread::sleep_until(arrival);
+                }
+
+                if (profile.stages) {
+                    time_stage(project, [&] { engine(mesh, element.Hoc, element.lens); });
                 }
+                time_stage(classify, [&] {
+                    engine(mesh, element.Hoc, element.lens, element.image.data, visualmesh::fourcc("BGRA"));
+                });
+                latency.record(duration_cast<nanoseconds>(steady_clock::now() - arrival).count());
             }
         });
     }
@@ -63,47 +149,140 @@ public:
         thread.join();
     }
 
-    std::chrono::steady_clock::duration total;
+    Histogram latency;
+    StageTime project;
+    StageTime classify;
 
 private:
-    Engine engine;
+    const Engine& engine;
     const Mesh& mesh;
     const std::vector<dataset_element<Scalar>>& dataset;
-    int loops;
+    LoadProfile profile;
+    unsigned int camera;
     std::thread thread;
 };
 
 template <typename Engine, typename Mesh>
-void benchmark(const visualmesh::NetworkStructure<Scalar>& network,
+std::vector<Benchmarker<Engine, Mesh>> make_benchmarkers(const Engine& engine,
+                                                         const Mesh& mesh,
+                                                         const std::vector<dataset_element<Scalar>>& dataset,
+                                                         const LoadProfile& profile) {
+    std::vector<Benchmarker<Engine, Mesh>> benchmarkers;
+    // Reserve so the benchmarkers don't move once their threads hold a pointer to them
+    benchmarkers.reserve(profile.threads);
+    for (unsigned int t = 0; t < profile.threads; ++t) {
+        benchmarkers.emplace_back(engine, mesh, dataset, profile, t);
+    }
+    return benchmarkers;
+}
+
+inline void print_stage(const std::string& name, const StageTime& stage) {
+    using namespace std::chrono;  // NOLINT(google-build-using-namespace) fine in function scope
+    if (stage.count == 0) { return; }
+    const double wall = duration_cast<duration<double, std::milli>>(stage.wall).count() / double(stage.count);
+    const double cpu  = duration_cast<duration<double, std::milli>>(stage.cpu).count() / double(stage.count);
+    std::cout << "    " << std::left << std::setw(10) << name << std::right << std::fixed << std::setprecision(3)
+              << "wall " << wall << "ms  cpu " << cpu << "ms  utilisation " << std::setprecision(1)
+              << (100.0 * cpu / wall) << "%" << std::endl;
+}
+
+template <typename Engine, typename Mesh>
+void report(const std::string& name,
+            const std::vector<Benchmarker<Engine, Mesh>>& benchmarkers,
+            const std::chrono::steady_clock::duration& elapsed) {
+    using namespace std::chrono;  // NOLINT(google-build-using-namespace) fine in function scope
+
+    Histogram latency;
+    StageTime project;
+    StageTime classify;
+    for (const auto& b : benchmarkers) {
+        latency.merge(b.latency);
+        project.merge(b.project);
+        classify.merge(b.classify);
+    }
+
+    auto ms = [](const uint64_t& ns) { return double(ns) * 1e-6; };
+    std::cout << "  " << name << std::fixed << std::setprecision(1) << ": "
+              << double(latency.count()) / duration_cast<duration<double>>(elapsed).count() << " fps" << std::endl;
+    std::cout << std::setprecision(3) << "    latency   p50 " << ms(latency.percentile(50)) << "ms  p90 "
+              << ms(latency.percentile(90)) << "ms  p99 " << ms(latency.percentile(99)) << "ms  p99.9 "
+              << ms(latency.percentile(99.9)) << "ms  max " << ms(latency.max()) << "ms" << std::endl;
+    print_stage("project", project);
+    print_stage("classify", classify);
+}
+
+/**
+ * @brief Runs a single engine under a load profile and reports its throughput, latency and CPU usage
+ */
+template <typename Engine, typename Mesh>
+void benchmark(const std::string& name,
+               const visualmesh::NetworkStructure<Scalar>& network,
                const std::vector<dataset_element<Scalar>>& dataset,
                const Mesh& mesh,
-               const int& loops,
-               const unsigned int& parallelity = 1) {
+               const LoadProfile& profile) {
 
     using namespace std::chrono;  // NOLINT(google-build-using-namespace) fine in function scope
-    Timer t;
-    // Build engines
-    std::vector<Benchmarker<Engine, Mesh>> benchmarkers;
-    benchmarkers.reserve(parallelity);
-    for (unsigned int t = 0; t < parallelity; ++t) {
-        benchmarkers.emplace_back(network, mesh, dataset, loops);
-    }
-    t.measure("Built benchmarkers");
+    // Build a single engine that is shared by all the threads
+    Engine engine(network);
+    auto benchmarkers = make_benchmarkers(engine, mesh, dataset, profile);
 
-    steady_clock::time_point start = steady_clock::now();
+    const auto cpu   = cpu_time(CLOCK_PROCESS_CPUTIME_ID);
+    const auto start = steady_clock::now();
     for (auto& b : benchmarkers) {
-        b.start();
+        b.start(start);
     }
-
-    // Wait until all the threads are done
     for (auto& b : benchmarkers) {
         b.join();
     }
-    steady_clock::time_point end = steady_clock::now();
+    const auto elapsed = steady_clock::now() - start;
+    const auto used    = cpu_time(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+
+    report(name, benchmarkers, elapsed);
+    std::cout << "    process   " << std::setprecision(2)
+              << duration_cast<duration<double>>(used).count() / duration_cast<duration<double>>(elapsed).count()
+              << " cores busy" << std::endl;
+}
+
+/**
+ * @brief Runs two engines at the same time so the effect of them contending for the same device can be seen
+ */
+template <typename EngineA, typename EngineB, typename Mesh>
+void benchmark_mixed(const std::string& name_a,
+                     const LoadProfile& profile_a,
+                     const std::string& name_b,
+                     const LoadProfile& profile_b,
+                     const visualmesh::NetworkStructure<Scalar>& network,
+                     const std::vector<dataset_element<Scalar>>& dataset,
+                     const Mesh& mesh) {
+
+    using namespace std::chrono;  // NOLINT(google-build-using-namespace) fine in function scope
+    EngineA engine_a(network);
+    EngineB engine_b(network);
+    auto a = make_benchmarkers(engine_a, mesh, dataset, profile_a);
+    auto b = make_benchmarkers(engine_b, mesh, dataset, profile_b);
+
+    const auto cpu   = cpu_time(CLOCK_PROCESS_CPUTIME_ID);
+    const auto start = steady_clock::now();
+    for (auto& x : a) {
+        x.start(start);
+    }
+    for (auto& x : b) {
+        x.start(start);
+    }
+    for (auto& x : a) {
+        x.join();
+    }
+    for (auto& x : b) {
+        x.join();
+    }
+    const auto elapsed = steady_clock::now() - start;
+    const auto used    = cpu_time(CLOCK_PROCESS_CPUTIME_ID) - cpu;
 
-    steady_clock::duration total = end - start;
-    double fps = double(parallelity * loops * dataset.size()) / duration_cast<duration<double>>(total).count();
-    std::cout << "FPS: " << fps << std::endl;
+    report(name_a, a, elapsed);
+    report(name_b, b, elapsed);
+    std::cout << "    process   " << std::setprecision(2)
+              << duration_cast<duration<double>>(used).count() / duration_cast<duration<double>>(elapsed).count()
+              << " cores busy" << std::endl;
 }
 
 // NOLINTNEXTLINE(bugprone-exception-escape) This is debugging code, I would prefer exceptions crash the program
@@ -127,17 +306,54 @@ int main() {
     auto dataset = load_dataset<Scalar>(image_path);
     t.measure("Loaded dataset");
 
+    using Mesh = decltype(mesh);
+    const unsigned int cores = std::thread::hardware_concurrency();
+
+    // Throughput runs frames back to back, the paced runs replay the dataset like cameras running at 30Hz with jitter
+    // clang-format off
+    const LoadProfile stages        {100, 1, 0.0, 0.0, true};
+    const LoadProfile cpu_throughput{2 * int(dataset.size()), cores, 0.0, 0.0, false};
+    const LoadProfile cpu_paced     {150, 2, 30.0, 0.1, false};
+#if !defined(VISUALMESH_DISABLE_OPENCL) || !defined(VISUALMESH_DISABLE_VULKAN)
+    const LoadProfile throughput    {400, 4, 0.0, 0.0, false};
+    const LoadProfile paced         {300, 4, 30.0, 0.1, false};
+#endif  // !defined(VISUALMESH_DISABLE_OPENCL) || !defined(VISUALMESH_DISABLE_VULKAN)
+    // clang-format on
+
 // Do benchmarks
 #if !defined(VISUALMESH_DISABLE_OPENCL)
     std::cout << "Benchmarking OpenCL Engine" << std::endl;
-    benchmark<visualmesh::engine::opencl::Engine<Scalar>>(network, dataset, mesh, 100, 4);
+    benchmark<visualmesh::engine::opencl::Engine<Scalar>>("throughput", network, dataset, mesh, throughput);
+    benchmark<visualmesh::engine::opencl::Engine<Scalar>>("paced", network, dataset, mesh, paced);
+    benchmark<visualmesh::engine::opencl::Engine<Scalar>>("stages", network, dataset, mesh, stages);
 #endif  // !defined(VISUALMESH_DISABLE_OPENCL)
 
 #if !defined(VISUALMESH_DISABLE_VULKAN)
     std::cout << "Benchmarking Vulkan Engine" << std::endl;
-    benchmark<visualmesh::engine::vulkan::Engine<Scalar>>(network, dataset, mesh, 100, 4);
+    benchmark<visualmesh::engine::vulkan::Engine<Scalar>>("throughput", network, dataset, mesh, throughput);
+    benchmark<visualmesh::engine::vulkan::Engine<Scalar>>("paced", network, dataset, mesh, paced);
+    benchmark<visualmesh::engine::vulkan::Engine<Scalar>>("stages", network, dataset, mesh, stages);
 #endif  // !defined(VISUALMESH_DISABLE_VULKAN)
 
     std::cout << "Benchmarking CPU Engine" << std::endl;
-    benchmark<visualmesh::engine::cpu::Engine<Scalar>>(network, dataset, mesh, 2, std::thread::hardware_concurrency());
+    benchmark<visualmesh::engine::cpu::Engine<Scalar>>("throughput", network, dataset, mesh, cpu_throughput);
+    benchmark<visualmesh::engine::cpu::Engine<Scalar>>("paced", network, dataset, mesh, cpu_paced);
+    benchmark<visualmesh::engine::cpu::Engine<Scalar>>("stages", network, dataset, mesh, stages);
+
+    // Two engines sharing the machine at once
+#if !defined(VISUALMESH_DISABLE_OPENCL) && !defined(VISUALMESH_DISABLE_VULKAN)
+    std::cout << "Benchmarking OpenCL and Vulkan Engines sharing the GPU" << std::endl;
+    benchmark_mixed<visualmesh::engine::opencl::Engine<Scalar>, visualmesh::engine::vulkan::Engine<Scalar>, Mesh>(
+      "opencl", paced, "vulkan", paced, network, dataset, mesh);
+#endif  // !defined(VISUALMESH_DISABLE_OPENCL) && !defined(VISUALMESH_DISABLE_VULKAN)
+
+#if !defined(VISUALMESH_DISABLE_OPENCL)
+    std::cout << "Benchmarking OpenCL and CPU Engines sharing the host" << std::endl;
+    benchmark_mixed<visualmesh::engine::opencl::Engine<Scalar>, visualmesh::engine::cpu::Engine<Scalar>, Mesh>(
+      "opencl", paced, "cpu", cpu_paced, network, dataset, mesh);
+#else
+    std::cout << "Benchmarking two CPU Engines sharing the host" << std::endl;
+    benchmark_mixed<visualmesh::engine::cpu::Engine<Scalar>, visualmesh::engine::cpu::Engine<Scalar>, Mesh>(
+      "cpu a", cpu_paced, "cpu b", cpu_paced, network, dataset, mesh);
+#endif  // !defined(VISUALMESH_DISABLE_OPENCL)
 }
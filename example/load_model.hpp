@@ -51,4 +51,23 @@ visualmesh::NetworkStructure<Scalar> load_model(const std::string& path) {
     return model;
 }
 
+template <typename Scalar>
+visualmesh::Cascade<Scalar> load_cascade(const std::string& path) {
+
+    visualmesh::Cascade<Scalar> cascade{0, {}, Scalar(1)};
+    YAML::Node config = YAML::LoadFile(path);
+    if (config["cascade"]) {
+        cascade.groups    = config["cascade"]["groups"].as<unsigned int>();
+        cascade.threshold = config["cascade"]["threshold"].as<Scalar>();
+        for (const auto& layer : config["cascade"]["head"]) {
+            cascade.head.emplace_back(visualmesh::Layer<Scalar>{
+              layer["weights"].as<std::vector<std::vector<Scalar>>>(),
+              layer["biases"].as<std::vector<Scalar>>(),
+              activation_function(layer["activation"].as<std::string>()),
+            });
+        }
+    }
+    return cascade;
+}
+
 #endif  // LOAD_MODEL_HPP
@@ -15,17 +15,26 @@
  * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include <algorithm>
 #include <array>
+#include <chrono>
 #include <cmath>
 #include <cstdint>
+#include <cstdlib>
 #include <iomanip>
 #include <iostream>
 #include <limits>
-#include <map>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 
-#include "visualmesh/geometry/Circle.hpp"
+#include "visualmesh/classified_mesh.hpp"
+#include "visualmesh/clusters.hpp"
+#include "visualmesh/compact_nodes.hpp"
 #include "visualmesh/geometry/Sphere.hpp"
 #include "visualmesh/mesh.hpp"
 #include "visualmesh/model/nmgrid4.hpp"
@@ -40,254 +49,767 @@
 #include "visualmesh/model/xygrid4.hpp"
 #include "visualmesh/model/xygrid6.hpp"
 #include "visualmesh/model/xygrid8.hpp"
+#include "visualmesh/region.hpp"
 #include "visualmesh/utility/math.hpp"
 #include "visualmesh/utility/phi_difference.hpp"
+#include "visualmesh/utility/projection.hpp"
+#include "visualmesh/utility/thread_pool.hpp"
 
-template <typename Scalar>
-using vec3 = visualmesh::vec3<Scalar>;
-
-template <typename Scalar, int N_NEIGHBOURS>
-struct NodeQuality {
-    /// The distance this node is from the origin
-    Scalar distance;
-    /// The angle this node is around the z axis
-    Scalar angle;
-    /// The number of object jumps between this node and the nodes around it
-    std::array<Scalar, N_NEIGHBOURS> radial;
-    /// The number of object jumps between each neighbour and the subsequent neighbour
-    std::array<Scalar, N_NEIGHBOURS> cyclical;
-    /// The angle between each neighbour and the subsequent neighbour
-    std::array<Scalar, N_NEIGHBOURS> angular;
+/**
+ * @brief Online statistics for one quality measure, accumulated without keeping the values that went into it
+ *
+ * @details
+ *  The mean and variance are kept with Welford's algorithm so a single pass over the nodes is enough, and the values
+ *  are binned into a fixed linear histogram so the distribution and its percentiles can be reported. Every measure is
+ *  normalised so that a perfect mesh gives 1, which means the same histogram range suits all of them.
+ */
+struct Statistics {
+    /// The largest value the histogram bins, anything above this goes into the overflow bin
+    static constexpr double HISTOGRAM_MAX = 3.0;
+    /// The number of bins the histogram range is split into
+    static constexpr int HISTOGRAM_BINS = 300;
+
+    void update(const double& v) {
+        // Neighbours that were off screen or the same node do not say anything about the quality
+        if (std::isnan(v) || v == 0) { return; }
+
+        ++n;
+        const double delta = v - mean;
+        mean += delta / double(n);
+        m2 += delta * (v - mean);
+        ++bins[std::min(HISTOGRAM_BINS, int(v * HISTOGRAM_BINS / HISTOGRAM_MAX))];
+    }
+
+    void merge(const Statistics& other) {
+        if (other.n == 0) { return; }
+        const uint64_t total = n + other.n;
+        const double delta   = other.mean - mean;
+        mean += delta * double(other.n) / double(total);
+        m2 += other.m2 + delta * delta * double(n) * double(other.n) / double(total);
+        n = total;
+        for (int i = 0; i <= HISTOGRAM_BINS; ++i) {
+            bins[i] += other.bins[i];
+        }
+    }
+
+    double stddev() const {
+        return n == 0 ? 0.0 : std::sqrt(m2 / double(n));
+    }
+
+    /// The value that p percent of the values are below, interpolated linearly within the bin that holds it
+    double percentile(const double& p) const {
+        if (n == 0) { return 0.0; }
+        const double target = p / 100.0 * double(n);
+        double seen         = 0;
+        for (int i = 0; i < HISTOGRAM_BINS; ++i) {
+            if (seen + double(bins[i]) >= target) {
+                const double f = bins[i] == 0 ? 0.0 : (target - seen) / double(bins[i]);
+                return (i + f) * HISTOGRAM_MAX / HISTOGRAM_BINS;
+            }
+            seen += double(bins[i]);
+        }
+        return HISTOGRAM_MAX;
+    }
+
+    uint64_t n  = 0;
+    double mean = 0;
+    double m2   = 0;
+    std::array<uint64_t, HISTOGRAM_BINS + 1> bins{};
+};
+
+/// A quality measure for each neighbour slot of the model along with all of the slots together
+struct Measure {
+    void update(const int& slot, const double& v) {
+        slots[slot].update(v);
+    }
+
+    Statistics all() const {
+        Statistics total;
+        for (const auto& s : slots) {
+            total.merge(s);
+        }
+        return total;
+    }
+
+    std::vector<Statistics> slots;
 };
 
-template <typename Scalar, template <typename> class Shape, template <typename> class Model>
-std::vector<NodeQuality<Scalar, Model<Scalar>::N_NEIGHBOURS>> check_quality(
-  const Shape<Scalar>& shape, const visualmesh::Mesh<Scalar, Model>& mesh) {
+/// A single combination of parameters to build and analyse a mesh for
+struct Job {
+    int model;
+    double h;
+    double r;
+    double k;
+    double max_distance;
+};
 
-    constexpr int N_NEIGHBOURS = Model<Scalar>::N_NEIGHBOURS;
+/// Everything that is reported about a single mesh
+struct Summary {
+    Job job;
+    /// Why the mesh could not be built, or empty if it was analysed
+    std::string error;
+    std::size_t nodes;
+    double seconds;
+
+    /// The number of object jumps between a node and each of its neighbours multiplied by k
+    Measure radial;
+    /// The number of object jumps between each neighbour and the subsequent neighbour multiplied by k
+    Measure cyclical;
+    /// The angle between each neighbour and the subsequent neighbour as a fraction of an even split of the circle
+    Measure angular;
+
+    /// The mean log2 of how far through the node list each neighbour is from the node that references it
+    double locality_log2;
+    /// The percentage of neighbours within 8, 64, 512, 4096 and further than 4096 nodes
+    std::array<double, 5> locality;
+
+    /// The size of the compact nodes as a percentage of the float nodes
+    double compact_percent;
+    /// The percentage of neighbours that were too far away to be stored as a relative offset
+    double far_percent;
+    /// The largest angle between a ray and its compact encoding
+    double max_ray_error;
+    /// If every neighbour survived the compact encoding
+    bool neighbours_match;
+    /// If a lookup of many views at once found the same ranges as looking up each view on its own
+    bool views_match;
+    /// If every region lookup found the points that a lookup of the whole image finds in its rectangle
+    bool regions_match;
+    /// The furthest in pixels outside of its rectangle that a region lookup found a point
+    double region_margin;
+    /// If every lookup with a cache along a random walk of the camera found the points a full lookup finds
+    bool walk_match;
+    /// How many times the cache rebuilt its frontier along the walks
+    std::size_t walk_rebuilds;
+    /// How many more points the lookups with a cache found than the full lookups along the walks
+    std::size_t walk_extra;
+    /// If clustering random scores found the same clusters as a flood fill, both on one thread and on several
+    bool clusters_match;
+    /// The number of clusters of at least three points in the random scores
+    std::size_t clusters;
+};
 
-    // Loop through all the nodes in the mesh
-    std::vector<NodeQuality<Scalar, N_NEIGHBOURS>> nodes;
+template <template <typename> class Model>
+void check_quality(const visualmesh::geometry::Sphere<double>& shape,
+                   const visualmesh::Mesh<double, Model>& mesh,
+                   Summary& summary) {
+    using namespace visualmesh;  // NOLINT(google-build-using-namespace) Fine in function scope
+    constexpr int N_NEIGHBOURS = Model<double>::N_NEIGHBOURS;
+
+    summary.radial.slots.resize(N_NEIGHBOURS);
+    summary.cyclical.slots.resize(N_NEIGHBOURS);
+    summary.angular.slots.resize(N_NEIGHBOURS);
+
+    // Each node is folded into the statistics as it is measured rather than being stored
+    const int n = int(mesh.nodes.size());
     for (const auto& node : mesh.nodes) {
-        NodeQuality<Scalar, N_NEIGHBOURS> quality{};
 
         // Our ray pointing in the centre of the cluster
         const auto& r0 = node.ray;
 
-        // The rays location in the space
-        quality.distance = (mesh.h - shape.c()) * std::sqrt(1 - r0[2] * r0[2]) / -r0[2];
-        quality.angle    = std::atan2(r0[1], r0[0]);
-
-        // By default set things to nan as a "this node did not exist"
-        quality.radial.fill(std::numeric_limits<Scalar>::quiet_NaN());
-        quality.cyclical.fill(std::numeric_limits<Scalar>::quiet_NaN());
-        quality.angular.fill(std::numeric_limits<Scalar>::quiet_NaN());
-
         // We look through each of our neighbours to see how good we are
-        for (unsigned int i = 0; i < node.neighbours.size(); ++i) {
+        for (int i = 0; i < N_NEIGHBOURS; ++i) {
 
             // We get our next two neighbours in a clockwise direction
-            int n1 = node.neighbours[i];
-            int n2 = node.neighbours[(i + 1) % node.neighbours.size()];
+            const int n1 = node.neighbours[i];
+            const int n2 = node.neighbours[(i + 1) % N_NEIGHBOURS];
 
             // Ignore points that go off the screen
-            if (n1 < int(mesh.nodes.size())) {
-                // The neighbours ray
+            if (n1 < n) {
                 const auto& r1 = mesh.nodes[n1].ray;
 
                 // Radial difference to our neighbour
-                using namespace visualmesh;  // NOLINT(google-build-using-namespace) Fine in function scope
-                auto r_d          = util::phi_difference(mesh.h, shape.c(), r0, r1);
-                quality.radial[i] = std::abs(shape.n(r_d.phi_0, r_d.h_prime) - shape.n(r_d.phi_1, r_d.h_prime));
+                auto r_d = util::phi_difference(mesh.h, shape.c(), r0, r1);
+                summary.radial.update(
+                  i, summary.job.k * std::abs(shape.n(r_d.phi_0, r_d.h_prime) - shape.n(r_d.phi_1, r_d.h_prime)));
 
                 // Ignore points that go off the screen
-                if (n2 < int(mesh.nodes.size())) {
+                if (n2 < n) {
                     const auto& r2 = mesh.nodes[n2].ray;
 
                     // The distance difference between the two neighbour rays
-                    auto c_d            = util::phi_difference<Scalar>(mesh.h, shape.c(), r1, r2);
-                    quality.cyclical[i] = std::abs(shape.n(c_d.phi_0, c_d.h_prime) - shape.n(c_d.phi_1, c_d.h_prime));
+                    auto c_d = util::phi_difference(mesh.h, shape.c(), r1, r2);
+                    summary.cyclical.update(
+                      i, summary.job.k * std::abs(shape.n(c_d.phi_0, c_d.h_prime) - shape.n(c_d.phi_1, c_d.h_prime)));
 
                     // The angular difference between two neighbourhood rays
-                    auto u             = normalise(cross(r0, r1));
-                    auto v             = normalise(cross(r0, r2));
-                    quality.angular[i] = Scalar(2.0) * std::atan2(norm(subtract(u, v)), norm(add(u, v)));
+                    auto u = normalise(cross(r0, r1));
+                    auto v = normalise(cross(r0, r2));
+                    summary.angular.update(
+                      i, N_NEIGHBOURS / (M_PI * 2.0) * 2.0 * std::atan2(norm(subtract(u, v)), norm(add(u, v))));
                 }
             }
         }
+    }
+}
 
-        nodes.push_back(quality);
+template <template <typename> class Model>
+void check_locality(const visualmesh::Mesh<double, Model>& mesh, Summary& summary) {
+
+    // How far through the node list each neighbour is from the node that references it
+    // Distances are bucketed by powers of 8 which roughly corresponds to nodes per cache line, per page etc
+    constexpr int N_BUCKETS = 4;
+    std::array<uint64_t, N_BUCKETS + 1> buckets{};
+    uint64_t total = 0;
+    double log_sum = 0;
+    const int n    = int(mesh.nodes.size());
+    for (int i = 0; i < n; ++i) {
+        for (const auto& j : mesh.nodes[i].neighbours) {
+            // Ignore points that go off the screen
+            if (j < n) {
+                const int d = std::abs(j - i);
+                int b       = 0;
+                for (int limit = 8; b < N_BUCKETS && d > limit; limit *= 8) {
+                    ++b;
+                }
+                buckets[b]++;
+                total++;
+                log_sum += std::log2(double(d));
+            }
+        }
     }
 
-    return nodes;
+    summary.locality_log2 = total == 0 ? 0.0 : log_sum / double(total);
+    for (int b = 0; b <= N_BUCKETS; ++b) {
+        summary.locality[b] = total == 0 ? 0.0 : 100.0 * double(buckets[b]) / double(total);
+    }
 }
 
-template <typename Scalar, int N_NEIGHBOURS>
-struct Statistics {
-    Statistics() {
-        means.fill(0);
-        sums.fill(0);
-        counts.fill(0);
+template <template <typename> class Model>
+void check_compact(const visualmesh::Mesh<double, Model>& mesh, Summary& summary) {
+    static constexpr int N_NEIGHBOURS = Model<double>::N_NEIGHBOURS;
+
+    // Encode the nodes and check how far the decoded rays moved and that every neighbour survived
+    const visualmesh::CompactNodes<double, N_NEIGHBOURS> compact(mesh.nodes);
+    double max_angle = 0;
+    bool neighbours  = true;
+    for (std::size_t i = 0; i < mesh.nodes.size(); ++i) {
+        const double d = visualmesh::dot(mesh.nodes[i].ray, compact.ray(i));
+        max_angle      = std::max(max_angle, std::acos(std::min(1.0, d)));
+        neighbours     = neighbours && compact.node(i).neighbours == mesh.nodes[i].neighbours;
     }
 
-    void update(const std::array<Scalar, N_NEIGHBOURS> input) {
+    // Compare against the nodes as float, which is how they are normally held for inference
+    const double full        = double(mesh.nodes.size()) * sizeof(visualmesh::Node<float, N_NEIGHBOURS>);
+    const double links       = double(mesh.nodes.size()) * N_NEIGHBOURS;
+    summary.compact_percent  = full == 0 ? 0.0 : 100.0 * double(compact.bytes()) / full;
+    summary.far_percent      = links == 0 ? 0.0 : 100.0 * double(compact.far.size()) / links;
+    summary.max_ray_error    = max_angle;
+    summary.neighbours_match = neighbours;
+}
 
-        for (unsigned int i = 0; i < N_NEIGHBOURS; ++i) {
-            if (!std::isnan(input[i]) && input[i] != 0) {
-                sums[i] += input[i];
-                counts[i]++;
-                means[i] = sums[i] / counts[i];
-            }
-        }
-    }
+/// A 1280x1024 lens of the projection, wide enough to see most of the mesh for a fisheye
+visualmesh::Lens<double> make_lens(const visualmesh::LensProjection& projection) {
+    visualmesh::Lens<double> lens{};
+    lens.projection   = projection;
+    lens.dimensions   = {{1280, 1024}};
+    lens.centre       = {{0, 0}};
+    lens.k            = {{0, 0}};
+    lens.focal_length = projection == visualmesh::RECTILINEAR ? 640 : 420;
+    lens.fov          = projection == visualmesh::RECTILINEAR ? 1.6 : 3.14;
+    return lens;
+}
 
-    std::array<Scalar, N_NEIGHBOURS> means;
-    std::array<Scalar, N_NEIGHBOURS> sums;
-    std::array<uint32_t, N_NEIGHBOURS> counts;
-};
+/// A camera at height h turned by yaw around the vertical and pitched down by pitch
+visualmesh::mat4<double> make_camera(const double& yaw, const double& pitch, const double& h) {
+    return {{
+      {{std::cos(yaw) * std::cos(pitch), -std::sin(yaw), std::cos(yaw) * std::sin(pitch), 0}},
+      {{std::sin(yaw) * std::cos(pitch), std::cos(yaw), std::sin(yaw) * std::sin(pitch), 0}},
+      {{-std::sin(pitch), 0, std::cos(pitch), h}},
+      {{0, 0, 0, 1}},
+    }};
+}
+
+/// If a ray in camera space lands on the screen, the same test a lookup makes of each point near the screen edge
+bool on_screen(const visualmesh::vec3<double>& ray, const visualmesh::Lens<double>& lens) {
+    if (ray[0] <= std::cos(lens.fov * 0.5)) { return false; }
+    const auto px = visualmesh::project(ray, lens);
+    return 0 <= px[0] && px[0] + 1 <= lens.dimensions[0] && 0 <= px[1] && px[1] + 1 <= lens.dimensions[1];
+}
+
+template <template <typename> class Model>
+void check_views(const visualmesh::Mesh<double, Model>& mesh, Summary& summary) {
+    // More views than bits in the mask so the lookup needs a full walk with every bit set and a partial one after it
+    constexpr int N_VIEWS = 67;
 
-template <typename Scalar, int N_NEIGHBOURS>
-void print_quality(const std::vector<NodeQuality<Scalar, N_NEIGHBOURS>>& nodes, const Scalar& k) {
-
-    // Storage for the statistics
-    Statistics<Scalar, N_NEIGHBOURS> radial;
-    Statistics<Scalar, N_NEIGHBOURS> radial_var;
-    Statistics<Scalar, N_NEIGHBOURS> cyclical;
-    Statistics<Scalar, N_NEIGHBOURS> cyclical_var;
-    Statistics<Scalar, N_NEIGHBOURS> angular;
-    Statistics<Scalar, N_NEIGHBOURS> angular_var;
-
-    // Go through all the nodes and accumulate for the mean value
-    for (const auto& node : nodes) {
-        radial.update(visualmesh::multiply(node.radial, k));
-        cyclical.update(visualmesh::multiply(node.cyclical, k));
-        angular.update(visualmesh::multiply(node.angular, Scalar(N_NEIGHBOURS * (M_PI * 2.0))));
+    // Spin around the vertical while nodding up and down so the views overlap without being the same
+    std::vector<std::pair<visualmesh::mat4<double>, visualmesh::Lens<double>>> views;
+    for (int v = 0; v < N_VIEWS; ++v) {
+        views.emplace_back(make_camera(2.0 * M_PI * v / N_VIEWS, 0.6 * std::sin(v * 0.7), mesh.h),
+                           make_lens(v % 2 == 0 ? visualmesh::RECTILINEAR : visualmesh::EQUISOLID));
     }
 
-    // Sum up the variance
-    for (const auto& node : nodes) {
-        auto v = visualmesh::subtract(visualmesh::multiply(node.radial, k), radial.means);
-        radial_var.update(visualmesh::multiply(v, v));
-        auto c = visualmesh::subtract(visualmesh::multiply(node.cyclical, k), cyclical.means);
-        cyclical_var.update(visualmesh::multiply(c, c));
-        auto a =
-          visualmesh::subtract(visualmesh::multiply(node.angular, Scalar(N_NEIGHBOURS * (M_PI * 2.0))), angular.means);
-        angular_var.update(visualmesh::multiply(a, a));
+    const auto all = mesh.lookup(views);
+    bool match     = all.size() == views.size();
+    for (std::size_t v = 0; match && v < views.size(); ++v) {
+        match = all[v] == mesh.lookup(views[v].first, views[v].second);
     }
+    summary.views_match = match;
+}
 
-    std::cout << std::setprecision(4);
-    std::cout << "Covered with " << nodes.size() << " nodes" << std::endl;
-    for (unsigned int i = 0; i < N_NEIGHBOURS; ++i) {
-        std::cout << "* " << (radial.means[i]) << "±" << (std::sqrt(radial_var.means[i]));
-        std::cout << " o " << (cyclical.means[i]) << "±" << (std::sqrt(cyclical_var.means[i]));
-        std::cout << " a " << (angular.means[i]) << "±" << (std::sqrt(angular_var.means[i]));
-        std::cout << std::endl;
+template <template <typename> class Model>
+void check_regions(const visualmesh::Mesh<double, Model>& mesh, Summary& summary) {
+    // Random rectangles, some of which hang off the image or miss it entirely, seen from random cameras
+    constexpr int N_REGIONS = 200;
+    std::mt19937 generator(N_REGIONS);
+    std::uniform_real_distribution<double> yaw(-M_PI, M_PI);
+    std::uniform_real_distribution<double> pitch(-0.2, 1.2);
+    std::uniform_int_distribution<int> offset(-300, 1200);
+    std::uniform_int_distribution<int> size(1, 600);
+
+    const int n = int(mesh.nodes.size());
+    std::vector<char> found(n);
+    std::vector<char> on_screen(n);
+    double worst = 0;
+    bool missed  = false;
+    for (int r = 0; r < N_REGIONS; ++r) {
+        const auto lens   = make_lens(r % 2 == 0 ? visualmesh::RECTILINEAR : visualmesh::EQUISOLID);
+        const auto Hoc    = make_camera(yaw(generator), pitch(generator), mesh.h);
+        const auto region = visualmesh::pixel_region<double>({{offset(generator), offset(generator)}},
+                                                             {{size(generator), size(generator)}});
+
+        std::fill(found.begin(), found.end(), 0);
+        for (const auto& range : mesh.lookup(Hoc, lens, region)) {
+            std::fill(found.begin() + range.first, found.begin() + range.second, 1);
+        }
+        std::fill(on_screen.begin(), on_screen.end(), 0);
+        for (const auto& range : mesh.lookup(Hoc, lens)) {
+            std::fill(on_screen.begin() + range.first, on_screen.begin() + range.second, 1);
+        }
+
+        // Every point the whole image finds inside the rectangle must be found, project them all to check
+        std::array<double, 2> low;
+        std::array<double, 2> high;
+        for (int i = 0; i < 2; ++i) {
+            low[i]  = std::max(region.offset[i], 0);
+            high[i] = std::min(region.offset[i] + region.dimensions[i], lens.dimensions[i]) - 1;
+        }
+        const auto Rco = visualmesh::block<3, 3>(visualmesh::transpose(Hoc));
+        for (int i = 0; i < n; ++i) {
+            const auto ray = visualmesh::multiply(Rco, mesh.nodes[i].ray);
+            double outside = std::numeric_limits<double>::infinity();
+            if (ray[0] > 0) {
+                const auto px = visualmesh::project(ray, lens);
+                outside       = std::max({0.0, low[0] - px[0], px[0] - high[0], low[1] - px[1], px[1] - high[1]});
+            }
+            if (found[i] != 0) { worst = std::max(worst, outside); }
+            else if (on_screen[i] != 0 && outside == 0) {
+                missed = true;
+            }
+        }
     }
+    // The lookup grows the rectangle by two pixels and fisheye screen edges are a little looser, so extra points are
+    // only reported while a missing one is a bug
+    summary.region_margin = worst;
+    summary.regions_match = !missed;
 }
 
-// NOLINTNEXTLINE(bugprone-exception-escape) This is debugging code, I would prefer exceptions crash the program
-int main(int argc, const char* argv[]) {
+template <template <typename> class Model>
+void check_walk(const visualmesh::Mesh<double, Model>& mesh, Summary& summary) {
+    // Each lens takes a random walk that is sometimes within the tolerance of the reference frame and sometimes not
+    constexpr int N_FRAMES = 400;
+    std::mt19937 generator(N_FRAMES);
+    std::uniform_real_distribution<double> yaw(-M_PI, M_PI);
+    std::uniform_real_distribution<double> pitch(-0.2, 1.2);
+    std::normal_distribution<double> step(0.0, 0.004);
+
+    const int n = int(mesh.nodes.size());
+    std::vector<char> found(n);
+    bool match = true;
+    for (const auto& projection : {visualmesh::RECTILINEAR, visualmesh::EQUISOLID}) {
+        const auto lens = make_lens(projection);
+        visualmesh::LookupCache<double> cache(0.02);
+        double y = yaw(generator);
+        double p = pitch(generator);
+        for (int f = 0; f < N_FRAMES; ++f) {
+            y += step(generator);
+            p += step(generator);
+            const auto Hoc = make_camera(y, p, mesh.h);
+
+            // Every point on the screen that a full lookup finds must be found, but either lookup may include a few
+            // points just off the edge of a fisheye lens that the other doesn't
+            std::fill(found.begin(), found.end(), 0);
+            for (const auto& range : mesh.lookup(Hoc, lens, cache)) {
+                std::fill(found.begin() + range.first, found.begin() + range.second, 1);
+            }
+            const auto Rco = visualmesh::block<3, 3>(visualmesh::transpose(Hoc));
+            for (const auto& range : mesh.lookup(Hoc, lens)) {
+                for (int i = range.first; i < range.second; ++i) {
+                    const auto ray = visualmesh::multiply(Rco, mesh.nodes[i].ray);
+                    if (found[i] == 0 && on_screen(ray, lens)) { match = false; }
+                    found[i] = 0;
+                }
+            }
+            summary.walk_extra += std::size_t(std::count(found.begin(), found.end(), 1));
+        }
+        summary.walk_rebuilds += cache.rebuilds;
+    }
+    summary.walk_match = match;
+}
 
-    const double h            = argc > 1 ? std::stof(argv[1]) : 1;
-    const double r            = argc > 2 ? std::stof(argv[2]) : 0.0949996;
-    const double k            = argc > 3 ? std::stof(argv[3]) : 1;
-    const double max_distance = argc > 4 ? std::stof(argv[4]) : 20;
+template <template <typename> class Model>
+void check_clusters(const visualmesh::Mesh<double, Model>& mesh, Summary& summary) {
+    static constexpr int N_NEIGHBOURS = Model<double>::N_NEIGHBOURS;
+    constexpr std::size_t MIN_POINTS  = 3;
+
+    // Classify the whole mesh with random scores, which at an even threshold makes clusters of every shape and size
+    const int n = int(mesh.nodes.size());
+    visualmesh::ClassifiedMesh<double, N_NEIGHBOURS> classified;
+    std::mt19937 generator(n);
+    std::uniform_real_distribution<double> score(0.0, 1.0);
+    for (int i = 0; i < n; ++i) {
+        const auto& ray = mesh.nodes[i].ray;
+        classified.pixel_coordinates.push_back({{ray[0], ray[1]}});
+        classified.neighbourhood.push_back(mesh.nodes[i].neighbours);
+        classified.global_indices.push_back(i);
+        const double s = score(generator);
+        classified.classifications.push_back(s);
+        classified.classifications.push_back(1.0 - s);
+    }
+    std::array<int, N_NEIGHBOURS> offscreen;
+    offscreen.fill(n);
+    classified.neighbourhood.push_back(offscreen);
+    classified.classifications.push_back(0);
+    classified.classifications.push_back(0);
+
+    // Flood fill from the first point of each cluster, following the graph both ways as the union find does
+    std::vector<std::vector<int>> graph(n);
+    for (int i = 0; i < n; ++i) {
+        for (const auto& j : mesh.nodes[i].neighbours) {
+            if (j < n) {
+                graph[i].push_back(j);
+                graph[j].push_back(i);
+            }
+        }
+    }
+    std::vector<std::vector<int>> reference;
+    std::vector<char> visited(n, 0);
+    for (int i = 0; i < n; ++i) {
+        if (visited[i] != 0 || classified.classifications[i * 2] < 0.5) { continue; }
+        std::vector<int> points = {i};
+        visited[i]              = 1;
+        for (std::size_t k = 0; k < points.size(); ++k) {
+            for (const auto& j : graph[points[k]]) {
+                if (visited[j] == 0 && classified.classifications[j * 2] >= 0.5) {
+                    visited[j] = 1;
+                    points.push_back(j);
+                }
+            }
+        }
+        if (points.size() >= MIN_POINTS) {
+            std::sort(points.begin(), points.end());
+            reference.push_back(points);
+        }
+    }
+
+    // The clusters should be the same found on this thread or split across several
+    visualmesh::ThreadPool pool(4);
+    bool match = true;
+    for (auto* p : {static_cast<visualmesh::ThreadPool*>(nullptr), &pool}) {
+        const auto clusters = visualmesh::find_clusters(mesh, classified, 0, 0.5, MIN_POINTS, p);
+        match               = match && clusters.size() == reference.size();
+        for (std::size_t c = 0; match && c < clusters.size(); ++c) {
+            match = clusters[c].points == reference[c];
+        }
+    }
+    summary.clusters       = reference.size();
+    summary.clusters_match = match;
+}
 
-    visualmesh::geometry::Sphere<double> shape(r);
+template <template <typename> class Model>
+Summary analyse(const Job& job) {
+    const auto start = std::chrono::steady_clock::now();
+
+    // Each mesh is built on a single thread as the sweep already keeps every thread busy with a mesh of its own
+    visualmesh::geometry::Sphere<double> shape(job.r);
+    visualmesh::Mesh<double, Model> mesh(shape, job.h, job.k, job.max_distance);
+
+    Summary summary{};
+    summary.job   = job;
+    summary.nodes = mesh.nodes.size();
+    check_quality(shape, mesh, summary);
+    check_locality(mesh, summary);
+    check_compact(mesh, summary);
+    check_views(mesh, summary);
+    check_regions(mesh, summary);
+    check_walk(mesh, summary);
+    check_clusters(mesh, summary);
+
+    summary.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return summary;
+}
 
-    {
-        std::cout << "Ring 4 Quality:" << std::endl;
-        visualmesh::Mesh<double, visualmesh::model::Ring4> mesh(shape, h, k, max_distance);
-        auto quality = check_quality(shape, mesh);
-        print_quality(quality, k);
-        std::cout << std::endl;
+/// The models that can be swept, the name is how they are selected on the command line and reported in the output
+struct ModelEntry {
+    const char* name;
+    const char* title;
+    Summary (*analyse)(const Job&);
+};
+const std::array<ModelEntry, 12> models = {{
+  {"ring4", "Ring 4", &analyse<visualmesh::model::Ring4>},
+  {"ring6", "Ring 6", &analyse<visualmesh::model::Ring6>},
+  {"ring8", "Ring 8", &analyse<visualmesh::model::Ring8>},
+  {"xmgrid4", "XM Grid 4", &analyse<visualmesh::model::XMGrid4>},
+  {"xmgrid6", "XM Grid 6", &analyse<visualmesh::model::XMGrid6>},
+  {"xmgrid8", "XM Grid 8", &analyse<visualmesh::model::XMGrid8>},
+  {"xygrid4", "XY Grid 4", &analyse<visualmesh::model::XYGrid4>},
+  {"xygrid6", "XY Grid 6", &analyse<visualmesh::model::XYGrid6>},
+  {"xygrid8", "XY Grid 8", &analyse<visualmesh::model::XYGrid8>},
+  {"nmgrid4", "NM Grid 4", &analyse<visualmesh::model::NMGrid4>},
+  {"nmgrid6", "NM Grid 6", &analyse<visualmesh::model::NMGrid6>},
+  {"nmgrid8", "NM Grid 8", &analyse<visualmesh::model::NMGrid8>},
+}};
+
+std::vector<std::string> split(const std::string& s, const char& delimiter) {
+    std::vector<std::string> parts;
+    std::stringstream stream(s);
+    for (std::string part; std::getline(stream, part, delimiter);) {
+        parts.push_back(part);
     }
+    return parts;
+}
 
-    {
-        std::cout << "Ring 6 Quality:" << std::endl;
-        visualmesh::Mesh<double, visualmesh::model::Ring6> mesh(shape, h, k, max_distance);
-        auto quality = check_quality(shape, mesh);
-        print_quality(quality, k);
-        std::cout << std::endl;
+/**
+ * @brief Parse a sweep of values from a command line argument
+ *
+ * @param arg either a single value, a comma separated list of values, or an inclusive range as start:stop:step
+ *
+ * @return the values to sweep over
+ */
+std::vector<double> parse_values(const std::string& arg) {
+    const auto range = split(arg, ':');
+    if (range.size() == 3) {
+        const double start = std::stod(range[0]);
+        const double stop  = std::stod(range[1]);
+        const double step  = std::stod(range[2]);
+        if (!(step > 0) || stop < start) { throw std::invalid_argument("Invalid range " + arg); }
+
+        // Allow a little slack so rounding in the step does not drop the last value
+        std::vector<double> values;
+        const int n = int(std::floor((stop - start) / step + 1e-9)) + 1;
+        for (int i = 0; i < n; ++i) {
+            values.push_back(start + i * step);
+        }
+        return values;
     }
 
-    {
-        std::cout << "Ring 8 Quality:" << std::endl;
-        visualmesh::Mesh<double, visualmesh::model::Ring8> mesh(shape, h, k, max_distance);
-        auto quality = check_quality(shape, mesh);
-        print_quality(quality, k);
-        std::cout << std::endl;
+    std::vector<double> values;
+    for (const auto& v : split(arg, ',')) {
+        values.push_back(std::stod(v));
     }
+    return values;
+}
 
-    {
-        std::cout << "XM Grid 4 Quality:" << std::endl;
-        visualmesh::Mesh<double, visualmesh::model::XMGrid4> mesh(shape, h, k, max_distance);
-        auto quality = check_quality(shape, mesh);
-        print_quality(quality, k);
-        std::cout << std::endl;
+std::vector<int> parse_models(const std::string& arg) {
+    std::vector<int> selected;
+    if (arg == "all") {
+        for (int i = 0; i < int(models.size()); ++i) {
+            selected.push_back(i);
+        }
+        return selected;
     }
 
-    {
-        std::cout << "XM Grid 6 Quality:" << std::endl;
-        visualmesh::Mesh<double, visualmesh::model::XMGrid6> mesh(shape, h, k, max_distance);
-        auto quality = check_quality(shape, mesh);
-        print_quality(quality, k);
-        std::cout << std::endl;
+    for (const auto& name : split(arg, ',')) {
+        auto it = std::find_if(models.begin(), models.end(), [&](const ModelEntry& m) { return name == m.name; });
+        if (it == models.end()) { throw std::invalid_argument("Unknown model " + name); }
+        selected.push_back(int(std::distance(models.begin(), it)));
     }
+    return selected;
+}
 
-    {
-        std::cout << "XM Grid 8 Quality:" << std::endl;
-        visualmesh::Mesh<double, visualmesh::model::XMGrid8> mesh(shape, h, k, max_distance);
-        auto quality = check_quality(shape, mesh);
-        print_quality(quality, k);
+void print_text(const std::vector<Summary>& summaries) {
+    std::cout << std::setprecision(4);
+    for (const auto& s : summaries) {
+        std::cout << models[s.job.model].title << " Quality (h " << s.job.h << ", r " << s.job.r << ", k " << s.job.k
+                  << "):" << std::endl;
+        std::cout << "Covered with " << s.nodes << " nodes in " << s.seconds << "s" << std::endl;
+        for (std::size_t i = 0; i < s.radial.slots.size(); ++i) {
+            const auto& r = s.radial.slots[i];
+            const auto& c = s.cyclical.slots[i];
+            const auto& a = s.angular.slots[i];
+            std::cout << "* " << r.mean << "±" << r.stddev();
+            std::cout << " o " << c.mean << "±" << c.stddev();
+            std::cout << " a " << a.mean << "±" << a.stddev();
+            std::cout << std::endl;
+        }
+        const auto r = s.radial.all();
+        std::cout << "Radial percentiles: 5% " << r.percentile(5) << " 50% " << r.percentile(50) << " 95% "
+                  << r.percentile(95) << std::endl;
+
+        std::cout << "Neighbour index distance (mean log2 " << s.locality_log2 << "):";
+        int limit = 8;
+        for (int b = 0; b < 4; ++b, limit *= 8) {
+            std::cout << " <=" << limit << " " << s.locality[b] << "%";
+        }
+        std::cout << " >" << (limit / 8) << " " << s.locality[4] << "%" << std::endl;
+
+        std::cout << "Compact nodes: " << s.compact_percent << "% of float nodes, " << s.far_percent
+                  << "% far neighbours, max ray error " << s.max_ray_error << " rad"
+                  << (s.neighbours_match ? "" : ", NEIGHBOURS DIFFER") << std::endl;
+        if (!s.views_match) { std::cout << "Multiple view lookup differs from single view lookups" << std::endl; }
+        std::cout << "Region lookups found points up to " << s.region_margin << " pixels outside their rectangle"
+                  << (s.regions_match ? "" : ", REGIONS DIFFER") << std::endl;
+        std::cout << "Cached lookups rebuilt " << s.walk_rebuilds << " times and found " << s.walk_extra
+                  << " extra points" << (s.walk_match ? "" : ", MISSED POINTS") << std::endl;
+        std::cout << "Clustered random scores into " << s.clusters << " clusters"
+                  << (s.clusters_match ? "" : ", CLUSTERS DIFFER") << std::endl;
         std::cout << std::endl;
     }
+}
 
-    {
-        std::cout << "XY Grid 4 Quality:" << std::endl;
-        visualmesh::Mesh<double, visualmesh::model::XYGrid4> mesh(shape, h, k, max_distance);
-        auto quality = check_quality(shape, mesh);
-        print_quality(quality, k);
-        std::cout << std::endl;
+void print_csv(const std::vector<Summary>& summaries) {
+    // One row for each measure of each neighbour slot, with the slot "all" holding every slot together
+    std::cout << std::setprecision(8);
+    std::cout << "model,h,r,k,max_distance,nodes,seconds,measure,slot,count,mean,stddev,p5,p50,p95,locality_log2,"
+                 "compact_percent,far_percent,max_ray_error"
+              << std::endl;
+    for (const auto& s : summaries) {
+        auto row = [&](const char* measure, const std::string& slot, const Statistics& st) {
+            std::cout << models[s.job.model].name << "," << s.job.h << "," << s.job.r << "," << s.job.k << ","
+                      << s.job.max_distance << "," << s.nodes << "," << s.seconds << "," << measure << "," << slot
+                      << "," << st.n << "," << st.mean << "," << st.stddev() << "," << st.percentile(5) << ","
+                      << st.percentile(50) << "," << st.percentile(95) << "," << s.locality_log2 << ","
+                      << s.compact_percent << "," << s.far_percent << "," << s.max_ray_error << std::endl;
+        };
+        auto rows = [&](const char* measure, const Measure& m) {
+            for (std::size_t i = 0; i < m.slots.size(); ++i) {
+                row(measure, std::to_string(i), m.slots[i]);
+            }
+            row(measure, "all", m.all());
+        };
+        rows("radial", s.radial);
+        rows("cyclical", s.cyclical);
+        rows("angular", s.angular);
     }
+}
 
-    {
-        std::cout << "XY Grid 6 Quality:" << std::endl;
-        visualmesh::Mesh<double, visualmesh::model::XYGrid6> mesh(shape, h, k, max_distance);
-        auto quality = check_quality(shape, mesh);
-        print_quality(quality, k);
-        std::cout << std::endl;
+void print_json(const std::vector<Summary>& summaries) {
+    auto statistics = [](const Statistics& st) {
+        std::stringstream out;
+        out << std::setprecision(8) << "{\"count\": " << st.n << ", \"mean\": " << st.mean
+            << ", \"stddev\": " << st.stddev() << ", \"p5\": " << st.percentile(5) << ", \"p50\": " << st.percentile(50)
+            << ", \"p95\": " << st.percentile(95) << "}";
+        return out.str();
+    };
+    auto measure = [&](const Measure& m) {
+        const auto all = m.all();
+        std::stringstream out;
+        out << "{\"all\": " << statistics(all) << ", \"slots\": [";
+        for (std::size_t i = 0; i < m.slots.size(); ++i) {
+            out << (i == 0 ? "" : ", ") << statistics(m.slots[i]);
+        }
+        out << "], \"histogram\": {\"max\": " << Statistics::HISTOGRAM_MAX << ", \"counts\": [";
+        for (std::size_t i = 0; i < all.bins.size(); ++i) {
+            out << (i == 0 ? "" : ", ") << all.bins[i];
+        }
+        out << "]}}";
+        return out.str();
+    };
+
+    std::cout << std::setprecision(8) << "[" << std::endl;
+    for (std::size_t i = 0; i < summaries.size(); ++i) {
+        const auto& s = summaries[i];
+        std::cout << "  {\"model\": \"" << models[s.job.model].name << "\", \"h\": " << s.job.h
+                  << ", \"r\": " << s.job.r << ", \"k\": " << s.job.k << ", \"max_distance\": " << s.job.max_distance
+                  << ", \"nodes\": " << s.nodes << ", \"seconds\": " << s.seconds << "," << std::endl;
+        std::cout << "   \"radial\": " << measure(s.radial) << "," << std::endl;
+        std::cout << "   \"cyclical\": " << measure(s.cyclical) << "," << std::endl;
+        std::cout << "   \"angular\": " << measure(s.angular) << "," << std::endl;
+        std::cout << "   \"locality\": {\"mean_log2\": " << s.locality_log2 << ", \"percent\": [";
+        for (std::size_t b = 0; b < s.locality.size(); ++b) {
+            std::cout << (b == 0 ? "" : ", ") << s.locality[b];
+        }
+        std::cout << "]}," << std::endl;
+        std::cout << "   \"compact\": {\"percent\": " << s.compact_percent << ", \"far_percent\": " << s.far_percent
+                  << ", \"max_ray_error\": " << s.max_ray_error
+                  << ", \"neighbours_match\": " << (s.neighbours_match ? "true" : "false") << "}," << std::endl;
+        std::cout << "   \"views_match\": " << (s.views_match ? "true" : "false") << "," << std::endl;
+        std::cout << "   \"regions\": {\"match\": " << (s.regions_match ? "true" : "false")
+                  << ", \"margin\": " << s.region_margin << "}," << std::endl;
+        std::cout << "   \"walk\": {\"match\": " << (s.walk_match ? "true" : "false")
+                  << ", \"rebuilds\": " << s.walk_rebuilds << ", \"extra\": " << s.walk_extra << "}," << std::endl;
+        std::cout << "   \"clusters\": {\"match\": " << (s.clusters_match ? "true" : "false")
+                  << ", \"count\": " << s.clusters << "}}"
+                  << (i + 1 < summaries.size() ? "," : "") << std::endl;
     }
+    std::cout << "]" << std::endl;
+}
 
-    {
-        std::cout << "XY Grid 8 Quality:" << std::endl;
-        visualmesh::Mesh<double, visualmesh::model::XYGrid8> mesh(shape, h, k, max_distance);
-        auto quality = check_quality(shape, mesh);
-        print_quality(quality, k);
-        std::cout << std::endl;
+// NOLINTNEXTLINE(bugprone-exception-escape) This is debugging code, I would prefer exceptions crash the program
+int main(int argc, const char* argv[]) {
+
+    // The heights, radii and k values can each be a single value, a list a,b,c or an inclusive range start:stop:step
+    const std::vector<double> heights = parse_values(argc > 1 ? argv[1] : "1");
+    const std::vector<double> radii   = parse_values(argc > 2 ? argv[2] : "0.0949996");
+    const std::vector<double> ks      = parse_values(argc > 3 ? argv[3] : "1");
+    const double max_distance         = argc > 4 ? std::stod(argv[4]) : 20;
+    const std::string format          = argc > 5 ? argv[5] : "text";
+    const std::vector<int> selected   = parse_models(argc > 6 ? argv[6] : "all");
+    const unsigned int threads        = argc > 7 ? std::stoi(argv[7]) : std::thread::hardware_concurrency();
+
+    if (format != "text" && format != "csv" && format != "json") {
+        throw std::invalid_argument("Unknown format " + format + ", expected text, csv or json");
     }
 
-    {
-        std::cout << "NM Grid 4 Quality:" << std::endl;
-        visualmesh::Mesh<double, visualmesh::model::NMGrid4> mesh(shape, h, k, max_distance);
-        auto quality = check_quality(shape, mesh);
-        print_quality(quality, k);
-        std::cout << std::endl;
+    std::vector<Job> jobs;
+    for (const auto& m : selected) {
+        for (const auto& h : heights) {
+            for (const auto& r : radii) {
+                for (const auto& k : ks) {
+                    jobs.push_back(Job{m, h, r, k, max_distance});
+                }
+            }
+        }
     }
 
-    {
-        std::cout << "NM Grid 6 Quality:" << std::endl;
-        visualmesh::Mesh<double, visualmesh::model::NMGrid6> mesh(shape, h, k, max_distance);
-        auto quality = check_quality(shape, mesh);
-        print_quality(quality, k);
-        std::cout << std::endl;
+    // The number of nodes grows with k and shrinks with r, so start the largest meshes first to avoid a long tail
+    std::vector<std::size_t> order(jobs.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](const std::size_t& a, const std::size_t& b) {
+        return jobs[a].k / jobs[a].r > jobs[b].k / jobs[b].r;
+    });
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<Summary> summaries(jobs.size());
+    visualmesh::ThreadPool pool(threads);
+    pool.parallel_for(order.size(), [&](const std::size_t& begin, const std::size_t& end) {
+        for (std::size_t i = begin; i < end; ++i) {
+            // Some parameters do not make a mesh at all, which should not stop the rest of the sweep
+            const auto& job = jobs[order[i]];
+            try {
+                summaries[order[i]] = models[job.model].analyse(job);
+            }
+            catch (const std::exception& e) {
+                summaries[order[i]].job   = job;
+                summaries[order[i]].error = e.what();
+            }
+        }
+    });
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Only the meshes that were built are reported, the others are listed separately
+    std::vector<Summary> built;
+    for (const auto& s : summaries) {
+        if (s.error.empty()) { built.push_back(s); }
+        else {
+            std::cerr << "Skipped " << models[s.job.model].name << " h " << s.job.h << " r " << s.job.r << " k "
+                      << s.job.k << ": " << s.error << std::endl;
+        }
     }
 
-    {
-        std::cout << "NM Grid 8 Quality:" << std::endl;
-        visualmesh::Mesh<double, visualmesh::model::NMGrid8> mesh(shape, h, k, max_distance);
-        auto quality = check_quality(shape, mesh);
-        print_quality(quality, k);
-        std::cout << std::endl;
+    if (format == "csv") { print_csv(built); }
+    else if (format == "json") {
+        print_json(built);
+    }
+    else {
+        print_text(built);
     }
+    std::cerr << "Analysed " << jobs.size() << " meshes in " << elapsed << "s on " << pool.size() << " threads"
+              << std::endl;
+
+    // A lookup or clustering that disagrees with its plain reference is a bug rather than a property of the mesh
+    const bool match = std::all_of(built.begin(), built.end(), [](const Summary& s) {
+        return s.views_match && s.regions_match && s.walk_match && s.clusters_match;
+    });
+    return match ? EXIT_SUCCESS : EXIT_FAILURE;
 }
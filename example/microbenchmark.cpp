@@ -0,0 +1,419 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "visualmesh/compiled_network.hpp"
+#include "visualmesh/engine/cpu/apply_activation.hpp"
+#include "visualmesh/engine/cpu/dense.hpp"
+#include "visualmesh/engine/cpu/engine.hpp"
+#include "visualmesh/engine/cpu/pixel.hpp"
+#include "visualmesh/engine/cuda/engine.hpp"
+#include "visualmesh/engine/opencl/engine.hpp"
+#include "visualmesh/engine/vulkan/engine.hpp"
+#include "visualmesh/geometry/Sphere.hpp"
+#include "visualmesh/lens.hpp"
+#include "visualmesh/mesh.hpp"
+#include "visualmesh/model/nmgrid4.hpp"
+#include "visualmesh/model/nmgrid6.hpp"
+#include "visualmesh/model/nmgrid8.hpp"
+#include "visualmesh/model/ring4.hpp"
+#include "visualmesh/model/ring6.hpp"
+#include "visualmesh/model/ring8.hpp"
+#include "visualmesh/model/xmgrid4.hpp"
+#include "visualmesh/model/xmgrid6.hpp"
+#include "visualmesh/model/xmgrid8.hpp"
+#include "visualmesh/model/xygrid4.hpp"
+#include "visualmesh/model/xygrid6.hpp"
+#include "visualmesh/model/xygrid8.hpp"
+#include "visualmesh/network_structure.hpp"
+#include "visualmesh/utility/fourcc.hpp"
+
+/*
+ * Microbenchmarks for each stage of the pipeline. Run with --benchmark_format=json (or --benchmark_out=<file>
+ * --benchmark_out_format=json) to get machine readable results, and --benchmark_filter=<regex> to select cases.
+ * Every case runs on a synthetic scene so the results don't depend on the example dataset or model.
+ */
+
+/// The camera height and ball radius used for every mesh
+constexpr double HEIGHT = 1.2;
+constexpr double RADIUS = 0.0949996;
+
+/// The image formats that the image interpolation is benchmarked with
+const std::array<uint32_t, 6> FORMATS = {{
+  visualmesh::fourcc("RGBA"),
+  visualmesh::fourcc("BGRA"),
+  visualmesh::fourcc("RGB3"),
+  visualmesh::fourcc("BGR3"),
+  visualmesh::fourcc("GRBG"),
+  visualmesh::fourcc("GREY"),
+}};
+
+/// The lens projections that the lookup is benchmarked with
+const std::array<visualmesh::LensProjection, 3> PROJECTIONS = {{
+  visualmesh::RECTILINEAR,
+  visualmesh::EQUISOLID,
+  visualmesh::EQUIDISTANT,
+}};
+
+template <typename Scalar>
+visualmesh::Lens<Scalar> make_lens(const visualmesh::LensProjection& projection) {
+    visualmesh::Lens<Scalar> lens{};
+    lens.projection   = projection;
+    lens.dimensions   = {{1280, 1024}};
+    lens.centre       = {{0, 0}};
+    lens.k            = {{0, 0}};
+    lens.focal_length = projection == visualmesh::RECTILINEAR ? 640 : 420;
+    lens.fov          = projection == visualmesh::RECTILINEAR ? 1.6 : 3.14;
+    return lens;
+}
+
+template <typename Scalar>
+visualmesh::mat4<Scalar> make_Hoc() {
+    // Pitched down towards the field so both the near and far parts of the mesh are on screen
+    const Scalar a = 0.6;
+    return {{
+      {{std::cos(a), 0, std::sin(a), 0}},
+      {{0, 1, 0, 0}},
+      {{-std::sin(a), 0, std::cos(a), Scalar(HEIGHT)}},
+      {{0, 0, 0, 1}},
+    }};
+}
+
+inline const std::vector<uint8_t>& image() {
+    static const std::vector<uint8_t> data = [] {
+        std::vector<uint8_t> pixels(1280 * 1024 * 4);
+        std::mt19937 rng(2);
+        std::uniform_int_distribution<int> dist(0, 255);
+        for (auto& p : pixels) {
+            p = dist(rng);
+        }
+        return pixels;
+    }();
+    return data;
+}
+
+/**
+ * @brief Build a network with random weights that has the same shape as example/model.yaml
+ */
+template <typename Scalar>
+visualmesh::NetworkStructure<Scalar> make_network(const int& n_neighbours) {
+    std::mt19937 rng(1);
+    std::normal_distribution<Scalar> dist(0, 0.3);
+
+    const std::vector<int> widths = {16, 16, 16, 16, 16, 16, 8, 8, 8, 8, 8, 8, 5};
+    visualmesh::NetworkStructure<Scalar> network;
+    int input = 4;
+    for (unsigned int i = 0; i < widths.size(); ++i) {
+        visualmesh::Layer<Scalar> layer;
+        layer.weights.assign(input * (n_neighbours + 1), std::vector<Scalar>(widths[i]));
+        for (auto& row : layer.weights) {
+            for (auto& w : row) {
+                w = dist(rng);
+            }
+        }
+        layer.biases.resize(widths[i]);
+        for (auto& b : layer.biases) {
+            b = dist(rng);
+        }
+        layer.activation = i + 1 == widths.size() ? visualmesh::SOFTMAX : visualmesh::SELU;
+        network.push_back({layer});
+        input = widths[i];
+    }
+    return network;
+}
+
+/**
+ * @brief The mesh for a model, built once and shared by every case that only uses it
+ */
+template <typename Scalar, template <typename> class Model>
+const visualmesh::Mesh<Scalar, Model>& mesh() {
+    static const visualmesh::geometry::Sphere<Scalar> sphere(RADIUS);
+    static const visualmesh::Mesh<Scalar, Model> m(sphere, HEIGHT, 6, 20);
+    return m;
+}
+
+template <typename Scalar, template <typename> class Model>
+void mesh_construction(benchmark::State& state) {
+    const visualmesh::geometry::Sphere<Scalar> sphere(RADIUS);
+    for (auto _ : state) {
+        visualmesh::Mesh<Scalar, Model> m(sphere, HEIGHT, 6, 20);
+        benchmark::DoNotOptimize(m.nodes.data());
+    }
+    state.counters["nodes"] = mesh<Scalar, Model>().nodes.size();
+}
+
+template <typename Scalar, template <typename> class Model>
+void lookup(benchmark::State& state) {
+    const auto& m    = mesh<Scalar, Model>();
+    const auto lens  = make_lens<Scalar>(PROJECTIONS[state.range(0)]);
+    const auto Hoc   = make_Hoc<Scalar>();
+    std::size_t size = 0;
+    for (auto _ : state) {
+        auto ranges = m.lookup(Hoc, lens);
+        benchmark::DoNotOptimize(ranges.data());
+        size = ranges.size();
+    }
+    state.counters["ranges"] = size;
+}
+
+template <typename Scalar, template <typename> class Model, typename Engine>
+void project(benchmark::State& state) {
+    const auto& m     = mesh<Scalar, Model>();
+    const auto lens   = make_lens<Scalar>(visualmesh::EQUISOLID);
+    const auto Hoc    = make_Hoc<Scalar>();
+    const Engine engine;
+    std::size_t n_points = 0;
+    for (auto _ : state) {
+        auto projected = engine(m, Hoc, lens);
+        benchmark::DoNotOptimize(projected.pixel_coordinates.data());
+        n_points = projected.global_indices.size();
+    }
+    state.counters["points"] = n_points;
+}
+
+template <typename Scalar>
+void interpolate(benchmark::State& state) {
+    const auto& m        = mesh<Scalar, visualmesh::model::Ring6>();
+    const auto lens      = make_lens<Scalar>(visualmesh::EQUISOLID);
+    const auto projected = visualmesh::engine::cpu::Engine<Scalar>()(m, make_Hoc<Scalar>(), lens);
+    const uint32_t format = FORMATS[state.range(0)];
+    const auto& pixels    = projected.pixel_coordinates;
+
+    std::vector<visualmesh::vec4<Scalar>> output(pixels.size());
+    for (auto _ : state) {
+        for (std::size_t i = 0; i < pixels.size(); ++i) {
+            output[i] = visualmesh::engine::cpu::interpolate(pixels[i], image().data(), lens.dimensions, format);
+        }
+        benchmark::DoNotOptimize(output.data());
+    }
+    state.SetItemsProcessed(state.iterations() * pixels.size());
+    state.SetLabel(visualmesh::fourcc_text(format));
+}
+
+/**
+ * @brief Run a single convolutional group of the network on one thread, the same way that the CPU engine does
+ */
+template <typename Scalar>
+void conv_group(benchmark::State& state) {
+    const auto& m        = mesh<Scalar, visualmesh::model::Ring6>();
+    const auto lens      = make_lens<Scalar>(visualmesh::EQUISOLID);
+    const auto projected = visualmesh::engine::cpu::Engine<Scalar>()(m, make_Hoc<Scalar>(), lens);
+    const auto& graph    = projected.neighbourhood;
+    const std::size_t n_points = graph.size();
+
+    const visualmesh::CompiledNetwork<Scalar> network(make_network<Scalar>(6),
+                                                      visualmesh::engine::cpu::dense_block<Scalar>());
+    const unsigned int group = state.range(0);
+
+    // The values don't change how long the layers take, so the input doesn't need to come from the earlier groups
+    const int input_dimensions = group == 0 ? 4 : network.back(group - 1).output_dimensions;
+    std::vector<Scalar> input(n_points * input_dimensions, Scalar(0.5));
+    std::vector<Scalar> a(n_points * network.max_width());
+    std::vector<Scalar> b(n_points * network.max_width());
+
+    for (auto _ : state) {
+        for (unsigned int layer_no = 0; layer_no < network.size(group); ++layer_no) {
+            const auto layer = network.layer(group, layer_no);
+            if (layer_no == 0) {
+                visualmesh::engine::cpu::dense_gather(
+                  layer, input.data(), input_dimensions, graph, a.data(), 0, n_points);
+            }
+            else {
+                visualmesh::engine::cpu::dense(layer, a.data(), b.data(), n_points);
+                std::swap(a, b);
+            }
+        }
+        benchmark::DoNotOptimize(a.data());
+    }
+    state.SetItemsProcessed(state.iterations() * n_points);
+}
+
+/**
+ * @brief Apply an activation function to a buffer of values, either exactly or with the fast approximations
+ *
+ * @details
+ *  The inputs are spread evenly over [state.range(0), state.range(1)]. Besides the throughput the largest absolute
+ *  and relative errors against the exact function are reported, which are zero for the exact case.
+ */
+template <typename Scalar, template <typename, bool> class Fn, bool Approximate>
+void activate(benchmark::State& state) {
+    std::vector<Scalar> input(1 << 16);
+    for (std::size_t i = 0; i < input.size(); ++i) {
+        input[i] = Scalar(state.range(0)) + Scalar(state.range(1) - state.range(0)) * Scalar(i) / input.size();
+    }
+    std::vector<Scalar> output(input.size());
+
+    for (auto _ : state) {
+        std::transform(input.begin(), input.end(), output.begin(), Fn<Scalar, Approximate>());
+        benchmark::DoNotOptimize(output.data());
+    }
+
+    const Fn<Scalar, false> exact;
+    double max_absolute = 0.0;
+    double max_relative = 0.0;
+    for (std::size_t i = 0; i < input.size(); ++i) {
+        const double reference = exact(input[i]);
+        const double error     = std::abs(double(output[i]) - reference);
+        max_absolute           = std::max(max_absolute, error);
+        if (reference != 0.0) { max_relative = std::max(max_relative, error / std::abs(reference)); }
+    }
+    state.counters["max_abs_error"] = max_absolute;
+    state.counters["max_rel_error"] = max_relative;
+    state.SetItemsProcessed(state.iterations() * input.size());
+}
+
+template <typename Scalar, template <typename> class Model, typename Engine>
+void classify(benchmark::State& state) {
+    const auto& m   = mesh<Scalar, Model>();
+    const auto lens = make_lens<Scalar>(visualmesh::EQUISOLID);
+    const auto Hoc  = make_Hoc<Scalar>();
+    const Engine engine(make_network<Scalar>(Model<Scalar>::N_NEIGHBOURS));
+    for (auto _ : state) {
+        auto classified = engine(m, Hoc, lens, image().data(), visualmesh::fourcc("RGBA"));
+        benchmark::DoNotOptimize(classified.classifications.data());
+    }
+}
+
+#if !defined(VISUALMESH_DISABLE_OPENCL)
+/**
+ * @brief Read a classification sized buffer back from the default OpenCL device
+ */
+template <typename Scalar>
+void readback(benchmark::State& state) {
+    namespace opencl = visualmesh::engine::opencl;
+    opencl::cl::context context;
+    cl_device_id device       = nullptr;
+    std::tie(context, device) = opencl::operation::make_context();
+    const opencl::cl::command_queue queue = opencl::operation::make_queue(context, device);
+
+    // As many values as the output of the network for a frame of this scene
+    const std::size_t size = state.range(0) * 5 * sizeof(Scalar);
+    cl_int error           = CL_SUCCESS;
+    const opencl::cl::mem buffer(::clCreateBuffer(context, CL_MEM_READ_WRITE, size, nullptr, &error),
+                                 ::clReleaseMemObject);
+    opencl::throw_cl_error(error, "Error allocating the readback buffer");
+
+    std::vector<uint8_t> host(size);
+    for (auto _ : state) {
+        opencl::throw_cl_error(
+          ::clEnqueueReadBuffer(queue, buffer, true, 0, size, host.data(), 0, nullptr, nullptr),
+          "Error reading back the buffer");
+    }
+    state.SetBytesProcessed(state.iterations() * size);
+}
+#endif  // !defined(VISUALMESH_DISABLE_OPENCL)
+
+template <typename Scalar, template <typename> class Model, typename Engine>
+void register_engine(const std::string& name) {
+    benchmark::RegisterBenchmark(("Project/" + name).c_str(), project<Scalar, Model, Engine>)
+      ->Unit(benchmark::kMicrosecond);
+    benchmark::RegisterBenchmark(("Classify/" + name).c_str(), classify<Scalar, Model, Engine>)
+      ->Unit(benchmark::kMillisecond);
+}
+
+template <typename Scalar, template <typename> class Model>
+void register_model(const std::string& scalar, const std::string& model) {
+    const std::string name = scalar + "/" + model;
+
+    benchmark::RegisterBenchmark(("Mesh/" + name).c_str(), mesh_construction<Scalar, Model>)
+      ->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark(("Lookup/" + name).c_str(), lookup<Scalar, Model>)
+      ->DenseRange(0, PROJECTIONS.size() - 1)
+      ->Unit(benchmark::kMicrosecond);
+
+    register_engine<Scalar, Model, visualmesh::engine::cpu::Engine<Scalar>>(name + "/cpu");
+#if !defined(VISUALMESH_DISABLE_OPENCL)
+    register_engine<Scalar, Model, visualmesh::engine::opencl::Engine<Scalar>>(name + "/opencl");
+#endif  // !defined(VISUALMESH_DISABLE_OPENCL)
+#if !defined(VISUALMESH_DISABLE_VULKAN)
+    register_engine<Scalar, Model, visualmesh::engine::vulkan::Engine<Scalar>>(name + "/vulkan");
+#endif  // !defined(VISUALMESH_DISABLE_VULKAN)
+#if !defined(VISUALMESH_DISABLE_CUDA)
+    register_engine<Scalar, Model, visualmesh::engine::cuda::Engine<Scalar>>(name + "/cuda");
+#endif  // !defined(VISUALMESH_DISABLE_CUDA)
+}
+
+template <typename Scalar, template <typename, bool> class Fn>
+void register_activation(const std::string& name, const int& low, const int& high) {
+    benchmark::RegisterBenchmark((name + "/exact").c_str(), activate<Scalar, Fn, false>)
+      ->Args({low, high})
+      ->Unit(benchmark::kMicrosecond);
+    benchmark::RegisterBenchmark((name + "/approximate").c_str(), activate<Scalar, Fn, true>)
+      ->Args({low, high})
+      ->Unit(benchmark::kMicrosecond);
+}
+
+template <typename Scalar>
+void register_scalar(const std::string& scalar) {
+    register_model<Scalar, visualmesh::model::Ring4>(scalar, "Ring4");
+    register_model<Scalar, visualmesh::model::Ring6>(scalar, "Ring6");
+    register_model<Scalar, visualmesh::model::Ring8>(scalar, "Ring8");
+    register_model<Scalar, visualmesh::model::XYGrid4>(scalar, "XYGrid4");
+    register_model<Scalar, visualmesh::model::XYGrid6>(scalar, "XYGrid6");
+    register_model<Scalar, visualmesh::model::XYGrid8>(scalar, "XYGrid8");
+    register_model<Scalar, visualmesh::model::NMGrid4>(scalar, "NMGrid4");
+    register_model<Scalar, visualmesh::model::NMGrid6>(scalar, "NMGrid6");
+    register_model<Scalar, visualmesh::model::NMGrid8>(scalar, "NMGrid8");
+    register_model<Scalar, visualmesh::model::XMGrid4>(scalar, "XMGrid4");
+    register_model<Scalar, visualmesh::model::XMGrid6>(scalar, "XMGrid6");
+    register_model<Scalar, visualmesh::model::XMGrid8>(scalar, "XMGrid8");
+
+    benchmark::RegisterBenchmark(("Interpolate/" + scalar).c_str(), interpolate<Scalar>)
+      ->DenseRange(0, FORMATS.size() - 1)
+      ->Unit(benchmark::kMicrosecond);
+    benchmark::RegisterBenchmark(("ConvGroup/" + scalar).c_str(), conv_group<Scalar>)
+      ->DenseRange(0, make_network<Scalar>(6).size() - 1)
+      ->Unit(benchmark::kMicrosecond);
+
+    // The softmax exponential is checked over the whole range the approximation is clamped to
+    using namespace visualmesh::engine::cpu;
+    register_activation<Scalar, activation::Selu>("Activation/" + scalar + "/selu", -16, 16);
+    register_activation<Scalar, activation::Tanh>("Activation/" + scalar + "/tanh", -16, 16);
+    register_activation<Scalar, activation::Exp>("Activation/" + scalar + "/exp", -87, 88);
+
+#if !defined(VISUALMESH_DISABLE_OPENCL)
+    const std::size_t n_points = visualmesh::engine::cpu::Engine<Scalar>()(mesh<Scalar, visualmesh::model::Ring6>(),
+                                                                           make_Hoc<Scalar>(),
+                                                                           make_lens<Scalar>(visualmesh::EQUISOLID))
+                                   .global_indices.size();
+    benchmark::RegisterBenchmark(("Readback/" + scalar).c_str(), readback<Scalar>)
+      ->Arg(n_points)
+      ->Unit(benchmark::kMicrosecond);
+#endif  // !defined(VISUALMESH_DISABLE_OPENCL)
+}
+
+int main(int argc, char** argv) {
+    register_scalar<float>("float");
+    register_scalar<double>("double");
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) { return 1; }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "dataset.hpp"
+#include "load_model.hpp"
+#include "visualmesh/engine/cpu/engine.hpp"
+#include "visualmesh/engine/opencl/engine.hpp"
+#include "visualmesh/engine/vulkan/engine.hpp"
+#include "visualmesh/geometry/Sphere.hpp"
+#include "visualmesh/model/ring6.hpp"
+#include "visualmesh/quantisation.hpp"
+#include "visualmesh/utility/fourcc.hpp"
+#include "visualmesh/visualmesh.hpp"
+
+using Scalar = float;
+
+template <typename Engine, typename Mesh, typename Reference>
+void report(const std::string& name,
+            Engine& engine,
+            const Mesh& mesh,
+            const std::vector<dataset_element<Scalar>>& dataset,
+            const Reference& reference) {
+    visualmesh::ClassificationDrift<Scalar> worst;
+    double mean      = 0.0;
+    double agreement = 0.0;
+    for (std::size_t i = 0; i < dataset.size(); ++i) {
+        const auto& element = dataset[i];
+        auto classified = engine(mesh, element.Hoc, element.lens, element.image.data, visualmesh::fourcc("BGRA"));
+        auto drift      = visualmesh::drift(reference[i], classified);
+        worst.max_error = std::max(worst.max_error, drift.max_error);
+        mean += drift.mean_error;
+        agreement += drift.agreement;
+    }
+    std::cout << name << ": max error " << worst.max_error << ", mean error " << mean / dataset.size()
+              << ", argmax agreement " << 100.0 * agreement / dataset.size() << "%" << std::endl;
+}
+
+// NOLINTNEXTLINE(bugprone-exception-escape) This is debugging code, I would prefer exceptions crash the program
+int main() {
+    std::string image_path = "../example/images";
+    std::string model_path = "../example/model.yaml";
+
+    // Load the classification network, mesh and the dataset that we calibrate over
+    visualmesh::CompiledNetwork<Scalar> network = load_model<Scalar>(model_path);
+    visualmesh::geometry::Sphere<Scalar> sphere(0.0949996);
+    visualmesh::VisualMesh<Scalar, visualmesh::model::Ring6> mesh(sphere, 0.5, 1.5, 6, 0.5, 20);
+    auto dataset = load_dataset<Scalar>(image_path);
+
+    // Run the full precision network over the dataset to find the range of each layer's input
+    visualmesh::engine::cpu::Engine<Scalar> cpu_engine(network);
+    visualmesh::Calibration<Scalar> calibration;
+    std::vector<visualmesh::ClassifiedMesh<Scalar, visualmesh::model::Ring6<Scalar>::N_NEIGHBOURS>> reference;
+    for (const auto& element : dataset) {
+        reference.push_back(cpu_engine.calibrate(
+          calibration, mesh, element.Hoc, element.lens, element.image.data, visualmesh::fourcc("BGRA")));
+    }
+    visualmesh::QuantisedNetwork<Scalar> quantised(network, calibration);
+
+    // Compare each of the reduced precision engines against the full precision classifications
+    cpu_engine.quantise(calibration);
+    report("CPU INT8", cpu_engine, mesh, dataset, reference);
+
+#if !defined(VISUALMESH_DISABLE_OPENCL)
+    visualmesh::engine::opencl::Engine<Scalar> cl_half(network, visualmesh::Precision::HALF);
+    report("OpenCL HALF", cl_half, mesh, dataset, reference);
+    visualmesh::engine::opencl::Engine<Scalar> cl_int8(quantised);
+    report("OpenCL INT8", cl_int8, mesh, dataset, reference);
+#endif  // !defined(VISUALMESH_DISABLE_OPENCL)
+
+#if !defined(VISUALMESH_DISABLE_VULKAN)
+    visualmesh::engine::vulkan::Engine<Scalar> vk_int8(quantised);
+    report("Vulkan INT8", vk_int8, mesh, dataset, reference);
+#endif  // !defined(VISUALMESH_DISABLE_VULKAN)
+}
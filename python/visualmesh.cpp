@@ -0,0 +1,442 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <nanobind/nanobind.h>
+#include <nanobind/ndarray.h>
+#include <nanobind/stl/array.h>
+#include <nanobind/stl/string.h>
+
+#include <array>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "visualmesh/classified_mesh.hpp"
+#include "visualmesh/engine/cpu/engine.hpp"
+#include "visualmesh/geometry/Circle.hpp"
+#include "visualmesh/geometry/Sphere.hpp"
+#include "visualmesh/lens.hpp"
+#include "visualmesh/model/nmgrid4.hpp"
+#include "visualmesh/model/nmgrid6.hpp"
+#include "visualmesh/model/nmgrid8.hpp"
+#include "visualmesh/model/ring4.hpp"
+#include "visualmesh/model/ring6.hpp"
+#include "visualmesh/model/ring8.hpp"
+#include "visualmesh/model/xmgrid4.hpp"
+#include "visualmesh/model/xmgrid6.hpp"
+#include "visualmesh/model/xmgrid8.hpp"
+#include "visualmesh/model/xygrid4.hpp"
+#include "visualmesh/model/xygrid6.hpp"
+#include "visualmesh/model/xygrid8.hpp"
+#include "visualmesh/network_file.hpp"
+#include "visualmesh/projected_mesh.hpp"
+#include "visualmesh/utility/fourcc.hpp"
+#include "visualmesh/utility/math.hpp"
+#include "visualmesh/visualmesh.hpp"
+#if !defined(VISUALMESH_DISABLE_OPENCL)
+#include "visualmesh/engine/opencl/engine.hpp"
+#endif  // !defined(VISUALMESH_DISABLE_OPENCL)
+#if !defined(VISUALMESH_DISABLE_VULKAN)
+#include "visualmesh/engine/vulkan/engine.hpp"
+#endif  // !defined(VISUALMESH_DISABLE_VULKAN)
+
+namespace nb = nanobind;
+using namespace nb::literals;  // NOLINT(google-build-using-namespace) The argument literals are needed everywhere
+
+namespace {
+
+/// The engines are used at float precision from python, the same as the exported networks
+using Scalar = float;
+
+/// An image in host memory from any object that supports DLPack or the buffer protocol, it is never copied
+using Image = nb::ndarray<const uint8_t, nb::c_contig, nb::device::cpu>;
+/// A homogeneous transform from the observation plane to the camera
+using Transform = nb::ndarray<const Scalar, nb::shape<4, 4>, nb::c_contig, nb::device::cpu>;
+
+visualmesh::mat4<Scalar> to_mat4(const Transform& Hoc) {
+    visualmesh::mat4<Scalar> out{};
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            out[i][j] = Hoc.data()[i * 4 + j];
+        }
+    }
+    return out;
+}
+
+uint32_t to_fourcc(const std::string& format) {
+    if (format.size() != 4) { throw std::invalid_argument("The image format must be a four character code"); }
+    return uint32_t(format[0] | (format[1] << 8) | (format[2] << 16) | (format[3] << 24));
+}
+
+/**
+ * @brief The number of bytes an image of a format must have, so a short buffer is rejected rather than read past
+ *
+ * @param format     the pixel format of the image as a fourcc code
+ * @param dimensions the width and height of the image in pixels
+ *
+ * @return the number of bytes in the image
+ */
+std::size_t image_bytes(const uint32_t& format, const std::array<int, 2>& dimensions) {
+    using visualmesh::fourcc;
+    const std::size_t pixels = std::size_t(dimensions[0]) * std::size_t(dimensions[1]);
+    switch (format) {
+        case fourcc("GRBG"):
+        case fourcc("RGGB"):
+        case fourcc("GBRG"):
+        case fourcc("BGGR"):
+        case fourcc("GRAY"):
+        case fourcc("GREY"):
+        case fourcc("Y8  "): return pixels;
+        case fourcc("NV12"): return pixels + pixels / 2;
+        case fourcc("YUYV"):
+        case fourcc("YUY2"):
+        case fourcc("UYVY"): return pixels * 2;
+        case fourcc("BGR3"):
+        case fourcc("BGR8"):
+        case fourcc("RGB3"):
+        case fourcc("RGB8"): return pixels * 3;
+        case fourcc("BGRA"):
+        case fourcc("RGBA"): return pixels * 4;
+        default: throw std::invalid_argument("Unsupported image format " + visualmesh::fourcc_text(format));
+    }
+}
+
+/// Wrap memory that is kept alive by owner in a numpy array without copying it
+template <typename T>
+nb::object view(T* data, std::initializer_list<std::size_t> shape, const nb::capsule& owner) {
+    return nb::cast(nb::ndarray<nb::numpy, T>(data, shape, owner));
+}
+
+template <int N_NEIGHBOURS>
+void add_classifications(const visualmesh::ProjectedMesh<Scalar, N_NEIGHBOURS>& /*projected*/,
+                         nb::dict& /*out*/,
+                         const nb::capsule& /*owner*/) {}
+
+template <int N_NEIGHBOURS>
+void add_classifications(visualmesh::ClassifiedMesh<Scalar, N_NEIGHBOURS>& classified,
+                         nb::dict& out,
+                         const nb::capsule& owner) {
+    // There is a row for each point and one more for the off screen point
+    const std::size_t rows    = classified.neighbourhood.size();
+    const std::size_t classes = rows == 0 ? 0 : classified.classifications.size() / rows;
+    out["classifications"]    = view(classified.classifications.data(), {rows, classes}, owner);
+}
+
+/**
+ * @brief Hand the result of an engine to python as numpy arrays that view its vectors
+ *
+ * @details
+ *  The result is moved onto the heap and owned by a capsule that every array holds a reference to, so none of the
+ *  vectors are copied and they are freed once the last of the arrays is.
+ *
+ * @tparam Result       either ProjectedMesh or ClassifiedMesh
+ * @tparam N_NEIGHBOURS the number of neighbours each point has
+ *
+ * @param result the output of the engine
+ *
+ * @return a dictionary from the name of each field of the result to an array that views it
+ */
+template <template <typename, int> class Result, int N_NEIGHBOURS>
+nb::dict to_python(Result<Scalar, N_NEIGHBOURS>&& result) {
+    auto* owned = new Result<Scalar, N_NEIGHBOURS>(std::move(result));
+    nb::capsule owner(owned, [](void* p) noexcept { delete static_cast<Result<Scalar, N_NEIGHBOURS>*>(p); });
+
+    nb::dict out;
+    out["pixel_coordinates"] = view(
+      reinterpret_cast<Scalar*>(owned->pixel_coordinates.data()), {owned->pixel_coordinates.size(), 2}, owner);
+    out["neighbourhood"] = view(reinterpret_cast<int*>(owned->neighbourhood.data()),
+                                {owned->neighbourhood.size(), std::size_t(N_NEIGHBOURS)},
+                                owner);
+    out["global_indices"] = view(owned->global_indices.data(), {owned->global_indices.size()}, owner);
+    add_classifications(*owned, out, owner);
+    return out;
+}
+
+/// Lets a generic lambda name the VisualMesh type of the model that was chosen at runtime
+template <template <typename> class Model>
+struct ModelTag {
+    using Mesh = visualmesh::VisualMesh<Scalar, Model>;
+};
+
+/**
+ * @brief Call a function with the tag of a mesh model given by its name, using the same names as the TensorFlow op
+ *
+ * @param model the name of the mesh model, e.g. RING6
+ * @param fn    the function to call with a ModelTag for the model
+ *
+ * @return whatever the function returns
+ */
+template <typename Func>
+auto visit_model(const std::string& model, Func&& fn) {
+    // clang-format off
+    using namespace visualmesh::model; // NOLINT(google-build-using-namespace) function scope is fine
+    if (model == "RING4") { return fn(ModelTag<Ring4>()); }
+    if (model == "RING6") { return fn(ModelTag<Ring6>()); }
+    if (model == "RING8") { return fn(ModelTag<Ring8>()); }
+    if (model == "NMGRID4") { return fn(ModelTag<NMGrid4>()); }
+    if (model == "NMGRID6") { return fn(ModelTag<NMGrid6>()); }
+    if (model == "NMGRID8") { return fn(ModelTag<NMGrid8>()); }
+    if (model == "XMGRID4") { return fn(ModelTag<XMGrid4>()); }
+    if (model == "XMGRID6") { return fn(ModelTag<XMGrid6>()); }
+    if (model == "XMGRID8") { return fn(ModelTag<XMGrid8>()); }
+    if (model == "XYGRID4") { return fn(ModelTag<XYGrid4>()); }
+    if (model == "XYGRID6") { return fn(ModelTag<XYGrid6>()); }
+    if (model == "XYGRID8") { return fn(ModelTag<XYGrid8>()); }
+    // clang-format on
+    throw std::invalid_argument("The provided Visual Mesh model was not one of the known models");
+}
+
+/// A Visual Mesh of a model that was chosen at runtime
+struct AnyVisualMesh {
+    /// The name of the mesh model
+    std::string model;
+    /// The VisualMesh of that model
+    std::shared_ptr<const void> mesh;
+
+    /// Call a function with the VisualMesh as its real type
+    template <typename Func>
+    auto visit(Func&& fn) const {
+        return visit_model(model, [&](auto tag) {
+            using Mesh = typename decltype(tag)::Mesh;
+            return fn(*static_cast<const Mesh*>(mesh.get()));
+        });
+    }
+};
+
+AnyVisualMesh make_mesh(const std::string& model,
+                        const std::string& geometry,
+                        const Scalar& radius,
+                        const Scalar& min_height,
+                        const Scalar& max_height,
+                        const Scalar& k,
+                        const Scalar& max_error,
+                        const Scalar& max_distance,
+                        const unsigned int& concurrency) {
+    nb::gil_scoped_release release;
+    return visit_model(model, [&](auto tag) {
+        using Mesh = typename decltype(tag)::Mesh;
+        auto build = [&](const auto& shape) {
+            return AnyVisualMesh{model,
+                                 std::make_shared<const Mesh>(
+                                   shape, min_height, max_height, k, max_error, max_distance, concurrency)};
+        };
+        if (geometry == "SPHERE") { return build(visualmesh::geometry::Sphere<Scalar>(radius)); }
+        if (geometry == "CIRCLE") { return build(visualmesh::geometry::Circle<Scalar>(radius)); }
+        throw std::invalid_argument("Geometry must be one of SPHERE or CIRCLE");
+    });
+}
+
+/**
+ * @brief Add the projection and classification methods that every engine has
+ *
+ * @details
+ *  The GIL is released while the engine runs so several python threads can share an engine the same way C++ threads
+ *  do, and the image is read in place from the memory of the array that was passed in.
+ *
+ * @tparam Engine the type of the engine
+ *
+ * @param engine the python class of the engine
+ */
+template <typename Engine>
+void bind_engine(nb::class_<Engine>& engine) {
+    engine.def(
+      "project",
+      [](const Engine& e, const AnyVisualMesh& mesh, const Transform& Hoc, const visualmesh::Lens<Scalar>& lens) {
+          const auto hoc = to_mat4(Hoc);
+          return mesh.visit([&](const auto& m) {
+              auto projected = [&] {
+                  nb::gil_scoped_release release;
+                  return e(m.height(hoc[2][3]), hoc, lens);
+              }();
+              return to_python(std::move(projected));
+          });
+      },
+      "mesh"_a,
+      "Hoc"_a,
+      "lens"_a,
+      "Project the on screen points of the mesh to pixel coordinates");
+
+    engine.def(
+      "__call__",
+      [](const Engine& e,
+         const AnyVisualMesh& mesh,
+         const Transform& Hoc,
+         const visualmesh::Lens<Scalar>& lens,
+         const Image& image,
+         const std::string& format) {
+          const uint32_t code = to_fourcc(format);
+          if (image.nbytes() < image_bytes(code, lens.dimensions)) {
+              throw std::invalid_argument("The image is smaller than a " + format + " image of the lens dimensions");
+          }
+
+          const auto hoc = to_mat4(Hoc);
+          return mesh.visit([&](const auto& m) {
+              auto classified = [&] {
+                  nb::gil_scoped_release release;
+                  return e(m.height(hoc[2][3]), hoc, lens, image.data(), code);
+              }();
+              return to_python(std::move(classified));
+          });
+      },
+      "mesh"_a,
+      "Hoc"_a,
+      "lens"_a,
+      "image"_a.noconvert(),
+      "format"_a,
+      "Project and classify the mesh using the image, which is read without copying it");
+}
+
+}  // namespace
+
+NB_MODULE(visualmesh_engine, m) {
+    m.doc() = "The Visual Mesh and its inference engines";
+
+    nb::enum_<visualmesh::LensProjection>(m, "LensProjection")
+      .value("RECTILINEAR", visualmesh::RECTILINEAR)
+      .value("EQUISOLID", visualmesh::EQUISOLID)
+      .value("EQUIDISTANT", visualmesh::EQUIDISTANT);
+
+    nb::class_<visualmesh::Lens<Scalar>>(m, "Lens")
+      .def(
+        "__init__",
+        [](visualmesh::Lens<Scalar>* lens,
+           const std::array<int, 2>& dimensions,
+           const visualmesh::LensProjection& projection,
+           const Scalar& focal_length,
+           const std::array<Scalar, 2>& centre,
+           const std::array<Scalar, 2>& k,
+           const Scalar& fov) {
+            new (lens) visualmesh::Lens<Scalar>{dimensions, projection, focal_length, centre, k, fov};
+        },
+        "dimensions"_a,
+        "projection"_a,
+        "focal_length"_a,
+        "centre"_a,
+        "k"_a,
+        "fov"_a)
+      .def_rw("dimensions", &visualmesh::Lens<Scalar>::dimensions)
+      .def_rw("projection", &visualmesh::Lens<Scalar>::projection)
+      .def_rw("focal_length", &visualmesh::Lens<Scalar>::focal_length)
+      .def_rw("centre", &visualmesh::Lens<Scalar>::centre)
+      .def_rw("k", &visualmesh::Lens<Scalar>::k)
+      .def_rw("fov", &visualmesh::Lens<Scalar>::fov);
+
+    nb::class_<visualmesh::NetworkFile<Scalar>>(m, "Network")
+      .def_static("load", &visualmesh::NetworkFile<Scalar>::load, "path"_a, "Load a network exported as model.vmnn");
+
+    nb::class_<AnyVisualMesh>(m, "VisualMesh")
+      .def(
+        "__init__",
+        [](AnyVisualMesh* mesh,
+           const std::string& model,
+           const std::string& geometry,
+           const Scalar& radius,
+           const Scalar& min_height,
+           const Scalar& max_height,
+           const Scalar& k,
+           const Scalar& max_error,
+           const Scalar& max_distance,
+           const unsigned int& concurrency) {
+            new (mesh) AnyVisualMesh(
+              make_mesh(model, geometry, radius, min_height, max_height, k, max_error, max_distance, concurrency));
+        },
+        "model"_a,
+        "geometry"_a,
+        "radius"_a,
+        "min_height"_a,
+        "max_height"_a,
+        "k"_a,
+        "max_error"_a,
+        "max_distance"_a,
+        "concurrency"_a = std::thread::hardware_concurrency())
+      .def_static(
+        "load",
+        [](const std::string& model, const std::string& path) {
+            return visit_model(model, [&](auto tag) {
+                using Mesh = typename decltype(tag)::Mesh;
+                return AnyVisualMesh{model, std::make_shared<const Mesh>(Mesh::load(path))};
+            });
+        },
+        "model"_a,
+        "path"_a,
+        "Load a mesh of the given model that was written with save")
+      .def(
+        "save",
+        [](const AnyVisualMesh& mesh, const std::string& path) {
+            mesh.visit([&](const auto& m) { m.save(path); });
+        },
+        "path"_a)
+      .def_ro("model", &AnyVisualMesh::model)
+      .def(
+        "lookup",
+        [](const AnyVisualMesh& mesh, const Transform& Hoc, const visualmesh::Lens<Scalar>& lens) {
+            using Ranges   = std::vector<std::pair<int, int>>;
+            const auto hoc = to_mat4(Hoc);
+            auto* ranges =
+              new Ranges(mesh.visit([&](const auto& m) { return m.height(hoc[2][3]).lookup(hoc, lens); }));
+            nb::capsule owner(ranges, [](void* p) noexcept { delete static_cast<Ranges*>(p); });
+            return view(reinterpret_cast<int*>(ranges->data()), {ranges->size(), 2}, owner);
+        },
+        "Hoc"_a,
+        "lens"_a,
+        "Find the [start, end) index ranges of the points of the mesh that are on screen");
+
+    nb::class_<visualmesh::engine::cpu::Engine<Scalar>> cpu(m, "CPUEngine");
+    cpu.def(
+      "__init__",
+      [](visualmesh::engine::cpu::Engine<Scalar>* engine,
+         const visualmesh::NetworkFile<Scalar>& network,
+         const unsigned int& concurrency,
+         const bool& approximate) {
+          new (engine) visualmesh::engine::cpu::Engine<Scalar>(network.network, concurrency, approximate);
+      },
+      "network"_a,
+      "concurrency"_a = 1,
+      "approximate"_a = false);
+    bind_engine(cpu);
+
+#if !defined(VISUALMESH_DISABLE_OPENCL)
+    nb::class_<visualmesh::engine::opencl::Engine<Scalar>> opencl(m, "OpenCLEngine");
+    opencl.def(
+      "__init__",
+      [](visualmesh::engine::opencl::Engine<Scalar>* engine,
+         const visualmesh::NetworkFile<Scalar>& network,
+         const std::string& cache_directory) {
+          new (engine)
+            visualmesh::engine::opencl::Engine<Scalar>(network.network, visualmesh::Precision::FULL, cache_directory);
+      },
+      "network"_a,
+      "cache_directory"_a = "");
+    bind_engine(opencl);
+#endif  // !defined(VISUALMESH_DISABLE_OPENCL)
+
+#if !defined(VISUALMESH_DISABLE_VULKAN)
+    nb::class_<visualmesh::engine::vulkan::Engine<Scalar>> vulkan(m, "VulkanEngine");
+    vulkan.def(
+      "__init__",
+      [](visualmesh::engine::vulkan::Engine<Scalar>* engine, const visualmesh::NetworkFile<Scalar>& network) {
+          new (engine) visualmesh::engine::vulkan::Engine<Scalar>(network.network);
+      },
+      "network"_a);
+    bind_engine(vulkan);
+#endif  // !defined(VISUALMESH_DISABLE_VULKAN)
+}
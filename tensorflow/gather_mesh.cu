@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <climits>
+
+#include "gather_mesh.hpp"
+
+namespace {
+
+/**
+ * @brief Find the last range that starts at or before a value
+ *
+ * @param ranges   the start, end and packed offset of each range
+ * @param n_ranges the number of ranges
+ * @param value    the value to search for, either a mesh index or a packed index
+ * @param field    0 to search the starts of the ranges, 2 to search their packed offsets
+ *
+ * @return the index of the range, or -1 if the value is before every range
+ */
+__device__ int find_range(const int32_t* ranges, const int n_ranges, const int value, const int field) {
+    int lo = 0;
+    int hi = n_ranges;
+    while (lo < hi) {
+        const int mid = (lo + hi) / 2;
+        if (ranges[mid * 3 + field] <= value) { lo = mid + 1; }
+        else {
+            hi = mid;
+        }
+    }
+    return lo - 1;
+}
+
+template <typename T>
+__global__ void gather_mesh_kernel(const T* rays,
+                                   const int32_t* neighbours,
+                                   const int n_neighbours,
+                                   const int32_t* ranges,
+                                   const int n_ranges,
+                                   const int n_points,
+                                   T* vectors,
+                                   int32_t* graph) {
+    for (int idx = blockIdx.x * blockDim.x + threadIdx.x; idx < n_points; idx += blockDim.x * gridDim.x) {
+
+        // Find the point in the mesh from its packed index
+        const int r = find_range(ranges, n_ranges, idx, 2);
+        const int i = ranges[r * 3] + (idx - ranges[r * 3 + 2]);
+
+        // Copy across the ray
+        vectors[idx * 3 + 0] = rays[i * 3 + 0];
+        vectors[idx * 3 + 1] = rays[i * 3 + 1];
+        vectors[idx * 3 + 2] = rays[i * 3 + 2];
+
+        // Copy across the graph points in their new position, with points off the screen as the lowest int
+        int32_t* g = graph + idx * (n_neighbours + 1);
+        g[0]       = idx;
+        for (int j = 0; j < n_neighbours; ++j) {
+            const int n  = neighbours[i * n_neighbours + j];
+            const int nr = find_range(ranges, n_ranges, n, 0);
+            g[j + 1]     = nr >= 0 && n < ranges[nr * 3 + 1] ? ranges[nr * 3 + 2] + (n - ranges[nr * 3]) : INT_MIN;
+        }
+    }
+}
+
+}  // namespace
+
+template <typename T>
+cudaError_t gather_mesh(cudaStream_t stream,
+                        const T* rays,
+                        const int32_t* neighbours,
+                        int n_neighbours,
+                        const int32_t* ranges,
+                        int n_ranges,
+                        int n_points,
+                        T* vectors,
+                        int32_t* graph) {
+    if (n_points == 0) { return cudaSuccess; }
+    const int threads = 256;
+    const int blocks  = (n_points + threads - 1) / threads;
+    gather_mesh_kernel<T><<<blocks, threads, 0, stream>>>(
+      rays, neighbours, n_neighbours, ranges, n_ranges, n_points, vectors, graph);
+    return cudaGetLastError();
+}
+
+template cudaError_t gather_mesh<float>(cudaStream_t,
+                                        const float*,
+                                        const int32_t*,
+                                        int,
+                                        const int32_t*,
+                                        int,
+                                        int,
+                                        float*,
+                                        int32_t*);
+template cudaError_t gather_mesh<double>(cudaStream_t,
+                                         const double*,
+                                         const int32_t*,
+                                         int,
+                                         const int32_t*,
+                                         int,
+                                         int,
+                                         double*,
+                                         int32_t*);
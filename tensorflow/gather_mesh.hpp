@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_TENSORFLOW_GATHER_MESH_HPP
+#define VISUALMESH_TENSORFLOW_GATHER_MESH_HPP
+
+#if GOOGLE_CUDA
+
+#include <cuda_runtime.h>
+
+#include <cstdint>
+
+/**
+ * @brief Gather the rays and graph of the on screen points of a mesh that is already on the device
+ *
+ * @details
+ *  Only the ranges found by the lookup on the host are uploaded each step, the rays and neighbourhood of the mesh stay
+ *  on the device between steps. Each thread finds the range its point is in and the packed index of each of its
+ *  neighbours with a binary search over the ranges, so the output has the same layout as the CPU op.
+ *
+ * @tparam T the scalar type of the rays
+ *
+ * @param stream       the stream to run the kernel on
+ * @param rays         the unit vector of every point in the mesh as n x 3
+ * @param neighbours   the neighbours of every point in the mesh as n x n_neighbours
+ * @param n_neighbours the number of neighbours each point has
+ * @param ranges       the start, end and packed offset of each on screen range as n_ranges x 3
+ * @param n_ranges     the number of on screen ranges
+ * @param n_points     the number of on screen points
+ * @param vectors      the output rays of the on screen points as n_points x 3
+ * @param graph        the output graph of the on screen points as n_points x (n_neighbours + 1)
+ *
+ * @return the error from launching the kernel
+ */
+template <typename T>
+cudaError_t gather_mesh(cudaStream_t stream,
+                        const T* rays,
+                        const int32_t* neighbours,
+                        int n_neighbours,
+                        const int32_t* ranges,
+                        int n_ranges,
+                        int n_points,
+                        T* vectors,
+                        int32_t* graph);
+
+#endif  // GOOGLE_CUDA
+
+#endif  // VISUALMESH_TENSORFLOW_GATHER_MESH_HPP
@@ -0,0 +1,354 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#if GOOGLE_CUDA
+#define EIGEN_USE_GPU
+#endif  // GOOGLE_CUDA
+
+#include <tensorflow/core/framework/op.h>
+#include <tensorflow/core/framework/op_kernel.h>
+#include <tensorflow/core/framework/shape_inference.h>
+#include <tensorflow/core/util/work_sharder.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+#include "graph_convolution_kernels.hpp"
+
+enum Args {
+    FEATURES = 0,
+    GRAPH    = 1,
+    WEIGHTS  = 2,
+    GRAD     = 3,
+};
+
+enum Outputs {
+    OUTPUT        = 0,
+    FEATURES_GRAD = 0,
+    WEIGHTS_GRAD  = 1,
+};
+
+using CPUDevice = Eigen::ThreadPoolDevice;
+#if GOOGLE_CUDA
+using GPUDevice = Eigen::GpuDevice;
+#endif  // GOOGLE_CUDA
+
+// NOLINTNEXTLINE(cert-err58-cpp) this macro makes a static variable
+REGISTER_OP("GraphConvolutionVisualMesh")
+  .Attr("T: {float, double}")
+  .Input("features: T")
+  .Input("graph: int32")
+  .Input("weights: T")
+  .Output("output: T")
+  .SetShapeFn([](::tensorflow::shape_inference::InferenceContext* c) {
+      // One output row for each row of the graph with a column for each column of the weights
+      c->set_output(Outputs::OUTPUT, c->Matrix(c->Dim(c->input(Args::GRAPH), 0), c->Dim(c->input(Args::WEIGHTS), 1)));
+      return tensorflow::Status::OK();
+  });
+
+// NOLINTNEXTLINE(cert-err58-cpp) this macro makes a static variable
+REGISTER_OP("GraphConvolutionVisualMeshGrad")
+  .Attr("T: {float, double}")
+  .Input("features: T")
+  .Input("graph: int32")
+  .Input("weights: T")
+  .Input("grad: T")
+  .Output("features_grad: T")
+  .Output("weights_grad: T")
+  .SetShapeFn([](::tensorflow::shape_inference::InferenceContext* c) {
+      c->set_output(Outputs::FEATURES_GRAD, c->input(Args::FEATURES));
+      c->set_output(Outputs::WEIGHTS_GRAD, c->input(Args::WEIGHTS));
+      return tensorflow::Status::OK();
+  });
+
+/**
+ * @brief Check that the features, graph and weights of a graph convolution fit together
+ *
+ * @param context the context of the op that is being run, its status is set if the inputs are not valid
+ */
+static void ValidateGraphConvolution(tensorflow::OpKernelContext* context) {
+    const auto& features = context->input(Args::FEATURES);
+    const auto& graph    = context->input(Args::GRAPH);
+    const auto& weights  = context->input(Args::WEIGHTS);
+
+    OP_REQUIRES(context,
+                tensorflow::TensorShapeUtils::IsMatrix(features.shape()),
+                tensorflow::errors::InvalidArgument("The features must be an nxc matrix"));
+    OP_REQUIRES(context,
+                tensorflow::TensorShapeUtils::IsMatrix(graph.shape()),
+                tensorflow::errors::InvalidArgument("The graph must be an nxk matrix"));
+    OP_REQUIRES(context,
+                tensorflow::TensorShapeUtils::IsMatrix(weights.shape())
+                  && weights.dim_size(0) == graph.dim_size(1) * features.dim_size(1),
+                tensorflow::errors::InvalidArgument("The weights must be a (k*c)xu matrix"));
+    OP_REQUIRES(context,
+                features.NumElements() <= std::numeric_limits<int32_t>::max()
+                  && graph.NumElements() <= std::numeric_limits<int32_t>::max()
+                  && weights.NumElements() <= std::numeric_limits<int32_t>::max(),
+                tensorflow::errors::InvalidArgument("The inputs of the graph convolution are too large"));
+}
+
+/**
+ * @brief Check that every index in the graph is a row of the features
+ *
+ * @details
+ *  This is only checked on the CPU, like tf.gather the GPU kernels can't report a bad index.
+ *
+ * @param context the context of the op that is being run, its status is set if an index is not valid
+ */
+static void ValidateGraphIndices(tensorflow::OpKernelContext* context) {
+    const auto n_features = context->input(Args::FEATURES).dim_size(0);
+    const auto graph      = context->input(Args::GRAPH).flat<tensorflow::int32>();
+    const auto bad =
+      std::find_if(graph.data(), graph.data() + graph.size(), [n_features](const tensorflow::int32& i) {
+          return i < 0 || i >= n_features;
+      });
+    OP_REQUIRES(context,
+                bad == graph.data() + graph.size(),
+                tensorflow::errors::InvalidArgument("The graph index ", *bad, " is not a row of the features"));
+}
+
+/**
+ * @brief The fused graph convolution op
+ *
+ * @details
+ *  This is the same as gathering the features of each point and its neighbours with the graph, flattening each
+ *  neighbourhood and multiplying it by the weights, but without ever holding the gathered neighbourhoods in memory. The
+ *  gathered tensor is (k+1) times the size of the features, so on a dense mesh it is most of the memory of a training
+ *  step, and it is needed in both the forward and backward pass.
+ *
+ * @tparam Device The device the op runs on
+ * @tparam T      The scalar type used for floating point numbers
+ */
+template <typename Device, typename T>
+class GraphConvolutionVisualMeshOp : public tensorflow::OpKernel {
+public:
+    explicit GraphConvolutionVisualMeshOp(tensorflow::OpKernelConstruction* context) : OpKernel(context) {}
+
+    void Compute(tensorflow::OpKernelContext* context) override {
+        ValidateGraphConvolution(context);
+        if (!context->status().ok()) { return; }
+
+        const int64_t n_points  = context->input(Args::GRAPH).dim_size(0);
+        const int64_t n_outputs = context->input(Args::WEIGHTS).dim_size(1);
+
+        tensorflow::Tensor* output = nullptr;
+        OP_REQUIRES_OK(context, context->allocate_output(Outputs::OUTPUT, {n_points, n_outputs}, &output));
+
+        Convolve(context, output, context->eigen_device<Device>());
+    }
+
+private:
+    void Convolve(tensorflow::OpKernelContext* context, tensorflow::Tensor* output, const CPUDevice& /*device*/) {
+        ValidateGraphIndices(context);
+        if (!context->status().ok()) { return; }
+
+        const T* features              = context->input(Args::FEATURES).flat<T>().data();
+        const tensorflow::int32* graph = context->input(Args::GRAPH).flat<tensorflow::int32>().data();
+        const T* weights               = context->input(Args::WEIGHTS).flat<T>().data();
+        const int64_t n_points         = context->input(Args::GRAPH).dim_size(0);
+        const int64_t n_neighbours     = context->input(Args::GRAPH).dim_size(1);
+        const int64_t n_channels       = context->input(Args::FEATURES).dim_size(1);
+        const int64_t n_outputs        = output->dim_size(1);
+        T* out                         = output->flat<T>().data();
+
+        // Each point is independent so split the points over the worker threads
+        const auto& workers = *context->device()->tensorflow_cpu_worker_threads();
+        const int64_t cost  = n_neighbours * n_channels * n_outputs;
+        tensorflow::Shard(workers.num_threads, workers.workers, n_points, cost, [&](int64_t start, int64_t end) {
+            for (int64_t p = start; p < end; ++p) {
+                T* o = out + p * n_outputs;
+                std::fill(o, o + n_outputs, T(0));
+                for (int64_t k = 0; k < n_neighbours; ++k) {
+                    const T* f = features + int64_t(graph[p * n_neighbours + k]) * n_channels;
+                    const T* w = weights + k * n_channels * n_outputs;
+                    for (int64_t c = 0; c < n_channels; ++c) {
+                        for (int64_t u = 0; u < n_outputs; ++u) {
+                            o[u] += f[c] * w[c * n_outputs + u];
+                        }
+                    }
+                }
+            }
+        });
+    }
+
+#if GOOGLE_CUDA
+    void Convolve(tensorflow::OpKernelContext* context, tensorflow::Tensor* output, const GPUDevice& device) {
+        cudaError_t error = graph_convolution<T>(device.stream(),
+                                                 context->input(Args::FEATURES).flat<T>().data(),
+                                                 context->input(Args::GRAPH).flat<tensorflow::int32>().data(),
+                                                 context->input(Args::WEIGHTS).flat<T>().data(),
+                                                 context->input(Args::GRAPH).dim_size(0),
+                                                 context->input(Args::GRAPH).dim_size(1),
+                                                 context->input(Args::FEATURES).dim_size(1),
+                                                 output->dim_size(1),
+                                                 output->flat<T>().data());
+        OP_REQUIRES(
+          context,
+          error == cudaSuccess,
+          tensorflow::errors::Internal("Failed to launch the graph convolution kernel: ", cudaGetErrorString(error)));
+    }
+#endif  // GOOGLE_CUDA
+};
+
+/**
+ * @brief The gradient of the fused graph convolution op
+ *
+ * @details
+ *  The gradient of the weights is reduced over the points one row of the weights at a time, and the gradient of the
+ *  features is scattered back through the graph one channel at a time, so the gathered neighbourhoods are never held in
+ *  memory and no two threads ever write to the same value.
+ *
+ * @tparam Device The device the op runs on
+ * @tparam T      The scalar type used for floating point numbers
+ */
+template <typename Device, typename T>
+class GraphConvolutionVisualMeshGradOp : public tensorflow::OpKernel {
+public:
+    explicit GraphConvolutionVisualMeshGradOp(tensorflow::OpKernelConstruction* context) : OpKernel(context) {}
+
+    void Compute(tensorflow::OpKernelContext* context) override {
+        ValidateGraphConvolution(context);
+        if (!context->status().ok()) { return; }
+        OP_REQUIRES(context,
+                    tensorflow::TensorShapeUtils::IsMatrix(context->input(Args::GRAD).shape())
+                      && context->input(Args::GRAD).dim_size(0) == context->input(Args::GRAPH).dim_size(0)
+                      && context->input(Args::GRAD).dim_size(1) == context->input(Args::WEIGHTS).dim_size(1),
+                    tensorflow::errors::InvalidArgument("The gradient must be the same shape as the output"));
+
+        tensorflow::Tensor* features_grad = nullptr;
+        OP_REQUIRES_OK(context,
+                       context->allocate_output(
+                         Outputs::FEATURES_GRAD, context->input(Args::FEATURES).shape(), &features_grad));
+        tensorflow::Tensor* weights_grad = nullptr;
+        OP_REQUIRES_OK(
+          context,
+          context->allocate_output(Outputs::WEIGHTS_GRAD, context->input(Args::WEIGHTS).shape(), &weights_grad));
+
+        Gradient(context, features_grad, weights_grad, context->eigen_device<Device>());
+    }
+
+private:
+    void Gradient(tensorflow::OpKernelContext* context,
+                  tensorflow::Tensor* features_grad,
+                  tensorflow::Tensor* weights_grad,
+                  const CPUDevice& /*device*/) {
+        ValidateGraphIndices(context);
+        if (!context->status().ok()) { return; }
+
+        const T* features              = context->input(Args::FEATURES).flat<T>().data();
+        const tensorflow::int32* graph = context->input(Args::GRAPH).flat<tensorflow::int32>().data();
+        const T* weights               = context->input(Args::WEIGHTS).flat<T>().data();
+        const T* grad                  = context->input(Args::GRAD).flat<T>().data();
+        const int64_t n_points         = context->input(Args::GRAPH).dim_size(0);
+        const int64_t n_neighbours     = context->input(Args::GRAPH).dim_size(1);
+        const int64_t n_channels       = context->input(Args::FEATURES).dim_size(1);
+        const int64_t n_outputs        = context->input(Args::WEIGHTS).dim_size(1);
+        T* df                          = features_grad->flat<T>().data();
+        T* dw                          = weights_grad->flat<T>().data();
+
+        const auto& workers = *context->device()->tensorflow_cpu_worker_threads();
+
+        // Each row of the weight gradient is the sum over the points of one gathered feature times the gradient
+        tensorflow::Shard(workers.num_threads,
+                          workers.workers,
+                          n_neighbours * n_channels,
+                          n_points * n_outputs,
+                          [&](int64_t start, int64_t end) {
+                              for (int64_t r = start; r < end; ++r) {
+                                  const int64_t k = r / n_channels;
+                                  const int64_t c = r % n_channels;
+                                  T* w            = dw + r * n_outputs;
+                                  std::fill(w, w + n_outputs, T(0));
+                                  for (int64_t p = 0; p < n_points; ++p) {
+                                      const T f  = features[int64_t(graph[p * n_neighbours + k]) * n_channels + c];
+                                      const T* g = grad + p * n_outputs;
+                                      for (int64_t u = 0; u < n_outputs; ++u) {
+                                          w[u] += f * g[u];
+                                      }
+                                  }
+                              }
+                          });
+
+        // Each channel of the features gradient is only written by one thread so the scatter needs no atomics
+        std::fill(df, df + features_grad->NumElements(), T(0));
+        tensorflow::Shard(workers.num_threads,
+                          workers.workers,
+                          n_channels,
+                          n_points * n_neighbours * n_outputs,
+                          [&](int64_t start, int64_t end) {
+                              for (int64_t c = start; c < end; ++c) {
+                                  for (int64_t p = 0; p < n_points; ++p) {
+                                      const T* g = grad + p * n_outputs;
+                                      for (int64_t k = 0; k < n_neighbours; ++k) {
+                                          const T* w = weights + (k * n_channels + c) * n_outputs;
+                                          T acc      = T(0);
+                                          for (int64_t u = 0; u < n_outputs; ++u) {
+                                              acc += g[u] * w[u];
+                                          }
+                                          df[int64_t(graph[p * n_neighbours + k]) * n_channels + c] += acc;
+                                      }
+                                  }
+                              }
+                          });
+    }
+
+#if GOOGLE_CUDA
+    void Gradient(tensorflow::OpKernelContext* context,
+                  tensorflow::Tensor* features_grad,
+                  tensorflow::Tensor* weights_grad,
+                  const GPUDevice& device) {
+        cudaError_t error = graph_convolution_grad<T>(device.stream(),
+                                                      context->input(Args::FEATURES).flat<T>().data(),
+                                                      context->input(Args::GRAPH).flat<tensorflow::int32>().data(),
+                                                      context->input(Args::WEIGHTS).flat<T>().data(),
+                                                      context->input(Args::GRAD).flat<T>().data(),
+                                                      context->input(Args::FEATURES).dim_size(0),
+                                                      context->input(Args::GRAPH).dim_size(0),
+                                                      context->input(Args::GRAPH).dim_size(1),
+                                                      context->input(Args::FEATURES).dim_size(1),
+                                                      context->input(Args::WEIGHTS).dim_size(1),
+                                                      features_grad->flat<T>().data(),
+                                                      weights_grad->flat<T>().data());
+        OP_REQUIRES(context,
+                    error == cudaSuccess,
+                    tensorflow::errors::Internal("Failed to launch the graph convolution gradient kernels: ",
+                                                 cudaGetErrorString(error)));
+    }
+#endif  // GOOGLE_CUDA
+};
+
+// Register a version for float/double on each device
+#define REGISTER(DEVICE, Device, T)                                                                                 \
+    REGISTER_KERNEL_BUILDER(                                                                                        \
+      Name("GraphConvolutionVisualMesh").Device(tensorflow::DEVICE).TypeConstraint<T>("T"),                         \
+      GraphConvolutionVisualMeshOp<Device, T>)                                                                      \
+    REGISTER_KERNEL_BUILDER(                                                                                        \
+      Name("GraphConvolutionVisualMeshGrad").Device(tensorflow::DEVICE).TypeConstraint<T>("T"),                     \
+      GraphConvolutionVisualMeshGradOp<Device, T>)
+// NOLINTNEXTLINE(cert-err58-cpp) this macro makes a static variable
+REGISTER(DEVICE_CPU, CPUDevice, float)
+// NOLINTNEXTLINE(cert-err58-cpp) this macro makes a static variable
+REGISTER(DEVICE_CPU, CPUDevice, double)
+#if GOOGLE_CUDA
+// NOLINTNEXTLINE(cert-err58-cpp) this macro makes a static variable
+REGISTER(DEVICE_GPU, GPUDevice, float)
+// NOLINTNEXTLINE(cert-err58-cpp) this macro makes a static variable
+REGISTER(DEVICE_GPU, GPUDevice, double)
+#endif  // GOOGLE_CUDA
+#undef REGISTER
@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <algorithm>
+
+#include "graph_convolution_kernels.hpp"
+
+namespace {
+
+/// The number of threads in each block, the weight gradient reduction relies on this being a power of two
+constexpr int THREADS = 256;
+/// The number of outputs each thread accumulates at once when reducing the weight gradient
+constexpr int OUTPUT_CHUNK = 16;
+
+template <typename T>
+__global__ void graph_convolution_kernel(const T* features,
+                                         const int32_t* graph,
+                                         const T* weights,
+                                         const int n_points,
+                                         const int n_neighbours,
+                                         const int n_channels,
+                                         const int n_outputs,
+                                         T* output) {
+    const int64_t n_values = int64_t(n_points) * n_outputs;
+    for (int64_t idx = blockIdx.x * int64_t(blockDim.x) + threadIdx.x; idx < n_values;
+         idx += int64_t(blockDim.x) * gridDim.x) {
+        const int p = idx / n_outputs;
+        const int o = idx % n_outputs;
+
+        T acc = T(0);
+        for (int k = 0; k < n_neighbours; ++k) {
+            const T* f = features + int64_t(graph[int64_t(p) * n_neighbours + k]) * n_channels;
+            const T* w = weights + int64_t(k) * n_channels * n_outputs + o;
+            for (int c = 0; c < n_channels; ++c) {
+                acc += f[c] * w[int64_t(c) * n_outputs];
+            }
+        }
+        output[idx] = acc;
+    }
+}
+
+template <typename T>
+__global__ void graph_convolution_features_grad_kernel(const int32_t* graph,
+                                                       const T* weights,
+                                                       const T* grad,
+                                                       const int n_points,
+                                                       const int n_neighbours,
+                                                       const int n_channels,
+                                                       const int n_outputs,
+                                                       T* features_grad) {
+    const int64_t n_values = int64_t(n_points) * n_neighbours * n_channels;
+    for (int64_t idx = blockIdx.x * int64_t(blockDim.x) + threadIdx.x; idx < n_values;
+         idx += int64_t(blockDim.x) * gridDim.x) {
+        const int p = idx / (n_neighbours * n_channels);
+        const int r = idx % (n_neighbours * n_channels);
+
+        const T* g = grad + int64_t(p) * n_outputs;
+        const T* w = weights + int64_t(r) * n_outputs;
+        T acc      = T(0);
+        for (int o = 0; o < n_outputs; ++o) {
+            acc += g[o] * w[o];
+        }
+
+        // Several points can share a neighbour so the gradients must be summed atomically
+        const int k = r / n_channels;
+        const int c = r % n_channels;
+        atomicAdd(features_grad + int64_t(graph[int64_t(p) * n_neighbours + k]) * n_channels + c, acc);
+    }
+}
+
+template <typename T>
+__global__ void graph_convolution_weights_grad_kernel(const T* features,
+                                                      const int32_t* graph,
+                                                      const T* grad,
+                                                      const int n_points,
+                                                      const int n_neighbours,
+                                                      const int n_channels,
+                                                      const int n_outputs,
+                                                      T* weights_grad) {
+    __shared__ T partial[THREADS];
+
+    // Each block reduces one row of the weight gradient over every point
+    for (int r = blockIdx.x; r < n_neighbours * n_channels; r += gridDim.x) {
+        const int k = r / n_channels;
+        const int c = r % n_channels;
+
+        for (int o0 = 0; o0 < n_outputs; o0 += OUTPUT_CHUNK) {
+            const int n_chunk = min(OUTPUT_CHUNK, n_outputs - o0);
+
+            T acc[OUTPUT_CHUNK];
+            for (int j = 0; j < OUTPUT_CHUNK; ++j) {
+                acc[j] = T(0);
+            }
+            for (int p = threadIdx.x; p < n_points; p += blockDim.x) {
+                const T f  = features[int64_t(graph[int64_t(p) * n_neighbours + k]) * n_channels + c];
+                const T* g = grad + int64_t(p) * n_outputs + o0;
+                for (int j = 0; j < n_chunk; ++j) {
+                    acc[j] += f * g[j];
+                }
+            }
+
+            for (int j = 0; j < n_chunk; ++j) {
+                partial[threadIdx.x] = acc[j];
+                __syncthreads();
+                for (int s = blockDim.x / 2; s > 0; s /= 2) {
+                    if (threadIdx.x < s) { partial[threadIdx.x] += partial[threadIdx.x + s]; }
+                    __syncthreads();
+                }
+                if (threadIdx.x == 0) { weights_grad[int64_t(r) * n_outputs + o0 + j] = partial[0]; }
+                __syncthreads();
+            }
+        }
+    }
+}
+
+/// The number of blocks to launch for a grid stride loop over n values
+int blocks_for(const int64_t& n) {
+    return static_cast<int>(std::min<int64_t>((n + THREADS - 1) / THREADS, 65535));
+}
+
+}  // namespace
+
+template <typename T>
+cudaError_t graph_convolution(cudaStream_t stream,
+                              const T* features,
+                              const int32_t* graph,
+                              const T* weights,
+                              int n_points,
+                              int n_neighbours,
+                              int n_channels,
+                              int n_outputs,
+                              T* output) {
+    const int64_t n_values = int64_t(n_points) * n_outputs;
+    if (n_values == 0) { return cudaSuccess; }
+    graph_convolution_kernel<T><<<blocks_for(n_values), THREADS, 0, stream>>>(
+      features, graph, weights, n_points, n_neighbours, n_channels, n_outputs, output);
+    return cudaGetLastError();
+}
+
+template <typename T>
+cudaError_t graph_convolution_grad(cudaStream_t stream,
+                                   const T* features,
+                                   const int32_t* graph,
+                                   const T* weights,
+                                   const T* grad,
+                                   int n_features,
+                                   int n_points,
+                                   int n_neighbours,
+                                   int n_channels,
+                                   int n_outputs,
+                                   T* features_grad,
+                                   T* weights_grad) {
+    const int n_rows = n_neighbours * n_channels;
+
+    // Both gradients are zero if there are no points, otherwise every weight gradient is written by the reduction
+    cudaError_t error = cudaMemsetAsync(features_grad, 0, sizeof(T) * int64_t(n_features) * n_channels, stream);
+    if (error != cudaSuccess) { return error; }
+    if (n_points == 0 || n_rows == 0) {
+        return cudaMemsetAsync(weights_grad, 0, sizeof(T) * int64_t(n_rows) * n_outputs, stream);
+    }
+
+    graph_convolution_features_grad_kernel<T><<<blocks_for(int64_t(n_points) * n_rows), THREADS, 0, stream>>>(
+      graph, weights, grad, n_points, n_neighbours, n_channels, n_outputs, features_grad);
+    error = cudaGetLastError();
+    if (error != cudaSuccess) { return error; }
+
+    graph_convolution_weights_grad_kernel<T><<<std::min(n_rows, 65535), THREADS, 0, stream>>>(
+      features, graph, grad, n_points, n_neighbours, n_channels, n_outputs, weights_grad);
+    return cudaGetLastError();
+}
+
+template cudaError_t graph_convolution<float>(cudaStream_t,
+                                              const float*,
+                                              const int32_t*,
+                                              const float*,
+                                              int,
+                                              int,
+                                              int,
+                                              int,
+                                              float*);
+template cudaError_t graph_convolution<double>(cudaStream_t,
+                                               const double*,
+                                               const int32_t*,
+                                               const double*,
+                                               int,
+                                               int,
+                                               int,
+                                               int,
+                                               double*);
+template cudaError_t graph_convolution_grad<float>(cudaStream_t,
+                                                   const float*,
+                                                   const int32_t*,
+                                                   const float*,
+                                                   const float*,
+                                                   int,
+                                                   int,
+                                                   int,
+                                                   int,
+                                                   int,
+                                                   float*,
+                                                   float*);
+template cudaError_t graph_convolution_grad<double>(cudaStream_t,
+                                                    const double*,
+                                                    const int32_t*,
+                                                    const double*,
+                                                    const double*,
+                                                    int,
+                                                    int,
+                                                    int,
+                                                    int,
+                                                    int,
+                                                    double*,
+                                                    double*);
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_TENSORFLOW_GRAPH_CONVOLUTION_KERNELS_HPP
+#define VISUALMESH_TENSORFLOW_GRAPH_CONVOLUTION_KERNELS_HPP
+
+#if GOOGLE_CUDA
+
+#include <cuda_runtime.h>
+
+#include <cstdint>
+
+/**
+ * @brief Apply a graph convolution on the GPU without gathering the neighbourhood of each point into memory first
+ *
+ * @details
+ *  Each thread calculates one output value, reading the features of each neighbour directly through the graph.
+ *
+ * @tparam T the scalar type of the features and weights
+ *
+ * @param stream       the stream to run the kernel on
+ * @param features     the features of every point as n_features x n_channels
+ * @param graph        the index of each point and its neighbours as n_points x n_neighbours
+ * @param weights      the weights of the convolution as (n_neighbours * n_channels) x n_outputs
+ * @param n_points     the number of points in the graph
+ * @param n_neighbours the number of indices in each row of the graph, including the point itself
+ * @param n_channels   the number of channels of the input features
+ * @param n_outputs    the number of channels of the output
+ * @param output       the convolved features as n_points x n_outputs
+ *
+ * @return the error from launching the kernel
+ */
+template <typename T>
+cudaError_t graph_convolution(cudaStream_t stream,
+                              const T* features,
+                              const int32_t* graph,
+                              const T* weights,
+                              int n_points,
+                              int n_neighbours,
+                              int n_channels,
+                              int n_outputs,
+                              T* output);
+
+/**
+ * @brief Calculate the gradients of a graph convolution on the GPU
+ *
+ * @details
+ *  The gradient of the features is scattered back through the graph with atomic adds, and the gradient of the weights
+ *  is reduced over the points with one block for each row of the weights, so neither needs the gathered neighbourhood
+ *  in memory.
+ *
+ * @tparam T the scalar type of the features and weights
+ *
+ * @param stream        the stream to run the kernels on
+ * @param features      the features of every point as n_features x n_channels
+ * @param graph         the index of each point and its neighbours as n_points x n_neighbours
+ * @param weights       the weights of the convolution as (n_neighbours * n_channels) x n_outputs
+ * @param grad          the gradient of the output as n_points x n_outputs
+ * @param n_features    the number of rows of the features
+ * @param n_points      the number of points in the graph
+ * @param n_neighbours  the number of indices in each row of the graph, including the point itself
+ * @param n_channels    the number of channels of the input features
+ * @param n_outputs     the number of channels of the output
+ * @param features_grad the gradient of the features as n_features x n_channels
+ * @param weights_grad  the gradient of the weights as (n_neighbours * n_channels) x n_outputs
+ *
+ * @return the error from launching the kernels
+ */
+template <typename T>
+cudaError_t graph_convolution_grad(cudaStream_t stream,
+                                   const T* features,
+                                   const int32_t* graph,
+                                   const T* weights,
+                                   const T* grad,
+                                   int n_features,
+                                   int n_points,
+                                   int n_neighbours,
+                                   int n_channels,
+                                   int n_outputs,
+                                   T* features_grad,
+                                   T* weights_grad);
+
+#endif  // GOOGLE_CUDA
+
+#endif  // VISUALMESH_TENSORFLOW_GRAPH_CONVOLUTION_KERNELS_HPP
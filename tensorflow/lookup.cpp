@@ -15,9 +15,16 @@
  * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#if GOOGLE_CUDA
+#define EIGEN_USE_GPU
+#endif  // GOOGLE_CUDA
+
 #include <tensorflow/core/framework/op.h>
 #include <tensorflow/core/framework/op_kernel.h>
 #include <tensorflow/core/framework/shape_inference.h>
+#if GOOGLE_CUDA
+#include <tensorflow/core/platform/stream_executor.h>
+#endif  // GOOGLE_CUDA
 
 #include <array>
 #include <cstdint>
@@ -25,14 +32,17 @@
 #include <limits>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
+#include "gather_mesh.hpp"
 #include "mesh_cache.hpp"
 #include "model_op_base.hpp"
 #include "visualmesh/lens.hpp"
 #include "visualmesh/mesh.hpp"
 #include "visualmesh/utility/math.hpp"
+#include "visualmesh/utility/range_lookup.hpp"
 
 enum Args {
     DIMENSIONS             = 0,
@@ -56,6 +66,11 @@ enum Outputs {
     NEIGHBOURS = 1,
 };
 
+using CPUDevice = Eigen::ThreadPoolDevice;
+#if GOOGLE_CUDA
+using GPUDevice = Eigen::GpuDevice;
+#endif  // GOOGLE_CUDA
+
 // NOLINTNEXTLINE(cert-err58-cpp) this macro makes a static variable
 REGISTER_OP("LookupVisualMesh")
   .Attr("T: {float, double}")
@@ -91,15 +106,19 @@ REGISTER_OP("LookupVisualMesh")
  *  This op will perform a projection using the visual mesh and will return the neighbourhood graph and the pixel
  * coordinates for the points that would be on screen for the lens paramters provided.
  *
- * @tparam T The scalar type used for floating point numbers
- * @tparam U The scalar type used for integer numbers
+ *  The lookup always runs on the host. On the GPU the rays and graph of each mesh are uploaded once and kept on the
+ *  device, so each step only uploads the on screen ranges and gathers the outputs where the network will use them.
+ *
+ * @tparam Device The device the outputs are written on
+ * @tparam T      The scalar type used for floating point numbers
+ * @tparam U      The scalar type used for integer numbers
  */
-template <typename T, typename U>
+template <typename Device, typename T, typename U>
 class LookupVisualMeshOp
-  : public ModelOpBase<T, LookupVisualMeshOp<T, U>, Args::MESH_MODEL, Args::GEOMETRY, Args::RADIUS> {
+  : public ModelOpBase<T, LookupVisualMeshOp<Device, T, U>, Args::MESH_MODEL, Args::GEOMETRY, Args::RADIUS> {
 public:
     explicit LookupVisualMeshOp(tensorflow::OpKernelConstruction* context)
-      : ModelOpBase<T, LookupVisualMeshOp<T, U>, Args::MESH_MODEL, Args::GEOMETRY, Args::RADIUS>(context) {}
+      : ModelOpBase<T, LookupVisualMeshOp<Device, T, U>, Args::MESH_MODEL, Args::GEOMETRY, Args::RADIUS>(context) {}
 
     template <template <typename> class Model, typename Shape>
     void DoCompute(tensorflow::OpKernelContext* context, const Shape& shape) {
@@ -188,8 +207,7 @@ public:
           get_mesh<T, Model>(shape, Hoc[2][3], n_intersections, intersection_tolerance, cached_meshes, max_distance);
 
         // Grab the ranges
-        auto ranges       = mesh->lookup(Hoc, lens);
-        const auto& nodes = mesh->nodes;
+        auto ranges = mesh->lookup(Hoc, lens);
 
         // Work out how many points total there are in the ranges
         unsigned int n_points = 0;
@@ -197,6 +215,28 @@ public:
             n_points += r.second - r.first;
         }
 
+        Gather(context, mesh, ranges, n_points, cached_meshes, context->eigen_device<Device>());
+    }
+
+private:
+    /**
+     * @brief Write the rays and graph of the on screen points on the host
+     *
+     * @param context  the context of the op to allocate the outputs from
+     * @param mesh     the mesh that was looked up
+     * @param ranges   the on screen ranges of the mesh
+     * @param n_points the number of points in the ranges
+     * @param device   the CPU the op is running on
+     */
+    template <template <typename> class Model>
+    void Gather(tensorflow::OpKernelContext* context,
+                const std::shared_ptr<visualmesh::Mesh<T, Model>>& mesh,
+                const std::vector<std::pair<int, int>>& ranges,
+                const unsigned int& n_points,
+                const tensorflow::int32& /*cached_meshes*/,
+                const CPUDevice& /*device*/) {
+        const auto& nodes = mesh->nodes;
+
         // Allocate our outputs
         tensorflow::Tensor* vectors = nullptr;
         tensorflow::TensorShape vectors_shape;
@@ -211,15 +251,7 @@ public:
         OP_REQUIRES_OK(context, context->allocate_output(Outputs::NEIGHBOURS, neighbours_shape, &neighbours));
 
         // Build the lookup for the graph so we can find the new location of points
-        std::vector<int> r_lookup(nodes.size() + 1, std::numeric_limits<tensorflow::int32>::lowest());
-        {
-            int idx = 0;
-            for (const auto& r : ranges) {
-                for (int i = r.first; i < r.second; ++i) {
-                    r_lookup[i] = idx++;
-                }
-            }
-        }
+        const visualmesh::RangeLookup r_lookup(ranges);
 
         // Copy across the unit vectors we looked up
         {
@@ -239,7 +271,8 @@ public:
                     const auto& node = nodes[i];
                     n(idx, 0)        = idx;
                     for (int j = 0; j < Model<T>::N_NEIGHBOURS; ++j) {
-                        n(idx, j + 1) = r_lookup[node.neighbours[j]];
+                        const int l   = r_lookup(node.neighbours[j]);
+                        n(idx, j + 1) = l == r_lookup.size() ? std::numeric_limits<tensorflow::int32>::lowest() : l;
                     }
 
                     // Next value to fill
@@ -248,6 +281,180 @@ public:
             }
         }
     }
+
+#if GOOGLE_CUDA
+    /// A mesh whose rays and neighbourhood have been uploaded to the GPU
+    struct DeviceMesh {
+        /// Keeps the mesh alive so its address isn't reused while it is in this cache
+        std::shared_ptr<const void> mesh;
+        /// The unit vector of every point in the mesh
+        tensorflow::Tensor rays;
+        /// The neighbours of every point in the mesh
+        tensorflow::Tensor neighbours;
+        /// The value of the clock when this mesh was last used
+        uint64_t last_used;
+    };
+
+    /**
+     * @brief Copy a host tensor to the device on the stream of the op, keeping the host tensor alive until it is done
+     *
+     * @param context the context of the op
+     * @param host    the pinned host tensor to copy from
+     * @param device  the device tensor to copy to
+     */
+    static void Upload(tensorflow::OpKernelContext* context,
+                       const tensorflow::Tensor& host,
+                       tensorflow::Tensor* device) {
+        auto* stream     = context->op_device_context()->stream();
+        const auto bytes = host.TotalBytes();
+        stream_executor::DeviceMemoryBase dst(const_cast<char*>(device->tensor_data().data()), bytes);
+        stream->ThenMemcpy(&dst, host.tensor_data().data(), bytes);
+        stream->ThenDoHostCallback([host] {});
+        OP_REQUIRES(context, stream->ok(), tensorflow::errors::Internal("Failed to upload to the GPU"));
+    }
+
+    /**
+     * @brief Get the device copy of a mesh, uploading it if this is the first time it has been used
+     *
+     * @param context       the context of the op to allocate the device tensors from
+     * @param mesh          the mesh to get the device copy of
+     * @param cached_meshes the number of meshes to keep on the device
+     *
+     * @return the device copy of the mesh
+     */
+    template <template <typename> class Model>
+    DeviceMesh GetDeviceMesh(tensorflow::OpKernelContext* context,
+                             const std::shared_ptr<visualmesh::Mesh<T, Model>>& mesh,
+                             const tensorflow::int32& cached_meshes) {
+        constexpr int N_NEIGHBOURS = Model<T>::N_NEIGHBOURS;
+        std::lock_guard<std::mutex> lock(device_meshes_mutex);
+
+        auto it = device_meshes.find(mesh.get());
+        if (it != device_meshes.end()) {
+            it->second.last_used = ++clock;
+            return it->second;
+        }
+
+        // Copy the mesh into pinned host memory so it can be uploaded asynchronously
+        const auto& nodes = mesh->nodes;
+        const int64_t n   = nodes.size();
+        DeviceMesh device = {mesh, tensorflow::Tensor(), tensorflow::Tensor(), ++clock};
+        tensorflow::AllocatorAttributes pinned;
+        pinned.set_on_host(true);
+        pinned.set_gpu_compatible(true);
+        tensorflow::Tensor host_rays;
+        tensorflow::Tensor host_neighbours;
+        OP_REQUIRES_OK_RETURN(
+          context,
+          device,
+          context->allocate_temp(tensorflow::DataTypeToEnum<T>::v(), {n, 3}, &host_rays, pinned));
+        OP_REQUIRES_OK_RETURN(
+          context,
+          device,
+          context->allocate_temp(tensorflow::DT_INT32, {n, N_NEIGHBOURS}, &host_neighbours, pinned));
+        auto r = host_rays.matrix<T>();
+        auto g = host_neighbours.matrix<tensorflow::int32>();
+        for (int64_t i = 0; i < n; ++i) {
+            for (int j = 0; j < 3; ++j) {
+                r(i, j) = nodes[i].ray[j];
+            }
+            for (int j = 0; j < N_NEIGHBOURS; ++j) {
+                g(i, j) = nodes[i].neighbours[j];
+            }
+        }
+
+        OP_REQUIRES_OK_RETURN(
+          context, device, context->allocate_temp(tensorflow::DataTypeToEnum<T>::v(), {n, 3}, &device.rays));
+        OP_REQUIRES_OK_RETURN(
+          context, device, context->allocate_temp(tensorflow::DT_INT32, {n, N_NEIGHBOURS}, &device.neighbours));
+        Upload(context, host_rays, &device.rays);
+        Upload(context, host_neighbours, &device.neighbours);
+
+        // Only keep as many meshes on the device as are kept on the host, removing the least recently used
+        while (!device_meshes.empty() && static_cast<int32_t>(device_meshes.size()) >= std::max(cached_meshes, 1)) {
+            auto oldest =
+              std::min_element(device_meshes.begin(), device_meshes.end(), [](const auto& a, const auto& b) {
+                  return a.second.last_used < b.second.last_used;
+              });
+            device_meshes.erase(oldest);
+        }
+        device_meshes.emplace(mesh.get(), device);
+        return device;
+    }
+
+    /**
+     * @brief Gather the rays and graph of the on screen points on the GPU from the device copy of the mesh
+     *
+     * @param context       the context of the op to allocate the outputs from
+     * @param mesh          the mesh that was looked up
+     * @param ranges        the on screen ranges of the mesh
+     * @param n_points      the number of points in the ranges
+     * @param cached_meshes the number of meshes to keep on the device
+     * @param device        the GPU the op is running on
+     */
+    template <template <typename> class Model>
+    void Gather(tensorflow::OpKernelContext* context,
+                const std::shared_ptr<visualmesh::Mesh<T, Model>>& mesh,
+                const std::vector<std::pair<int, int>>& ranges,
+                const unsigned int& n_points,
+                const tensorflow::int32& cached_meshes,
+                const GPUDevice& device) {
+        constexpr int N_NEIGHBOURS = Model<T>::N_NEIGHBOURS;
+
+        DeviceMesh device_mesh = GetDeviceMesh(context, mesh, cached_meshes);
+        if (!context->status().ok()) { return; }
+
+        // Allocate our outputs
+        tensorflow::Tensor* vectors = nullptr;
+        OP_REQUIRES_OK(context, context->allocate_output(Outputs::VECTORS, {int64_t(n_points), 3}, &vectors));
+        tensorflow::Tensor* neighbours = nullptr;
+        OP_REQUIRES_OK(
+          context,
+          context->allocate_output(Outputs::NEIGHBOURS, {int64_t(n_points), N_NEIGHBOURS + 1}, &neighbours));
+        if (n_points == 0) { return; }
+
+        // Upload the start, end and packed offset of each range
+        const int64_t n_ranges = ranges.size();
+        tensorflow::AllocatorAttributes pinned;
+        pinned.set_on_host(true);
+        pinned.set_gpu_compatible(true);
+        tensorflow::Tensor host_ranges;
+        OP_REQUIRES_OK(context, context->allocate_temp(tensorflow::DT_INT32, {n_ranges, 3}, &host_ranges, pinned));
+        auto hr        = host_ranges.matrix<tensorflow::int32>();
+        int32_t offset = 0;
+        for (int64_t i = 0; i < n_ranges; ++i) {
+            hr(i, 0) = ranges[i].first;
+            hr(i, 1) = ranges[i].second;
+            hr(i, 2) = offset;
+            offset += ranges[i].second - ranges[i].first;
+        }
+        tensorflow::Tensor device_ranges;
+        OP_REQUIRES_OK(context, context->allocate_temp(tensorflow::DT_INT32, {n_ranges, 3}, &device_ranges));
+        Upload(context, host_ranges, &device_ranges);
+        if (!context->status().ok()) { return; }
+
+        cudaError_t error = gather_mesh<T>(device.stream(),
+                                           device_mesh.rays.flat<T>().data(),
+                                           device_mesh.neighbours.flat<tensorflow::int32>().data(),
+                                           N_NEIGHBOURS,
+                                           device_ranges.flat<tensorflow::int32>().data(),
+                                           n_ranges,
+                                           n_points,
+                                           vectors->flat<T>().data(),
+                                           neighbours->flat<tensorflow::int32>().data());
+        OP_REQUIRES(
+          context,
+          error == cudaSuccess,
+          tensorflow::errors::Internal("Failed to launch the mesh gather kernel: ", cudaGetErrorString(error)));
+    }
+
+    /// Guards the device meshes as the op can run on several steps at once
+    std::mutex device_meshes_mutex;
+    /// The meshes that have been uploaded to the device, by the address of the mesh on the host
+    std::map<const void*, DeviceMesh> device_meshes;
+    /// Incremented each time a device mesh is used to track which was used longest ago
+    uint64_t clock = 0;
+#endif  // GOOGLE_CUDA
 };
 
 // Register a version for all the combinations of float/double and int32/int64
@@ -256,22 +463,55 @@ REGISTER_KERNEL_BUILDER(Name("LookupVisualMesh")
                           .Device(tensorflow::DEVICE_CPU)
                           .TypeConstraint<float>("T")
                           .TypeConstraint<tensorflow::int32>("U"),
-                        LookupVisualMeshOp<float, tensorflow::int32>)
+                        LookupVisualMeshOp<CPUDevice, float, tensorflow::int32>)
 // NOLINTNEXTLINE(cert-err58-cpp) this macro makes a static variable
 REGISTER_KERNEL_BUILDER(Name("LookupVisualMesh")
                           .Device(tensorflow::DEVICE_CPU)
                           .TypeConstraint<float>("T")
                           .TypeConstraint<tensorflow::int64>("U"),
-                        LookupVisualMeshOp<float, tensorflow::int64>)
+                        LookupVisualMeshOp<CPUDevice, float, tensorflow::int64>)
 // NOLINTNEXTLINE(cert-err58-cpp) this macro makes a static variable
 REGISTER_KERNEL_BUILDER(Name("LookupVisualMesh")
                           .Device(tensorflow::DEVICE_CPU)
                           .TypeConstraint<double>("T")
                           .TypeConstraint<tensorflow::int32>("U"),
-                        LookupVisualMeshOp<double, tensorflow::int32>)
+                        LookupVisualMeshOp<CPUDevice, double, tensorflow::int32>)
 // NOLINTNEXTLINE(cert-err58-cpp) this macro makes a static variable
 REGISTER_KERNEL_BUILDER(Name("LookupVisualMesh")
                           .Device(tensorflow::DEVICE_CPU)
                           .TypeConstraint<double>("T")
                           .TypeConstraint<tensorflow::int64>("U"),
-                        LookupVisualMeshOp<double, tensorflow::int64>)
+                        LookupVisualMeshOp<CPUDevice, double, tensorflow::int64>)
+
+#if GOOGLE_CUDA
+// On the GPU every input is read on the host for the lookup, and only the outputs are on the device
+#define REGISTER_GPU(T, U)                                                                   \
+    REGISTER_KERNEL_BUILDER(Name("LookupVisualMesh")                                         \
+                              .Device(tensorflow::DEVICE_GPU)                                \
+                              .TypeConstraint<T>("T")                                        \
+                              .TypeConstraint<U>("U")                                        \
+                              .HostMemory("image_dimensions")                                \
+                              .HostMemory("lens_projection")                                 \
+                              .HostMemory("lens_focal_length")                               \
+                              .HostMemory("lens_centre")                                     \
+                              .HostMemory("lens_distortion")                                 \
+                              .HostMemory("lens_fov")                                        \
+                              .HostMemory("cam_to_observation_plane")                        \
+                              .HostMemory("mesh_model")                                      \
+                              .HostMemory("cached_meshes")                                   \
+                              .HostMemory("max_distance")                                    \
+                              .HostMemory("geometry")                                        \
+                              .HostMemory("radius")                                          \
+                              .HostMemory("n_intersections")                                 \
+                              .HostMemory("intersection_tolerance"),                         \
+                            LookupVisualMeshOp<GPUDevice, T, U>)
+// NOLINTNEXTLINE(cert-err58-cpp) this macro makes a static variable
+REGISTER_GPU(float, tensorflow::int32)
+// NOLINTNEXTLINE(cert-err58-cpp) this macro makes a static variable
+REGISTER_GPU(float, tensorflow::int64)
+// NOLINTNEXTLINE(cert-err58-cpp) this macro makes a static variable
+REGISTER_GPU(double, tensorflow::int32)
+// NOLINTNEXTLINE(cert-err58-cpp) this macro makes a static variable
+REGISTER_GPU(double, tensorflow::int64)
+#undef REGISTER_GPU
+#endif  // GOOGLE_CUDA
@@ -0,0 +1,373 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <tensorflow/core/framework/op.h>
+#include <tensorflow/core/framework/op_kernel.h>
+#include <tensorflow/core/framework/shape_inference.h>
+#include <tensorflow/core/util/work_sharder.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "mesh_cache.hpp"
+#include "model_op_base.hpp"
+#include "visualmesh/lens.hpp"
+#include "visualmesh/mesh.hpp"
+#include "visualmesh/utility/math.hpp"
+#include "visualmesh/utility/projection.hpp"
+#include "visualmesh/utility/range_lookup.hpp"
+
+enum Args {
+    IMAGES                 = 0,
+    DIMENSIONS             = 1,
+    PROJECTION             = 2,
+    FOCAL_LENGTH           = 3,
+    LENS_CENTRE            = 4,
+    LENS_DISTORTION        = 5,
+    FIELD_OF_VIEW          = 6,
+    HOC                    = 7,
+    MESH_MODEL             = 8,
+    CACHED_MESHES          = 9,
+    MAX_DISTANCE           = 10,
+    GEOMETRY               = 11,
+    RADIUS                 = 12,
+    N_INTERSECTIONS        = 13,
+    INTERSECTION_TOLERANCE = 14,
+};
+
+enum Outputs {
+    VECTORS    = 0,
+    NEIGHBOURS = 1,
+    PIXELS     = 2,
+    COLOURS    = 3,
+    ROW_SPLITS = 4,
+};
+
+// NOLINTNEXTLINE(cert-err58-cpp) this macro makes a static variable
+REGISTER_OP("LookupVisualMeshBatch")
+  .Attr("T: {float, double}")
+  .Attr("U: {int32, int64}")
+  .Input("images: T")
+  .Input("image_dimensions: U")
+  .Input("lens_projection: string")
+  .Input("lens_focal_length: T")
+  .Input("lens_centre: T")
+  .Input("lens_distortion: T")
+  .Input("lens_fov: T")
+  .Input("cam_to_observation_plane: T")
+  .Input("mesh_model: string")
+  .Input("cached_meshes: int32")
+  .Input("max_distance: T")
+  .Input("geometry: string")
+  .Input("radius: T")
+  .Input("n_intersections: T")
+  .Input("intersection_tolerance: T")
+  .Output("vectors: T")
+  .Output("neighbours: int32")
+  .Output("pixels: T")
+  .Output("colours: T")
+  .Output("row_splits: int64")
+  .SetShapeFn([](::tensorflow::shape_inference::InferenceContext* c) {
+      constexpr auto kUnknownDim = ::tensorflow::shape_inference::InferenceContext::kUnknownDim;
+      // The points of every example are concatenated, row_splits gives where each example starts and ends
+      ::tensorflow::shape_inference::DimensionHandle splits;
+      TF_RETURN_IF_ERROR(c->Add(c->Dim(c->input(Args::IMAGES), 0), 1, &splits));
+      c->set_output(Outputs::VECTORS, c->MakeShape({kUnknownDim, 3}));
+      c->set_output(Outputs::NEIGHBOURS, c->MakeShape({kUnknownDim, kUnknownDim}));
+      c->set_output(Outputs::PIXELS, c->MakeShape({kUnknownDim, 2}));
+      c->set_output(Outputs::COLOURS, c->MakeShape({kUnknownDim, c->Dim(c->input(Args::IMAGES), 3)}));
+      c->set_output(Outputs::ROW_SPLITS, c->Vector(splits));
+      return tensorflow::Status::OK();
+  });
+
+/**
+ * @brief The batched Visual Mesh lookup op
+ *
+ * @details
+ *  This op does the work of LookupVisualMesh, the projection to pixel coordinates and the bilinear sampling of the
+ *  image for a whole batch of examples in one call. The examples are split between the worker threads of the device so
+ *  the lookups run in parallel, rather than one at a time in a tf.data map.
+ *
+ *  The images are given as a single tensor padded to the largest image, with the real size of each in
+ *  image_dimensions. The points of every example are concatenated in each output, with the points of example i being
+ *  the rows [row_splits[i], row_splits[i + 1]) so the outputs can be made into ragged tensors. The neighbourhood graph
+ *  of each example is indexed from the start of that example, and has the same layout as the one from
+ *  LookupVisualMesh. The pixel coordinates are in tensorflow's (y, x) order.
+ *
+ * @tparam T The scalar type used for floating point numbers
+ * @tparam U The scalar type used for integer numbers
+ */
+template <typename T, typename U>
+class LookupVisualMeshBatchOp
+  : public ModelOpBase<T, LookupVisualMeshBatchOp<T, U>, Args::MESH_MODEL, Args::GEOMETRY, Args::RADIUS> {
+public:
+    explicit LookupVisualMeshBatchOp(tensorflow::OpKernelConstruction* context)
+      : ModelOpBase<T, LookupVisualMeshBatchOp<T, U>, Args::MESH_MODEL, Args::GEOMETRY, Args::RADIUS>(context) {}
+
+    template <template <typename> class Model, typename Shape>
+    void DoCompute(tensorflow::OpKernelContext* context, const Shape& shape) {
+        static constexpr int N_NEIGHBOURS = Model<T>::N_NEIGHBOURS;
+
+        // Check that the shape of each of the inputs is valid
+        OP_REQUIRES(context,
+                    context->input(Args::IMAGES).dims() == 4,
+                    tensorflow::errors::InvalidArgument("The images must be a 4d tensor of [batch, y, x, channels]"));
+        const int64_t batch = context->input(Args::IMAGES).dim_size(0);
+        OP_REQUIRES(
+          context,
+          tensorflow::TensorShapeUtils::IsMatrix(context->input(Args::DIMENSIONS).shape())
+            && context->input(Args::DIMENSIONS).dim_size(0) == batch
+            && context->input(Args::DIMENSIONS).dim_size(1) == 2,
+          tensorflow::errors::InvalidArgument("The image dimensions must be a batch of [y_size, x_size] vectors"));
+        OP_REQUIRES(context,
+                    tensorflow::TensorShapeUtils::IsVector(context->input(Args::PROJECTION).shape())
+                      && context->input(Args::PROJECTION).dim_size(0) == batch,
+                    tensorflow::errors::InvalidArgument("The lens projection must be a vector of one per image"));
+        OP_REQUIRES(context,
+                    tensorflow::TensorShapeUtils::IsVector(context->input(Args::FOCAL_LENGTH).shape())
+                      && context->input(Args::FOCAL_LENGTH).dim_size(0) == batch,
+                    tensorflow::errors::InvalidArgument("The focal length must be a vector of one per image"));
+        OP_REQUIRES(context,
+                    tensorflow::TensorShapeUtils::IsMatrix(context->input(Args::LENS_CENTRE).shape())
+                      && context->input(Args::LENS_CENTRE).dim_size(0) == batch
+                      && context->input(Args::LENS_CENTRE).dim_size(1) == 2,
+                    tensorflow::errors::InvalidArgument("The lens centre must be a batch of 2d vectors"));
+        OP_REQUIRES(context,
+                    tensorflow::TensorShapeUtils::IsMatrix(context->input(Args::LENS_DISTORTION).shape())
+                      && context->input(Args::LENS_DISTORTION).dim_size(0) == batch
+                      && context->input(Args::LENS_DISTORTION).dim_size(1) == 2,
+                    tensorflow::errors::InvalidArgument("The lens distortion must be a batch of 2d vectors"));
+        OP_REQUIRES(context,
+                    tensorflow::TensorShapeUtils::IsVector(context->input(Args::FIELD_OF_VIEW).shape())
+                      && context->input(Args::FIELD_OF_VIEW).dim_size(0) == batch,
+                    tensorflow::errors::InvalidArgument("The field of view must be a vector of one per image"));
+        OP_REQUIRES(context,
+                    context->input(Args::HOC).dims() == 3 && context->input(Args::HOC).dim_size(0) == batch
+                      && context->input(Args::HOC).dim_size(1) == 4 && context->input(Args::HOC).dim_size(2) == 4,
+                    tensorflow::errors::InvalidArgument("Hoc must be a batch of 4x4 matrices"));
+        OP_REQUIRES(context,
+                    tensorflow::TensorShapeUtils::IsScalar(context->input(Args::N_INTERSECTIONS).shape()),
+                    tensorflow::errors::InvalidArgument("The number of intersections must be a scalar"));
+        OP_REQUIRES(context,
+                    tensorflow::TensorShapeUtils::IsScalar(context->input(Args::CACHED_MESHES).shape()),
+                    tensorflow::errors::InvalidArgument("The number cached meshes must be a scalar"));
+        OP_REQUIRES(context,
+                    tensorflow::TensorShapeUtils::IsScalar(context->input(Args::INTERSECTION_TOLERANCE).shape()),
+                    tensorflow::errors::InvalidArgument("The intersection tolerance must be a scalar"));
+        OP_REQUIRES(context,
+                    tensorflow::TensorShapeUtils::IsScalar(context->input(Args::MAX_DISTANCE).shape()),
+                    tensorflow::errors::InvalidArgument("The maximum distance must be a scalar"));
+
+        // Extract information from our input tensors
+        auto images                     = context->input(Args::IMAGES).tensor<T, 4>();
+        auto image_dimensions           = context->input(Args::DIMENSIONS).matrix<U>();
+        auto projections                = context->input(Args::PROJECTION).vec<tensorflow::tstring>();
+        auto focal_length               = context->input(Args::FOCAL_LENGTH).vec<T>();
+        auto lens_centre                = context->input(Args::LENS_CENTRE).matrix<T>();
+        auto lens_distortion            = context->input(Args::LENS_DISTORTION).matrix<T>();
+        auto fov                        = context->input(Args::FIELD_OF_VIEW).vec<T>();
+        auto tHoc                       = context->input(Args::HOC).tensor<T, 3>();
+        T max_distance                  = context->input(Args::MAX_DISTANCE).scalar<T>()(0);
+        T n_intersections               = context->input(Args::N_INTERSECTIONS).scalar<T>()(0);
+        tensorflow::int32 cached_meshes = context->input(Args::CACHED_MESHES).scalar<tensorflow::int32>()(0);
+        T intersection_tolerance        = context->input(Args::INTERSECTION_TOLERANCE).scalar<T>()(0);
+        const int64_t channels          = images.dimension(3);
+
+        // Build the lens and Hoc for each example, flipping x and y as tensorflow has them reversed compared to us
+        std::vector<visualmesh::Lens<T>> lenses(batch);
+        std::vector<visualmesh::mat4<T>> Hocs(batch);
+        for (int64_t b = 0; b < batch; ++b) {
+            const std::string projection = projections(b);
+            OP_REQUIRES(
+              context,
+              projection == "EQUISOLID" || projection == "EQUIDISTANT" || projection == "RECTILINEAR",
+              tensorflow::errors::InvalidArgument("Projection must be one of EQUISOLID, EQUIDISTANT or RECTILINEAR"));
+            OP_REQUIRES(context,
+                        image_dimensions(b, 0) <= images.dimension(1) && image_dimensions(b, 1) <= images.dimension(2),
+                        tensorflow::errors::InvalidArgument("The image dimensions must fit in the padded images"));
+
+            auto& lens        = lenses[b];
+            lens.dimensions   = {{int32_t(image_dimensions(b, 1)), int32_t(image_dimensions(b, 0))}};
+            lens.focal_length = focal_length(b);
+            lens.centre       = {{lens_centre(b, 1), lens_centre(b, 0)}};
+            lens.k            = {{lens_distortion(b, 0), lens_distortion(b, 1)}};
+            lens.fov          = fov(b);
+
+            // clang-format off
+            if (projection == "EQUISOLID") { lens.projection = visualmesh::EQUISOLID; }
+            else if (projection == "EQUIDISTANT") { lens.projection = visualmesh::EQUIDISTANT; }
+            else if (projection == "RECTILINEAR") { lens.projection = visualmesh::RECTILINEAR; }
+            // clang-format on
+
+            for (int i = 0; i < 4; ++i) {
+                Hocs[b][i] = visualmesh::vec4<T>{tHoc(b, i, 0), tHoc(b, i, 1), tHoc(b, i, 2), tHoc(b, i, 3)};
+            }
+        }
+
+        // A lookup of a single example is expensive enough that it is always worth giving each its own shard
+        const auto& workers = *context->device()->tensorflow_cpu_worker_threads();
+        const int64_t cost  = 1000000;
+        std::vector<std::shared_ptr<visualmesh::Mesh<T, Model>>> meshes(batch);
+        std::vector<std::vector<std::pair<int, int>>> ranges(batch);
+
+        // Find the on screen points of every example in parallel
+        tensorflow::Shard(workers.num_threads, workers.workers, batch, cost, [&](int64_t start, int64_t end) {
+            for (int64_t b = start; b < end; ++b) {
+                meshes[b] = get_mesh<T, Model>(
+                  shape, Hocs[b][2][3], n_intersections, intersection_tolerance, cached_meshes, max_distance);
+                ranges[b] = meshes[b]->lookup(Hocs[b], lenses[b]);
+            }
+        });
+
+        // Work out where the points of each example start in the outputs
+        tensorflow::Tensor* row_splits = nullptr;
+        OP_REQUIRES_OK(
+          context, context->allocate_output(Outputs::ROW_SPLITS, tensorflow::TensorShape({batch + 1}), &row_splits));
+        auto splits = row_splits->vec<tensorflow::int64>();
+        splits(0)   = 0;
+        for (int64_t b = 0; b < batch; ++b) {
+            int64_t n_points = 0;
+            for (const auto& r : ranges[b]) {
+                n_points += r.second - r.first;
+            }
+            splits(b + 1) = splits(b) + n_points;
+        }
+        const int64_t n_points = splits(batch);
+
+        // Allocate our outputs
+        tensorflow::Tensor* vectors = nullptr;
+        OP_REQUIRES_OK(context,
+                       context->allocate_output(Outputs::VECTORS, tensorflow::TensorShape({n_points, 3}), &vectors));
+        tensorflow::Tensor* neighbours = nullptr;
+        OP_REQUIRES_OK(
+          context,
+          context->allocate_output(
+            Outputs::NEIGHBOURS, tensorflow::TensorShape({n_points, N_NEIGHBOURS + 1}), &neighbours));
+        tensorflow::Tensor* pixels = nullptr;
+        OP_REQUIRES_OK(context,
+                       context->allocate_output(Outputs::PIXELS, tensorflow::TensorShape({n_points, 2}), &pixels));
+        tensorflow::Tensor* colours = nullptr;
+        OP_REQUIRES_OK(
+          context,
+          context->allocate_output(Outputs::COLOURS, tensorflow::TensorShape({n_points, channels}), &colours));
+
+        auto v = vectors->matrix<T>();
+        auto n = neighbours->matrix<tensorflow::int32>();
+        auto c = pixels->matrix<T>();
+        auto x = colours->matrix<T>();
+
+        // Fill in the points of every example in parallel, each writes only to its own rows
+        tensorflow::Shard(workers.num_threads, workers.workers, batch, cost, [&](int64_t start, int64_t end) {
+            for (int64_t b = start; b < end; ++b) {
+                const auto& nodes = meshes[b]->nodes;
+                const auto& lens  = lenses[b];
+                const auto& Hoc   = Hocs[b];
+                const int h       = lens.dimensions[1];
+                const int w       = lens.dimensions[0];
+
+                // Build the lookup for the graph so we can find the new location of points
+                const visualmesh::RangeLookup r_lookup(ranges[b]);
+
+                int64_t idx = splits(b);
+                int local   = 0;
+                for (const auto& r : ranges[b]) {
+                    for (int i = r.first; i < r.second; ++i) {
+
+                        // Copy across the ray
+                        const auto& node = nodes[i];
+                        const auto& ray  = node.ray;
+                        v(idx, 0)        = ray[0];
+                        v(idx, 1)        = ray[1];
+                        v(idx, 2)        = ray[2];
+
+                        // Copy across the graph points in their new position
+                        n(idx, 0) = local;
+                        for (int j = 0; j < N_NEIGHBOURS; ++j) {
+                            const int l = r_lookup(node.neighbours[j]);
+                            n(idx, j + 1) =
+                              l == r_lookup.size() ? std::numeric_limits<tensorflow::int32>::lowest() : l;
+                        }
+
+                        // Rotate the ray into the camera and project it to get the pixel
+                        const visualmesh::vec3<T> cam = {{
+                          Hoc[0][0] * ray[0] + Hoc[1][0] * ray[1] + Hoc[2][0] * ray[2],
+                          Hoc[0][1] * ray[0] + Hoc[1][1] * ray[1] + Hoc[2][1] * ray[2],
+                          Hoc[0][2] * ray[0] + Hoc[1][2] * ray[1] + Hoc[2][2] * ray[2],
+                        }};
+                        const visualmesh::vec2<T> px = visualmesh::project(cam, lens);
+                        c(idx, 0)                    = px[1];
+                        c(idx, 1)                    = px[0];
+
+                        // Bilinearly sample the image, clamping each of the four pixels to the edge of the image
+                        const T y0 = std::floor(px[1]);
+                        const T x0 = std::floor(px[0]);
+                        const T yw = px[1] - y0;
+                        const T xw = px[0] - x0;
+
+                        const std::array<int, 2> ys = {{std::min(std::max(int(y0), 0), h - 1),
+                                                        std::min(std::max(int(y0) + 1, 0), h - 1)}};
+                        const std::array<int, 2> xs = {{std::min(std::max(int(x0), 0), w - 1),
+                                                        std::min(std::max(int(x0) + 1, 0), w - 1)}};
+                        for (int64_t k = 0; k < channels; ++k) {
+                            x(idx, k) = images(b, ys[0], xs[0], k) * (T(1) - yw) * (T(1) - xw)
+                                        + images(b, ys[0], xs[1], k) * (T(1) - yw) * xw
+                                        + images(b, ys[1], xs[0], k) * yw * (T(1) - xw)
+                                        + images(b, ys[1], xs[1], k) * yw * xw;
+                        }
+
+                        // Next value to fill
+                        ++idx;
+                        ++local;
+                    }
+                }
+            }
+        });
+    }
+};
+
+// Register a version for all the combinations of float/double and int32/int64
+// NOLINTNEXTLINE(cert-err58-cpp) this macro makes a static variable
+REGISTER_KERNEL_BUILDER(Name("LookupVisualMeshBatch")
+                          .Device(tensorflow::DEVICE_CPU)
+                          .TypeConstraint<float>("T")
+                          .TypeConstraint<tensorflow::int32>("U"),
+                        LookupVisualMeshBatchOp<float, tensorflow::int32>)
+// NOLINTNEXTLINE(cert-err58-cpp) this macro makes a static variable
+REGISTER_KERNEL_BUILDER(Name("LookupVisualMeshBatch")
+                          .Device(tensorflow::DEVICE_CPU)
+                          .TypeConstraint<float>("T")
+                          .TypeConstraint<tensorflow::int64>("U"),
+                        LookupVisualMeshBatchOp<float, tensorflow::int64>)
+// NOLINTNEXTLINE(cert-err58-cpp) this macro makes a static variable
+REGISTER_KERNEL_BUILDER(Name("LookupVisualMeshBatch")
+                          .Device(tensorflow::DEVICE_CPU)
+                          .TypeConstraint<double>("T")
+                          .TypeConstraint<tensorflow::int32>("U"),
+                        LookupVisualMeshBatchOp<double, tensorflow::int32>)
+// NOLINTNEXTLINE(cert-err58-cpp) this macro makes a static variable
+REGISTER_KERNEL_BUILDER(Name("LookupVisualMeshBatch")
+                          .Device(tensorflow::DEVICE_CPU)
+                          .TypeConstraint<double>("T")
+                          .TypeConstraint<tensorflow::int64>("U"),
+                        LookupVisualMeshBatchOp<double, tensorflow::int64>)
@@ -18,8 +18,10 @@
 #include <tensorflow/core/framework/op.h>
 #include <tensorflow/core/framework/op_kernel.h>
 #include <tensorflow/core/framework/shape_inference.h>
+#include <tensorflow/core/util/work_sharder.h>
 
 #include <cmath>
+#include <cstdint>
 #include <functional>
 
 #include "model_op_base.hpp"
@@ -90,15 +92,18 @@ public:
         vectors_shape.AddDim(3);
         OP_REQUIRES_OK(context, context->allocate_output(Outputs::VECTORS, vectors_shape, &vectors));
 
-        // Perform the map operation for this shape
-        auto vs = vectors->matrix<T>();
-        for (int i = 0; i < n_elems; ++i) {
-            visualmesh::vec3<T> v = visualmesh::normalise(
-              Model<T>::map(shape, height, visualmesh::vec2<T>({coordinates(i, 0), coordinates(i, 1)})));
-            vs(i, 0) = v[0];
-            vs(i, 1) = v[1];
-            vs(i, 2) = v[2];
-        }
+        // Perform the map operation for this shape, split over the worker threads as the grid models map iteratively
+        auto vs             = vectors->matrix<T>();
+        const auto& workers = *context->device()->tensorflow_cpu_worker_threads();
+        tensorflow::Shard(workers.num_threads, workers.workers, n_elems, 5000, [&](int64_t start, int64_t end) {
+            for (int64_t i = start; i < end; ++i) {
+                visualmesh::vec3<T> v = visualmesh::normalise(
+                  Model<T>::map(shape, height, visualmesh::vec2<T>({coordinates(i, 0), coordinates(i, 1)})));
+                vs(i, 0) = v[0];
+                vs(i, 1) = v[1];
+                vs(i, 2) = v[2];
+            }
+        });
     }
 };
 
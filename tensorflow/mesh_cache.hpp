@@ -18,11 +18,35 @@
 #ifndef VISUALMESH_TENSORFLOW_MESH_CACHE_HPP
 #define VISUALMESH_TENSORFLOW_MESH_CACHE_HPP
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <limits>
+#include <map>
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
 #include <vector>
 
 #include "visualmesh/mesh.hpp"
+#include "visualmesh/utility/atomic_file.hpp"
+#include "visualmesh/utility/serialisation.hpp"
+
+#ifdef VISUALMESH_HAVE_MMAP
+#include <dirent.h>
+#endif
 
 /**
  * @brief Given a shape, two heights and a k value, calculate the absolute number of intersections difference given
@@ -43,65 +67,255 @@ Scalar mesh_k_error(const Shape<Scalar>& shape, const Scalar& h_0, const Scalar&
     return std::abs(k - k * shape.k(h_0, h_1));
 }
 
+/**
+ * @brief The cached meshes that were generated for one combination of shape, k and maximum distance
+ *
+ * @details
+ *  The meshes are indexed by their height. Since the error in k grows the further the height of a mesh is from the
+ *  requested height, the best mesh is always one of the two meshes either side of the requested height so a lookup only
+ *  needs to check those two. Lookups only take a shared lock so they can run concurrently. Each mesh records when it
+ *  was last used with an atomic so that this can be updated under the shared lock, and when the cache is full the mesh
+ *  that was used longest ago is removed.
+ *
+ * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+ * @tparam Model  the model used to generate the meshes
+ */
+template <typename Scalar, template <typename> class Model>
+struct MeshCachePartition {
+    struct Entry {
+        Entry(std::shared_ptr<visualmesh::Mesh<Scalar, Model>> mesh, const uint64_t& last_used)
+          : mesh(std::move(mesh)), last_used(last_used) {}
+
+        /// The cached mesh
+        std::shared_ptr<visualmesh::Mesh<Scalar, Model>> mesh;
+        /// The value of the clock when this mesh was last returned
+        std::atomic<uint64_t> last_used;
+    };
+
+    /// The meshes in this partition indexed by the height they were generated for
+    std::map<Scalar, Entry> meshes;
+    /// Incremented on every use to order the entries by when they were last used
+    std::atomic<uint64_t> clock{0};
+    /// Shared for lookups and exclusive for adding or removing meshes
+    std::shared_timed_mutex mutex;
+};
+
 /**
  * @brief Lookup an appropriate Visual Mesh to use for this lens and height given the provided tolerances
  *
+ * @details
+ *  The caller must hold at least a shared lock on the partition.
+ *
  * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
  * @tparam Shape  the type of shape to use when calculating the error
  *
- * @param meshes  the list of meshes that we will be looking for the target in
- * @param shape   the shape that we will be using for the lookup
- * @param h       the current height of the camera above the ground
- * @param k       the number of cross sectional intersections that we want with the object
- * @param t       the tolerance for the number of cross sectional intersections before we need a new mesh
- * @param d       the maximum distance that the mesh should be generated for
+ * @param partition the partition of meshes generated for this shape, k and maximum distance
+ * @param shape     the shape that we will be using for the lookup
+ * @param h         the current height of the camera above the ground
+ * @param k         the number of cross sectional intersections that we want with the object
+ * @param t         the tolerance for the number of cross sectional intersections before we need a new mesh
  *
  * @return either returns a shared_ptr to the mesh that would best fit within our tolerance, or if none could be found a
  *         nullptr
  */
 template <typename Scalar, template <typename> class Model, template <typename> class Shape>
-std::shared_ptr<visualmesh::Mesh<Scalar, Model>> find_mesh(
-  std::vector<std::shared_ptr<visualmesh::Mesh<Scalar, Model>>>& meshes,
-  const Shape<Scalar>& shape,
-  const Scalar& h,
-  const Scalar& k,
-  const Scalar& t,
-  const Scalar& d) {
+std::shared_ptr<visualmesh::Mesh<Scalar, Model>> find_mesh(MeshCachePartition<Scalar, Model>& partition,
+                                                           const Shape<Scalar>& shape,
+                                                           const Scalar& h,
+                                                           const Scalar& k,
+                                                           const Scalar& t) {
 
     // Nothing in the map!
-    if (meshes.empty()) { return nullptr; }
+    if (partition.meshes.empty()) { return nullptr; }
+
+    // The best mesh is either the first one at or above this height or the one below it
+    auto above = partition.meshes.lower_bound(h);
+    auto best  = partition.meshes.end();
 
-    // Find the best mesh we have available
-    auto best_it      = meshes.begin();
     Scalar best_error = std::numeric_limits<Scalar>::max();
-    for (auto it = meshes.begin(); it != meshes.end(); ++it) {
-        auto error = mesh_k_error(shape, (*it)->h, h, k);
-        if (d == (*it)->max_distance && error < best_error) {
-            best_error = error;
-            best_it    = it;
+    if (above != partition.meshes.end()) {
+        best_error = mesh_k_error(shape, above->first, h, k);
+        best       = above;
+    }
+    if (above != partition.meshes.begin()) {
+        auto below         = std::prev(above);
+        Scalar below_error = mesh_k_error(shape, below->first, h, k);
+        if (below_error < best_error) {
+            best_error = below_error;
+            best       = below;
         }
     }
 
     // If it was good enough return it, otherwise return null
     if (best_error <= t) {
-        // Swap it to the top of the list so we can keep somewhat of which items are most used
-        std::iter_swap(meshes.begin(), best_it);
-        // iter_swap moves the lowest error mesh into the first position of meshes
-        return *meshes.begin();
+        best->second.last_used.store(++partition.clock, std::memory_order_relaxed);
+        return best->second.mesh;
     }
 
     return nullptr;
 }
 
+/**
+ * @brief Find the directory that generated meshes are shared between processes in
+ *
+ * @details
+ *  This is `$VISUALMESH_MESH_CACHE` if it is set, otherwise `$XDG_CACHE_HOME/visualmesh` or `$HOME/.cache/visualmesh`.
+ *  Setting `VISUALMESH_MESH_CACHE` to an empty string disables the disk cache.
+ *
+ * @return the cache directory, or an empty string if meshes should not be cached on disk
+ */
+inline std::string mesh_cache_directory() {
+#ifdef VISUALMESH_HAVE_MMAP
+    if (const char* dir = std::getenv("VISUALMESH_MESH_CACHE")) { return dir; }
+    if (const char* dir = std::getenv("XDG_CACHE_HOME")) { return *dir ? std::string(dir) + "/visualmesh" : ""; }
+    if (const char* dir = std::getenv("HOME")) { return *dir ? std::string(dir) + "/.cache/visualmesh" : ""; }
+#endif
+    return "";
+}
+
+/**
+ * @brief Work out the directory that the meshes for one cache partition are stored in on disk
+ *
+ * @details
+ *  The name is a 64 bit FNV-1a hash of everything other than the height that affects the generated mesh: the model, the
+ *  scalar type, the shape, the number of intersections and the maximum distance. A version is included so that files
+ *  written in an older format are never read.
+ *
+ * @param cache_directory the root directory of the disk cache
+ * @param model           a name that uniquely identifies the model
+ * @param key             the bytes of the shape, number of intersections and maximum distance
+ *
+ * @return the path of the directory for this partition
+ */
+inline std::string mesh_partition_path(const std::string& cache_directory,
+                                       const std::string& model,
+                                       const std::string& key) {
+    uint64_t hash = 0xcbf29ce484222325;
+    auto add      = [&hash](const std::string& s) {
+        // Include the terminator so the boundaries between the strings are part of the hash
+        for (const auto& c : s + '\0') {
+            hash ^= static_cast<unsigned char>(c);
+            hash *= 0x100000001b3;
+        }
+    };
+    add("mesh-v1");
+    add(model);
+    add(key);
+
+    std::stringstream path;
+    path << cache_directory << "/" << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return path.str();
+}
+
+/**
+ * @brief Load the mesh stored on disk that best fits a height, if one is within tolerance
+ *
+ * @details
+ *  Each file in the partition directory is named by the height its mesh was generated for, so the best mesh can be
+ *  chosen without opening any of them. The chosen file is memory mapped so processes on the same node share the pages
+ *  of the file while decoding it. Files that can't be read, such as ones from a different build, are ignored.
+ *
+ * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+ * @tparam Model  the model used to generate the meshes
+ * @tparam Shape  the type of shape to use when calculating the error
+ *
+ * @param directory the directory of the partition on disk
+ * @param shape     the shape that we will be using for the lookup
+ * @param h         the current height of the camera above the ground
+ * @param k         the number of cross sectional intersections that we want with the object
+ * @param t         the tolerance for the number of cross sectional intersections before we need a new mesh
+ *
+ * @return the height and mesh that was loaded, or a nullptr mesh if none was suitable
+ */
+template <typename Scalar, template <typename> class Model, template <typename> class Shape>
+std::pair<Scalar, std::shared_ptr<visualmesh::Mesh<Scalar, Model>>> load_mesh(const std::string& directory,
+                                                                               const Shape<Scalar>& shape,
+                                                                               const Scalar& h,
+                                                                               const Scalar& k,
+                                                                               const Scalar& t) {
+    std::pair<Scalar, std::shared_ptr<visualmesh::Mesh<Scalar, Model>>> result(h, nullptr);
+#ifdef VISUALMESH_HAVE_MMAP
+    std::unique_ptr<DIR, int (*)(DIR*)> dir(::opendir(directory.c_str()), ::closedir);
+    if (dir == nullptr) { return result; }
+
+    // Find the height with the least error from the file names
+    std::string best;
+    Scalar best_error = std::numeric_limits<Scalar>::max();
+    for (dirent* entry = ::readdir(dir.get()); entry != nullptr; entry = ::readdir(dir.get())) {
+        const std::string name(entry->d_name);
+        if (name.size() <= 5 || name.compare(name.size() - 5, 5, ".mesh") != 0) { continue; }
+        char* end           = nullptr;
+        const Scalar height = static_cast<Scalar>(std::strtod(name.c_str(), &end));
+        const Scalar error  = mesh_k_error(shape, height, h, k);
+        if (end == name.c_str() + name.size() - 5 && error < best_error) {
+            best_error   = error;
+            best         = name;
+            result.first = height;
+        }
+    }
+
+    if (best.empty() || best_error > t) { return result; }
+    try {
+        visualmesh::MappedFile file(directory + "/" + best);
+        visualmesh::BinaryReader reader = file.reader();
+        result.second = std::make_shared<visualmesh::Mesh<Scalar, Model>>(reader);
+    }
+    catch (const std::exception&) {
+        result.second = nullptr;
+    }
+#else
+    (void) directory;
+    (void) shape;
+    (void) k;
+    (void) t;
+#endif
+    return result;
+}
+
+/**
+ * @brief Store a generated mesh on disk so other processes and later runs can load it instead of generating it
+ *
+ * @details
+ *  The mesh is written to a temporary file that is then renamed into place, so a process that is reading the cache
+ *  never sees a partially written file even when several processes generate the same mesh at once. Failing to write the
+ *  cache is not an error.
+ *
+ * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+ * @tparam Model  the model used to generate the meshes
+ *
+ * @param directory the directory of the partition on disk
+ * @param height    the height the mesh was generated for
+ * @param mesh      the mesh to store
+ */
+template <typename Scalar, template <typename> class Model>
+void store_mesh(const std::string& directory, const Scalar& height, const visualmesh::Mesh<Scalar, Model>& mesh) {
+    if (!visualmesh::make_directories(directory)) { return; }
+
+    // Name the file by its height in hexadecimal floating point so it can be parsed back exactly
+    std::stringstream name;
+    name << directory << "/" << std::hexfloat << static_cast<double>(height) << ".mesh";
+    const std::string path = name.str();
+
+    std::stringstream file;
+    visualmesh::BinaryWriter writer(file);
+    mesh.save(writer);
+    visualmesh::write_atomically(path, file.str());
+}
+
 /**
  * @brief Lookup or create an appropriate Visual Mesh to use for this lens and height given the provided tolerances
  *
  * @details
  *  This function gets the best fitting mesh that it can find that is within the number of intersections tolerance. If
- *  it cannot find a mesh that matches the tolerance it will create a new one for the provided details. The mesh will
- *  not match if the maximum distance has changed, only if the k difference is small enough. Additionally it will only
- *  cache `cached_meshes` number of meshes. Each time a mesh is used again it will move it to the top of the list, and
- *  if a new mesh must be added and this would exceed this limit the least recently used mesh will be dropped.
+ *  it cannot find a mesh that matches the tolerance it will create a new one for the provided details. Meshes are kept
+ *  in a separate partition for each shape, number of intersections and maximum distance, and each partition will only
+ *  cache `cached_meshes` number of meshes. If a new mesh must be added and this would exceed this limit the least
+ *  recently used mesh in that partition will be dropped. Finding a mesh only takes shared locks so many threads can
+ *  look up meshes at once.
+ *
+ *  Before generating a new mesh the disk cache from `mesh_cache_directory` is checked for one that fits, and newly
+ *  generated meshes are stored there. This lets every worker process on a node, and every later run, reuse a mesh that
+ *  was generated once rather than each generating it again in double precision.
  *
  * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
  * @tparam Shape  the type of shape to use when calculating the error
@@ -122,39 +336,85 @@ std::shared_ptr<visualmesh::Mesh<Scalar, Model>> get_mesh(const Shape<Scalar>& s
                                                           const Scalar& intersection_tolerance,
                                                           const int32_t& cached_meshes,
                                                           const Scalar& max_distance) {
+    static_assert(std::is_trivially_copyable<Shape<Scalar>>::value,
+                  "The shape is used as part of the cache key so it must be trivially copyable");
 
-    // Static map of heights to meshes
-    static std::vector<std::shared_ptr<visualmesh::Mesh<Scalar, Model>>> meshes;
-    static std::mutex mesh_mutex;
+    // Static map of partitions, the partitions are never removed so a pointer to one stays valid
+    static std::map<std::string, std::unique_ptr<MeshCachePartition<Scalar, Model>>> partitions;
+    static std::shared_timed_mutex partitions_mutex;
+
+    // Meshes can only be shared if they were made for the same shape, number of intersections and distance
+    std::string key(sizeof(shape) + 2 * sizeof(Scalar), '\0');
+    std::memcpy(&key[0], &shape, sizeof(shape));
+    std::memcpy(&key[sizeof(shape)], &n_intersections, sizeof(Scalar));
+    std::memcpy(&key[sizeof(shape) + sizeof(Scalar)], &max_distance, sizeof(Scalar));
+
+    MeshCachePartition<Scalar, Model>* partition = nullptr;
+    /* mutex scope */ {
+        std::shared_lock<std::shared_timed_mutex> lock(partitions_mutex);
+        auto it = partitions.find(key);
+        if (it != partitions.end()) { partition = it->second.get(); }
+    }
+    if (partition == nullptr) {
+        std::lock_guard<std::shared_timed_mutex> lock(partitions_mutex);
+        auto& slot = partitions[key];
+        if (slot == nullptr) { slot = std::make_unique<MeshCachePartition<Scalar, Model>>(); }
+        partition = slot.get();
+    }
 
     // Find and return an element if one is appropriate
     /* mutex scope */ {
-        std::lock_guard<std::mutex> lock(mesh_mutex);
+        std::shared_lock<std::shared_timed_mutex> lock(partition->mutex);
 
         // If we found an acceptable mesh return it
-        auto mesh = find_mesh(meshes, shape, height, n_intersections, intersection_tolerance, max_distance);
+        auto mesh = find_mesh(*partition, shape, height, n_intersections, intersection_tolerance);
         if (mesh != nullptr) { return mesh; }
     }
 
-    // We can't find an appropriate mesh, make a new one but don't hold the mutex while we do so others can still query
-    // Generate the mesh using double precision and then cast it over to whatever we need
-    auto generated_mesh = visualmesh::Mesh<double, Model>(shape, height, n_intersections, max_distance);
+    // We can't find an appropriate mesh in memory, so try the disk cache and otherwise make a new one. Don't hold the
+    // mutex while we do so others can still query
+    static const std::string cache_directory = mesh_cache_directory();
+    const std::string directory =
+      cache_directory.empty()
+        ? std::string()
+        : mesh_partition_path(cache_directory, typeid(Model<Scalar>).name() + std::to_string(sizeof(Scalar)), key);
+
+    Scalar generated_height = height;
+    std::shared_ptr<visualmesh::Mesh<Scalar, Model>> generated_mesh;
+    if (!directory.empty()) {
+        std::tie(generated_height, generated_mesh) =
+          load_mesh<Scalar, Model>(directory, shape, height, n_intersections, intersection_tolerance);
+    }
+    if (generated_mesh == nullptr) {
+        // Generate the mesh using double precision and store it as whatever we need
+        generated_height = height;
+        generated_mesh   = std::make_shared<visualmesh::Mesh<Scalar, Model>>(
+          visualmesh::Mesh<Scalar, Model>::template generated_in<double>(shape, height, n_intersections, max_distance));
+        if (!directory.empty()) { store_mesh(directory, height, *generated_mesh); }
+    }
 
     /* mutex scope */ {
-        std::lock_guard<std::mutex> lock(mesh_mutex);
+        std::lock_guard<std::shared_timed_mutex> lock(partition->mutex);
 
         // Check again for an acceptable mesh in case someone else made one too
-        auto mesh = find_mesh(meshes, shape, height, n_intersections, intersection_tolerance, max_distance);
+        auto mesh = find_mesh(*partition, shape, height, n_intersections, intersection_tolerance);
         if (mesh != nullptr) { return mesh; }
 
-        // Only cache a fixed number of meshes so remove the old ones
-        while (static_cast<int32_t>(meshes.size()) > cached_meshes) {
-            meshes.pop_back();
+        // Only cache a fixed number of meshes so remove the least recently used ones
+        auto& meshes = partition->meshes;
+        while (!meshes.empty() && static_cast<int32_t>(meshes.size()) >= std::max(cached_meshes, 1)) {
+            auto oldest = std::min_element(meshes.begin(), meshes.end(), [](const auto& a, const auto& b) {
+                return a.second.last_used.load(std::memory_order_relaxed)
+                       < b.second.last_used.load(std::memory_order_relaxed);
+            });
+            meshes.erase(oldest);
         }
 
         // Add our new mesh to the cache and return
-        meshes.push_back(std::make_shared<visualmesh::Mesh<Scalar, Model>>(generated_mesh));
-        return meshes.back();
+        meshes.emplace(std::piecewise_construct,
+                       std::forward_as_tuple(generated_height),
+                       std::forward_as_tuple(generated_mesh, ++partition->clock));
+        return generated_mesh;
     }
 }
 
@@ -18,8 +18,10 @@
 #include <tensorflow/core/framework/op.h>
 #include <tensorflow/core/framework/op_kernel.h>
 #include <tensorflow/core/framework/shape_inference.h>
+#include <tensorflow/core/util/work_sharder.h>
 
 #include <cmath>
+#include <cstdint>
 #include <functional>
 
 #include "model_op_base.hpp"
@@ -90,14 +92,17 @@ public:
         coordinates_shape.AddDim(2);
         OP_REQUIRES_OK(context, context->allocate_output(Outputs::COORDINATES, coordinates_shape, &coordinates));
 
-        // Perform the map operation for this shape
-        auto cs = coordinates->matrix<T>();
-        for (int i = 0; i < n_elems; ++i) {
-            visualmesh::vec2<T> c =
-              Model<T>::unmap(shape, height, visualmesh::vec3<T>({vectors(i, 0), vectors(i, 1), vectors(i, 2)}));
-            cs(i, 0) = c[0];
-            cs(i, 1) = c[1];
-        }
+        // Perform the unmap operation for this shape, split over the worker threads
+        auto cs             = coordinates->matrix<T>();
+        const auto& workers = *context->device()->tensorflow_cpu_worker_threads();
+        tensorflow::Shard(workers.num_threads, workers.workers, n_elems, 1000, [&](int64_t start, int64_t end) {
+            for (int64_t i = start; i < end; ++i) {
+                visualmesh::vec2<T> c =
+                  Model<T>::unmap(shape, height, visualmesh::vec3<T>({vectors(i, 0), vectors(i, 1), vectors(i, 2)}));
+                cs(i, 0) = c[0];
+                cs(i, 1) = c[1];
+            }
+        });
     }
 };
 
@@ -14,6 +14,7 @@
 # OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 import os
+import struct
 
 import numpy as np
 import yaml
@@ -25,6 +26,68 @@ from .flavour import Dataset
 from .layer.graph_convolution import GraphConvolution
 from .model import VisualMeshModel
 
+# The order of visualmesh::ActivationFunction in the c++ code
+_activations = ["selu", "relu", "softmax", "tanh"]
+
+
+def write_network(stages, path):
+    """Write the network stages in the binary network format that visualmesh::NetworkFile loads"""
+    with open(path, "wb") as out:
+        # Magic number and version, then the compiled network with a block size of 1 and 32 bit floats
+        out.write(b"VMNN")
+        out.write(struct.pack("<III", 1, 1, 4))
+
+        # The number of layers in each convolution and the shape of every layer
+        out.write(struct.pack("<Q", len(stages)))
+        for conv in stages:
+            out.write(struct.pack("<Q", len(conv)))
+            for layer in conv:
+                w = np.asarray(layer["weights"])
+                out.write(struct.pack("<III", w.shape[0], w.shape[1], _activations.index(layer["activation"])))
+
+        # With a block size of 1 the weights are stored output major, followed by the biases
+        for conv in stages:
+            for layer in conv:
+                out.write(np.asarray(layer["weights"], dtype="<f4").T.tobytes())
+                out.write(np.asarray(layer["biases"], dtype="<f4").tobytes())
+
+        # There is no quantised network
+        out.write(struct.pack("<I", 0))
+
+
+def export_cascade(model, threshold):
+    """Export the early exit head of a model as the cascade section that visualmesh::Cascade is loaded from"""
+
+    # The head is a list of dense layers run on the output of one of the groups
+    head = []
+    for s in model.head_stages:
+        op = model.ops[s]
+        if type(op[0]) is not tf.keras.layers.Dense or len(op[1]) != 1:
+            print("Error: the cascade head can only be made of Dense layers")
+            exit(1)
+        op = op[0]
+        head.append(
+            {
+                "weights": op.weights[0].numpy().tolist(),
+                "biases": op.weights[1].numpy().tolist(),
+                "activation": op.activation.__name__,
+            }
+        )
+
+    # The engines run the head between two groups, so it has to start from the last layer of a group
+    source = model.ops[model.head_stages[0]][1][0]
+    position = model.stages.index(source) if source in model.stages else -1
+    following = model.stages[position + 1] if 0 <= position < len(model.stages) - 1 else None
+    if following is None or type(model.ops[following][0]) is not GraphConvolution:
+        print("Error: the cascade head must follow the last layer of a group that is not the last group")
+        exit(1)
+
+    return {
+        "groups": sum(type(model.ops[s][0]) is GraphConvolution for s in model.stages[: position + 1]),
+        "threshold": float(threshold),
+        "head": head,
+    }
+
 
 def export(config, output_path):
 
@@ -37,7 +100,9 @@ def export(config, output_path):
     output_dims = training_dataset.element_spec[1].shape[-1]
 
     # Define the model
-    model = VisualMeshModel(structure=config["network"]["structure"], output_dims=output_dims)
+    model = VisualMeshModel(
+        structure=config["network"]["structure"], output_dims=output_dims, cascade=config["network"].get("cascade")
+    )
 
     # Find the latest checkpoint file and load it
     checkpoint_file = tf.train.latest_checkpoint(output_path)
@@ -98,9 +163,16 @@ def export(config, output_path):
         "network": stages,
     }
 
+    # Add the early exit head if the network was trained with one
+    if model.head_stages:
+        network["cascade"] = export_cascade(model, config["network"]["cascade"]["threshold"])
+
     # Add classification meta data
     if config["label"]["type"] == "Classification":
         network["class_map"] = {c["name"]: i for i, c in enumerate(config["label"]["config"]["classes"])}
 
     with open(os.path.join(output_path, "model.yaml"), "w") as out:
         yaml.dump(network, out, default_flow_style=None, width=float("inf"))
+
+    # The binary version of the network loads directly into the engines without parsing any text
+    write_network(stages, os.path.join(output_path, "model.vmnn"))
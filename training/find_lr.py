@@ -92,7 +92,9 @@ def find_lr(config, output_path, min_lr, max_lr, n_steps, window_size):
     output_dims = training_dataset.element_spec[1].shape[-1]
 
     # Define the model
-    model = VisualMeshModel(structure=config["network"]["structure"], output_dims=output_dims)
+    model = VisualMeshModel(
+        structure=config["network"]["structure"], output_dims=output_dims, cascade=config["network"].get("cascade")
+    )
 
     def lr_schedule(epoch, lr):
         return min_lr * (max_lr / min_lr) ** (epoch / n_steps)
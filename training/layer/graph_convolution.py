@@ -14,6 +14,7 @@
 # OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 import tensorflow as tf
+from training.op import graph_convolution_visual_mesh
 
 
 class GraphConvolution(tf.keras.layers.Layer):
@@ -22,5 +23,12 @@ class GraphConvolution(tf.keras.layers.Layer):
         self.dense = tf.keras.layers.Dense(**kwargs)
 
     def call(self, X, G):
-        # Call the dense layer with the gathered data
-        return self.dense(tf.reshape(tf.gather(X, G, name="NetworkGather"), shape=[-1, X.shape[-1] * G.shape[-1]]))
+        # The dense layer holds the weights so they are created, regularised and exported as they always have been
+        if not self.dense.built:
+            self.dense.build(tf.TensorShape([None, X.shape[-1] * G.shape[-1]]))
+
+        # Gather and multiply in one op so the gathered neighbourhoods are never held in memory
+        Y = graph_convolution_visual_mesh(features=X, graph=G, weights=self.dense.kernel)
+        if self.dense.use_bias:
+            Y = tf.nn.bias_add(Y, self.dense.bias)
+        return self.dense.activation(Y) if self.dense.activation is not None else Y
@@ -61,35 +61,65 @@ class VisualMeshModel(tf.keras.Model):
 
         return stack
 
-    def __init__(self, structure, output_dims):
+    def __init__(self, structure, output_dims, cascade=None):
         super(VisualMeshModel, self).__init__()
 
         # Build up the graph of operations
         self.output_dims = output_dims
         self.ops = {k: (self._make_op(v["op"], v.get("options")), v["inputs"]) for k, v in structure.items()}
+        graph = {**{k: v["inputs"] for k, v in structure.items()}, "X": [], "G": []}
 
         # Perform a topological sort to ensure that the results are done in order
-        self.stages = self._topological_sort(
-            ("output", structure["output"]["inputs"]),
-            {**{k: v["inputs"] for k, v in structure.items()}, "X": [], "G": []},
-        )
+        self.stages = self._topological_sort(("output", structure["output"]["inputs"]), graph)
 
-    def call(self, X, training=False):
+        # An early exit head is a branch off the network that the output doesn't need, so its ops are sorted separately
+        self.cascade = cascade
+        self.head_stages = []
+        if cascade is not None:
+            head = cascade["head"]
+            self.head_stages = [s for s in self._topological_sort((head, graph[head]), graph) if s not in self.stages]
+
+    def _forward(self, X):
 
         # Split out the graph and logits
         logits, G = X
 
         # Run through each of the layers which are sorted in topological order
+        # The head is always run as well so its weights are made whenever the network is built
         results = {"X": logits, "G": G}
-        for s in self.stages:
+        for s in self.stages + self.head_stages:
             # Get the operation and inputs from the list of ops
             op, inputs = self.ops[s]
 
             # Run the op with the inputs
             results[s] = op(*[results[i] for i in inputs])
 
+        return results
+
+    def call(self, X, training=False):
+
         # Our output is stored in the "output" member
-        logits = results["output"]
+        logits = self._forward(X)["output"]
 
         # At the very end of the network, we remove the offscreen point (last point)
         return logits[:-1]
+
+    def train_step(self, data):
+
+        # Without an early exit head this is the normal training step
+        if not self.head_stages:
+            return super(VisualMeshModel, self).train_step(data)
+
+        # The head learns the same labels as the output, its loss is weighted and added to the loss of the network
+        X, Y = data
+        with tf.GradientTape() as tape:
+            results = self._forward(X)
+            logits = results["output"][:-1]
+            head = results[self.cascade["head"]][:-1]
+            loss = self.compiled_loss(Y, logits, regularization_losses=self.losses)
+            head_loss = tf.reduce_mean(self.loss(Y, head))
+            total = loss + float(self.cascade.get("weight", 1.0)) * head_loss
+
+        self.optimizer.minimize(total, self.trainable_variables, tape=tape)
+        self.compiled_metrics.update_state(Y, logits)
+        return {**{m.name: m.result() for m in self.metrics}, "cascade_loss": head_loss}
@@ -16,6 +16,17 @@ else:
     raise Exception("Please build the tensorflow visual mesh op before running")
 
 lookup_visual_mesh = _library.lookup_visual_mesh
+lookup_visual_mesh_batch = _library.lookup_visual_mesh_batch
 map_visual_mesh = _library.map_visual_mesh
 unmap_visual_mesh = _library.unmap_visual_mesh
 difference_visual_mesh = _library.difference_visual_mesh
+graph_convolution_visual_mesh = _library.graph_convolution_visual_mesh
+
+
+@tf.RegisterGradient("GraphConvolutionVisualMesh")
+def _graph_convolution_visual_mesh_grad(op, grad):
+    features_grad, weights_grad = _library.graph_convolution_visual_mesh_grad(
+        features=op.inputs[0], graph=op.inputs[1], weights=op.inputs[2], grad=grad
+    )
+    # The graph is made of indices so it has no gradient
+    return [features_grad, None, weights_grad]
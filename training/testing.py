@@ -35,7 +35,9 @@ def test(config, output_path):
     output_dims = testing_dataset.element_spec[1].shape[-1]
 
     # Define the model
-    model = VisualMeshModel(structure=config["network"]["structure"], output_dims=output_dims)
+    model = VisualMeshModel(
+        structure=config["network"]["structure"], output_dims=output_dims, cascade=config["network"].get("cascade")
+    )
 
     # Find the latest checkpoint file and load it
     checkpoint_file = tf.train.latest_checkpoint(output_path)
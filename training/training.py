@@ -41,7 +41,9 @@ def train(config, output_path):
     output_dims = training_dataset.element_spec[1].shape[-1]
 
     # Define the model
-    model = VisualMeshModel(structure=config["network"]["structure"], output_dims=output_dims)
+    model = VisualMeshModel(
+        structure=config["network"]["structure"], output_dims=output_dims, cascade=config["network"].get("cascade")
+    )
 
     # Determine the learning rate policy to use
     if config["training"]["learning_rate"]["type"] == "static":